@@ -0,0 +1,1435 @@
+// Benchmarks for the code that large captures go through: decoding, copying, hashing, indexing, and the parts of
+// painting that do not call into GDI. The payloads come from PayloadGenerator.h, so every run measures the same bytes.
+// Builds on any platform that Portable.h supports (see the README for the command line).
+//
+// Every result is written to stdout as one line of JSON (NDJSON), e.g.
+//   {"name":"decode/dib/32bpp","bytes":8294454,"batch":1,"samples":42,"best_us":2210.000,"median_us":2302.000,"mb_per_s":3753.148}
+// Times are per run. "bytes" is what one run reads, and "mb_per_s" follows from it and the best time; both are left
+// out where there is no meaningful size. Compare runs by name, preferably by "best_us", which is the least noisy.
+// The coalesce/*/latency lines report simulated time instead: captures per trace of notifications, and their latency.
+// The index/trigrams/*size lines report the size of the trigram index of a corpus, and how long one build took.
+//
+// Options:
+//   /filter:<text>   Only runs the benchmarks whose name contains text.
+//   /quick           Measures briefly, e.g. to check that everything still runs.
+//   /list            Lists the names without running anything.
+//   /large           Also runs the benchmarks on 1 GB inputs, which take minutes and several GB of memory.
+
+#include "Portable.h"
+#include "PayloadGenerator.h"
+#include "PackedDIB.h"
+#include "PngDecoder.h"
+#include "Inflate.h"
+#include "PixelBuffer.h"
+#include "PixelAlpha.h"
+#include "MipPyramid.h"
+#include "TileCache.h"
+#include "ImageCodec.h"
+#include "PerceptualHash.h"
+#include "ContentHash.h"
+#include "ClipboardHistory.h"
+#include "HistoryStore.h"
+#include "Coalescer.h"
+#include "TextCodec.h"
+#include "TextLayout.h"
+#include "TrigramIndex.h"
+#include "HexDump.h"
+#include "ClipboardHtml.h"
+#include "RtfTokenizer.h"
+#include "ClipboardBackend.h"
+#include "FakeClipboardBackend.h"
+#include "CaptureWorker.h"
+#include "ClipboardSnapshot.h"
+#include "Tracer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#define SCREEN_WIDTH 1920
+#define SCREEN_HEIGHT 1080
+#define TEXT_LENGTH (4 * 1024 * 1024)
+// 100 MB of UTF-16, for what has to stay fast however long the text is.
+#define LARGE_TEXT_LENGTH (50 * 1024 * 1024)
+#define TEXT_TAB_WIDTH 8
+// The search worker stops checking candidates once it has this many results (SEARCH_MAX_RESULTS).
+#define TRIGRAM_MAX_RESULTS 200
+// The history that the monitor keeps, and how many texts are appended to it in one run.
+#define HISTORY_MAX_ENTRIES 100
+#define HISTORY_ARENA_SIZE (64 * 1024 * 1024)
+#define HISTORY_BYTE_BUDGET (512 * 1024 * 1024)
+#define HISTORY_APPEND_COUNT (1000 * 1000)
+// The history store, in directories below the current one. store/open-100k opens a store of that many short texts,
+// store/append appends texts to a new one.
+#define STORE_DIRECTORY PATH_TEXT("clipboard-benchmark.store")
+#define STORE_APPEND_DIRECTORY PATH_TEXT("clipboard-benchmark.append")
+#define STORE_SEGMENT_SIZE (64 * 1024 * 1024)
+#define STORE_OPEN_ENTRIES 100000
+#define STORE_APPEND_COUNT 1000
+// Texts of the lengths that are copied, compressed one by one by */text-codec/clips, without and with a dictionary that
+// is trained from the first HISTORY_MAX_ENTRIES of them, like the monitor does.
+#define TEXT_CLIP_COUNT 2000
+// The same as the monitor's.
+#define COALESCE_QUIET_US (30 * 1000)
+#define COALESCE_MAX_LATENCY_US (250 * 1000)
+#define COALESCE_TRACE_EVENTS 100000
+
+// The window that the paint benchmarks draw into, and how far they scroll between two paints.
+#define VIEW_WIDTH 1280
+#define VIEW_HEIGHT 720
+#define VIEW_LINE_HEIGHT 16
+#define VIEW_CHAR_WIDTH 8
+#define VIEW_POSITIONS 100
+
+#define MIN_SAMPLE_US 2000
+#define MIN_SAMPLES 5
+#define MAX_SAMPLES 1000
+#define MAX_MALFORMED_PAYLOADS 80
+// Malformed DIBs that claim more pixels than this are only parsed, not decoded.
+#define MAX_MALFORMED_PIXELS (4 * 1024 * 1024)
+
+static ULONGLONG MinTimeUs = 500 * 1000;
+static const char *Filter;
+static BOOL ListOnly;
+static BOOL LargeInputs;
+// Results go here, so that the compiler cannot drop the work.
+static volatile ULONGLONG Sink;
+
+
+static BOOL IsSelected(const char *Name)
+{
+	return Filter == nullptr || strstr(Name, Filter) != nullptr;
+}
+
+
+// Runs Run in batches that take at least MIN_SAMPLE_US each (so that the resolution of the clock does not matter), for
+// at least MinTimeUs and MIN_SAMPLES batches, and writes the result.
+static void Measure(const char *Name, SIZE_T BytesPerRun, void (*Run)(void *Context), void *Context)
+{
+	if (!IsSelected(Name)) return;
+	if (ListOnly)
+	{
+		printf("%s\n", Name);
+		return;
+	}
+
+	// One run to warm up the caches, then find the batch size.
+	Run(Context);
+	UINT Batch = 1;
+	for (;;)
+	{
+		ULONGLONG StartUs = GetMonotonicTimeUs();
+		for (UINT i = 0; i < Batch; ++i) Run(Context);
+		if (GetMonotonicTimeUs() - StartUs >= MIN_SAMPLE_US || Batch >= (1u << 24)) break;
+		Batch *= 2;
+	}
+
+	static double Samples[MAX_SAMPLES];
+	UINT SampleCount = 0;
+	ULONGLONG EndUs = GetMonotonicTimeUs() + MinTimeUs;
+	while (SampleCount < MAX_SAMPLES && (SampleCount < MIN_SAMPLES || GetMonotonicTimeUs() < EndUs))
+	{
+		ULONGLONG StartUs = GetMonotonicTimeUs();
+		for (UINT i = 0; i < Batch; ++i) Run(Context);
+		Samples[SampleCount++] = (double)(GetMonotonicTimeUs() - StartUs) / Batch;
+	}
+	std::sort(Samples, Samples + SampleCount);
+	double Best = Samples[0];
+	double Median = Samples[SampleCount / 2];
+
+	printf("{\"name\":\"%s\"", Name);
+	if (BytesPerRun != 0) printf(",\"bytes\":%llu", (unsigned long long)BytesPerRun);
+	printf(",\"batch\":%u,\"samples\":%u,\"best_us\":%.3f,\"median_us\":%.3f", Batch, SampleCount, Best, Median);
+	if (BytesPerRun != 0 && Best > 0) printf(",\"mb_per_s\":%.3f", BytesPerRun / Best);
+	printf("}\n");
+	fflush(stdout);
+}
+
+
+// Packed DIBs in every layout that GetPixelDataOffsetForPackedDIB and GetPackedDIBInfo handle.
+struct DIB_VARIANT
+{
+	const char *Name;
+	DIB_PAYLOAD_SPEC Spec;
+	BYTE *Data;
+	SIZE_T SizeCb;
+};
+
+static DIB_VARIANT DibVariants[] =
+{
+	{ "decode/dib/1bpp",                 { SCREEN_WIDTH, SCREEN_HEIGHT, 1, BI_RGB, DIB_HEADER_INFO, 0, 1 } },
+	{ "decode/dib/4bpp",                 { SCREEN_WIDTH, SCREEN_HEIGHT, 4, BI_RGB, DIB_HEADER_INFO, 0, 2 } },
+	{ "decode/dib/8bpp",                 { SCREEN_WIDTH, SCREEN_HEIGHT, 8, BI_RGB, DIB_HEADER_INFO, 0, 3 } },
+	{ "decode/dib/8bpp-16-colors",       { SCREEN_WIDTH, SCREEN_HEIGHT, 8, BI_RGB, DIB_HEADER_INFO, 16, 4 } },
+	{ "decode/dib/16bpp-555",            { SCREEN_WIDTH, SCREEN_HEIGHT, 16, BI_RGB, DIB_HEADER_INFO, 0, 5 } },
+	{ "decode/dib/16bpp-565-bitfields",  { SCREEN_WIDTH, SCREEN_HEIGHT, 16, BI_BITFIELDS, DIB_HEADER_INFO, 0, 6 } },
+	{ "decode/dib/24bpp",                { SCREEN_WIDTH, SCREEN_HEIGHT, 24, BI_RGB, DIB_HEADER_INFO, 0, 7 } },
+	{ "decode/dib/24bpp-top-down",       { SCREEN_WIDTH, -SCREEN_HEIGHT, 24, BI_RGB, DIB_HEADER_INFO, 0, 8 } },
+	{ "decode/dib/32bpp",                { SCREEN_WIDTH, SCREEN_HEIGHT, 32, BI_RGB, DIB_HEADER_INFO, 0, 9 } },
+	{ "decode/dib/32bpp-bitfields",      { SCREEN_WIDTH, SCREEN_HEIGHT, 32, BI_BITFIELDS, DIB_HEADER_INFO, 0, 10 } },
+	{ "decode/dib/32bpp-alphabitfields", { SCREEN_WIDTH, SCREEN_HEIGHT, 32, BI_ALPHABITFIELDS, DIB_HEADER_INFO, 0, 11 } },
+	{ "decode/dib/32bpp-v4-bitfields",   { SCREEN_WIDTH, SCREEN_HEIGHT, 32, BI_BITFIELDS, DIB_HEADER_V4, 0, 12 } },
+	{ "decode/dib/32bpp-v5-alpha",       { SCREEN_WIDTH, SCREEN_HEIGHT, 32, BI_BITFIELDS, DIB_HEADER_V5, 0, 13 } },
+	{ "decode/dib/32bpp-v5-top-down",    { SCREEN_WIDTH, -SCREEN_HEIGHT, 32, BI_RGB, DIB_HEADER_V5, 0, 14 } },
+	{ "decode/dib/4bpp-rle",             { SCREEN_WIDTH, SCREEN_HEIGHT, 4, BI_RLE4, DIB_HEADER_INFO, 0, 15 } },
+	{ "decode/dib/8bpp-rle",             { SCREEN_WIDTH, SCREEN_HEIGHT, 8, BI_RLE8, DIB_HEADER_INFO, 0, 16 } },
+	{ "decode/dib/8bpp-core",            { SCREEN_WIDTH, SCREEN_HEIGHT, 8, BI_RGB, DIB_HEADER_CORE, 0, 17 } },
+};
+
+// The 32bpp BI_RGB variant, which is what screenshots usually are.
+#define SCREENSHOT_VARIANT 8
+// The variant with straight alpha, for the alpha benchmarks.
+#define ALPHA_VARIANT 12
+
+// PNGs like applications put them on the clipboard next to the DIB, mostly with adaptive filters, and a few in rarer
+// formats.
+struct PNG_VARIANT
+{
+	const char *Name;
+	PNG_PAYLOAD_SPEC Spec;
+	BYTE *Data;
+	SIZE_T SizeCb;
+};
+
+static PNG_VARIANT PngVariants[] =
+{
+	{ "decode/png/rgba",                 { SCREEN_WIDTH, SCREEN_HEIGHT, PNG_RGBA, 8, false, PNG_FILTER_ADAPTIVE, PNG_COMPRESSION_FIXED, false, 31 } },
+	{ "decode/png/rgb",                  { SCREEN_WIDTH, SCREEN_HEIGHT, PNG_RGB, 8, false, PNG_FILTER_ADAPTIVE, PNG_COMPRESSION_FIXED, false, 32 } },
+	{ "decode/png/rgb-stored",           { SCREEN_WIDTH, SCREEN_HEIGHT, PNG_RGB, 8, false, PNG_FILTER_ADAPTIVE, PNG_COMPRESSION_STORED, false, 33 } },
+	{ "decode/png/rgb-key",              { SCREEN_WIDTH, SCREEN_HEIGHT, PNG_RGB, 8, false, PNG_FILTER_ADAPTIVE, PNG_COMPRESSION_FIXED, true, 34 } },
+	{ "decode/png/rgba-interlaced",      { SCREEN_WIDTH, SCREEN_HEIGHT, PNG_RGBA, 8, true, PNG_FILTER_ADAPTIVE, PNG_COMPRESSION_FIXED, false, 35 } },
+	{ "decode/png/rgba-16",              { SCREEN_WIDTH, SCREEN_HEIGHT, PNG_RGBA, 16, false, PNG_FILTER_ADAPTIVE, PNG_COMPRESSION_FIXED, false, 36 } },
+	{ "decode/png/gray",                 { SCREEN_WIDTH, SCREEN_HEIGHT, PNG_GRAY, 8, false, PNG_FILTER_ADAPTIVE, PNG_COMPRESSION_FIXED, false, 37 } },
+	{ "decode/png/gray-alpha",           { SCREEN_WIDTH, SCREEN_HEIGHT, PNG_GRAY_ALPHA, 8, false, PNG_FILTER_ADAPTIVE, PNG_COMPRESSION_FIXED, false, 38 } },
+	{ "decode/png/palette-8",            { SCREEN_WIDTH, SCREEN_HEIGHT, PNG_PALETTE, 8, false, PNG_FILTER_ADAPTIVE, PNG_COMPRESSION_FIXED, true, 39 } },
+	{ "decode/png/palette-4",            { SCREEN_WIDTH, SCREEN_HEIGHT, PNG_PALETTE, 4, false, 0, PNG_COMPRESSION_FIXED, false, 40 } },
+};
+
+// The variant that screenshots usually are.
+#define PNG_SCREENSHOT_VARIANT 0
+
+enum EVENT_TRACE_KIND
+{
+	EVENT_TRACE_BURSTS,
+	EVENT_TRACE_STEADY,
+	EVENT_TRACE_RANDOM,
+};
+
+// Synthetic clipboard notification times, COALESCE_TRACE_EVENTS of them.
+struct EVENT_TRACE
+{
+	const char *Name;
+	const char *LatencyName;
+	EVENT_TRACE_KIND Kind;
+	ULONGLONG *TimesUs;
+};
+
+static EVENT_TRACE EventTraces[] =
+{
+	// A script or password manager copying 100 times in a row, once a second.
+	{ "coalesce/bursts", "coalesce/bursts/latency", EVENT_TRACE_BURSTS },
+	// A notification every 10 ms that never lets up, so only the latency bound ends a burst.
+	{ "coalesce/steady", "coalesce/steady/latency", EVENT_TRACE_STEADY },
+	// Mostly single copies, some in quick succession.
+	{ "coalesce/random", "coalesce/random/latency", EVENT_TRACE_RANDOM },
+};
+
+// Texts cut into documents for the trigram index, in several sizes. Each is only generated and indexed when one of its
+// benchmarks runs, and freed right after, since the larger ones take a while and a lot of memory.
+struct TRIGRAM_CORPUS
+{
+	const char *Name;
+	const char *SizeName;
+	SIZE_T Length;                     // Characters.
+	DWORD Seed;
+	BOOL Large;                        // Only with /large.
+	WCHAR *Text;
+	SIZE_T *DocumentEnds;
+	SIZE_T DocumentCount;
+	ULONGLONG *Candidates;             // One per document.
+	TRIGRAM_INDEX Index;
+	ULONGLONG BuildUs;
+};
+
+static TRIGRAM_CORPUS TrigramCorpora[] =
+{
+	{ "search/trigrams", "index/trigrams/size", TEXT_LENGTH, 21 },
+	{ "search/trigrams/128MB", "index/trigrams/128MB/size", 64 * 1024 * 1024, 23 },
+	{ "search/trigrams/1GB", "index/trigrams/1GB/size", 512 * 1024 * 1024, 24, true },
+};
+
+// Everything the benchmarks work on. Built once, before any measurement.
+struct BENCHMARK_STATE
+{
+	BYTE *DecodeBuffer;                // SCREEN_WIDTH x SCREEN_HEIGHT BGRA.
+	GENERATED_PAYLOAD Malformed[MAX_MALFORMED_PAYLOADS];
+	UINT MalformedCount;
+	SIZE_T MalformedBytes;
+	GENERATED_PAYLOAD MalformedPngs[MAX_MALFORMED_PAYLOADS];
+	UINT MalformedPngCount;
+	SIZE_T MalformedPngBytes;
+	GENERATED_PAYLOAD MalformedRichText[MAX_MALFORMED_PAYLOADS];
+	UINT MalformedRichTextCount;
+	SIZE_T MalformedRichTextBytes;
+
+	// TEXT_LENGTH characters as CF_HTML, the same with a fragment offset that does not fit so that the fragment has to
+	// be searched for, and as RTF.
+	BYTE *Html;
+	SIZE_T HtmlSizeCb;
+	BYTE *BrokenHtml;
+	BYTE *Rtf;
+	SIZE_T RtfSizeCb;
+
+	// The zlib stream of the PNG screenshot, joined from its IDAT chunks, and what it decompresses to.
+	BYTE *PngStream;
+	SIZE_T PngStreamSizeCb;
+	BYTE *PngFiltered;
+	SIZE_T PngFilteredSizeCb;
+	BYTE *UnfilterBuffer;              // Two rows.
+
+	PIXEL_BUFFER *Screenshot;          // Decoded, with its mip pyramid.
+	PIXEL_BUFFER *FlatScreenshot;      // The same, without one.
+	PIXEL_BUFFER *HalfSize;            // Scratch for MipDownsample.
+	PIXEL_BUFFER *TranslucentImage;    // ALPHA_VARIANT, decoded and premultiplied.
+	BYTE *StraightAlphaPixels;         // ALPHA_VARIANT, decoded only.
+	COMPRESSED_IMAGE *CompressedScreenshot;
+	BYTE *TileBuffer;
+
+	WCHAR *Text;
+	SIZE_T TextLength;
+	void *CompressedText;
+	SIZE_T CompressedTextSizeCb;
+	WCHAR *DecompressedText;
+	TEXT_LINE_INDEX TextIndex;
+	WCHAR *LargeText;                  // LARGE_TEXT_LENGTH characters.
+	TEXT_LINE_INDEX LargeTextIndex;
+	SIZE_T HistoryAppendBytes;         // What one run of history/append-1M copies.
+	SIZE_T StoreAppendBytes;           // What one run of store/append writes.
+	const WCHAR *Clips[TEXT_CLIP_COUNT];   // Within Text.
+	SIZE_T ClipLengths[TEXT_CLIP_COUNT];
+	SIZE_T ClipBytes;
+	TEXT_DICTIONARY *ClipDictionary;
+	BYTE *CompressedClips[2];          // Without and with the dictionary, each clip at its ClipOffsets.
+	SIZE_T ClipOffsets[TEXT_CLIP_COUNT];
+	SIZE_T CompressedClipSizes[2][TEXT_CLIP_COUNT];
+	HEX_DUMP HexDump;
+
+	FAKE_CLIPBOARD FakeClipboard;
+	CLIPBOARD_BACKEND FakeBackend;
+	FAKE_CLIPBOARD_FORMAT FakeFormats[2];
+	UINT PngFormat;
+	CLIPBOARD_SNAPSHOT Snapshot;
+
+	TILE_CACHE Tiles;
+	double Scale;                      // For the zoomed paint.
+	ULONGLONG TraceStart;              // Where the next span of trace/span begins.
+};
+
+static BENCHMARK_STATE State;
+
+
+static void BenchDecodeDib(void *Context)
+{
+	const DIB_VARIANT *Variant = (const DIB_VARIANT *)Context;
+	PACKED_DIB_INFO Info;
+	if (GetPackedDIBInfo((const BITMAPINFOHEADER *)Variant->Data, Variant->SizeCb, &Info))
+	{
+		DecodePackedDIB(&Info, State.DecodeBuffer, (SIZE_T)Info.Width * 4);
+		Sink += State.DecodeBuffer[0];
+	}
+}
+
+
+static void BenchDecodeMalformedDibs(void *Context)
+{
+	for (UINT i = 0; i < State.MalformedCount; ++i)
+	{
+		const GENERATED_PAYLOAD *Payload = &State.Malformed[i];
+		PACKED_DIB_INFO Info;
+		if (!GetPackedDIBInfo((const BITMAPINFOHEADER *)Payload->Data, Payload->SizeCb, &Info)) continue;
+		if ((ULONGLONG)Info.Width * Info.Height > MAX_MALFORMED_PIXELS) continue;
+		DecodePackedDIB(&Info, State.DecodeBuffer, (SIZE_T)Info.Width * 4);
+		Sink += State.DecodeBuffer[0];
+	}
+}
+
+
+static void BenchDecodePng(void *Context)
+{
+	const PNG_VARIANT *Variant = (const PNG_VARIANT *)Context;
+	PNG_INFO Info;
+	if (GetPngInfo(Variant->Data, Variant->SizeCb, &Info))
+	{
+		PIXEL_BUFFER *Image = DecodePng(&Info, 1);
+		if (Image != nullptr) Sink += Image->Pixels[0];
+		PixelBufferRelease(Image);
+	}
+}
+
+
+// Decompression and unfiltering pipelined on two threads.
+static void BenchDecodePngThreads(void *Context)
+{
+	const PNG_VARIANT *Variant = (const PNG_VARIANT *)Context;
+	PNG_INFO Info;
+	if (GetPngInfo(Variant->Data, Variant->SizeCb, &Info))
+	{
+		PIXEL_BUFFER *Image = DecodePng(&Info, 0);
+		if (Image != nullptr) Sink += Image->Pixels[0];
+		PixelBufferRelease(Image);
+	}
+}
+
+
+static void BenchDecodeMalformedPngs(void *Context)
+{
+	for (UINT i = 0; i < State.MalformedPngCount; ++i)
+	{
+		const GENERATED_PAYLOAD *Payload = &State.MalformedPngs[i];
+		PNG_INFO Info;
+		if (!GetPngInfo(Payload->Data, Payload->SizeCb, &Info)) continue;
+		if ((ULONGLONG)Info.Width * Info.Height > MAX_MALFORMED_PIXELS) continue;
+		PIXEL_BUFFER *Image = DecodePng(&Info, 1);
+		if (Image != nullptr) Sink += Image->Pixels[0];
+		PixelBufferRelease(Image);
+	}
+}
+
+
+static void BenchInflate(void *Context)
+{
+	SIZE_T ProducedCb;
+	ZlibInflate(State.PngStream, State.PngStreamSizeCb, State.PngFiltered, State.PngFilteredSizeCb, &ProducedCb, nullptr);
+	Sink += ProducedCb;
+}
+
+
+// Unfilters all rows of the PNG screenshot's filtered data with one filter (the low byte of Context) as if they had
+// pixels of the size in the next byte, regardless of the filters they were made with; only the speed counts.
+static void BenchUnfilter(void *Context)
+{
+	BYTE Filter = (BYTE)(UINT_PTR)Context;
+	UINT PixelSizeCb = (UINT)((UINT_PTR)Context >> 8);
+	SIZE_T RowSizeCb = (SIZE_T)SCREEN_WIDTH * 4;
+	BYTE *Rows[2] = { State.UnfilterBuffer, State.UnfilterBuffer + RowSizeCb + PNG_ROW_SLACK };
+	memset(Rows[1], 0, RowSizeCb);
+	for (LONG y = 0; y < SCREEN_HEIGHT; ++y)
+	{
+		const BYTE *Row = State.PngFiltered + y * (RowSizeCb + 1) + 1;
+		PngUnfilterRow(Filter, Row, Rows[(y + 1) % 2], Rows[y % 2], RowSizeCb, PixelSizeCb);
+	}
+	Sink += Rows[0][0];
+}
+
+
+// What the monitor does with the clipboard open and right after: snapshots the captured format, and the format passed
+// as Context too if it is not 0 (like inspecting a format does), then makes the capture job.
+static void BenchSnapshotCapture(void *Context)
+{
+	UINT InspectFormat = (UINT)(UINT_PTR)Context;
+	CLIPBOARD_SNAPSHOT_REQUEST Requests[2] = { CaptureSnapshotRequest, { &InspectFormat, 1 } };
+	CLIPBOARD_BACKEND *Backend = &State.FakeBackend;
+	if (!Backend->Open(Backend->Context)) return;
+	BOOL Snapshotted = ClipboardSnapshotTake(&State.Snapshot, Backend, Requests, InspectFormat != 0 ? 2 : 1);
+	Backend->Close(Backend->Context);
+	if (!Snapshotted) return;
+	Sink += State.Snapshot.Items[1].SizeCb;
+	CAPTURE_JOB *Job = CaptureJobCreateFromSnapshot(&State.Snapshot, 0);
+	ClipboardSnapshotRelease(&State.Snapshot);
+	if (Job != nullptr)
+	{
+		Sink += Job->SizeCb;
+		CaptureJobFree(Job);
+	}
+}
+
+
+static void BenchCopyTilePixels(void *Context)
+{
+	const PIXEL_BUFFER *Image = State.Screenshot;
+	LONG Columns = (Image->Width + TILE_SIZE - 1) / TILE_SIZE;
+	LONG Rows = (Image->Height + TILE_SIZE - 1) / TILE_SIZE;
+	for (LONG Row = 0; Row < Rows; ++Row)
+	{
+		for (LONG Column = 0; Column < Columns; ++Column)
+		{
+			TILE_BOUNDS Bounds;
+			GetTileBounds(Image->Width, Image->Height, Column, Row, &Bounds);
+			CopyTilePixels(Image, &Bounds, State.TileBuffer);
+			Sink += State.TileBuffer[0];
+		}
+	}
+}
+
+
+static void BenchHashContent(void *Context)
+{
+	const DIB_VARIANT *Variant = (const DIB_VARIANT *)Context;
+	CONTENT_HASH Hash;
+	ComputeContentHash(Variant->Data, Variant->SizeCb, &Hash);
+	Sink += Hash.Low;
+}
+
+
+static void BenchHashText(void *Context)
+{
+	CONTENT_HASH Hash;
+	ComputeContentHash(State.Text, State.TextLength * sizeof(WCHAR), &Hash);
+	Sink += Hash.Low;
+}
+
+
+// ComputePerceptualHash reads the smallest level of the pyramid that is still large enough, or the whole image if
+// there is no pyramid yet.
+static void BenchHashPerceptual(void *Context)
+{
+	Sink += ComputePerceptualHash((const PIXEL_BUFFER *)Context);
+}
+
+
+static void BenchMipDownsample(void *Context)
+{
+	MipDownsample(State.Screenshot, State.HalfSize);
+	Sink += State.HalfSize->Pixels[0];
+}
+
+
+static void BenchClassifyAlpha(void *Context)
+{
+	Sink += ClassifyAlpha(State.Screenshot->Pixels, (SIZE_T)SCREEN_WIDTH * SCREEN_HEIGHT);
+}
+
+
+// Premultiplies the same pixels over and over. Only the colors change with every run; which pixels are opaque, and
+// with that the work, stays the same.
+static void BenchPremultiplyAlpha(void *Context)
+{
+	PremultiplyAlpha(State.StraightAlphaPixels, (SIZE_T)SCREEN_WIDTH * SCREEN_HEIGHT);
+	Sink += State.StraightAlphaPixels[0];
+}
+
+
+// Composites a whole view of the translucent image, like painting it does. The view starts at an odd column, so that
+// the pixels up to the first group of four are included.
+static void BenchPaintCheckerboard(void *Context)
+{
+	const PIXEL_BUFFER *Image = State.TranslucentImage;
+	const BYTE *Source = Image->Pixels + (SIZE_T)100 * Image->Stride + 3 * 4;
+	CompositeOverCheckerboard(Source, Image->Stride, State.DecodeBuffer, VIEW_WIDTH * 4, VIEW_WIDTH, VIEW_HEIGHT, 3, 100);
+	Sink += State.DecodeBuffer[0];
+}
+
+
+static void BenchEncodeImage(void *Context)
+{
+	COMPRESSED_IMAGE *Compressed = ImageCodecEncode(State.Screenshot, (UINT)(UINT_PTR)Context);
+	if (Compressed != nullptr) Sink += ImageCodecGetSize(Compressed);
+	free(Compressed);
+}
+
+
+static void BenchDecodeImage(void *Context)
+{
+	PIXEL_BUFFER *Image = ImageCodecDecode(State.CompressedScreenshot, (UINT)(UINT_PTR)Context);
+	if (Image != nullptr) Sink += Image->Pixels[0];
+	PixelBufferRelease(Image);
+}
+
+
+static void BenchEncodeText(void *Context)
+{
+	Sink += TextCodecEncode(State.Text, State.TextLength, nullptr, State.CompressedText);
+}
+
+
+static void BenchDecodeText(void *Context)
+{
+	const TEXT_CODEC_HEADER *Header = TextCodecValidate(State.CompressedText, State.CompressedTextSizeCb);
+	if (Header != nullptr && TextCodecDecode(Header, State.CompressedTextSizeCb, nullptr, State.DecompressedText))
+	{
+		Sink += State.DecompressedText[0];
+	}
+}
+
+
+// Context is 1 to compress with the dictionary.
+static void BenchEncodeClips(void *Context)
+{
+	UINT d = (UINT)(UINT_PTR)Context;
+	for (UINT i = 0; i < TEXT_CLIP_COUNT; ++i)
+	{
+		Sink += TextCodecEncode(State.Clips[i], State.ClipLengths[i], d != 0 ? State.ClipDictionary : nullptr, State.CompressedClips[d] + State.ClipOffsets[i]);
+	}
+}
+
+
+static void BenchDecodeClips(void *Context)
+{
+	UINT d = (UINT)(UINT_PTR)Context;
+	for (UINT i = 0; i < TEXT_CLIP_COUNT; ++i)
+	{
+		SIZE_T SizeCb = State.CompressedClipSizes[d][i];
+		const TEXT_CODEC_HEADER *Header = TextCodecValidate(State.CompressedClips[d] + State.ClipOffsets[i], SizeCb);
+		if (Header != nullptr && TextCodecDecode(Header, SizeCb, d != 0 ? State.ClipDictionary : nullptr, State.DecompressedText))
+		{
+			Sink += State.DecompressedText[0];
+		}
+	}
+}
+
+
+// How much the clips shrink without and with the dictionary.
+static void ReportTextClips()
+{
+	static const char Name[] = "size/text-codec/clips";
+	if (!IsSelected(Name)) return;
+	if (ListOnly)
+	{
+		printf("%s\n", Name);
+		return;
+	}
+	SIZE_T SizeCb[2] = {};
+	for (UINT d = 0; d < 2; ++d)
+	{
+		for (UINT i = 0; i < TEXT_CLIP_COUNT; ++i) SizeCb[d] += State.CompressedClipSizes[d][i];
+	}
+	printf("{\"name\":\"%s\",\"bytes\":%zu,\"texts\":%u,\"dictionary_bytes\":%zu,\"compressed_fraction\":%.3f,\"dictionary_compressed_fraction\":%.3f}\n", Name, State.ClipBytes, TEXT_CLIP_COUNT,
+		State.ClipDictionary->SizeCb, (double)SizeCb[0] / State.ClipBytes, (double)SizeCb[1] / State.ClipBytes);
+	fflush(stdout);
+}
+
+
+static void BenchParseHtml(void *Context)
+{
+	CLIPBOARD_HTML Html;
+	if (ParseClipboardHtml((const BYTE *)Context, State.HtmlSizeCb, &Html)) Sink += Html.FragmentSizeCb;
+}
+
+
+static void BenchTokenizeRtf(void *Context)
+{
+	RTF_TOKENIZER Tokenizer;
+	RTF_TOKEN Token;
+	RtfTokenizerInit(&Tokenizer, State.Rtf, State.RtfSizeCb);
+	while (RtfNextToken(&Tokenizer, &Token)) Sink += Token.Type;
+}
+
+
+static void BenchExtractRtf(void *Context)
+{
+	RTF_DOCUMENT Document;
+	if (RtfExtract(State.Rtf, State.RtfSizeCb, &Document)) Sink += Document.TextLength + Document.OutlineCount;
+	RtfDocumentFree(&Document);
+}
+
+
+static void BenchParseMalformedRichText(void *Context)
+{
+	for (UINT i = 0; i < State.MalformedRichTextCount; ++i)
+	{
+		const GENERATED_PAYLOAD *Payload = &State.MalformedRichText[i];
+		CLIPBOARD_HTML Html;
+		if (ParseClipboardHtml(Payload->Data, Payload->SizeCb, &Html)) Sink += Html.FragmentSizeCb;
+		RTF_DOCUMENT Document;
+		if (RtfExtract(Payload->Data, Payload->SizeCb, &Document)) Sink += Document.TextLength;
+		RtfDocumentFree(&Document);
+	}
+}
+
+
+// Indexes the text of the index in Context again.
+static void BenchIndexTextLines(void *Context)
+{
+	const TEXT_LINE_INDEX *Source = (const TEXT_LINE_INDEX *)Context;
+	TEXT_LINE_INDEX Index;
+	if (TextLineIndexBuild(&Index, Source->Text, Source->Length, TEXT_TAB_WIDTH))
+	{
+		Sink += TextLineIndexGetLineCount(&Index);
+	}
+	TextLineIndexFree(&Index);
+}
+
+
+static void BenchIndexTextLinesScalar(void *Context)
+{
+	TEXT_LINE_INDEX Index;
+	if (TextLineIndexBuildScalar(&Index, State.Text, State.TextLength, TEXT_TAB_WIDTH))
+	{
+		Sink += TextLineIndexGetLineCount(&Index);
+	}
+	TextLineIndexFree(&Index);
+}
+
+
+// The length of the next text appended to the history: mostly a few words or lines, now and then a whole document.
+static SIZE_T GetNextHistoryTextLength(DWORD *Random)
+{
+	*Random = *Random * 1664525 + 1013904223;
+	DWORD r = *Random >> 8;
+	return r % 100 == 0 ? r % (128 * 1024) : 1 + r % 512;
+}
+
+
+// Appends a million texts to a history that is as large as the monitor's, so that it wraps around its arena again and
+// again, and evicts an entry with every append.
+static void BenchHistoryAppend(void *Context)
+{
+	CLIPBOARD_HISTORY History;
+	if (!ClipboardHistoryInit(&History, HISTORY_MAX_ENTRIES, HISTORY_ARENA_SIZE, HISTORY_BYTE_BUDGET)) return;
+	CONTENT_HASH Hash = {};
+	DWORD Random = 1;
+	for (UINT i = 0; i < HISTORY_APPEND_COUNT; ++i)
+	{
+		SIZE_T Length = GetNextHistoryTextLength(&Random);
+		Hash.Low = i;
+		ClipboardHistoryAppend(&History, CF_UNICODETEXT, State.Text + (Random % (State.TextLength - Length)), Length * sizeof(WCHAR), nullptr, &Hash, i);
+	}
+	Sink += History.NextId;
+	ClipboardHistoryFree(&History);
+}
+
+
+// Writes the store for store/open-100k: short texts, as most clipboard texts are. Only the number of entries matters
+// for opening it.
+static BOOL CreateBenchmarkStore()
+{
+	HistoryStoreDelete(STORE_DIRECTORY);
+	HISTORY_STORE Store;
+	if (!HistoryStoreOpen(&Store, STORE_DIRECTORY, STORE_SEGMENT_SIZE)) return false;
+	BOOL Succeeded = true;
+	for (UINT i = 0; i < STORE_OPEN_ENTRIES && Succeeded; ++i)
+	{
+		SIZE_T Length = 1 + i % 64;
+		const WCHAR *Text = State.Text + (SIZE_T)i * 37 % (State.TextLength - Length);
+		CONTENT_HASH Hash;
+		ComputeContentHash(Text, Length * sizeof(WCHAR), &Hash);
+		Succeeded = HistoryStoreAppend(&Store, CF_UNICODETEXT, Text, Length * sizeof(WCHAR), &Hash, i);
+	}
+	HistoryStoreClose(&Store);
+	return Succeeded;
+}
+
+
+// Opening has to look at the last entry and the end of the log, but never at all the others.
+static void BenchStoreOpen(void *Context)
+{
+	HISTORY_STORE Store;
+	if (HistoryStoreOpen(&Store, STORE_DIRECTORY, STORE_SEGMENT_SIZE))
+	{
+		Sink += HistoryStoreGetCount(&Store) + Store.RecoveredEntries;
+		HistoryStoreClose(&Store);
+	}
+}
+
+
+// Appends texts like history/append-1M does to a new store, and deletes it again.
+static void BenchStoreAppend(void *Context)
+{
+	HISTORY_STORE Store;
+	if (!HistoryStoreOpen(&Store, STORE_APPEND_DIRECTORY, STORE_SEGMENT_SIZE)) return;
+	CONTENT_HASH Hash = {};
+	DWORD Random = 1;
+	for (UINT i = 0; i < STORE_APPEND_COUNT; ++i)
+	{
+		SIZE_T Length = GetNextHistoryTextLength(&Random);
+		Hash.Low = i;
+		HistoryStoreAppend(&Store, CF_UNICODETEXT, State.Text + (Random % (State.TextLength - Length)), Length * sizeof(WCHAR), &Hash, i);
+	}
+	Sink += HistoryStoreGetCount(&Store);
+	HistoryStoreClose(&Store);
+	HistoryStoreDelete(STORE_APPEND_DIRECTORY);
+}
+
+
+static BOOL GenerateEventTrace(EVENT_TRACE *Trace)
+{
+	Trace->TimesUs = (ULONGLONG *)malloc(COALESCE_TRACE_EVENTS * sizeof(ULONGLONG));
+	if (Trace->TimesUs == nullptr) return false;
+	DWORD Random = 1;
+	ULONGLONG NowUs = 0;
+	for (UINT i = 0; i < COALESCE_TRACE_EVENTS; ++i)
+	{
+		switch (Trace->Kind)
+		{
+			case EVENT_TRACE_BURSTS: NowUs = (ULONGLONG)(i / 100) * 1000000 + (i % 100) * 200; break;
+			case EVENT_TRACE_STEADY: NowUs = (ULONGLONG)i * 10000; break;
+			case EVENT_TRACE_RANDOM:
+			{
+				Random = Random * 1664525 + 1013904223;
+				DWORD r = Random >> 8;
+				NowUs += r % 10 == 0 ? 50000 + r % 2000000 : r % 20000;
+				break;
+			}
+		}
+		Trace->TimesUs[i] = NowUs;
+	}
+	return true;
+}
+
+
+// Runs a trace through the coalescer, polling at exactly the deadlines it asks for, like the monitor's timer. Returns
+// the sum of the latencies of all fires; the coalescer has the rest of the statistics.
+static ULONGLONG RunEventTrace(COALESCER *Coalescer, const EVENT_TRACE *Trace)
+{
+	COALESCER_CONFIG Config;
+	Config.QuietUs = COALESCE_QUIET_US;
+	Config.MaxLatencyUs = COALESCE_MAX_LATENCY_US;
+	CoalescerInit(Coalescer, &Config);
+	ULONGLONG LatencySumUs = 0;
+	ULONGLONG DeadlineUs = 0;
+	for (UINT i = 0; i <= COALESCE_TRACE_EVENTS; ++i)
+	{
+		ULONGLONG NowUs = i < COALESCE_TRACE_EVENTS ? Trace->TimesUs[i] : (ULONGLONG)-1;
+		while (DeadlineUs != 0 && DeadlineUs <= NowUs)
+		{
+			ULONGLONG FirstEventUs = Coalescer->FirstEventUs;
+			ULONGLONG PollUs = DeadlineUs;
+			if (CoalescerPoll(Coalescer, PollUs, &DeadlineUs)) LatencySumUs += PollUs - FirstEventUs;
+		}
+		if (i < COALESCE_TRACE_EVENTS) DeadlineUs = CoalescerAddEvent(Coalescer, NowUs);
+	}
+	return LatencySumUs;
+}
+
+
+static void BenchCoalesce(void *Context)
+{
+	COALESCER Coalescer;
+	RunEventTrace(&Coalescer, (const EVENT_TRACE *)Context);
+	Sink += Coalescer.Fires;
+}
+
+
+// Where the time goes in simulated time rather than CPU time: how many captures a trace turns into, and how long after
+// the first notification of a burst they start.
+static void ReportCoalescing(const EVENT_TRACE *Trace)
+{
+	if (!IsSelected(Trace->LatencyName)) return;
+	if (ListOnly)
+	{
+		printf("%s\n", Trace->LatencyName);
+		return;
+	}
+	COALESCER Coalescer;
+	ULONGLONG LatencySumUs = RunEventTrace(&Coalescer, Trace);
+	printf("{\"name\":\"%s\",\"events\":%lld,\"fires\":%lld,\"mean_latency_us\":%.3f,\"max_latency_us\":%llu}\n", Trace->LatencyName, (long long)Coalescer.Events, (long long)Coalescer.Fires,
+		Coalescer.Fires > 0 ? (double)LatencySumUs / Coalescer.Fires : 0.0, (unsigned long long)Coalescer.MaxLatencyUs);
+	fflush(stdout);
+}
+
+
+// Documents of very different lengths, like clipboard texts: most short, some long. About 1000 characters on average.
+static SIZE_T GetNextDocumentLength(DWORD *Random)
+{
+	*Random = *Random * 1664525 + 1013904223;
+	DWORD r = *Random >> 8;
+	return r % 10 == 0 ? 1 + r % (16 * 1024) : 1 + r % 512;
+}
+
+
+static BOOL AddTrigramDocuments(TRIGRAM_INDEX *Index, const TRIGRAM_CORPUS *Corpus)
+{
+	SIZE_T Start = 0;
+	for (SIZE_T i = 0; i < Corpus->DocumentCount; ++i)
+	{
+		if (!TrigramIndexAdd(Index, i, Corpus->Text + Start, Corpus->DocumentEnds[i] - Start)) return false;
+		Start = Corpus->DocumentEnds[i];
+	}
+	return true;
+}
+
+
+static void FreeTrigramCorpus(TRIGRAM_CORPUS *Corpus)
+{
+	if (Corpus->Text == nullptr) return;
+	TrigramIndexFree(&Corpus->Index);
+	free(Corpus->Candidates);
+	free(Corpus->DocumentEnds);
+	free(Corpus->Text);
+	Corpus->Text = nullptr;
+}
+
+
+// Generates the text, cuts it into documents and indexes them, timing the last part.
+static BOOL PrepareTrigramCorpus(TRIGRAM_CORPUS *Corpus)
+{
+	DWORD Random = Corpus->Seed;
+	SIZE_T DocumentCount = 0;
+	for (SIZE_T End = 0; End < Corpus->Length; End += GetNextDocumentLength(&Random)) ++DocumentCount;
+	Corpus->Text = GenerateText(Corpus->Length, Corpus->Seed);
+	Corpus->DocumentEnds = (SIZE_T *)malloc(DocumentCount * sizeof(SIZE_T));
+	Corpus->Candidates = (ULONGLONG *)malloc(DocumentCount * sizeof(ULONGLONG));
+	if (Corpus->Text == nullptr || Corpus->DocumentEnds == nullptr || Corpus->Candidates == nullptr || !TrigramIndexInit(&Corpus->Index))
+	{
+		free(Corpus->Candidates);
+		free(Corpus->DocumentEnds);
+		free(Corpus->Text);
+		Corpus->Text = nullptr;
+		return false;
+	}
+	Random = Corpus->Seed;
+	SIZE_T End = 0;
+	for (SIZE_T i = 0; i < DocumentCount; ++i)
+	{
+		End += GetNextDocumentLength(&Random);
+		Corpus->DocumentEnds[i] = End < Corpus->Length ? End : Corpus->Length;
+	}
+	Corpus->DocumentCount = DocumentCount;
+	ULONGLONG StartUs = GetMonotonicTimeUs();
+	BOOL Indexed = AddTrigramDocuments(&Corpus->Index, Corpus);
+	Corpus->BuildUs = GetMonotonicTimeUs() - StartUs;
+	if (!Indexed) FreeTrigramCorpus(Corpus);
+	return Indexed;
+}
+
+
+static void BenchIndexTrigrams(void *Context)
+{
+	TRIGRAM_INDEX Index;
+	if (TrigramIndexInit(&Index))
+	{
+		AddTrigramDocuments(&Index, (const TRIGRAM_CORPUS *)Context);
+		Sink += TrigramIndexGetMemoryUsage(&Index);
+		TrigramIndexFree(&Index);
+	}
+}
+
+
+// Queries the trigram index, and checks the candidates newest first until there are enough results, like the search
+// worker does.
+static void BenchSearchTrigrams(void *Context)
+{
+	static const char *const Patterns[] = { "clipboard monitor", "Buffer->SizeCb", "error id=", "WARN] worker-07", "zzqx", "history of" };
+	const TRIGRAM_CORPUS *Corpus = (const TRIGRAM_CORPUS *)Context;
+	for (UINT p = 0; p < sizeof(Patterns) / sizeof(Patterns[0]); ++p)
+	{
+		WCHAR Pattern[64];
+		SIZE_T PatternLength = 0;
+		for (; Patterns[p][PatternLength] != 0; ++PatternLength) Pattern[PatternLength] = (WCHAR)Patterns[p][PatternLength];
+		SIZE_T Count = TrigramIndexQuery(&Corpus->Index, Pattern, PatternLength, Corpus->Candidates, Corpus->DocumentCount);
+		UINT Results = 0;
+		for (SIZE_T i = 0; i < Count && Results < TRIGRAM_MAX_RESULTS; ++i)
+		{
+			SIZE_T Document = (SIZE_T)Corpus->Candidates[i];
+			SIZE_T Start = Document > 0 ? Corpus->DocumentEnds[Document - 1] : 0;
+			SIZE_T Position;
+			Results += TextFindFolded(Corpus->Text + Start, Corpus->DocumentEnds[Document] - Start, Pattern, PatternLength, &Position);
+		}
+		Sink += Results;
+	}
+}
+
+
+// How large the index of a corpus is compared to its UTF-16 text, and how long it took to build once.
+static void ReportTrigramIndex(const TRIGRAM_CORPUS *Corpus)
+{
+	if (!IsSelected(Corpus->SizeName)) return;
+	if (ListOnly)
+	{
+		printf("%s\n", Corpus->SizeName);
+		return;
+	}
+	SIZE_T TextBytes = Corpus->Length * sizeof(WCHAR);
+	SIZE_T IndexBytes = TrigramIndexGetMemoryUsage(&Corpus->Index);
+	printf("{\"name\":\"%s\",\"bytes\":%zu,\"documents\":%zu,\"index_bytes\":%zu,\"index_fraction\":%.3f,\"build_us\":%llu}\n", Corpus->SizeName, TextBytes, Corpus->DocumentCount, IndexBytes,
+		(double)IndexBytes / TextBytes, (unsigned long long)Corpus->BuildUs);
+	fflush(stdout);
+}
+
+
+// Paints VIEW_POSITIONS pages spread over the text of the index in Context, the way PaintText does, except for the
+// ExtTextOutW.
+static void BenchPaintText(void *Context)
+{
+	static WCHAR Scratch[VIEW_WIDTH / VIEW_CHAR_WIDTH + 1];
+	const TEXT_LINE_INDEX *Index = (const TEXT_LINE_INDEX *)Context;
+	SIZE_T LineCount = TextLineIndexGetLineCount(Index);
+	ULONGLONG ContentHeight = (ULONGLONG)LineCount * VIEW_LINE_HEIGHT;
+	for (UINT i = 0; i < VIEW_POSITIONS; ++i)
+	{
+		ULONGLONG Top = ContentHeight * i / VIEW_POSITIONS;
+		// Every other page is scrolled to the right a bit, past the start of most lines.
+		SIZE_T FirstColumn = (i % 2) * 40;
+		SIZE_T FirstLine, EndLine;
+		TextLayoutGetVisibleLines(Index, Top, Top + VIEW_HEIGHT, VIEW_LINE_HEIGHT, &FirstLine, &EndLine);
+		for (SIZE_T Line = FirstLine; Line < EndLine; ++Line)
+		{
+			SIZE_T RunLength;
+			const WCHAR *Run = TextLayoutGetVisibleRun(Index, Line, FirstColumn, VIEW_WIDTH / VIEW_CHAR_WIDTH, Scratch, &RunLength);
+			Sink += RunLength + (RunLength > 0 ? Run[0] : 0);
+		}
+	}
+}
+
+
+// Formats VIEW_POSITIONS pages spread over a hex dump of a screenshot DIB, the way PaintHexDump does.
+static void BenchPaintHexDump(void *Context)
+{
+	ULONGLONG ContentHeight = HexDumpGetRowCount(&State.HexDump) * VIEW_LINE_HEIGHT;
+	for (UINT i = 0; i < VIEW_POSITIONS; ++i)
+	{
+		ULONGLONG Top = ContentHeight * i / VIEW_POSITIONS;
+		ULONGLONG FirstRow, EndRow;
+		HexDumpGetVisibleRows(&State.HexDump, Top, Top + VIEW_HEIGHT, VIEW_LINE_HEIGHT, &FirstRow, &EndRow);
+		for (ULONGLONG Row = FirstRow; Row < EndRow; ++Row)
+		{
+			WCHAR Text[HEX_DUMP_MAX_ROW_LENGTH];
+			Sink += HexDumpFormatRow(&State.HexDump, Row, Text);
+		}
+	}
+}
+
+
+// Resamples the middle of the screenshot for a whole view at State.Scale, like PaintZoomedImage.
+static void BenchPaintZoomed(void *Context)
+{
+	double Scale = *(const double *)Context;
+	LONGLONG X = (LONGLONG)(SCREEN_WIDTH * Scale / 2) - VIEW_WIDTH / 2;
+	LONGLONG Y = (LONGLONG)(SCREEN_HEIGHT * Scale / 2) - VIEW_HEIGHT / 2;
+	MipResample(State.Screenshot, Scale, X, Y, VIEW_WIDTH, VIEW_HEIGHT, State.DecodeBuffer, VIEW_WIDTH * 4);
+	Sink += State.DecodeBuffer[0];
+}
+
+
+static void *CreateTile(void *Context, const PIXEL_BUFFER *Image, const TILE_BOUNDS *Bounds)
+{
+	BYTE *Tile = (BYTE *)malloc((SIZE_T)Bounds->Width * Bounds->Height * 4);
+	if (Tile != nullptr) CopyTilePixels(Image, Bounds, Tile);
+	return Tile;
+}
+
+
+static void DestroyTile(void *Context, void *Tile)
+{
+	free(Tile);
+}
+
+
+// Scrolls the view diagonally over the screenshot, getting the visible tiles from the cache, like PaintImage. Cold
+// starts with an empty cache every time, so every tile is created once.
+static void BenchPaintTiles(void *Context)
+{
+	BOOL Cold = Context != nullptr;
+	if (Cold) TileCacheClear(&State.Tiles);
+	TileCacheSetImage(&State.Tiles, State.Screenshot);
+	for (UINT i = 0; i < VIEW_POSITIONS; ++i)
+	{
+		LONGLONG Left = (LONGLONG)(SCREEN_WIDTH - VIEW_WIDTH) * i / VIEW_POSITIONS;
+		LONGLONG Top = (LONGLONG)(SCREEN_HEIGHT - VIEW_HEIGHT) * i / VIEW_POSITIONS;
+		TILE_RANGE Range;
+		if (!GetVisibleTiles(SCREEN_WIDTH, SCREEN_HEIGHT, Left, Top, Left + VIEW_WIDTH, Top + VIEW_HEIGHT, &Range)) continue;
+		for (LONG Row = Range.FirstRow; Row < Range.EndRow; ++Row)
+		{
+			for (LONG Column = Range.FirstColumn; Column < Range.EndColumn; ++Column)
+			{
+				Sink += (UINT_PTR)TileCacheGet(&State.Tiles, Column, Row) & 1;
+			}
+		}
+	}
+}
+
+
+// A span the way the stages of a capture record them one after the other: each begins where the one before ended, so
+// it takes one clock read and the bookkeeping.
+static void BenchTraceSpan(void *Context)
+{
+	if (State.TraceStart == 0) State.TraceStart = TraceBegin();
+	State.TraceStart = TraceEnd("Benchmark", State.TraceStart, 1);
+}
+
+
+// A span on its own: two clock reads.
+static void BenchTraceIsolatedSpan(void *Context)
+{
+	ULONGLONG Start = TraceBegin();
+	TraceEnd("Benchmark", Start, 1);
+}
+
+
+// Only the bookkeeping, without reading the clock.
+static void BenchTraceRecord(void *Context)
+{
+	TraceSpan("Benchmark", 1, 2, 1);
+}
+
+
+static void BenchTraceClock(void *Context)
+{
+	Sink += TraceGetTicks();
+}
+
+
+// Picks the clips from Text, trains the dictionary, and compresses them once, for the decode benchmarks.
+static BOOL PrepareTextClips()
+{
+	DWORD Random = 3;
+	SIZE_T MaxSizeCb = 0;
+	for (UINT i = 0; i < TEXT_CLIP_COUNT; ++i)
+	{
+		SIZE_T Length = GetNextHistoryTextLength(&Random);
+		State.Clips[i] = State.Text + Random % (State.TextLength - Length);
+		State.ClipLengths[i] = Length;
+		State.ClipBytes += Length * sizeof(WCHAR);
+		State.ClipOffsets[i] = MaxSizeCb;
+		MaxSizeCb += TextCodecGetMaxSize(Length);
+	}
+	BYTE *Data = (BYTE *)malloc(TEXT_DICTIONARY_MAX_SIZE);
+	if (Data == nullptr) return false;
+	SIZE_T DictionarySizeCb = TextDictionaryTrain(State.Clips, State.ClipLengths, HISTORY_MAX_ENTRIES, Data, TEXT_DICTIONARY_MAX_SIZE);
+	State.ClipDictionary = TextDictionaryCreate(Data, DictionarySizeCb, 1);
+	free(Data);
+	if (State.ClipDictionary == nullptr || !TextDictionaryPrepareEncoding(State.ClipDictionary)) return false;
+
+	for (UINT d = 0; d < 2; ++d)
+	{
+		State.CompressedClips[d] = (BYTE *)malloc(MaxSizeCb);
+		if (State.CompressedClips[d] == nullptr) return false;
+		for (UINT i = 0; i < TEXT_CLIP_COUNT; ++i)
+		{
+			State.CompressedClipSizes[d][i] = TextCodecEncode(State.Clips[i], State.ClipLengths[i], d != 0 ? State.ClipDictionary : nullptr, State.CompressedClips[d] + State.ClipOffsets[i]);
+		}
+	}
+	return true;
+}
+
+
+static BOOL PreparePayloads()
+{
+	for (UINT i = 0; i < sizeof(DibVariants) / sizeof(DibVariants[0]); ++i)
+	{
+		DibVariants[i].Data = GeneratePackedDIB(&DibVariants[i].Spec, &DibVariants[i].SizeCb);
+		if (DibVariants[i].Data == nullptr) return false;
+	}
+	State.DecodeBuffer = (BYTE *)malloc((SIZE_T)SCREEN_WIDTH * SCREEN_HEIGHT * 4);
+	State.TileBuffer = (BYTE *)malloc(TILE_SIZE * TILE_SIZE * 4);
+	if (State.DecodeBuffer == nullptr || State.TileBuffer == nullptr) return false;
+
+	State.MalformedCount = GenerateMalformedDIBs(20, State.Malformed, MAX_MALFORMED_PAYLOADS);
+	for (UINT i = 0; i < State.MalformedCount; ++i)
+	{
+		State.MalformedBytes += State.Malformed[i].SizeCb;
+	}
+
+	const DIB_VARIANT *Screenshot = &DibVariants[SCREENSHOT_VARIANT];
+	State.Screenshot = PixelBufferCreateFromPackedDIB((const BITMAPINFOHEADER *)Screenshot->Data, Screenshot->SizeCb);
+	State.FlatScreenshot = PixelBufferCreateFromPackedDIB((const BITMAPINFOHEADER *)Screenshot->Data, Screenshot->SizeCb);
+	if (State.Screenshot == nullptr || State.FlatScreenshot == nullptr) return false;
+	for (PIXEL_BUFFER *Level = State.Screenshot; Level != nullptr; Level = MipPyramidAddLevel(Level))
+	{
+	}
+	const DIB_VARIANT *Translucent = &DibVariants[ALPHA_VARIANT];
+	State.TranslucentImage = PixelBufferCreateFromPackedDIB((const BITMAPINFOHEADER *)Translucent->Data, Translucent->SizeCb);
+	State.StraightAlphaPixels = (BYTE *)malloc((SIZE_T)SCREEN_WIDTH * SCREEN_HEIGHT * 4);
+	PACKED_DIB_INFO Info;
+	if (State.TranslucentImage == nullptr || State.StraightAlphaPixels == nullptr || !GetPackedDIBInfo((const BITMAPINFOHEADER *)Translucent->Data, Translucent->SizeCb, &Info)) return false;
+	DecodePackedDIB(&Info, State.StraightAlphaPixels, (SIZE_T)SCREEN_WIDTH * 4);
+	State.HalfSize = PixelBufferCreate((SCREEN_WIDTH + 1) / 2, (SCREEN_HEIGHT + 1) / 2);
+	State.CompressedScreenshot = ImageCodecEncode(State.Screenshot, 1);
+	if (State.HalfSize == nullptr || State.CompressedScreenshot == nullptr) return false;
+
+	State.TextLength = TEXT_LENGTH;
+	State.Text = GenerateText(State.TextLength, 21);
+	if (State.Text == nullptr) return false;
+	State.CompressedText = malloc(TextCodecGetMaxSize(State.TextLength));
+	State.DecompressedText = (WCHAR *)malloc(State.TextLength * sizeof(WCHAR));
+	if (State.CompressedText == nullptr || State.DecompressedText == nullptr) return false;
+	State.CompressedTextSizeCb = TextCodecEncode(State.Text, State.TextLength, nullptr, State.CompressedText);
+	if (!PrepareTextClips()) return false;
+	if (!TextLineIndexBuild(&State.TextIndex, State.Text, State.TextLength, TEXT_TAB_WIDTH)) return false;
+	State.LargeText = GenerateText(LARGE_TEXT_LENGTH, 22);
+	if (State.LargeText == nullptr || !TextLineIndexBuild(&State.LargeTextIndex, State.LargeText, LARGE_TEXT_LENGTH, TEXT_TAB_WIDTH)) return false;
+
+	DWORD Random = 1;
+	for (UINT i = 0; i < HISTORY_APPEND_COUNT; ++i)
+	{
+		State.HistoryAppendBytes += GetNextHistoryTextLength(&Random) * sizeof(WCHAR);
+	}
+	Random = 1;
+	for (UINT i = 0; i < STORE_APPEND_COUNT; ++i)
+	{
+		State.StoreAppendBytes += GetNextHistoryTextLength(&Random) * sizeof(WCHAR);
+	}
+	for (UINT i = 0; i < sizeof(EventTraces) / sizeof(EventTraces[0]); ++i)
+	{
+		if (!GenerateEventTrace(&EventTraces[i])) return false;
+	}
+
+	for (UINT i = 0; i < sizeof(PngVariants) / sizeof(PngVariants[0]); ++i)
+	{
+		PngVariants[i].Data = GeneratePng(&PngVariants[i].Spec, &PngVariants[i].SizeCb);
+		if (PngVariants[i].Data == nullptr) return false;
+	}
+	State.MalformedPngCount = GenerateMalformedPngs(22, State.MalformedPngs, MAX_MALFORMED_PAYLOADS);
+	for (UINT i = 0; i < State.MalformedPngCount; ++i)
+	{
+		State.MalformedPngBytes += State.MalformedPngs[i].SizeCb;
+	}
+	// The IDAT chunks of the screenshot are all in a row, each with a length, type and CRC around it.
+	const PNG_VARIANT *PngScreenshot = &PngVariants[PNG_SCREENSHOT_VARIANT];
+	PNG_INFO PngInfo;
+	if (!GetPngInfo(PngScreenshot->Data, PngScreenshot->SizeCb, &PngInfo)) return false;
+	State.PngStream = (BYTE *)malloc(PngInfo.IdatSizeCb);
+	State.PngFilteredSizeCb = (SIZE_T)SCREEN_HEIGHT * (SCREEN_WIDTH * 4 + 1);
+	State.PngFiltered = (BYTE *)malloc(State.PngFilteredSizeCb + INFLATE_OUTPUT_SLACK);
+	State.UnfilterBuffer = (BYTE *)malloc(2 * ((SIZE_T)SCREEN_WIDTH * 4 + PNG_ROW_SLACK));
+	if (State.PngStream == nullptr || State.PngFiltered == nullptr || State.UnfilterBuffer == nullptr) return false;
+	const BYTE *Chunk = PngInfo.FirstIdat;
+	for (UINT i = 0; i < PngInfo.IdatCount; ++i)
+	{
+		SIZE_T Length = (SIZE_T)Chunk[0] << 24 | (SIZE_T)Chunk[1] << 16 | (SIZE_T)Chunk[2] << 8 | Chunk[3];
+		memcpy(State.PngStream + State.PngStreamSizeCb, Chunk + 8, Length);
+		State.PngStreamSizeCb += Length;
+		Chunk += 12 + Length;
+	}
+	SIZE_T ProducedCb;
+	if (!ZlibInflate(State.PngStream, State.PngStreamSizeCb, State.PngFiltered, State.PngFilteredSizeCb, &ProducedCb, nullptr)) return false;
+
+	State.Html = GenerateHtmlFormat(TEXT_LENGTH, 23, &State.HtmlSizeCb);
+	State.BrokenHtml = State.Html != nullptr ? (BYTE *)malloc(State.HtmlSizeCb) : nullptr;
+	State.Rtf = GenerateRtf(TEXT_LENGTH, 23, &State.RtfSizeCb);
+	if (State.BrokenHtml == nullptr || State.Rtf == nullptr) return false;
+	memcpy(State.BrokenHtml, State.Html, State.HtmlSizeCb);
+	char *StartFragment = strstr((char *)State.BrokenHtml, "StartFragment:");
+	if (StartFragment != nullptr) memcpy(StartFragment + 14, "9999999999", 10);
+	State.MalformedRichTextCount = GenerateMalformedRichText(24, State.MalformedRichText, MAX_MALFORMED_PAYLOADS);
+	for (UINT i = 0; i < State.MalformedRichTextCount; ++i)
+	{
+		State.MalformedRichTextBytes += State.MalformedRichText[i].SizeCb;
+	}
+
+	HexDumpInit(&State.HexDump, Screenshot->Data, Screenshot->SizeCb);
+	FakeClipboardInit(&State.FakeClipboard, &State.FakeBackend);
+	CaptureRegisterFormats(&State.FakeBackend);
+	State.PngFormat = State.FakeBackend.RegisterFormat(State.FakeBackend.Context, "PNG");
+	ClipboardSnapshotInit(&State.Snapshot);
+	TileCacheInit(&State.Tiles, 128 * 1024 * 1024, CreateTile, DestroyTile, nullptr);
+	return true;
+}
+
+
+static void SetFakeClipboard(UINT Format, const void *Data, SIZE_T SizeCb)
+{
+	State.FakeFormats[0].Format = Format;
+	State.FakeFormats[0].Name = nullptr;
+	State.FakeFormats[0].Data = Data;
+	State.FakeFormats[0].SizeCb = SizeCb;
+	FakeClipboardSetFormats(&State.FakeClipboard, State.FakeFormats, 1);
+}
+
+
+static void RunBenchmarks()
+{
+	const DIB_VARIANT *Screenshot = &DibVariants[SCREENSHOT_VARIANT];
+	SIZE_T ScreenshotPixelBytes = (SIZE_T)SCREEN_WIDTH * SCREEN_HEIGHT * 4;
+	SIZE_T TextBytes = State.TextLength * sizeof(WCHAR);
+
+	for (UINT i = 0; i < sizeof(DibVariants) / sizeof(DibVariants[0]); ++i)
+	{
+		Measure(DibVariants[i].Name, DibVariants[i].SizeCb, BenchDecodeDib, &DibVariants[i]);
+	}
+	Measure("decode/dib/malformed", State.MalformedBytes, BenchDecodeMalformedDibs, nullptr);
+	for (UINT i = 0; i < sizeof(PngVariants) / sizeof(PngVariants[0]); ++i)
+	{
+		Measure(PngVariants[i].Name, PngVariants[i].SizeCb, BenchDecodePng, &PngVariants[i]);
+	}
+	const PNG_VARIANT *PngScreenshot = &PngVariants[PNG_SCREENSHOT_VARIANT];
+	Measure("decode/png/rgba/threads", PngScreenshot->SizeCb, BenchDecodePngThreads, (void *)PngScreenshot);
+	Measure("decode/png/rgba-interlaced/threads", PngVariants[4].SizeCb, BenchDecodePngThreads, &PngVariants[4]);
+	Measure("decode/png/malformed", State.MalformedPngBytes, BenchDecodeMalformedPngs, nullptr);
+	Measure("decode/inflate", State.PngStreamSizeCb, BenchInflate, nullptr);
+	static const char *const UnfilterNames[] = { "decode/unfilter/none", "decode/unfilter/sub", "decode/unfilter/up", "decode/unfilter/average", "decode/unfilter/paeth" };
+	static const char *const UnfilterRgbNames[] = { "decode/unfilter/none/rgb", "decode/unfilter/sub/rgb", "decode/unfilter/up/rgb", "decode/unfilter/average/rgb", "decode/unfilter/paeth/rgb" };
+	for (UINT Filter = 0; Filter <= 4; ++Filter)
+	{
+		Measure(UnfilterNames[Filter], ScreenshotPixelBytes, BenchUnfilter, (void *)(UINT_PTR)(Filter | 4 << 8));
+		Measure(UnfilterRgbNames[Filter], ScreenshotPixelBytes, BenchUnfilter, (void *)(UINT_PTR)(Filter | 3 << 8));
+	}
+	Measure("decode/image-codec", ScreenshotPixelBytes, BenchDecodeImage, (void *)(UINT_PTR)1);
+	Measure("decode/image-codec/threads", ScreenshotPixelBytes, BenchDecodeImage, (void *)(UINT_PTR)0);
+	Measure("decode/text-codec", TextBytes, BenchDecodeText, nullptr);
+	Measure("decode/text-codec/clips", State.ClipBytes, BenchDecodeClips, (void *)(UINT_PTR)0);
+	Measure("decode/text-codec/clips/dictionary", State.ClipBytes, BenchDecodeClips, (void *)(UINT_PTR)1);
+	// Only the header is read, so there is no meaningful size.
+	Measure("parse/html-format", 0, BenchParseHtml, State.Html);
+	Measure("parse/html-format/no-offsets", State.HtmlSizeCb, BenchParseHtml, State.BrokenHtml);
+	Measure("parse/rtf/tokens", State.RtfSizeCb, BenchTokenizeRtf, nullptr);
+	Measure("parse/rtf/text", State.RtfSizeCb, BenchExtractRtf, nullptr);
+	Measure("parse/malformed", State.MalformedRichTextBytes, BenchParseMalformedRichText, nullptr);
+
+	SetFakeClipboard(CF_DIB, Screenshot->Data, Screenshot->SizeCb);
+	Measure("copy/snapshot/dib", Screenshot->SizeCb, BenchSnapshotCapture, nullptr);
+	SetFakeClipboard(CF_UNICODETEXT, State.Text, TextBytes + sizeof(WCHAR));
+	Measure("copy/snapshot/text", TextBytes, BenchSnapshotCapture, nullptr);
+	// Like copying a screenshot together with its caption: the image is captured, and the text is inspected.
+	State.FakeFormats[1].Format = CF_DIB;
+	State.FakeFormats[1].Name = nullptr;
+	State.FakeFormats[1].Data = Screenshot->Data;
+	State.FakeFormats[1].SizeCb = Screenshot->SizeCb;
+	FakeClipboardSetFormats(&State.FakeClipboard, State.FakeFormats, 2);
+	Measure("copy/snapshot/dib+inspect-text", Screenshot->SizeCb + TextBytes, BenchSnapshotCapture, (void *)(UINT_PTR)CF_UNICODETEXT);
+	// Like copying an image from a browser: PNG is preferred, so the much larger DIB is never copied.
+	State.FakeFormats[0].Format = State.PngFormat;
+	State.FakeFormats[0].Data = PngScreenshot->Data;
+	State.FakeFormats[0].SizeCb = PngScreenshot->SizeCb;
+	FakeClipboardSetFormats(&State.FakeClipboard, State.FakeFormats, 2);
+	Measure("copy/snapshot/png+dib", PngScreenshot->SizeCb, BenchSnapshotCapture, nullptr);
+	Measure("copy/tile-pixels", ScreenshotPixelBytes, BenchCopyTilePixels, nullptr);
+
+	Measure("hash/content/dib", Screenshot->SizeCb, BenchHashContent, (void *)Screenshot);
+	Measure("hash/content/text", TextBytes, BenchHashText, nullptr);
+	Measure("hash/perceptual", 0, BenchHashPerceptual, State.Screenshot);
+	Measure("hash/perceptual/no-pyramid", ScreenshotPixelBytes, BenchHashPerceptual, State.FlatScreenshot);
+
+	Measure("compress/image-codec", ScreenshotPixelBytes, BenchEncodeImage, (void *)(UINT_PTR)1);
+	Measure("compress/image-codec/threads", ScreenshotPixelBytes, BenchEncodeImage, (void *)(UINT_PTR)0);
+	Measure("compress/text-codec", TextBytes, BenchEncodeText, nullptr);
+	Measure("compress/text-codec/clips", State.ClipBytes, BenchEncodeClips, (void *)(UINT_PTR)0);
+	Measure("compress/text-codec/clips/dictionary", State.ClipBytes, BenchEncodeClips, (void *)(UINT_PTR)1);
+	ReportTextClips();
+	Measure("mip/downsample", ScreenshotPixelBytes, BenchMipDownsample, nullptr);
+	Measure("alpha/classify", ScreenshotPixelBytes, BenchClassifyAlpha, nullptr);
+	Measure("alpha/premultiply", ScreenshotPixelBytes, BenchPremultiplyAlpha, nullptr);
+
+	Measure("index/text-lines", TextBytes, BenchIndexTextLines, &State.TextIndex);
+	Measure("index/text-lines/scalar", TextBytes, BenchIndexTextLinesScalar, nullptr);
+	Measure("index/text-lines/100MB", LARGE_TEXT_LENGTH * sizeof(WCHAR), BenchIndexTextLines, &State.LargeTextIndex);
+	for (UINT i = 0; i < sizeof(TrigramCorpora) / sizeof(TrigramCorpora[0]); ++i)
+	{
+		TRIGRAM_CORPUS *Corpus = &TrigramCorpora[i];
+		if (Corpus->Large && !LargeInputs) continue;
+		// index/trigrams builds the index of the first corpus again and again; the larger ones are built just once.
+		const char *IndexName = i == 0 ? "index/trigrams" : nullptr;
+		BOOL Selected = IsSelected(Corpus->Name) || IsSelected(Corpus->SizeName) || (IndexName != nullptr && IsSelected(IndexName));
+		if (Selected && !ListOnly && !PrepareTrigramCorpus(Corpus))
+		{
+			fprintf(stderr, "Out of memory for %s.\n", Corpus->Name);
+			continue;
+		}
+		if (IndexName != nullptr) Measure(IndexName, Corpus->Length * sizeof(WCHAR), BenchIndexTrigrams, Corpus);
+		Measure(Corpus->Name, 0, BenchSearchTrigrams, Corpus);
+		ReportTrigramIndex(Corpus);
+		FreeTrigramCorpus(Corpus);
+	}
+	Measure("history/append-1M", State.HistoryAppendBytes, BenchHistoryAppend, nullptr);
+	// Writing the store takes a while, so it is only done if it is going to be opened.
+	if (IsSelected("store/open-100k") && !ListOnly && !CreateBenchmarkStore())
+	{
+		fprintf(stderr, "Cannot write the history store for store/open-100k.\n");
+	}
+	Measure("store/open-100k", 0, BenchStoreOpen, nullptr);
+	HistoryStoreDelete(STORE_DIRECTORY);
+	Measure("store/append", State.StoreAppendBytes, BenchStoreAppend, nullptr);
+
+	for (UINT i = 0; i < sizeof(EventTraces) / sizeof(EventTraces[0]); ++i)
+	{
+		Measure(EventTraces[i].Name, 0, BenchCoalesce, &EventTraces[i]);
+		ReportCoalescing(&EventTraces[i]);
+	}
+
+	Measure("paint/text", 0, BenchPaintText, &State.TextIndex);
+	Measure("paint/text/100MB", 0, BenchPaintText, &State.LargeTextIndex);
+	Measure("paint/hex-dump", 0, BenchPaintHexDump, nullptr);
+	static const double Scales[] = { 0.25, 0.6, 3.0 };
+	static const char *const ScaleNames[] = { "paint/zoomed/0.25", "paint/zoomed/0.6", "paint/zoomed/3" };
+	for (UINT i = 0; i < 3; ++i)
+	{
+		Measure(ScaleNames[i], 0, BenchPaintZoomed, (void *)&Scales[i]);
+	}
+	Measure("paint/tiles/warm", 0, BenchPaintTiles, nullptr);
+	Measure("paint/tiles/cold", 0, BenchPaintTiles, (void *)(UINT_PTR)1);
+	Measure("paint/checkerboard", (SIZE_T)VIEW_WIDTH * VIEW_HEIGHT * 4, BenchPaintCheckerboard, nullptr);
+
+	TracerStart();
+	Measure("trace/span", 0, BenchTraceSpan, nullptr);
+	Measure("trace/span/isolated", 0, BenchTraceIsolatedSpan, nullptr);
+	Measure("trace/record", 0, BenchTraceRecord, nullptr);
+	Measure("trace/clock", 0, BenchTraceClock, nullptr);
+	TracerStop();
+	Measure("trace/span/stopped", 0, BenchTraceIsolatedSpan, nullptr);
+	TracerFree();
+}
+
+
+static void FreePayloads()
+{
+	for (UINT i = 0; i < sizeof(DibVariants) / sizeof(DibVariants[0]); ++i)
+	{
+		free(DibVariants[i].Data);
+	}
+	for (UINT i = 0; i < sizeof(PngVariants) / sizeof(PngVariants[0]); ++i)
+	{
+		free(PngVariants[i].Data);
+	}
+	for (UINT i = 0; i < sizeof(EventTraces) / sizeof(EventTraces[0]); ++i)
+	{
+		free(EventTraces[i].TimesUs);
+	}
+	FreeGeneratedPayloads(State.MalformedPngs, State.MalformedPngCount);
+	FreeGeneratedPayloads(State.MalformedRichText, State.MalformedRichTextCount);
+	free(State.Rtf);
+	free(State.BrokenHtml);
+	free(State.Html);
+	free(State.UnfilterBuffer);
+	free(State.PngFiltered);
+	free(State.PngStream);
+	FreeGeneratedPayloads(State.Malformed, State.MalformedCount);
+	TileCacheFree(&State.Tiles);
+	ClipboardSnapshotFree(&State.Snapshot);
+	TextLineIndexFree(&State.LargeTextIndex);
+	free(State.LargeText);
+	TextLineIndexFree(&State.TextIndex);
+	free(State.CompressedClips[0]);
+	free(State.CompressedClips[1]);
+	TextDictionaryFree(State.ClipDictionary);
+	free(State.DecompressedText);
+	free(State.CompressedText);
+	free(State.Text);
+	free(State.CompressedScreenshot);
+	PixelBufferRelease(State.HalfSize);
+	free(State.StraightAlphaPixels);
+	PixelBufferRelease(State.TranslucentImage);
+	PixelBufferRelease(State.FlatScreenshot);
+	PixelBufferRelease(State.Screenshot);
+	free(State.TileBuffer);
+	free(State.DecodeBuffer);
+}
+
+
+int main(int argc, char **argv)
+{
+	static const char FilterOption[] = "/filter:";
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strncmp(argv[i], FilterOption, sizeof(FilterOption) - 1) == 0)
+		{
+			Filter = argv[i] + sizeof(FilterOption) - 1;
+		}
+		else if (strcmp(argv[i], "/quick") == 0)
+		{
+			MinTimeUs = 20 * 1000;
+		}
+		else if (strcmp(argv[i], "/list") == 0)
+		{
+			ListOnly = true;
+		}
+		else if (strcmp(argv[i], "/large") == 0)
+		{
+			LargeInputs = true;
+		}
+		else
+		{
+			fprintf(stderr, "Unknown option: %s\nUsage: %s [/filter:<text>] [/quick] [/list] [/large]\n", argv[i], argv[0]);
+			return 2;
+		}
+	}
+
+	if (!ListOnly && !PreparePayloads())
+	{
+		fprintf(stderr, "Out of memory.\n");
+		FreePayloads();
+		return 1;
+	}
+	RunBenchmarks();
+	if (!ListOnly) FreePayloads();
+	return 0;
+}
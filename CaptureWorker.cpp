@@ -0,0 +1,377 @@
+#include "CaptureWorker.h"
+#include "ClipboardSnapshot.h"
+#include "PixelBuffer.h"
+#include "PackedDIB.h"
+#include "PngDecoder.h"
+#include "ClipboardBackend.h"
+#include "MipPyramid.h"
+#include "PixelAlpha.h"
+#include "ImageCodec.h"
+#include "Tracer.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Rows decoded between checks for cancellation.
+#define DECODE_STRIPE_ROWS 64
+#define RESULT_QUEUE_CAPACITY 8
+
+
+// The formats that can be captured, best first, like for GetPriorityClipboardFormat.
+// PNG comes first where an application offers it next to a DIB (browsers and most image editors do): it is usually a
+// fraction of the size, so the clipboard is held for a shorter time, and unlike in a DIB its alpha channel is always
+// meant as alpha. Its formats are registered ones, filled in by CaptureRegisterFormats; until then they are 0, which
+// never matches.
+// CF_DIBV5 comes before CF_DIB: when an application puts only one of the two on the clipboard, Windows synthesizes the
+// other, and the synthesized CF_DIB loses the alpha channel.
+static UINT CaptureFormats[] =
+{
+	0, // "PNG"
+	0, // "image/png"
+	CF_DIBV5,
+	CF_DIB,
+	CF_UNICODETEXT
+};
+
+// Windows applications use the first, X11 ones the MIME type.
+static const char *const PngFormatNames[] = { "PNG", "image/png" };
+#define PNG_FORMAT_COUNT (sizeof(PngFormatNames) / sizeof(PngFormatNames[0]))
+
+const CLIPBOARD_SNAPSHOT_REQUEST CaptureSnapshotRequest = { CaptureFormats, sizeof(CaptureFormats) / sizeof(CaptureFormats[0]) };
+
+
+// Looks up the registered formats among CaptureFormats. Must be called before taking the first snapshot with
+// CaptureSnapshotRequest.
+void CaptureRegisterFormats(CLIPBOARD_BACKEND *Backend)
+{
+	for (UINT i = 0; i < PNG_FORMAT_COUNT; ++i)
+	{
+		CaptureFormats[i] = Backend->RegisterFormat(Backend->Context, PngFormatNames[i]);
+	}
+}
+
+
+static BOOL IsPngFormat(UINT Format)
+{
+	for (UINT i = 0; i < PNG_FORMAT_COUNT; ++i)
+	{
+		if (CaptureFormats[i] == Format) return true;
+	}
+	return false;
+}
+
+
+// Makes a job of what a snapshot holds for CaptureSnapshotRequest (which was its request number Item). Takes over
+// the arena if the payload starts it, and copies the payload otherwise. Returns null if the clipboard had none of the
+// formats, or if out of memory.
+CAPTURE_JOB *CaptureJobCreateFromSnapshot(CLIPBOARD_SNAPSHOT *Snapshot, UINT Item)
+{
+	if (Item >= Snapshot->ItemCount || Snapshot->Items[Item].Format == 0) return nullptr;
+	const CLIPBOARD_SNAPSHOT_ITEM *Payload = &Snapshot->Items[Item];
+	CAPTURE_JOB *Job = (CAPTURE_JOB *)calloc(1, sizeof(CAPTURE_JOB));
+	if (Job == nullptr) return nullptr;
+
+	// Both are packed DIBs, and are handled the same. PNG is an image too, and only differs in how it is decoded.
+	Job->IsPng = IsPngFormat(Payload->Format);
+	Job->Format = Payload->Format == CF_DIBV5 || Job->IsPng ? CF_DIB : Payload->Format;
+	Job->SizeCb = Payload->SizeCb;
+	if (Payload->Data == Snapshot->Arena)
+	{
+		Job->Data = ClipboardSnapshotTakeArena(Snapshot);
+	}
+	else
+	{
+		// Including the two zero bytes.
+		Job->Data = (BYTE *)malloc(Payload->SizeCb + 2);
+		if (Job->Data != nullptr) memcpy(Job->Data, Payload->Data, Payload->SizeCb + 2);
+	}
+	if (Job->Data == nullptr)
+	{
+		free(Job);
+		return nullptr;
+	}
+	return Job;
+}
+
+
+void CaptureJobFree(CAPTURE_JOB *Job)
+{
+	if (Job == nullptr) return;
+	PixelBufferRelease(Job->Image);
+	free(Job->CompressedImage);
+	free(Job->KnownHashes);
+	free(Job->Data);
+	free(Job);
+}
+
+
+static BOOL IsStale(CAPTURE_WORKER *Worker, const CAPTURE_JOB *Job)
+{
+	return Job->Generation != Worker->Generation.load(std::memory_order_acquire) || Worker->Stopping.load(std::memory_order_relaxed);
+}
+
+
+// Sets *Image to null if the DIB cannot be decoded. Returns false if the job was cancelled.
+static BOOL DecodeDib(CAPTURE_WORKER *Worker, CAPTURE_JOB *Job, PIXEL_BUFFER **Image)
+{
+	*Image = nullptr;
+	PACKED_DIB_INFO Info;
+	if (!GetPackedDIBInfo((const BITMAPINFOHEADER *)Job->Data, Job->SizeCb, &Info)) return true;
+	PIXEL_BUFFER *Decoded = PixelBufferCreate(Info.Width, Info.Height);
+	if (Decoded == nullptr) return true;
+
+	ULONGLONG TraceStart = TraceBegin();
+	// An RLE stream has to be read from its start for every stripe, so it is decoded in one go.
+	BOOL Rle = Info.Compression == BI_RLE4 || Info.Compression == BI_RLE8;
+	LONG StripeRows = Rle ? Info.Height : DECODE_STRIPE_ROWS;
+	for (LONG Row = 0; Row < Info.Height; Row += StripeRows)
+	{
+		if (IsStale(Worker, Job))
+		{
+			PixelBufferRelease(Decoded);
+			return false;
+		}
+		LONG Rows = Info.Height - Row < StripeRows ? Info.Height - Row : StripeRows;
+		DecodePackedDIBRows(&Info, Row, Rows, Decoded->Pixels + Row * Decoded->Stride, Decoded->Stride);
+	}
+	if (Info.HasAlpha)
+	{
+		PrepareDecodedAlpha(Decoded, Info.Masks[3] != 0);
+	}
+	TraceEnd("DecodePackedDIB", TraceStart, Job->SequenceNumber);
+	*Image = Decoded;
+	return true;
+}
+
+
+// Returns false if the job was cancelled.
+static BOOL DecodeImage(CAPTURE_WORKER *Worker, CAPTURE_JOB *Job)
+{
+	PIXEL_BUFFER *Image = nullptr;
+	if (Job->IsPng)
+	{
+		// The rows of a PNG can only be decoded in order, from the start of the compressed data, so it is decoded in
+		// one go, like an RLE bitmap. It comes out premultiplied already.
+		if (IsStale(Worker, Job)) return false;
+		ULONGLONG TraceStart = TraceBegin();
+		PNG_INFO Info;
+		if (GetPngInfo(Job->Data, Job->SizeCb, &Info))
+		{
+			Image = DecodePng(&Info, 0);
+		}
+		TraceEnd("DecodePng", TraceStart, Job->SequenceNumber);
+	}
+	else if (!DecodeDib(Worker, Job, &Image))
+	{
+		return false;
+	}
+
+	if (Image != nullptr)
+	{
+		// The levels for drawing the image zoomed out; see MipPyramid.h.
+		ULONGLONG TraceStart = TraceBegin();
+		for (PIXEL_BUFFER *Level = Image; Level != nullptr; Level = MipPyramidAddLevel(Level))
+		{
+			if (IsStale(Worker, Job))
+			{
+				PixelBufferRelease(Image);
+				return false;
+			}
+		}
+		TraceStart = TraceEnd("MipPyramid", TraceStart, Job->SequenceNumber);
+		// The history only keeps the compressed image. This also computes the perceptual hash.
+		Job->CompressedImage = ImageCodecEncode(Image, 0);
+		TraceEnd("CompressImage", TraceStart, Job->SequenceNumber);
+		if (Job->CompressedImage == nullptr)
+		{
+			PixelBufferRelease(Image);
+			return true;
+		}
+		Job->Image = Image;
+	}
+
+	// The raw data is not needed anymore once the image is decoded. It is kept otherwise, so that the UI can show it in
+	// hex.
+	if (Job->Image != nullptr)
+	{
+		free(Job->Data);
+		Job->Data = nullptr;
+		Job->SizeCb = 0;
+	}
+	return true;
+}
+
+
+static BOOL IsKnownHash(const CAPTURE_JOB *Job)
+{
+	for (UINT i = 0; i < Job->KnownHashCount; ++i)
+	{
+		if (ContentHashEqual(&Job->KnownHashes[i], &Job->Hash)) return true;
+	}
+	return false;
+}
+
+
+static void ProcessJob(CAPTURE_WORKER *Worker, CAPTURE_JOB *Job)
+{
+	ULONGLONG TraceStart = TraceBegin();
+	switch (Job->Format)
+	{
+		case CF_DIB:
+		{
+			ComputeContentHash(Job->Data, Job->SizeCb, &Job->Hash);
+			Job->HashedSizeCb = Job->SizeCb;
+			TraceEnd("ContentHash", TraceStart, Job->SequenceNumber);
+			// Copying the same image again is common, and decoding it would only produce what the UI has already.
+			Job->IsKnown = IsKnownHash(Job);
+			if (!Job->IsKnown && !DecodeImage(Worker, Job))
+			{
+				TraceEnd("DecodeCapture (cancelled)", TraceStart, Job->SequenceNumber);
+				++Worker->JobsCancelled;
+				CaptureJobFree(Job);
+				return;
+			}
+			break;
+		}
+		case CF_UNICODETEXT:
+		{
+			// Clipboard text is terminated by a 0, but the allocation may be larger than the text.
+			const WCHAR *Text = (const WCHAR *)Job->Data;
+			SIZE_T MaxLength = Job->SizeCb / sizeof(WCHAR);
+			SIZE_T Length = 0;
+			while (Length < MaxLength && Text[Length] != 0) ++Length;
+			Job->SizeCb = Length * sizeof(WCHAR);
+			ComputeContentHash(Job->Data, Job->SizeCb, &Job->Hash);
+			Job->HashedSizeCb = Job->SizeCb;
+			TraceEnd("ContentHash", TraceStart, Job->SequenceNumber);
+			break;
+		}
+	}
+	TraceEnd("DecodeCapture", TraceStart, Job->SequenceNumber);
+
+	// The UI normally drains the queue as soon as it is notified, so it is only ever full for a moment.
+	while (!SpscQueuePush(&Worker->Results, Job))
+	{
+		if (IsStale(Worker, Job))
+		{
+			++Worker->JobsCancelled;
+			CaptureJobFree(Job);
+			return;
+		}
+		std::this_thread::yield();
+	}
+	++Worker->JobsCompleted;
+	Worker->Notify(Worker->NotifyContext);
+}
+
+
+static void WorkerThread(CAPTURE_WORKER *Worker)
+{
+	TracerSetThreadName("CaptureWorker");
+	for (;;)
+	{
+		{
+			std::unique_lock<std::mutex> Lock(Worker->WakeLock);
+			while (!Worker->WakeRequested)
+			{
+				Worker->WakeCondition.wait(Lock);
+			}
+			Worker->WakeRequested = false;
+		}
+		if (Worker->Stopping.load()) break;
+
+		CAPTURE_JOB *Job = Worker->PendingJob.exchange(nullptr, std::memory_order_acquire);
+		if (Job != nullptr)
+		{
+			if (IsStale(Worker, Job))
+			{
+				++Worker->JobsCancelled;
+				CaptureJobFree(Job);
+			}
+			else
+			{
+				ProcessJob(Worker, Job);
+			}
+		}
+	}
+}
+
+
+static void WakeWorker(CAPTURE_WORKER *Worker)
+{
+	{
+		std::lock_guard<std::mutex> Lock(Worker->WakeLock);
+		Worker->WakeRequested = true;
+	}
+	Worker->WakeCondition.notify_one();
+}
+
+
+BOOL CaptureWorkerStart(CAPTURE_WORKER *Worker, void (*Notify)(void *Context), void *NotifyContext)
+{
+	if (!SpscQueueInit(&Worker->Results, RESULT_QUEUE_CAPACITY)) return false;
+	Worker->Notify = Notify;
+	Worker->NotifyContext = NotifyContext;
+	Worker->PendingJob.store(nullptr);
+	Worker->Generation.store(0);
+	Worker->WakeRequested = false;
+	Worker->Stopping.store(false);
+	Worker->JobsCompleted.store(0);
+	Worker->JobsCancelled.store(0);
+	Worker->Thread = std::thread(WorkerThread, Worker);
+	return true;
+}
+
+
+// Waits for the worker thread to exit, and frees all jobs that have not been picked up by the UI.
+void CaptureWorkerStop(CAPTURE_WORKER *Worker)
+{
+	if (!Worker->Thread.joinable()) return;
+	Worker->Stopping.store(true);
+	WakeWorker(Worker);
+	Worker->Thread.join();
+
+	CaptureJobFree(Worker->PendingJob.exchange(nullptr));
+	void *Item;
+	while (SpscQueuePop(&Worker->Results, &Item))
+	{
+		CaptureJobFree((CAPTURE_JOB *)Item);
+	}
+	SpscQueueFree(&Worker->Results);
+}
+
+
+// Takes ownership of the job. Must always be called from the same thread as CaptureWorkerGetResult.
+void CaptureWorkerSubmit(CAPTURE_WORKER *Worker, CAPTURE_JOB *Job)
+{
+	Job->Generation = Worker->Generation.fetch_add(1) + 1;
+	CAPTURE_JOB *Replaced = Worker->PendingJob.exchange(Job, std::memory_order_acq_rel);
+	if (Replaced != nullptr)
+	{
+		// Never started.
+		++Worker->JobsCancelled;
+		CaptureJobFree(Replaced);
+	}
+	WakeWorker(Worker);
+}
+
+
+// Drops everything that has been submitted so far, e.g. because the clipboard now contains something that is not
+// captured at all.
+void CaptureWorkerCancel(CAPTURE_WORKER *Worker)
+{
+	Worker->Generation.fetch_add(1);
+}
+
+
+// Returns the next finished job, or null. Results of cancelled jobs are skipped. The caller owns the returned job.
+CAPTURE_JOB *CaptureWorkerGetResult(CAPTURE_WORKER *Worker)
+{
+	void *Item;
+	while (SpscQueuePop(&Worker->Results, &Item))
+	{
+		CAPTURE_JOB *Job = (CAPTURE_JOB *)Item;
+		if (Job->Generation == Worker->Generation.load(std::memory_order_relaxed)) return Job;
+		CaptureJobFree(Job);
+	}
+	return nullptr;
+}
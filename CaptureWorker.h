@@ -0,0 +1,88 @@
+#pragma once
+
+#include "Portable.h"
+#include "ContentHash.h"
+#include "SpscQueue.h"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+struct CLIPBOARD_BACKEND;
+struct CLIPBOARD_SNAPSHOT;
+struct CLIPBOARD_SNAPSHOT_REQUEST;
+struct PIXEL_BUFFER;
+struct COMPRESSED_IMAGE;
+struct CAPTURE_JOB;
+struct CAPTURE_WORKER;
+
+// Turns raw clipboard snapshots into displayable content on a background thread.
+//
+// The UI thread takes a snapshot of the clipboard (see ClipboardSnapshot.h) with CaptureSnapshotRequest among its
+// requests, turns it into a CAPTURE_JOB once the clipboard is closed again, and submits the job. The worker
+// hashes and decodes it, and hands the finished job back through a lock-free queue; Notify is called (on the worker
+// thread) whenever something was added. Submitting a job cancels all older jobs, including one that is being decoded,
+// so only the newest clipboard content ever reaches the UI. Images the UI already has are not decoded at all: it can
+// list their hashes in the job, and the worker hands such a job back right after hashing it.
+//
+// Images are captured as PNG where the clipboard has it, which needs CaptureRegisterFormats to be called first.
+
+extern const CLIPBOARD_SNAPSHOT_REQUEST CaptureSnapshotRequest;
+
+extern void                CaptureRegisterFormats(CLIPBOARD_BACKEND *Backend);
+extern CAPTURE_JOB        *CaptureJobCreateFromSnapshot(CLIPBOARD_SNAPSHOT *Snapshot, UINT Item);
+extern void                CaptureJobFree(CAPTURE_JOB *Job);
+extern BOOL                CaptureWorkerStart(CAPTURE_WORKER *Worker, void (*Notify)(void *Context), void *NotifyContext);
+extern void                CaptureWorkerStop(CAPTURE_WORKER *Worker);
+extern void                CaptureWorkerSubmit(CAPTURE_WORKER *Worker, CAPTURE_JOB *Job);
+extern void                CaptureWorkerCancel(CAPTURE_WORKER *Worker);
+extern CAPTURE_JOB        *CaptureWorkerGetResult(CAPTURE_WORKER *Worker);
+
+struct CAPTURE_JOB
+{
+	ULONGLONG Generation; // Assigned by CaptureWorkerSubmit.
+	UINT Format;          // CF_DIB or CF_UNICODETEXT.
+	BOOL IsPng;           // For CF_DIB: the payload is a PNG file rather than a packed DIB.
+	DWORD SequenceNumber;
+	LONGLONG Timestamp;
+	ULONGLONG TraceStartTicks; // When the change was noticed, for tracing the whole capture (see Tracer.h), or 0.
+	ULONGLONG ClipboardHoldUs; // How long the clipboard was open to take the snapshot, for reporting.
+	// Hashes of images that the UI has already, set before submitting (or null). Owned by the job.
+	CONTENT_HASH *KnownHashes;
+	UINT KnownHashCount;
+
+	// The raw payload, followed by two zero bytes. For text, the worker cuts SizeCb down to the actual text length.
+	// For images, it is freed once the image has been decoded and compressed.
+	BYTE *Data;
+	SIZE_T SizeCb;
+
+	// Filled in by the worker.
+	CONTENT_HASH Hash;    // Of the raw payload (of the text only, for CF_UNICODETEXT).
+	SIZE_T HashedSizeCb;  // The size of what Hash covers.
+	PIXEL_BUFFER *Image;  // The decoded image, or null if it could not be decoded. Owned by the job.
+	COMPRESSED_IMAGE *CompressedImage; // Image, compressed for the history; see ImageCodec.h. Owned by the job.
+	BOOL IsKnown;         // Hash is one of KnownHashes, so nothing was decoded; Data is still there.
+};
+
+struct CAPTURE_WORKER
+{
+	std::thread Thread;
+	void (*Notify)(void *Context);
+	void *NotifyContext;
+
+	// The newest submitted job that the worker has not picked up yet. Replaced, not queued, by newer submissions.
+	std::atomic<CAPTURE_JOB *> PendingJob;
+	// The generation of the newest submitted job. Anything older is stale and gets dropped.
+	std::atomic<ULONGLONG> Generation;
+	// Finished jobs, worker to UI.
+	SPSC_QUEUE Results;
+
+	// Only used to put the worker to sleep while there is nothing to do.
+	std::mutex WakeLock;
+	std::condition_variable WakeCondition;
+	BOOL WakeRequested;
+	std::atomic<BOOL> Stopping;
+
+	std::atomic<LONGLONG> JobsCompleted;
+	std::atomic<LONGLONG> JobsCancelled;
+};
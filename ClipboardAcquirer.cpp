@@ -0,0 +1,119 @@
+#include "ClipboardAcquirer.h"
+#include "ClipboardBackend.h"
+#include "Tracer.h"
+#include <string.h>
+
+void ClipboardAcquirerInit(CLIPBOARD_ACQUIRER *Acquirer, CLIPBOARD_BACKEND *Backend, const CLIPBOARD_ACQUIRER_CONFIG *Config, DWORD RandomSeed)
+{
+	memset(Acquirer, 0, sizeof(*Acquirer));
+	Acquirer->Backend = Backend;
+	Acquirer->Config = *Config;
+	Acquirer->RandomState = RandomSeed != 0 ? RandomSeed : 0x2545F491;
+}
+
+
+// xorshift32; only used for jitter.
+static DWORD NextRandom(CLIPBOARD_ACQUIRER *Acquirer)
+{
+	DWORD x = Acquirer->RandomState;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	Acquirer->RandomState = x;
+	return x;
+}
+
+
+static ULONGLONG ApplyJitter(CLIPBOARD_ACQUIRER *Acquirer, ULONGLONG DelayUs)
+{
+	UINT Percent = Acquirer->Config.JitterPercent;
+	if (Percent == 0 || DelayUs == 0) return DelayUs;
+	if (Percent > 100) Percent = 100;
+	ULONGLONG Range = DelayUs * Percent / 100;
+	ULONGLONG Offset = Range > 0 ? NextRandom(Acquirer) % (2 * Range + 1) : 0;
+	return DelayUs - Range + Offset;
+}
+
+
+static void EndAcquisition(CLIPBOARD_ACQUIRER *Acquirer, ULONGLONG NowUs, BOOL Succeeded)
+{
+	Acquirer->Pending = false;
+	Acquirer->LastSucceeded = Succeeded;
+	Acquirer->LastAttempts = Acquirer->Attempts;
+	Acquirer->LastDurationUs = NowUs - Acquirer->StartUs;
+}
+
+
+static ACQUIRE_RESULT Attempt(CLIPBOARD_ACQUIRER *Acquirer, ULONGLONG NowUs, ULONGLONG *RetryDelayUs)
+{
+	++Acquirer->Attempts;
+	ULONGLONG TraceStart = TraceBegin();
+	BOOL Opened = Acquirer->Backend->Open(Acquirer->Backend->Context);
+	TraceEnd(Opened ? "OpenClipboard" : "OpenClipboard (busy)", TraceStart, 0);
+	if (Opened)
+	{
+		Acquirer->OpenedUs = NowUs;
+		EndAcquisition(Acquirer, NowUs, true);
+		return ACQUIRE_OPENED;
+	}
+
+	// This can fail if the clipboard is currently being accessed by another application.
+	// A zero delay would read as "already pending" to the caller, which then never retries.
+	ULONGLONG Delay = ApplyJitter(Acquirer, Acquirer->NextDelayUs);
+	if (Delay == 0) Delay = 1;
+	if (Acquirer->Attempts >= Acquirer->Config.MaxAttempts || NowUs + Delay - Acquirer->StartUs > Acquirer->Config.MaxWaitUs)
+	{
+		EndAcquisition(Acquirer, NowUs, false);
+		return ACQUIRE_FAILED;
+	}
+
+	Acquirer->NextDelayUs *= 2;
+	if (Acquirer->NextDelayUs > Acquirer->Config.MaxDelayUs)
+	{
+		Acquirer->NextDelayUs = Acquirer->Config.MaxDelayUs;
+	}
+	*RetryDelayUs = Delay;
+	return ACQUIRE_RETRY;
+}
+
+
+// Makes the first attempt. If an acquisition is already pending, this simply returns ACQUIRE_RETRY with the remaining
+// schedule unchanged; the caller should keep its existing timer.
+ACQUIRE_RESULT ClipboardAcquirerBegin(CLIPBOARD_ACQUIRER *Acquirer, ULONGLONG NowUs, ULONGLONG *RetryDelayUs)
+{
+	*RetryDelayUs = 0;
+	if (Acquirer->Pending) return ACQUIRE_RETRY;
+
+	Acquirer->Pending = true;
+	Acquirer->Attempts = 0;
+	Acquirer->StartUs = NowUs;
+	Acquirer->NextDelayUs = Acquirer->Config.InitialDelayUs;
+	return Attempt(Acquirer, NowUs, RetryDelayUs);
+}
+
+
+ACQUIRE_RESULT ClipboardAcquirerRetry(CLIPBOARD_ACQUIRER *Acquirer, ULONGLONG NowUs, ULONGLONG *RetryDelayUs)
+{
+	*RetryDelayUs = 0;
+	if (!Acquirer->Pending) return ACQUIRE_FAILED;
+	return Attempt(Acquirer, NowUs, RetryDelayUs);
+}
+
+
+void ClipboardAcquirerRelease(CLIPBOARD_ACQUIRER *Acquirer, ULONGLONG NowUs)
+{
+	Acquirer->Backend->Close(Acquirer->Backend->Context);
+	Acquirer->LastHoldUs = NowUs - Acquirer->OpenedUs;
+}
+
+
+void ClipboardAcquirerCancel(CLIPBOARD_ACQUIRER *Acquirer)
+{
+	Acquirer->Pending = false;
+}
+
+
+BOOL ClipboardAcquirerIsPending(const CLIPBOARD_ACQUIRER *Acquirer)
+{
+	return Acquirer->Pending;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Portable.h"
+
+struct CLIPBOARD_BACKEND;
+struct CLIPBOARD_ACQUIRER;
+struct CLIPBOARD_ACQUIRER_CONFIG;
+
+// Opens the clipboard without ever waiting for it. If it is held by another process, the acquirer tells the caller
+// how long to wait before the next attempt (exponential backoff with jitter), and the caller is expected to come back
+// by then, e.g. with a timer. Time is passed in by the caller, in microseconds.
+//
+// Once opened, the caller closes the clipboard with ClipboardAcquirerRelease, which also measures how long it was held,
+// i.e. how long every other application had to wait for it.
+
+enum ACQUIRE_RESULT
+{
+	ACQUIRE_OPENED,  // The clipboard is open; the caller must close it with ClipboardAcquirerRelease.
+	ACQUIRE_RETRY,   // Call ClipboardAcquirerRetry after *RetryDelayUs, which is never 0 unless a timer is already set.
+	ACQUIRE_FAILED,  // Gave up.
+};
+
+extern void                ClipboardAcquirerInit(CLIPBOARD_ACQUIRER *Acquirer, CLIPBOARD_BACKEND *Backend, const CLIPBOARD_ACQUIRER_CONFIG *Config, DWORD RandomSeed);
+extern ACQUIRE_RESULT      ClipboardAcquirerBegin(CLIPBOARD_ACQUIRER *Acquirer, ULONGLONG NowUs, ULONGLONG *RetryDelayUs);
+extern ACQUIRE_RESULT      ClipboardAcquirerRetry(CLIPBOARD_ACQUIRER *Acquirer, ULONGLONG NowUs, ULONGLONG *RetryDelayUs);
+extern void                ClipboardAcquirerRelease(CLIPBOARD_ACQUIRER *Acquirer, ULONGLONG NowUs);
+extern void                ClipboardAcquirerCancel(CLIPBOARD_ACQUIRER *Acquirer);
+extern BOOL                ClipboardAcquirerIsPending(const CLIPBOARD_ACQUIRER *Acquirer);
+
+struct CLIPBOARD_ACQUIRER_CONFIG
+{
+	UINT MaxAttempts;
+	ULONGLONG MaxWaitUs;       // Gives up once this much time has passed since the first attempt.
+	ULONGLONG InitialDelayUs;  // Delay after the first failed attempt; doubles after every further one.
+	ULONGLONG MaxDelayUs;
+	UINT JitterPercent;        // Every delay is randomly changed by up to this many percent, in either direction.
+};
+
+struct CLIPBOARD_ACQUIRER
+{
+	CLIPBOARD_BACKEND *Backend;
+	CLIPBOARD_ACQUIRER_CONFIG Config;
+	DWORD RandomState;
+
+	BOOL Pending;
+	UINT Attempts;
+	ULONGLONG StartUs;
+	ULONGLONG NextDelayUs;
+	ULONGLONG OpenedUs;
+
+	// Statistics of the last acquisition that ended (successfully or not).
+	BOOL LastSucceeded;
+	UINT LastAttempts;
+	ULONGLONG LastDurationUs;
+	ULONGLONG LastHoldUs;      // From the attempt that opened the clipboard to ClipboardAcquirerRelease.
+};
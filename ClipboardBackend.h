@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Portable.h"
+
+// The operations the monitor needs from a clipboard, so that the logic on top of them can run against something other
+// than the Win32 clipboard (see FakeClipboardBackend.h).
+// None of these may block; in particular, Open only tries once.
+// Everything except Open, GetSequenceNumber, GetFormatName and RegisterFormat may only be called while the clipboard is open. Other
+// applications cannot use the clipboard while it is open, so everything else should happen after closing it; see
+// ClipboardSnapshot.h.
+struct CLIPBOARD_BACKEND
+{
+	void *Context;
+
+	// Returns false if the clipboard is currently held by someone else.
+	BOOL (*Open)(void *Context);
+	void (*Close)(void *Context);
+	// Changes whenever the clipboard content changes. 0 means unknown.
+	DWORD (*GetSequenceNumber)(void *Context);
+
+	// Returns the format after Format, in the order they were put on the clipboard. Pass 0 to get the first one.
+	// Returns 0 after the last one.
+	UINT (*EnumFormats)(void *Context, UINT Format);
+	// Standard formats get their CF_ name. Returns false if the format has no name.
+	BOOL (*GetFormatName)(void *Context, UINT Format, WCHAR *Name, UINT NameLength);
+	// Returns the format for a format name that is not a standard one (e.g. "PNG"), registering it if needed, or 0 if
+	// that fails.
+	UINT (*RegisterFormat)(void *Context, const char *Name);
+	// Makes the payload of a format readable, in place where possible, until UnlockData is called with what this
+	// returned. This is the only call that makes the owner of the clipboard render delayed formats. Returns null if the
+	// format is not available, or is not a block of memory (e.g. CF_BITMAP).
+	const BYTE *(*LockData)(void *Context, UINT Format, SIZE_T *SizeCb);
+	void (*UnlockData)(void *Context, UINT Format, const BYTE *Data);
+};
@@ -0,0 +1,322 @@
+#include "ClipboardHistory.h"
+#include "ImageCodec.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Room for the two zero bytes behind every payload, rounded so that allocations stay 8 byte aligned.
+static SIZE_T ArenaAllocationSize(SIZE_T SizeCb)
+{
+	return (SizeCb + 2 + 7) & ~(SIZE_T)7;
+}
+
+
+BOOL ClipboardHistoryInit(CLIPBOARD_HISTORY *History, UINT MaxEntries, SIZE_T ArenaSize, SIZE_T ByteBudget)
+{
+	memset(History, 0, sizeof(*History));
+	if (MaxEntries == 0) return false;
+	ArenaSize &= ~(SIZE_T)7;
+	History->Entries = (HISTORY_ENTRY *)calloc(MaxEntries, sizeof(HISTORY_ENTRY));
+	History->Arena = ArenaSize > 0 ? (BYTE *)malloc(ArenaSize) : nullptr;
+	if (History->Entries == nullptr || (ArenaSize > 0 && History->Arena == nullptr))
+	{
+		ClipboardHistoryFree(History);
+		return false;
+	}
+	History->MaxEntries = MaxEntries;
+	History->ArenaSize = ArenaSize;
+	History->ByteBudget = ByteBudget;
+	History->NextId = 1;
+	return true;
+}
+
+
+static void EvictOldest(CLIPBOARD_HISTORY *History)
+{
+	HISTORY_ENTRY *Entry = &History->Entries[History->First];
+	if (Entry->OutsideArena)
+	{
+		free((void *)Entry->Data);
+	}
+	else
+	{
+		History->ArenaUsed -= Entry->ArenaCharge;
+		History->ArenaTail = Entry->ArenaOffset + ArenaAllocationSize(Entry->SizeCb);
+		if (History->ArenaTail == History->ArenaSize) History->ArenaTail = 0;
+	}
+	free(Entry->Image);
+	History->BytesUsed -= Entry->BudgetCharge;
+	memset(Entry, 0, sizeof(*Entry));
+
+	History->First = (History->First + 1) % History->MaxEntries;
+	--History->Count;
+	if (History->ArenaUsed == 0)
+	{
+		// Nothing left in the arena; start over at the beginning to get the largest possible contiguous space.
+		History->ArenaHead = 0;
+		History->ArenaTail = 0;
+	}
+}
+
+
+void ClipboardHistoryClear(CLIPBOARD_HISTORY *History)
+{
+	while (History->Count > 0)
+	{
+		EvictOldest(History);
+	}
+}
+
+
+void ClipboardHistoryFree(CLIPBOARD_HISTORY *History)
+{
+	if (History->Entries != nullptr)
+	{
+		ClipboardHistoryClear(History);
+	}
+	free(History->Entries);
+	free(History->Arena);
+	memset(History, 0, sizeof(*History));
+}
+
+
+// Finds room for Size bytes in the arena without evicting anything. Returns false if there is no contiguous space.
+static BOOL TryAllocateInArena(const CLIPBOARD_HISTORY *History, SIZE_T Size, SIZE_T *Offset, SIZE_T *Charge)
+{
+	SIZE_T Head = History->ArenaHead;
+	SIZE_T Tail = History->ArenaTail;
+	BOOL Full = Head == Tail && History->ArenaUsed > 0;
+	if (Full) return false;
+
+	if (Head >= Tail)
+	{
+		// Free space is [Head, ArenaSize) and [0, Tail).
+		if (History->ArenaSize - Head >= Size)
+		{
+			*Offset = Head;
+			*Charge = Size;
+			return true;
+		}
+		if (Tail >= Size)
+		{
+			*Offset = 0;
+			*Charge = (History->ArenaSize - Head) + Size;
+			return true;
+		}
+		return false;
+	}
+
+	// Free space is [Head, Tail).
+	if (Tail - Head >= Size)
+	{
+		*Offset = Head;
+		*Charge = Size;
+		return true;
+	}
+	return false;
+}
+
+
+// Takes over Image (if any). Returns null if the entry does not fit into ByteBudget even with an empty history; in
+// that case, Image is freed.
+const HISTORY_ENTRY *ClipboardHistoryAppend(CLIPBOARD_HISTORY *History, UINT Format, const void *Data, SIZE_T SizeCb, COMPRESSED_IMAGE *Image, const CONTENT_HASH *Hash, LONGLONG Timestamp)
+{
+	SIZE_T AllocationSize = ArenaAllocationSize(SizeCb);
+	SIZE_T BudgetCharge = AllocationSize + (Image != nullptr ? ImageCodecGetSize(Image) : 0);
+	if (BudgetCharge > History->ByteBudget || AllocationSize < SizeCb)
+	{
+		free(Image);
+		return nullptr;
+	}
+	BOOL OutsideArena = AllocationSize > History->ArenaSize;
+
+	while (History->Count == History->MaxEntries || History->BytesUsed + BudgetCharge > History->ByteBudget)
+	{
+		EvictOldest(History);
+	}
+
+	SIZE_T Offset = 0;
+	SIZE_T Charge = 0;
+	BYTE *Destination;
+	if (OutsideArena)
+	{
+		Destination = (BYTE *)malloc(AllocationSize);
+		if (Destination == nullptr)
+		{
+			free(Image);
+			return nullptr;
+		}
+	}
+	else
+	{
+		while (!TryAllocateInArena(History, AllocationSize, &Offset, &Charge))
+		{
+			// Cannot run dry: with an empty arena, there is always room for anything up to ArenaSize.
+			EvictOldest(History);
+		}
+		Destination = History->Arena + Offset;
+		History->ArenaHead = Offset + AllocationSize;
+		if (History->ArenaHead == History->ArenaSize) History->ArenaHead = 0;
+		History->ArenaUsed += Charge;
+	}
+
+	if (SizeCb > 0)
+	{
+		memcpy(Destination, Data, SizeCb);
+	}
+	Destination[SizeCb] = 0;
+	Destination[SizeCb + 1] = 0;
+
+	HISTORY_ENTRY *Entry = &History->Entries[(History->First + History->Count) % History->MaxEntries];
+	Entry->Id = History->NextId++;
+	Entry->Format = Format;
+	Entry->Timestamp = Timestamp;
+	Entry->Hash = *Hash;
+	Entry->Data = Destination;
+	Entry->SizeCb = SizeCb;
+	Entry->Image = Image;
+	Entry->StoredIndex = HISTORY_NOT_STORED;
+	Entry->ArenaOffset = Offset;
+	Entry->ArenaCharge = Charge;
+	Entry->BudgetCharge = BudgetCharge;
+	Entry->OutsideArena = OutsideArena;
+	History->BytesUsed += BudgetCharge;
+	++History->Count;
+	return Entry;
+}
+
+
+static UINT SlotFromIndex(const CLIPBOARD_HISTORY *History, UINT Index)
+{
+	return (History->First + History->Count - 1 - Index) % History->MaxEntries;
+}
+
+
+// Removes an entry from anywhere in the history. This is O(MaxEntries), unlike evicting.
+// The arena space of the entry is merged into the next newer arena allocation, and so is reclaimed when that one is
+// evicted. If there is no newer arena allocation, the space is given back right away.
+void ClipboardHistoryRemove(CLIPBOARD_HISTORY *History, UINT Index)
+{
+	if (Index >= History->Count) return;
+	if (Index == History->Count - 1)
+	{
+		EvictOldest(History);
+		return;
+	}
+
+	HISTORY_ENTRY *Entry = &History->Entries[SlotFromIndex(History, Index)];
+	if (Entry->OutsideArena)
+	{
+		free((void *)Entry->Data);
+	}
+	else
+	{
+		HISTORY_ENTRY *Newer = nullptr;
+		for (UINT i = Index; i-- > 0;)
+		{
+			HISTORY_ENTRY *Candidate = &History->Entries[SlotFromIndex(History, i)];
+			if (!Candidate->OutsideArena)
+			{
+				Newer = Candidate;
+				break;
+			}
+		}
+		if (Newer != nullptr)
+		{
+			Newer->ArenaCharge += Entry->ArenaCharge;
+		}
+		else
+		{
+			// This is the newest allocation in the arena. Roll the head back to where it was before it was made: its charge
+			// covers everything from there up to its end, the gap of a wrap-around as well as the space of removed entries
+			// merged into it.
+			SIZE_T End = Entry->ArenaOffset + ArenaAllocationSize(Entry->SizeCb);
+			History->ArenaHead = End >= Entry->ArenaCharge ? End - Entry->ArenaCharge : End + History->ArenaSize - Entry->ArenaCharge;
+			History->ArenaUsed -= Entry->ArenaCharge;
+			if (History->ArenaUsed == 0)
+			{
+				History->ArenaHead = 0;
+				History->ArenaTail = 0;
+			}
+		}
+	}
+	free(Entry->Image);
+	History->BytesUsed -= Entry->BudgetCharge;
+
+	// Close the hole by moving the newer entries back by one slot.
+	for (UINT i = Index; i > 0; --i)
+	{
+		History->Entries[SlotFromIndex(History, i)] = History->Entries[SlotFromIndex(History, i - 1)];
+	}
+	memset(&History->Entries[SlotFromIndex(History, 0)], 0, sizeof(HISTORY_ENTRY));
+	--History->Count;
+}
+
+
+// Looks for an entry with the same format and content hash. Index receives its index (0 is the newest entry).
+BOOL ClipboardHistoryFind(const CLIPBOARD_HISTORY *History, UINT Format, const CONTENT_HASH *Hash, UINT *Index)
+{
+	for (UINT i = 0; i < History->Count; ++i)
+	{
+		const HISTORY_ENTRY *Entry = &History->Entries[SlotFromIndex(History, i)];
+		if (Entry->Format == Format && ContentHashEqual(&Entry->Hash, Hash))
+		{
+			*Index = i;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+// Ids increase from the oldest to the newest entry, so this is a binary search.
+BOOL ClipboardHistoryFindId(const CLIPBOARD_HISTORY *History, ULONGLONG Id, UINT *Index)
+{
+	UINT Newer = 0;
+	UINT Older = History->Count;
+	while (Newer < Older)
+	{
+		UINT Middle = Newer + (Older - Newer) / 2;
+		ULONGLONG MiddleId = History->Entries[SlotFromIndex(History, Middle)].Id;
+		if (MiddleId == Id)
+		{
+			*Index = Middle;
+			return true;
+		}
+		if (MiddleId > Id) Newer = Middle + 1;
+		else Older = Middle;
+	}
+	return false;
+}
+
+
+// Index 0 is the newest entry.
+const HISTORY_ENTRY *ClipboardHistoryGet(const CLIPBOARD_HISTORY *History, UINT Index)
+{
+	if (Index >= History->Count) return nullptr;
+	return &History->Entries[SlotFromIndex(History, Index)];
+}
+
+
+UINT ClipboardHistoryCount(const CLIPBOARD_HISTORY *History)
+{
+	return History->Count;
+}
+
+
+// Index 0 is the newest entry.
+void ClipboardHistorySetStoredIndex(CLIPBOARD_HISTORY *History, UINT Index, ULONGLONG StoredIndex)
+{
+	if (Index >= History->Count) return;
+	History->Entries[SlotFromIndex(History, Index)].StoredIndex = StoredIndex;
+}
+
+
+// Index 0 is the newest entry. The entry keeps its charge against ByteBudget until it is removed.
+COMPRESSED_IMAGE *ClipboardHistoryTakeImage(CLIPBOARD_HISTORY *History, UINT Index)
+{
+	if (Index >= History->Count) return nullptr;
+	HISTORY_ENTRY *Entry = &History->Entries[SlotFromIndex(History, Index)];
+	COMPRESSED_IMAGE *Image = Entry->Image;
+	Entry->Image = nullptr;
+	return Image;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "Portable.h"
+#include "ContentHash.h"
+
+struct COMPRESSED_IMAGE;
+struct CLIPBOARD_HISTORY;
+struct HISTORY_ENTRY;
+
+// A bounded history of the last captures.
+// Payload bytes are stored in a single ring arena that is allocated once and then reused in FIFO order, so that
+// a monitor running for days does not fragment the heap. Images are kept compressed (see ImageCodec.h), in their own
+// allocations which the history takes over, and are charged to ByteBudget at their compressed size. Appending and
+// evicting are O(1) (appending evicts as many old entries as needed).
+// Entries are evicted when any of MaxEntries, ArenaSize or ByteBudget would be exceeded.
+// Every entry carries the content hash of its raw clipboard payload, so that repeated content can be stored only once,
+// and the index of the record that holds it in a persistent store, if the caller keeps one.
+// Appending and removing invalidate all HISTORY_ENTRY pointers obtained before.
+
+extern BOOL                ClipboardHistoryInit(CLIPBOARD_HISTORY *History, UINT MaxEntries, SIZE_T ArenaSize, SIZE_T ByteBudget);
+extern void                ClipboardHistoryFree(CLIPBOARD_HISTORY *History);
+extern void                ClipboardHistoryClear(CLIPBOARD_HISTORY *History);
+extern const HISTORY_ENTRY *ClipboardHistoryAppend(CLIPBOARD_HISTORY *History, UINT Format, const void *Data, SIZE_T SizeCb, COMPRESSED_IMAGE *Image, const CONTENT_HASH *Hash, LONGLONG Timestamp);
+extern void                ClipboardHistoryRemove(CLIPBOARD_HISTORY *History, UINT Index);
+extern BOOL                ClipboardHistoryFind(const CLIPBOARD_HISTORY *History, UINT Format, const CONTENT_HASH *Hash, UINT *Index);
+extern BOOL                ClipboardHistoryFindId(const CLIPBOARD_HISTORY *History, ULONGLONG Id, UINT *Index);
+extern const HISTORY_ENTRY *ClipboardHistoryGet(const CLIPBOARD_HISTORY *History, UINT Index);
+extern UINT                ClipboardHistoryCount(const CLIPBOARD_HISTORY *History);
+extern void                ClipboardHistorySetStoredIndex(CLIPBOARD_HISTORY *History, UINT Index, ULONGLONG StoredIndex);
+extern COMPRESSED_IMAGE   *ClipboardHistoryTakeImage(CLIPBOARD_HISTORY *History, UINT Index);
+
+#define HISTORY_NOT_STORED ((ULONGLONG)-1)
+
+struct HISTORY_ENTRY
+{
+	ULONGLONG Id;          // Increases with every append, never reused.
+	UINT Format;
+	LONGLONG Timestamp;    // Whatever the caller passed in.
+	CONTENT_HASH Hash;     // Of the raw clipboard data, which is not necessarily what's stored here (e.g. for images).
+	// Payload. Always followed by two zero bytes, so that text can be used as a null-terminated string directly.
+	const BYTE *Data;
+	SIZE_T SizeCb;
+	COMPRESSED_IMAGE *Image; // Owned by the history, or null.
+	ULONGLONG StoredIndex; // HISTORY_NOT_STORED until set with ClipboardHistorySetStoredIndex.
+
+	// Bookkeeping
+	SIZE_T ArenaOffset;
+	SIZE_T ArenaCharge;    // Bytes of the arena this entry accounts for (payload plus the gap skipped when wrapping around).
+	SIZE_T BudgetCharge;   // Bytes counted against ByteBudget.
+	BOOL OutsideArena;     // Payloads that are larger than the arena are allocated separately.
+};
+
+struct CLIPBOARD_HISTORY
+{
+	// Entries, oldest first, in a ring of MaxEntries slots.
+	HISTORY_ENTRY *Entries;
+	UINT MaxEntries;
+	UINT First;
+	UINT Count;
+
+	// FIFO ring allocator for the payloads. Allocations are contiguous; when one does not fit at the end, it starts
+	// over at the beginning, and the skipped gap is charged to it.
+	BYTE *Arena;
+	SIZE_T ArenaSize;
+	SIZE_T ArenaHead;      // Where the next allocation goes.
+	SIZE_T ArenaTail;      // Start of the oldest allocation.
+	SIZE_T ArenaUsed;
+
+	SIZE_T ByteBudget;
+	SIZE_T BytesUsed;
+	ULONGLONG NextId;
+};
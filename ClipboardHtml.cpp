@@ -0,0 +1,182 @@
+#include "ClipboardHtml.h"
+#include <string.h>
+
+// Far more than any real header needs, SourceURL included; a payload without a header ends within this.
+#define MAX_HEADER_SIZE (64 * 1024)
+// Offsets above this cannot fit any payload, and stop the parsing before it can overflow.
+#define MAX_OFFSET (1LL << 48)
+// Marks an offset that is missing from the header; -1 is a valid value that means "none".
+#define MISSING_OFFSET (-2LL)
+
+static const char StartFragmentComment[] = "<!--StartFragment-->";
+static const char EndFragmentComment[] = "<!--EndFragment-->";
+
+struct HTML_HEADER
+{
+	LONGLONG StartHtml;
+	LONGLONG EndHtml;
+	LONGLONG StartFragment;
+	LONGLONG EndFragment;
+	LONGLONG StartSelection;
+	LONGLONG EndSelection;
+};
+
+
+static BOOL IsName(const BYTE *Name, SIZE_T SizeCb, const char *Expected)
+{
+	return strlen(Expected) == SizeCb && memcmp(Name, Expected, SizeCb) == 0;
+}
+
+
+// Decimal, usually padded with zeros to 10 digits.
+static BOOL ParseOffset(const BYTE *Value, SIZE_T SizeCb, LONGLONG *Offset)
+{
+	BOOL Negative = SizeCb > 0 && Value[0] == '-';
+	SIZE_T i = Negative ? 1 : 0;
+	if (i == SizeCb) return false;
+	LONGLONG Result = 0;
+	for (; i < SizeCb; ++i)
+	{
+		if (Value[i] < '0' || Value[i] > '9' || Result > MAX_OFFSET) return false;
+		Result = Result * 10 + (Value[i] - '0');
+	}
+	*Offset = Negative ? -Result : Result;
+	return true;
+}
+
+
+static void SetOffset(const BYTE *Name, SIZE_T NameSizeCb, const BYTE *Value, SIZE_T ValueSizeCb, HTML_HEADER *Header)
+{
+	LONGLONG *Offset;
+	if (IsName(Name, NameSizeCb, "StartHTML")) Offset = &Header->StartHtml;
+	else if (IsName(Name, NameSizeCb, "EndHTML")) Offset = &Header->EndHtml;
+	else if (IsName(Name, NameSizeCb, "StartFragment")) Offset = &Header->StartFragment;
+	else if (IsName(Name, NameSizeCb, "EndFragment")) Offset = &Header->EndFragment;
+	else if (IsName(Name, NameSizeCb, "StartSelection")) Offset = &Header->StartSelection;
+	else if (IsName(Name, NameSizeCb, "EndSelection")) Offset = &Header->EndSelection;
+	else return;
+	if (!ParseOffset(Value, ValueSizeCb, Offset)) *Offset = MISSING_OFFSET;
+}
+
+
+// Reads the Name:Value lines, and returns where the header ends, or 0 if there is no header.
+static SIZE_T ParseHeader(const BYTE *Data, SIZE_T SizeCb, HTML_HEADER *Header, CLIPBOARD_HTML *Html)
+{
+	SIZE_T Limit = SizeCb < MAX_HEADER_SIZE ? SizeCb : MAX_HEADER_SIZE;
+	SIZE_T Position = 0;
+	while (Position < Limit)
+	{
+		SIZE_T NameEnd = Position;
+		while (NameEnd < Limit && ((Data[NameEnd] >= 'A' && Data[NameEnd] <= 'Z') || (Data[NameEnd] >= 'a' && Data[NameEnd] <= 'z')))
+		{
+			++NameEnd;
+		}
+		if (NameEnd == Position || NameEnd == Limit || Data[NameEnd] != ':') break;
+		SIZE_T ValueStart = NameEnd + 1;
+		SIZE_T ValueEnd = ValueStart;
+		while (ValueEnd < Limit && Data[ValueEnd] != '\r' && Data[ValueEnd] != '\n' && Data[ValueEnd] != 0)
+		{
+			++ValueEnd;
+		}
+		if (ValueEnd == Limit && Limit < SizeCb) break;
+
+		const BYTE *Name = Data + Position;
+		const BYTE *Value = Data + ValueStart;
+		SIZE_T ValueSizeCb = ValueEnd - ValueStart;
+		while (ValueSizeCb > 0 && Value[ValueSizeCb - 1] == ' ') --ValueSizeCb;
+		if (Position == 0 && !IsName(Name, NameEnd - Position, "Version")) return 0;
+		if (IsName(Name, NameEnd - Position, "Version"))
+		{
+			Html->Version = Value;
+			Html->VersionSizeCb = ValueSizeCb;
+		}
+		else if (IsName(Name, NameEnd - Position, "SourceURL"))
+		{
+			Html->SourceUrl = Value;
+			Html->SourceUrlSizeCb = ValueSizeCb;
+		}
+		else
+		{
+			SetOffset(Name, NameEnd - Position, Value, ValueSizeCb, Header);
+		}
+
+		Position = ValueEnd;
+		if (Position < SizeCb && Data[Position] == '\r') ++Position;
+		if (Position < SizeCb && Data[Position] == '\n') ++Position;
+	}
+	return Position;
+}
+
+
+static const BYTE *FindString(const BYTE *Data, const BYTE *End, const char *String)
+{
+	SIZE_T Length = strlen(String);
+	while ((SIZE_T)(End - Data) >= Length)
+	{
+		const BYTE *Found = (const BYTE *)memchr(Data, String[0], End - Data - Length + 1);
+		if (Found == nullptr) return nullptr;
+		if (memcmp(Found, String, Length) == 0) return Found;
+		Data = Found + 1;
+	}
+	return nullptr;
+}
+
+
+BOOL ParseClipboardHtml(const BYTE *Data, SIZE_T SizeCb, CLIPBOARD_HTML *Html)
+{
+	memset(Html, 0, sizeof(*Html));
+	HTML_HEADER Header;
+	Header.StartHtml = MISSING_OFFSET;
+	Header.EndHtml = MISSING_OFFSET;
+	Header.StartFragment = MISSING_OFFSET;
+	Header.EndFragment = MISSING_OFFSET;
+	Header.StartSelection = MISSING_OFFSET;
+	Header.EndSelection = MISSING_OFFSET;
+	SIZE_T HeaderEnd = ParseHeader(Data, SizeCb, &Header, Html);
+	if (HeaderEnd == 0) return false;
+
+	LONGLONG DocumentStart = Header.StartHtml;
+	LONGLONG DocumentEnd = Header.EndHtml;
+	BOOL OffsetsValid = DocumentStart >= (LONGLONG)HeaderEnd && DocumentStart <= DocumentEnd && DocumentEnd <= (LONGLONG)SizeCb;
+	if (!OffsetsValid)
+	{
+		// No context, or offsets that are wrong: everything after the header, up to the terminating zero.
+		OffsetsValid = DocumentStart == -1 && DocumentEnd == -1;
+		const BYTE *Zero = (const BYTE *)memchr(Data + HeaderEnd, 0, SizeCb - HeaderEnd);
+		DocumentStart = HeaderEnd;
+		DocumentEnd = Zero != nullptr ? Zero - Data : SizeCb;
+	}
+	Html->Document = Data + DocumentStart;
+	Html->DocumentSizeCb = (SIZE_T)(DocumentEnd - DocumentStart);
+
+	if (Header.StartFragment >= DocumentStart && Header.StartFragment <= Header.EndFragment && Header.EndFragment <= DocumentEnd)
+	{
+		Html->Fragment = Data + Header.StartFragment;
+		Html->FragmentSizeCb = (SIZE_T)(Header.EndFragment - Header.StartFragment);
+	}
+	else
+	{
+		OffsetsValid = false;
+		const BYTE *End = Html->Document + Html->DocumentSizeCb;
+		const BYTE *Start = FindString(Html->Document, End, StartFragmentComment);
+		const BYTE *Stop = Start != nullptr ? FindString(Start + sizeof(StartFragmentComment) - 1, End, EndFragmentComment) : nullptr;
+		if (Stop != nullptr)
+		{
+			Html->Fragment = Start + sizeof(StartFragmentComment) - 1;
+			Html->FragmentSizeCb = Stop - Html->Fragment;
+		}
+		else
+		{
+			Html->Fragment = Html->Document;
+			Html->FragmentSizeCb = Html->DocumentSizeCb;
+		}
+	}
+
+	if (Header.StartSelection >= DocumentStart && Header.StartSelection <= Header.EndSelection && Header.EndSelection <= DocumentEnd)
+	{
+		Html->Selection = Data + Header.StartSelection;
+		Html->SelectionSizeCb = (SIZE_T)(Header.EndSelection - Header.StartSelection);
+	}
+	Html->OffsetsValid = OffsetsValid;
+	return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "Portable.h"
+
+struct CLIPBOARD_HTML;
+
+// CF_HTML, the registered "HTML Format" that browsers and Office put on the clipboard: a header of Name:Value lines
+// with byte offsets into the payload, followed by an HTML document that contains the copied fragment, e.g.
+//
+// Version:0.9
+// StartHTML:0000000137
+// EndHTML:0000000213
+// StartFragment:0000000169
+// EndFragment:0000000181
+// SourceURL:https://example.com/
+// <html><body><!--StartFragment--><b>Hello</b><!--EndFragment--></body></html>
+//
+// ParseClipboardHtml only reads the header and points into the payload for everything else, so nothing is copied and
+// a multi-MB payload costs the same as a small one. The text is UTF-8. Offsets that do not fit the payload (some
+// applications get them wrong) fall back to the <!--StartFragment--> and <!--EndFragment--> comments, found in a single
+// pass over the document, and then to the whole document. StartHTML and EndHTML may be -1 where there is no context.
+
+extern BOOL                ParseClipboardHtml(const BYTE *Data, SIZE_T SizeCb, CLIPBOARD_HTML *Html);
+
+// Filled by ParseClipboardHtml. The pointers point into the payload, which must stay valid while they are used.
+struct CLIPBOARD_HTML
+{
+	const BYTE *Version;          // E.g. "0.9"; not terminated.
+	SIZE_T VersionSizeCb;
+	const BYTE *Document;         // Between StartHTML and EndHTML, or everything after the header if those are -1.
+	SIZE_T DocumentSizeCb;
+	const BYTE *Fragment;         // Between StartFragment and EndFragment, within Document.
+	SIZE_T FragmentSizeCb;
+	const BYTE *Selection;        // Between StartSelection and EndSelection, or null if there is no selection.
+	SIZE_T SelectionSizeCb;
+	const BYTE *SourceUrl;        // Null if there is no SourceURL.
+	SIZE_T SourceUrlSizeCb;
+	BOOL OffsetsValid;            // False if the fragment had to be found without the header's offsets.
+};
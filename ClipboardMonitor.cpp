@@ -6,10 +6,34 @@
 #include <assert.h>
 #include <strsafe.h>
 #include <stdlib.h>
-#include <Uxtheme.h>
-#pragma comment(lib, "uxtheme.lib")
+#include <wchar.h>
+#include <math.h>
 
 #include "Win32Toolbox.h"
+#include "PixelBuffer.h"
+#include "ClipboardHistory.h"
+#include "ContentHash.h"
+#include "ClipboardBackend.h"
+#include "ClipboardAcquirer.h"
+#include "ClipboardSnapshot.h"
+#include "Win32ClipboardBackend.h"
+#include "CaptureWorker.h"
+#include "Coalescer.h"
+#include "TextLayout.h"
+#include "TextIndexer.h"
+#include "FormatInspector.h"
+#include "ClipboardHtml.h"
+#include "RtfTokenizer.h"
+#include "HexDump.h"
+#include "HistoryStore.h"
+#include "SearchWorker.h"
+#include "TileCache.h"
+#include "MipPyramid.h"
+#include "PixelAlpha.h"
+#include "HammingIndex.h"
+#include "ImageCodec.h"
+#include "TextCodec.h"
+#include "Tracer.h"
 
 
 #pragma comment(linker,"\"/manifestdependency:type='win32' name='Microsoft.Windows.Common-Controls' version='6.0.0.0' processorArchitecture='*' publicKeyToken='6595b64144ccf1df' language='*'\"")
@@ -22,6 +46,83 @@ static void                UpdateCapturedContent(HWND hWnd);
 
 static HINSTANCE hInst;
 
+// Set with /history:<directory> on the command line. Captures are then also written to a history store in that
+// directory, and the newest ones are loaded again on the next start.
+static WCHAR HistoryDirectory[STORE_PATH_LENGTH];
+// Set with /similar:<bits> or /similar:off. A captured image replaces an older one in the history if their perceptual
+// hashes differ in at most this many bits (and they have the same size and about the same average color); -1 turns
+// this off.
+static INT SimilarImageDistance = 3;
+// Set with /trace:<file>. Records how long the stages of every capture take, and writes them to that file on exit; see
+// Tracer.h.
+static WCHAR TraceFile[MAX_PATH];
+
+
+// Options are separated by spaces. Values that contain spaces have to be quoted, e.g. /history:"C:\My Captures".
+static void ParseCommandLine(LPCWSTR CommandLine)
+{
+	static const WCHAR HistoryOption[] = L"/history:";
+	static const WCHAR SimilarOption[] = L"/similar:";
+	static const WCHAR TraceOption[] = L"/trace:";
+	for (;;)
+	{
+		while (*CommandLine == ' ') ++CommandLine;
+		if (*CommandLine == 0) return;
+		LPCWSTR Option = CommandLine;
+		LPCWSTR Value = wcschr(Option, ':');
+		LPCWSTR End = wcschr(Option, ' ');
+		if (End == nullptr) End = Option + wcslen(Option);
+		if (Value == nullptr || Value > End)
+		{
+			// Not an option with a value; skip it.
+			CommandLine = End;
+			continue;
+		}
+		++Value;
+		SIZE_T Length = End - Value;
+		if (*Value == '"')
+		{
+			LPCWSTR Quote = wcschr(Value + 1, '"');
+			if (Quote == nullptr) return;
+			++Value;
+			Length = Quote - Value;
+			End = Quote + 1;
+		}
+		CommandLine = End;
+
+		if (wcsncmp(Option, HistoryOption, _countof(HistoryOption) - 1) == 0)
+		{
+			if (Length > 0 && Length < _countof(HistoryDirectory))
+			{
+				memcpy(HistoryDirectory, Value, Length * sizeof(WCHAR));
+				HistoryDirectory[Length] = 0;
+			}
+		}
+		else if (wcsncmp(Option, SimilarOption, _countof(SimilarOption) - 1) == 0)
+		{
+			if (Length == 3 && wcsncmp(Value, L"off", 3) == 0)
+			{
+				SimilarImageDistance = -1;
+			}
+			else
+			{
+				INT Distance = 0;
+				SIZE_T i = 0;
+				while (i < Length && i < 2 && Value[i] >= '0' && Value[i] <= '9') Distance = Distance * 10 + (Value[i++] - '0');
+				if (i > 0 && i == Length && Distance <= 64) SimilarImageDistance = Distance;
+			}
+		}
+		else if (wcsncmp(Option, TraceOption, _countof(TraceOption) - 1) == 0)
+		{
+			if (Length > 0 && Length < _countof(TraceFile))
+			{
+				memcpy(TraceFile, Value, Length * sizeof(WCHAR));
+				TraceFile[Length] = 0;
+			}
+		}
+	}
+}
+
 
 int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
                       _In_opt_ HINSTANCE hPrevInstance,
@@ -29,6 +130,12 @@ int APIENTRY wWinMain(_In_ HINSTANCE hInstance,
                       _In_ int       nCmdShow)
 {
 	hInst = hInstance;
+	ParseCommandLine(lpCmdLine);
+	TracerSetThreadName("UI");
+	if (TraceFile[0] != 0)
+	{
+		TracerStart();
+	}
 
 	// Initialize global strings
 	ATOM Atom_MainWindow = MyRegisterClass(hInstance);
@@ -75,23 +182,179 @@ ATOM MyRegisterClass(HINSTANCE hInstance)
 #define IDM_CLEAR_CLIPBOARD 100
 #define IDM_REFRESH 101
 #define IDM_TOGGLE_AUTO 102
+#define IDM_HISTORY_OLDER 103
+#define IDM_HISTORY_NEWER 104
+#define IDM_SHOW_FORMATS 105
+#define IDM_FIND 106
+#define IDM_ZOOM_IN 107
+#define IDM_ZOOM_OUT 108
+#define IDM_ZOOM_FIT 109
+#define IDM_ZOOM_ACTUAL 110
+// One item per clipboard format in the Formats menu.
+#define IDM_FORMAT_FIRST 1000
+#define FORMAT_MENU_MAX_ITEMS 500
+
+// Controls of the Find dialog.
+#define IDC_FIND_PATTERN 200
+#define IDC_FIND_RESULTS 201
+
+// History limits. Text payloads are stored in an arena of HISTORY_ARENA_SIZE bytes; images are shared with the viewer
+// and only count towards HISTORY_BYTE_BUDGET.
+#define HISTORY_MAX_ENTRIES 100
+#define HISTORY_ARENA_SIZE (64 * 1024 * 1024)
+#define HISTORY_BYTE_BUDGET (512 * 1024 * 1024)
+// Size of the segment files of the history store.
+#define HISTORY_STORE_SEGMENT_SIZE (64 * 1024 * 1024)
+// Texts stored before the first dictionary is trained, and between later ones.
+#define TEXT_DICTIONARY_FIRST_TEXTS 50
+#define TEXT_DICTIONARY_INTERVAL 1000
+// Text captures are searched in the history store, if there is one. Without it, the search keeps copies of their text,
+// up to this many bytes.
+#define SEARCH_TEXT_BUDGET (64 * 1024 * 1024)
+// Memory for the tiles of the displayed image, at 4 bytes per pixel.
+#define IMAGE_TILE_CACHE_BYTES (128 * 1024 * 1024)
+// Limits of the image zoom, in screen pixels per image pixel. Zooming in and out goes by a quarter of a doubling.
+#define IMAGE_ZOOM_MIN (1.0 / 64)
+#define IMAGE_ZOOM_MAX 32.0
+#define IMAGE_ZOOM_STEP 1.189207115002721
+
+#define TIMER_ACQUIRE_CLIPBOARD 1
+#define TIMER_COALESCE 2
+
+// Clipboard notifications in AUTO mode are merged until there has been no new one for COALESCE_QUIET_US, but for no
+// longer than COALESCE_MAX_LATENCY_US.
+#define COALESCE_QUIET_US (30 * 1000)
+#define COALESCE_MAX_LATENCY_US (250 * 1000)
+
+// Posted by the capture worker when it has finished decoding something.
+#define WM_APP_CAPTURE_DONE (WM_APP + 0)
+// Posted by the text indexer when more lines of the displayed text are available.
+#define WM_APP_TEXT_INDEXED (WM_APP + 1)
+// Posted by the search worker when it has answered a query.
+#define WM_APP_SEARCH_DONE (WM_APP + 2)
+
+// What to do once the clipboard has been opened. Requests made while an acquisition is pending are merged.
+#define PENDING_CLEAR 0x1
+#define PENDING_CAPTURE 0x2
+#define PENDING_INSPECT 0x4
+#define PENDING_COPY 0x8
+// Only the list of formats, for the Formats menu. Unlike PENDING_INSPECT, this leaves the view as it is.
+#define PENDING_LIST_FORMATS 0x10
+
+
+static CLIPBOARD_HISTORY History;
+static UINT HistoryPosition; // 0 is the newest entry.
+// Perceptual hashes of the images in the history, by entry id.
+static HAMMING_INDEX ImageHashes;
+// The history keeps images compressed. The one that was shown last is kept decoded, by entry id.
+static PIXEL_BUFFER *DecodedImage;
+static ULONGLONG DecodedImageId;
+static DWORD LastClipboardSequenceNumber;
+static HISTORY_STORE HistoryStore;
+static BOOL HistoryStoreOpened;
+// Dictionaries for the compressed texts in the history store (see TextCodec.h). A text is compressed with the newest
+// dictionary before it in the store, whose id is its index + 1. Dictionaries that have been read are kept until exit,
+// since the search worker uses them as well.
+static TEXT_DICTIONARY **TextDictionaries;
+static UINT TextDictionaryCount;
+static UINT TextDictionaryCapacity;
+static TEXT_DICTIONARY *NewestTextDictionary;
+static UINT TextsSinceDictionary;
+
+static CLIPBOARD_BACKEND ClipboardBackend;
+static CLIPBOARD_ACQUIRER ClipboardAcquirer;
+static UINT PendingClipboardActions;
+static BOOL ClipboardAcquired; // Whether ClipboardAcquirer has any statistics yet.
+// Kept from one opening of the clipboard to the next, so that its format list does not need to be allocated again.
+static CLIPBOARD_SNAPSHOT ClipboardSnapshot;
+static CAPTURE_WORKER CaptureWorker;
+static COALESCER UpdateCoalescer;
+// For tracing a capture from the notification to the paint that shows it (see Tracer.h): when the first notification
+// that has not been captured yet arrived, and when the capture whose result is about to be painted started. 0 if there
+// is none, or the tracer is stopped.
+static ULONGLONG ClipboardUpdateTraceStart;
+static ULONGLONG PaintTraceStart;
+static DWORD PaintTraceSequenceNumber;
+static FORMAT_INSPECTOR FormatInspector;
+static HMENU FormatsMenu;
+static HMENU ZoomMenu;
+// The formats behind the items of FormatsMenu, as of the last time it was opened.
+static UINT FormatMenuFormats[FORMAT_MENU_MAX_ITEMS];
+static UINT FormatMenuCount;
+// The format to fetch and mark with PENDING_INSPECT; 0 for none.
+static UINT PendingInspectFormat;
+// The CF_UNICODETEXT handle to put on the clipboard with PENDING_COPY. Owned by the monitor until the clipboard takes it.
+static HGLOBAL PendingCopyData;
+
+// Indexes every text capture. Document ids are indexes into the history store if it is open, and history entry ids
+// otherwise.
+static SEARCH_WORKER SearchWorker;
+// The Find dialog, while it is open, and the answer it is showing.
+static HWND FindDialog;
+static BOOL FindDialogCloseRequested;
+static SEARCH_QUERY *FindResults;
+static DEFAULT_GUI_FONT_CACHE FindDialogFont;
+// The result that was picked when the dialog closed.
+static BOOL FindResultChosen;
+static ULONGLONG FindChosenId;
+
+static PIXEL_BUFFER *CurrentImage;
+// Tiles of CurrentImage that have been painted, as bitmaps in the format of the screen.
+static TILE_CACHE ImageTiles;
+// Screen pixels per image pixel. At any zoom but 1, CurrentImage is resampled from its mip pyramid into
+// ZoomedImagePool while painting, instead of being drawn from the tiles. Untiled parts of a translucent image are
+// composited there as well.
+static double ImageZoom = 1;
+// The zoom follows the size of the window, and is kept for the next image.
+static BOOL ImageZoomToFit;
+static HEAP_POOL ZoomedImagePool;
+
+// Points into the history entry that is being displayed. Only the visible part is ever drawn, so this can be huge.
+static LPCWSTR CurrentText;
+static TEXT_LINE_INDEX CurrentTextIndex;
+// Finishes CurrentTextIndex in the background if the text is too long to be indexed right away.
+static TEXT_INDEXER CurrentTextIndexer;
+// Payloads that are neither text nor a decodable image are shown as a hex dump. Owned by the viewer.
+static BYTE *CurrentHexData;
+static HEX_DUMP CurrentHexDump;
+static WCHAR HexViewCaption[FORMAT_NAME_LENGTH + 64];
+// The text that CurrentText points to while ShowingFormats is true: the format list, or the payload of an inspected
+// format that can be shown as text, with InspectedViewCaption describing it.
+static WCHAR *FormatViewText;
+static BOOL ShowingFormats;
+static WCHAR InspectedViewCaption[FORMAT_NAME_LENGTH + 64];
+// A text from the history store that is no longer in the history, found through the Find dialog. CurrentText points
+// to it.
+static WCHAR *StoredViewText;
+static WCHAR StoredViewCaption[64];
+// Lines of CurrentTextIndex that the scroll bars have been set up for.
+static SIZE_T CurrentTextLineCount;
+static HEAP_POOL TextRunPool;
+// The selection in CurrentText, as text offsets: from where it was started to where it was extended to, in either
+// order. Nothing is selected if the two are equal.
+static SIZE_T SelectionAnchor;
+static SIZE_T SelectionCaret;
+// The left button is held down to select, and the mouse is captured.
+static BOOL Selecting;
 
-
-static HBITMAP CurrentImage;
-static LONG CurrentImageWidth;
-static LONG CurrentImageHeight;
-
-static LPWSTR CurrentText;
-static HWND CurrentEditControl;
 static HFONT FontMonospace;
+// Metrics of FontMonospace, valid whenever it is.
+static INT TextLineHeight;
+static INT TextCharWidth;
+
+#define TEXT_TAB_WIDTH 8
+// Characters indexed at a time while indexing the first screenful on the UI thread.
+#define TEXT_INDEX_INITIAL_CHUNK (64 * 1024)
+#define TEXT_INDEX_NOTIFY_INTERVAL_US (50 * 1000)
 
 
-static void SetEditControlFont(HWND Edit, HWND Parent)
+// Created on first use, and again after a DPI change.
+static HFONT GetMonospaceFont(HWND hWnd)
 {
 	if (FontMonospace == nullptr)
 	{
-		HDC hdc = GetDC(Parent);
-		INT dpi = GetDpi(Parent, hdc);
+		HDC hdc = GetDC(hWnd);
+		INT dpi = GetDpi(hWnd, hdc);
 		INT FontSizePx = MulDiv(12 /*12pt*/, dpi, 72);
 
 		FONT_DESC font_descs[] =
@@ -101,168 +364,1849 @@ static void SetEditControlFont(HWND Edit, HWND Parent)
 		};
 
 		FontMonospace = GetFirstMatchingFont(hdc, font_descs, sizeof(font_descs) / sizeof(font_descs[0]), nullptr);
-		ReleaseDC(Parent, hdc);
 		if (FontMonospace == NULL)
 		{
 			// Did not find an appropriate font.
 			FontMonospace = (HFONT)GetStockObject(ANSI_FIXED_FONT);
 		}
+
+		HGDIOBJ OldFont = SelectObject(hdc, FontMonospace);
+		TEXTMETRICW TextMetric;
+		GetTextMetricsW(hdc, &TextMetric);
+		TextLineHeight = GetTextLineHeight(&TextMetric, false);
+		TextCharWidth = TextMetric.tmAveCharWidth;
+		if (TextLineHeight <= 0) TextLineHeight = 1;
+		if (TextCharWidth <= 0) TextCharWidth = 1;
+		SelectObject(hdc, OldFont);
+		ReleaseDC(hWnd, hdc);
 	}
 
-	SendMessageW(Edit, WM_SETFONT, (WPARAM)(HFONT)FontMonospace, 0);
+	return FontMonospace;
 }
 
 
-static HWND CreateEditControl(HWND Parent)
+static LONGLONG GetTimestamp()
 {
-	SIZE ClientSize = GetClientSize(Parent);
-	HWND Edit = CreateWindowExW(0, WC_EDITW, nullptr, WS_CHILD | WS_VISIBLE | WS_VSCROLL | WS_HSCROLL | ES_MULTILINE | ES_WANTRETURN, 0, 0, ClientSize.cx, ClientSize.cy, Parent, nullptr, hInst, nullptr);
-	assert(Edit != nullptr);
-
-	SetEditControlFont(Edit, Parent);
-	
-	return Edit;
+	FILETIME Now;
+	GetSystemTimeAsFileTime(&Now);
+	return ((LONGLONG)Now.dwHighDateTime << 32) | Now.dwLowDateTime;
 }
 
 
-static BOOL OpenClipboard_ButTryABitHarder(HWND hWnd)
+static void UpdateWindowTitle(HWND hWnd)
 {
-	for (int i = 0; i < 20; ++i)
+	WCHAR Title[192];
+	UINT Count = ClipboardHistoryCount(&History);
+	if (CurrentHexData != nullptr)
 	{
-		// This can fail if the clipboard is currently being accessed by another application.
-		if (OpenClipboard(hWnd)) return true;
-		Sleep(10);
+		StringCchPrintfW(Title, _countof(Title), L"Clipboard Monitor - %s", HexViewCaption);
 	}
-	return false;
+	else if (ShowingFormats && InspectedViewCaption[0] != 0)
+	{
+		StringCchPrintfW(Title, _countof(Title), L"Clipboard Monitor - %s", InspectedViewCaption);
+	}
+	else if (ShowingFormats)
+	{
+		StringCchCopyW(Title, _countof(Title), L"Clipboard Monitor - Clipboard Formats");
+	}
+	else if (StoredViewText != nullptr)
+	{
+		StringCchPrintfW(Title, _countof(Title), L"Clipboard Monitor - %s", StoredViewCaption);
+	}
+	else if (Count > 1)
+	{
+		StringCchPrintfW(Title, _countof(Title), L"Clipboard Monitor - History %u/%u", Count - HistoryPosition, Count);
+	}
+	else
+	{
+		StringCchCopyW(Title, _countof(Title), L"Clipboard Monitor");
+	}
+	if (CurrentImage != nullptr && ImageZoom != 1)
+	{
+		WCHAR Zoom[32];
+		StringCchPrintfW(Zoom, _countof(Zoom), L" - %u%%", (UINT)(ImageZoom * 100 + 0.5));
+		StringCchCatW(Title, _countof(Title), Zoom);
+	}
+	if (ClipboardAcquired)
+	{
+		WCHAR Acquisition[96];
+		ULONGLONG Duration = ClipboardAcquirer.LastDurationUs;
+		StringCchPrintfW(Acquisition, _countof(Acquisition), L" - Clipboard %s after %llu.%02llu ms (%u attempts)",
+			ClipboardAcquirer.LastSucceeded ? L"opened" : L"busy, gave up", Duration / 1000, Duration % 1000 / 10, ClipboardAcquirer.LastAttempts);
+		if (ClipboardAcquirer.LastSucceeded)
+		{
+			// How long other applications could not use the clipboard because of us.
+			WCHAR Hold[32];
+			ULONGLONG HoldUs = ClipboardAcquirer.LastHoldUs;
+			StringCchPrintfW(Hold, _countof(Hold), L", held %llu.%02llu ms", HoldUs / 1000, HoldUs % 1000 / 10);
+			StringCchCatW(Acquisition, _countof(Acquisition), Hold);
+		}
+		StringCchCatW(Title, _countof(Title), Acquisition);
+	}
+	ULONGLONG TraceStart = TraceBegin();
+	SetWindowTextW(hWnd, Title);
+	TraceEnd("SetWindowTextW", TraceStart, 0);
 }
 
 
-static void UpdateClipboard(HWND hWnd)
+// The zoom at which CurrentImage fits into the window. Images that fit already are not magnified.
+static double GetFitZoom(HWND hWnd)
+{
+	SIZE ClientSize = GetClientSize(hWnd);
+	double Zoom = (double)ClientSize.cx / CurrentImage->Width;
+	if ((double)ClientSize.cy / CurrentImage->Height < Zoom) Zoom = (double)ClientSize.cy / CurrentImage->Height;
+	if (Zoom > 1) Zoom = 1;
+	return Zoom > IMAGE_ZOOM_MIN ? Zoom : IMAGE_ZOOM_MIN;
+}
+
+
+// Size of CurrentImage on the screen, at ImageZoom.
+static SIZE GetZoomedImageSize()
+{
+	double Width = floor(CurrentImage->Width * ImageZoom + 0.5);
+	double Height = floor(CurrentImage->Height * ImageZoom + 0.5);
+	SIZE Size;
+	Size.cx = (LONG)(Width < 1 ? 1 : Width < MAXINT ? Width : MAXINT);
+	Size.cy = (LONG)(Height < 1 ? 1 : Height < MAXINT ? Height : MAXINT);
+	return Size;
+}
+
+
+// Drops the references to the displayed history entry, without updating the window yet. Must be called before
+// the history is modified, and followed by ShowHistoryEntry.
+static void ForgetDisplayedEntry()
 {
-	DeleteObject(CurrentImage);
+	PixelBufferRelease(CurrentImage);
 	CurrentImage = nullptr;
-	free(CurrentText);
+	TileCacheSetImage(&ImageTiles, nullptr);
 	CurrentText = nullptr;
+	SelectionAnchor = 0;
+	SelectionCaret = 0;
+	TextIndexerStop(&CurrentTextIndexer);
+	TextLineIndexFree(&CurrentTextIndex);
+	free(CurrentHexData);
+	CurrentHexData = nullptr;
+	free(FormatViewText);
+	FormatViewText = nullptr;
+	ShowingFormats = false;
+	InspectedViewCaption[0] = 0;
+	free(StoredViewText);
+	StoredViewText = nullptr;
+}
+
+
+// Called on the text indexer thread.
+static void NotifyTextIndexed(void *Context)
+{
+	PostMessageW((HWND)Context, WM_APP_TEXT_INDEXED, 0, 0);
+}
 
-	if (OpenClipboard_ButTryABitHarder(hWnd))
+
+// Indexes enough of the text to fill the window, and leaves the rest to the text indexer.
+static BOOL StartIndexingText(HWND hWnd, LPCWSTR Text, SIZE_T Length)
+{
+	if (!TextLineIndexInit(&CurrentTextIndex, Text, Length, TEXT_TAB_WIDTH))
 	{
-		UINT KnownFormats[] =
-		{
-			CF_DIB,
-			CF_UNICODETEXT
-		};
-		int ClipboardFormat = GetPriorityClipboardFormat(KnownFormats, _countof(KnownFormats));
+		TextLineIndexFree(&CurrentTextIndex);
+		return false;
+	}
+
+	GetMonospaceFont(hWnd);
+	SIZE_T VisibleLines = GetClientHeight(hWnd) / TextLineHeight + 1;
+	while (!TextLineIndexIsComplete(&CurrentTextIndex) && TextLineIndexGetLineCount(&CurrentTextIndex) < VisibleLines)
+	{
+		// If this fails, whatever has been indexed so far is displayed.
+		if (!TextLineIndexContinue(&CurrentTextIndex, TEXT_INDEX_INITIAL_CHUNK)) return true;
+	}
+
+	if (!TextLineIndexIsComplete(&CurrentTextIndex))
+	{
+		TextIndexerStart(&CurrentTextIndexer, &CurrentTextIndex, TEXT_INDEX_NOTIFY_INTERVAL_US, NotifyTextIndexed, hWnd);
+	}
+	return true;
+}
+
+
+// Takes over the reference to Image.
+static void SetDecodedImage(ULONGLONG Id, PIXEL_BUFFER *Image)
+{
+	PixelBufferRelease(DecodedImage);
+	DecodedImage = Image;
+	DecodedImageId = Id;
+}
+
+
+// Returns a new reference to the decoded image of a history entry, with its mip pyramid, or null if there is not
+// enough memory.
+static PIXEL_BUFFER *GetDecodedImage(const HISTORY_ENTRY *Entry)
+{
+	if (DecodedImage == nullptr || DecodedImageId != Entry->Id)
+	{
+		PIXEL_BUFFER *Image = ImageCodecDecode(Entry->Image, 0);
+		if (Image == nullptr) return nullptr;
+		for (PIXEL_BUFFER *Level = Image; Level != nullptr; Level = MipPyramidAddLevel(Level));
+		SetDecodedImage(Entry->Id, Image);
+	}
+	return PixelBufferAddRef(DecodedImage);
+}
 
-		switch (ClipboardFormat)
+
+// Displays a history entry, or nothing if Entry is null.
+static void ShowHistoryEntry(HWND hWnd, const HISTORY_ENTRY *Entry)
+{
+	ForgetDisplayedEntry();
+
+	if (Entry != nullptr)
+	{
+		switch (Entry->Format)
 		{
 			case CF_DIB:
-			{
-				HGLOBAL ClipboardDataHandle = GetClipboardData(CF_DIB);
-				if (ClipboardDataHandle)
-				{
-					BITMAPINFOHEADER *BitmapInfoHeader = (BITMAPINFOHEADER *)GlobalLock(ClipboardDataHandle);
-					SIZE_T ClipboardDataSize = GlobalSize(ClipboardDataHandle);
-					if (BitmapInfoHeader)
-					{
-						BITMAP BitmapDesc = {};
-						HBITMAP hBitmap = CreateDIBFromPackedDIB(BitmapInfoHeader, ClipboardDataSize, &BitmapDesc);
-						if (hBitmap)
-						{
-							CurrentImage = hBitmap;
-							CurrentImageWidth = BitmapDesc.bmWidth;
-							CurrentImageHeight = BitmapDesc.bmHeight;
-						}
-					}
-				}
+				CurrentImage = GetDecodedImage(Entry);
+				// Each image starts at its actual size, unless the zoom follows the window.
+				ImageZoom = ImageZoomToFit ? GetFitZoom(hWnd) : 1;
 				break;
-			}
-
 			case CF_UNICODETEXT:
-			{
-				HANDLE ClipboardTextHandle = GetClipboardData(CF_UNICODETEXT);
-				if (ClipboardTextHandle != nullptr)
+				if (StartIndexingText(hWnd, (LPCWSTR)Entry->Data, Entry->SizeCb / sizeof(WCHAR)))
 				{
-					LPCWSTR ClipboardText = (LPCWSTR)GlobalLock(ClipboardTextHandle);
-					SIZE_T ClipboardTextLength = GlobalSize(ClipboardTextHandle);
-					if (ClipboardText != nullptr)
-					{
-						// Add a terminating 0 just in case the original data doesn't have one.
-						CurrentText = (LPWSTR)malloc(sizeof(WCHAR) * (ClipboardTextLength + 1));
-						if (CurrentText != nullptr)
-						{
-							CurrentText[ClipboardTextLength] = 0;
-							memcpy(CurrentText, ClipboardText, sizeof(WCHAR) * ClipboardTextLength);
-						}
-					}
-					GlobalUnlock(ClipboardTextHandle);
+					CurrentText = (LPCWSTR)Entry->Data;
 				}
 				break;
-			}
 		}
+	}
+
+	UpdateWindowTitle(hWnd);
+	UpdateCapturedContent(hWnd);
+}
+
+
+static void ShowHistoryPosition(HWND hWnd, UINT Position)
+{
+	UINT Count = ClipboardHistoryCount(&History);
+	if (Count == 0) return;
+	if (Position >= Count) Position = Count - 1;
+	if (Position == HistoryPosition && !ShowingFormats && StoredViewText == nullptr) return;
+	HistoryPosition = Position;
+	ShowHistoryEntry(hWnd, ClipboardHistoryGet(&History, Position));
+}
+
+
+// Used by UpdateClipboard when the clipboard content is the same as the newest history entry.
+static void ShowNewestHistoryEntry(HWND hWnd)
+{
+	if (HistoryPosition != 0 || ShowingFormats || StoredViewText != nullptr || (CurrentImage == nullptr && CurrentText == nullptr && CurrentHexData == nullptr))
+	{
+		HistoryPosition = 0;
+		ShowHistoryEntry(hWnd, ClipboardHistoryGet(&History, 0));
+	}
+}
+
+
+// Checks whether the payload is already in the history. If it's the newest entry, returns true, and nothing needs to
+// be done at all. If it's an older entry, that entry is removed, so that the content is stored only once after the
+// caller has appended it again; MovedFrom (unless null) then receives the store record that already holds it, and is
+// HISTORY_NOT_STORED otherwise. MovedImage (unless null) receives the compressed image of the entry, so that the
+// caller can append it again without decoding anything, or null.
+static BOOL FindDuplicateInHistory(UINT Format, const CONTENT_HASH *Hash, ULONGLONG *MovedFrom, COMPRESSED_IMAGE **MovedImage)
+{
+	if (MovedFrom != nullptr) *MovedFrom = HISTORY_NOT_STORED;
+	if (MovedImage != nullptr) *MovedImage = nullptr;
+	UINT Index;
+	if (!ClipboardHistoryFind(&History, Format, Hash, &Index)) return false;
+	if (Index == 0) return true;
+
+	// Removing may discard the entry that's currently displayed.
+	ForgetDisplayedEntry();
+	const HISTORY_ENTRY *Entry = ClipboardHistoryGet(&History, Index);
+	HammingIndexRemove(&ImageHashes, Entry->Id);
+	if (MovedFrom != nullptr) *MovedFrom = Entry->StoredIndex;
+	if (MovedImage != nullptr) *MovedImage = ClipboardHistoryTakeImage(&History, Index);
+	ClipboardHistoryRemove(&History, Index);
+	return false;
+}
+
+
+// HammingIndexFindNearest callback: the hash is only a hint, the images also have to have the same size and about the
+// same average color (which the hash ignores).
+static BOOL IsSimilarImage(void *Context, ULONGLONG Id)
+{
+	const COMPRESSED_IMAGE *Image = (const COMPRESSED_IMAGE *)Context;
+	UINT Index;
+	if (!ClipboardHistoryFindId(&History, Id, &Index)) return false;
+	const COMPRESSED_IMAGE *Other = ClipboardHistoryGet(&History, Index)->Image;
+	if (Other == nullptr || Other->Width != Image->Width || Other->Height != Image->Height) return false;
+	DWORD a = Image->AverageColor;
+	DWORD b = Other->AverageColor;
+	for (int Channel = 0; Channel < 3; ++Channel)
+	{
+		int Difference = (int)((a >> (Channel * 8)) & 0xFF) - (int)((b >> (Channel * 8)) & 0xFF);
+		if (Difference < -8 || Difference > 8) return false;
+	}
+	return true;
+}
 
-		CloseClipboard();
+
+// Appends an image to the history. An older image that looks the same (see SimilarImageDistance) is removed, so that
+// a series of nearly identical screenshots only keeps the newest one. Takes over Image.
+static const HISTORY_ENTRY *AppendImageToHistory(COMPRESSED_IMAGE *Image, const CONTENT_HASH *Hash, LONGLONG Timestamp)
+{
+	ULONGLONG ImageHash = Image->PerceptualHash;
+	ULONGLONG SimilarId;
+	UINT Distance;
+	if (SimilarImageDistance >= 0 && HammingIndexFindNearest(&ImageHashes, ImageHash, SimilarImageDistance, IsSimilarImage, Image, &SimilarId, &Distance))
+	{
+		UINT Index;
+		ClipboardHistoryFindId(&History, SimilarId, &Index);
+		ForgetDisplayedEntry();
+		HammingIndexRemove(&ImageHashes, SimilarId);
+		ClipboardHistoryRemove(&History, Index);
+	}
+
+	const HISTORY_ENTRY *Entry = ClipboardHistoryAppend(&History, CF_DIB, nullptr, 0, Image, Hash, Timestamp);
+	if (Entry != nullptr)
+	{
+		HammingIndexAdd(&ImageHashes, ImageHash, Entry->Id);
+	}
+	// Whatever the append has evicted.
+	UINT Count = ClipboardHistoryCount(&History);
+	HammingIndexRemoveBefore(&ImageHashes, Count > 0 ? ClipboardHistoryGet(&History, Count - 1)->Id : (ULONGLONG)-1);
+	return Entry;
+}
+
+
+// Displays the list of formats on the clipboard, as far as FormatInspector knows them. Selected is marked.
+static void ShowFormatView(HWND hWnd, UINT SelectedFormat)
+{
+	ForgetDisplayedEntry();
+
+	SIZE_T Length;
+	FormatViewText = FormatInspectorDescribe(&FormatInspector, SelectedFormat, &Length);
+	if (FormatViewText != nullptr && StartIndexingText(hWnd, FormatViewText, Length))
+	{
+		CurrentText = FormatViewText;
 	}
+	ShowingFormats = true;
 
+	UpdateWindowTitle(hWnd);
 	UpdateCapturedContent(hWnd);
 }
 
 
-// Called initially, and inside UpdateClipboard after the clipboard contents have been captured.
-static void UpdateCapturedContent(HWND hWnd)
+// Displays Data as a hex dump, and takes ownership of it. Caption goes into the window title.
+static void ShowHexView(HWND hWnd, BYTE *Data, SIZE_T SizeCb, LPCWSTR Caption)
 {
-	// Update scroll bars
-	SCROLLINFO ScrollInfo = {};
-	ScrollInfo.cbSize = sizeof(ScrollInfo);
-	if (CurrentImage != nullptr)
+	ForgetDisplayedEntry();
+
+	CurrentHexData = Data;
+	HexDumpInit(&CurrentHexDump, Data, SizeCb);
+	StringCchCopyW(HexViewCaption, _countof(HexViewCaption), Caption);
+
+	UpdateWindowTitle(hWnd);
+	UpdateCapturedContent(hWnd);
+}
+
+
+// Displays the payload of an inspected format as Text, and takes ownership of it. Caption goes into the window title.
+static void ShowInspectedText(HWND hWnd, WCHAR *Text, SIZE_T Length, LPCWSTR Caption)
+{
+	ForgetDisplayedEntry();
+
+	FormatViewText = Text;
+	if (StartIndexingText(hWnd, Text, Length))
 	{
-		// This is bugged.
-		// Even if you toggle scroll bar visibility by turning the window style on and off it doesn't fix it.
-		// Forcing the scroll bars to be visible *before* changing the scroll bar parameters is required to fix this.
-		// If the scroll bar is not already visible at the time a SIF_DISABLENOSCROLL thing is sent, it won't show.
-		ShowScrollBar(hWnd, SB_VERT, true);
-		ShowScrollBar(hWnd, SB_HORZ, true);
-		SIZE ClientSize = GetClientSize(hWnd);
-		ScrollInfo.fMask = SIF_DISABLENOSCROLL | SIF_PAGE | SIF_RANGE;
-		ScrollInfo.nPage = ClientSize.cy;
-		ScrollInfo.nMax = CurrentImageHeight - 1;
-		SetScrollInfo(hWnd, SB_VERT, &ScrollInfo, true);
-		ScrollInfo.nPage = ClientSize.cx;
-		ScrollInfo.nMax = CurrentImageWidth - 1;
-		SetScrollInfo(hWnd, SB_HORZ, &ScrollInfo, true);
+		CurrentText = Text;
+	}
+	ShowingFormats = true;
+	StringCchCopyW(InspectedViewCaption, _countof(InspectedViewCaption), Caption);
+
+	UpdateWindowTitle(hWnd);
+	UpdateCapturedContent(hWnd);
+}
+
+
+// The fragment of a CF_HTML payload, converted from UTF-8, after a line with the page it was copied from. Returns null
+// if the payload is not CF_HTML. Appends the size of the fragment to Caption.
+static WCHAR *DescribeHtmlFormat(const BYTE *Data, SIZE_T SizeCb, SIZE_T *Length, WCHAR *Caption, SIZE_T CaptionLength)
+{
+	CLIPBOARD_HTML Html;
+	if (!ParseClipboardHtml(Data, SizeCb, &Html) || Html.FragmentSizeCb > MAXINT) return nullptr;
+
+	static const WCHAR SourcePrefix[] = L"Source: ";
+	int UrlLength = Html.SourceUrlSizeCb > 0 ? MultiByteToWideChar(CP_UTF8, 0, (LPCSTR)Html.SourceUrl, (int)Html.SourceUrlSizeCb, nullptr, 0) : 0;
+	int FragmentLength = Html.FragmentSizeCb > 0 ? MultiByteToWideChar(CP_UTF8, 0, (LPCSTR)Html.Fragment, (int)Html.FragmentSizeCb, nullptr, 0) : 0;
+	SIZE_T HeaderLength = UrlLength > 0 ? _countof(SourcePrefix) - 1 + UrlLength + 4 : 0;
+	WCHAR *Text = (WCHAR *)malloc((HeaderLength + FragmentLength + 1) * sizeof(WCHAR));
+	if (Text == nullptr) return nullptr;
+
+	WCHAR *p = Text;
+	if (UrlLength > 0)
+	{
+		memcpy(p, SourcePrefix, sizeof(SourcePrefix) - sizeof(WCHAR));
+		p += _countof(SourcePrefix) - 1;
+		p += MultiByteToWideChar(CP_UTF8, 0, (LPCSTR)Html.SourceUrl, (int)Html.SourceUrlSizeCb, p, UrlLength);
+		memcpy(p, L"\r\n\r\n", 4 * sizeof(WCHAR));
+		p += 4;
+	}
+	if (FragmentLength > 0)
+	{
+		p += MultiByteToWideChar(CP_UTF8, 0, (LPCSTR)Html.Fragment, (int)Html.FragmentSizeCb, p, FragmentLength);
+	}
+	*p = 0;
+	*Length = p - Text;
+
+	WCHAR Details[64];
+	StringCchPrintfW(Details, _countof(Details), Html.OffsetsValid ? L", fragment of %llu bytes" : L", fragment of %llu bytes (offsets repaired)", (ULONGLONG)Html.FragmentSizeCb);
+	StringCchCatW(Caption, CaptionLength, Details);
+	return Text;
+}
+
+
+// The plain text of an RTF payload, followed by its outline: a line per destination, indented by nesting depth. Returns
+// null if the payload is not RTF. Appends the length of the text to Caption.
+static WCHAR *DescribeRtf(const BYTE *Data, SIZE_T SizeCb, SIZE_T *Length, WCHAR *Caption, SIZE_T CaptionLength)
+{
+	RTF_DOCUMENT Document;
+	if (!RtfExtract(Data, SizeCb, &Document)) return nullptr;
+
+	// Room for the heading, and for each entry its indentation, the backslashes, its name and the sizes.
+	const SIZE_T HeadingLength = 128;
+	const SIZE_T EntryExtraLength = 64;
+	SIZE_T OutlineLength = HeadingLength;
+	for (UINT i = 0; i < Document.OutlineCount; ++i)
+	{
+		OutlineLength += 2 * (SIZE_T)Document.Outline[i].Depth + Document.Outline[i].NameSizeCb + EntryExtraLength;
+	}
+	WCHAR *Text = (WCHAR *)realloc(Document.Text, (Document.TextLength + OutlineLength + 1) * sizeof(WCHAR));
+	if (Text == nullptr)
+	{
+		RtfDocumentFree(&Document);
+		return nullptr;
+	}
+	Document.Text = Text;
+
+	WCHAR *p = Text + Document.TextLength;
+	WCHAR *End = p + OutlineLength + 1;
+	StringCchPrintfW(p, End - p, L"\r\n\r\n--- Outline: %u destinations%s, nested %llu deep ---\r\n", Document.OutlineCount, Document.OutlineTruncated ? L" (truncated)" : L"", (ULONGLONG)Document.MaxDepth);
+	p += wcslen(p);
+	for (UINT i = 0; i < Document.OutlineCount; ++i)
+	{
+		const RTF_OUTLINE_ENTRY *Entry = &Document.Outline[i];
+		for (UINT d = 1; d < Entry->Depth; ++d)
+		{
+			*p++ = ' ';
+			*p++ = ' ';
+		}
+		*p++ = '\\';
+		if (Entry->Ignorable)
+		{
+			*p++ = '*';
+			*p++ = '\\';
+		}
+		for (SIZE_T k = 0; k < Entry->NameSizeCb; ++k)
+		{
+			*p++ = Entry->Name[k];
+		}
+		StringCchPrintfW(p, End - p, L"  %llu bytes at %llu\r\n", (ULONGLONG)Entry->SizeCb, (ULONGLONG)Entry->Offset);
+		p += wcslen(p);
+	}
+	*Length = p - Text;
+
+	WCHAR Details[64];
+	StringCchPrintfW(Details, _countof(Details), L", %llu characters of text", (ULONGLONG)Document.TextLength);
+	StringCchCatW(Caption, CaptionLength, Details);
+	// The outline is in the text now, which is the caller's.
+	free(Document.Outline);
+	return Text;
+}
+
+
+// Shows the payload of a format that has just been fetched by FormatInspector, or the format list with the format
+// marked if there is no payload. HTML and RTF are shown as text, everything else as a hex dump.
+static void ShowInspectedFormat(HWND hWnd, UINT Format)
+{
+	SIZE_T SizeCb;
+	BYTE *Data = FormatInspectorTakeData(&FormatInspector, Format, &SizeCb);
+	if (Data == nullptr)
+	{
+		ShowFormatView(hWnd, Format);
+		return;
+	}
+
+	const CLIPBOARD_FORMAT_INFO *Info = FormatInspectorFind(&FormatInspector, Format);
+	WCHAR Caption[_countof(HexViewCaption)];
+	if (Info->Name[0] != 0)
+	{
+		StringCchPrintfW(Caption, _countof(Caption), L"%s (%u), %llu bytes", (LPCWSTR)Info->Name, Format, (ULONGLONG)SizeCb);
+	}
+	else
+	{
+		StringCchPrintfW(Caption, _countof(Caption), L"Format %u, %llu bytes", Format, (ULONGLONG)SizeCb);
+	}
+
+	WCHAR *Text = nullptr;
+	SIZE_T Length;
+	if (wcscmp((LPCWSTR)Info->Name, L"HTML Format") == 0)
+	{
+		Text = DescribeHtmlFormat(Data, SizeCb, &Length, Caption, _countof(Caption));
+	}
+	else if (wcsncmp((LPCWSTR)Info->Name, L"Rich Text Format", 16) == 0)
+	{
+		// Also "Rich Text Format Without Objects", which Word offers besides it.
+		Text = DescribeRtf(Data, SizeCb, &Length, Caption, _countof(Caption));
+	}
+	if (Text != nullptr)
+	{
+		free(Data);
+		ShowInspectedText(hWnd, Text, Length, Caption);
+		return;
+	}
+	ShowHexView(hWnd, Data, SizeCb, Caption);
+	ShowingFormats = true;
+}
+
+
+// Makes a job of the capture request (number Item) of ClipboardSnapshot; everything else happens on the capture worker.
+// Returns null if the clipboard contained nothing that can be displayed.
+static CAPTURE_JOB *CaptureClipboardSnapshot(UINT Item)
+{
+	CAPTURE_JOB *Job = CaptureJobCreateFromSnapshot(&ClipboardSnapshot, Item);
+	if (Job != nullptr)
+	{
+		Job->SequenceNumber = LastClipboardSequenceNumber;
+		Job->Timestamp = GetTimestamp();
+	}
+	if (Job != nullptr && Job->Format == CF_DIB)
+	{
+		// An image that is in the history already is not decoded again (see AcceptCapturedContent). Without memory for
+		// the hashes, it is just decoded.
+		UINT Count = ClipboardHistoryCount(&History);
+		Job->KnownHashes = Count > 0 ? (CONTENT_HASH *)malloc(Count * sizeof(CONTENT_HASH)) : nullptr;
+		for (UINT i = 0; Job->KnownHashes != nullptr && i < Count; ++i)
+		{
+			const HISTORY_ENTRY *Entry = ClipboardHistoryGet(&History, i);
+			if (Entry->Format == CF_DIB && Entry->Image != nullptr)
+			{
+				Job->KnownHashes[Job->KnownHashCount++] = Entry->Hash;
+			}
+		}
+	}
+	return Job;
+}
+
+
+// Called on the capture worker thread.
+static void NotifyCaptureDone(void *Context)
+{
+	PostMessageW((HWND)Context, WM_APP_CAPTURE_DONE, 0, 0);
+}
+
+
+static BOOL AddTextDictionary(TEXT_DICTIONARY *Dictionary)
+{
+	if (TextDictionaryCount == TextDictionaryCapacity)
+	{
+		UINT NewCapacity = TextDictionaryCapacity != 0 ? TextDictionaryCapacity * 2 : 8;
+		TEXT_DICTIONARY **NewDictionaries = (TEXT_DICTIONARY **)realloc(TextDictionaries, NewCapacity * sizeof(TEXT_DICTIONARY *));
+		if (NewDictionaries == nullptr) return false;
+		TextDictionaries = NewDictionaries;
+		TextDictionaryCapacity = NewCapacity;
+	}
+	TextDictionaries[TextDictionaryCount++] = Dictionary;
+	return true;
+}
+
+
+// Returns the dictionary with the given id, reading it from the history store if necessary, or null if it cannot be
+// read.
+static TEXT_DICTIONARY *GetTextDictionary(ULONGLONG Id)
+{
+	for (UINT i = 0; i < TextDictionaryCount; ++i)
+	{
+		if (TextDictionaries[i]->Id == Id) return TextDictionaries[i];
+	}
+	const STORED_ENTRY *Stored = HistoryStoreGetEntry(&HistoryStore, Id - 1);
+	if (Stored == nullptr || Stored->Format != STORED_FORMAT_TEXT_DICTIONARY || Stored->SizeCb > TEXT_DICTIONARY_MAX_SIZE) return nullptr;
+	BYTE *Data = (BYTE *)malloc(TEXT_DICTIONARY_MAX_SIZE);
+	TEXT_DICTIONARY *Dictionary = nullptr;
+	if (Data != nullptr && HistoryStoreRead(&HistoryStore, Id - 1, Data))
+	{
+		Dictionary = TextDictionaryCreate(Data, (SIZE_T)Stored->SizeCb, Id);
+		if (Dictionary != nullptr && !AddTextDictionary(Dictionary))
+		{
+			TextDictionaryFree(Dictionary);
+			Dictionary = nullptr;
+		}
+	}
+	free(Data);
+	return Dictionary;
+}
+
+
+static void FreeTextDictionaries()
+{
+	for (UINT i = 0; i < TextDictionaryCount; ++i)
+	{
+		TextDictionaryFree(TextDictionaries[i]);
+	}
+	free(TextDictionaries);
+	TextDictionaries = nullptr;
+	TextDictionaryCount = 0;
+	TextDictionaryCapacity = 0;
+	NewestTextDictionary = nullptr;
+}
+
+
+// Makes Dictionary the one new texts are compressed with.
+static void UseTextDictionary(TEXT_DICTIONARY *Dictionary)
+{
+	if (Dictionary != nullptr && !TextDictionaryPrepareEncoding(Dictionary)) return;
+	NewestTextDictionary = Dictionary;
+	TextsSinceDictionary = 0;
+}
+
+
+// Trains a dictionary from the texts in the history, and appends it to the history store.
+static void TrainTextDictionary()
+{
+	const WCHAR *Texts[HISTORY_MAX_ENTRIES];
+	SIZE_T Lengths[HISTORY_MAX_ENTRIES];
+	UINT Count = 0;
+	for (UINT i = 0; i < ClipboardHistoryCount(&History) && Count < HISTORY_MAX_ENTRIES; ++i)
+	{
+		const HISTORY_ENTRY *Entry = ClipboardHistoryGet(&History, i);
+		if (Entry->Format == CF_UNICODETEXT)
+		{
+			Texts[Count] = (const WCHAR *)Entry->Data;
+			Lengths[Count] = Entry->SizeCb / sizeof(WCHAR);
+			++Count;
+		}
+	}
+	// Tried again after another interval, if this does not work out.
+	TextsSinceDictionary = 0;
+
+	BYTE *Data = (BYTE *)malloc(TEXT_DICTIONARY_MAX_SIZE);
+	if (Data == nullptr) return;
+	SIZE_T SizeCb = TextDictionaryTrain(Texts, Lengths, Count, Data, TEXT_DICTIONARY_MAX_SIZE);
+	CONTENT_HASH Hash;
+	ComputeContentHash(Data, SizeCb, &Hash);
+	if (SizeCb > 0 && HistoryStoreAppend(&HistoryStore, STORED_FORMAT_TEXT_DICTIONARY, Data, SizeCb, &Hash, 0))
+	{
+		TEXT_DICTIONARY *Dictionary = TextDictionaryCreate(Data, SizeCb, HistoryStoreGetCount(&HistoryStore));
+		if (Dictionary != nullptr && AddTextDictionary(Dictionary))
+		{
+			UseTextDictionary(Dictionary);
+		}
+		else
+		{
+			TextDictionaryFree(Dictionary);
+		}
+	}
+	free(Data);
+}
+
+
+// Writes a text to the history store as a STORED_FORMAT_COMPRESSED_TEXT record (or as it is, if compressing fails),
+// and hands it to the search worker.
+static BOOL StoreText(const WCHAR *Text, SIZE_T Length, const CONTENT_HASH *Hash, LONGLONG Timestamp)
+{
+	TEXT_DICTIONARY *Dictionary = NewestTextDictionary;
+	BOOL Stored;
+	BYTE *Record = (BYTE *)malloc(sizeof(CONTENT_HASH) + TextCodecGetMaxSize(Length));
+	SIZE_T CompressedSize = Record != nullptr ? TextCodecEncode(Text, Length, Dictionary, Record + sizeof(CONTENT_HASH)) : 0;
+	if (CompressedSize != 0)
+	{
+		memcpy(Record, Hash, sizeof(CONTENT_HASH));
+		CONTENT_HASH RecordHash;
+		ComputeContentHash(Record, sizeof(CONTENT_HASH) + CompressedSize, &RecordHash);
+		Stored = HistoryStoreAppend(&HistoryStore, STORED_FORMAT_COMPRESSED_TEXT, Record, sizeof(CONTENT_HASH) + CompressedSize, &RecordHash, Timestamp);
+	}
+	else
+	{
+		Stored = HistoryStoreAppend(&HistoryStore, CF_UNICODETEXT, Text, Length * sizeof(WCHAR), Hash, Timestamp);
+		Dictionary = nullptr;
+	}
+	free(Record);
+	if (!Stored) return false;
+
+	ULONGLONG Index = HistoryStoreGetCount(&HistoryStore) - 1;
+	SearchWorkerAddStored(&SearchWorker, Index, HistoryStoreGetEntry(&HistoryStore, Index), Dictionary);
+	if (++TextsSinceDictionary >= (NewestTextDictionary != nullptr ? TEXT_DICTIONARY_INTERVAL : TEXT_DICTIONARY_FIRST_TEXTS))
+	{
+		TrainTextDictionary();
+	}
+	return true;
+}
+
+
+// Reads a text from the history store, whether it is compressed or not. Returns it with a terminating 0 (free it with
+// free()), and the content hash of the raw text, or null if it cannot be read.
+static WCHAR *ReadStoredText(ULONGLONG Index, SIZE_T *Length, CONTENT_HASH *Hash)
+{
+	const STORED_ENTRY *Stored = HistoryStoreGetEntry(&HistoryStore, Index);
+	if (Stored == nullptr || Stored->SizeCb > (SIZE_T)-1 - sizeof(WCHAR)) return nullptr;
+	if (Stored->Format == CF_UNICODETEXT)
+	{
+		WCHAR *Text = (WCHAR *)calloc((SIZE_T)Stored->SizeCb / sizeof(WCHAR) + 1, sizeof(WCHAR));
+		if (Text == nullptr || !HistoryStoreRead(&HistoryStore, Index, Text))
+		{
+			free(Text);
+			return nullptr;
+		}
+		*Length = (SIZE_T)Stored->SizeCb / sizeof(WCHAR);
+		*Hash = Stored->Hash;
+		return Text;
+	}
+	if (Stored->Format != STORED_FORMAT_COMPRESSED_TEXT || Stored->SizeCb < sizeof(CONTENT_HASH)) return nullptr;
+
+	BYTE *Record = (BYTE *)malloc((SIZE_T)Stored->SizeCb);
+	WCHAR *Text = nullptr;
+	if (Record != nullptr && HistoryStoreRead(&HistoryStore, Index, Record))
+	{
+		SIZE_T SizeCb = (SIZE_T)Stored->SizeCb - sizeof(CONTENT_HASH);
+		const TEXT_CODEC_HEADER *Header = TextCodecValidate(Record + sizeof(CONTENT_HASH), SizeCb);
+		const TEXT_DICTIONARY *Dictionary = Header != nullptr && Header->DictionaryId != 0 ? GetTextDictionary(Header->DictionaryId) : nullptr;
+		if (Header != nullptr)
+		{
+			Text = (WCHAR *)malloc(((SIZE_T)Header->Length + 1) * sizeof(WCHAR));
+		}
+		if (Text != nullptr && TextCodecDecode(Header, SizeCb, Dictionary, Text))
+		{
+			Text[Header->Length] = 0;
+			*Length = (SIZE_T)Header->Length;
+			memcpy(Hash, Record, sizeof(CONTENT_HASH));
+		}
+		else
+		{
+			free(Text);
+			Text = nullptr;
+		}
+	}
+	free(Record);
+	return Text;
+}
+
+
+// Writes an image entry of the history to the history store, as a STORED_FORMAT_COMPRESSED_DIB record.
+static BOOL StoreCompressedImage(const HISTORY_ENTRY *Entry)
+{
+	SIZE_T ImageSize = ImageCodecGetSize(Entry->Image);
+	SIZE_T SizeCb = sizeof(CONTENT_HASH) + ImageSize;
+	BYTE *Record = (BYTE *)malloc(SizeCb);
+	if (Record == nullptr) return false;
+	memcpy(Record, &Entry->Hash, sizeof(CONTENT_HASH));
+	memcpy(Record + sizeof(CONTENT_HASH), Entry->Image, ImageSize);
+	CONTENT_HASH RecordHash;
+	ComputeContentHash(Record, SizeCb, &RecordHash);
+	BOOL Stored = HistoryStoreAppend(&HistoryStore, STORED_FORMAT_COMPRESSED_DIB, Record, SizeCb, &RecordHash, Entry->Timestamp);
+	free(Record);
+	return Stored;
+}
+
+
+// Writes a STORED_FORMAT_MOVED record for content that was captured again, and is already held by record StoredIndex.
+static BOOL StoreMove(UINT Format, ULONGLONG StoredIndex, LONGLONG Timestamp)
+{
+	CONTENT_HASH RecordHash;
+	ComputeContentHash(&StoredIndex, sizeof(StoredIndex), &RecordHash);
+	return HistoryStoreAppend(&HistoryStore, STORED_FORMAT_MOVED | Format, &StoredIndex, sizeof(StoredIndex), &RecordHash, Timestamp);
+}
+
+
+// Puts a decoded capture into the history and displays it. Takes ownership of the job.
+static void AcceptCapturedContent(HWND hWnd, CAPTURE_JOB *Job)
+{
+	ULONGLONG TraceStart = TraceBegin();
+	DWORD SequenceNumber = Job->SequenceNumber;
+	PaintTraceStart = Job->TraceStartTicks;
+	PaintTraceSequenceNumber = SequenceNumber;
+	const HISTORY_ENTRY *Entry = nullptr;
+	ULONGLONG MovedFrom;
+	COMPRESSED_IMAGE *MovedImage = nullptr;
+	if (FindDuplicateInHistory(Job->Format, &Job->Hash, &MovedFrom, Job->IsKnown ? &MovedImage : nullptr))
+	{
+		// Same content as before; skip the control and window updates.
+		CaptureJobFree(Job);
+		ShowNewestHistoryEntry(hWnd);
+		TraceEnd("AcceptCapture (duplicate)", TraceStart, SequenceNumber);
+		return;
+	}
+	if (Job->IsKnown && MovedImage == nullptr)
+	{
+		// The image has left the history since the job was submitted, so it has to be decoded after all.
+		free(Job->KnownHashes);
+		Job->KnownHashes = nullptr;
+		Job->KnownHashCount = 0;
+		Job->IsKnown = false;
+		CaptureWorkerSubmit(&CaptureWorker, Job);
+		TraceEnd("AcceptCapture (decode again)", TraceStart, SequenceNumber);
+		return;
+	}
+
+	switch (Job->Format)
+	{
+		case CF_DIB:
+		{
+			if (Job->IsKnown)
+			{
+				// Captured before: the compressed image of the older entry moves to the front, and is decoded for display
+				// like any other entry.
+				ForgetDisplayedEntry();
+				Entry = AppendImageToHistory(MovedImage, &Job->Hash, Job->Timestamp);
+			}
+			else if (Job->Image != nullptr)
+			{
+				ForgetDisplayedEntry();
+				// The history takes over the compressed image; the decoded one is what gets displayed now.
+				Entry = AppendImageToHistory(Job->CompressedImage, &Job->Hash, Job->Timestamp);
+				Job->CompressedImage = nullptr;
+				if (Entry != nullptr)
+				{
+					SetDecodedImage(Entry->Id, Job->Image);
+					Job->Image = nullptr;
+				}
+			}
+			else
+			{
+				// Too large, or not a format the decoder understands. The raw data is still worth a look.
+				HistoryPosition = 0;
+				WCHAR Caption[64];
+				StringCchPrintfW(Caption, _countof(Caption), L"%s (not decoded), %llu bytes", Job->IsPng ? L"PNG" : L"CF_DIB", (ULONGLONG)Job->SizeCb);
+				ShowHexView(hWnd, Job->Data, Job->SizeCb, Caption);
+				Job->Data = nullptr;
+				CaptureJobFree(Job);
+				TraceEnd("AcceptCapture", TraceStart, SequenceNumber);
+				return;
+			}
+			break;
+		}
+		case CF_UNICODETEXT:
+		{
+			// The history adds a terminating 0, just in case the original data doesn't have one.
+			ForgetDisplayedEntry();
+			Entry = ClipboardHistoryAppend(&History, CF_UNICODETEXT, Job->Data, Job->SizeCb, nullptr, &Job->Hash, Job->Timestamp);
+			break;
+		}
+	}
+	if (Entry != nullptr && HistoryStoreOpened)
+	{
+		// If this fails, the capture is still in the history; it just won't be there after a restart, and can't be
+		// searched. Content that was captured before only gets a small record (it is already indexed for searching).
+		ULONGLONG StoredIndex = HistoryStoreGetCount(&HistoryStore);
+		if (MovedFrom != HISTORY_NOT_STORED && StoreMove(Job->Format, MovedFrom, Job->Timestamp))
+		{
+			ClipboardHistorySetStoredIndex(&History, 0, MovedFrom);
+		}
+		else if (Job->Format == CF_DIB ? StoreCompressedImage(Entry) : StoreText((LPCWSTR)Job->Data, Job->SizeCb / sizeof(WCHAR), &Job->Hash, Job->Timestamp))
+		{
+			ClipboardHistorySetStoredIndex(&History, 0, StoredIndex);
+		}
+	}
+	else if (Entry != nullptr && Job->Format == CF_UNICODETEXT)
+	{
+		SearchWorkerAddText(&SearchWorker, Entry->Id, (LPCWSTR)Job->Data, Job->SizeCb / sizeof(WCHAR), Job->Timestamp);
+	}
+	CaptureJobFree(Job);
+
+	HistoryPosition = 0;
+	ShowHistoryEntry(hWnd, Entry);
+	TraceEnd("AcceptCapture", TraceStart, SequenceNumber);
+}
+
+
+// Puts the content of a store record into the history, as the newest entry.
+static void LoadStoredEntry(ULONGLONG Index, LONGLONG Timestamp)
+{
+	const STORED_ENTRY *Stored = HistoryStoreGetEntry(&HistoryStore, Index);
+	if (Stored->Format == CF_UNICODETEXT || Stored->Format == STORED_FORMAT_COMPRESSED_TEXT)
+	{
+		SIZE_T Length;
+		CONTENT_HASH Hash;
+		WCHAR *Text = ReadStoredText(Index, &Length, &Hash);
+		if (Text != nullptr && !FindDuplicateInHistory(CF_UNICODETEXT, &Hash, nullptr, nullptr) && ClipboardHistoryAppend(&History, CF_UNICODETEXT, Text, Length * sizeof(WCHAR), nullptr, &Hash, Timestamp) != nullptr)
+		{
+			ClipboardHistorySetStoredIndex(&History, 0, Index);
+		}
+		free(Text);
+		return;
+	}
+	if (Stored->Format != CF_DIB && Stored->Format != STORED_FORMAT_COMPRESSED_DIB) return;
+	// Compressed images carry their content hash in the payload, and are checked once it has been read.
+	if (Stored->Format == CF_DIB && FindDuplicateInHistory(CF_DIB, &Stored->Hash, nullptr, nullptr)) return;
+
+	BYTE *Data = (BYTE *)malloc((SIZE_T)Stored->SizeCb);
+	if (Data == nullptr) return;
+	const HISTORY_ENTRY *Entry = nullptr;
+	if (HistoryStoreRead(&HistoryStore, Index, Data))
+	{
+		if (Stored->Format == STORED_FORMAT_COMPRESSED_DIB)
+		{
+			if (Stored->SizeCb >= sizeof(CONTENT_HASH))
+			{
+				CONTENT_HASH Hash;
+				SIZE_T ImageSize = (SIZE_T)Stored->SizeCb - sizeof(CONTENT_HASH);
+				memcpy(&Hash, Data, sizeof(CONTENT_HASH));
+				// The image goes to the start of the allocation, so that the history can take it over.
+				memmove(Data, Data + sizeof(CONTENT_HASH), ImageSize);
+				if (ImageCodecValidate(Data, ImageSize) != nullptr && !FindDuplicateInHistory(CF_DIB, &Hash, nullptr, nullptr))
+				{
+					Entry = AppendImageToHistory((COMPRESSED_IMAGE *)Data, &Hash, Timestamp);
+					Data = nullptr;
+				}
+			}
+		}
+		else
+		{
+			// Written before images were stored compressed.
+			PIXEL_BUFFER *Image = PixelBufferCreateFromPackedDIB((const BITMAPINFOHEADER *)Data, (SIZE_T)Stored->SizeCb);
+			if (Image != nullptr)
+			{
+				for (PIXEL_BUFFER *Level = Image; Level != nullptr; Level = MipPyramidAddLevel(Level));
+				COMPRESSED_IMAGE *CompressedImage = ImageCodecEncode(Image, 0);
+				PixelBufferRelease(Image);
+				if (CompressedImage != nullptr)
+				{
+					Entry = AppendImageToHistory(CompressedImage, &Stored->Hash, Timestamp);
+				}
+			}
+		}
+	}
+	free(Data);
+	if (Entry != nullptr)
+	{
+		ClipboardHistorySetStoredIndex(&History, 0, Index);
+	}
+}
+
+
+// The record that holds the content of a store record: the record itself, or the one a STORED_FORMAT_MOVED record
+// points to. HISTORY_NOT_STORED if that cannot be read.
+static ULONGLONG ResolveStoredIndex(ULONGLONG Index)
+{
+	const STORED_ENTRY *Stored = HistoryStoreGetEntry(&HistoryStore, Index);
+	if ((Stored->Format & 0xFFFF0000) != STORED_FORMAT_MOVED) return Index;
+	ULONGLONG Target;
+	if (Stored->SizeCb != sizeof(Target) || !HistoryStoreRead(&HistoryStore, Index, &Target) || Target >= Index) return HISTORY_NOT_STORED;
+	return Target;
+}
+
+
+// Puts the newest entries of the history store into the history, as far as they fit.
+static void LoadStoredHistory()
+{
+	ULONGLONG Count = HistoryStoreGetCount(&HistoryStore);
+	ULONGLONG First = Count;
+	ULONGLONG Bytes = 0;
+	while (First > 0 && Count - First < HISTORY_MAX_ENTRIES)
+	{
+		ULONGLONG Index = ResolveStoredIndex(First - 1);
+		Bytes += HistoryStoreGetEntry(&HistoryStore, Index != HISTORY_NOT_STORED ? Index : First - 1)->SizeCb;
+		if (Bytes > HISTORY_BYTE_BUDGET) break;
+		--First;
+	}
+
+	for (ULONGLONG i = First; i < Count; ++i)
+	{
+		// Content that was captured again is loaded from its first record, with the time of the move.
+		ULONGLONG Index = ResolveStoredIndex(i);
+		if (Index != HISTORY_NOT_STORED)
+		{
+			LoadStoredEntry(Index, HistoryStoreGetEntry(&HistoryStore, i)->Timestamp);
+		}
+	}
+}
+
+
+// Hands every text in the history store to the search worker, which indexes them in the background. Also picks up the
+// newest dictionary, for compressing new texts.
+static void IndexStoredHistory()
+{
+	ULONGLONG Count = HistoryStoreGetCount(&HistoryStore);
+	TEXT_DICTIONARY *Dictionary = nullptr;
+	UINT TextsAfterDictionary = 0;
+	for (ULONGLONG i = 0; i < Count; ++i)
+	{
+		const STORED_ENTRY *Stored = HistoryStoreGetEntry(&HistoryStore, i);
+		if (Stored->Format == STORED_FORMAT_TEXT_DICTIONARY)
+		{
+			Dictionary = GetTextDictionary(i + 1);
+			TextsAfterDictionary = 0;
+		}
+		else if (Stored->Format == CF_UNICODETEXT || Stored->Format == STORED_FORMAT_COMPRESSED_TEXT)
+		{
+			SearchWorkerAddStored(&SearchWorker, i, Stored, Stored->Format == STORED_FORMAT_COMPRESSED_TEXT ? Dictionary : nullptr);
+			++TextsAfterDictionary;
+		}
+	}
+	UseTextDictionary(Dictionary);
+	TextsSinceDictionary = TextsAfterDictionary;
+}
+
+
+// Called on the search worker thread.
+static void NotifySearchDone(void *Context)
+{
+	PostMessageW((HWND)Context, WM_APP_SEARCH_DONE, 0, 0);
+}
+
+
+// Timestamps are FILETIMEs (UTC); this shows them in local time.
+static void FormatTimestamp(LONGLONG Timestamp, LPWSTR Text, SIZE_T TextLength)
+{
+	FILETIME Utc;
+	Utc.dwLowDateTime = (DWORD)Timestamp;
+	Utc.dwHighDateTime = (DWORD)((ULONGLONG)Timestamp >> 32);
+	FILETIME Local;
+	SYSTEMTIME Time;
+	if (Timestamp == 0 || !FileTimeToLocalFileTime(&Utc, &Local) || !FileTimeToSystemTime(&Local, &Time))
+	{
+		StringCchCopyW(Text, TextLength, L"(unknown time)");
+		return;
+	}
+	StringCchPrintfW(Text, TextLength, L"%04u-%02u-%02u %02u:%02u:%02u", Time.wYear, Time.wMonth, Time.wDay, Time.wHour, Time.wMinute, Time.wSecond);
+}
+
+
+// Displays a text that was read from the history store, and takes ownership of it.
+static void ShowStoredText(HWND hWnd, WCHAR *Text, SIZE_T Length, LONGLONG Timestamp)
+{
+	ForgetDisplayedEntry();
+
+	StoredViewText = Text;
+	if (StartIndexingText(hWnd, Text, Length))
+	{
+		CurrentText = Text;
+	}
+	WCHAR Time[32];
+	FormatTimestamp(Timestamp, Time, _countof(Time));
+	StringCchPrintfW(StoredViewCaption, _countof(StoredViewCaption), L"Stored Text from %s", Time);
+
+	UpdateWindowTitle(hWnd);
+	UpdateCapturedContent(hWnd);
+}
+
+
+// Displays a document found by the search worker: the history entry if it is still in the history, otherwise the
+// text from the history store.
+static void OpenSearchResult(HWND hWnd, ULONGLONG Id)
+{
+	UINT Count = ClipboardHistoryCount(&History);
+	if (!HistoryStoreOpened)
+	{
+		for (UINT i = 0; i < Count; ++i)
+		{
+			if (ClipboardHistoryGet(&History, i)->Id == Id)
+			{
+				ShowHistoryPosition(hWnd, i);
+				return;
+			}
+		}
+		// Evicted from the history since the search.
+		MessageBeep(MB_ICONWARNING);
+		return;
+	}
+
+	const STORED_ENTRY *Stored = HistoryStoreGetEntry(&HistoryStore, Id);
+	if (Stored == nullptr) return;
+	SIZE_T Length;
+	CONTENT_HASH Hash;
+	WCHAR *Text = ReadStoredText(Id, &Length, &Hash);
+	if (Text == nullptr)
+	{
+		MessageBeep(MB_ICONWARNING);
+		return;
+	}
+	UINT Index;
+	if (ClipboardHistoryFind(&History, CF_UNICODETEXT, &Hash, &Index))
+	{
+		free(Text);
+		ShowHistoryPosition(hWnd, Index);
+		return;
+	}
+	ShowStoredText(hWnd, Text, Length, Stored->Timestamp);
+}
+
+
+static void LayoutFindDialog(HWND hDlg)
+{
+	HWND Pattern = GetDlgItem(hDlg, IDC_FIND_PATTERN);
+	HWND Results = GetDlgItem(hDlg, IDC_FIND_RESULTS);
+	SIZE ClientSize = GetClientSize(hDlg);
+	INT Margin = MulDiv(8, GetDpi(hDlg, nullptr), 96);
+	INT PatternHeight = GetDefaultSinglelineEditBoxHeight(Pattern, 0);
+	INT Width = ClientSize.cx - 2 * Margin;
+	INT ResultsTop = 2 * Margin + PatternHeight;
+	SetWindowPos(Pattern, nullptr, Margin, Margin, Width > 0 ? Width : 0, PatternHeight, SWP_NOZORDER);
+	SetWindowPos(Results, nullptr, Margin, ResultsTop, Width > 0 ? Width : 0, ClientSize.cy - ResultsTop - Margin > 0 ? ClientSize.cy - ResultsTop - Margin : 0, SWP_NOZORDER);
+}
+
+
+// Searches for whatever is in the pattern box. An empty pattern lists the newest texts.
+static void StartFindQuery(HWND hDlg)
+{
+	HWND Pattern = GetDlgItem(hDlg, IDC_FIND_PATTERN);
+	INT Length = GetWindowTextLengthW(Pattern);
+	WCHAR *Text = (WCHAR *)malloc((Length + 1) * sizeof(WCHAR));
+	if (Text == nullptr) return;
+	Length = GetWindowTextW(Pattern, Text, Length + 1);
+	SearchWorkerQuery(&SearchWorker, Text, Length);
+	free(Text);
+}
+
+
+// Takes ownership of the query.
+static void ShowFindResults(SEARCH_QUERY *Query)
+{
+	SearchQueryFree(FindResults);
+	FindResults = Query;
+
+	HWND Results = GetDlgItem(FindDialog, IDC_FIND_RESULTS);
+	SendMessageW(Results, WM_SETREDRAW, false, 0);
+	SendMessageW(Results, LB_RESETCONTENT, 0, 0);
+	for (UINT i = 0; i < Query->ResultCount; ++i)
+	{
+		WCHAR Item[SEARCH_SNIPPET_LENGTH + 64];
+		FormatTimestamp(Query->Results[i].Timestamp, Item, _countof(Item));
+		StringCchCatW(Item, _countof(Item), L"    ");
+		StringCchCatW(Item, _countof(Item), Query->Results[i].Snippet);
+		SendMessageW(Results, LB_ADDSTRING, 0, (LPARAM)Item);
+	}
+	SendMessageW(Results, WM_SETREDRAW, true, 0);
+	InvalidateRect(Results, nullptr, true);
+
+	WCHAR Title[128];
+	StringCchPrintfW(Title, _countof(Title), L"Find - %u%s matches in %llu.%02llu ms (%llu texts%s)", Query->ResultCount, Query->MoreResults ? L"+" : L"",
+		Query->DurationUs / 1000, Query->DurationUs % 1000 / 10, (ULONGLONG)Query->DocumentCount, Query->Complete ? L"" : L", still indexing");
+	SetWindowTextW(FindDialog, Title);
+}
+
+
+// Closes the dialog with the selected result, or the first one if none is selected.
+static void ChooseFindResult(HWND hDlg)
+{
+	if (FindResults == nullptr || FindResults->ResultCount == 0) return;
+	LRESULT Selected = SendDlgItemMessageW(hDlg, IDC_FIND_RESULTS, LB_GETCURSEL, 0, 0);
+	if (Selected == LB_ERR || Selected < 0 || (ULONGLONG)Selected >= FindResults->ResultCount) Selected = 0;
+	FindChosenId = FindResults->Results[Selected].Id;
+	FindResultChosen = true;
+	FindDialogCloseRequested = true;
+}
+
+
+static INT_PTR CALLBACK FindDialogProc(HWND hDlg, UINT message, WPARAM wParam, LPARAM lParam)
+{
+	switch (message)
+	{
+		case WM_INITDIALOG:
+		{
+			FindDialog = hDlg;
+			SetWindowTextW(hDlg, L"Find");
+			HFONT Font = GetDefaultGuiFont(&FindDialogFont, 0, hDlg, nullptr);
+			HWND Pattern = CreateWindowExW(WS_EX_CLIENTEDGE, L"EDIT", L"", WS_CHILD | WS_VISIBLE | WS_TABSTOP | ES_AUTOHSCROLL,
+				0, 0, 0, 0, hDlg, (HMENU)IDC_FIND_PATTERN, hInst, nullptr);
+			HWND Results = CreateWindowExW(WS_EX_CLIENTEDGE, L"LISTBOX", L"", WS_CHILD | WS_VISIBLE | WS_TABSTOP | WS_VSCROLL | LBS_NOTIFY | LBS_NOINTEGRALHEIGHT,
+				0, 0, 0, 0, hDlg, (HMENU)IDC_FIND_RESULTS, hInst, nullptr);
+			SendMessageW(Pattern, WM_SETFONT, (WPARAM)Font, false);
+			SendMessageW(Results, WM_SETFONT, (WPARAM)Font, false);
+			LayoutFindDialog(hDlg);
+			SetFocus(Pattern);
+			StartFindQuery(hDlg);
+			// The focus has been set.
+			return false;
+		}
+		case WM_SIZE:
+		{
+			LayoutFindDialog(hDlg);
+			return true;
+		}
+		case WM_COMMAND:
+		{
+			switch (LOWORD(wParam))
+			{
+				case IDC_FIND_PATTERN:
+				{
+					if (HIWORD(wParam) == EN_CHANGE) StartFindQuery(hDlg);
+					return true;
+				}
+				case IDC_FIND_RESULTS:
+				{
+					if (HIWORD(wParam) == LBN_DBLCLK) ChooseFindResult(hDlg);
+					return true;
+				}
+				case IDOK:
+				{
+					// Enter, in either control.
+					ChooseFindResult(hDlg);
+					return true;
+				}
+				case IDCANCEL:
+				{
+					FindDialogCloseRequested = true;
+					return true;
+				}
+			}
+			break;
+		}
+		case WM_CLOSE:
+		{
+			FindDialogCloseRequested = true;
+			return true;
+		}
+	}
+	return false;
+}
+
+
+// Runs the Find dialog, and shows the result that was picked in it, if any.
+static void ShowFindDialog(HWND hWnd)
+{
+	DLGTEMPLATE_EMPTY Template = {};
+	Template.style = WS_CAPTION | WS_SYSMENU | WS_POPUP | WS_THICKFRAME | DS_CENTER;
+	Template.cx = 360;
+	Template.cy = 240;
+	FindDialogCloseRequested = false;
+	FindResultChosen = false;
+	HWND hDlg = CreateDialogIndirectParamW(hInst, (LPCDLGTEMPLATEW)&Template, hWnd, FindDialogProc, 0);
+	if (hDlg == nullptr) return;
+	ShowWindowModal(hDlg, &FindDialogCloseRequested);
+
+	FindDialog = nullptr;
+	SearchQueryFree(FindResults);
+	FindResults = nullptr;
+	if (FindResultChosen)
+	{
+		OpenSearchResult(hWnd, FindChosenId);
+	}
+}
+
+
+// Runs everything that was waiting for the clipboard, and closes it again.
+static void RunPendingClipboardActions(HWND hWnd)
+{
+	ULONGLONG TraceStart = TraceBegin();
+	UINT Actions = PendingClipboardActions;
+	PendingClipboardActions = 0;
+	ClipboardAcquired = true;
+
+	if (Actions & (PENDING_CLEAR | PENDING_COPY))
+	{
+		EmptyClipboard();
+	}
+	if ((Actions & PENDING_COPY) && PendingCopyData != nullptr)
+	{
+		if (SetClipboardData(CF_UNICODETEXT, PendingCopyData) == nullptr)
+		{
+			GlobalFree(PendingCopyData);
+		}
+		PendingCopyData = nullptr;
+	}
+	// Everything needed from the clipboard is copied in one go, and all the rest waits until it is closed again. Only
+	// the payloads that are needed are copied: the captured one, and the one that is to be inspected.
+	UINT InspectFormat = PendingInspectFormat;
+	PendingInspectFormat = 0;
+	CLIPBOARD_SNAPSHOT_REQUEST Requests[2];
+	UINT RequestCount = 0;
+	UINT CaptureItem = 0;
+	UINT InspectItem = 0;
+	if (Actions & PENDING_CAPTURE)
+	{
+		CaptureItem = RequestCount;
+		Requests[RequestCount++] = CaptureSnapshotRequest;
+	}
+	if ((Actions & PENDING_INSPECT) && InspectFormat != 0)
+	{
+		InspectItem = RequestCount;
+		Requests[RequestCount].Formats = &InspectFormat;
+		Requests[RequestCount++].Count = 1;
+	}
+	BOOL Snapshotted = false;
+	if (Actions & (PENDING_CAPTURE | PENDING_INSPECT | PENDING_LIST_FORMATS))
+	{
+		Snapshotted = ClipboardSnapshotTake(&ClipboardSnapshot, &ClipboardBackend, Requests, RequestCount);
+	}
+	if (Actions & PENDING_CAPTURE)
+	{
+		LastClipboardSequenceNumber = ClipboardSnapshot.SequenceNumber;
+	}
+
+	ClipboardAcquirerRelease(&ClipboardAcquirer, GetMonotonicTimeUs());
+	TraceEnd("ClipboardOpen", TraceStart, LastClipboardSequenceNumber);
+
+	CAPTURE_JOB *Job = nullptr;
+	if (Snapshotted)
+	{
+		FormatInspectorUpdate(&FormatInspector, &ClipboardSnapshot);
+		if ((Actions & PENDING_INSPECT) && InspectFormat != 0)
+		{
+			const CLIPBOARD_SNAPSHOT_ITEM *Item = &ClipboardSnapshot.Items[InspectItem];
+			FormatInspectorSetData(&FormatInspector, InspectFormat, Item->Format != 0 ? Item->Data : nullptr, Item->SizeCb);
+		}
+		if (Actions & PENDING_CAPTURE)
+		{
+			// Last, because it may take over the arena.
+			Job = CaptureClipboardSnapshot(CaptureItem);
+		}
+		ClipboardSnapshotRelease(&ClipboardSnapshot);
+	}
+
+	UpdateWindowTitle(hWnd);
+	if (Job != nullptr)
+	{
+		// Refreshing by hand starts the trace here, without a notification.
+		Job->TraceStartTicks = ClipboardUpdateTraceStart != 0 ? ClipboardUpdateTraceStart : TraceStart;
+		// This also cancels the decoding of anything captured before.
+		CaptureWorkerSubmit(&CaptureWorker, Job);
+	}
+	else if (Actions & PENDING_CAPTURE)
+	{
+		CaptureWorkerCancel(&CaptureWorker);
+		HistoryPosition = 0;
+		ShowHistoryEntry(hWnd, nullptr);
+	}
+	if (Actions & PENDING_CAPTURE)
+	{
+		ClipboardUpdateTraceStart = 0;
+	}
+	if (Actions & PENDING_INSPECT)
+	{
+		ShowInspectedFormat(hWnd, InspectFormat);
+	}
+	if (Actions & PENDING_CLEAR)
+	{
+		InvalidateRect(hWnd, nullptr, false);
+	}
+}
+
+
+static void HandleAcquireResult(HWND hWnd, ACQUIRE_RESULT Result, ULONGLONG RetryDelayUs)
+{
+	switch (Result)
+	{
+		case ACQUIRE_OPENED:
+		{
+			RunPendingClipboardActions(hWnd);
+			break;
+		}
+		case ACQUIRE_RETRY:
+		{
+			// A delay of 0 means an acquisition is already pending, and its timer is still running.
+			if (RetryDelayUs != 0)
+			{
+				UINT DelayMs = (UINT)((RetryDelayUs + 999) / 1000);
+				SetTimer(hWnd, TIMER_ACQUIRE_CLIPBOARD, DelayMs, nullptr);
+			}
+			break;
+		}
+		case ACQUIRE_FAILED:
+		{
+			// The clipboard is still held by someone else. If it changes in the meantime, we hear about it again.
+			PendingClipboardActions = 0;
+			PendingInspectFormat = 0;
+			if (PendingCopyData != nullptr)
+			{
+				GlobalFree(PendingCopyData);
+				PendingCopyData = nullptr;
+			}
+			ClipboardAcquired = true;
+			UpdateWindowTitle(hWnd);
+			break;
+		}
+	}
+}
+
+
+// Opens the clipboard as soon as possible, without blocking, and then runs Actions.
+static void RequestClipboard(HWND hWnd, UINT Actions)
+{
+	PendingClipboardActions |= Actions;
+	ULONGLONG RetryDelayUs;
+	ACQUIRE_RESULT Result = ClipboardAcquirerBegin(&ClipboardAcquirer, GetMonotonicTimeUs(), &RetryDelayUs);
+	HandleAcquireResult(hWnd, Result, RetryDelayUs);
+}
+
+
+static void UpdateClipboard(HWND hWnd)
+{
+	// Many applications announce a single copy several times. If the clipboard has not changed since the last capture,
+	// there is nothing to do.
+	DWORD SequenceNumber = ClipboardBackend.GetSequenceNumber(ClipboardBackend.Context);
+	if (SequenceNumber != 0 && SequenceNumber == LastClipboardSequenceNumber && !ClipboardAcquirerIsPending(&ClipboardAcquirer))
+	{
+		ShowNewestHistoryEntry(hWnd);
+		return;
+	}
+
+	RequestClipboard(hWnd, PENDING_CAPTURE);
+}
+
+
+// Size of the displayed content in pixels, i.e. the scroll range. Returns false if nothing is displayed.
+static BOOL GetContentSize(HWND hWnd, SIZE *Size)
+{
+	if (CurrentImage != nullptr)
+	{
+		*Size = GetZoomedImageSize();
+		return true;
+	}
+	if (CurrentText != nullptr)
+	{
+		GetMonospaceFont(hWnd);
+		// Scroll positions are ints; the very end of extremely long texts cannot be reached.
+		// While the text is still being indexed, this only covers the lines indexed so far.
+		CurrentTextLineCount = TextLineIndexGetLineCount(&CurrentTextIndex);
+		ULONGLONG Width = (ULONGLONG)TextLineIndexGetMaxColumns(&CurrentTextIndex) * TextCharWidth;
+		ULONGLONG Height = (ULONGLONG)CurrentTextLineCount * TextLineHeight;
+		Size->cx = (LONG)(Width < MAXINT ? Width : MAXINT);
+		Size->cy = (LONG)(Height < MAXINT ? Height : MAXINT);
+		return true;
+	}
+	if (CurrentHexData != nullptr)
+	{
+		GetMonospaceFont(hWnd);
+		// Same limitation as for text: rows beyond MAXINT pixels cannot be scrolled to.
+		ULONGLONG Height = HexDumpGetRowCount(&CurrentHexDump) * TextLineHeight;
+		Size->cx = CurrentHexDump.RowLength * TextCharWidth;
+		Size->cy = (LONG)(Height < MAXINT ? Height : MAXINT);
+		return true;
+	}
+	return false;
+}
+
+
+// Sets the scroll ranges to the size of the displayed content. If ResetPosition is true, text is scrolled back to
+// the top left.
+static void UpdateScrollBars(HWND hWnd, BOOL ResetPosition)
+{
+	SCROLLINFO ScrollInfo = {};
+	ScrollInfo.cbSize = sizeof(ScrollInfo);
+	SIZE ContentSize;
+	if (GetContentSize(hWnd, &ContentSize))
+	{
+		// This is bugged.
+		// Even if you toggle scroll bar visibility by turning the window style on and off it doesn't fix it.
+		// Forcing the scroll bars to be visible *before* changing the scroll bar parameters is required to fix this.
+		// If the scroll bar is not already visible at the time a SIF_DISABLENOSCROLL thing is sent, it won't show.
+		ShowScrollBar(hWnd, SB_VERT, true);
+		ShowScrollBar(hWnd, SB_HORZ, true);
+		SIZE ClientSize = GetClientSize(hWnd);
+		ScrollInfo.fMask = SIF_DISABLENOSCROLL | SIF_PAGE | SIF_RANGE;
+		if ((CurrentText != nullptr || CurrentHexData != nullptr) && ResetPosition)
+		{
+			// New text starts at the top left, like it did in the EDIT control.
+			ScrollInfo.fMask |= SIF_POS;
+		}
+		ScrollInfo.nPage = ClientSize.cy;
+		ScrollInfo.nMax = ContentSize.cy - 1;
+		SetScrollInfo(hWnd, SB_VERT, &ScrollInfo, true);
+		ScrollInfo.nPage = ClientSize.cx;
+		ScrollInfo.nMax = ContentSize.cx - 1;
+		SetScrollInfo(hWnd, SB_HORZ, &ScrollInfo, true);
+	}
+	else
+	{
+		ScrollInfo.fMask = SIF_PAGE | SIF_RANGE;
+		// This makes the scroll bars effectively invisible.
+		SetScrollInfo(hWnd, SB_VERT, &ScrollInfo, true);
+		SetScrollInfo(hWnd, SB_HORZ, &ScrollInfo, true);
+	}
+}
+
+
+// Called initially, and whenever a different history entry is displayed.
+static void UpdateCapturedContent(HWND hWnd)
+{
+	UpdateScrollBars(hWnd, true);
+	InvalidateRect(hWnd, nullptr, true);
+}
+
+
+// More of the displayed text has been indexed. The scroll ranges grow, and lines that were missing so far may now
+// be visible.
+static void UpdateTextIndexProgress(HWND hWnd)
+{
+	SIZE_T PreviousLineCount = CurrentTextLineCount;
+	UpdateScrollBars(hWnd, false);
+
+	SCROLLINFO ScrollInfo = {};
+	ScrollInfo.cbSize = sizeof(ScrollInfo);
+	ScrollInfo.fMask = SIF_POS;
+	GetScrollInfo(hWnd, SB_VERT, &ScrollInfo);
+	ULONGLONG VisibleBottom = (ULONGLONG)ScrollInfo.nPos + GetClientHeight(hWnd);
+	if ((ULONGLONG)PreviousLineCount * TextLineHeight < VisibleBottom)
+	{
+		InvalidateRect(hWnd, nullptr, false);
+	}
+}
+
+
+// Zooms CurrentImage, keeping the point under (AnchorX, AnchorY) in the client area where it is. With ToFit, Zoom is
+// ignored, and the image is fitted into the window.
+static void SetImageZoom(HWND hWnd, double Zoom, BOOL ToFit, INT AnchorX, INT AnchorY)
+{
+	if (CurrentImage == nullptr) return;
+	if (ToFit) Zoom = GetFitZoom(hWnd);
+	if (Zoom < IMAGE_ZOOM_MIN) Zoom = IMAGE_ZOOM_MIN;
+	if (Zoom > IMAGE_ZOOM_MAX) Zoom = IMAGE_ZOOM_MAX;
+	// Repeated steps do not come back to exactly 1, but the actual size is the one that is drawn from the tiles.
+	if (fabs(Zoom - 1) < 1e-6) Zoom = 1;
+
+	SCROLLINFO ScrollInfo = {};
+	ScrollInfo.cbSize = sizeof(ScrollInfo);
+	ScrollInfo.fMask = SIF_POS;
+	GetScrollInfo(hWnd, SB_HORZ, &ScrollInfo);
+	double AnchorImageX = (ScrollInfo.nPos + AnchorX) / ImageZoom;
+	GetScrollInfo(hWnd, SB_VERT, &ScrollInfo);
+	double AnchorImageY = (ScrollInfo.nPos + AnchorY) / ImageZoom;
+
+	ImageZoom = Zoom;
+	ImageZoomToFit = ToFit;
+	UpdateScrollBars(hWnd, false);
+	// SetScrollInfo clamps the positions to the new ranges.
+	double ScrollH = floor(AnchorImageX * Zoom - AnchorX + 0.5);
+	double ScrollV = floor(AnchorImageY * Zoom - AnchorY + 0.5);
+	ScrollInfo.nPos = (int)(ScrollH < 0 ? 0 : ScrollH < MAXINT ? ScrollH : MAXINT);
+	SetScrollInfo(hWnd, SB_HORZ, &ScrollInfo, true);
+	ScrollInfo.nPos = (int)(ScrollV < 0 ? 0 : ScrollV < MAXINT ? ScrollV : MAXINT);
+	SetScrollInfo(hWnd, SB_VERT, &ScrollInfo, true);
+
+	UpdateWindowTitle(hWnd);
+	InvalidateRect(hWnd, nullptr, false);
+}
+
+
+// Zooms around the center of the client area.
+static void StepImageZoom(HWND hWnd, double Factor)
+{
+	SIZE ClientSize = GetClientSize(hWnd);
+	SetImageZoom(hWnd, ImageZoom * Factor, false, ClientSize.cx / 2, ClientSize.cy / 2);
+}
+
+
+// The selection in CurrentText, from Start up to End.
+static void GetTextSelection(SIZE_T *Start, SIZE_T *End)
+{
+	*Start = SelectionAnchor < SelectionCaret ? SelectionAnchor : SelectionCaret;
+	*End = SelectionAnchor < SelectionCaret ? SelectionCaret : SelectionAnchor;
+}
+
+
+static void SetTextSelection(HWND hWnd, SIZE_T Anchor, SIZE_T Caret)
+{
+	if (Anchor == SelectionAnchor && Caret == SelectionCaret) return;
+	SelectionAnchor = Anchor;
+	SelectionCaret = Caret;
+	InvalidateRect(hWnd, nullptr, false);
+}
+
+
+// The caret position in CurrentText closest to the point in the client area. Points below the lines indexed so far
+// are at the end of the last one.
+static SIZE_T GetTextOffsetFromPoint(HWND hWnd, INT x, INT y)
+{
+	SIZE_T LineCount = TextLineIndexGetLineCount(&CurrentTextIndex);
+	if (LineCount == 0) return 0;
+	SCROLLINFO ScrollInfo = {};
+	ScrollInfo.cbSize = sizeof(ScrollInfo);
+	ScrollInfo.fMask = SIF_POS;
+	GetScrollInfo(hWnd, SB_VERT, &ScrollInfo);
+	LONGLONG Top = (LONGLONG)ScrollInfo.nPos + y;
+	GetScrollInfo(hWnd, SB_HORZ, &ScrollInfo);
+	LONGLONG Left = (LONGLONG)ScrollInfo.nPos + x + TextCharWidth / 2;
+
+	SIZE_T Line = Top < 0 ? 0 : (SIZE_T)(Top / TextLineHeight);
+	if (Line >= LineCount)
+	{
+		SIZE_T Start, Length;
+		TextLineIndexGetLine(&CurrentTextIndex, LineCount - 1, &Start, &Length);
+		return Start + Length;
+	}
+	return TextLayoutGetOffset(&CurrentTextIndex, Line, Left < 0 ? 0 : (SIZE_T)(Left / TextCharWidth));
+}
+
+
+// Puts the selected text on the clipboard, once it can be opened.
+static void CopyTextSelection(HWND hWnd)
+{
+	SIZE_T Start, End;
+	GetTextSelection(&Start, &End);
+	if (CurrentText == nullptr || Start == End) return;
+	HGLOBAL Data = GlobalAlloc(GMEM_MOVEABLE, (End - Start + 1) * sizeof(WCHAR));
+	if (Data == nullptr) return;
+	WCHAR *Copy = (WCHAR *)GlobalLock(Data);
+	memcpy(Copy, CurrentText + Start, (End - Start) * sizeof(WCHAR));
+	Copy[End - Start] = 0;
+	GlobalUnlock(Data);
+	if (PendingCopyData != nullptr)
+	{
+		GlobalFree(PendingCopyData);
+	}
+	PendingCopyData = Data;
+	RequestClipboard(hWnd, PENDING_COPY);
+}
+
+
+// Draws the lines and columns of CurrentText that intersect PaintRect, and fills the rest of PaintRect with the
+// background. The selection is highlighted.
+static void PaintText(HWND hWnd, HDC hdc, const RECT *PaintRect, INT ScrollH, INT ScrollV)
+{
+	HGDIOBJ OldFont = SelectObject(hdc, GetMonospaceFont(hWnd));
+	SetTextColor(hdc, GetSysColor(COLOR_WINDOWTEXT));
+	SetBkColor(hdc, GetSysColor(COLOR_WINDOW));
+
+	SIZE_T FirstLine, EndLine;
+	TextLayoutGetVisibleLines(&CurrentTextIndex, (ULONGLONG)ScrollV + PaintRect->top, (ULONGLONG)ScrollV + PaintRect->bottom, TextLineHeight, &FirstLine, &EndLine);
+	SIZE_T FirstColumn = ((SIZE_T)ScrollH + PaintRect->left) / TextCharWidth;
+	SIZE_T EndColumn = ((SIZE_T)ScrollH + PaintRect->right + TextCharWidth - 1) / TextCharWidth;
+	SIZE_T MaxColumns = EndColumn - FirstColumn;
+	INT TextX = (INT)(FirstColumn * TextCharWidth) - ScrollH;
+
+	SIZE_T SelectionStart, SelectionEnd;
+	GetTextSelection(&SelectionStart, &SelectionEnd);
+
+	LONG Bottom = PaintRect->top;
+	if (MaxColumns > 0 && HeapPoolEnsure(&TextRunPool, MaxColumns * sizeof(WCHAR)))
+	{
+		for (SIZE_T Line = FirstLine; Line < EndLine; ++Line)
+		{
+			SIZE_T RunLength;
+			LPCWSTR Run = TextLayoutGetVisibleRun(&CurrentTextIndex, Line, FirstColumn, MaxColumns, (WCHAR *)TextRunPool.Data, &RunLength);
+			RECT LineRect = { PaintRect->left, (LONG)((LONGLONG)Line * TextLineHeight - ScrollV), PaintRect->right, 0 };
+			LineRect.bottom = LineRect.top + TextLineHeight;
+			// ETO_OPAQUE also fills the part of the line to the right of the text.
+			ExtTextOutW(hdc, TextX, LineRect.top, ETO_OPAQUE | ETO_CLIPPED, &LineRect, Run, (UINT)RunLength, nullptr);
+			Bottom = LineRect.bottom;
+
+			// The selected part of the line is drawn over it again, with the same run. A selected line break shows as
+			// one more selected cell.
+			SIZE_T Start, Length;
+			TextLineIndexGetLine(&CurrentTextIndex, Line, &Start, &Length);
+			if (SelectionStart < SelectionEnd && SelectionStart <= Start + Length && SelectionEnd > Start)
+			{
+				SIZE_T SelectedColumn = TextLayoutGetColumn(&CurrentTextIndex, Line, SelectionStart);
+				SIZE_T EndSelectedColumn = TextLayoutGetColumn(&CurrentTextIndex, Line, SelectionEnd) + (SelectionEnd > Start + Length ? 1 : 0);
+				if (SelectedColumn < FirstColumn) SelectedColumn = FirstColumn;
+				if (EndSelectedColumn > EndColumn) EndSelectedColumn = EndColumn;
+				if (SelectedColumn < EndSelectedColumn)
+				{
+					RECT SelectedRect = LineRect;
+					SelectedRect.left = (LONG)((LONGLONG)SelectedColumn * TextCharWidth - ScrollH);
+					SelectedRect.right = (LONG)((LONGLONG)EndSelectedColumn * TextCharWidth - ScrollH);
+					SetTextColor(hdc, GetSysColor(COLOR_HIGHLIGHTTEXT));
+					SetBkColor(hdc, GetSysColor(COLOR_HIGHLIGHT));
+					ExtTextOutW(hdc, TextX, LineRect.top, ETO_OPAQUE | ETO_CLIPPED, &SelectedRect, Run, (UINT)RunLength, nullptr);
+					SetTextColor(hdc, GetSysColor(COLOR_WINDOWTEXT));
+					SetBkColor(hdc, GetSysColor(COLOR_WINDOW));
+				}
+			}
+		}
+	}
+
+	SelectObject(hdc, OldFont);
+
+	RECT EmptyRect = { PaintRect->left, Bottom, PaintRect->right, PaintRect->bottom };
+	if (EmptyRect.bottom > EmptyRect.top)
+	{
+		FillRect(hdc, &EmptyRect, GetSysColorBrush(COLOR_WINDOW));
+	}
+}
+
+
+// Formats and draws the rows of CurrentHexDump that intersect PaintRect, and fills the rest of PaintRect with the
+// background.
+static void PaintHexDump(HWND hWnd, HDC hdc, const RECT *PaintRect, INT ScrollH, INT ScrollV)
+{
+	HGDIOBJ OldFont = SelectObject(hdc, GetMonospaceFont(hWnd));
+	SetTextColor(hdc, GetSysColor(COLOR_WINDOWTEXT));
+	SetBkColor(hdc, GetSysColor(COLOR_WINDOW));
+
+	ULONGLONG FirstRow, EndRow;
+	HexDumpGetVisibleRows(&CurrentHexDump, (ULONGLONG)ScrollV + PaintRect->top, (ULONGLONG)ScrollV + PaintRect->bottom, TextLineHeight, &FirstRow, &EndRow);
+
+	LONG Bottom = PaintRect->top;
+	for (ULONGLONG Row = FirstRow; Row < EndRow; ++Row)
+	{
+		// Rows are short, so they are always drawn as a whole and clipped.
+		WCHAR Text[HEX_DUMP_MAX_ROW_LENGTH];
+		UINT Length = HexDumpFormatRow(&CurrentHexDump, Row, Text);
+		RECT RowRect = { PaintRect->left, (LONG)((LONGLONG)Row * TextLineHeight - ScrollV), PaintRect->right, 0 };
+		RowRect.bottom = RowRect.top + TextLineHeight;
+		ExtTextOutW(hdc, -ScrollH, RowRect.top, ETO_OPAQUE | ETO_CLIPPED, &RowRect, Text, Length, nullptr);
+		Bottom = RowRect.bottom;
+	}
+
+	SelectObject(hdc, OldFont);
+
+	RECT EmptyRect = { PaintRect->left, Bottom, PaintRect->right, PaintRect->bottom };
+	if (EmptyRect.bottom > EmptyRect.top)
+	{
+		FillRect(hdc, &EmptyRect, GetSysColorBrush(COLOR_WINDOW));
+	}
+}
+
+
+// Copies the part of Image that starts at (SourceX, SourceY) to DestinationRect. The pixels go straight from the
+// pixel buffer to the device; there is no intermediate bitmap, unless the image is translucent and has to be composited.
+static void PaintPixelBuffer(HDC hdc, const RECT *DestinationRect, const PIXEL_BUFFER *Image, LONG SourceX, LONG SourceY)
+{
+	LONG Rows = DestinationRect->bottom - DestinationRect->top;
+	if (Image->HasAlpha)
+	{
+		LONG Width = DestinationRect->right - DestinationRect->left;
+		if (!HeapPoolEnsure(&ZoomedImagePool, (SIZE_T)Width * Rows * 4))
+		{
+			FillRect(hdc, DestinationRect, (HBRUSH)GetStockObject(BLACK_BRUSH));
+			return;
+		}
+		CompositeOverCheckerboard(Image->Pixels + SourceY * Image->Stride + (SIZE_T)SourceX * 4, Image->Stride, (BYTE *)ZoomedImagePool.Data,
+			(SIZE_T)Width * 4, Width, Rows, SourceX, SourceY);
+		BITMAPINFO BitmapInfo = {};
+		BitmapInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+		BitmapInfo.bmiHeader.biWidth = Width;
+		BitmapInfo.bmiHeader.biHeight = -Rows;
+		BitmapInfo.bmiHeader.biPlanes = 1;
+		BitmapInfo.bmiHeader.biBitCount = 32;
+		BitmapInfo.bmiHeader.biCompression = BI_RGB;
+		SetDIBitsToDevice(hdc, DestinationRect->left, DestinationRect->top, Width, Rows, 0, 0, 0, Rows, ZoomedImagePool.Data, &BitmapInfo, DIB_RGB_COLORS);
+		return;
+	}
+	BITMAPINFO BitmapInfo = {};
+	BitmapInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+	BitmapInfo.bmiHeader.biWidth = Image->Width;
+	BitmapInfo.bmiHeader.biHeight = -Rows; // Top-down, starting at row SourceY.
+	BitmapInfo.bmiHeader.biPlanes = 1;
+	BitmapInfo.bmiHeader.biBitCount = 32;
+	BitmapInfo.bmiHeader.biCompression = BI_RGB;
+	SetDIBitsToDevice(hdc, DestinationRect->left, DestinationRect->top, DestinationRect->right - DestinationRect->left, Rows,
+		SourceX, 0, 0, Rows, Image->Pixels + SourceY * Image->Stride, &BitmapInfo, DIB_RGB_COLORS);
+}
+
+
+// Tile cache callbacks. A tile is a bitmap that is compatible with the window, so that painting it is a plain BitBlt
+// without any format conversion.
+static void *CreateImageTile(void *Context, const PIXEL_BUFFER *Image, const TILE_BOUNDS *Bounds)
+{
+	// Copying the tile first keeps GDI from touching whole rows of the image.
+	static BYTE Pixels[TILE_SIZE * TILE_SIZE * 4];
+	CopyTilePixels(Image, Bounds, Pixels);
+	if (Image->HasAlpha)
+	{
+		CompositeOverCheckerboard(Pixels, (SIZE_T)Bounds->Width * 4, Pixels, (SIZE_T)Bounds->Width * 4, Bounds->Width, Bounds->Height, Bounds->X, Bounds->Y);
+	}
+
+	HWND hWnd = (HWND)Context;
+	HDC hdc = GetDC(hWnd);
+	HBITMAP Bitmap = CreateCompatibleBitmap(hdc, Bounds->Width, Bounds->Height);
+	if (Bitmap != nullptr)
+	{
+		HDC MemoryDC = CreateCompatibleDC(hdc);
+		HGDIOBJ OldBitmap = SelectObject(MemoryDC, Bitmap);
+		BITMAPINFO BitmapInfo = {};
+		BitmapInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+		BitmapInfo.bmiHeader.biWidth = Bounds->Width;
+		BitmapInfo.bmiHeader.biHeight = -Bounds->Height;
+		BitmapInfo.bmiHeader.biPlanes = 1;
+		BitmapInfo.bmiHeader.biBitCount = 32;
+		BitmapInfo.bmiHeader.biCompression = BI_RGB;
+		SetDIBitsToDevice(MemoryDC, 0, 0, Bounds->Width, Bounds->Height, 0, 0, 0, Bounds->Height, Pixels, &BitmapInfo, DIB_RGB_COLORS);
+		SelectObject(MemoryDC, OldBitmap);
+		DeleteDC(MemoryDC);
 	}
-	else
+	ReleaseDC(hWnd, hdc);
+	return Bitmap;
+}
+
+
+static void DestroyImageTile(void *Context, void *Tile)
+{
+	DeleteObject((HBITMAP)Tile);
+}
+
+
+// Draws the tiles of CurrentImage that intersect PaintRect, clipped to it. Tiles that cannot be cached are copied
+// straight from the pixel buffer.
+static void PaintImage(HDC hdc, const RECT *PaintRect, INT ScrollH, INT ScrollV)
+{
+	TileCacheSetImage(&ImageTiles, CurrentImage);
+	TILE_RANGE Range;
+	if (!GetVisibleTiles(CurrentImage->Width, CurrentImage->Height, (LONGLONG)PaintRect->left + ScrollH, (LONGLONG)PaintRect->top + ScrollV,
+		(LONGLONG)PaintRect->right + ScrollH, (LONGLONG)PaintRect->bottom + ScrollV, &Range))
 	{
-		ScrollInfo.fMask = SIF_PAGE | SIF_RANGE;
-		// This makes the scroll bars effectively invisible.
-		SetScrollInfo(hWnd, SB_VERT, &ScrollInfo, true);
-		SetScrollInfo(hWnd, SB_HORZ, &ScrollInfo, true);
+		return;
 	}
 
-	// Update edit control
-	if (CurrentText != nullptr)
+	HDC MemoryDC = CreateCompatibleDC(hdc);
+	for (LONG Row = Range.FirstRow; Row < Range.EndRow; ++Row)
 	{
-		if (CurrentEditControl == nullptr)
+		for (LONG Column = Range.FirstColumn; Column < Range.EndColumn; ++Column)
 		{
-			CurrentEditControl = CreateEditControl(hWnd);
+			TILE_BOUNDS Bounds;
+			GetTileBounds(CurrentImage->Width, CurrentImage->Height, Column, Row, &Bounds);
+			RECT TileRect = { Bounds.X - ScrollH, Bounds.Y - ScrollV, Bounds.X + Bounds.Width - ScrollH, Bounds.Y + Bounds.Height - ScrollV };
+			RECT DrawRect;
+			if (!IntersectRect(&DrawRect, &TileRect, PaintRect)) continue;
+
+			HBITMAP Tile = MemoryDC != nullptr ? (HBITMAP)TileCacheGet(&ImageTiles, Column, Row) : nullptr;
+			if (Tile != nullptr)
+			{
+				HGDIOBJ OldBitmap = SelectObject(MemoryDC, Tile);
+				BitBlt(hdc, DrawRect.left, DrawRect.top, DrawRect.right - DrawRect.left, DrawRect.bottom - DrawRect.top,
+					MemoryDC, DrawRect.left - TileRect.left, DrawRect.top - TileRect.top, SRCCOPY);
+				SelectObject(MemoryDC, OldBitmap);
+			}
+			else
+			{
+				PaintPixelBuffer(hdc, &DrawRect, CurrentImage, DrawRect.left + ScrollH, DrawRect.top + ScrollV);
+			}
 		}
-		SetWindowTextW(CurrentEditControl, CurrentText);
 	}
-	else
+	if (MemoryDC != nullptr) DeleteDC(MemoryDC);
+}
+
+
+// Draws the part of CurrentImage at ImageZoom that intersects PaintRect, resampled from the image or its mip pyramid.
+// Only the damaged area is resampled, so scrolling costs the same at any zoom.
+static void PaintZoomedImage(HDC hdc, const RECT *PaintRect, INT ScrollH, INT ScrollV)
+{
+	SIZE ImageSize = GetZoomedImageSize();
+	RECT ImageRect = { -ScrollH, -ScrollV, ImageSize.cx - ScrollH, ImageSize.cy - ScrollV };
+	RECT DrawRect;
+	if (!IntersectRect(&DrawRect, &ImageRect, PaintRect)) return;
+	LONG Width = DrawRect.right - DrawRect.left;
+	LONG Height = DrawRect.bottom - DrawRect.top;
+	if (!HeapPoolEnsure(&ZoomedImagePool, (SIZE_T)Width * Height * 4))
 	{
-		// Text is null; remove EDIT control
-		if (CurrentEditControl != nullptr)
-		{
-			DestroyWindow(CurrentEditControl);
-			CurrentEditControl = nullptr;
-		}
+		FillRect(hdc, &DrawRect, (HBRUSH)GetStockObject(BLACK_BRUSH));
+		return;
+	}
+	MipResample(CurrentImage, ImageZoom, (LONGLONG)DrawRect.left + ScrollH, (LONGLONG)DrawRect.top + ScrollV, Width, Height,
+		(BYTE *)ZoomedImagePool.Data, (SIZE_T)Width * 4);
+	if (CurrentImage->HasAlpha)
+	{
+		CompositeOverCheckerboard((BYTE *)ZoomedImagePool.Data, (SIZE_T)Width * 4, (BYTE *)ZoomedImagePool.Data, (SIZE_T)Width * 4, Width, Height,
+			(LONGLONG)DrawRect.left + ScrollH, (LONGLONG)DrawRect.top + ScrollV);
 	}
 
-	InvalidateRect(hWnd, nullptr, true);
+	BITMAPINFO BitmapInfo = {};
+	BitmapInfo.bmiHeader.biSize = sizeof(BITMAPINFOHEADER);
+	BitmapInfo.bmiHeader.biWidth = Width;
+	BitmapInfo.bmiHeader.biHeight = -Height;
+	BitmapInfo.bmiHeader.biPlanes = 1;
+	BitmapInfo.bmiHeader.biBitCount = 32;
+	BitmapInfo.bmiHeader.biCompression = BI_RGB;
+	SetDIBitsToDevice(hdc, DrawRect.left, DrawRect.top, Width, Height, 0, 0, 0, Height, ZoomedImagePool.Data, &BitmapInfo, DIB_RGB_COLORS);
 }
 
 
 static int ScrollAmountPerLine = 10;
 
+// Text and hex dumps scroll by whole lines and characters.
+static int GetScrollAmountPerLine(int nBar)
+{
+	if (CurrentText != nullptr || CurrentHexData != nullptr)
+	{
+		return nBar == SB_VERT ? TextLineHeight : TextCharWidth;
+	}
+	return ScrollAmountPerLine;
+}
+
 static BOOL Panning;
 static int PanningX;
 static int PanningY;
@@ -278,6 +2222,21 @@ enum MONITORING_MODE
 static MONITORING_MODE MonitoringMode = MONITORING_AUTO;
 
 
+static void SetCoalesceTimer(HWND hWnd, ULONGLONG DeadlineUs)
+{
+	ULONGLONG NowUs = GetMonotonicTimeUs();
+	UINT DelayMs = DeadlineUs > NowUs ? (UINT)((DeadlineUs - NowUs + 999) / 1000) : 0;
+	SetTimer(hWnd, TIMER_COALESCE, DelayMs, nullptr);
+}
+
+
+static void CancelCoalescedUpdate(HWND hWnd)
+{
+	CoalescerCancel(&UpdateCoalescer);
+	KillTimer(hWnd, TIMER_COALESCE);
+}
+
+
 // Updates the menu according to TurnedOn.
 static void UpdateMenuState(HWND hWnd, HMENU hMenu)
 {
@@ -310,22 +2269,138 @@ static void UpdateMenuState(HWND hWnd, HMENU hMenu)
 }
 
 
+// Fills the Formats menu with the formats currently on the clipboard. If the list is out of date, this asks for the
+// clipboard to enumerate them, but does not wait for it: if it is busy, the list is updated once the acquirer gets it.
+static void RebuildFormatsMenu(HWND hWnd)
+{
+	while (GetMenuItemCount(FormatsMenu) > 0)
+	{
+		DeleteMenu(FormatsMenu, 0, MF_BYPOSITION);
+	}
+	FormatMenuCount = 0;
+
+	BOOL b = AppendMenuW(FormatsMenu, MF_STRING, IDM_SHOW_FORMATS, L"Show Format List"); assert(b);
+	b = AppendMenuW(FormatsMenu, MF_SEPARATOR, 0, nullptr); assert(b);
+
+	if (FormatInspectorIsStale(&FormatInspector))
+	{
+		// Through the acquirer like every other use of the clipboard, so that how long it was held shows in the title.
+		// If it opens right away, the list is up to date now.
+		RequestClipboard(hWnd, PENDING_LIST_FORMATS);
+		if (ClipboardAcquirerIsPending(&ClipboardAcquirer))
+		{
+			b = AppendMenuW(FormatsMenu, MF_STRING | MF_GRAYED, 0, L"(Clipboard is busy)"); assert(b);
+			return;
+		}
+	}
+
+	for (UINT i = 0; i < FormatInspector.Count && FormatMenuCount < FORMAT_MENU_MAX_ITEMS; ++i)
+	{
+		const CLIPBOARD_FORMAT_INFO *Info = &FormatInspector.Formats[i];
+		WCHAR Text[FORMAT_NAME_LENGTH + 64];
+		if (Info->Name[0] != 0)
+		{
+			StringCchPrintfW(Text, _countof(Text), L"%s (%u)", (LPCWSTR)Info->Name, Info->Format);
+		}
+		else
+		{
+			StringCchPrintfW(Text, _countof(Text), L"Format %u", Info->Format);
+		}
+		if (Info->Fetched && !Info->Unavailable)
+		{
+			WCHAR Size[32];
+			StringCchPrintfW(Size, _countof(Size), L"\t%llu bytes", (ULONGLONG)Info->SizeCb);
+			StringCchCatW(Text, _countof(Text), Size);
+		}
+		FormatMenuFormats[FormatMenuCount] = Info->Format;
+		b = AppendMenuW(FormatsMenu, MF_STRING, IDM_FORMAT_FIRST + FormatMenuCount, Text); assert(b);
+		++FormatMenuCount;
+	}
+	if (FormatInspector.Count == 0)
+	{
+		b = AppendMenuW(FormatsMenu, MF_STRING | MF_GRAYED, 0, L"(Clipboard is empty)"); assert(b);
+	}
+}
+
+
 LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 {
 	switch (message)
 	{
 		case WM_CREATE:
 		{
-			HRESULT hr = BufferedPaintInit(); assert(SUCCEEDED(hr));
+			BOOL b = ClipboardHistoryInit(&History, HISTORY_MAX_ENTRIES, HISTORY_ARENA_SIZE, HISTORY_BYTE_BUDGET); assert(b);
+			HammingIndexInit(&ImageHashes);
+			if (HistoryDirectory[0] != 0)
+			{
+				HistoryStoreOpened = HistoryStoreOpen(&HistoryStore, HistoryDirectory, HISTORY_STORE_SEGMENT_SIZE);
+				if (HistoryStoreOpened)
+				{
+					LoadStoredHistory();
+				}
+				else
+				{
+					MessageBoxW(hWnd, L"The history directory could not be opened. Captures will not be saved.", L"Clipboard Monitor", MB_OK | MB_ICONERROR);
+				}
+			}
+			b = SearchWorkerStart(&SearchWorker, HistoryStoreOpened ? &HistoryStore : nullptr, SEARCH_TEXT_BUDGET, NotifySearchDone, hWnd); assert(b);
+			if (HistoryStoreOpened)
+			{
+				IndexStoredHistory();
+			}
 
-			BOOL b = AddClipboardFormatListener(hWnd); assert(b);
+			// Another application may hold the clipboard for a while, so keep trying for a bit, but back off quickly.
+			CLIPBOARD_ACQUIRER_CONFIG AcquirerConfig = {};
+			AcquirerConfig.MaxAttempts = 20;
+			AcquirerConfig.MaxWaitUs = 2000 * 1000;
+			AcquirerConfig.InitialDelayUs = 5 * 1000;
+			AcquirerConfig.MaxDelayUs = 100 * 1000;
+			AcquirerConfig.JitterPercent = 25;
+			Win32ClipboardBackendInit(&ClipboardBackend, hWnd);
+			CaptureRegisterFormats(&ClipboardBackend);
+			FormatInspectorInit(&FormatInspector, &ClipboardBackend);
+			ClipboardSnapshotInit(&ClipboardSnapshot);
+			ClipboardAcquirerInit(&ClipboardAcquirer, &ClipboardBackend, &AcquirerConfig, GetCurrentProcessId() ^ GetTickCount());
+			b = CaptureWorkerStart(&CaptureWorker, NotifyCaptureDone, hWnd); assert(b);
+			TileCacheInit(&ImageTiles, IMAGE_TILE_CACHE_BYTES, CreateImageTile, DestroyImageTile, hWnd);
+
+			COALESCER_CONFIG CoalescerConfig = {};
+			CoalescerConfig.QuietUs = COALESCE_QUIET_US;
+			CoalescerConfig.MaxLatencyUs = COALESCE_MAX_LATENCY_US;
+			CoalescerInit(&UpdateCoalescer, &CoalescerConfig);
+
+			b = AddClipboardFormatListener(hWnd); assert(b);
 
 			HMENU Menu = CreateMenu();
 			assert(Menu != nullptr);
+			FormatsMenu = CreatePopupMenu();
+			assert(FormatsMenu != nullptr);
 			MENUITEMINFOW MenuItemInfo = {};
 			MenuItemInfo.cbSize = sizeof(MenuItemInfo);
-			MenuItemInfo.fMask = MIIM_FTYPE | MIIM_ID | MIIM_STRING;
+			MenuItemInfo.fMask = MIIM_FTYPE | MIIM_SUBMENU | MIIM_STRING;
 			MenuItemInfo.fType = MFT_STRING;
+			MenuItemInfo.hSubMenu = FormatsMenu;
+			MenuItemInfo.dwTypeData = (LPWSTR)L"Formats";
+			b = InsertMenuItemW(Menu, 0, false, &MenuItemInfo); assert(b);
+			ZoomMenu = CreatePopupMenu();
+			assert(ZoomMenu != nullptr);
+			b = AppendMenuW(ZoomMenu, MF_STRING, IDM_ZOOM_IN, L"Zoom In (Ctrl+Plus)"); assert(b);
+			b = AppendMenuW(ZoomMenu, MF_STRING, IDM_ZOOM_OUT, L"Zoom Out (Ctrl+Minus)"); assert(b);
+			b = AppendMenuW(ZoomMenu, MF_STRING, IDM_ZOOM_FIT, L"Fit to Window (Ctrl+0)"); assert(b);
+			b = AppendMenuW(ZoomMenu, MF_STRING, IDM_ZOOM_ACTUAL, L"Actual Size (Ctrl+1)"); assert(b);
+			MenuItemInfo.hSubMenu = ZoomMenu;
+			MenuItemInfo.dwTypeData = (LPWSTR)L"Zoom";
+			b = InsertMenuItemW(Menu, 0, false, &MenuItemInfo); assert(b);
+			MenuItemInfo.fMask = MIIM_FTYPE | MIIM_ID | MIIM_STRING;
+			MenuItemInfo.wID = IDM_FIND;
+			MenuItemInfo.dwTypeData = (LPWSTR)L"Find (Ctrl+F)";
+			b = InsertMenuItemW(Menu, 0, false, &MenuItemInfo); assert(b);
+			MenuItemInfo.wID = IDM_HISTORY_NEWER;
+			MenuItemInfo.dwTypeData = (LPWSTR)L"Newer (Ctrl+Right)";
+			b = InsertMenuItemW(Menu, 0, false, &MenuItemInfo); assert(b);
+			MenuItemInfo.wID = IDM_HISTORY_OLDER;
+			MenuItemInfo.dwTypeData = (LPWSTR)L"Older (Ctrl+Left)";
+			b = InsertMenuItemW(Menu, 0, false, &MenuItemInfo); assert(b);
 			MenuItemInfo.wID = IDM_CLEAR_CLIPBOARD;
 			MenuItemInfo.dwTypeData = (LPWSTR)L"Clear Clipboard Data";
 			b = InsertMenuItemW(Menu, 0, false, &MenuItemInfo); assert(b);
@@ -339,21 +2414,38 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			b = SetMenu(hWnd, Menu); assert(b);
 
 			UpdateMenuState(hWnd, Menu);
-			UpdateCapturedContent(hWnd);
+			if (ClipboardHistoryCount(&History) > 0)
+			{
+				// Whatever was loaded from the history store.
+				ShowHistoryEntry(hWnd, ClipboardHistoryGet(&History, 0));
+			}
+			else
+			{
+				UpdateCapturedContent(hWnd);
+			}
 
 			return 0;
 		}
 
+		case WM_DISPLAYCHANGE:
+		{
+			// The cached tiles have the color format of the old display mode.
+			TileCacheClear(&ImageTiles);
+			InvalidateRect(hWnd, nullptr, false);
+			break;
+		}
+
 		case WM_DPICHANGED:
 		{
-			if (CurrentEditControl != nullptr)
+			if (FontMonospace != nullptr)
 			{
 				HFONT OldFont = FontMonospace;
 				FontMonospace = nullptr;
-				SetEditControlFont(CurrentEditControl, hWnd);
-				if (OldFont)
+				DeleteObject(OldFont);
+				if (CurrentText != nullptr || CurrentHexData != nullptr)
 				{
-					DeleteObject(OldFont);
+					// The line height and character width have changed, and with them the scroll range.
+					UpdateCapturedContent(hWnd);
 				}
 			}
 			break;
@@ -368,6 +2460,63 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 					UpdateClipboard(hWnd);
 					break;
 				}
+				case VK_LEFT:
+				case VK_RIGHT:
+				{
+					if (GetKeyState(VK_CONTROL) < 0)
+					{
+						SendMessageW(hWnd, WM_COMMAND, wParam == VK_LEFT ? IDM_HISTORY_OLDER : IDM_HISTORY_NEWER, 0);
+					}
+					else
+					{
+						ScrollTo(hWnd, SB_HORZ, SCROLLTO_RELATIVE, (wParam == VK_LEFT ? -1 : 1) * GetScrollAmountPerLine(SB_HORZ), nullptr);
+					}
+					break;
+				}
+				case 'F':
+				{
+					if (GetKeyState(VK_CONTROL) < 0)
+					{
+						SendMessageW(hWnd, WM_COMMAND, IDM_FIND, 0);
+					}
+					break;
+				}
+				case 'A':
+				{
+					if (GetKeyState(VK_CONTROL) < 0 && CurrentText != nullptr)
+					{
+						SetTextSelection(hWnd, 0, CurrentTextIndex.Length);
+					}
+					break;
+				}
+				case 'C':
+				{
+					if (GetKeyState(VK_CONTROL) < 0)
+					{
+						CopyTextSelection(hWnd);
+					}
+					break;
+				}
+				case VK_OEM_PLUS:
+				case VK_ADD:
+				case VK_OEM_MINUS:
+				case VK_SUBTRACT:
+				case '0':
+				case '1':
+				{
+					if (GetKeyState(VK_CONTROL) < 0)
+					{
+						UINT CommandID = wParam == VK_OEM_PLUS || wParam == VK_ADD ? IDM_ZOOM_IN :
+							wParam == VK_OEM_MINUS || wParam == VK_SUBTRACT ? IDM_ZOOM_OUT : wParam == '0' ? IDM_ZOOM_FIT : IDM_ZOOM_ACTUAL;
+						SendMessageW(hWnd, WM_COMMAND, CommandID, 0);
+					}
+					break;
+				}
+				default:
+				{
+					HandleWindowMessage_KeyDown_ForVScroll(hWnd, wParam, lParam, GetScrollAmountPerLine(SB_VERT), nullptr);
+					break;
+				}
 			}
 			return 0;
 		}
@@ -375,16 +2524,18 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 		case WM_COMMAND:
 		{
 			USHORT CommandID = LOWORD(wParam);
+			if (CommandID >= IDM_FORMAT_FIRST && CommandID < IDM_FORMAT_FIRST + FormatMenuCount)
+			{
+				// The payload is only copied now, once it has been asked for.
+				PendingInspectFormat = FormatMenuFormats[CommandID - IDM_FORMAT_FIRST];
+				RequestClipboard(hWnd, PENDING_INSPECT);
+				return 0;
+			}
 			switch (CommandID)
 			{
 				case IDM_CLEAR_CLIPBOARD:
 				{
-					if (OpenClipboard_ButTryABitHarder(hWnd))
-					{
-						EmptyClipboard();
-						CloseClipboard();
-						InvalidateRect(hWnd, nullptr, false);
-					}
+					RequestClipboard(hWnd, PENDING_CLEAR);
 					break;
 				}
 				case IDM_REFRESH:
@@ -392,9 +2543,54 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 					UpdateClipboard(hWnd);
 					break;
 				}
+				case IDM_HISTORY_OLDER:
+				{
+					ShowHistoryPosition(hWnd, HistoryPosition + 1);
+					break;
+				}
+				case IDM_HISTORY_NEWER:
+				{
+					if (HistoryPosition > 0)
+					{
+						ShowHistoryPosition(hWnd, HistoryPosition - 1);
+					}
+					break;
+				}
+				case IDM_SHOW_FORMATS:
+				{
+					RequestClipboard(hWnd, PENDING_INSPECT);
+					break;
+				}
+				case IDM_FIND:
+				{
+					ShowFindDialog(hWnd);
+					break;
+				}
+				case IDM_ZOOM_IN:
+				{
+					StepImageZoom(hWnd, IMAGE_ZOOM_STEP);
+					break;
+				}
+				case IDM_ZOOM_OUT:
+				{
+					StepImageZoom(hWnd, 1 / IMAGE_ZOOM_STEP);
+					break;
+				}
+				case IDM_ZOOM_FIT:
+				{
+					SetImageZoom(hWnd, 0, true, 0, 0);
+					break;
+				}
+				case IDM_ZOOM_ACTUAL:
+				{
+					StepImageZoom(hWnd, 1 / ImageZoom);
+					break;
+				}
 				case IDM_TOGGLE_AUTO:
 				{
 					MonitoringMode = (MONITORING_MODE)((MonitoringMode + 1) % MONITORING_MODE_COUNT);
+					// A burst that started in AUTO mode is not captured anymore once monitoring is OFF.
+					CancelCoalescedUpdate(hWnd);
 					UpdateMenuState(hWnd, nullptr);
 					break;
 				}
@@ -402,19 +2598,108 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			return 0;
 		}
 
+		case WM_INITMENUPOPUP:
+		{
+			if ((HMENU)wParam == FormatsMenu)
+			{
+				RebuildFormatsMenu(hWnd);
+			}
+			else if ((HMENU)wParam == ZoomMenu)
+			{
+				UINT Enable = CurrentImage != nullptr ? MF_ENABLED : MF_GRAYED;
+				EnableMenuItem(ZoomMenu, IDM_ZOOM_IN, MF_BYCOMMAND | Enable);
+				EnableMenuItem(ZoomMenu, IDM_ZOOM_OUT, MF_BYCOMMAND | Enable);
+				EnableMenuItem(ZoomMenu, IDM_ZOOM_FIT, MF_BYCOMMAND | Enable);
+				EnableMenuItem(ZoomMenu, IDM_ZOOM_ACTUAL, MF_BYCOMMAND | Enable);
+				CheckMenuItem(ZoomMenu, IDM_ZOOM_FIT, MF_BYCOMMAND | (ImageZoomToFit ? MF_CHECKED : MF_UNCHECKED));
+			}
+			return 0;
+		}
+
+		case WM_TIMER:
+		{
+			if (wParam == TIMER_ACQUIRE_CLIPBOARD)
+			{
+				KillTimer(hWnd, TIMER_ACQUIRE_CLIPBOARD);
+				ULONGLONG RetryDelayUs;
+				ACQUIRE_RESULT Result = ClipboardAcquirerRetry(&ClipboardAcquirer, GetMonotonicTimeUs(), &RetryDelayUs);
+				HandleAcquireResult(hWnd, Result, RetryDelayUs);
+			}
+			else if (wParam == TIMER_COALESCE)
+			{
+				KillTimer(hWnd, TIMER_COALESCE);
+				ULONGLONG DeadlineUs;
+				if (CoalescerPoll(&UpdateCoalescer, GetMonotonicTimeUs(), &DeadlineUs))
+				{
+					UpdateClipboard(hWnd);
+				}
+				else if (DeadlineUs != 0)
+				{
+					SetCoalesceTimer(hWnd, DeadlineUs);
+				}
+			}
+			return 0;
+		}
+
+		case WM_APP_CAPTURE_DONE:
+		{
+			// Results are only handed out for the newest capture; anything older has been cancelled.
+			while (CAPTURE_JOB *Job = CaptureWorkerGetResult(&CaptureWorker))
+			{
+				AcceptCapturedContent(hWnd, Job);
+			}
+			return 0;
+		}
+
+		case WM_APP_SEARCH_DONE:
+		{
+			// Only the answer to the newest query is handed out.
+			while (SEARCH_QUERY *Query = SearchWorkerGetResult(&SearchWorker))
+			{
+				if (FindDialog != nullptr)
+				{
+					ShowFindResults(Query);
+				}
+				else
+				{
+					SearchQueryFree(Query);
+				}
+			}
+			return 0;
+		}
+
+		case WM_APP_TEXT_INDEXED:
+		{
+			if (CurrentText != nullptr)
+			{
+				UpdateTextIndexProgress(hWnd);
+			}
+			return 0;
+		}
+
 		case WM_CLIPBOARDUPDATE:
 		{
+			TraceInstant("WM_CLIPBOARDUPDATE", 0);
+			if (ClipboardUpdateTraceStart == 0 && MonitoringMode != MONITORING_OFF)
+			{
+				ClipboardUpdateTraceStart = TraceBegin();
+			}
 			switch (MonitoringMode)
 			{
 				case MONITORING_AUTO:
+				{
+					// The capture reads whatever is on the clipboard when the burst is over.
+					ULONGLONG DeadlineUs = CoalescerAddEvent(&UpdateCoalescer, GetMonotonicTimeUs());
+					SetCoalesceTimer(hWnd, DeadlineUs);
+					break;
+				}
 				case MONITORING_ONESHOT:
 				{
+					// Waiting for the burst to end would capture a later state than the first change, so capture
+					// right away. Everything after that is ignored anyway.
 					UpdateClipboard(hWnd);
-					if (MonitoringMode == MONITORING_ONESHOT)
-					{
-						MonitoringMode = MONITORING_OFF;
-						UpdateMenuState(hWnd, nullptr);
-					}
+					MonitoringMode = MONITORING_OFF;
+					UpdateMenuState(hWnd, nullptr);
 					break;
 				}
 			}
@@ -423,25 +2708,46 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 
 		case WM_VSCROLL:
 		{
-			HandleWindowMessage_Scroll(hWnd, wParam, SB_VERT, ScrollAmountPerLine, nullptr);
+			HandleWindowMessage_Scroll(hWnd, wParam, SB_VERT, GetScrollAmountPerLine(SB_VERT), nullptr);
 			return 0;
 		}
 
 		case WM_HSCROLL:
 		{
-			HandleWindowMessage_Scroll(hWnd, wParam, SB_HORZ, ScrollAmountPerLine, nullptr);
+			HandleWindowMessage_Scroll(hWnd, wParam, SB_HORZ, GetScrollAmountPerLine(SB_HORZ), nullptr);
 			return 0;
 		}
 
 		case WM_MOUSEWHEEL:
 		{
+			if (GetKeyState(VK_CONTROL) < 0)
+			{
+				if (CurrentImage != nullptr)
+				{
+					// Zooms around the cursor. The wheel message has screen coordinates.
+					POINT Cursor = { GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam) };
+					ScreenToClient(hWnd, &Cursor);
+					double Steps = (double)GET_WHEEL_DELTA_WPARAM(wParam) / WHEEL_DELTA;
+					SetImageZoom(hWnd, ImageZoom * pow(IMAGE_ZOOM_STEP, Steps), false, Cursor.x, Cursor.y);
+				}
+				return 0;
+			}
 			int nBar = GetKeyState(VK_SHIFT) < 0 ? SB_HORZ : SB_VERT;
-			HandleWindowMessage_MouseWheel(hWnd, wParam, nBar, ScrollAmountPerLine, nullptr);
+			HandleWindowMessage_MouseWheel(hWnd, wParam, nBar, GetScrollAmountPerLine(nBar), nullptr);
 			return 0;
 		}
 
 		case WM_LBUTTONDOWN:
 		{
+			if (CurrentText != nullptr)
+			{
+				// Text is selected instead of panned. Shift+click extends the selection.
+				SIZE_T Offset = GetTextOffsetFromPoint(hWnd, GET_X_LPARAM(lParam), GET_Y_LPARAM(lParam));
+				SetTextSelection(hWnd, (wParam & MK_SHIFT) ? SelectionAnchor : Offset, Offset);
+				Selecting = true;
+				SetCapture(hWnd);
+				return 0;
+			}
 			PanningX = GET_X_LPARAM(lParam);
 			PanningY = GET_Y_LPARAM(lParam);
 			Panning = true;
@@ -450,6 +2756,30 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 
 		case WM_MOUSEMOVE:
 		{
+			if (Selecting)
+			{
+				if (CurrentText != nullptr && (wParam & MK_LBUTTON))
+				{
+					// Dragging past the edges of the window scrolls.
+					int x = GET_X_LPARAM(lParam);
+					int y = GET_Y_LPARAM(lParam);
+					SIZE ClientSize = GetClientSize(hWnd);
+					if (y < 0 || y >= ClientSize.cy)
+					{
+						ScrollTo(hWnd, SB_VERT, SCROLLTO_RELATIVE, y < 0 ? -TextLineHeight : TextLineHeight, nullptr);
+					}
+					if (x < 0 || x >= ClientSize.cx)
+					{
+						ScrollTo(hWnd, SB_HORZ, SCROLLTO_RELATIVE, x < 0 ? -TextCharWidth : TextCharWidth, nullptr);
+					}
+					SetTextSelection(hWnd, SelectionAnchor, GetTextOffsetFromPoint(hWnd, x, y));
+				}
+				else
+				{
+					ReleaseCapture();
+				}
+				return 0;
+			}
 			if (Panning && (wParam & MK_LBUTTON))
 			{
 				int x = GET_X_LPARAM(lParam);
@@ -468,16 +2798,26 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 			return 0;
 		}
 
-		case WM_SIZE:
+		case WM_LBUTTONUP:
 		{
-			SIZE ClientSize = GetClientSize(hWnd);
-
-			if (CurrentEditControl != nullptr)
+			if (Selecting)
 			{
-				SetWindowPos(CurrentEditControl, nullptr, 0, 0, ClientSize.cx, ClientSize.cy, 0);
+				ReleaseCapture();
 			}
+			return 0;
+		}
 
-			if (CurrentImage != nullptr)
+		case WM_CAPTURECHANGED:
+		{
+			Selecting = false;
+			return 0;
+		}
+
+		case WM_SIZE:
+		{
+			SIZE ClientSize = GetClientSize(hWnd);
+
+			if (CurrentImage != nullptr || CurrentText != nullptr || CurrentHexData != nullptr)
 			{
 				SCROLLINFO ScrollInfo = {};
 				ScrollInfo.cbSize = sizeof(ScrollInfo);
@@ -487,57 +2827,99 @@ LRESULT CALLBACK WndProc(HWND hWnd, UINT message, WPARAM wParam, LPARAM lParam)
 				ScrollInfo.nPage = ClientSize.cx;
 				SetScrollInfo(hWnd, SB_HORZ, &ScrollInfo, true);
 			}
+			if (CurrentImage != nullptr && ImageZoomToFit)
+			{
+				SetImageZoom(hWnd, 0, true, 0, 0);
+			}
 
 			return 0;
 		}
 
 		case WM_PAINT:
 		{
+			ULONGLONG TraceStart = TraceBegin();
 			PAINTSTRUCT ps;
-			HDC hdc0 = BeginPaint(hWnd, &ps);
-
-			if (CurrentEditControl == nullptr)
+			HDC hdc = BeginPaint(hWnd, &ps);
+
+			// Adjust for scrolling
+			SCROLLINFO ScrollInfo = {};
+			ScrollInfo.cbSize = sizeof(ScrollInfo);
+			ScrollInfo.fMask = SIF_POS;
+			GetScrollInfo(hWnd, SB_VERT, &ScrollInfo);
+			int ScrollV = ScrollInfo.nPos;
+			GetScrollInfo(hWnd, SB_HORZ, &ScrollInfo);
+			int ScrollH = ScrollInfo.nPos;
+
+			if (CurrentText != nullptr)
+			{
+				PaintText(hWnd, hdc, &ps.rcPaint, ScrollH, ScrollV);
+			}
+			else if (CurrentHexData != nullptr)
+			{
+				PaintHexDump(hWnd, hdc, &ps.rcPaint, ScrollH, ScrollV);
+			}
+			else
 			{
-				HDC hdc = nullptr;
-				HPAINTBUFFER PaintBuffer = BeginBufferedPaint(hdc0, &ps.rcPaint, BPBF_DIB, nullptr, &hdc);
-				assert(PaintBuffer != nullptr);
-
-				FillRect(hdc, &ps.rcPaint, (HBRUSH)GetStockObject(BLACK_BRUSH));
-
 				if (CurrentImage != nullptr)
 				{
-					// Adjust for scrolling
-					SCROLLINFO ScrollInfo = {};
-					ScrollInfo.cbSize = sizeof(ScrollInfo);
-					ScrollInfo.fMask = SIF_POS;
-					GetScrollInfo(hWnd, SB_VERT, &ScrollInfo);
-					int ScrollV = ScrollInfo.nPos;
-					GetScrollInfo(hWnd, SB_HORZ, &ScrollInfo);
-					int ScrollH = ScrollInfo.nPos;
-					SetViewportOrgEx(hdc, -ScrollH, -ScrollV, nullptr);
-					ps.rcPaint.top += ScrollV;
-					ps.rcPaint.bottom += ScrollV;
-					ps.rcPaint.left += ScrollH;
-					ps.rcPaint.right += ScrollH;
-			
-					HDC src = CreateCompatibleDC(hdc);
-					SelectObject(src, CurrentImage);
-					BitBlt(hdc, 0, 0, CurrentImageWidth, CurrentImageHeight, src, 0, 0, SRCCOPY);
-					DeleteDC(src);
-				}
-
-				SetViewportOrgEx(hdc, 0, 0, nullptr);
-				EndBufferedPaint(PaintBuffer, true);
+					// The image and the background never overlap, so they can be drawn directly without flickering.
+					SIZE ImageSize = GetZoomedImageSize();
+					RECT ImageRect = { -ScrollH, -ScrollV, ImageSize.cx - ScrollH, ImageSize.cy - ScrollV };
+					if (ImageZoom == 1)
+					{
+						PaintImage(hdc, &ps.rcPaint, ScrollH, ScrollV);
+					}
+					else
+					{
+						PaintZoomedImage(hdc, &ps.rcPaint, ScrollH, ScrollV);
+					}
+					ExcludeClipRect(hdc, ImageRect.left, ImageRect.top, ImageRect.right, ImageRect.bottom);
+				}
+
+				FillRect(hdc, &ps.rcPaint, (HBRUSH)GetStockObject(BLACK_BRUSH));
 			}
 
 			EndPaint(hWnd, &ps);
+			ULONGLONG PaintEnd = TraceEnd("WM_PAINT", TraceStart, PaintTraceStart != 0 ? PaintTraceSequenceNumber : 0);
+			if (PaintTraceStart != 0)
+			{
+				// The first paint after a capture is the one that shows it.
+				TraceSpan("CopyToPaint", PaintTraceStart, PaintEnd, PaintTraceSequenceNumber);
+				PaintTraceStart = 0;
+			}
 			return 0;
 		}
 
 		case WM_DESTROY:
 		{
-			BufferedPaintUnInit();
 			RemoveClipboardFormatListener(hWnd);
+			KillTimer(hWnd, TIMER_ACQUIRE_CLIPBOARD);
+			CancelCoalescedUpdate(hWnd);
+			ClipboardAcquirerCancel(&ClipboardAcquirer);
+			CaptureWorkerStop(&CaptureWorker);
+			// Reads from the history store, so it has to stop first.
+			SearchWorkerStop(&SearchWorker);
+			ForgetDisplayedEntry();
+			SetDecodedImage(0, nullptr);
+			TileCacheFree(&ImageTiles);
+			FormatInspectorFree(&FormatInspector);
+			ClipboardSnapshotFree(&ClipboardSnapshot);
+			HeapPoolFree(&TextRunPool);
+			HeapPoolFree(&ZoomedImagePool);
+			ClipboardHistoryFree(&History);
+			HammingIndexFree(&ImageHashes);
+			// Used by the search worker, which has stopped by now.
+			FreeTextDictionaries();
+			if (HistoryStoreOpened)
+			{
+				HistoryStoreClose(&HistoryStore);
+			}
+			// Every thread that records spans has stopped by now.
+			if (TraceFile[0] != 0)
+			{
+				TracerWriteChromeTrace(TraceFile);
+			}
+			TracerFree();
 			PostQuitMessage(0);
 			return 0;
 		}
@@ -0,0 +1,143 @@
+#include "ClipboardSnapshot.h"
+#include "ClipboardBackend.h"
+#include "Tracer.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Payloads start at multiples of this in the arena.
+#define ARENA_ALIGNMENT 16
+#define INITIAL_FORMAT_CAPACITY 32
+
+
+void ClipboardSnapshotInit(CLIPBOARD_SNAPSHOT *Snapshot)
+{
+	memset(Snapshot, 0, sizeof(*Snapshot));
+}
+
+
+void ClipboardSnapshotFree(CLIPBOARD_SNAPSHOT *Snapshot)
+{
+	ClipboardSnapshotRelease(Snapshot);
+	free(Snapshot->Formats);
+	Snapshot->Formats = nullptr;
+	Snapshot->FormatCount = 0;
+	Snapshot->FormatCapacity = 0;
+}
+
+
+// Frees the arena (unless it has been taken), and forgets the items. The format list stays.
+void ClipboardSnapshotRelease(CLIPBOARD_SNAPSHOT *Snapshot)
+{
+	free(Snapshot->Arena);
+	Snapshot->Arena = nullptr;
+	Snapshot->ArenaSizeCb = 0;
+	memset(Snapshot->Items, 0, sizeof(Snapshot->Items));
+	Snapshot->ItemCount = 0;
+}
+
+
+// Hands the arena over to the caller, who must free it. The items stay valid for as long as the caller keeps it.
+BYTE *ClipboardSnapshotTakeArena(CLIPBOARD_SNAPSHOT *Snapshot)
+{
+	BYTE *Arena = Snapshot->Arena;
+	Snapshot->Arena = nullptr;
+	Snapshot->ArenaSizeCb = 0;
+	return Arena;
+}
+
+
+static BOOL ListFormats(CLIPBOARD_SNAPSHOT *Snapshot, CLIPBOARD_BACKEND *Backend)
+{
+	Snapshot->FormatCount = 0;
+	for (UINT Format = Backend->EnumFormats(Backend->Context, 0); Format != 0; Format = Backend->EnumFormats(Backend->Context, Format))
+	{
+		if (Snapshot->FormatCount == Snapshot->FormatCapacity)
+		{
+			UINT NewCapacity = Snapshot->FormatCapacity != 0 ? Snapshot->FormatCapacity * 2 : INITIAL_FORMAT_CAPACITY;
+			UINT *NewFormats = (UINT *)realloc(Snapshot->Formats, NewCapacity * sizeof(UINT));
+			if (NewFormats == nullptr) return false;
+			Snapshot->Formats = NewFormats;
+			Snapshot->FormatCapacity = NewCapacity;
+		}
+		Snapshot->Formats[Snapshot->FormatCount++] = Format;
+	}
+	return true;
+}
+
+
+static BOOL HasFormat(const CLIPBOARD_SNAPSHOT *Snapshot, UINT Format)
+{
+	for (UINT i = 0; i < Snapshot->FormatCount; ++i)
+	{
+		if (Snapshot->Formats[i] == Format) return true;
+	}
+	return false;
+}
+
+
+// Must only be called while the clipboard is open. Replaces what the snapshot held before. Returns false if out of
+// memory; requests whose formats are not available are not an error, their items just have Format 0.
+BOOL ClipboardSnapshotTake(CLIPBOARD_SNAPSHOT *Snapshot, CLIPBOARD_BACKEND *Backend, const CLIPBOARD_SNAPSHOT_REQUEST *Requests, UINT RequestCount)
+{
+	ClipboardSnapshotRelease(Snapshot);
+	if (RequestCount > SNAPSHOT_MAX_REQUESTS) return false;
+	Snapshot->SequenceNumber = Backend->GetSequenceNumber(Backend->Context);
+	if (!ListFormats(Snapshot, Backend)) return false;
+
+	ULONGLONG TraceStart = TraceBegin();
+	// Locks everything first, so that the arena can be allocated at its final size.
+	const BYTE *Locked[SNAPSHOT_MAX_REQUESTS] = {};
+	SIZE_T ArenaSizeCb = 0;
+	BOOL Succeeded = true;
+	for (UINT r = 0; r < RequestCount; ++r)
+	{
+		CLIPBOARD_SNAPSHOT_ITEM *Item = &Snapshot->Items[r];
+		for (UINT i = 0; i < Requests[r].Count && Locked[r] == nullptr; ++i)
+		{
+			UINT Format = Requests[r].Formats[i];
+			if (!HasFormat(Snapshot, Format)) continue;
+			SIZE_T SizeCb;
+			Locked[r] = Backend->LockData(Backend->Context, Format, &SizeCb);
+			if (Locked[r] == nullptr) continue;
+			Item->Format = Format;
+			Item->SizeCb = SizeCb;
+		}
+		if (Locked[r] == nullptr) continue;
+
+		SIZE_T PaddedSizeCb = (Item->SizeCb + 2 + ARENA_ALIGNMENT - 1) & ~(SIZE_T)(ARENA_ALIGNMENT - 1);
+		if (Item->SizeCb > (SIZE_T)-1 - 2 * ARENA_ALIGNMENT || PaddedSizeCb > (SIZE_T)-1 - ArenaSizeCb) Succeeded = false;
+		ArenaSizeCb += PaddedSizeCb;
+	}
+	Snapshot->ItemCount = RequestCount;
+
+	if (Succeeded && ArenaSizeCb > 0)
+	{
+		Snapshot->Arena = (BYTE *)malloc(ArenaSizeCb);
+		Succeeded = Snapshot->Arena != nullptr;
+	}
+	SIZE_T Offset = 0;
+	for (UINT r = 0; r < RequestCount; ++r)
+	{
+		if (Locked[r] == nullptr) continue;
+		CLIPBOARD_SNAPSHOT_ITEM *Item = &Snapshot->Items[r];
+		if (Succeeded)
+		{
+			BYTE *Data = Snapshot->Arena + Offset;
+			memcpy(Data, Locked[r], Item->SizeCb);
+			Data[Item->SizeCb] = 0;
+			Data[Item->SizeCb + 1] = 0;
+			Item->Data = Data;
+			Offset += (Item->SizeCb + 2 + ARENA_ALIGNMENT - 1) & ~(SIZE_T)(ARENA_ALIGNMENT - 1);
+		}
+		Backend->UnlockData(Backend->Context, Item->Format, Locked[r]);
+	}
+	TraceEnd("CopyClipboardData", TraceStart, Snapshot->SequenceNumber);
+
+	if (!Succeeded)
+	{
+		ClipboardSnapshotRelease(Snapshot);
+		return false;
+	}
+	Snapshot->ArenaSizeCb = ArenaSizeCb;
+	return true;
+}
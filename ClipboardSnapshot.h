@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Portable.h"
+
+struct CLIPBOARD_BACKEND;
+struct CLIPBOARD_SNAPSHOT_REQUEST;
+struct CLIPBOARD_SNAPSHOT_ITEM;
+struct CLIPBOARD_SNAPSHOT;
+
+// Everything the monitor needs from the open clipboard, taken in one go, so that it can close the clipboard again as
+// soon as possible: while it is open, no other application can copy or paste.
+//
+// ClipboardSnapshotTake lists all formats, and for every request locks the first of its formats that is available.
+// Once it knows their sizes, it copies all of them into a single block (the arena), and unlocks them. Nothing else
+// happens while the clipboard is open; format names, hashing, decoding etc. all work on the snapshot afterwards.
+
+#define SNAPSHOT_MAX_REQUESTS 4
+
+extern void                ClipboardSnapshotInit(CLIPBOARD_SNAPSHOT *Snapshot);
+extern void                ClipboardSnapshotFree(CLIPBOARD_SNAPSHOT *Snapshot);
+extern BOOL                ClipboardSnapshotTake(CLIPBOARD_SNAPSHOT *Snapshot, CLIPBOARD_BACKEND *Backend, const CLIPBOARD_SNAPSHOT_REQUEST *Requests, UINT RequestCount);
+extern BYTE               *ClipboardSnapshotTakeArena(CLIPBOARD_SNAPSHOT *Snapshot);
+extern void                ClipboardSnapshotRelease(CLIPBOARD_SNAPSHOT *Snapshot);
+
+// Formats that serve the same purpose, best first.
+struct CLIPBOARD_SNAPSHOT_REQUEST
+{
+	const UINT *Formats;
+	UINT Count;
+};
+
+struct CLIPBOARD_SNAPSHOT_ITEM
+{
+	UINT Format;          // Which of the requested formats was copied, or 0 if none of them was available.
+	const BYTE *Data;     // In the arena, and followed by two zero bytes (so text is always terminated).
+	SIZE_T SizeCb;
+};
+
+struct CLIPBOARD_SNAPSHOT
+{
+	DWORD SequenceNumber;
+	// All formats on the clipboard, in the order of EnumFormats. The array is kept from one snapshot to the next, so
+	// it is only allocated while the clipboard is open if there are more formats than ever before.
+	UINT *Formats;
+	UINT FormatCount;
+	UINT FormatCapacity;
+
+	// One item per request, in the same order. Their payloads are in the arena in that order too, so the first item
+	// with a payload starts the arena.
+	CLIPBOARD_SNAPSHOT_ITEM Items[SNAPSHOT_MAX_REQUESTS];
+	UINT ItemCount;
+	BYTE *Arena;          // Allocated with malloc, or null if nothing was copied.
+	SIZE_T ArenaSizeCb;
+};
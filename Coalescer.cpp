@@ -0,0 +1,71 @@
+#include "Coalescer.h"
+#include <string.h>
+
+void CoalescerInit(COALESCER *Coalescer, const COALESCER_CONFIG *Config)
+{
+	memset(Coalescer, 0, sizeof(*Coalescer));
+	Coalescer->Config = *Config;
+	if (Coalescer->Config.MaxLatencyUs < Coalescer->Config.QuietUs)
+	{
+		Coalescer->Config.MaxLatencyUs = Coalescer->Config.QuietUs;
+	}
+}
+
+
+static ULONGLONG GetDeadline(const COALESCER *Coalescer)
+{
+	ULONGLONG QuietDeadline = Coalescer->LastEventUs + Coalescer->Config.QuietUs;
+	ULONGLONG LatencyDeadline = Coalescer->FirstEventUs + Coalescer->Config.MaxLatencyUs;
+	return QuietDeadline < LatencyDeadline ? QuietDeadline : LatencyDeadline;
+}
+
+
+// Returns the time at which CoalescerPoll must be called next.
+ULONGLONG CoalescerAddEvent(COALESCER *Coalescer, ULONGLONG NowUs)
+{
+	++Coalescer->Events;
+	if (!Coalescer->Pending)
+	{
+		Coalescer->Pending = true;
+		Coalescer->FirstEventUs = NowUs;
+	}
+	Coalescer->LastEventUs = NowUs;
+	return GetDeadline(Coalescer);
+}
+
+
+// Returns true if the action should be run now. Otherwise, if an action is still pending, *DeadlineUs receives the
+// time at which CoalescerPoll must be called again; it is 0 if nothing is pending.
+BOOL CoalescerPoll(COALESCER *Coalescer, ULONGLONG NowUs, ULONGLONG *DeadlineUs)
+{
+	*DeadlineUs = 0;
+	if (!Coalescer->Pending) return false;
+
+	ULONGLONG Deadline = GetDeadline(Coalescer);
+	if (NowUs < Deadline)
+	{
+		*DeadlineUs = Deadline;
+		return false;
+	}
+
+	ULONGLONG Latency = NowUs - Coalescer->FirstEventUs;
+	if (Latency > Coalescer->MaxLatencyUs)
+	{
+		Coalescer->MaxLatencyUs = Latency;
+	}
+	++Coalescer->Fires;
+	Coalescer->Pending = false;
+	return true;
+}
+
+
+void CoalescerCancel(COALESCER *Coalescer)
+{
+	Coalescer->Pending = false;
+}
+
+
+BOOL CoalescerIsPending(const COALESCER *Coalescer)
+{
+	return Coalescer->Pending;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "Portable.h"
+
+struct COALESCER;
+struct COALESCER_CONFIG;
+
+// Merges bursts of events into a single action. The action fires once no new event has arrived for QuietUs, but never
+// later than MaxLatencyUs after the first event of the burst, so a steady stream of events cannot delay it forever.
+// Time is passed in by the caller, in microseconds; the caller is responsible for calling CoalescerPoll at the
+// returned deadlines (e.g. with a timer).
+
+extern void                CoalescerInit(COALESCER *Coalescer, const COALESCER_CONFIG *Config);
+extern ULONGLONG           CoalescerAddEvent(COALESCER *Coalescer, ULONGLONG NowUs);
+extern BOOL                CoalescerPoll(COALESCER *Coalescer, ULONGLONG NowUs, ULONGLONG *DeadlineUs);
+extern void                CoalescerCancel(COALESCER *Coalescer);
+extern BOOL                CoalescerIsPending(const COALESCER *Coalescer);
+
+struct COALESCER_CONFIG
+{
+	ULONGLONG QuietUs;
+	ULONGLONG MaxLatencyUs;
+};
+
+struct COALESCER
+{
+	COALESCER_CONFIG Config;
+	BOOL Pending;
+	ULONGLONG FirstEventUs; // Of the current burst.
+	ULONGLONG LastEventUs;
+
+	// Statistics over the lifetime of the coalescer.
+	LONGLONG Events;
+	LONGLONG Fires;
+	ULONGLONG MaxLatencyUs; // Longest time from the first event of a burst until it fired.
+};
@@ -0,0 +1,161 @@
+#include "ContentHash.h"
+#include <string.h>
+
+// The input is processed in 64 byte stripes, each feeding 8 independent 64 bit accumulators. Every lane multiplies
+// the two 32 bit halves of (data ^ key), which is a single _mm_mul_epu32 with SSE2, and the raw data is added to the
+// neighboring lane so that no input bits are lost. The accumulators are scrambled every STRIPES_PER_BLOCK stripes.
+// The structure is that of XXH3's long-input loop; the constants are its primes.
+
+#define STRIPE_SIZE 64
+#define STRIPES_PER_BLOCK 16
+
+static const ULONGLONG PRIME32_1 = 0x9E3779B1ULL;
+static const ULONGLONG PRIME64_1 = 0x9E3779B185EBCA87ULL;
+static const ULONGLONG PRIME64_2 = 0xC2B2AE3D27D4EB4FULL;
+static const ULONGLONG PRIME64_3 = 0x165667B19E3779F9ULL;
+
+// Arbitrary bits (the fractional part of pi).
+static const ULONGLONG Keys[8] =
+{
+	0x243F6A8885A308D3ULL, 0x13198A2E03707344ULL, 0xA4093822299F31D0ULL, 0x082EFA98EC4E6C89ULL,
+	0x452821E638D01377ULL, 0xBE5466CF34E90C6CULL, 0xC0AC29B7C97C50DDULL, 0x3F84D5B5B5470917ULL,
+};
+
+static ULONGLONG Avalanche(ULONGLONG h)
+{
+	h ^= h >> 37;
+	h *= PRIME64_3;
+	h ^= h >> 32;
+	return h;
+}
+
+static void Scramble(ULONGLONG *Acc)
+{
+	for (int i = 0; i < 8; ++i)
+	{
+		ULONGLONG a = Acc[i];
+		a ^= a >> 47;
+		a ^= Keys[7 - i];
+		a *= PRIME32_1;
+		Acc[i] = a;
+	}
+}
+
+#ifdef PORTABLE_SSE2
+static void AccumulateStripes_SSE2(ULONGLONG *Acc, const BYTE *Data, SIZE_T Stripes)
+{
+	__m128i a[4];
+	__m128i k[4];
+	for (int i = 0; i < 4; ++i)
+	{
+		a[i] = _mm_loadu_si128((const __m128i *)(Acc + i * 2));
+		k[i] = _mm_loadu_si128((const __m128i *)(Keys + i * 2));
+	}
+	for (SIZE_T s = 0; s < Stripes; ++s, Data += STRIPE_SIZE)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			__m128i Value = _mm_loadu_si128((const __m128i *)(Data + i * 16));
+			__m128i Keyed = _mm_xor_si128(Value, k[i]);
+			__m128i Product = _mm_mul_epu32(Keyed, _mm_srli_epi64(Keyed, 32));
+			__m128i Swapped = _mm_shuffle_epi32(Value, _MM_SHUFFLE(1, 0, 3, 2));
+			a[i] = _mm_add_epi64(a[i], _mm_add_epi64(Product, Swapped));
+		}
+	}
+	for (int i = 0; i < 4; ++i)
+	{
+		_mm_storeu_si128((__m128i *)(Acc + i * 2), a[i]);
+	}
+}
+#else
+static ULONGLONG Read64(const BYTE *p)
+{
+	ULONGLONG Value;
+	memcpy(&Value, p, sizeof(Value));
+	return Value;
+}
+
+static void AccumulateStripes_Scalar(ULONGLONG *Acc, const BYTE *Data, SIZE_T Stripes)
+{
+	for (SIZE_T s = 0; s < Stripes; ++s, Data += STRIPE_SIZE)
+	{
+		for (int i = 0; i < 8; ++i)
+		{
+			ULONGLONG Value = Read64(Data + i * 8);
+			ULONGLONG Keyed = Value ^ Keys[i];
+			Acc[i ^ 1] += Value;
+			Acc[i] += (Keyed & 0xFFFFFFFF) * (Keyed >> 32);
+		}
+	}
+}
+#endif
+
+static void AccumulateStripes(ULONGLONG *Acc, const BYTE *Data, SIZE_T Stripes)
+{
+#ifdef PORTABLE_SSE2
+	AccumulateStripes_SSE2(Acc, Data, Stripes);
+#else
+	AccumulateStripes_Scalar(Acc, Data, Stripes);
+#endif
+}
+
+static ULONGLONG MergeAccumulators(const ULONGLONG *Acc, ULONGLONG Start)
+{
+	ULONGLONG Result = Start;
+	for (int i = 0; i < 8; i += 2)
+	{
+		ULONGLONG a = Acc[i] ^ Keys[i];
+		ULONGLONG b = Acc[i + 1] ^ Keys[i + 1];
+		// Fold the 128 bit product of a and b into 64 bits.
+		ULONGLONG al = a & 0xFFFFFFFF, ah = a >> 32, bl = b & 0xFFFFFFFF, bh = b >> 32;
+		ULONGLONG ll = al * bl, lh = al * bh, hl = ah * bl, hh = ah * bh;
+		ULONGLONG Cross = (ll >> 32) + (hl & 0xFFFFFFFF) + lh;
+		ULONGLONG Upper = hh + (hl >> 32) + (Cross >> 32);
+		ULONGLONG Lower = (Cross << 32) | (ll & 0xFFFFFFFF);
+		Result += Lower ^ Upper;
+	}
+	return Avalanche(Result);
+}
+
+
+void ComputeContentHash(const void *Data, SIZE_T SizeCb, CONTENT_HASH *Hash)
+{
+	const BYTE *p = (const BYTE *)Data;
+	ULONGLONG Acc[8] =
+	{
+		PRIME32_1, PRIME64_1, PRIME64_2, PRIME64_3,
+		PRIME64_1 ^ PRIME64_2, PRIME32_1 ^ PRIME64_3, PRIME64_2 ^ PRIME32_1, PRIME64_3 ^ PRIME64_1
+	};
+
+	SIZE_T FullStripes = SizeCb / STRIPE_SIZE;
+	while (FullStripes > 0)
+	{
+		SIZE_T Stripes = FullStripes < STRIPES_PER_BLOCK ? FullStripes : STRIPES_PER_BLOCK;
+		AccumulateStripes(Acc, p, Stripes);
+		p += Stripes * STRIPE_SIZE;
+		FullStripes -= Stripes;
+		if (Stripes == STRIPES_PER_BLOCK)
+		{
+			Scramble(Acc);
+		}
+	}
+
+	// The last, partial stripe is padded with zeros. The length is mixed in at the end, so that trailing zeros matter.
+	SIZE_T Remaining = SizeCb % STRIPE_SIZE;
+	if (Remaining > 0)
+	{
+		BYTE Last[STRIPE_SIZE] = {};
+		memcpy(Last, p, Remaining);
+		AccumulateStripes(Acc, Last, 1);
+	}
+
+	ULONGLONG Length = (ULONGLONG)SizeCb;
+	Hash->Low = MergeAccumulators(Acc, Length * PRIME64_1);
+	Hash->High = MergeAccumulators(Acc, ~(Length * PRIME64_2));
+}
+
+
+BOOL ContentHashEqual(const CONTENT_HASH *a, const CONTENT_HASH *b)
+{
+	return a->Low == b->Low && a->High == b->High;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "Portable.h"
+
+struct CONTENT_HASH;
+
+// Fast 128 bit hash, used to recognize clipboard payloads that have been seen before. This is not a cryptographic hash.
+// The SSE2 and the scalar implementation give identical results.
+extern void                ComputeContentHash(const void *Data, SIZE_T SizeCb, CONTENT_HASH *Hash);
+extern BOOL                ContentHashEqual(const CONTENT_HASH *a, const CONTENT_HASH *b);
+
+struct CONTENT_HASH
+{
+	ULONGLONG Low;
+	ULONGLONG High;
+};
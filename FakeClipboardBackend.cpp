@@ -0,0 +1,142 @@
+#include "FakeClipboardBackend.h"
+#include "ClipboardBackend.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+static BOOL FakeOpen(void *Context)
+{
+	FAKE_CLIPBOARD *Fake = (FAKE_CLIPBOARD *)Context;
+	++Fake->OpenAttempts;
+	if (Fake->IsOpen) return false;
+	if (Fake->NowUs < Fake->BusyUntilUs) return false;
+	if (Fake->FailNextOpens > 0)
+	{
+		--Fake->FailNextOpens;
+		return false;
+	}
+	Fake->IsOpen = true;
+	++Fake->OpenCount;
+	return true;
+}
+
+
+static void FakeClose(void *Context)
+{
+	FAKE_CLIPBOARD *Fake = (FAKE_CLIPBOARD *)Context;
+	assert(Fake->IsOpen && Fake->LockedCount == 0);
+	Fake->IsOpen = false;
+}
+
+
+static DWORD FakeGetSequenceNumber(void *Context)
+{
+	return ((FAKE_CLIPBOARD *)Context)->SequenceNumber;
+}
+
+
+static const FAKE_CLIPBOARD_FORMAT *FindFormat(FAKE_CLIPBOARD *Fake, UINT Format)
+{
+	for (UINT i = 0; i < Fake->FormatCount; ++i)
+	{
+		if (Fake->Formats[i].Format == Format) return &Fake->Formats[i];
+	}
+	return nullptr;
+}
+
+
+static UINT FakeEnumFormats(void *Context, UINT Format)
+{
+	FAKE_CLIPBOARD *Fake = (FAKE_CLIPBOARD *)Context;
+	assert(Fake->IsOpen);
+	UINT i = 0;
+	if (Format != 0)
+	{
+		while (i < Fake->FormatCount && Fake->Formats[i].Format != Format) ++i;
+		++i;
+	}
+	return i < Fake->FormatCount ? Fake->Formats[i].Format : 0;
+}
+
+
+static BOOL FakeGetFormatName(void *Context, UINT Format, WCHAR *Name, UINT NameLength)
+{
+	FAKE_CLIPBOARD *Fake = (FAKE_CLIPBOARD *)Context;
+	const FAKE_CLIPBOARD_FORMAT *Info = FindFormat(Fake, Format);
+	if (Info == nullptr || Info->Name == nullptr || NameLength == 0) return false;
+	UINT i = 0;
+	for (; i + 1 < NameLength && Info->Name[i] != 0; ++i)
+	{
+		Name[i] = Info->Name[i];
+	}
+	Name[i] = 0;
+	return true;
+}
+
+
+// Like on Windows, registered formats are numbered from 0xC000.
+static UINT FakeRegisterFormat(void *Context, const char *Name)
+{
+	FAKE_CLIPBOARD *Fake = (FAKE_CLIPBOARD *)Context;
+	UINT i = 0;
+	while (i < Fake->RegisteredCount && strcmp(Fake->RegisteredNames[i], Name) != 0) ++i;
+	if (i == Fake->RegisteredCount)
+	{
+		if (i == FAKE_CLIPBOARD_MAX_REGISTERED) return 0;
+		Fake->RegisteredNames[Fake->RegisteredCount++] = Name;
+	}
+	return FAKE_CLIPBOARD_FIRST_REGISTERED + i;
+}
+
+
+static const BYTE *FakeLockData(void *Context, UINT Format, SIZE_T *SizeCb)
+{
+	FAKE_CLIPBOARD *Fake = (FAKE_CLIPBOARD *)Context;
+	assert(Fake->IsOpen);
+	const FAKE_CLIPBOARD_FORMAT *Info = FindFormat(Fake, Format);
+	if (Info == nullptr || Info->Data == nullptr) return nullptr;
+	*SizeCb = Info->SizeCb;
+	++Fake->LockCount;
+	++Fake->LockedCount;
+	return (const BYTE *)Info->Data;
+}
+
+
+static void FakeUnlockData(void *Context, UINT Format, const BYTE *Data)
+{
+	FAKE_CLIPBOARD *Fake = (FAKE_CLIPBOARD *)Context;
+	assert(Fake->IsOpen && Fake->LockedCount > 0);
+	--Fake->LockedCount;
+}
+
+
+void FakeClipboardInit(FAKE_CLIPBOARD *Fake, CLIPBOARD_BACKEND *Backend)
+{
+	memset(Fake, 0, sizeof(*Fake));
+	Fake->SequenceNumber = 1;
+	Backend->Context = Fake;
+	Backend->Open = FakeOpen;
+	Backend->Close = FakeClose;
+	Backend->GetSequenceNumber = FakeGetSequenceNumber;
+	Backend->EnumFormats = FakeEnumFormats;
+	Backend->GetFormatName = FakeGetFormatName;
+	Backend->RegisterFormat = FakeRegisterFormat;
+	Backend->LockData = FakeLockData;
+	Backend->UnlockData = FakeUnlockData;
+}
+
+
+// Simulates another application putting something on the clipboard.
+void FakeClipboardChange(FAKE_CLIPBOARD *Fake)
+{
+	++Fake->SequenceNumber;
+}
+
+
+// Replaces the content of the fake clipboard. The array is not copied.
+void FakeClipboardSetFormats(FAKE_CLIPBOARD *Fake, const FAKE_CLIPBOARD_FORMAT *Formats, UINT Count)
+{
+	Fake->Formats = Formats;
+	Fake->FormatCount = Count;
+	FakeClipboardChange(Fake);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "Portable.h"
+
+struct CLIPBOARD_BACKEND;
+struct FAKE_CLIPBOARD;
+struct FAKE_CLIPBOARD_FORMAT;
+
+// An in-memory clipboard for exercising the code on top of CLIPBOARD_BACKEND without a real clipboard.
+// Registered format names are not copied, and must stay valid.
+// Contention is simulated by setting BusyUntilUs (compared against NowUs, which the caller advances) or FailNextOpens.
+
+#define FAKE_CLIPBOARD_MAX_REGISTERED 8
+#define FAKE_CLIPBOARD_FIRST_REGISTERED 0xC000
+
+extern void                FakeClipboardInit(FAKE_CLIPBOARD *Fake, CLIPBOARD_BACKEND *Backend);
+extern void                FakeClipboardChange(FAKE_CLIPBOARD *Fake);
+extern void                FakeClipboardSetFormats(FAKE_CLIPBOARD *Fake, const FAKE_CLIPBOARD_FORMAT *Formats, UINT Count);
+
+// Data is not copied; it must stay valid while it's on the fake clipboard. A null Data behaves like a format that is
+// not a block of memory.
+struct FAKE_CLIPBOARD_FORMAT
+{
+	UINT Format;
+	const WCHAR *Name;
+	const void *Data;
+	SIZE_T SizeCb;
+};
+
+struct FAKE_CLIPBOARD
+{
+	ULONGLONG NowUs;
+	ULONGLONG BusyUntilUs;     // Open fails while NowUs is before this.
+	UINT FailNextOpens;        // Open fails this many more times.
+
+	DWORD SequenceNumber;
+	const FAKE_CLIPBOARD_FORMAT *Formats;
+	UINT FormatCount;
+	const char *RegisteredNames[FAKE_CLIPBOARD_MAX_REGISTERED];
+	UINT RegisteredCount;
+
+	BOOL IsOpen;
+	UINT OpenAttempts;
+	UINT OpenCount;
+	UINT LockCount;            // Number of payloads that have been fetched.
+	UINT LockedCount;          // Locked right now; must be 0 when the clipboard is closed.
+};
@@ -0,0 +1,248 @@
+#include "FormatInspector.h"
+#include "ClipboardBackend.h"
+#include "ClipboardSnapshot.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Width of the name column in FormatInspectorDescribe; longer names push the size to the right.
+#define NAME_COLUMN_WIDTH 40
+
+void FormatInspectorInit(FORMAT_INSPECTOR *Inspector, CLIPBOARD_BACKEND *Backend)
+{
+	memset(Inspector, 0, sizeof(*Inspector));
+	Inspector->Backend = Backend;
+}
+
+
+static void ClearFormats(FORMAT_INSPECTOR *Inspector)
+{
+	for (UINT i = 0; i < Inspector->Count; ++i)
+	{
+		free(Inspector->Formats[i].Data);
+	}
+	Inspector->Count = 0;
+	Inspector->Valid = false;
+}
+
+
+void FormatInspectorFree(FORMAT_INSPECTOR *Inspector)
+{
+	ClearFormats(Inspector);
+	free(Inspector->Formats);
+	Inspector->Formats = nullptr;
+	Inspector->Capacity = 0;
+}
+
+
+// Returns true if the list does not describe the current clipboard content.
+BOOL FormatInspectorIsStale(const FORMAT_INSPECTOR *Inspector)
+{
+	if (!Inspector->Valid) return true;
+	DWORD SequenceNumber = Inspector->Backend->GetSequenceNumber(Inspector->Backend->Context);
+	return SequenceNumber == 0 || SequenceNumber != Inspector->SequenceNumber;
+}
+
+
+// Takes over the format list of a snapshot if it describes other clipboard content than the current list. Payloads
+// fetched before are dropped in that case.
+BOOL FormatInspectorUpdate(FORMAT_INSPECTOR *Inspector, const CLIPBOARD_SNAPSHOT *Snapshot)
+{
+	if (Inspector->Valid && Snapshot->SequenceNumber != 0 && Snapshot->SequenceNumber == Inspector->SequenceNumber) return true;
+
+	CLIPBOARD_BACKEND *Backend = Inspector->Backend;
+	ClearFormats(Inspector);
+	if (Snapshot->FormatCount > Inspector->Capacity)
+	{
+		UINT NewCapacity = Inspector->Capacity != 0 ? Inspector->Capacity : 16;
+		while (NewCapacity < Snapshot->FormatCount) NewCapacity *= 2;
+		CLIPBOARD_FORMAT_INFO *NewFormats = (CLIPBOARD_FORMAT_INFO *)realloc(Inspector->Formats, NewCapacity * sizeof(CLIPBOARD_FORMAT_INFO));
+		if (NewFormats == nullptr) return false;
+		Inspector->Formats = NewFormats;
+		Inspector->Capacity = NewCapacity;
+	}
+	for (UINT i = 0; i < Snapshot->FormatCount; ++i)
+	{
+		CLIPBOARD_FORMAT_INFO *Info = &Inspector->Formats[Inspector->Count++];
+		memset(Info, 0, sizeof(*Info));
+		Info->Format = Snapshot->Formats[i];
+		if (!Backend->GetFormatName(Backend->Context, Info->Format, Info->Name, FORMAT_NAME_LENGTH))
+		{
+			Info->Name[0] = 0;
+		}
+		Info->Name[FORMAT_NAME_LENGTH - 1] = 0;
+	}
+	Inspector->SequenceNumber = Snapshot->SequenceNumber;
+	Inspector->Valid = true;
+	return true;
+}
+
+
+const CLIPBOARD_FORMAT_INFO *FormatInspectorFind(const FORMAT_INSPECTOR *Inspector, UINT Format)
+{
+	for (UINT i = 0; i < Inspector->Count; ++i)
+	{
+		if (Inspector->Formats[i].Format == Format) return &Inspector->Formats[i];
+	}
+	return nullptr;
+}
+
+
+// Stores a copy of the payload of a format, as taken from a snapshot; null Data means the snapshot could not get it.
+// Returns the format, or null if it is not in the list (or out of memory).
+const CLIPBOARD_FORMAT_INFO *FormatInspectorSetData(FORMAT_INSPECTOR *Inspector, UINT Format, const BYTE *Data, SIZE_T SizeCb)
+{
+	CLIPBOARD_FORMAT_INFO *Info = (CLIPBOARD_FORMAT_INFO *)FormatInspectorFind(Inspector, Format);
+	if (Info == nullptr) return nullptr;
+
+	free(Info->Data);
+	Info->Data = nullptr;
+	Info->SizeCb = 0;
+	Info->Fetched = true;
+	Info->Unavailable = Data == nullptr;
+	if (Data == nullptr) return Info;
+
+	Info->Data = (BYTE *)malloc(SizeCb != 0 ? SizeCb : 1);
+	if (Info->Data == nullptr)
+	{
+		Info->Fetched = false;
+		return nullptr;
+	}
+	memcpy(Info->Data, Data, SizeCb);
+	Info->SizeCb = SizeCb;
+	return Info;
+}
+
+
+// Hands the fetched payload of Format over to the caller, who must free it. Returns null if it has not been fetched.
+// The format keeps its size for FormatInspectorDescribe, but it has to be set again to be taken again.
+BYTE *FormatInspectorTakeData(FORMAT_INSPECTOR *Inspector, UINT Format, SIZE_T *SizeCb)
+{
+	CLIPBOARD_FORMAT_INFO *Info = (CLIPBOARD_FORMAT_INFO *)FormatInspectorFind(Inspector, Format);
+	if (Info == nullptr || Info->Data == nullptr) return nullptr;
+	BYTE *Data = Info->Data;
+	Info->Data = nullptr;
+	*SizeCb = Info->SizeCb;
+	return Data;
+}
+
+
+struct TEXT_BUILDER
+{
+	WCHAR *Text;
+	SIZE_T Length;
+	SIZE_T Capacity;
+	BOOL Failed;
+};
+
+
+static void AppendCharacters(TEXT_BUILDER *Builder, WCHAR c, SIZE_T Count)
+{
+	if (Builder->Failed) return;
+	if (Builder->Length + Count + 1 > Builder->Capacity)
+	{
+		SIZE_T NewCapacity = Builder->Capacity != 0 ? Builder->Capacity * 2 : 1024;
+		while (NewCapacity < Builder->Length + Count + 1) NewCapacity *= 2;
+		WCHAR *NewText = (WCHAR *)realloc(Builder->Text, NewCapacity * sizeof(WCHAR));
+		if (NewText == nullptr)
+		{
+			Builder->Failed = true;
+			return;
+		}
+		Builder->Text = NewText;
+		Builder->Capacity = NewCapacity;
+	}
+	for (SIZE_T i = 0; i < Count; ++i)
+	{
+		Builder->Text[Builder->Length++] = c;
+	}
+	Builder->Text[Builder->Length] = 0;
+}
+
+
+static void AppendAscii(TEXT_BUILDER *Builder, const char *String)
+{
+	for (; *String != 0; ++String)
+	{
+		AppendCharacters(Builder, (WCHAR)*String, 1);
+	}
+}
+
+
+static void AppendWide(TEXT_BUILDER *Builder, const WCHAR *String, SIZE_T Width)
+{
+	SIZE_T Length = 0;
+	for (; String[Length] != 0; ++Length)
+	{
+		AppendCharacters(Builder, String[Length], 1);
+	}
+	if (Length < Width)
+	{
+		AppendCharacters(Builder, ' ', Width - Length);
+	}
+}
+
+
+// Right-aligned in Width columns.
+static void AppendNumber(TEXT_BUILDER *Builder, ULONGLONG Number, SIZE_T Width)
+{
+	char Digits[24];
+	SIZE_T Count = 0;
+	do
+	{
+		Digits[Count++] = (char)('0' + Number % 10);
+		Number /= 10;
+	} while (Number != 0);
+	if (Count < Width)
+	{
+		AppendCharacters(Builder, ' ', Width - Count);
+	}
+	while (Count > 0)
+	{
+		AppendCharacters(Builder, (WCHAR)Digits[--Count], 1);
+	}
+}
+
+
+// Returns a table of all formats (ID, name and size, as far as it is known), allocated with malloc, or null if out
+// of memory. SelectedFormat is marked.
+WCHAR *FormatInspectorDescribe(const FORMAT_INSPECTOR *Inspector, UINT SelectedFormat, SIZE_T *Length)
+{
+	TEXT_BUILDER Builder = {};
+	AppendAscii(&Builder, "  Format  Name");
+	AppendCharacters(&Builder, ' ', NAME_COLUMN_WIDTH - 4);
+	AppendAscii(&Builder, "Size\n");
+	for (UINT i = 0; i < Inspector->Count; ++i)
+	{
+		const CLIPBOARD_FORMAT_INFO *Info = &Inspector->Formats[i];
+		AppendAscii(&Builder, Info->Format == SelectedFormat ? "> " : "  ");
+		AppendNumber(&Builder, Info->Format, 6);
+		AppendAscii(&Builder, "  ");
+		AppendWide(&Builder, Info->Name, NAME_COLUMN_WIDTH);
+		if (!Info->Fetched)
+		{
+			AppendAscii(&Builder, "not fetched");
+		}
+		else if (Info->Unavailable)
+		{
+			AppendAscii(&Builder, "not available as memory");
+		}
+		else
+		{
+			AppendNumber(&Builder, Info->SizeCb, 0);
+			AppendAscii(&Builder, " bytes");
+		}
+		AppendCharacters(&Builder, '\n', 1);
+	}
+	if (Inspector->Count == 0)
+	{
+		AppendAscii(&Builder, "  (The clipboard is empty.)\n");
+	}
+
+	if (Builder.Failed)
+	{
+		free(Builder.Text);
+		return nullptr;
+	}
+	*Length = Builder.Length;
+	return Builder.Text;
+}
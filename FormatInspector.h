@@ -0,0 +1,44 @@
+#pragma once
+
+#include "Portable.h"
+
+struct CLIPBOARD_BACKEND;
+struct CLIPBOARD_SNAPSHOT;
+struct CLIPBOARD_FORMAT_INFO;
+struct FORMAT_INSPECTOR;
+
+// Lists all formats on the clipboard, but only holds the payload of a format when it is asked for. The list and the
+// payloads are kept until the clipboard sequence number changes.
+// The list comes from a clipboard snapshot, and the payloads are copied from one by the caller, so nothing here needs
+// the clipboard to be open; format names are looked up after it has been closed again.
+
+extern void                FormatInspectorInit(FORMAT_INSPECTOR *Inspector, CLIPBOARD_BACKEND *Backend);
+extern void                FormatInspectorFree(FORMAT_INSPECTOR *Inspector);
+extern BOOL                FormatInspectorIsStale(const FORMAT_INSPECTOR *Inspector);
+extern BOOL                FormatInspectorUpdate(FORMAT_INSPECTOR *Inspector, const CLIPBOARD_SNAPSHOT *Snapshot);
+extern const CLIPBOARD_FORMAT_INFO *FormatInspectorFind(const FORMAT_INSPECTOR *Inspector, UINT Format);
+extern const CLIPBOARD_FORMAT_INFO *FormatInspectorSetData(FORMAT_INSPECTOR *Inspector, UINT Format, const BYTE *Data, SIZE_T SizeCb);
+extern BYTE               *FormatInspectorTakeData(FORMAT_INSPECTOR *Inspector, UINT Format, SIZE_T *SizeCb);
+extern WCHAR              *FormatInspectorDescribe(const FORMAT_INSPECTOR *Inspector, UINT SelectedFormat, SIZE_T *Length);
+
+#define FORMAT_NAME_LENGTH 80
+
+struct CLIPBOARD_FORMAT_INFO
+{
+	UINT Format;
+	WCHAR Name[FORMAT_NAME_LENGTH]; // Empty if the format has no name.
+	BOOL Fetched;                   // SizeCb is known.
+	BOOL Unavailable;               // Fetched, but there was nothing to copy.
+	BYTE *Data;                     // Null unless fetched, and not taken by FormatInspectorTakeData since.
+	SIZE_T SizeCb;
+};
+
+struct FORMAT_INSPECTOR
+{
+	CLIPBOARD_BACKEND *Backend;
+	BOOL Valid;
+	DWORD SequenceNumber;           // Of the clipboard content the list describes.
+	CLIPBOARD_FORMAT_INFO *Formats;
+	UINT Count;
+	UINT Capacity;
+};
@@ -0,0 +1,199 @@
+#include "HammingIndex.h"
+#include "PerceptualHash.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Below this many nodes, removed nodes are not worth a rebuild.
+#define MIN_REBUILD_COUNT 64
+
+
+void HammingIndexInit(HAMMING_INDEX *Index)
+{
+	memset(Index, 0, sizeof(*Index));
+}
+
+
+void HammingIndexFree(HAMMING_INDEX *Index)
+{
+	free(Index->Nodes);
+	free(Index->Stack);
+	memset(Index, 0, sizeof(*Index));
+}
+
+
+// Links node Node (which must not be linked yet) into the tree below the root.
+static void Insert(HAMMING_INDEX *Index, UINT Node)
+{
+	HAMMING_INDEX_NODE *Nodes = Index->Nodes;
+	Nodes[Node].FirstChild = HAMMING_INDEX_NONE;
+	Nodes[Node].NextSibling = HAMMING_INDEX_NONE;
+	Nodes[Node].Distance = 0;
+	if (Node == 0) return;
+
+	UINT Parent = 0;
+	for (;;)
+	{
+		UINT Distance = PerceptualHashDistance(Nodes[Parent].Hash, Nodes[Node].Hash);
+		UINT Child = Nodes[Parent].FirstChild;
+		while (Child != HAMMING_INDEX_NONE && Nodes[Child].Distance != Distance)
+		{
+			Child = Nodes[Child].NextSibling;
+		}
+		if (Child == HAMMING_INDEX_NONE)
+		{
+			Nodes[Node].Distance = (BYTE)Distance;
+			Nodes[Node].NextSibling = Nodes[Parent].FirstChild;
+			Nodes[Parent].FirstChild = Node;
+			return;
+		}
+		Parent = Child;
+	}
+}
+
+
+// Drops the removed nodes, and builds the tree again from the others, in the same order.
+static void Rebuild(HAMMING_INDEX *Index)
+{
+	UINT Count = 0;
+	for (UINT i = 0; i < Index->Count; ++i)
+	{
+		if (!Index->Nodes[i].Removed)
+		{
+			Index->Nodes[Count++] = Index->Nodes[i];
+		}
+	}
+	Index->Count = Count;
+	Index->RemovedCount = 0;
+	Index->FirstLive = 0;
+	for (UINT i = 0; i < Count; ++i)
+	{
+		Insert(Index, i);
+	}
+}
+
+
+static void RebuildIfMostlyRemoved(HAMMING_INDEX *Index)
+{
+	if (Index->Count >= MIN_REBUILD_COUNT && Index->RemovedCount > Index->Count / 2)
+	{
+		Rebuild(Index);
+	}
+}
+
+
+// Id must be larger than the ids of all hashes added so far. Returns false if there is not enough memory.
+BOOL HammingIndexAdd(HAMMING_INDEX *Index, ULONGLONG Hash, ULONGLONG Id)
+{
+	if (Index->Count == Index->Capacity)
+	{
+		UINT NewCapacity = Index->Capacity != 0 ? Index->Capacity * 2 : 64;
+		HAMMING_INDEX_NODE *NewNodes = (HAMMING_INDEX_NODE *)realloc(Index->Nodes, NewCapacity * sizeof(HAMMING_INDEX_NODE));
+		if (NewNodes == nullptr) return false;
+		Index->Nodes = NewNodes;
+		UINT *NewStack = (UINT *)realloc(Index->Stack, NewCapacity * sizeof(UINT));
+		if (NewStack == nullptr) return false;
+		Index->Stack = NewStack;
+		Index->Capacity = NewCapacity;
+	}
+	UINT Node = Index->Count++;
+	Index->Nodes[Node].Hash = Hash;
+	Index->Nodes[Node].Id = Id;
+	Index->Nodes[Node].Removed = false;
+	Insert(Index, Node);
+	return true;
+}
+
+
+// Returns the first node with an id of at least Id, or Count.
+static UINT FindFirstNode(const HAMMING_INDEX *Index, ULONGLONG Id)
+{
+	UINT Low = 0;
+	UINT High = Index->Count;
+	while (Low < High)
+	{
+		UINT Middle = Low + (High - Low) / 2;
+		if (Index->Nodes[Middle].Id < Id) Low = Middle + 1;
+		else High = Middle;
+	}
+	return Low;
+}
+
+
+void HammingIndexRemove(HAMMING_INDEX *Index, ULONGLONG Id)
+{
+	UINT Node = FindFirstNode(Index, Id);
+	if (Node == Index->Count || Index->Nodes[Node].Id != Id || Index->Nodes[Node].Removed) return;
+	Index->Nodes[Node].Removed = true;
+	++Index->RemovedCount;
+	RebuildIfMostlyRemoved(Index);
+}
+
+
+// Removes all hashes with ids below Id, e.g. those of history entries that have been evicted.
+void HammingIndexRemoveBefore(HAMMING_INDEX *Index, ULONGLONG Id)
+{
+	UINT End = FindFirstNode(Index, Id);
+	for (UINT Node = Index->FirstLive; Node < End; ++Node)
+	{
+		if (!Index->Nodes[Node].Removed)
+		{
+			Index->Nodes[Node].Removed = true;
+			++Index->RemovedCount;
+		}
+	}
+	if (End > Index->FirstLive) Index->FirstLive = End;
+	RebuildIfMostlyRemoved(Index);
+}
+
+
+// Finds the hash nearest to Hash, at most Radius bits away, for which Accept (if not null) returns true. Of several
+// hashes at the same distance, the one with the largest id is returned.
+BOOL HammingIndexFindNearest(HAMMING_INDEX *Index, ULONGLONG Hash, UINT Radius, BOOL (*Accept)(void *Context, ULONGLONG Id), void *Context, ULONGLONG *Id, UINT *Distance)
+{
+	Index->LastVisited = 0;
+	if (Index->Count == 0) return false;
+
+	const HAMMING_INDEX_NODE *Nodes = Index->Nodes;
+	BOOL Found = false;
+	UINT BestNode = 0;
+	UINT BestDistance = 0;
+	// Every node is pushed at most once, since it has a single parent.
+	UINT StackSize = 0;
+	Index->Stack[StackSize++] = 0;
+	while (StackSize > 0)
+	{
+		UINT Node = Index->Stack[--StackSize];
+		UINT NodeDistance = PerceptualHashDistance(Nodes[Node].Hash, Hash);
+		++Index->LastVisited;
+		if (NodeDistance <= Radius && !Nodes[Node].Removed &&
+			(!Found || NodeDistance < BestDistance || (NodeDistance == BestDistance && Nodes[Node].Id > Nodes[BestNode].Id)) &&
+			(Accept == nullptr || Accept(Context, Nodes[Node].Id)))
+		{
+			Found = true;
+			BestNode = Node;
+			BestDistance = NodeDistance;
+			// Anything farther than this is of no interest anymore.
+			Radius = NodeDistance;
+		}
+		for (UINT Child = Nodes[Node].FirstChild; Child != HAMMING_INDEX_NONE; Child = Nodes[Child].NextSibling)
+		{
+			UINT ChildDistance = Nodes[Child].Distance;
+			if (ChildDistance + Radius >= NodeDistance && ChildDistance <= NodeDistance + Radius)
+			{
+				Index->Stack[StackSize++] = Child;
+			}
+		}
+	}
+
+	if (!Found) return false;
+	*Id = Nodes[BestNode].Id;
+	*Distance = BestDistance;
+	return true;
+}
+
+
+// Hashes that have not been removed.
+UINT HammingIndexGetCount(const HAMMING_INDEX *Index)
+{
+	return Index->Count - Index->RemovedCount;
+}
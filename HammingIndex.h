@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Portable.h"
+
+struct HAMMING_INDEX_NODE;
+struct HAMMING_INDEX;
+
+// BK-tree over 64 bit hashes, with the Hamming distance as the metric, for finding the hash nearest to a query within
+// a small distance without comparing it to all of them.
+//
+// Every node keeps its children linked by their distance to it. By the triangle inequality, a hash within Radius of the
+// query can only be below children whose distance d to their parent satisfies |d - (distance of the parent to the
+// query)| <= Radius, so a query only visits a small part of the tree when Radius is small.
+//
+// Hashes are identified by the caller, and must be added in increasing order of their ids. Removing marks the node;
+// it keeps routing queries until the tree is rebuilt without the removed nodes, once they are the majority.
+
+extern void                HammingIndexInit(HAMMING_INDEX *Index);
+extern void                HammingIndexFree(HAMMING_INDEX *Index);
+extern BOOL                HammingIndexAdd(HAMMING_INDEX *Index, ULONGLONG Hash, ULONGLONG Id);
+extern void                HammingIndexRemove(HAMMING_INDEX *Index, ULONGLONG Id);
+extern void                HammingIndexRemoveBefore(HAMMING_INDEX *Index, ULONGLONG Id);
+extern BOOL                HammingIndexFindNearest(HAMMING_INDEX *Index, ULONGLONG Hash, UINT Radius, BOOL (*Accept)(void *Context, ULONGLONG Id), void *Context, ULONGLONG *Id, UINT *Distance);
+extern UINT                HammingIndexGetCount(const HAMMING_INDEX *Index);
+
+#define HAMMING_INDEX_NONE ((UINT)-1)
+
+struct HAMMING_INDEX_NODE
+{
+	ULONGLONG Hash;
+	ULONGLONG Id;
+	UINT FirstChild;       // Or HAMMING_INDEX_NONE.
+	UINT NextSibling;      // Or HAMMING_INDEX_NONE.
+	BYTE Distance;         // To the parent.
+	BOOL Removed;
+};
+
+struct HAMMING_INDEX
+{
+	// In the order in which they were added, i.e. by id. Node 0 is the root.
+	HAMMING_INDEX_NODE *Nodes;
+	UINT Count;
+	UINT Capacity;
+	UINT RemovedCount;
+	// All nodes before this one are removed.
+	UINT FirstLive;
+	// Nodes still to be visited by a query. Holds at most Count nodes.
+	UINT *Stack;
+
+	// Distance computations of the last query, to see how much of the tree it had to visit.
+	UINT LastVisited;
+};
@@ -0,0 +1,363 @@
+// The monitor without a window, for Linux: watches an X11 selection and writes one line of JSON to stdout for every
+// change (NDJSON), e.g.
+//   {"sequence":2,"time":1760000000123,"hold_us":412,"format":"CF_UNICODETEXT","size":24,"hash":"...","length":12}
+//   {"sequence":3,"time":1760000004567,"hold_us":9730,"format":"CF_DIB","size":1920054,"hash":"...","width":800,"height":600}
+//   {"sequence":4,"time":1760000009876,"hold_us":198,"format":null}
+// "size" is the size of the payload that "hash" covers (UTF-16 without the terminating 0, for text), so the hashes
+// match the ones the Windows monitor computes for the same content. "format" is null if the selection holds nothing
+// that the monitor captures. "time" is in milliseconds since 1970. "hold_us" is how long the selection was being
+// copied, in microseconds; that includes waiting for its owner to convert it.
+//
+// Options:
+//   /display:<name>     The X display, instead of $DISPLAY.
+//   /selection:<name>   The selection to watch (default CLIPBOARD, e.g. PRIMARY).
+//   /trace:<file>       Records how long the stages of every capture take, and writes them to file on exit; see
+//                       Tracer.h.
+
+#include "Portable.h"
+#include "ClipboardBackend.h"
+#include "X11ClipboardBackend.h"
+#include "ClipboardAcquirer.h"
+#include "Coalescer.h"
+#include "CaptureWorker.h"
+#include "ClipboardSnapshot.h"
+#include "PixelBuffer.h"
+#include "Tracer.h"
+#include <poll.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <stdio.h>
+#include <string.h>
+
+// Owner changes are merged like in the Windows monitor; dragging out a PRIMARY selection changes its owner constantly.
+#define COALESCE_QUIET_US (30 * 1000)
+#define COALESCE_MAX_LATENCY_US (250 * 1000)
+
+// Between 1601 (FILETIME) and 1970, in 100 ns.
+#define UNIX_EPOCH_FILETIME 116444736000000000LL
+
+static X11_CLIPBOARD Clipboard;
+static CLIPBOARD_BACKEND ClipboardBackend;
+static CLIPBOARD_ACQUIRER ClipboardAcquirer;
+static COALESCER UpdateCoalescer;
+static CAPTURE_WORKER CaptureWorker;
+static DWORD LastClipboardSequenceNumber;
+static CLIPBOARD_SNAPSHOT ClipboardSnapshot;
+
+// Wakes the main loop when the capture worker has a result.
+static int NotifyPipe[2];
+static volatile sig_atomic_t StopRequested;
+
+// Deadlines of the timers, in GetMonotonicTimeUs time, or 0.
+static ULONGLONG AcquireRetryUs;
+static ULONGLONG CoalesceDeadlineUs;
+
+// When the first change that has not been captured yet was noticed, for tracing; 0 if there is none, or the tracer is
+// stopped.
+static ULONGLONG ChangeTraceStart;
+
+
+static LONGLONG GetTimestamp()
+{
+	timespec Now;
+	clock_gettime(CLOCK_REALTIME, &Now);
+	return UNIX_EPOCH_FILETIME + (LONGLONG)Now.tv_sec * 10000000 + Now.tv_nsec / 100;
+}
+
+
+// Returns false if stdout is gone. TraceStart is when the change was noticed.
+static BOOL WriteRecord(DWORD SequenceNumber, LONGLONG Timestamp, ULONGLONG HoldUs, const CAPTURE_JOB *Job, ULONGLONG TraceStart)
+{
+	ULONGLONG WriteTraceStart = TraceBegin();
+	printf("{\"sequence\":%u,\"time\":%lld,\"hold_us\":%llu", SequenceNumber, (Timestamp - UNIX_EPOCH_FILETIME) / 10000, (unsigned long long)HoldUs);
+	if (Job == nullptr)
+	{
+		printf(",\"format\":null");
+	}
+	else
+	{
+		printf(",\"format\":\"%s\",\"size\":%llu,\"hash\":\"%016llx%016llx\"", Job->Format == CF_UNICODETEXT ? "CF_UNICODETEXT" : Job->IsPng ? "PNG" : "CF_DIB",
+			(unsigned long long)Job->HashedSizeCb, (unsigned long long)Job->Hash.High, (unsigned long long)Job->Hash.Low);
+		if (Job->Format == CF_UNICODETEXT)
+		{
+			printf(",\"length\":%llu", (unsigned long long)(Job->HashedSizeCb / sizeof(WCHAR)));
+		}
+		else if (Job->Image != nullptr)
+		{
+			printf(",\"width\":%d,\"height\":%d", Job->Image->Width, Job->Image->Height);
+		}
+	}
+	printf("}\n");
+	BOOL Succeeded = fflush(stdout) == 0;
+	ULONGLONG WriteEnd = TraceEnd("WriteRecord", WriteTraceStart, SequenceNumber);
+	TraceSpan("CopyToOutput", TraceStart, WriteEnd, SequenceNumber);
+	return Succeeded;
+}
+
+
+// Called on the capture worker thread.
+static void NotifyCaptureDone(void *)
+{
+	// If the pipe is full, the main loop is going to wake up anyway.
+	BYTE Byte = 0;
+	ssize_t Written = write(NotifyPipe[1], &Byte, 1);
+	(void)Written;
+}
+
+
+static void CaptureClipboard()
+{
+	ULONGLONG TraceStart = TraceBegin();
+	BOOL Snapshotted = ClipboardSnapshotTake(&ClipboardSnapshot, &ClipboardBackend, &CaptureSnapshotRequest, 1);
+	LastClipboardSequenceNumber = ClipboardSnapshot.SequenceNumber;
+	ClipboardAcquirerRelease(&ClipboardAcquirer, GetMonotonicTimeUs());
+	TraceEnd("ClipboardOpen", TraceStart, LastClipboardSequenceNumber);
+	CAPTURE_JOB *Job = Snapshotted ? CaptureJobCreateFromSnapshot(&ClipboardSnapshot, 0) : nullptr;
+	ClipboardSnapshotRelease(&ClipboardSnapshot);
+
+	LONGLONG Timestamp = GetTimestamp();
+	ULONGLONG ChangeStart = ChangeTraceStart;
+	ChangeTraceStart = 0;
+	if (Job != nullptr)
+	{
+		Job->SequenceNumber = LastClipboardSequenceNumber;
+		Job->Timestamp = Timestamp;
+		Job->TraceStartTicks = ChangeStart;
+		Job->ClipboardHoldUs = ClipboardAcquirer.LastHoldUs;
+		// This also cancels the decoding of anything captured before.
+		CaptureWorkerSubmit(&CaptureWorker, Job);
+	}
+	else
+	{
+		CaptureWorkerCancel(&CaptureWorker);
+		if (!WriteRecord(LastClipboardSequenceNumber, Timestamp, ClipboardAcquirer.LastHoldUs, nullptr, ChangeStart)) StopRequested = true;
+	}
+}
+
+
+// The selection has a new owner.
+static void NoteSelectionChange()
+{
+	TraceInstant("SelectionChange", 0);
+	if (ChangeTraceStart == 0) ChangeTraceStart = TraceBegin();
+	CoalesceDeadlineUs = CoalescerAddEvent(&UpdateCoalescer, GetMonotonicTimeUs());
+}
+
+
+static void HandleAcquireResult(ACQUIRE_RESULT Result, ULONGLONG RetryDelayUs)
+{
+	switch (Result)
+	{
+		case ACQUIRE_OPENED:
+		{
+			CaptureClipboard();
+			break;
+		}
+		case ACQUIRE_RETRY:
+		{
+			// A delay of 0 means an acquisition is already pending, and its timer is still running.
+			if (RetryDelayUs != 0)
+			{
+				AcquireRetryUs = GetMonotonicTimeUs() + RetryDelayUs;
+			}
+			break;
+		}
+		case ACQUIRE_FAILED:
+		{
+			// The owner does not answer. If the selection changes in the meantime, we hear about it again.
+			AcquireRetryUs = 0;
+			break;
+		}
+	}
+}
+
+
+static void UpdateClipboard()
+{
+	DWORD SequenceNumber = ClipboardBackend.GetSequenceNumber(ClipboardBackend.Context);
+	if (SequenceNumber == LastClipboardSequenceNumber && !ClipboardAcquirerIsPending(&ClipboardAcquirer)) return;
+
+	ULONGLONG RetryDelayUs;
+	ACQUIRE_RESULT Result = ClipboardAcquirerBegin(&ClipboardAcquirer, GetMonotonicTimeUs(), &RetryDelayUs);
+	HandleAcquireResult(Result, RetryDelayUs);
+}
+
+
+// Runs the timers that are due, and returns the time until the next one in milliseconds, or -1 if none is running.
+static int RunTimers()
+{
+	ULONGLONG NowUs = GetMonotonicTimeUs();
+	if (AcquireRetryUs != 0 && NowUs >= AcquireRetryUs)
+	{
+		AcquireRetryUs = 0;
+		ULONGLONG RetryDelayUs;
+		ACQUIRE_RESULT Result = ClipboardAcquirerRetry(&ClipboardAcquirer, NowUs, &RetryDelayUs);
+		HandleAcquireResult(Result, RetryDelayUs);
+	}
+	if (CoalesceDeadlineUs != 0 && NowUs >= CoalesceDeadlineUs)
+	{
+		if (CoalescerPoll(&UpdateCoalescer, NowUs, &CoalesceDeadlineUs))
+		{
+			UpdateClipboard();
+		}
+	}
+
+	NowUs = GetMonotonicTimeUs();
+	ULONGLONG NextUs = 0;
+	if (AcquireRetryUs != 0) NextUs = AcquireRetryUs;
+	if (CoalesceDeadlineUs != 0 && (NextUs == 0 || CoalesceDeadlineUs < NextUs)) NextUs = CoalesceDeadlineUs;
+	if (NextUs == 0) return -1;
+	return NextUs > NowUs ? (int)((NextUs - NowUs + 999) / 1000) : 0;
+}
+
+
+static void HandleSignal(int)
+{
+	StopRequested = true;
+}
+
+
+static BOOL ParseOptions(int argc, char **argv, const char **DisplayName, const char **SelectionName, const char **TraceFile)
+{
+	static const char DisplayOption[] = "/display:";
+	static const char SelectionOption[] = "/selection:";
+	static const char TraceOption[] = "/trace:";
+	for (int i = 1; i < argc; ++i)
+	{
+		const char *Option = argv[i];
+		if (strncmp(Option, DisplayOption, sizeof(DisplayOption) - 1) == 0)
+		{
+			*DisplayName = Option + sizeof(DisplayOption) - 1;
+		}
+		else if (strncmp(Option, SelectionOption, sizeof(SelectionOption) - 1) == 0 && Option[sizeof(SelectionOption) - 1] != 0)
+		{
+			*SelectionName = Option + sizeof(SelectionOption) - 1;
+		}
+		else if (strncmp(Option, TraceOption, sizeof(TraceOption) - 1) == 0 && Option[sizeof(TraceOption) - 1] != 0)
+		{
+			*TraceFile = Option + sizeof(TraceOption) - 1;
+		}
+		else
+		{
+			fprintf(stderr, "Unknown option: %s\nUsage: %s [/display:<name>] [/selection:<name>] [/trace:<file>]\n", Option, argv[0]);
+			return false;
+		}
+	}
+	return true;
+}
+
+
+int main(int argc, char **argv)
+{
+	const char *DisplayName = nullptr;
+	const char *SelectionName = "CLIPBOARD";
+	const char *TraceFile = nullptr;
+	if (!ParseOptions(argc, argv, &DisplayName, &SelectionName, &TraceFile)) return 2;
+	TracerSetThreadName("Main");
+	if (TraceFile != nullptr)
+	{
+		TracerStart();
+	}
+
+	if (!X11ClipboardConnect(&Clipboard, DisplayName, SelectionName))
+	{
+		fprintf(stderr, "Cannot open the X display, or it does not support XFixes.\n");
+		return 1;
+	}
+	if (pipe(NotifyPipe) != 0)
+	{
+		X11ClipboardDisconnect(&Clipboard);
+		return 1;
+	}
+	fcntl(NotifyPipe[0], F_SETFL, O_NONBLOCK);
+	fcntl(NotifyPipe[1], F_SETFL, O_NONBLOCK);
+
+	// Without SA_RESTART, so that the signal also ends the wait in poll.
+	struct sigaction Action = {};
+	Action.sa_handler = HandleSignal;
+	sigaction(SIGINT, &Action, nullptr);
+	sigaction(SIGTERM, &Action, nullptr);
+	// A closed stdout shows up as a failed write instead.
+	signal(SIGPIPE, SIG_IGN);
+
+	X11ClipboardBackendInit(&ClipboardBackend, &Clipboard);
+	CaptureRegisterFormats(&ClipboardBackend);
+
+	CLIPBOARD_ACQUIRER_CONFIG AcquirerConfig = {};
+	AcquirerConfig.MaxAttempts = 20;
+	AcquirerConfig.MaxWaitUs = 2000 * 1000;
+	AcquirerConfig.InitialDelayUs = 5 * 1000;
+	AcquirerConfig.MaxDelayUs = 100 * 1000;
+	AcquirerConfig.JitterPercent = 25;
+	ClipboardAcquirerInit(&ClipboardAcquirer, &ClipboardBackend, &AcquirerConfig, (DWORD)getpid() ^ (DWORD)GetMonotonicTimeUs());
+	ClipboardSnapshotInit(&ClipboardSnapshot);
+
+	COALESCER_CONFIG CoalescerConfig = {};
+	CoalescerConfig.QuietUs = COALESCE_QUIET_US;
+	CoalescerConfig.MaxLatencyUs = COALESCE_MAX_LATENCY_US;
+	CoalescerInit(&UpdateCoalescer, &CoalescerConfig);
+
+	if (!CaptureWorkerStart(&CaptureWorker, NotifyCaptureDone, nullptr))
+	{
+		X11ClipboardDisconnect(&Clipboard);
+		return 1;
+	}
+
+	while (!StopRequested)
+	{
+		if (X11ClipboardHandleEvents(&Clipboard))
+		{
+			NoteSelectionChange();
+		}
+		int TimeoutMs = RunTimers();
+		// A capture in RunTimers may have read new events.
+		if (X11ClipboardHandleEvents(&Clipboard))
+		{
+			NoteSelectionChange();
+			TimeoutMs = 0;
+		}
+
+		pollfd Fds[2] = {};
+		Fds[0].fd = X11ClipboardGetFd(&Clipboard);
+		Fds[0].events = POLLIN;
+		Fds[1].fd = NotifyPipe[0];
+		Fds[1].events = POLLIN;
+		if (poll(Fds, 2, TimeoutMs) < 0 && errno != EINTR) break;
+		if (Fds[0].revents & (POLLERR | POLLHUP))
+		{
+			fprintf(stderr, "Lost the connection to the X display.\n");
+			break;
+		}
+
+		if (Fds[1].revents & POLLIN)
+		{
+			BYTE Bytes[64];
+			while (read(NotifyPipe[0], Bytes, sizeof(Bytes)) > 0)
+			{
+			}
+			// Results are only handed out for the newest capture; anything older has been cancelled.
+			while (CAPTURE_JOB *Job = CaptureWorkerGetResult(&CaptureWorker))
+			{
+				if (!WriteRecord(Job->SequenceNumber, Job->Timestamp, Job->ClipboardHoldUs, Job, Job->TraceStartTicks)) StopRequested = true;
+				CaptureJobFree(Job);
+			}
+		}
+	}
+
+	CaptureWorkerStop(&CaptureWorker);
+	ClipboardSnapshotFree(&ClipboardSnapshot);
+	X11ClipboardDisconnect(&Clipboard);
+	close(NotifyPipe[0]);
+	close(NotifyPipe[1]);
+	int ExitCode = 0;
+	if (TraceFile != nullptr && !TracerWriteChromeTrace(TraceFile))
+	{
+		fprintf(stderr, "Cannot write the trace to %s.\n", TraceFile);
+		ExitCode = 1;
+	}
+	TracerFree();
+	return ExitCode;
+}
@@ -0,0 +1,158 @@
+#include "HexDump.h"
+
+// Columns, relative to the end of the offset.
+#define HEX_COLUMN 2
+#define HEX_GROUP_WIDTH (3 * 8 + 1)   // Eight bytes, and the gap between the two groups.
+#define ASCII_COLUMN (HEX_COLUMN + 2 * HEX_GROUP_WIDTH)
+
+static const char HexDigits[] = "0123456789ABCDEF";
+
+void HexDumpInit(HEX_DUMP *Dump, const BYTE *Data, SIZE_T SizeCb)
+{
+	Dump->Data = Data;
+	Dump->SizeCb = SizeCb;
+	Dump->OffsetDigits = (ULONGLONG)SizeCb > 0xFFFFFFFF ? 16 : 8;
+	Dump->RowLength = Dump->OffsetDigits + ASCII_COLUMN + HEX_DUMP_BYTES_PER_ROW;
+}
+
+
+ULONGLONG HexDumpGetRowCount(const HEX_DUMP *Dump)
+{
+	return ((ULONGLONG)Dump->SizeCb + HEX_DUMP_BYTES_PER_ROW - 1) / HEX_DUMP_BYTES_PER_ROW;
+}
+
+
+// Returns the rows that intersect the vertical pixel range [Top, Bottom), where row N starts at N * RowHeight.
+void HexDumpGetVisibleRows(const HEX_DUMP *Dump, ULONGLONG Top, ULONGLONG Bottom, UINT RowHeight, ULONGLONG *FirstRow, ULONGLONG *EndRow)
+{
+	*FirstRow = 0;
+	*EndRow = 0;
+	if (RowHeight == 0 || Bottom <= Top) return;
+	ULONGLONG RowCount = HexDumpGetRowCount(Dump);
+	ULONGLONG First = Top / RowHeight;
+	ULONGLONG End = (Bottom + RowHeight - 1) / RowHeight;
+	*FirstRow = First < RowCount ? First : RowCount;
+	*EndRow = End < RowCount ? End : RowCount;
+}
+
+
+// Writes the hex and ASCII columns of up to HEX_DUMP_BYTES_PER_ROW bytes; missing bytes are left blank.
+static void FormatBytes(const BYTE *Bytes, UINT Count, WCHAR *Hex, WCHAR *Ascii)
+{
+	for (UINT i = 0; i < HEX_DUMP_BYTES_PER_ROW; ++i)
+	{
+		WCHAR *h = Hex + 3 * i + (i >= 8 ? 1 : 0);
+		if (i < Count)
+		{
+			BYTE b = Bytes[i];
+			h[0] = HexDigits[b >> 4];
+			h[1] = HexDigits[b & 15];
+			Ascii[i] = b >= 0x20 && b < 0x7F ? b : '.';
+		}
+		else
+		{
+			h[0] = ' ';
+			h[1] = ' ';
+			Ascii[i] = ' ';
+		}
+		h[2] = ' ';
+	}
+	Hex[3 * 8] = ' ';
+	Hex[2 * HEX_GROUP_WIDTH - 1] = ' ';
+}
+
+
+#ifdef PORTABLE_SSE2
+// Writes "hh " for each of eight bytes, given their hex digits in the low 16 bit lanes of High and Low. Every store
+// writes one character too many, which the next store (or the caller) overwrites.
+static void StoreHexGroup(WCHAR *Out, __m128i High, __m128i Low)
+{
+	const __m128i Space = _mm_set1_epi32(' ');
+	__m128i Pairs0 = _mm_unpacklo_epi16(High, Low);
+	__m128i Pairs1 = _mm_unpackhi_epi16(High, Low);
+	__m128i Bytes01 = _mm_unpacklo_epi32(Pairs0, Space);
+	__m128i Bytes23 = _mm_unpackhi_epi32(Pairs0, Space);
+	__m128i Bytes45 = _mm_unpacklo_epi32(Pairs1, Space);
+	__m128i Bytes67 = _mm_unpackhi_epi32(Pairs1, Space);
+	_mm_storel_epi64((__m128i *)(Out + 0), Bytes01);
+	_mm_storel_epi64((__m128i *)(Out + 3), _mm_srli_si128(Bytes01, 8));
+	_mm_storel_epi64((__m128i *)(Out + 6), Bytes23);
+	_mm_storel_epi64((__m128i *)(Out + 9), _mm_srli_si128(Bytes23, 8));
+	_mm_storel_epi64((__m128i *)(Out + 12), Bytes45);
+	_mm_storel_epi64((__m128i *)(Out + 15), _mm_srli_si128(Bytes45, 8));
+	_mm_storel_epi64((__m128i *)(Out + 18), Bytes67);
+	_mm_storel_epi64((__m128i *)(Out + 21), _mm_srli_si128(Bytes67, 8));
+}
+
+
+// Same as FormatBytes for a full row. Converts all 16 bytes to hex digits and printable characters at once.
+static void FormatBytes16(const BYTE *Bytes, WCHAR *Hex, WCHAR *Ascii)
+{
+	const __m128i Zero = _mm_setzero_si128();
+	const __m128i Nibble = _mm_set1_epi8(0x0F);
+	const __m128i Nine = _mm_set1_epi8(9);
+	const __m128i DigitZero = _mm_set1_epi8('0');
+	const __m128i LetterOffset = _mm_set1_epi8('A' - '0' - 10);
+
+	__m128i Data = _mm_loadu_si128((const __m128i *)Bytes);
+	__m128i High = _mm_and_si128(_mm_srli_epi16(Data, 4), Nibble);
+	__m128i Low = _mm_and_si128(Data, Nibble);
+	High = _mm_add_epi8(_mm_add_epi8(High, DigitZero), _mm_and_si128(_mm_cmpgt_epi8(High, Nine), LetterOffset));
+	Low = _mm_add_epi8(_mm_add_epi8(Low, DigitZero), _mm_and_si128(_mm_cmpgt_epi8(Low, Nine), LetterOffset));
+
+	StoreHexGroup(Hex, _mm_unpacklo_epi8(High, Zero), _mm_unpacklo_epi8(Low, Zero));
+	StoreHexGroup(Hex + HEX_GROUP_WIDTH, _mm_unpackhi_epi8(High, Zero), _mm_unpackhi_epi8(Low, Zero));
+	Hex[3 * 8] = ' ';
+	Hex[2 * HEX_GROUP_WIDTH - 1] = ' ';
+
+	// 0x20 to 0x7E are printable; bytes from 0x80 up are negative as signed bytes, so they fail the first comparison.
+	__m128i Printable = _mm_and_si128(_mm_cmpgt_epi8(Data, _mm_set1_epi8(0x1F)), _mm_cmplt_epi8(Data, _mm_set1_epi8(0x7F)));
+	__m128i Characters = _mm_or_si128(_mm_and_si128(Printable, Data), _mm_andnot_si128(Printable, _mm_set1_epi8('.')));
+	_mm_storeu_si128((__m128i *)Ascii, _mm_unpacklo_epi8(Characters, Zero));
+	_mm_storeu_si128((__m128i *)(Ascii + 8), _mm_unpackhi_epi8(Characters, Zero));
+}
+#endif
+
+
+static UINT FormatRow(const HEX_DUMP *Dump, ULONGLONG Row, WCHAR *Out, BOOL UseSimd)
+{
+	ULONGLONG Offset = Row * HEX_DUMP_BYTES_PER_ROW;
+	if (Offset >= Dump->SizeCb) return 0;
+
+	UINT Digits = Dump->OffsetDigits;
+	for (UINT i = 0; i < Digits; ++i)
+	{
+		Out[i] = HexDigits[(Offset >> (4 * (Digits - 1 - i))) & 15];
+	}
+	WCHAR *Columns = Out + Digits;
+	Columns[0] = ' ';
+	Columns[1] = ' ';
+
+	const BYTE *Bytes = Dump->Data + Offset;
+	ULONGLONG Remaining = Dump->SizeCb - Offset;
+	UINT Count = Remaining < HEX_DUMP_BYTES_PER_ROW ? (UINT)Remaining : HEX_DUMP_BYTES_PER_ROW;
+#ifdef PORTABLE_SSE2
+	if (UseSimd && Count == HEX_DUMP_BYTES_PER_ROW)
+	{
+		FormatBytes16(Bytes, Columns + HEX_COLUMN, Columns + ASCII_COLUMN);
+		return Dump->RowLength;
+	}
+#endif
+	FormatBytes(Bytes, Count, Columns + HEX_COLUMN, Columns + ASCII_COLUMN);
+	return Dump->RowLength;
+}
+
+
+// Writes row Row to Out, which must have room for HEX_DUMP_MAX_ROW_LENGTH characters, and returns its length. The row
+// is not terminated.
+UINT HexDumpFormatRow(const HEX_DUMP *Dump, ULONGLONG Row, WCHAR *Out)
+{
+	return FormatRow(Dump, Row, Out, true);
+}
+
+
+// The same row, formatted one byte at a time even where SIMD is available. Only there to compare the two.
+UINT HexDumpFormatRowScalar(const HEX_DUMP *Dump, ULONGLONG Row, WCHAR *Out)
+{
+	return FormatRow(Dump, Row, Out, false);
+}
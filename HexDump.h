@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Portable.h"
+
+struct HEX_DUMP;
+
+// Hex/ASCII dump of a block of memory, one row per HEX_DUMP_BYTES_PER_ROW bytes. Rows are formatted on demand, so only
+// the rows that are actually visible ever cost anything; the data itself is not copied.
+//
+// Every row has the same length, e.g.
+// 00000010  48 65 6C 6C 6F 2C 20 77  6F 72 6C 64 21 0D 0A 00  Hello, world!...
+
+extern void                HexDumpInit(HEX_DUMP *Dump, const BYTE *Data, SIZE_T SizeCb);
+extern ULONGLONG           HexDumpGetRowCount(const HEX_DUMP *Dump);
+extern void                HexDumpGetVisibleRows(const HEX_DUMP *Dump, ULONGLONG Top, ULONGLONG Bottom, UINT RowHeight, ULONGLONG *FirstRow, ULONGLONG *EndRow);
+extern UINT                HexDumpFormatRow(const HEX_DUMP *Dump, ULONGLONG Row, WCHAR *Out);
+extern UINT                HexDumpFormatRowScalar(const HEX_DUMP *Dump, ULONGLONG Row, WCHAR *Out);
+
+#define HEX_DUMP_BYTES_PER_ROW 16
+// Room needed for one row by HexDumpFormatRow.
+#define HEX_DUMP_MAX_ROW_LENGTH 84
+
+struct HEX_DUMP
+{
+	const BYTE *Data;
+	SIZE_T SizeCb;
+	UINT OffsetDigits;  // 8, or 16 for data of 4 GB and more.
+	UINT RowLength;
+};
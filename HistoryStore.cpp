@@ -0,0 +1,431 @@
+#include "HistoryStore.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define INDEX_MAGIC 0x58494D43  // "CMIX"
+#define RECORD_MAGIC 0x43524D43 // "CMRC"
+#define INDEX_VERSION 1
+
+struct INDEX_HEADER
+{
+	DWORD Magic;
+	DWORD Version;
+	DWORD EntrySize;
+	DWORD Reserved;
+};
+
+struct RECORD_HEADER
+{
+	DWORD Magic;
+	UINT Format;
+	ULONGLONG SizeCb;
+	LONGLONG Timestamp;
+	CONTENT_HASH Hash;
+	UINT Segment;
+	DWORD Check;           // Of everything before it, so that a header that was only partially written is recognized.
+};
+
+static_assert(sizeof(STORED_ENTRY) == 48, "The index entry layout is part of the file format.");
+static_assert(sizeof(RECORD_HEADER) == 48, "The record header layout is part of the file format.");
+
+
+static DWORD ComputeHeaderCheck(const RECORD_HEADER *Header)
+{
+	CONTENT_HASH Hash;
+	ComputeContentHash(Header, offsetof(RECORD_HEADER, Check), &Hash);
+	return (DWORD)Hash.Low;
+}
+
+
+// Records start at multiples of 8 bytes.
+static ULONGLONG GetRecordSize(ULONGLONG SizeCb)
+{
+	return (sizeof(RECORD_HEADER) + SizeCb + 7) & ~(ULONGLONG)7;
+}
+
+
+// Segment 0 is the index.
+static BOOL BuildPath(const PATH_CHAR *Directory, UINT Segment, PATH_CHAR *Path)
+{
+	SIZE_T Length = 0;
+	while (Directory[Length] != 0)
+	{
+		Path[Length] = Directory[Length];
+		++Length;
+	}
+	static const PATH_CHAR IndexName[] = PATH_TEXT("history.idx");
+	if (Length + 1 + sizeof(IndexName) / sizeof(IndexName[0]) > STORE_PATH_LENGTH) return false;
+	Path[Length++] = PATH_SEPARATOR;
+	if (Segment == 0)
+	{
+		memcpy(Path + Length, IndexName, sizeof(IndexName));
+		return true;
+	}
+	for (int i = 7; i >= 0; --i, Segment /= 10)
+	{
+		Path[Length + i] = (PATH_CHAR)('0' + Segment % 10);
+	}
+	static const PATH_CHAR Extension[] = PATH_TEXT(".log");
+	memcpy(Path + Length + 8, Extension, sizeof(Extension));
+	return true;
+}
+
+
+static BOOL OpenSegment(const HISTORY_STORE *Store, UINT Segment, BOOL Create, PORTABLE_FILE *File)
+{
+	PATH_CHAR Path[STORE_PATH_LENGTH];
+	return BuildPath(Store->Directory, Segment, Path) && FileOpen(File, Path, Create);
+}
+
+
+// Returns a file to read Segment from; the one being written if possible.
+static const PORTABLE_FILE *GetSegmentForReading(HISTORY_STORE *Store, UINT Segment)
+{
+	if (FileIsOpen(&Store->SegmentFile) && Store->Segment == Segment) return &Store->SegmentFile;
+	if (FileIsOpen(&Store->ReaderFile) && Store->ReaderSegment == Segment) return &Store->ReaderFile;
+	FileClose(&Store->ReaderFile);
+	PATH_CHAR Path[STORE_PATH_LENGTH];
+	if (!BuildPath(Store->Directory, Segment, Path) || !FileOpenForReading(&Store->ReaderFile, Path)) return nullptr;
+	Store->ReaderSegment = Segment;
+	return &Store->ReaderFile;
+}
+
+
+// Reads the header of the record at Offset, and checks that it is complete (including the payload, unless
+// CheckPayload is false, in which case only its size is checked).
+static BOOL ReadRecordHeader(HISTORY_STORE *Store, UINT Segment, ULONGLONG Offset, BOOL CheckPayload, RECORD_HEADER *Header)
+{
+	const PORTABLE_FILE *File = GetSegmentForReading(Store, Segment);
+	ULONGLONG FileSize;
+	if (File == nullptr || !FileGetSize(File, &FileSize)) return false;
+	if (FileSize < sizeof(RECORD_HEADER) || Offset > FileSize - sizeof(RECORD_HEADER)) return false;
+	if (!FileReadAt(File, Offset, Header, sizeof(*Header))) return false;
+	if (Header->Magic != RECORD_MAGIC || Header->Segment != Segment || Header->Check != ComputeHeaderCheck(Header)) return false;
+	if (Header->SizeCb > FileSize - Offset - sizeof(RECORD_HEADER) || Header->SizeCb > (SIZE_T)-1) return false;
+	if (!CheckPayload) return true;
+
+	BYTE *Payload = (BYTE *)malloc(Header->SizeCb != 0 ? (SIZE_T)Header->SizeCb : 1);
+	if (Payload == nullptr) return false;
+	CONTENT_HASH Hash;
+	BOOL Intact = FileReadAt(File, Offset + sizeof(RECORD_HEADER), Payload, (SIZE_T)Header->SizeCb);
+	if (Intact)
+	{
+		ComputeContentHash(Payload, (SIZE_T)Header->SizeCb, &Hash);
+		Intact = ContentHashEqual(&Hash, &Header->Hash);
+	}
+	free(Payload);
+	return Intact;
+}
+
+
+static BOOL EntryMatchesRecord(HISTORY_STORE *Store, const STORED_ENTRY *Entry)
+{
+	RECORD_HEADER Header;
+	if (!ReadRecordHeader(Store, Entry->Segment, Entry->Offset, false, &Header)) return false;
+	return Header.Format == Entry->Format && Header.SizeCb == Entry->SizeCb && Header.Timestamp == Entry->Timestamp && ContentHashEqual(&Header.Hash, &Entry->Hash);
+}
+
+
+static BOOL AddEntry(HISTORY_STORE *Store, const STORED_ENTRY *Entry)
+{
+	if (Store->AddedCount == Store->AddedCapacity)
+	{
+		SIZE_T NewCapacity = Store->AddedCapacity != 0 ? Store->AddedCapacity * 2 : 256;
+		STORED_ENTRY *NewEntries = (STORED_ENTRY *)realloc(Store->AddedEntries, NewCapacity * sizeof(STORED_ENTRY));
+		if (NewEntries == nullptr) return false;
+		Store->AddedEntries = NewEntries;
+		Store->AddedCapacity = NewCapacity;
+	}
+	ULONGLONG IndexOffset = sizeof(INDEX_HEADER) + HistoryStoreGetCount(Store) * sizeof(STORED_ENTRY);
+	if (!FileWriteAt(&Store->IndexFile, IndexOffset, Entry, sizeof(*Entry))) return false;
+	Store->AddedEntries[Store->AddedCount++] = *Entry;
+	return true;
+}
+
+
+// Opens the index, drops entries at its end whose records did not make it to disk, and maps the rest.
+static BOOL OpenIndex(HISTORY_STORE *Store)
+{
+	PATH_CHAR Path[STORE_PATH_LENGTH];
+	if (!BuildPath(Store->Directory, 0, Path) || !FileOpen(&Store->IndexFile, Path, true)) return false;
+
+	ULONGLONG FileSize;
+	if (!FileGetSize(&Store->IndexFile, &FileSize)) return false;
+	INDEX_HEADER Header = {};
+	BOOL Valid = FileSize >= sizeof(Header) && FileReadAt(&Store->IndexFile, 0, &Header, sizeof(Header)) &&
+		Header.Magic == INDEX_MAGIC && Header.Version == INDEX_VERSION && Header.EntrySize == sizeof(STORED_ENTRY);
+	ULONGLONG Count = 0;
+	if (Valid)
+	{
+		Count = (FileSize - sizeof(Header)) / sizeof(STORED_ENTRY);
+	}
+	else
+	{
+		// A new or unusable index; it is rebuilt from the log.
+		Header.Magic = INDEX_MAGIC;
+		Header.Version = INDEX_VERSION;
+		Header.EntrySize = sizeof(STORED_ENTRY);
+		if (!FileTruncate(&Store->IndexFile, 0) || !FileWriteAt(&Store->IndexFile, 0, &Header, sizeof(Header))) return false;
+	}
+
+	// Normally only the last entry is looked at.
+	while (Count > 0)
+	{
+		STORED_ENTRY Entry;
+		if (FileReadAt(&Store->IndexFile, sizeof(Header) + (Count - 1) * sizeof(STORED_ENTRY), &Entry, sizeof(Entry)) && EntryMatchesRecord(Store, &Entry)) break;
+		--Count;
+		++Store->DroppedEntries;
+	}
+
+	// This also cuts off a partially written entry. Mapped files cannot be truncated on Windows, so this has to
+	// happen first.
+	ULONGLONG IndexSize = sizeof(Header) + Count * sizeof(STORED_ENTRY);
+	if (IndexSize != FileSize && Valid && !FileTruncate(&Store->IndexFile, IndexSize)) return false;
+	if (Count > 0)
+	{
+		if (!FileMapView(&Store->IndexFile, IndexSize, &Store->IndexView)) return false;
+		Store->MappedEntries = (const STORED_ENTRY *)(Store->IndexView.Data + sizeof(Header));
+	}
+	Store->MappedCount = Count;
+	return true;
+}
+
+
+static void DeleteSegmentsFrom(const PATH_CHAR *Directory, UINT Segment)
+{
+	PATH_CHAR Path[STORE_PATH_LENGTH];
+	while (BuildPath(Directory, Segment, Path) && FileExists(Path))
+	{
+		FileDelete(Path);
+		++Segment;
+	}
+}
+
+
+// Indexes the records behind the last indexed one, and finds out where the next record goes.
+static BOOL RecoverLog(HISTORY_STORE *Store)
+{
+	UINT Segment = 1;
+	ULONGLONG Offset = 0;
+	ULONGLONG Count = HistoryStoreGetCount(Store);
+	if (Count > 0)
+	{
+		const STORED_ENTRY *Last = HistoryStoreGetEntry(Store, Count - 1);
+		Segment = Last->Segment;
+		Offset = Last->Offset + GetRecordSize(Last->SizeCb);
+	}
+
+	for (;;)
+	{
+		const PORTABLE_FILE *File = GetSegmentForReading(Store, Segment);
+		ULONGLONG FileSize;
+		if (File == nullptr || !FileGetSize(File, &FileSize))
+		{
+			// Only the first segment may be missing, in a new store.
+			if (Segment != 1 || Offset != 0) return false;
+			break;
+		}
+
+		RECORD_HEADER Header;
+		while (Offset < FileSize && ReadRecordHeader(Store, Segment, Offset, true, &Header))
+		{
+			STORED_ENTRY Entry = {};
+			Entry.Offset = Offset;
+			Entry.SizeCb = Header.SizeCb;
+			Entry.Timestamp = Header.Timestamp;
+			Entry.Hash = Header.Hash;
+			Entry.Segment = Segment;
+			Entry.Format = Header.Format;
+			if (!AddEntry(Store, &Entry)) return false;
+			++Store->RecoveredEntries;
+			Offset += GetRecordSize(Header.SizeCb);
+		}
+
+		if (Offset < FileSize)
+		{
+			// A partial record. Nothing after it can have been written completely.
+			Store->TruncatedLog = true;
+			FileClose(&Store->ReaderFile);
+			PORTABLE_FILE Truncated;
+			if (!OpenSegment(Store, Segment, false, &Truncated)) return false;
+			BOOL b = FileTruncate(&Truncated, Offset);
+			FileClose(&Truncated);
+			if (!b) return false;
+			DeleteSegmentsFrom(Store->Directory, Segment + 1);
+			break;
+		}
+
+		PATH_CHAR Path[STORE_PATH_LENGTH];
+		if (!BuildPath(Store->Directory, Segment + 1, Path) || !FileExists(Path)) break;
+		++Segment;
+		Offset = 0;
+	}
+
+	FileClose(&Store->ReaderFile);
+	Store->Segment = Segment;
+	Store->SegmentOffset = Offset;
+	return OpenSegment(Store, Segment, true, &Store->SegmentFile);
+}
+
+
+// Creates the directory and the store if they do not exist yet. SegmentSize is the size at which a new segment is
+// started; larger records get a segment of their own.
+BOOL HistoryStoreOpen(HISTORY_STORE *Store, const PATH_CHAR *Directory, ULONGLONG SegmentSize)
+{
+	memset(Store, 0, sizeof(*Store));
+	SIZE_T Length = 0;
+	while (Directory[Length] != 0) ++Length;
+	// Room for the separator and the longest file name.
+	if (Length + 16 > STORE_PATH_LENGTH) return false;
+	memcpy(Store->Directory, Directory, (Length + 1) * sizeof(PATH_CHAR));
+	Store->SegmentSize = SegmentSize;
+
+	if (!DirectoryCreate(Directory) || !OpenIndex(Store) || !RecoverLog(Store))
+	{
+		HistoryStoreClose(Store);
+		return false;
+	}
+	return true;
+}
+
+
+// Deletes the index and the log of a store that is not open, and the directory too if nothing else is in it. Returns
+// false if the directory is still there.
+BOOL HistoryStoreDelete(const PATH_CHAR *Directory)
+{
+	SIZE_T Length = 0;
+	while (Directory[Length] != 0) ++Length;
+	if (Length + 16 > STORE_PATH_LENGTH) return false;
+	PATH_CHAR Path[STORE_PATH_LENGTH];
+	if (BuildPath(Directory, 0, Path)) FileDelete(Path);
+	DeleteSegmentsFrom(Directory, 1);
+	return DirectoryDelete(Directory);
+}
+
+
+void HistoryStoreClose(HISTORY_STORE *Store)
+{
+	FileUnmapView(&Store->IndexView);
+	FileClose(&Store->IndexFile);
+	FileClose(&Store->SegmentFile);
+	FileClose(&Store->ReaderFile);
+	free(Store->AddedEntries);
+	Store->AddedEntries = nullptr;
+	Store->AddedCount = 0;
+	Store->AddedCapacity = 0;
+	Store->MappedEntries = nullptr;
+	Store->MappedCount = 0;
+}
+
+
+ULONGLONG HistoryStoreGetCount(const HISTORY_STORE *Store)
+{
+	return Store->MappedCount + Store->AddedCount;
+}
+
+
+// Index 0 is the oldest entry.
+const STORED_ENTRY *HistoryStoreGetEntry(const HISTORY_STORE *Store, ULONGLONG Index)
+{
+	if (Index < Store->MappedCount) return &Store->MappedEntries[Index];
+	Index -= Store->MappedCount;
+	return Index < Store->AddedCount ? &Store->AddedEntries[Index] : nullptr;
+}
+
+
+static BOOL ReadPayload(const PORTABLE_FILE *File, const STORED_ENTRY *Entry, void *Buffer)
+{
+	if (File == nullptr || Entry->SizeCb > (SIZE_T)-1) return false;
+	if (!FileReadAt(File, Entry->Offset + sizeof(RECORD_HEADER), Buffer, (SIZE_T)Entry->SizeCb)) return false;
+	CONTENT_HASH Hash;
+	ComputeContentHash(Buffer, (SIZE_T)Entry->SizeCb, &Hash);
+	return ContentHashEqual(&Hash, &Entry->Hash);
+}
+
+
+// Reads the payload of an entry into Buffer, which must have room for its SizeCb bytes. Returns false if the payload
+// cannot be read or does not match its hash.
+BOOL HistoryStoreRead(HISTORY_STORE *Store, ULONGLONG Index, void *Buffer)
+{
+	const STORED_ENTRY *Entry = HistoryStoreGetEntry(Store, Index);
+	if (Entry == nullptr) return false;
+	return ReadPayload(GetSegmentForReading(Store, Entry->Segment), Entry, Buffer);
+}
+
+
+// The reader has its own files, so it can be used on another thread than the store, as long as the entries it is
+// given have been appended completely.
+void HistoryStoreReaderInit(HISTORY_STORE_READER *Reader, const HISTORY_STORE *Store)
+{
+	memset(Reader, 0, sizeof(*Reader));
+	memcpy(Reader->Directory, Store->Directory, sizeof(Reader->Directory));
+}
+
+
+void HistoryStoreReaderClose(HISTORY_STORE_READER *Reader)
+{
+	FileClose(&Reader->File);
+}
+
+
+// Like HistoryStoreRead, for an entry that was taken from the store.
+BOOL HistoryStoreReaderRead(HISTORY_STORE_READER *Reader, const STORED_ENTRY *Entry, void *Buffer)
+{
+	if (!FileIsOpen(&Reader->File) || Reader->Segment != Entry->Segment)
+	{
+		FileClose(&Reader->File);
+		PATH_CHAR Path[STORE_PATH_LENGTH];
+		if (!BuildPath(Reader->Directory, Entry->Segment, Path) || !FileOpenForReading(&Reader->File, Path)) return false;
+		Reader->Segment = Entry->Segment;
+	}
+	return ReadPayload(&Reader->File, Entry, Buffer);
+}
+
+
+// Hash must be the content hash of the payload.
+BOOL HistoryStoreAppend(HISTORY_STORE *Store, UINT Format, const void *Data, SIZE_T SizeCb, const CONTENT_HASH *Hash, LONGLONG Timestamp)
+{
+	if (!FileIsOpen(&Store->SegmentFile)) return false;
+	ULONGLONG RecordSize = GetRecordSize(SizeCb);
+	if (Store->SegmentOffset > 0 && Store->SegmentOffset + RecordSize > Store->SegmentSize)
+	{
+		FileClose(&Store->SegmentFile);
+		++Store->Segment;
+		Store->SegmentOffset = 0;
+		if (!OpenSegment(Store, Store->Segment, true, &Store->SegmentFile)) return false;
+		// Whatever is left of an earlier attempt would otherwise show up in the next recovery.
+		if (!FileTruncate(&Store->SegmentFile, 0))
+		{
+			FileClose(&Store->SegmentFile);
+			return false;
+		}
+	}
+
+	RECORD_HEADER Header = {};
+	Header.Magic = RECORD_MAGIC;
+	Header.Format = Format;
+	Header.SizeCb = SizeCb;
+	Header.Timestamp = Timestamp;
+	Header.Hash = *Hash;
+	Header.Segment = Store->Segment;
+	Header.Check = ComputeHeaderCheck(&Header);
+	static const BYTE Padding[8] = {};
+	ULONGLONG Offset = Store->SegmentOffset;
+	if (!FileWriteAt(&Store->SegmentFile, Offset, &Header, sizeof(Header)) ||
+		!FileWriteAt(&Store->SegmentFile, Offset + sizeof(Header), Data, SizeCb) ||
+		!FileWriteAt(&Store->SegmentFile, Offset + sizeof(Header) + SizeCb, Padding, (SIZE_T)(RecordSize - sizeof(Header) - SizeCb)))
+	{
+		// Whatever made it to the file is cut off by the next recovery, or overwritten by the next append.
+		return false;
+	}
+	Store->SegmentOffset += RecordSize;
+
+	STORED_ENTRY Entry = {};
+	Entry.Offset = Offset;
+	Entry.SizeCb = SizeCb;
+	Entry.Timestamp = Timestamp;
+	Entry.Hash = *Hash;
+	Entry.Segment = Store->Segment;
+	Entry.Format = Format;
+	return AddEntry(Store, &Entry);
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "Portable.h"
+#include "PortableFile.h"
+#include "ContentHash.h"
+
+struct HISTORY_STORE;
+struct STORED_ENTRY;
+struct HISTORY_STORE_READER;
+
+// Persistent, append-only history of clipboard payloads, kept in a directory of its own:
+//  - The data log is a sequence of numbered segment files ("00000001.log", ...). Each one holds records: a header
+//    (format, size, hash, timestamp) followed by the payload. A new segment is started when the current one is full.
+//  - The index ("history.idx") holds one fixed size STORED_ENTRY per record, in order. It is memory mapped when the
+//    store is opened, so opening does not depend on the number of entries, and reading an entry only reads its record.
+// A record is always written before its index entry. If the process dies in between, or in the middle of a write,
+// opening the store again recovers the records that are missing from the index, and cuts off whatever was only
+// partially written.
+
+extern BOOL                HistoryStoreOpen(HISTORY_STORE *Store, const PATH_CHAR *Directory, ULONGLONG SegmentSize);
+extern void                HistoryStoreClose(HISTORY_STORE *Store);
+extern BOOL                HistoryStoreDelete(const PATH_CHAR *Directory);
+extern ULONGLONG           HistoryStoreGetCount(const HISTORY_STORE *Store);
+extern const STORED_ENTRY *HistoryStoreGetEntry(const HISTORY_STORE *Store, ULONGLONG Index);
+extern BOOL                HistoryStoreRead(HISTORY_STORE *Store, ULONGLONG Index, void *Buffer);
+extern BOOL                HistoryStoreAppend(HISTORY_STORE *Store, UINT Format, const void *Data, SIZE_T SizeCb, const CONTENT_HASH *Hash, LONGLONG Timestamp);
+extern void                HistoryStoreReaderInit(HISTORY_STORE_READER *Reader, const HISTORY_STORE *Store);
+extern void                HistoryStoreReaderClose(HISTORY_STORE_READER *Reader);
+extern BOOL                HistoryStoreReaderRead(HISTORY_STORE_READER *Reader, const STORED_ENTRY *Entry, void *Buffer);
+
+#define STORE_PATH_LENGTH 512
+
+// Formats of records that hold something other than a raw clipboard payload. They are above the range of clipboard
+// formats; the low word is the clipboard format they stand for, if any.
+#define STORED_FORMAT_COMPRESSED_DIB 0x10008  // CONTENT_HASH of the raw CF_DIB (or PNG), then its ImageCodec output.
+#define STORED_FORMAT_COMPRESSED_TEXT 0x1000D // CONTENT_HASH of the raw CF_UNICODETEXT, then its TextCodec output.
+#define STORED_FORMAT_TEXT_DICTIONARY 0x10100 // A TextCodec dictionary, for the texts after it.
+// Content that was captured again, and so moves to the front of the history without being written twice: the ULONGLONG
+// index of the earlier record that holds it. That record always holds the content itself, never another move.
+#define STORED_FORMAT_MOVED 0x20000           // Or'ed with the clipboard format.
+
+// Layout of an index entry on disk.
+struct STORED_ENTRY
+{
+	ULONGLONG Offset;      // Of the record within its segment.
+	ULONGLONG SizeCb;
+	LONGLONG Timestamp;
+	CONTENT_HASH Hash;     // Of the payload.
+	UINT Segment;
+	UINT Format;
+};
+
+struct HISTORY_STORE
+{
+	PATH_CHAR Directory[STORE_PATH_LENGTH];
+	ULONGLONG SegmentSize;
+
+	// Entries that were in the index when the store was opened are read from the mapping; everything appended or
+	// recovered after that is kept in AddedEntries.
+	PORTABLE_FILE IndexFile;
+	FILE_VIEW IndexView;
+	const STORED_ENTRY *MappedEntries;
+	ULONGLONG MappedCount;
+	STORED_ENTRY *AddedEntries;
+	SIZE_T AddedCount;
+	SIZE_T AddedCapacity;
+
+	// Where the next record goes.
+	PORTABLE_FILE SegmentFile;
+	UINT Segment;
+	ULONGLONG SegmentOffset;
+
+	// The segment read last, if it's not the one being written.
+	PORTABLE_FILE ReaderFile;
+	UINT ReaderSegment;
+
+	// What opening the store had to repair.
+	ULONGLONG DroppedEntries;   // Index entries whose records were missing or incomplete.
+	ULONGLONG RecoveredEntries; // Records that were missing from the index.
+	BOOL TruncatedLog;          // The log ended in a partial record, which was cut off.
+};
+
+struct HISTORY_STORE_READER
+{
+	PATH_CHAR Directory[STORE_PATH_LENGTH];
+	PORTABLE_FILE File;
+	UINT Segment;
+};
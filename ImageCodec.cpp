@@ -0,0 +1,441 @@
+#include "ImageCodec.h"
+#include "PixelBuffer.h"
+#include "PerceptualHash.h"
+#include "PixelAlpha.h"
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+
+#define IMAGE_CODEC_MAGIC 0x53494F51 // "QOIS"
+
+// Codes. The top two bits select the operation, except for OP_RGB and OP_RGBA, which take up the last two values of
+// OP_RUN.
+#define OP_INDEX 0x00 // 00iiiiii: the color in slot i of the cache.
+#define OP_DIFF 0x40  // 01rrggbb: the previous color plus (r - 2, g - 2, b - 2).
+#define OP_LUMA 0x80  // 10gggggg rrrrbbbb: the previous color plus g - 32 in all channels, and r - 8, b - 8 on top.
+#define OP_RUN 0xC0   // 11nnnnnn: the previous color, n + 1 times.
+#define OP_RGB 0xFE   // Followed by red, green, blue; alpha stays the same.
+#define OP_RGBA 0xFF  // Followed by red, green, blue, alpha.
+#define MAX_RUN 62
+#define MAX_CODE_BYTES_PER_PIXEL 5
+// Every stripe starts with this as the previous color, and with an empty cache.
+#define INITIAL_COLOR 0xFF000000
+
+
+static UINT HashColor(DWORD Color)
+{
+	UINT b = Color & 0xFF;
+	UINT g = (Color >> 8) & 0xFF;
+	UINT r = (Color >> 16) & 0xFF;
+	UINT a = Color >> 24;
+	return (r * 3 + g * 5 + b * 7 + a * 11) & 63;
+}
+
+
+// Difference of one channel, wrapped around to -128..127.
+static int GetChannelDifference(DWORD Color, DWORD Previous, int Shift)
+{
+	return (signed char)(BYTE)((Color >> Shift) - (Previous >> Shift));
+}
+
+
+// Returns the number of bytes written to Codes, which must have room for MAX_CODE_BYTES_PER_PIXEL per pixel.
+static SIZE_T EncodeStripe(const PIXEL_BUFFER *Image, LONG FirstRow, LONG Rows, BYTE *Codes)
+{
+	DWORD Cache[64] = {};
+	DWORD Previous = INITIAL_COLOR;
+	UINT Run = 0;
+	BYTE *Out = Codes;
+	for (LONG y = FirstRow; y < FirstRow + Rows; ++y)
+	{
+		const DWORD *Row = (const DWORD *)(Image->Pixels + (SIZE_T)y * Image->Stride);
+		for (LONG x = 0; x < Image->Width; ++x)
+		{
+			DWORD Color = Row[x];
+			if (Color == Previous)
+			{
+				if (++Run == MAX_RUN)
+				{
+					*Out++ = (BYTE)(OP_RUN | (Run - 1));
+					Run = 0;
+				}
+				continue;
+			}
+			if (Run > 0)
+			{
+				*Out++ = (BYTE)(OP_RUN | (Run - 1));
+				Run = 0;
+			}
+
+			UINT Slot = HashColor(Color);
+			if (Cache[Slot] == Color)
+			{
+				*Out++ = (BYTE)(OP_INDEX | Slot);
+			}
+			else
+			{
+				Cache[Slot] = Color;
+				BYTE Red = (BYTE)(Color >> 16);
+				BYTE Green = (BYTE)(Color >> 8);
+				BYTE Blue = (BYTE)Color;
+				if ((Color >> 24) == (Previous >> 24))
+				{
+					int dr = GetChannelDifference(Color, Previous, 16);
+					int dg = GetChannelDifference(Color, Previous, 8);
+					int db = GetChannelDifference(Color, Previous, 0);
+					if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+					{
+						*Out++ = (BYTE)(OP_DIFF | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2));
+					}
+					else if (dg >= -32 && dg <= 31 && dr - dg >= -8 && dr - dg <= 7 && db - dg >= -8 && db - dg <= 7)
+					{
+						*Out++ = (BYTE)(OP_LUMA | (dg + 32));
+						*Out++ = (BYTE)((dr - dg + 8) << 4 | (db - dg + 8));
+					}
+					else
+					{
+						Out[0] = OP_RGB;
+						Out[1] = Red;
+						Out[2] = Green;
+						Out[3] = Blue;
+						Out += 4;
+					}
+				}
+				else
+				{
+					Out[0] = OP_RGBA;
+					Out[1] = Red;
+					Out[2] = Green;
+					Out[3] = Blue;
+					Out[4] = (BYTE)(Color >> 24);
+					Out += 5;
+				}
+			}
+			Previous = Color;
+		}
+	}
+	if (Run > 0)
+	{
+		*Out++ = (BYTE)(OP_RUN | (Run - 1));
+	}
+	return Out - Codes;
+}
+
+
+// Decodes the first SkipRows + OutRows rows of a stripe, and writes the last OutRows of them to Pixels. Returns false
+// if the codes end too early.
+static BOOL DecodeStripe(const BYTE *Codes, const BYTE *End, LONG Width, LONG SkipRows, LONG OutRows, BYTE *Pixels, SIZE_T Stride)
+{
+	DWORD Cache[64] = {};
+	DWORD Color = INITIAL_COLOR;
+	UINT Run = 0;
+	const BYTE *In = Codes;
+	for (LONG y = 0; y < SkipRows + OutRows; ++y)
+	{
+		DWORD *Out = y >= SkipRows ? (DWORD *)(Pixels + (SIZE_T)(y - SkipRows) * Stride) : nullptr;
+		for (LONG x = 0; x < Width; ++x)
+		{
+			if (Run > 0)
+			{
+				--Run;
+			}
+			else
+			{
+				if (In == End) return false;
+				BYTE Code = *In++;
+				if (Code == OP_RGB)
+				{
+					if (End - In < 3) return false;
+					Color = (Color & 0xFF000000) | (DWORD)In[0] << 16 | (DWORD)In[1] << 8 | In[2];
+					In += 3;
+					Cache[HashColor(Color)] = Color;
+				}
+				else if (Code == OP_RGBA)
+				{
+					if (End - In < 4) return false;
+					Color = (DWORD)In[3] << 24 | (DWORD)In[0] << 16 | (DWORD)In[1] << 8 | In[2];
+					In += 4;
+					Cache[HashColor(Color)] = Color;
+				}
+				else
+				{
+					switch (Code & 0xC0)
+					{
+						case OP_INDEX:
+						{
+							Color = Cache[Code];
+							break;
+						}
+						case OP_DIFF:
+						{
+							BYTE Red = (BYTE)((Color >> 16) + ((Code >> 4) & 3) - 2);
+							BYTE Green = (BYTE)((Color >> 8) + ((Code >> 2) & 3) - 2);
+							BYTE Blue = (BYTE)(Color + (Code & 3) - 2);
+							Color = (Color & 0xFF000000) | (DWORD)Red << 16 | (DWORD)Green << 8 | Blue;
+							Cache[HashColor(Color)] = Color;
+							break;
+						}
+						case OP_LUMA:
+						{
+							if (In == End) return false;
+							int dg = (Code & 0x3F) - 32;
+							int dr = dg + (*In >> 4) - 8;
+							int db = dg + (*In & 0x0F) - 8;
+							++In;
+							BYTE Red = (BYTE)((int)((Color >> 16) & 0xFF) + dr);
+							BYTE Green = (BYTE)((int)((Color >> 8) & 0xFF) + dg);
+							BYTE Blue = (BYTE)((int)(Color & 0xFF) + db);
+							Color = (Color & 0xFF000000) | (DWORD)Red << 16 | (DWORD)Green << 8 | Blue;
+							Cache[HashColor(Color)] = Color;
+							break;
+						}
+						case OP_RUN:
+						{
+							Run = Code & 0x3F;
+							break;
+						}
+					}
+				}
+			}
+			if (Out != nullptr) Out[x] = Color;
+		}
+	}
+	return true;
+}
+
+
+static const ULONGLONG *GetStripeEnds(const COMPRESSED_IMAGE *Image)
+{
+	return (const ULONGLONG *)(Image + 1);
+}
+
+
+static const BYTE *GetCodes(const COMPRESSED_IMAGE *Image)
+{
+	return (const BYTE *)(GetStripeEnds(Image) + Image->StripeCount);
+}
+
+
+// Runs Work on ThreadCount threads (including the calling one), which share Items items between them.
+static void RunInParallel(UINT ThreadCount, UINT Items, void (*Work)(void *Context), void *Context)
+{
+	if (ThreadCount == 0) ThreadCount = std::thread::hardware_concurrency();
+	if (ThreadCount > IMAGE_CODEC_MAX_THREADS) ThreadCount = IMAGE_CODEC_MAX_THREADS;
+	if (ThreadCount > Items) ThreadCount = Items;
+	std::thread Threads[IMAGE_CODEC_MAX_THREADS];
+	for (UINT i = 1; i < ThreadCount; ++i)
+	{
+		Threads[i] = std::thread(Work, Context);
+	}
+	Work(Context);
+	for (UINT i = 1; i < ThreadCount; ++i)
+	{
+		Threads[i].join();
+	}
+}
+
+
+struct ENCODE_CONTEXT
+{
+	const PIXEL_BUFFER *Image;
+	UINT StripeCount;
+	std::atomic<UINT> NextStripe;
+	std::atomic<BOOL> Failed;
+	// The codes of every stripe, in an allocation of its own.
+	BYTE **StripeCodes;
+	SIZE_T *StripeSizes;
+};
+
+
+static void EncodeStripes(void *Context)
+{
+	ENCODE_CONTEXT *Encode = (ENCODE_CONTEXT *)Context;
+	const PIXEL_BUFFER *Image = Encode->Image;
+	BYTE *Scratch = (BYTE *)malloc((SIZE_T)IMAGE_CODEC_STRIPE_ROWS * Image->Width * MAX_CODE_BYTES_PER_PIXEL);
+	if (Scratch == nullptr)
+	{
+		Encode->Failed = true;
+		return;
+	}
+	for (;;)
+	{
+		UINT Stripe = Encode->NextStripe.fetch_add(1);
+		if (Stripe >= Encode->StripeCount || Encode->Failed) break;
+		LONG FirstRow = (LONG)Stripe * IMAGE_CODEC_STRIPE_ROWS;
+		LONG Rows = Image->Height - FirstRow < IMAGE_CODEC_STRIPE_ROWS ? Image->Height - FirstRow : IMAGE_CODEC_STRIPE_ROWS;
+		SIZE_T SizeCb = EncodeStripe(Image, FirstRow, Rows, Scratch);
+		BYTE *Codes = (BYTE *)malloc(SizeCb != 0 ? SizeCb : 1);
+		if (Codes == nullptr)
+		{
+			Encode->Failed = true;
+			break;
+		}
+		memcpy(Codes, Scratch, SizeCb);
+		Encode->StripeCodes[Stripe] = Codes;
+		Encode->StripeSizes[Stripe] = SizeCb;
+	}
+	free(Scratch);
+}
+
+
+// Returns null if there is not enough memory.
+COMPRESSED_IMAGE *ImageCodecEncode(const PIXEL_BUFFER *Image, UINT ThreadCount)
+{
+	ENCODE_CONTEXT Encode;
+	Encode.Image = Image;
+	Encode.StripeCount = (UINT)(((LONGLONG)Image->Height + IMAGE_CODEC_STRIPE_ROWS - 1) / IMAGE_CODEC_STRIPE_ROWS);
+	Encode.NextStripe = 0;
+	Encode.Failed = false;
+	Encode.StripeCodes = (BYTE **)calloc(Encode.StripeCount, sizeof(BYTE *));
+	Encode.StripeSizes = (SIZE_T *)calloc(Encode.StripeCount, sizeof(SIZE_T));
+	COMPRESSED_IMAGE *Compressed = nullptr;
+	if (Encode.StripeCodes != nullptr && Encode.StripeSizes != nullptr)
+	{
+		RunInParallel(ThreadCount, Encode.StripeCount, EncodeStripes, &Encode);
+	}
+	else
+	{
+		Encode.Failed = true;
+	}
+
+	if (!Encode.Failed)
+	{
+		SIZE_T SizeCb = sizeof(COMPRESSED_IMAGE) + Encode.StripeCount * sizeof(ULONGLONG);
+		for (UINT i = 0; i < Encode.StripeCount; ++i) SizeCb += Encode.StripeSizes[i];
+		Compressed = (COMPRESSED_IMAGE *)malloc(SizeCb);
+		if (Compressed != nullptr)
+		{
+			Compressed->Magic = IMAGE_CODEC_MAGIC;
+			Compressed->Width = Image->Width;
+			Compressed->Height = Image->Height;
+			Compressed->StripeRows = IMAGE_CODEC_STRIPE_ROWS;
+			Compressed->StripeCount = Encode.StripeCount;
+			Compressed->AverageColor = GetAverageColor(Image);
+			Compressed->PerceptualHash = ComputePerceptualHash(Image);
+			Compressed->SizeCb = SizeCb;
+			ULONGLONG *StripeEnds = (ULONGLONG *)(Compressed + 1);
+			BYTE *Codes = (BYTE *)(StripeEnds + Encode.StripeCount);
+			ULONGLONG Offset = 0;
+			for (UINT i = 0; i < Encode.StripeCount; ++i)
+			{
+				memcpy(Codes + Offset, Encode.StripeCodes[i], Encode.StripeSizes[i]);
+				Offset += Encode.StripeSizes[i];
+				StripeEnds[i] = Offset;
+			}
+		}
+	}
+
+	if (Encode.StripeCodes != nullptr)
+	{
+		for (UINT i = 0; i < Encode.StripeCount; ++i) free(Encode.StripeCodes[i]);
+	}
+	free(Encode.StripeCodes);
+	free(Encode.StripeSizes);
+	return Compressed;
+}
+
+
+// Decodes rows [FirstRow, FirstRow + RowCount) into Pixels, which receives the first of them. Only the stripes that
+// contain these rows are decoded. Returns false if the range is outside of the image, or the codes are corrupt.
+BOOL ImageCodecDecodeRows(const COMPRESSED_IMAGE *Image, LONG FirstRow, LONG RowCount, BYTE *Pixels, SIZE_T Stride)
+{
+	if (FirstRow < 0 || RowCount < 0 || RowCount > Image->Height - FirstRow) return false;
+	const ULONGLONG *StripeEnds = GetStripeEnds(Image);
+	const BYTE *Codes = GetCodes(Image);
+	LONG EndRow = FirstRow + RowCount;
+	for (LONG Stripe = FirstRow / Image->StripeRows; Stripe < (LONG)Image->StripeCount; ++Stripe)
+	{
+		LONG StripeFirstRow = Stripe * Image->StripeRows;
+		if (StripeFirstRow >= EndRow) break;
+		LONG StripeEndRow = Image->Height - StripeFirstRow < Image->StripeRows ? Image->Height : StripeFirstRow + Image->StripeRows;
+		LONG SkipRows = FirstRow > StripeFirstRow ? FirstRow - StripeFirstRow : 0;
+		LONG OutRows = (EndRow < StripeEndRow ? EndRow : StripeEndRow) - (StripeFirstRow + SkipRows);
+		BYTE *Out = Pixels + (SIZE_T)(StripeFirstRow + SkipRows - FirstRow) * Stride;
+		const BYTE *Begin = Codes + (Stripe > 0 ? StripeEnds[Stripe - 1] : 0);
+		const BYTE *End = Codes + StripeEnds[Stripe];
+		if (!DecodeStripe(Begin, End, Image->Width, SkipRows, OutRows, Out, Stride)) return false;
+	}
+	return true;
+}
+
+
+struct DECODE_CONTEXT
+{
+	const COMPRESSED_IMAGE *Image;
+	PIXEL_BUFFER *Pixels;
+	std::atomic<UINT> NextStripe;
+	std::atomic<BOOL> Failed;
+};
+
+
+static void DecodeStripes(void *Context)
+{
+	DECODE_CONTEXT *Decode = (DECODE_CONTEXT *)Context;
+	const COMPRESSED_IMAGE *Image = Decode->Image;
+	for (;;)
+	{
+		UINT Stripe = Decode->NextStripe.fetch_add(1);
+		if (Stripe >= Image->StripeCount || Decode->Failed) break;
+		LONG FirstRow = (LONG)Stripe * Image->StripeRows;
+		LONG Rows = Image->Height - FirstRow < Image->StripeRows ? Image->Height - FirstRow : Image->StripeRows;
+		BYTE *Out = Decode->Pixels->Pixels + (SIZE_T)FirstRow * Decode->Pixels->Stride;
+		if (!ImageCodecDecodeRows(Image, FirstRow, Rows, Out, Decode->Pixels->Stride))
+		{
+			Decode->Failed = true;
+		}
+	}
+}
+
+
+// Returns null if there is not enough memory, or the codes are corrupt. The result has no mip pyramid.
+PIXEL_BUFFER *ImageCodecDecode(const COMPRESSED_IMAGE *Image, UINT ThreadCount)
+{
+	DECODE_CONTEXT Decode;
+	Decode.Image = Image;
+	Decode.Pixels = PixelBufferCreate(Image->Width, Image->Height);
+	if (Decode.Pixels == nullptr) return nullptr;
+	Decode.NextStripe = 0;
+	Decode.Failed = false;
+	RunInParallel(ThreadCount, Image->StripeCount, DecodeStripes, &Decode);
+	if (Decode.Failed)
+	{
+		PixelBufferRelease(Decode.Pixels);
+		return nullptr;
+	}
+	// The pixels were premultiplied when they were encoded.
+	Decode.Pixels->HasAlpha = ClassifyAlpha(Decode.Pixels->Pixels, Decode.Pixels->SizeCb / 4) != ALPHA_OPAQUE;
+	return Decode.Pixels;
+}
+
+
+// Checks that Data (e.g. read back from a file) is a complete compressed image, whose stripes all lie within it and
+// have enough codes for their pixels, so that a corrupt header cannot make the decoder allocate more than 62 times
+// SizeCb. The codes themselves are only checked while decoding. Data must be 8 byte aligned.
+const COMPRESSED_IMAGE *ImageCodecValidate(const void *Data, SIZE_T SizeCb)
+{
+	if (SizeCb < sizeof(COMPRESSED_IMAGE)) return nullptr;
+	const COMPRESSED_IMAGE *Image = (const COMPRESSED_IMAGE *)Data;
+	if (Image->Magic != IMAGE_CODEC_MAGIC || Image->SizeCb != SizeCb) return nullptr;
+	if (Image->Width <= 0 || Image->Height <= 0 || Image->StripeRows <= 0) return nullptr;
+	if (Image->StripeCount != ((LONGLONG)Image->Height + Image->StripeRows - 1) / Image->StripeRows) return nullptr;
+	if ((SizeCb - sizeof(COMPRESSED_IMAGE)) / sizeof(ULONGLONG) < Image->StripeCount) return nullptr;
+	ULONGLONG CodesSizeCb = SizeCb - sizeof(COMPRESSED_IMAGE) - Image->StripeCount * sizeof(ULONGLONG);
+	const ULONGLONG *StripeEnds = GetStripeEnds(Image);
+	ULONGLONG Previous = 0;
+	for (UINT i = 0; i < Image->StripeCount; ++i)
+	{
+		if (StripeEnds[i] < Previous || StripeEnds[i] > CodesSizeCb) return nullptr;
+		LONGLONG FirstRow = (LONGLONG)i * Image->StripeRows;
+		LONGLONG Rows = Image->Height - FirstRow < Image->StripeRows ? Image->Height - FirstRow : Image->StripeRows;
+		if ((ULONGLONG)Rows * (ULONGLONG)Image->Width > (StripeEnds[i] - Previous) * MAX_RUN) return nullptr;
+		Previous = StripeEnds[i];
+	}
+	return Image;
+}
+
+
+SIZE_T ImageCodecGetSize(const COMPRESSED_IMAGE *Image)
+{
+	return (SIZE_T)Image->SizeCb;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Portable.h"
+
+struct PIXEL_BUFFER;
+struct COMPRESSED_IMAGE;
+
+// Lossless compression of BGRA images, for keeping captured images around without their 4 bytes per pixel.
+//
+// The image is cut into stripes of IMAGE_CODEC_STRIPE_ROWS rows, which are compressed independently of each other with
+// a QOI-style byte code (runs, a small cache of recent colors, and small differences to the previous pixel). Stripes
+// are encoded and decoded in parallel, and a range of rows can be decoded without touching the other stripes.
+//
+// A COMPRESSED_IMAGE is a single flat allocation without pointers, so it can be written to a file as it is, and read
+// back with ImageCodecValidate. Its header also carries the size, average color and perceptual hash of the image (see
+// PerceptualHash.h), so that images can be compared without decoding them. Free it with free().
+//
+// ThreadCount 0 uses one thread per core.
+
+#define IMAGE_CODEC_STRIPE_ROWS 64
+#define IMAGE_CODEC_MAX_THREADS 16
+
+extern COMPRESSED_IMAGE   *ImageCodecEncode(const PIXEL_BUFFER *Image, UINT ThreadCount);
+extern PIXEL_BUFFER       *ImageCodecDecode(const COMPRESSED_IMAGE *Image, UINT ThreadCount);
+extern BOOL                ImageCodecDecodeRows(const COMPRESSED_IMAGE *Image, LONG FirstRow, LONG RowCount, BYTE *Pixels, SIZE_T Stride);
+extern const COMPRESSED_IMAGE *ImageCodecValidate(const void *Data, SIZE_T SizeCb);
+extern SIZE_T              ImageCodecGetSize(const COMPRESSED_IMAGE *Image);
+
+struct COMPRESSED_IMAGE
+{
+	DWORD Magic;
+	LONG Width;
+	LONG Height;
+	LONG StripeRows;
+	UINT StripeCount;
+	DWORD AverageColor;       // BGRA.
+	ULONGLONG PerceptualHash;
+	ULONGLONG SizeCb;         // Of the whole allocation.
+	// Followed by StripeCount end offsets (ULONGLONG) of the stripes' codes, counted from the end of the offsets, and
+	// the codes.
+};
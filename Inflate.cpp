@@ -0,0 +1,549 @@
+#include "Inflate.h"
+#include <string.h>
+
+// A decoding table entry: the value of the symbol in the top 16 bits (a literal byte, the base of a length or distance,
+// or the offset of a second level table), what kind of symbol it is, the number of extra bits that follow the code of
+// a length or distance (or the index bits of a second level table), and the number of bits the code takes.
+#define ENTRY_LITERAL 0x1000
+#define ENTRY_END 0x2000
+#define ENTRY_SUBTABLE 0x4000
+#define ENTRY_INVALID 0x8000
+#define ENTRY_EXTRA_SHIFT 8
+#define ENTRY_VALUE_SHIFT 16
+
+// Enough for any code that is not over-subscribed, including the second level tables.
+#define LITLEN_TABLE_CAPACITY 2048
+#define DIST_TABLE_CAPACITY 1024
+#define PRECODE_TABLE_BITS 7
+
+#define MAX_CODE_BITS 15
+#define LITLEN_SYMBOLS 288
+#define DIST_SYMBOLS 32
+#define PRECODE_SYMBOLS 19
+#define END_OF_BLOCK 256
+
+// Virtual zero bytes that may be read past the end of the input before the stream counts as truncated. The bit reader
+// reads ahead, so the last symbols of a complete stream usually need some.
+#define MAX_OVERRUN 8
+
+static const WORD LengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const BYTE LengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const WORD DistBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const BYTE DistExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+// The order in which the code lengths of the precode are stored.
+static const BYTE PrecodeOrder[PRECODE_SYMBOLS] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+
+struct BIT_READER
+{
+	const BYTE *In;
+	const BYTE *InEnd;
+	// Bits are consumed from the bottom. Above BitCount, there may be bits of the bytes at In; refilling ORs the same
+	// bits in again.
+	ULONGLONG Bits;
+	UINT BitCount;
+	UINT Overrun;           // Zero bytes that were read past InEnd.
+};
+
+struct INFLATE_STATE
+{
+	BIT_READER Reader;
+	BYTE *OutStart;
+	BYTE *Out;
+	BYTE *OutEnd;
+	BYTE *ProgressAt;
+	const INFLATE_PROGRESS *Progress;
+	BOOL HasFixedTables;    // LitLen and Dist hold the fixed codes, and don't need to be built again.
+	DWORD LitLen[LITLEN_TABLE_CAPACITY];
+	DWORD Dist[DIST_TABLE_CAPACITY];
+	DWORD Precode[1 << PRECODE_TABLE_BITS];
+};
+
+
+static ULONGLONG ReadQword(const BYTE *p)
+{
+	ULONGLONG Value;
+	memcpy(&Value, p, sizeof(Value));
+	return Value;
+}
+
+
+// Makes sure there are at least 56 bits in the buffer. Returns false if the input is used up for good.
+static BOOL Refill(BIT_READER *Reader)
+{
+	if (Reader->InEnd - Reader->In >= 8)
+	{
+		Reader->Bits |= ReadQword(Reader->In) << Reader->BitCount;
+		Reader->In += (63 - Reader->BitCount) >> 3;
+		Reader->BitCount |= 56;
+		return true;
+	}
+	while (Reader->BitCount <= 56)
+	{
+		if (Reader->In < Reader->InEnd)
+		{
+			Reader->Bits |= (ULONGLONG)*Reader->In++ << Reader->BitCount;
+		}
+		else
+		{
+			++Reader->Overrun;
+		}
+		Reader->BitCount += 8;
+	}
+	return Reader->Overrun <= MAX_OVERRUN;
+}
+
+
+static DWORD PeekBits(const BIT_READER *Reader, UINT Count)
+{
+	return (DWORD)Reader->Bits & ((1u << Count) - 1);
+}
+
+
+static void ConsumeBits(BIT_READER *Reader, UINT Count)
+{
+	Reader->Bits >>= Count;
+	Reader->BitCount -= Count;
+}
+
+
+static DWORD MakeEntry(DWORD Value, DWORD Kind, DWORD Extra, DWORD CodeBits)
+{
+	return (Value << ENTRY_VALUE_SHIFT) | Kind | (Extra << ENTRY_EXTRA_SHIFT) | CodeBits;
+}
+
+
+static DWORD GetLitLenEntry(UINT Symbol)
+{
+	if (Symbol < END_OF_BLOCK) return MakeEntry(Symbol, ENTRY_LITERAL, 0, 0);
+	if (Symbol == END_OF_BLOCK) return MakeEntry(0, ENTRY_END, 0, 0);
+	if (Symbol < END_OF_BLOCK + 1 + 29) return MakeEntry(LengthBase[Symbol - 257], 0, LengthExtra[Symbol - 257], 0);
+	return MakeEntry(0, ENTRY_INVALID, 0, 0);
+}
+
+
+static DWORD GetDistEntry(UINT Symbol)
+{
+	if (Symbol < 30) return MakeEntry(DistBase[Symbol], 0, DistExtra[Symbol], 0);
+	return MakeEntry(0, ENTRY_INVALID, 0, 0);
+}
+
+
+static DWORD GetPrecodeEntry(UINT Symbol)
+{
+	return MakeEntry(Symbol, 0, 0, 0);
+}
+
+
+static DWORD ReverseBits(DWORD Code, UINT Count)
+{
+	DWORD Reversed = 0;
+	for (UINT i = 0; i < Count; ++i)
+	{
+		Reversed = (Reversed << 1) | ((Code >> i) & 1);
+	}
+	return Reversed;
+}
+
+
+// Builds the decoding table of a canonical Huffman code from its code lengths. Codes longer than RootBits go into
+// second level tables after the first 2^RootBits entries, each just large enough for the codes that share its prefix.
+// Over-subscribed codes are rejected. Incomplete ones are allowed (DEFLATE uses them for a single distance code);
+// their missing codes decode as invalid.
+static BOOL BuildTable(DWORD *Table, UINT Capacity, UINT RootBits, const BYTE *Lengths, UINT SymbolCount, DWORD (*GetEntry)(UINT Symbol))
+{
+	UINT Count[MAX_CODE_BITS + 1] = {};
+	for (UINT s = 0; s < SymbolCount; ++s)
+	{
+		++Count[Lengths[s]];
+	}
+	int Left = 1;
+	for (UINT Length = 1; Length <= MAX_CODE_BITS; ++Length)
+	{
+		Left = (Left << 1) - (int)Count[Length];
+		if (Left < 0) return false;
+	}
+
+	// The symbols, ordered by code length, and by value within each length: the order of their codes.
+	WORD Sorted[LITLEN_SYMBOLS];
+	UINT Offsets[MAX_CODE_BITS + 2];
+	Offsets[1] = 0;
+	for (UINT Length = 1; Length <= MAX_CODE_BITS; ++Length)
+	{
+		Offsets[Length + 1] = Offsets[Length] + Count[Length];
+	}
+	for (UINT s = 0; s < SymbolCount; ++s)
+	{
+		if (Lengths[s] != 0) Sorted[Offsets[Lengths[s]]++] = (WORD)s;
+	}
+
+	UINT RootSize = 1u << RootBits;
+	DWORD Invalid = MakeEntry(0, ENTRY_INVALID, 0, 0);
+	for (UINT i = 0; i < RootSize; ++i)
+	{
+		Table[i] = Invalid;
+	}
+	UINT Next = RootSize;
+	UINT SubtablePrefix = RootSize;
+	UINT SubtableStart = 0;
+	UINT SubtableBits = 0;
+	DWORD Code = 0;
+	UINT i = 0;
+	for (UINT Length = 1; Length <= MAX_CODE_BITS; ++Length)
+	{
+		for (; Count[Length] > 0; --Count[Length], ++i, ++Code)
+		{
+			// DEFLATE sends codes starting with their first bit, which the reader sees as the lowest one.
+			DWORD Reversed = ReverseBits(Code, Length);
+			DWORD Entry = GetEntry(Sorted[i]);
+			if (Length <= RootBits)
+			{
+				for (DWORD j = Reversed; j < RootSize; j += 1u << Length)
+				{
+					Table[j] = Entry | Length;
+				}
+				continue;
+			}
+
+			UINT Prefix = Reversed & (RootSize - 1);
+			if (Prefix != SubtablePrefix)
+			{
+				// Large enough for the codes of this length and the longer ones that are still to come, as far as they
+				// can share the prefix.
+				SubtableBits = Length - RootBits;
+				int Space = 1 << SubtableBits;
+				while (SubtableBits + RootBits < MAX_CODE_BITS)
+				{
+					Space -= (int)Count[SubtableBits + RootBits];
+					if (Space <= 0) break;
+					++SubtableBits;
+					Space <<= 1;
+				}
+				if (Next + (1u << SubtableBits) > Capacity) return false;
+				Table[Prefix] = MakeEntry(Next, ENTRY_SUBTABLE, SubtableBits, RootBits);
+				SubtablePrefix = Prefix;
+				SubtableStart = Next;
+				Next += 1u << SubtableBits;
+				for (UINT j = SubtableStart; j < Next; ++j)
+				{
+					Table[j] = Invalid;
+				}
+			}
+			UINT Remaining = Length - RootBits;
+			for (DWORD j = Reversed >> RootBits; j < (1u << SubtableBits); j += 1u << Remaining)
+			{
+				Table[SubtableStart + j] = Entry | Remaining;
+			}
+		}
+		Code <<= 1;
+	}
+	return true;
+}
+
+
+// Looks up the next symbol, and consumes its code. Needs at least 15 bits in the buffer.
+static DWORD DecodeSymbol(BIT_READER *Reader, const DWORD *Table, UINT RootBits)
+{
+	DWORD Entry = Table[PeekBits(Reader, RootBits)];
+	if (Entry & ENTRY_SUBTABLE)
+	{
+		ConsumeBits(Reader, RootBits);
+		Entry = Table[(Entry >> ENTRY_VALUE_SHIFT) + PeekBits(Reader, (Entry >> ENTRY_EXTRA_SHIFT) & 0xF)];
+	}
+	ConsumeBits(Reader, Entry & 0xFF);
+	return Entry;
+}
+
+
+// Reads the extra bits of a length or distance entry, and adds them to its base.
+static DWORD DecodeExtra(BIT_READER *Reader, DWORD Entry)
+{
+	UINT Extra = (Entry >> ENTRY_EXTRA_SHIFT) & 0xF;
+	DWORD Value = (Entry >> ENTRY_VALUE_SHIFT) + PeekBits(Reader, Extra);
+	ConsumeBits(Reader, Extra);
+	return Value;
+}
+
+
+// Sets where the next progress report is due. Without a callback, that is at the end of the output, which nothing
+// but the end of the stream can follow.
+static void ScheduleProgress(INFLATE_STATE *State)
+{
+	const INFLATE_PROGRESS *Progress = State->Progress;
+	if (Progress != nullptr && (SIZE_T)(State->OutEnd - State->Out) > Progress->Interval)
+	{
+		State->ProgressAt = State->Out + Progress->Interval;
+	}
+	else
+	{
+		State->ProgressAt = State->OutEnd;
+	}
+}
+
+
+static BOOL ReportProgress(INFLATE_STATE *State)
+{
+	const INFLATE_PROGRESS *Progress = State->Progress;
+	if (Progress != nullptr && !Progress->Callback(Progress->Context, State->Out - State->OutStart)) return false;
+	ScheduleProgress(State);
+	return true;
+}
+
+
+static BOOL CopyStoredBlock(INFLATE_STATE *State)
+{
+	BIT_READER *Reader = &State->Reader;
+	// The block starts at the next byte boundary. Whatever whole bytes are still in the buffer have not been read yet.
+	ConsumeBits(Reader, Reader->BitCount & 7);
+	if (Reader->Overrun * 8 > Reader->BitCount) return false;
+	const BYTE *In = Reader->In - (Reader->BitCount / 8 - Reader->Overrun);
+	Reader->Bits = 0;
+	Reader->BitCount = 0;
+	Reader->Overrun = 0;
+
+	if (Reader->InEnd - In < 4) return false;
+	DWORD Length = In[0] | (In[1] << 8);
+	DWORD InverseLength = In[2] | (In[3] << 8);
+	In += 4;
+	if ((Length ^ 0xFFFF) != InverseLength) return false;
+	if ((SIZE_T)(Reader->InEnd - In) < Length || (SIZE_T)(State->OutEnd - State->Out) < Length) return false;
+	memcpy(State->Out, In, Length);
+	State->Out += Length;
+	Reader->In = In + Length;
+	return State->Out < State->ProgressAt || ReportProgress(State);
+}
+
+
+static void BuildFixedTables(INFLATE_STATE *State)
+{
+	BYTE Lengths[LITLEN_SYMBOLS];
+	memset(Lengths, 8, 144);
+	memset(Lengths + 144, 9, 112);
+	memset(Lengths + 256, 7, 24);
+	memset(Lengths + 280, 8, 8);
+	BuildTable(State->LitLen, LITLEN_TABLE_CAPACITY, INFLATE_LITLEN_TABLE_BITS, Lengths, LITLEN_SYMBOLS, GetLitLenEntry);
+	memset(Lengths, 5, DIST_SYMBOLS);
+	BuildTable(State->Dist, DIST_TABLE_CAPACITY, INFLATE_DIST_TABLE_BITS, Lengths, DIST_SYMBOLS, GetDistEntry);
+	State->HasFixedTables = true;
+}
+
+
+static BOOL ReadDynamicTables(INFLATE_STATE *State)
+{
+	BIT_READER *Reader = &State->Reader;
+	State->HasFixedTables = false;
+	if (!Refill(Reader)) return false;
+	UINT LitLenCount = PeekBits(Reader, 5) + 257;
+	UINT DistCount = (PeekBits(Reader, 10) >> 5) + 1;
+	UINT PrecodeCount = (PeekBits(Reader, 14) >> 10) + 4;
+	ConsumeBits(Reader, 14);
+	if (LitLenCount > 286 || DistCount > 30) return false;
+
+	BYTE PrecodeLengths[PRECODE_SYMBOLS] = {};
+	for (UINT i = 0; i < PrecodeCount; ++i)
+	{
+		if (Reader->BitCount < 3 && !Refill(Reader)) return false;
+		PrecodeLengths[PrecodeOrder[i]] = (BYTE)PeekBits(Reader, 3);
+		ConsumeBits(Reader, 3);
+	}
+	if (!BuildTable(State->Precode, 1 << PRECODE_TABLE_BITS, PRECODE_TABLE_BITS, PrecodeLengths, PRECODE_SYMBOLS, GetPrecodeEntry)) return false;
+
+	// Both codes are sent as one sequence, and a repetition may run from one into the other.
+	BYTE Lengths[LITLEN_SYMBOLS + DIST_SYMBOLS] = {};
+	UINT Total = LitLenCount + DistCount;
+	UINT i = 0;
+	while (i < Total)
+	{
+		if (Reader->BitCount < 14 && !Refill(Reader)) return false;
+		DWORD Entry = DecodeSymbol(Reader, State->Precode, PRECODE_TABLE_BITS);
+		if (Entry & ENTRY_INVALID) return false;
+		UINT Symbol = Entry >> ENTRY_VALUE_SHIFT;
+		if (Symbol < 16)
+		{
+			Lengths[i++] = (BYTE)Symbol;
+			continue;
+		}
+		BYTE Value = 0;
+		UINT Repeat;
+		if (Symbol == 16)
+		{
+			if (i == 0) return false;
+			Value = Lengths[i - 1];
+			Repeat = 3 + PeekBits(Reader, 2);
+			ConsumeBits(Reader, 2);
+		}
+		else if (Symbol == 17)
+		{
+			Repeat = 3 + PeekBits(Reader, 3);
+			ConsumeBits(Reader, 3);
+		}
+		else
+		{
+			Repeat = 11 + PeekBits(Reader, 7);
+			ConsumeBits(Reader, 7);
+		}
+		if (Repeat > Total - i) return false;
+		memset(Lengths + i, Value, Repeat);
+		i += Repeat;
+	}
+	// A block without an end cannot be decoded.
+	if (Lengths[END_OF_BLOCK] == 0) return false;
+	return BuildTable(State->LitLen, LITLEN_TABLE_CAPACITY, INFLATE_LITLEN_TABLE_BITS, Lengths, LitLenCount, GetLitLenEntry) &&
+		BuildTable(State->Dist, DIST_TABLE_CAPACITY, INFLATE_DIST_TABLE_BITS, Lengths + LitLenCount, DistCount, GetDistEntry);
+}
+
+
+// Copies Length bytes from Distance bytes back. The source may overlap the destination, which then repeats it.
+static void CopyMatch(BYTE *Out, DWORD Length, DWORD Distance)
+{
+	const BYTE *Source = Out - Distance;
+	BYTE *End = Out + Length;
+	// Each chunk only reads bytes that are already written. The last one may write up to 15 bytes past the end, which
+	// is what INFLATE_OUTPUT_SLACK is for.
+	if (Distance >= 16)
+	{
+		do
+		{
+			memcpy(Out, Source, 16);
+			Out += 16;
+			Source += 16;
+		} while (Out < End);
+	}
+	else if (Distance >= 8)
+	{
+		do
+		{
+			memcpy(Out, Source, 8);
+			Out += 8;
+			Source += 8;
+		} while (Out < End);
+	}
+	else if (Distance == 1)
+	{
+		memset(Out, Source[0], Length);
+	}
+	else
+	{
+		// A short pattern, e.g. a run of pixels. Once it has been repeated to at least 8 bytes, the copy can go on from
+		// that many bytes back, 8 bytes at a time.
+		DWORD Period = Distance * ((8 + Distance - 1) / Distance);
+		BYTE *PatternEnd = Out + Period - Distance < End ? Out + Period - Distance : End;
+		while (Out < PatternEnd)
+		{
+			*Out++ = *Source++;
+		}
+		for (Source = Out - Period; Out < End; Out += 8, Source += 8)
+		{
+			memcpy(Out, Source, 8);
+		}
+	}
+}
+
+
+static BOOL DecodeHuffmanBlock(INFLATE_STATE *State)
+{
+	// The hot state lives in locals, so that it can stay in registers.
+	BIT_READER Reader = State->Reader;
+	BYTE *Out = State->Out;
+	BYTE *OutEnd = State->OutEnd;
+	const DWORD *LitLen = State->LitLen;
+	const DWORD *Dist = State->Dist;
+	BOOL Succeeded = false;
+	for (;;)
+	{
+		// Enough for a length code with its extra bits and a distance code with its extra bits: 15 + 5 + 15 + 13.
+		if (Reader.BitCount < 48 && !Refill(&Reader)) break;
+		DWORD Entry = DecodeSymbol(&Reader, LitLen, INFLATE_LITLEN_TABLE_BITS);
+		if (Entry & ENTRY_LITERAL)
+		{
+			if (Out == OutEnd) break;
+			*Out++ = (BYTE)(Entry >> ENTRY_VALUE_SHIFT);
+		}
+		else if ((Entry & (ENTRY_END | ENTRY_INVALID)) == 0)
+		{
+			DWORD Length = DecodeExtra(&Reader, Entry);
+			Entry = DecodeSymbol(&Reader, Dist, INFLATE_DIST_TABLE_BITS);
+			if (Entry & ENTRY_INVALID) break;
+			DWORD Distance = DecodeExtra(&Reader, Entry);
+			if (Distance > (SIZE_T)(Out - State->OutStart) || Length > (SIZE_T)(OutEnd - Out)) break;
+			CopyMatch(Out, Length, Distance);
+			Out += Length;
+		}
+		else
+		{
+			Succeeded = (Entry & ENTRY_END) != 0;
+			break;
+		}
+		if (Out >= State->ProgressAt)
+		{
+			State->Out = Out;
+			if (!ReportProgress(State)) break;
+		}
+	}
+	State->Reader = Reader;
+	State->Out = Out;
+	return Succeeded;
+}
+
+
+// Fails if the stream is damaged or truncated, or does not fit. A stream that ends early is not an error; *ProducedCb
+// tells how much was decompressed.
+BOOL ZlibInflate(const BYTE *Input, SIZE_T InputSizeCb, BYTE *Output, SIZE_T OutputSizeCb, SIZE_T *ProducedCb, const INFLATE_PROGRESS *Progress)
+{
+	*ProducedCb = 0;
+	// Deflate, with a window of at most 32 KB, no preset dictionary, and a valid header check.
+	if (InputSizeCb < 2) return false;
+	DWORD Header = (Input[0] << 8) | Input[1];
+	if ((Header & 0x0F00) != 0x0800 || (Header >> 12) > 7 || Header % 31 != 0 || (Header & 0x20) != 0) return false;
+
+	// Too large for the stack of a worker thread.
+	INFLATE_STATE *State = new INFLATE_STATE;
+	State->Reader.In = Input + 2;
+	State->Reader.InEnd = Input + InputSizeCb;
+	State->Reader.Bits = 0;
+	State->Reader.BitCount = 0;
+	State->Reader.Overrun = 0;
+	State->OutStart = Output;
+	State->Out = Output;
+	State->OutEnd = Output + OutputSizeCb;
+	State->Progress = Progress;
+	State->HasFixedTables = false;
+	ScheduleProgress(State);
+	BOOL Succeeded = true;
+
+	BOOL Final = false;
+	while (Succeeded && !Final)
+	{
+		BIT_READER *Reader = &State->Reader;
+		if (Reader->BitCount < 3 && !Refill(Reader))
+		{
+			Succeeded = false;
+			break;
+		}
+		Final = PeekBits(Reader, 1);
+		DWORD Type = PeekBits(Reader, 3) >> 1;
+		ConsumeBits(Reader, 3);
+		switch (Type)
+		{
+			case 0:
+				Succeeded = CopyStoredBlock(State);
+				break;
+			case 1:
+				if (!State->HasFixedTables) BuildFixedTables(State);
+				Succeeded = DecodeHuffmanBlock(State);
+				break;
+			case 2:
+				Succeeded = ReadDynamicTables(State) && DecodeHuffmanBlock(State);
+				break;
+			default:
+				Succeeded = false;
+				break;
+		}
+	}
+	// The zero bytes past the end may only have been read ahead, not used.
+	if (State->Reader.Overrun * 8 > State->Reader.BitCount) Succeeded = false;
+	if (Succeeded) Succeeded = ReportProgress(State);
+	*ProducedCb = State->Out - Output;
+	delete State;
+	return Succeeded;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "Portable.h"
+
+struct INFLATE_PROGRESS;
+
+// Decompresses zlib streams (RFC 1950 around RFC 1951 DEFLATE), e.g. the image data of a PNG, into a buffer of known
+// size.
+//
+// The whole output is kept as the window, so nothing is ever copied twice, and matches are copied 16 bytes at a time;
+// the output buffer therefore needs INFLATE_OUTPUT_SLACK writable bytes after its end. Huffman codes are decoded with a
+// lookup table on the next INFLATE_LITLEN_TABLE_BITS (or INFLATE_DIST_TABLE_BITS) bits, and small second level tables
+// for the rare longer codes.
+//
+// The Adler-32 at the end of the stream is not checked. Its only user, PNG, has a CRC on every chunk, and browsers skip
+// the check for the same reason.
+//
+// Progress lets a consumer work on the output while it is being produced (see PngDecoder.cpp): the callback is called
+// whenever another Interval bytes are done, and once more at the end. Everything before the reported size is final.
+
+#define INFLATE_OUTPUT_SLACK 16
+#define INFLATE_LITLEN_TABLE_BITS 10
+#define INFLATE_DIST_TABLE_BITS 8
+
+extern BOOL                ZlibInflate(const BYTE *Input, SIZE_T InputSizeCb, BYTE *Output, SIZE_T OutputSizeCb, SIZE_T *ProducedCb, const INFLATE_PROGRESS *Progress);
+
+struct INFLATE_PROGRESS
+{
+	SIZE_T Interval;
+	// Returns false to abort decompression, which then fails.
+	BOOL (*Callback)(void *Context, SIZE_T ProducedCb);
+	void *Context;
+};
@@ -0,0 +1,251 @@
+#include "MipPyramid.h"
+#include "PixelBuffer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+
+// Rounded average of four BGRA pixels, per channel.
+static DWORD AveragePixels(const BYTE *a, const BYTE *b, const BYTE *c, const BYTE *d)
+{
+	DWORD Result = 0;
+	for (int Channel = 0; Channel < 4; ++Channel)
+	{
+		DWORD Sum = (DWORD)a[Channel] + b[Channel] + c[Channel] + d[Channel] + 2;
+		Result |= (Sum >> 2) << (Channel * 8);
+	}
+	return Result;
+}
+
+
+// Averages the pixel pairs [First, End) of two rows into one row of half the width.
+static void DownsampleRowScalar(const BYTE *Row0, const BYTE *Row1, DWORD *Out, LONG First, LONG End)
+{
+	for (LONG x = First; x < End; ++x)
+	{
+		Out[x] = AveragePixels(Row0 + x * 8, Row0 + x * 8 + 4, Row1 + x * 8, Row1 + x * 8 + 4);
+	}
+}
+
+
+#ifdef PORTABLE_SSE2
+// Four output pixels at a time. Returns how many pairs were done; the rest is left to the scalar code.
+static LONG DownsampleRowSSE2(const BYTE *Row0, const BYTE *Row1, DWORD *Out, LONG Pairs)
+{
+	const __m128i Zero = _mm_setzero_si128();
+	const __m128i Rounding = _mm_set1_epi16(2);
+	LONG x = 0;
+	for (; x + 4 <= Pairs; x += 4)
+	{
+		__m128i A0 = _mm_loadu_si128((const __m128i *)(Row0 + x * 8));
+		__m128i A1 = _mm_loadu_si128((const __m128i *)(Row0 + x * 8 + 16));
+		__m128i B0 = _mm_loadu_si128((const __m128i *)(Row1 + x * 8));
+		__m128i B1 = _mm_loadu_si128((const __m128i *)(Row1 + x * 8 + 16));
+
+		// Vertical sums, two pixels per register, 16 bits per channel.
+		__m128i V0 = _mm_add_epi16(_mm_unpacklo_epi8(A0, Zero), _mm_unpacklo_epi8(B0, Zero));
+		__m128i V1 = _mm_add_epi16(_mm_unpackhi_epi8(A0, Zero), _mm_unpackhi_epi8(B0, Zero));
+		__m128i V2 = _mm_add_epi16(_mm_unpacklo_epi8(A1, Zero), _mm_unpacklo_epi8(B1, Zero));
+		__m128i V3 = _mm_add_epi16(_mm_unpackhi_epi8(A1, Zero), _mm_unpackhi_epi8(B1, Zero));
+
+		// Adding the upper half to the lower one completes the sum of each 2x2 block.
+		V0 = _mm_add_epi16(V0, _mm_srli_si128(V0, 8));
+		V1 = _mm_add_epi16(V1, _mm_srli_si128(V1, 8));
+		V2 = _mm_add_epi16(V2, _mm_srli_si128(V2, 8));
+		V3 = _mm_add_epi16(V3, _mm_srli_si128(V3, 8));
+
+		__m128i Sum01 = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(V0, V1), Rounding), 2);
+		__m128i Sum23 = _mm_srli_epi16(_mm_add_epi16(_mm_unpacklo_epi64(V2, V3), Rounding), 2);
+		_mm_storeu_si128((__m128i *)(Out + x), _mm_packus_epi16(Sum01, Sum23));
+	}
+	return x;
+}
+#endif
+
+
+// Destination must be half the size of Source, rounded up.
+void MipDownsample(const PIXEL_BUFFER *Source, PIXEL_BUFFER *Destination)
+{
+	LONG Pairs = Source->Width / 2;
+	for (LONG y = 0; y < Destination->Height; ++y)
+	{
+		const BYTE *Row0 = Source->Pixels + (SIZE_T)(2 * y) * Source->Stride;
+		const BYTE *Row1 = 2 * y + 1 < Source->Height ? Row0 + Source->Stride : Row0;
+		DWORD *Out = (DWORD *)(Destination->Pixels + (SIZE_T)y * Destination->Stride);
+		LONG Done = 0;
+#ifdef PORTABLE_SSE2
+		Done = DownsampleRowSSE2(Row0, Row1, Out, Pairs);
+#endif
+		DownsampleRowScalar(Row0, Row1, Out, Done, Pairs);
+		if (Source->Width % 2 != 0)
+		{
+			const BYTE *Last0 = Row0 + (SIZE_T)(Source->Width - 1) * 4;
+			const BYTE *Last1 = Row1 + (SIZE_T)(Source->Width - 1) * 4;
+			Out[Pairs] = AveragePixels(Last0, Last0, Last1, Last1);
+		}
+	}
+}
+
+
+// Adds the level below Level to the pyramid, and returns it. Returns null if Level is the last one (a single pixel), or
+// if there is not enough memory.
+PIXEL_BUFFER *MipPyramidAddLevel(PIXEL_BUFFER *Level)
+{
+	if (Level->HalfSize != nullptr) return Level->HalfSize;
+	if (Level->Width == 1 && Level->Height == 1) return nullptr;
+	PIXEL_BUFFER *HalfSize = PixelBufferCreate((Level->Width + 1) / 2, (Level->Height + 1) / 2);
+	if (HalfSize == nullptr) return nullptr;
+	MipDownsample(Level, HalfSize);
+	HalfSize->HasAlpha = Level->HasAlpha;
+	Level->HalfSize = HalfSize;
+	return HalfSize;
+}
+
+
+// Returns the smallest level that still has at least as many pixels as Image drawn at Scale, as far as the pyramid
+// has been built.
+const PIXEL_BUFFER *MipPyramidSelectLevel(const PIXEL_BUFFER *Image, double Scale)
+{
+	const PIXEL_BUFFER *Level = Image;
+	while (Scale <= 0.5 && Level->HalfSize != nullptr)
+	{
+		Level = Level->HalfSize;
+		Scale *= 2;
+	}
+	return Level;
+}
+
+
+// Position in the level, in 1/256 pixels, of the center of every pixel on the screen. Coordinate 0 is the first pixel
+// that is drawn, and Ratio is level pixels per screen pixel. Index + 1 is always valid as well, unless the level is
+// only a single pixel wide; Weight is how much of it goes into the result.
+static void MapCoordinates(LONGLONG First, LONG Count, double Ratio, LONG LevelSize, LONG *Index, UINT *Weight)
+{
+	for (LONG i = 0; i < Count; ++i)
+	{
+		double Position = ((double)(First + i) + 0.5) * Ratio - 0.5;
+		LONGLONG Fixed = (LONGLONG)floor(Position * 256);
+		if (Fixed < 0) Fixed = 0;
+		LONG Whole = (LONG)(Fixed >> 8);
+		UINT Fraction = (UINT)(Fixed & 255);
+		if (Whole >= LevelSize - 1)
+		{
+			Whole = LevelSize >= 2 ? LevelSize - 2 : 0;
+			Fraction = LevelSize >= 2 ? 256 : 0;
+		}
+		Index[i] = Whole;
+		Weight[i] = Fraction;
+	}
+}
+
+
+static DWORD InterpolateScalar(const BYTE *Top, const BYTE *Bottom, LONG Right, UINT WeightX, UINT WeightY)
+{
+	DWORD Result = 0;
+	for (int Channel = 0; Channel < 4; ++Channel)
+	{
+		UINT Left = (Top[Channel] * (256 - WeightY) + Bottom[Channel] * WeightY + 128) >> 8;
+		UINT RightValue = (Top[Right + Channel] * (256 - WeightY) + Bottom[Right + Channel] * WeightY + 128) >> 8;
+		Result |= (DWORD)((Left * (256 - WeightX) + RightValue * WeightX + 128) >> 8) << (Channel * 8);
+	}
+	return Result;
+}
+
+
+// Draws Image at Scale (screen pixels per image pixel) into Pixels, a top-down BGRA buffer of Width x Height pixels.
+// (X, Y) is the position of its top left pixel on the scaled image.
+void MipResample(const PIXEL_BUFFER *Image, double Scale, LONGLONG X, LONGLONG Y, LONG Width, LONG Height, BYTE *Pixels, SIZE_T Stride)
+{
+	if (Width <= 0 || Height <= 0) return;
+	const PIXEL_BUFFER *Level = MipPyramidSelectLevel(Image, Scale);
+	double RatioX = (double)Level->Width / ((double)Image->Width * Scale);
+	double RatioY = (double)Level->Height / ((double)Image->Height * Scale);
+
+	LONG *Columns = (LONG *)malloc(Width * sizeof(LONG));
+	UINT *ColumnWeights = (UINT *)malloc(Width * sizeof(UINT));
+	if (Columns == nullptr || ColumnWeights == nullptr)
+	{
+		free(Columns);
+		free(ColumnWeights);
+		return;
+	}
+
+	if (Scale >= 1)
+	{
+		// Magnified: every screen pixel shows the image pixel under its center.
+		for (LONG i = 0; i < Width; ++i)
+		{
+			LONGLONG Column = (LONGLONG)(((double)(X + i) + 0.5) * RatioX);
+			Columns[i] = (LONG)(Column < Image->Width ? Column : Image->Width - 1);
+		}
+		for (LONG j = 0; j < Height; ++j)
+		{
+			LONGLONG Row = (LONGLONG)(((double)(Y + j) + 0.5) * RatioY);
+			if (Row >= Image->Height) Row = Image->Height - 1;
+			const DWORD *Source = (const DWORD *)(Image->Pixels + (SIZE_T)Row * Image->Stride);
+			DWORD *Out = (DWORD *)(Pixels + j * Stride);
+			for (LONG i = 0; i < Width; ++i)
+			{
+				Out[i] = Source[Columns[i]];
+			}
+		}
+		free(Columns);
+		free(ColumnWeights);
+		return;
+	}
+
+	MapCoordinates(X, Width, RatioX, Level->Width, Columns, ColumnWeights);
+	LONG Right = Level->Width >= 2 ? 4 : 0;
+	for (LONG j = 0; j < Height; ++j)
+	{
+		LONG Row;
+		UINT RowWeight;
+		MapCoordinates(Y + j, 1, RatioY, Level->Height, &Row, &RowWeight);
+		const BYTE *Top = Level->Pixels + (SIZE_T)Row * Level->Stride;
+		const BYTE *Bottom = Row + 1 < Level->Height ? Top + Level->Stride : Top;
+		DWORD *Out = (DWORD *)(Pixels + j * Stride);
+		LONG i = 0;
+#ifdef PORTABLE_SSE2
+		if (Right != 0)
+		{
+			const __m128i Zero = _mm_setzero_si128();
+			const __m128i Rounding = _mm_set1_epi16(128);
+			const __m128i WeightTop = _mm_set1_epi16((short)(256 - RowWeight));
+			const __m128i WeightBottom = _mm_set1_epi16((short)RowWeight);
+			for (; i < Width; ++i)
+			{
+				// Both pixels of a row at once: the left one in the lower half, the right one in the upper half.
+				// All products stay below 65536, so the unsigned values survive the signed multiplication.
+				__m128i TopPair = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(Top + (SIZE_T)Columns[i] * 4)), Zero);
+				__m128i BottomPair = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(Bottom + (SIZE_T)Columns[i] * 4)), Zero);
+				__m128i Vertical = _mm_add_epi16(_mm_mullo_epi16(TopPair, WeightTop), _mm_mullo_epi16(BottomPair, WeightBottom));
+				Vertical = _mm_srli_epi16(_mm_add_epi16(Vertical, Rounding), 8);
+				UINT w = ColumnWeights[i];
+				__m128i WeightX = _mm_set_epi16((short)w, (short)w, (short)w, (short)w, (short)(256 - w), (short)(256 - w), (short)(256 - w), (short)(256 - w));
+				__m128i Horizontal = _mm_mullo_epi16(Vertical, WeightX);
+				Horizontal = _mm_add_epi16(Horizontal, _mm_srli_si128(Horizontal, 8));
+				Horizontal = _mm_srli_epi16(_mm_add_epi16(Horizontal, Rounding), 8);
+				Out[i] = (DWORD)_mm_cvtsi128_si32(_mm_packus_epi16(Horizontal, Horizontal));
+			}
+		}
+#endif
+		for (; i < Width; ++i)
+		{
+			Out[i] = InterpolateScalar(Top + (SIZE_T)Columns[i] * 4, Bottom + (SIZE_T)Columns[i] * 4, Right, ColumnWeights[i], RowWeight);
+		}
+	}
+	free(Columns);
+	free(ColumnWeights);
+}
+
+
+// Bytes of pixels in the image and all levels below it.
+SIZE_T MipPyramidGetSize(const PIXEL_BUFFER *Image)
+{
+	SIZE_T SizeCb = 0;
+	for (const PIXEL_BUFFER *Level = Image; Level != nullptr; Level = Level->HalfSize)
+	{
+		SizeCb += Level->SizeCb;
+	}
+	return SizeCb;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#include "Portable.h"
+
+struct PIXEL_BUFFER;
+
+// Mip pyramid of an image, for drawing it at any scale without touching all of its pixels.
+//
+// Every level is the one above it averaged down to half the width and height (rounded up; the last column or row of
+// an odd sized level is averaged with itself), down to a single pixel. The levels hang off the image through
+// PIXEL_BUFFER::HalfSize, so they are shared and released together with it. They have to be added by whoever created
+// the image, before it is shared, one level at a time so that the caller can stop in between.
+//
+// Drawing at a scale below 1 picks the level that is at most twice as large as needed, and resamples it bilinearly;
+// above 1, the image itself is magnified without smoothing, so that the pixels can be told apart.
+
+extern PIXEL_BUFFER       *MipPyramidAddLevel(PIXEL_BUFFER *Level);
+extern void                MipDownsample(const PIXEL_BUFFER *Source, PIXEL_BUFFER *Destination);
+extern const PIXEL_BUFFER *MipPyramidSelectLevel(const PIXEL_BUFFER *Image, double Scale);
+extern void                MipResample(const PIXEL_BUFFER *Image, double Scale, LONGLONG X, LONGLONG Y, LONG Width, LONG Height, BYTE *Pixels, SIZE_T Stride);
+extern SIZE_T              MipPyramidGetSize(const PIXEL_BUFFER *Image);
@@ -0,0 +1,684 @@
+#include "PackedDIB.h"
+#include <string.h>
+
+// The shortest OS/2 2.x header: up to and including biBitCount. Longer ones may end after any field.
+#define OS2_MIN_HEADER_SIZE 16
+// The color table of a BITMAPCOREHEADER has RGBTRIPLEs.
+#define CORE_COLOR_ENTRY_SIZE 3
+// The most pixels a DIB may have at all (16384 x 16384, 1 GB decoded).
+#define MAX_DIB_PIXELS (1ull << 28)
+// No layout stores more pixels per byte of pixel data than an RLE8 run (255 pixels in 2 bytes) does. Bitmaps with more
+// pixels than that, e.g. RLE bitmaps that skip to the end of the bitmap right away, are refused, unless they are small.
+#define MAX_PIXELS_PER_BYTE 128
+#define MIN_DIB_PIXELS_LIMIT (1ull << 20)
+
+
+// Reads any kind of DIB header into a BITMAPINFOHEADER. Only biSize bytes are read. A BITMAPCOREHEADER becomes the
+// equivalent BITMAPINFOHEADER, and the fields that a shortened OS/2 2.x header leaves out are 0, as the format defines.
+// Returns false if biSize is not the size of any header.
+static BOOL ReadHeader(const BITMAPINFOHEADER *BitmapInfoHeader, BITMAPINFOHEADER *Header)
+{
+	memset(Header, 0, sizeof(*Header));
+	DWORD Size = BitmapInfoHeader->biSize;
+	if (Size == sizeof(BITMAPCOREHEADER))
+	{
+		BITMAPCOREHEADER Core;
+		memcpy(&Core, BitmapInfoHeader, sizeof(Core));
+		Header->biSize = Size;
+		Header->biWidth = Core.bcWidth;
+		Header->biHeight = Core.bcHeight;
+		Header->biPlanes = Core.bcPlanes;
+		Header->biBitCount = Core.bcBitCount;
+		Header->biCompression = BI_RGB;
+		return true;
+	}
+	if (Size < OS2_MIN_HEADER_SIZE) return false;
+	memcpy(Header, BitmapInfoHeader, Size < sizeof(BITMAPINFOHEADER) ? Size : sizeof(BITMAPINFOHEADER));
+	return true;
+}
+
+
+// Returns the offset, in bytes, from the start of the BITMAPINFO, to the start of the pixel data array, for a packed DIB.
+INT GetPixelDataOffsetForPackedDIB(const BITMAPINFOHEADER *BitmapInfoHeader)
+{
+	BITMAPINFOHEADER Header;
+	if (!ReadHeader(BitmapInfoHeader, &Header))
+	{
+		return 0; // Not a valid header.
+	}
+	SIZE_T ColorEntrySize = Header.biSize == sizeof(BITMAPCOREHEADER) ? CORE_COLOR_ENTRY_SIZE : sizeof(RGBQUAD);
+
+	INT OffsetExtra = 0;
+
+	if (Header.biSize == sizeof(BITMAPINFOHEADER) /* 40 */)
+	{
+		// This is the common BITMAPINFOHEADER type. In this case, there may be bit masks following the BITMAPINFOHEADER
+		// and before the actual pixel bits (does not apply if bitmap has <= 8 bpp)
+		if (Header.biBitCount > 8)
+		{
+			if (Header.biCompression == BI_BITFIELDS)
+			{
+				OffsetExtra += 3 * sizeof(RGBQUAD);
+			}
+			else if (Header.biCompression == BI_ALPHABITFIELDS)
+			{
+				// Not widely supported, but valid.
+				OffsetExtra += 4 * sizeof(RGBQUAD);
+			}
+		}
+	}
+
+	if (Header.biClrUsed > 0)
+	{
+		// We have no choice but to trust this value.
+		OffsetExtra += Header.biClrUsed * (INT)ColorEntrySize;
+	}
+	else
+	{
+		// In this case, the color table contains the maximum number for the current bit count (0 if > 8bpp)
+		if (Header.biBitCount <= 8)
+		{
+			// 1bpp: 2
+			// 4bpp: 16
+			// 8bpp: 256
+			OffsetExtra += (INT)ColorEntrySize << Header.biBitCount;
+		}
+	}
+
+	return Header.biSize + OffsetExtra;
+}
+
+
+static DWORD ReadDword(const BYTE *p)
+{
+	DWORD Value;
+	memcpy(&Value, p, sizeof(Value));
+	return Value;
+}
+
+
+BOOL GetPackedDIBInfo(const BITMAPINFOHEADER *PackedDIB, SIZE_T PackedDIBSizeCb, PACKED_DIB_INFO *Info)
+{
+	memset(Info, 0, sizeof(*Info));
+	if (PackedDIBSizeCb < sizeof(BITMAPCOREHEADER)) return false;
+	if (PackedDIB->biSize > PackedDIBSizeCb) return false;
+	BITMAPINFOHEADER Header;
+	if (!ReadHeader(PackedDIB, &Header)) return false;
+	// Keeps GetPixelDataOffsetForPackedDIB from overflowing on garbage.
+	if (Header.biClrUsed > PackedDIBSizeCb / sizeof(RGBQUAD)) return false;
+
+	const BYTE *Base = (const BYTE *)PackedDIB;
+	LONG Width = Header.biWidth;
+	LONG Height = Header.biHeight;
+	if (Width <= 0 || Height == 0 || Height < -0x7FFFFFFF /* INT_MIN, which cannot be negated */) return false;
+
+	Info->Width = Width;
+	Info->TopDown = Height < 0;
+	Info->Height = Height < 0 ? -Height : Height;
+	Info->BitCount = Header.biBitCount;
+	Info->Compression = Header.biCompression;
+
+	// Refuse anything whose decoded size cannot be addressed.
+	if ((SIZE_T)Info->Width > ((SIZE_T)-1 / 4) / (SIZE_T)Info->Height) return false;
+
+	switch (Info->BitCount)
+	{
+		case 1:
+		case 4:
+		case 8:
+		{
+			DWORD RleCompression = Info->BitCount == 8 ? BI_RLE8 : Info->BitCount == 4 ? BI_RLE4 : BI_RGB;
+			if (Info->Compression != BI_RGB && Info->Compression != RleCompression) return false;
+			if (Info->Compression != BI_RGB)
+			{
+				// RLE bitmaps are always bottom-up.
+				if (Info->TopDown) return false;
+				Info->HasAlpha = true;
+			}
+			DWORD MaxColors = 1u << Info->BitCount;
+			DWORD NumColors = Header.biClrUsed != 0 ? Header.biClrUsed : MaxColors;
+			Info->ColorTableEntrySize = Header.biSize == sizeof(BITMAPCOREHEADER) ? CORE_COLOR_ENTRY_SIZE : sizeof(RGBQUAD);
+			if ((SIZE_T)Header.biSize + NumColors * Info->ColorTableEntrySize > PackedDIBSizeCb) return false;
+			Info->ColorTable = Base + Header.biSize;
+			Info->ColorTableSize = NumColors < MaxColors ? NumColors : MaxColors;
+			break;
+		}
+
+		case 16:
+		case 32:
+		{
+			if (Info->Compression == BI_RGB)
+			{
+				if (Info->BitCount == 16)
+				{
+					Info->Masks[0] = 0x7C00;
+					Info->Masks[1] = 0x03E0;
+					Info->Masks[2] = 0x001F;
+				}
+				else
+				{
+					Info->Masks[0] = 0x00FF0000;
+					Info->Masks[1] = 0x0000FF00;
+					Info->Masks[2] = 0x000000FF;
+				}
+			}
+			else if (Info->Compression == BI_BITFIELDS || Info->Compression == BI_ALPHABITFIELDS)
+			{
+				// The masks directly follow the 40 byte BITMAPINFOHEADER. For the V2+ headers, they are header members at
+				// that very same offset, so they can be read the same way in either case. The alpha mask exists if the header
+				// is a V3+ header (56 bytes or more), or if it's a plain BITMAPINFOHEADER with BI_ALPHABITFIELDS.
+				if (Header.biSize < sizeof(BITMAPINFOHEADER)) return false;
+				BOOL HasAlphaMask = Header.biSize >= 56 || Info->Compression == BI_ALPHABITFIELDS;
+				SIZE_T MasksEnd = sizeof(BITMAPINFOHEADER) + (HasAlphaMask ? 4 : 3) * sizeof(DWORD);
+				if (MasksEnd > PackedDIBSizeCb) return false;
+				for (int i = 0; i < (HasAlphaMask ? 4 : 3); ++i)
+				{
+					Info->Masks[i] = ReadDword(Base + sizeof(BITMAPINFOHEADER) + i * sizeof(DWORD));
+				}
+			}
+			else
+			{
+				return false;
+			}
+			Info->HasAlpha = Info->Masks[3] != 0;
+			break;
+		}
+
+		case 24:
+		{
+			if (Info->Compression != BI_RGB) return false;
+			break;
+		}
+
+		default:
+		{
+			return false;
+		}
+	}
+
+	INT PixelDataOffset = GetPixelDataOffsetForPackedDIB(PackedDIB);
+	if (PixelDataOffset == 0 || (SIZE_T)PixelDataOffset > PackedDIBSizeCb) return false;
+	Info->Pixels = Base + PixelDataOffset;
+	Info->PixelBytesAvailable = PackedDIBSizeCb - PixelDataOffset;
+	Info->Stride = Info->Compression == BI_RLE4 || Info->Compression == BI_RLE8 ? 0 : (((SIZE_T)Info->Width * Info->BitCount + 31) / 32) * 4;
+
+	// A few bytes must not be able to make us allocate GBs (the data is then shown as a hex dump instead).
+	ULONGLONG PixelCount = (ULONGLONG)Info->Width * (ULONGLONG)Info->Height;
+	ULONGLONG PixelLimit = (ULONGLONG)Info->PixelBytesAvailable * MAX_PIXELS_PER_BYTE;
+	if (PixelLimit < MIN_DIB_PIXELS_LIMIT) PixelLimit = MIN_DIB_PIXELS_LIMIT;
+	if (PixelCount > MAX_DIB_PIXELS || PixelCount > PixelLimit) return false;
+	return true;
+}
+
+
+// Per-decode lookup tables, built once per call to DecodePackedDIBRows.
+struct DIB_DECODE_TABLES
+{
+	// Palette, pre-converted to BGRA. Always 256 entries; indices that are out of range of the color table map to black.
+	DWORD Palette[256];
+
+	// For generic bit fields: one entry per channel (B, G, R, A -- in destination byte order).
+	struct
+	{
+		DWORD Mask;
+		INT Shift;
+		INT Bits;
+		BYTE Table[256]; // Only used if 0 < Bits <= 8.
+	} Channels[4];
+};
+
+typedef void (*DIB_ROW_KERNEL)(const DIB_DECODE_TABLES *Tables, const BYTE *Source, DWORD *Destination, LONG Width);
+
+
+static void DecodeRow_Palette1(const DIB_DECODE_TABLES *Tables, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	LONG x = 0;
+	for (; x + 8 <= Width; x += 8)
+	{
+		BYTE b = *Source++;
+		Destination[x + 0] = Tables->Palette[(b >> 7) & 1];
+		Destination[x + 1] = Tables->Palette[(b >> 6) & 1];
+		Destination[x + 2] = Tables->Palette[(b >> 5) & 1];
+		Destination[x + 3] = Tables->Palette[(b >> 4) & 1];
+		Destination[x + 4] = Tables->Palette[(b >> 3) & 1];
+		Destination[x + 5] = Tables->Palette[(b >> 2) & 1];
+		Destination[x + 6] = Tables->Palette[(b >> 1) & 1];
+		Destination[x + 7] = Tables->Palette[b & 1];
+	}
+	if (x < Width)
+	{
+		BYTE b = *Source;
+		for (int Bit = 7; x < Width; ++x, --Bit)
+		{
+			Destination[x] = Tables->Palette[(b >> Bit) & 1];
+		}
+	}
+}
+
+static void DecodeRow_Palette4(const DIB_DECODE_TABLES *Tables, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	LONG x = 0;
+	for (; x + 2 <= Width; x += 2)
+	{
+		BYTE b = *Source++;
+		Destination[x + 0] = Tables->Palette[b >> 4];
+		Destination[x + 1] = Tables->Palette[b & 15];
+	}
+	if (x < Width)
+	{
+		Destination[x] = Tables->Palette[*Source >> 4];
+	}
+}
+
+static void DecodeRow_Palette8(const DIB_DECODE_TABLES *Tables, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	LONG x = 0;
+	for (; x + 4 <= Width; x += 4)
+	{
+		Destination[x + 0] = Tables->Palette[Source[x + 0]];
+		Destination[x + 1] = Tables->Palette[Source[x + 1]];
+		Destination[x + 2] = Tables->Palette[Source[x + 2]];
+		Destination[x + 3] = Tables->Palette[Source[x + 3]];
+	}
+	for (; x < Width; ++x)
+	{
+		Destination[x] = Tables->Palette[Source[x]];
+	}
+}
+
+static void DecodeRow_BGR24(const DIB_DECODE_TABLES *, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	for (LONG x = 0; x < Width; ++x, Source += 3)
+	{
+		Destination[x] = 0xFF000000 | ((DWORD)Source[2] << 16) | ((DWORD)Source[1] << 8) | Source[0];
+	}
+}
+
+#ifdef PORTABLE_SSE2
+PORTABLE_TARGET("ssse3")
+static void DecodeRow_BGR24_SSSE3(const DIB_DECODE_TABLES *Tables, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	const __m128i Shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+	const __m128i Alpha = _mm_set1_epi32((int)0xFF000000);
+	LONG x = 0;
+	// Each iteration reads 16 bytes but only consumes 12; stop early enough to never read past the end of the row.
+	for (; x + 6 <= Width; x += 4, Source += 12)
+	{
+		__m128i Pixels = _mm_loadu_si128((const __m128i *)Source);
+		_mm_storeu_si128((__m128i *)(Destination + x), _mm_or_si128(_mm_shuffle_epi8(Pixels, Shuffle), Alpha));
+	}
+	DecodeRow_BGR24(Tables, Source, Destination + x, Width - x);
+}
+#endif
+
+static void DecodeRow_BGRX32(const DIB_DECODE_TABLES *, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	LONG x = 0;
+#ifdef PORTABLE_SSE2
+	const __m128i Alpha = _mm_set1_epi32((int)0xFF000000);
+	for (; x + 4 <= Width; x += 4)
+	{
+		__m128i Pixels = _mm_loadu_si128((const __m128i *)(Source + x * 4));
+		_mm_storeu_si128((__m128i *)(Destination + x), _mm_or_si128(Pixels, Alpha));
+	}
+#endif
+	for (; x < Width; ++x)
+	{
+		Destination[x] = ReadDword(Source + x * 4) | 0xFF000000;
+	}
+}
+
+static void DecodeRow_BGRA32(const DIB_DECODE_TABLES *, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	memcpy(Destination, Source, (SIZE_T)Width * 4);
+}
+
+static DWORD Expand555(WORD p)
+{
+	DWORD r = (p >> 10) & 31, g = (p >> 5) & 31, b = p & 31;
+	return 0xFF000000 | (((r << 3) | (r >> 2)) << 16) | (((g << 3) | (g >> 2)) << 8) | ((b << 3) | (b >> 2));
+}
+
+static DWORD Expand565(WORD p)
+{
+	DWORD r = (p >> 11) & 31, g = (p >> 5) & 63, b = p & 31;
+	return 0xFF000000 | (((r << 3) | (r >> 2)) << 16) | (((g << 2) | (g >> 4)) << 8) | ((b << 3) | (b >> 2));
+}
+
+#ifdef PORTABLE_SSE2
+// Widens 8 pixels worth of 8 bit channel values (one per 16 bit lane) into 8 BGRA pixels.
+static void Store8PixelsBGRA(DWORD *Destination, __m128i b8, __m128i g8, __m128i r8)
+{
+	__m128i bg = _mm_or_si128(b8, _mm_slli_epi16(g8, 8));
+	__m128i ra = _mm_or_si128(r8, _mm_set1_epi16((short)0xFF00));
+	_mm_storeu_si128((__m128i *)Destination, _mm_unpacklo_epi16(bg, ra));
+	_mm_storeu_si128((__m128i *)(Destination + 4), _mm_unpackhi_epi16(bg, ra));
+}
+#endif
+
+static void DecodeRow_RGB555(const DIB_DECODE_TABLES *, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	LONG x = 0;
+#ifdef PORTABLE_SSE2
+	const __m128i Mask5 = _mm_set1_epi16(31);
+	for (; x + 8 <= Width; x += 8)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i *)(Source + x * 2));
+		__m128i b5 = _mm_and_si128(p, Mask5);
+		__m128i g5 = _mm_and_si128(_mm_srli_epi16(p, 5), Mask5);
+		__m128i r5 = _mm_and_si128(_mm_srli_epi16(p, 10), Mask5);
+		__m128i b8 = _mm_or_si128(_mm_slli_epi16(b5, 3), _mm_srli_epi16(b5, 2));
+		__m128i g8 = _mm_or_si128(_mm_slli_epi16(g5, 3), _mm_srli_epi16(g5, 2));
+		__m128i r8 = _mm_or_si128(_mm_slli_epi16(r5, 3), _mm_srli_epi16(r5, 2));
+		Store8PixelsBGRA(Destination + x, b8, g8, r8);
+	}
+#endif
+	for (; x < Width; ++x)
+	{
+		Destination[x] = Expand555((WORD)(Source[x * 2] | (Source[x * 2 + 1] << 8)));
+	}
+}
+
+static void DecodeRow_RGB565(const DIB_DECODE_TABLES *, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	LONG x = 0;
+#ifdef PORTABLE_SSE2
+	const __m128i Mask5 = _mm_set1_epi16(31);
+	const __m128i Mask6 = _mm_set1_epi16(63);
+	for (; x + 8 <= Width; x += 8)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i *)(Source + x * 2));
+		__m128i b5 = _mm_and_si128(p, Mask5);
+		__m128i g6 = _mm_and_si128(_mm_srli_epi16(p, 5), Mask6);
+		__m128i r5 = _mm_srli_epi16(p, 11);
+		__m128i b8 = _mm_or_si128(_mm_slli_epi16(b5, 3), _mm_srli_epi16(b5, 2));
+		__m128i g8 = _mm_or_si128(_mm_slli_epi16(g6, 2), _mm_srli_epi16(g6, 4));
+		__m128i r8 = _mm_or_si128(_mm_slli_epi16(r5, 3), _mm_srli_epi16(r5, 2));
+		Store8PixelsBGRA(Destination + x, b8, g8, r8);
+	}
+#endif
+	for (; x < Width; ++x)
+	{
+		Destination[x] = Expand565((WORD)(Source[x * 2] | (Source[x * 2 + 1] << 8)));
+	}
+}
+
+static BYTE ExtractChannel(const DIB_DECODE_TABLES *Tables, int Channel, DWORD Pixel)
+{
+	const auto &c = Tables->Channels[Channel];
+	DWORD v = (Pixel & c.Mask) >> c.Shift;
+	if (c.Bits <= 8) return c.Table[v];
+	return (BYTE)(v >> (c.Bits - 8));
+}
+
+static void DecodeRow_Bitfields16(const DIB_DECODE_TABLES *Tables, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	for (LONG x = 0; x < Width; ++x)
+	{
+		DWORD p = Source[x * 2] | (Source[x * 2 + 1] << 8);
+		Destination[x] = ExtractChannel(Tables, 0, p) | (ExtractChannel(Tables, 1, p) << 8) | (ExtractChannel(Tables, 2, p) << 16) | ((DWORD)ExtractChannel(Tables, 3, p) << 24);
+	}
+}
+
+static void DecodeRow_Bitfields32(const DIB_DECODE_TABLES *Tables, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	for (LONG x = 0; x < Width; ++x)
+	{
+		DWORD p = ReadDword(Source + x * 4);
+		Destination[x] = ExtractChannel(Tables, 0, p) | (ExtractChannel(Tables, 1, p) << 8) | (ExtractChannel(Tables, 2, p) << 16) | ((DWORD)ExtractChannel(Tables, 3, p) << 24);
+	}
+}
+
+
+static void BuildChannel(DIB_DECODE_TABLES *Tables, int Channel, DWORD Mask, BYTE ValueIfMissing)
+{
+	auto &c = Tables->Channels[Channel];
+	c.Mask = Mask;
+	c.Shift = 0;
+	c.Bits = 0;
+	if (Mask == 0)
+	{
+		// With Bits == 0, ExtractChannel always looks up Table[0].
+		c.Table[0] = ValueIfMissing;
+		return;
+	}
+	while (!(Mask & 1)) { Mask >>= 1; ++c.Shift; }
+	// Masks are supposed to be contiguous. If they aren't, this simply treats the gaps as part of the channel.
+	while (Mask) { Mask >>= 1; ++c.Bits; }
+	if (c.Bits <= 8)
+	{
+		DWORD Max = (1u << c.Bits) - 1;
+		for (DWORD v = 0; v <= Max; ++v)
+		{
+			c.Table[v] = (BYTE)((v * 255 + Max / 2) / Max);
+		}
+	}
+}
+
+
+static void BuildPalette(const PACKED_DIB_INFO *Info, DIB_DECODE_TABLES *Tables)
+{
+	for (DWORD i = 0; i < 256; ++i)
+	{
+		if (i < Info->ColorTableSize)
+		{
+			// Blue, green, red, and for RGBQUADs a reserved byte.
+			const BYTE *q = Info->ColorTable + i * Info->ColorTableEntrySize;
+			Tables->Palette[i] = 0xFF000000 | ((DWORD)q[2] << 16) | ((DWORD)q[1] << 8) | q[0];
+		}
+		else
+		{
+			Tables->Palette[i] = 0xFF000000;
+		}
+	}
+}
+
+
+static DIB_ROW_KERNEL SelectRowKernel(const PACKED_DIB_INFO *Info, DIB_DECODE_TABLES *Tables)
+{
+	switch (Info->BitCount)
+	{
+		case 1:
+		case 4:
+		case 8:
+		{
+			BuildPalette(Info, Tables);
+			return Info->BitCount == 1 ? DecodeRow_Palette1 : Info->BitCount == 4 ? DecodeRow_Palette4 : DecodeRow_Palette8;
+		}
+
+		case 24:
+		{
+#ifdef PORTABLE_SSE2
+			if (CpuHasSSSE3()) return DecodeRow_BGR24_SSSE3;
+#endif
+			return DecodeRow_BGR24;
+		}
+	}
+
+	const DWORD *m = Info->Masks;
+	if (Info->BitCount == 32 && m[0] == 0x00FF0000 && m[1] == 0x0000FF00 && m[2] == 0x000000FF)
+	{
+		if (m[3] == 0) return DecodeRow_BGRX32;
+		if (m[3] == 0xFF000000) return DecodeRow_BGRA32;
+	}
+	if (Info->BitCount == 16 && m[3] == 0)
+	{
+		if (m[0] == 0x7C00 && m[1] == 0x03E0 && m[2] == 0x001F) return DecodeRow_RGB555;
+		if (m[0] == 0xF800 && m[1] == 0x07E0 && m[2] == 0x001F) return DecodeRow_RGB565;
+	}
+
+	BuildChannel(Tables, 0, m[2], 0);
+	BuildChannel(Tables, 1, m[1], 0);
+	BuildChannel(Tables, 2, m[0], 0);
+	BuildChannel(Tables, 3, m[3], 0xFF);
+	return Info->BitCount == 16 ? DecodeRow_Bitfields16 : DecodeRow_Bitfields32;
+}
+
+
+// Where DecodeRleRows writes to. Rows of the stream count from the bottom; only [FirstStreamRow, LastStreamRow] are
+// written.
+struct RLE_OUTPUT
+{
+	BYTE *Destination;
+	SIZE_T Stride;
+	LONG Width;
+	LONG FirstStreamRow;
+	LONG LastStreamRow;
+};
+
+
+static DWORD *GetRleLine(const RLE_OUTPUT *Output, LONG Row)
+{
+	if (Row < Output->FirstStreamRow || Row > Output->LastStreamRow) return nullptr;
+	return (DWORD *)(Output->Destination + (SIZE_T)(Output->LastStreamRow - Row) * Output->Stride);
+}
+
+
+// Makes the pixels from (Row, x) up to (ToRow, ToX), in the order of the stream, transparent.
+static void ClearRleGap(const RLE_OUTPUT *Output, LONG Row, LONG x, LONG ToRow, LONG ToX)
+{
+	if (ToRow > Output->LastStreamRow)
+	{
+		ToRow = Output->LastStreamRow + 1;
+		ToX = 0;
+	}
+	for (; Row <= ToRow; ++Row, x = 0)
+	{
+		LONG End = Row == ToRow ? ToX : Output->Width;
+		DWORD *Line = GetRleLine(Output, Row);
+		if (Line != nullptr && End > x)
+		{
+			memset(Line + x, 0, (SIZE_T)(End - x) * 4);
+		}
+	}
+}
+
+
+// An RLE bitmap is a stream of commands, starting at the bottom left: runs of one index (or of two alternating ones, for
+// RLE4), literal runs, line ends, and jumps ahead. Jumped over pixels, and everything after the end of the stream, are
+// transparent. Pixels beyond the right edge are dropped; a run does not continue on the next row.
+// Every pixel is written once, the transparent ones as the stream skips them.
+static void DecodeRleRows(const PACKED_DIB_INFO *Info, const DWORD *Palette, LONG FirstRow, LONG RowCount, BYTE *Destination, SIZE_T DestinationStride)
+{
+	RLE_OUTPUT Output;
+	Output.Destination = Destination;
+	Output.Stride = DestinationStride;
+	Output.Width = Info->Width;
+	Output.LastStreamRow = Info->Height - 1 - FirstRow;
+	Output.FirstStreamRow = Output.LastStreamRow - RowCount + 1;
+
+	BOOL Rle4 = Info->Compression == BI_RLE4;
+	LONG Width = Info->Width;
+	const BYTE *p = Info->Pixels;
+	const BYTE *End = p + Info->PixelBytesAvailable;
+	LONG x = 0;
+	LONG Row = 0;
+	while (Row <= Output.LastStreamRow && End - p >= 2)
+	{
+		UINT Count = p[0];
+		BYTE Value = p[1];
+		p += 2;
+		DWORD *Line = GetRleLine(&Output, Row);
+		if (Count > 0)
+		{
+			// A run; for RLE4, the two nibbles of Value alternate.
+			DWORD Colors[2] = { Palette[Rle4 ? Value >> 4 : Value], Palette[Rle4 ? Value & 15 : Value] };
+			LONG Visible = (LONG)Count < Width - x ? (LONG)Count : Width - x;
+			if (Line != nullptr)
+			{
+				DWORD *Out = Line + x;
+				LONG i = 0;
+#ifdef PORTABLE_SSE2
+				__m128i Pattern = _mm_set_epi32((int)Colors[1], (int)Colors[0], (int)Colors[1], (int)Colors[0]);
+				for (; i + 4 <= Visible; i += 4)
+				{
+					_mm_storeu_si128((__m128i *)(Out + i), Pattern);
+				}
+#endif
+				for (; i < Visible; ++i)
+				{
+					Out[i] = Colors[i & 1];
+				}
+			}
+			x += Visible;
+			continue;
+		}
+		if (Value == 1)
+		{
+			// End of bitmap.
+			break;
+		}
+		if (Value == 0 || Value == 2)
+		{
+			// End of line, or a jump right and up.
+			LONG ToRow = Row + 1;
+			LONG ToX = 0;
+			if (Value == 2)
+			{
+				if (End - p < 2) break;
+				ToX = x + ((LONG)p[0] < Width - x ? (LONG)p[0] : Width - x);
+				ToRow = Row + p[1];
+				p += 2;
+			}
+			ClearRleGap(&Output, Row, x, ToRow, ToX);
+			Row = ToRow;
+			x = ToX;
+			continue;
+		}
+
+		// Literal: Value indices, padded to a multiple of 2 bytes.
+		SIZE_T Bytes = Rle4 ? (Value + 1) / 2 : Value;
+		if ((SIZE_T)(End - p) < Bytes) break;
+		LONG Visible = (LONG)Value < Width - x ? (LONG)Value : Width - x;
+		for (LONG i = 0; Line != nullptr && i < Visible; ++i)
+		{
+			// RLE4 has two indices per byte, the high nibble first.
+			Line[x + i] = Palette[Rle4 ? (p[i / 2] >> (i % 2 == 0 ? 4 : 0)) & 15 : p[i]];
+		}
+		x += Visible;
+		SIZE_T PaddedBytes = (Bytes + 1) & ~(SIZE_T)1;
+		p += PaddedBytes < (SIZE_T)(End - p) ? PaddedBytes : (SIZE_T)(End - p);
+	}
+	ClearRleGap(&Output, Row, x, Output.LastStreamRow + 1, 0);
+}
+
+
+// Decodes the rows [FirstRow, FirstRow + RowCount) of the image (counted from the top, regardless of the DIB's orientation),
+// to Destination, which receives the first of those rows.
+// Rows that are missing because the DIB was truncated are filled with opaque black (transparent, for RLE).
+void DecodePackedDIBRows(const PACKED_DIB_INFO *Info, LONG FirstRow, LONG RowCount, BYTE *Destination, SIZE_T DestinationStride)
+{
+	DIB_DECODE_TABLES Tables;
+	if (Info->Compression == BI_RLE4 || Info->Compression == BI_RLE8)
+	{
+		BuildPalette(Info, &Tables);
+		DecodeRleRows(Info, Tables.Palette, FirstRow, RowCount, Destination, DestinationStride);
+		return;
+	}
+
+	DIB_ROW_KERNEL Kernel = SelectRowKernel(Info, &Tables);
+	SIZE_T RowBytesNeeded = ((SIZE_T)Info->Width * Info->BitCount + 7) / 8;
+
+	for (LONG y = FirstRow; y < FirstRow + RowCount; ++y, Destination += DestinationStride)
+	{
+		LONG SourceRow = Info->TopDown ? y : Info->Height - 1 - y;
+		SIZE_T SourceOffset = (SIZE_T)SourceRow * Info->Stride;
+		DWORD *DestinationRow = (DWORD *)Destination;
+		if (SourceOffset > Info->PixelBytesAvailable || Info->PixelBytesAvailable - SourceOffset < RowBytesNeeded)
+		{
+			// Malformed data; doesn't contain enough pixels. We'll do what we can.
+			for (LONG x = 0; x < Info->Width; ++x)
+			{
+				DestinationRow[x] = 0xFF000000;
+			}
+			continue;
+		}
+		Kernel(&Tables, Info->Pixels + SourceOffset, DestinationRow, Info->Width);
+	}
+}
+
+
+void DecodePackedDIB(const PACKED_DIB_INFO *Info, BYTE *Destination, SIZE_T DestinationStride)
+{
+	DecodePackedDIBRows(Info, 0, Info->Height, Destination, DestinationStride);
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "Portable.h"
+
+// Decodes packed DIBs (a BITMAPINFO immediately followed by the pixel array, which is what CF_DIB and CF_DIBV5
+// contain) into 32bpp BGRA, top-down, without going through GDI.
+// Besides BITMAPINFOHEADER and its V4 and V5 successors, this reads the BITMAPCOREHEADER of OS/2 1.x (with its 3 byte
+// color table entries) and the shortened OS/2 2.x headers, and RLE4 and RLE8 compressed bitmaps.
+// Every decoded pixel has a valid alpha value; formats without alpha information decode as opaque. Alpha is straight,
+// i.e. the colors are not premultiplied (see PixelAlpha.h). Pixels that an RLE bitmap skips are transparent.
+// RLE bitmaps can only be decoded from the start of their stream, so DecodePackedDIBRows goes through the stream up to
+// the last row asked for; they should be decoded in one call.
+// GetPackedDIBInfo refuses bitmaps of more than 16384 x 16384 pixels, and ones with more pixels than their pixel data
+// could describe (more than 128 per byte, beyond the first million), so that a few bytes cannot take GBs to decode.
+
+struct PACKED_DIB_INFO;
+
+extern INT                 GetPixelDataOffsetForPackedDIB(const BITMAPINFOHEADER *BitmapInfoHeader);
+extern BOOL                GetPackedDIBInfo(const BITMAPINFOHEADER *PackedDIB, SIZE_T PackedDIBSizeCb, PACKED_DIB_INFO *Info);
+extern void                DecodePackedDIBRows(const PACKED_DIB_INFO *Info, LONG FirstRow, LONG RowCount, BYTE *Destination, SIZE_T DestinationStride);
+extern void                DecodePackedDIB(const PACKED_DIB_INFO *Info, BYTE *Destination, SIZE_T DestinationStride);
+
+// Filled by GetPackedDIBInfo. The pointers point into the packed DIB, which must stay valid while decoding.
+struct PACKED_DIB_INFO
+{
+	LONG Width;
+	LONG Height; // Always positive. See TopDown.
+	BOOL TopDown;
+	WORD BitCount;
+	DWORD Compression;
+	// Red, green, blue and alpha masks. Only used for 16bpp and 32bpp. The defaults are filled in for BI_RGB.
+	DWORD Masks[4];
+	BOOL HasAlpha;               // Decoded pixels may be translucent: there is an alpha mask, or the bitmap is RLE.
+	const BYTE *ColorTable;
+	DWORD ColorTableSize;
+	DWORD ColorTableEntrySize;   // sizeof(RGBQUAD), or 3 (an RGBTRIPLE) for a BITMAPCOREHEADER.
+	const BYTE *Pixels;
+	SIZE_T PixelBytesAvailable;
+	// Bytes per row in the source pixel array, including the padding to a multiple of 4 bytes. 0 for RLE.
+	SIZE_T Stride;
+};
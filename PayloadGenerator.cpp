@@ -0,0 +1,1662 @@
+#include "PayloadGenerator.h"
+#include "PngDecoder.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define WINDOW_COUNT 6
+#define GLYPH_LINE_PITCH 18
+#define CS_TYPE_SRGB 0x73524742 // 'sRGB'
+#define BI_JPEG_VALUE 4
+#define BI_PNG_VALUE 5
+
+
+// xorshift32.
+static DWORD NextRandom(DWORD *State)
+{
+	DWORD x = *State;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*State = x;
+	return x;
+}
+
+
+static DWORD InitRandom(DWORD Seed)
+{
+	return Seed != 0 ? Seed : 0x2545F491;
+}
+
+
+// Random in [0, Count).
+static DWORD RandomBelow(DWORD *State, DWORD Count)
+{
+	return NextRandom(State) % Count;
+}
+
+
+static DWORD Mix(DWORD x)
+{
+	x ^= x >> 16;
+	x *= 0x7FEB352D;
+	x ^= x >> 15;
+	x *= 0x846CA68B;
+	x ^= x >> 16;
+	return x;
+}
+
+
+static void WriteDword(BYTE *p, DWORD Value)
+{
+	memcpy(p, &Value, sizeof(Value));
+}
+
+
+struct SCREEN_WINDOW
+{
+	LONG Left;
+	LONG Top;
+	LONG Right;
+	LONG Bottom;
+	DWORD Color;
+	BOOL IsPhoto;
+};
+
+struct SCREEN_LAYOUT
+{
+	DWORD Background;
+	DWORD Seed;
+	SCREEN_WINDOW Windows[WINDOW_COUNT]; // Later ones are on top.
+};
+
+
+static void InitScreenLayout(SCREEN_LAYOUT *Layout, LONG Width, LONG Height, DWORD Seed)
+{
+	DWORD State = InitRandom(Seed);
+	Layout->Seed = Seed;
+	Layout->Background = 0xFF000000 | (0x30 + RandomBelow(&State, 0x40)) * 0x010101;
+	for (int i = 0; i < WINDOW_COUNT; ++i)
+	{
+		SCREEN_WINDOW *Window = &Layout->Windows[i];
+		LONG WindowWidth = Width / 4 + (LONG)RandomBelow(&State, (DWORD)Width / 2 + 1);
+		LONG WindowHeight = Height / 4 + (LONG)RandomBelow(&State, (DWORD)Height / 2 + 1);
+		Window->Left = (LONG)RandomBelow(&State, (DWORD)(Width - WindowWidth / 2) + 1) - WindowWidth / 4;
+		Window->Top = (LONG)RandomBelow(&State, (DWORD)(Height - WindowHeight / 2) + 1) - WindowHeight / 4;
+		Window->Right = Window->Left + WindowWidth;
+		Window->Bottom = Window->Top + WindowHeight;
+		Window->Color = 0xFF000000 | (0xE0 + RandomBelow(&State, 0x20)) * 0x010101;
+		Window->IsPhoto = i == 1;
+	}
+}
+
+
+// The color of a pixel, as BGRA with full alpha.
+static DWORD GetScreenColor(const SCREEN_LAYOUT *Layout, LONG x, LONG y)
+{
+	for (int i = WINDOW_COUNT - 1; i >= 0; --i)
+	{
+		const SCREEN_WINDOW *Window = &Layout->Windows[i];
+		if (x < Window->Left || x >= Window->Right || y < Window->Top || y >= Window->Bottom) continue;
+
+		LONG InnerX = x - Window->Left;
+		LONG InnerY = y - Window->Top;
+		// Title bar.
+		if (InnerY < 24) return 0xFF2B5797 + (DWORD)(InnerX / 64 % 2) * 0x000808;
+		if (Window->IsPhoto)
+		{
+			DWORD Noise = Mix((DWORD)x * 0x9E3779B1 ^ (DWORD)y ^ Layout->Seed) & 0x0F;
+			DWORD Red = (InnerX * 255 / (Window->Right - Window->Left) + Noise) & 0xFF;
+			DWORD Green = (InnerY * 255 / (Window->Bottom - Window->Top) + Noise) & 0xFF;
+			DWORD Blue = (0x80 + (InnerX - InnerY) / 8 + Noise) & 0xFF;
+			return 0xFF000000 | (Red << 16) | (Green << 8) | Blue;
+		}
+		// Lines of "text": dark pixels in bands, with gaps between the words.
+		LONG LineY = (InnerY - 24) % GLYPH_LINE_PITCH;
+		BOOL InWord = ((InnerX / 6) % 9) != 0 && Mix((DWORD)(InnerX / 54) ^ (DWORD)((InnerY - 24) / GLYPH_LINE_PITCH) * 0x85EBCA6B ^ Layout->Seed) % 5 != 0;
+		if (InnerX >= 8 && LineY >= 4 && LineY < 14 && InWord && (Mix((DWORD)x ^ (DWORD)y * 0x27D4EB2F ^ Layout->Seed) & 3) == 0)
+		{
+			return 0xFF202020;
+		}
+		return Window->Color;
+	}
+	return Layout->Background;
+}
+
+
+static BYTE GetLuma(DWORD Color)
+{
+	DWORD Red = (Color >> 16) & 0xFF;
+	DWORD Green = (Color >> 8) & 0xFF;
+	DWORD Blue = Color & 0xFF;
+	return (BYTE)((Red * 77 + Green * 150 + Blue * 29) >> 8);
+}
+
+
+// Appends the RLE encoding of one row of indices, including its end of line, to Out. Runs of 3 or more equal indices
+// become encoded runs, everything else literal runs (or short encoded runs, where a literal run would be shorter than
+// the minimum of 3). Returns the number of bytes written, at most 2 * Width + 2.
+static SIZE_T EncodeRleRow(const BYTE *Indices, LONG Width, BOOL Rle4, BYTE *Out)
+{
+	BYTE *p = Out;
+	LONG x = 0;
+	while (x < Width)
+	{
+		LONG Run = 1;
+		while (x + Run < Width && Run < 255 && Indices[x + Run] == Indices[x]) ++Run;
+		if (Run >= 3)
+		{
+			*p++ = (BYTE)Run;
+			*p++ = Rle4 ? (BYTE)(Indices[x] << 4 | Indices[x]) : Indices[x];
+			x += Run;
+			continue;
+		}
+
+		// Extends the literal run up to the next run that is worth encoding.
+		LONG End = x;
+		while (End < Width && End - x < 255)
+		{
+			LONG Next = 1;
+			while (End + Next < Width && Next < 3 && Indices[End + Next] == Indices[End]) ++Next;
+			if (Next >= 3) break;
+			End += Next;
+		}
+		if (End - x > 255) End = x + 255;
+		LONG Length = End - x;
+		if (Length < 3)
+		{
+			for (; x < End; ++x)
+			{
+				*p++ = 1;
+				*p++ = Rle4 ? (BYTE)(Indices[x] << 4) : Indices[x];
+			}
+			continue;
+		}
+		*p++ = 0;
+		*p++ = (BYTE)Length;
+		SIZE_T Bytes = Rle4 ? (Length + 1) / 2 : Length;
+		memset(p, 0, (Bytes + 1) & ~(SIZE_T)1);
+		for (LONG i = 0; i < Length; ++i)
+		{
+			if (Rle4) p[i / 2] |= (BYTE)(Indices[x + i] << (i % 2 == 0 ? 4 : 0));
+			else p[i] = Indices[x + i];
+		}
+		p += (Bytes + 1) & ~(SIZE_T)1;
+		x = End;
+	}
+	*p++ = 0;
+	*p++ = 0;
+	return p - Out;
+}
+
+
+BYTE *GeneratePackedDIB(const DIB_PAYLOAD_SPEC *Spec, SIZE_T *SizeCb)
+{
+	LONG Width = Spec->Width;
+	LONG Height = Spec->Height < 0 ? -Spec->Height : Spec->Height;
+	WORD BitCount = Spec->BitCount;
+	if (Width <= 0 || Height <= 0) return nullptr;
+	BOOL Core = Spec->HeaderSize == DIB_HEADER_CORE;
+	BOOL Rle = Spec->Compression == BI_RLE4 || Spec->Compression == BI_RLE8;
+	if (Core && (Spec->Height < 0 || Spec->Compression != BI_RGB || Width > 0xFFFF || Height > 0xFFFF)) return nullptr;
+	if (Rle && (Spec->Height < 0 || BitCount != (Spec->Compression == BI_RLE4 ? 4 : 8))) return nullptr;
+
+	DWORD MaskCount = 0;
+	if (Spec->HeaderSize == DIB_HEADER_INFO && Spec->Compression == BI_BITFIELDS) MaskCount = 3;
+	if (Spec->HeaderSize == DIB_HEADER_INFO && Spec->Compression == BI_ALPHABITFIELDS) MaskCount = 4;
+	DWORD MaxColors = BitCount <= 8 ? 1u << BitCount : 0;
+	DWORD Colors = Spec->ClrUsed != 0 && Spec->ClrUsed < MaxColors ? Spec->ClrUsed : MaxColors;
+	SIZE_T ColorEntrySize = Core ? 3 : sizeof(RGBQUAD);
+	SIZE_T Stride = (((SIZE_T)Width * BitCount + 31) / 32) * 4;
+	SIZE_T PixelOffset = Spec->HeaderSize + MaskCount * sizeof(DWORD) + Colors * ColorEntrySize;
+	// RLE: every row at its worst, plus the end of bitmap. The size is corrected once the pixels are encoded.
+	SIZE_T PixelBytes = Rle ? ((SIZE_T)Width * 2 + 2) * Height + 2 : Stride * Height;
+	SIZE_T Size = PixelOffset + PixelBytes;
+	BYTE *Data = (BYTE *)calloc(1, Size);
+	if (Data == nullptr) return nullptr;
+	BYTE *Indices = Rle ? (BYTE *)malloc(Width) : nullptr;
+	if (Rle && Indices == nullptr)
+	{
+		free(Data);
+		return nullptr;
+	}
+
+	if (Core)
+	{
+		BITMAPCOREHEADER Header = {};
+		Header.bcSize = DIB_HEADER_CORE;
+		Header.bcWidth = (WORD)Width;
+		Header.bcHeight = (WORD)Height;
+		Header.bcPlanes = 1;
+		Header.bcBitCount = BitCount;
+		memcpy(Data, &Header, sizeof(Header));
+	}
+	else
+	{
+		BITMAPINFOHEADER Header = {};
+		Header.biSize = Spec->HeaderSize;
+		Header.biWidth = Width;
+		Header.biHeight = Spec->Height;
+		Header.biPlanes = 1;
+		Header.biBitCount = BitCount;
+		Header.biCompression = Spec->Compression;
+		Header.biSizeImage = (DWORD)(Stride * Height);
+		Header.biClrUsed = BitCount <= 8 ? (Colors < MaxColors ? Colors : 0) : 0;
+		memcpy(Data, &Header, sizeof(Header));
+	}
+
+	// Red, green, blue, alpha.
+	DWORD Masks[4] = { 0x00FF0000, 0x0000FF00, 0x000000FF, 0 };
+	if (BitCount == 16)
+	{
+		Masks[0] = 0xF800;
+		Masks[1] = 0x07E0;
+		Masks[2] = 0x001F;
+	}
+	BOOL HasAlpha = BitCount == 32 && (Spec->Compression == BI_ALPHABITFIELDS || (Spec->Compression == BI_BITFIELDS && Spec->HeaderSize >= DIB_HEADER_V5));
+	if (HasAlpha)
+	{
+		Masks[3] = 0xFF000000;
+	}
+	if (Spec->HeaderSize >= DIB_HEADER_V4)
+	{
+		for (int i = 0; i < 4; ++i)
+		{
+			WriteDword(Data + sizeof(BITMAPINFOHEADER) + i * sizeof(DWORD), Masks[i]);
+		}
+		WriteDword(Data + sizeof(BITMAPINFOHEADER) + 4 * sizeof(DWORD), CS_TYPE_SRGB);
+	}
+	for (DWORD i = 0; i < MaskCount; ++i)
+	{
+		WriteDword(Data + Spec->HeaderSize + i * sizeof(DWORD), Masks[i]);
+	}
+
+	// A slightly tinted gray ramp, indexed by luma. Blue, green, red, and for RGBQUADs a reserved 0.
+	BYTE *ColorTable = Data + Spec->HeaderSize + MaskCount * sizeof(DWORD);
+	for (DWORD i = 0; i < Colors; ++i)
+	{
+		BYTE Level = (BYTE)(Colors > 1 ? i * 255 / (Colors - 1) : 0);
+		ColorTable[i * ColorEntrySize + 0] = Level;
+		ColorTable[i * ColorEntrySize + 1] = Level;
+		ColorTable[i * ColorEntrySize + 2] = (BYTE)(Level > 0xF0 ? 0xFF : Level + 0x0F);
+	}
+
+	SCREEN_LAYOUT Layout;
+	InitScreenLayout(&Layout, Width, Height, Spec->Seed);
+	BYTE *RleEnd = Data + PixelOffset;
+	for (LONG Row = 0; Row < Height; ++Row)
+	{
+		LONG y = Spec->Height < 0 ? Row : Height - 1 - Row;
+		BYTE *Line = Data + PixelOffset + Row * Stride;
+		for (LONG x = 0; x < Width; ++x)
+		{
+			DWORD Color = GetScreenColor(&Layout, x, y);
+			switch (BitCount)
+			{
+				case 1:
+				case 4:
+				case 8:
+				{
+					DWORD Index = GetLuma(Color) * Colors / 256;
+					if (Rle)
+					{
+						Indices[x] = (BYTE)Index;
+						break;
+					}
+					SIZE_T Bit = (SIZE_T)x * BitCount;
+					Line[Bit / 8] |= (BYTE)(Index << (8 - BitCount - Bit % 8));
+					break;
+				}
+				case 16:
+				{
+					DWORD Red = (Color >> 16) & 0xFF;
+					DWORD Green = (Color >> 8) & 0xFF;
+					DWORD Blue = Color & 0xFF;
+					WORD Pixel = Spec->Compression == BI_RGB ? (WORD)(((Red >> 3) << 10) | ((Green >> 3) << 5) | (Blue >> 3)) : (WORD)(((Red >> 3) << 11) | ((Green >> 2) << 5) | (Blue >> 3));
+					memcpy(Line + x * 2, &Pixel, 2);
+					break;
+				}
+				case 24:
+				{
+					Line[x * 3 + 0] = (BYTE)Color;
+					Line[x * 3 + 1] = (BYTE)(Color >> 8);
+					Line[x * 3 + 2] = (BYTE)(Color >> 16);
+					break;
+				}
+				case 32:
+				{
+					// Without alpha, the fourth byte is 0, as in most screenshots. With it, some columns are translucent.
+					DWORD Pixel = Color & 0x00FFFFFF;
+					if (HasAlpha)
+					{
+						Pixel |= (x % 97 < 4 ? 0x80u : 0xFFu) << 24;
+					}
+					WriteDword(Line + x * 4, Pixel);
+					break;
+				}
+			}
+		}
+		if (Rle)
+		{
+			RleEnd += EncodeRleRow(Indices, Width, Spec->Compression == BI_RLE4, RleEnd);
+		}
+	}
+
+	if (Rle)
+	{
+		// The last end of line is replaced by the end of bitmap.
+		RleEnd[-1] = 1;
+		Size = RleEnd - Data;
+		((BITMAPINFOHEADER *)Data)->biSizeImage = (DWORD)(Size - PixelOffset);
+		free(Indices);
+	}
+	*SizeCb = Size;
+	return Data;
+}
+
+
+// libpng's default; the decoder has to join the chunks.
+#define PNG_IDAT_CHUNK_SIZE 8192
+#define DEFLATE_WINDOW_SIZE 32768
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_MAX_PROBES 8
+#define DEFLATE_MAX_STORED 65535
+
+static const WORD LengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const BYTE LengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const WORD DistanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const BYTE DistanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const BYTE Adam7[7][4] = // First x, first y, step x, step y.
+{
+	{ 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 }, { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 },
+};
+
+
+static void WriteBigEndian(BYTE *p, DWORD Value)
+{
+	p[0] = (BYTE)(Value >> 24);
+	p[1] = (BYTE)(Value >> 16);
+	p[2] = (BYTE)(Value >> 8);
+	p[3] = (BYTE)Value;
+}
+
+
+static DWORD UpdateCrc32(DWORD Crc, const BYTE *Data, SIZE_T SizeCb)
+{
+	Crc = ~Crc;
+	for (SIZE_T i = 0; i < SizeCb; ++i)
+	{
+		Crc ^= Data[i];
+		for (int Bit = 0; Bit < 8; ++Bit) Crc = (Crc >> 1) ^ (0xEDB88320 & (0 - (Crc & 1)));
+	}
+	return ~Crc;
+}
+
+
+static DWORD ComputeAdler32(const BYTE *Data, SIZE_T SizeCb)
+{
+	DWORD a = 1, b = 0;
+	for (SIZE_T i = 0; i < SizeCb; ++i)
+	{
+		a = (a + Data[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	return (b << 16) | a;
+}
+
+
+// Writes a chunk with its length and CRC at p, and returns the end.
+static BYTE *WriteChunk(BYTE *p, const char *Type, const BYTE *Data, SIZE_T SizeCb)
+{
+	WriteBigEndian(p, (DWORD)SizeCb);
+	memcpy(p + 4, Type, 4);
+	if (SizeCb != 0) memcpy(p + 8, Data, SizeCb);
+	WriteBigEndian(p + 8 + SizeCb, UpdateCrc32(0, p + 4, SizeCb + 4));
+	return p + 12 + SizeCb;
+}
+
+
+struct BIT_WRITER
+{
+	BYTE *Out;
+	ULONGLONG Bits;
+	UINT BitCount;
+};
+
+
+static void PutBits(BIT_WRITER *Writer, DWORD Value, UINT Count)
+{
+	Writer->Bits |= (ULONGLONG)Value << Writer->BitCount;
+	Writer->BitCount += Count;
+	while (Writer->BitCount >= 8)
+	{
+		*Writer->Out++ = (BYTE)Writer->Bits;
+		Writer->Bits >>= 8;
+		Writer->BitCount -= 8;
+	}
+}
+
+
+// Huffman codes go out starting with their most significant bit.
+static void PutCode(BIT_WRITER *Writer, DWORD Code, UINT Length)
+{
+	DWORD Reversed = 0;
+	for (UINT i = 0; i < Length; ++i) Reversed |= ((Code >> i) & 1) << (Length - 1 - i);
+	PutBits(Writer, Reversed, Length);
+}
+
+
+static void PutFixedLiteral(BIT_WRITER *Writer, UINT Symbol)
+{
+	if (Symbol < 144) PutCode(Writer, 0x30 + Symbol, 8);
+	else if (Symbol < 256) PutCode(Writer, 0x190 + Symbol - 144, 9);
+	else if (Symbol < 280) PutCode(Writer, Symbol - 256, 7);
+	else PutCode(Writer, 0xC0 + Symbol - 280, 8);
+}
+
+
+static void PutFixedMatch(BIT_WRITER *Writer, UINT Length, UINT Distance)
+{
+	UINT Code = 28;
+	while (LengthBase[Code] > Length) --Code;
+	PutFixedLiteral(Writer, 257 + Code);
+	PutBits(Writer, Length - LengthBase[Code], LengthExtra[Code]);
+	Code = 29;
+	while (DistanceBase[Code] > Distance) --Code;
+	PutCode(Writer, Code, 5);
+	PutBits(Writer, Distance - DistanceBase[Code], DistanceExtra[Code]);
+}
+
+
+// The most ZlibCompress can produce: a literal takes at most 9 bits, and no match takes more than its literals would.
+static SIZE_T CompressBound(SIZE_T SizeCb)
+{
+	return SizeCb + SizeCb / 8 + (SizeCb / DEFLATE_MAX_STORED + 1) * 5 + 16;
+}
+
+
+// Compresses Data into a zlib stream at Out, which must have room for CompressBound, and returns its size, or 0 if out
+// of memory. Stored blocks, or one block with the fixed Huffman codes and greedy matches from a short hash chain, about
+// what zlib does at its fastest level.
+static SIZE_T ZlibCompress(const BYTE *Data, SIZE_T SizeCb, BOOL Store, BYTE *Out)
+{
+	BIT_WRITER Writer = { Out + 2, 0, 0 };
+	Out[0] = 0x78;
+	Out[1] = 0x01;
+	if (Store)
+	{
+		SIZE_T Offset = 0;
+		do
+		{
+			SIZE_T BlockSize = SizeCb - Offset < DEFLATE_MAX_STORED ? SizeCb - Offset : DEFLATE_MAX_STORED;
+			PutBits(&Writer, Offset + BlockSize == SizeCb ? 1 : 0, 3);
+			PutBits(&Writer, 0, (8 - Writer.BitCount) % 8);
+			PutBits(&Writer, (DWORD)BlockSize, 16);
+			PutBits(&Writer, (DWORD)BlockSize ^ 0xFFFF, 16);
+			memcpy(Writer.Out, Data + Offset, BlockSize);
+			Writer.Out += BlockSize;
+			Offset += BlockSize;
+		} while (Offset < SizeCb);
+	}
+	else
+	{
+		LONG *Head = (LONG *)malloc(sizeof(LONG) << DEFLATE_HASH_BITS);
+		LONG *Previous = (LONG *)malloc(sizeof(LONG) * DEFLATE_WINDOW_SIZE);
+		if (Head == nullptr || Previous == nullptr)
+		{
+			free(Head);
+			free(Previous);
+			return 0;
+		}
+		memset(Head, 0xFF, sizeof(LONG) << DEFLATE_HASH_BITS);
+		PutBits(&Writer, 1 | (1 << 1), 3);
+		SIZE_T i = 0;
+		while (i < SizeCb)
+		{
+			UINT BestLength = 0;
+			UINT BestDistance = 0;
+			if (SizeCb - i >= DEFLATE_MIN_MATCH)
+			{
+				DWORD Hash = ((DWORD)Data[i] << 16 | (DWORD)Data[i + 1] << 8 | Data[i + 2]) * 0x9E3779B1 >> (32 - DEFLATE_HASH_BITS);
+				UINT MaxLength = SizeCb - i < DEFLATE_MAX_MATCH ? (UINT)(SizeCb - i) : DEFLATE_MAX_MATCH;
+				LONG Candidate = Head[Hash];
+				for (UINT Probe = 0; Probe < DEFLATE_MAX_PROBES && Candidate >= 0 && i - Candidate <= DEFLATE_WINDOW_SIZE; ++Probe)
+				{
+					UINT Length = 0;
+					while (Length < MaxLength && Data[Candidate + Length] == Data[i + Length]) ++Length;
+					if (Length > BestLength)
+					{
+						BestLength = Length;
+						BestDistance = (UINT)(i - Candidate);
+						if (Length == MaxLength) break;
+					}
+					LONG Next = Previous[Candidate % DEFLATE_WINDOW_SIZE];
+					if (Next >= Candidate) break;
+					Candidate = Next;
+				}
+				Previous[i % DEFLATE_WINDOW_SIZE] = Head[Hash];
+				Head[Hash] = (LONG)i;
+			}
+			if (BestLength >= DEFLATE_MIN_MATCH)
+			{
+				PutFixedMatch(&Writer, BestLength, BestDistance);
+				// The positions inside the match are not hashed, like zlib's fast mode.
+				i += BestLength;
+			}
+			else
+			{
+				PutFixedLiteral(&Writer, Data[i]);
+				++i;
+			}
+		}
+		PutFixedLiteral(&Writer, 256);
+		free(Head);
+		free(Previous);
+	}
+	PutBits(&Writer, 0, (8 - Writer.BitCount) % 8);
+	WriteBigEndian(Writer.Out, ComputeAdler32(Data, SizeCb));
+	return Writer.Out + 4 - Out;
+}
+
+
+static BYTE PaethPredictor(BYTE a, BYTE b, BYTE c)
+{
+	int p = a + b - c;
+	int pa = abs(p - a);
+	int pb = abs(p - b);
+	int pc = abs(p - c);
+	if (pa <= pb && pa <= pc) return a;
+	return pb <= pc ? b : c;
+}
+
+
+// Filters Row (against Prior, the row above in the same pass) into Out, which has room for the filter byte.
+static void FilterRow(BYTE Filter, const BYTE *Row, const BYTE *Prior, BYTE *Out, SIZE_T RowSizeCb, UINT PixelSizeCb)
+{
+	Out[0] = Filter;
+	for (SIZE_T i = 0; i < RowSizeCb; ++i)
+	{
+		BYTE a = i >= PixelSizeCb ? Row[i - PixelSizeCb] : 0;
+		BYTE b = Prior[i];
+		BYTE c = i >= PixelSizeCb ? Prior[i - PixelSizeCb] : 0;
+		BYTE Predicted = 0;
+		switch (Filter)
+		{
+			case 1: Predicted = a; break;
+			case 2: Predicted = b; break;
+			case 3: Predicted = (BYTE)((a + b) / 2); break;
+			case 4: Predicted = PaethPredictor(a, b, c); break;
+		}
+		Out[1 + i] = (BYTE)(Row[i] - Predicted);
+	}
+}
+
+
+// The filter with the smallest sum of the filtered bytes as signed values, the heuristic libpng uses.
+static BYTE ChooseFilter(const BYTE *Row, const BYTE *Prior, BYTE *Scratch, SIZE_T RowSizeCb, UINT PixelSizeCb)
+{
+	BYTE Best = 0;
+	ULONGLONG BestSum = ~0ull;
+	for (BYTE Filter = 0; Filter <= 4; ++Filter)
+	{
+		FilterRow(Filter, Row, Prior, Scratch, RowSizeCb, PixelSizeCb);
+		ULONGLONG Sum = 0;
+		for (SIZE_T i = 1; i <= RowSizeCb; ++i) Sum += Scratch[i] < 128 ? Scratch[i] : 256 - Scratch[i];
+		if (Sum < BestSum)
+		{
+			Best = Filter;
+			BestSum = Sum;
+		}
+	}
+	return Best;
+}
+
+
+static UINT GetPngChannels(BYTE ColorType)
+{
+	switch (ColorType)
+	{
+		case PNG_RGB: return 3;
+		case PNG_GRAY_ALPHA: return 2;
+		case PNG_RGBA: return 4;
+	}
+	return 1;
+}
+
+
+// The samples of one pixel, scaled to the bit depth. Alpha is translucent in the same columns as in DIBs with alpha.
+static void GetPngSamples(const PNG_PAYLOAD_SPEC *Spec, const SCREEN_LAYOUT *Layout, LONG x, LONG y, WORD *Samples)
+{
+	DWORD Color = GetScreenColor(Layout, x, y);
+	WORD Alpha = x % 97 < 4 ? 0x80 : 0xFF;
+	WORD Red = (Color >> 16) & 0xFF;
+	WORD Green = (Color >> 8) & 0xFF;
+	WORD Blue = Color & 0xFF;
+	WORD Luma = GetLuma(Color);
+	switch (Spec->ColorType)
+	{
+		case PNG_GRAY: Samples[0] = Luma; break;
+		case PNG_PALETTE: Samples[0] = (WORD)(Luma * (1u << Spec->BitDepth) / 256); return;
+		case PNG_GRAY_ALPHA: Samples[0] = Luma; Samples[1] = Alpha; break;
+		case PNG_RGB: Samples[0] = Red; Samples[1] = Green; Samples[2] = Blue; break;
+		case PNG_RGBA: Samples[0] = Red; Samples[1] = Green; Samples[2] = Blue; Samples[3] = Alpha; break;
+	}
+	for (UINT i = 0; i < GetPngChannels(Spec->ColorType); ++i)
+	{
+		Samples[i] = Spec->BitDepth == 16 ? Samples[i] * 257 : Samples[i] >> (8 - Spec->BitDepth);
+	}
+}
+
+
+// Packs the pixels of one row of a pass, big endian and the first pixel in the highest bits, as PNG stores them.
+static void PackPngRow(const PNG_PAYLOAD_SPEC *Spec, const SCREEN_LAYOUT *Layout, LONG y, LONG FirstX, LONG StepX, BYTE *Row, SIZE_T RowSizeCb)
+{
+	UINT Channels = GetPngChannels(Spec->ColorType);
+	memset(Row, 0, RowSizeCb);
+	SIZE_T Bit = 0;
+	for (LONG x = FirstX; x < Spec->Width; x += StepX)
+	{
+		WORD Samples[4];
+		GetPngSamples(Spec, Layout, x, y, Samples);
+		for (UINT i = 0; i < Channels; ++i, Bit += Spec->BitDepth)
+		{
+			if (Spec->BitDepth == 16)
+			{
+				Row[Bit / 8] = (BYTE)(Samples[i] >> 8);
+				Row[Bit / 8 + 1] = (BYTE)Samples[i];
+			}
+			else
+			{
+				Row[Bit / 8] |= (BYTE)(Samples[i] << (8 - Spec->BitDepth - Bit % 8));
+			}
+		}
+	}
+}
+
+
+BYTE *GeneratePng(const PNG_PAYLOAD_SPEC *Spec, SIZE_T *SizeCb)
+{
+	LONG Width = Spec->Width;
+	LONG Height = Spec->Height;
+	BYTE Depth = Spec->BitDepth;
+	if (Width <= 0 || Height <= 0 || Spec->Filter > PNG_FILTER_ADAPTIVE) return nullptr;
+	BOOL ValidDepth;
+	switch (Spec->ColorType)
+	{
+		case PNG_GRAY: ValidDepth = Depth == 1 || Depth == 2 || Depth == 4 || Depth == 8 || Depth == 16; break;
+		case PNG_PALETTE: ValidDepth = Depth == 1 || Depth == 2 || Depth == 4 || Depth == 8; break;
+		case PNG_RGB: case PNG_GRAY_ALPHA: case PNG_RGBA: ValidDepth = Depth == 8 || Depth == 16; break;
+		default: ValidDepth = false; break;
+	}
+	if (!ValidDepth) return nullptr;
+
+	UINT BitsPerPixel = GetPngChannels(Spec->ColorType) * Depth;
+	UINT PixelSizeCb = BitsPerPixel >= 8 ? BitsPerPixel / 8 : 1;
+	SIZE_T MaxRowSizeCb = ((SIZE_T)Width * BitsPerPixel + 7) / 8;
+	// With Adam7, each pass has its own rows, each with its filter byte; at most 7 more per image row.
+	SIZE_T FilteredSizeCb = 0;
+	UINT PassCount = Spec->Interlaced ? 7 : 1;
+	for (UINT Pass = 0; Pass < PassCount; ++Pass)
+	{
+		LONG FirstX = Spec->Interlaced ? Adam7[Pass][0] : 0, FirstY = Spec->Interlaced ? Adam7[Pass][1] : 0;
+		LONG StepX = Spec->Interlaced ? Adam7[Pass][2] : 1, StepY = Spec->Interlaced ? Adam7[Pass][3] : 1;
+		if (FirstX >= Width || FirstY >= Height) continue;
+		SIZE_T PassWidth = (Width - FirstX + StepX - 1) / StepX;
+		SIZE_T PassHeight = (Height - FirstY + StepY - 1) / StepY;
+		FilteredSizeCb += PassHeight * (1 + (PassWidth * BitsPerPixel + 7) / 8);
+	}
+	BYTE *Filtered = (BYTE *)malloc(FilteredSizeCb);
+	BYTE *Rows = (BYTE *)calloc(3, MaxRowSizeCb + 1);
+	if (Filtered == nullptr || Rows == nullptr)
+	{
+		free(Filtered);
+		free(Rows);
+		return nullptr;
+	}
+
+	SCREEN_LAYOUT Layout;
+	InitScreenLayout(&Layout, Width, Height, Spec->Seed);
+	BYTE *Out = Filtered;
+	for (UINT Pass = 0; Pass < PassCount; ++Pass)
+	{
+		LONG FirstX = Spec->Interlaced ? Adam7[Pass][0] : 0, FirstY = Spec->Interlaced ? Adam7[Pass][1] : 0;
+		LONG StepX = Spec->Interlaced ? Adam7[Pass][2] : 1, StepY = Spec->Interlaced ? Adam7[Pass][3] : 1;
+		if (FirstX >= Width || FirstY >= Height) continue;
+		SIZE_T RowSizeCb = (((Width - FirstX + StepX - 1) / StepX) * (SIZE_T)BitsPerPixel + 7) / 8;
+		BYTE *Row = Rows;
+		BYTE *Prior = Rows + MaxRowSizeCb + 1;
+		memset(Prior, 0, RowSizeCb);
+		for (LONG y = FirstY, Index = 0; y < Height; y += StepY, ++Index)
+		{
+			PackPngRow(Spec, &Layout, y, FirstX, StepX, Row, RowSizeCb);
+			BYTE Filter = Spec->Filter;
+			if (Filter == PNG_FILTER_ADAPTIVE) Filter = ChooseFilter(Row, Prior, Rows + 2 * (MaxRowSizeCb + 1), RowSizeCb, PixelSizeCb);
+			FilterRow(Filter, Row, Prior, Out, RowSizeCb, PixelSizeCb);
+			Out += 1 + RowSizeCb;
+			BYTE *Swap = Row;
+			Row = Prior;
+			Prior = Swap;
+		}
+	}
+	free(Rows);
+
+	// The palette is the same slightly tinted gray ramp as in the DIBs. With Transparency, the background around the
+	// windows becomes transparent, like in a screenshot of a single window: its palette entry, or it is the key color.
+	BYTE Palette[256 * 3];
+	UINT PaletteSize = Spec->ColorType == PNG_PALETTE ? 1u << Depth : 0;
+	for (UINT i = 0; i < PaletteSize; ++i)
+	{
+		BYTE Level = (BYTE)(PaletteSize > 1 ? i * 255 / (PaletteSize - 1) : 0);
+		Palette[i * 3 + 0] = (BYTE)(Level > 0xF0 ? 0xFF : Level + 0x0F);
+		Palette[i * 3 + 1] = Level;
+		Palette[i * 3 + 2] = Level;
+	}
+	// The background is gray, so its luma is the same as each of its components.
+	BYTE Background = GetLuma(Layout.Background);
+	BYTE Transparency[256];
+	SIZE_T TransparencySizeCb = 0;
+	if (Spec->Transparency && Spec->ColorType == PNG_PALETTE)
+	{
+		TransparencySizeCb = Background * PaletteSize / 256 + 1;
+		memset(Transparency, 0xFF, TransparencySizeCb - 1);
+		Transparency[TransparencySizeCb - 1] = 0;
+	}
+	else if (Spec->Transparency && (Spec->ColorType == PNG_GRAY || Spec->ColorType == PNG_RGB))
+	{
+		WORD Key = Depth == 16 ? Background * 257 : Background >> (8 - Depth);
+		TransparencySizeCb = Spec->ColorType == PNG_GRAY ? 2 : 6;
+		for (SIZE_T i = 0; i < TransparencySizeCb; i += 2)
+		{
+			Transparency[i] = (BYTE)(Key >> 8);
+			Transparency[i + 1] = (BYTE)Key;
+		}
+	}
+
+	BYTE *Compressed = (BYTE *)malloc(CompressBound(FilteredSizeCb));
+	SIZE_T CompressedSizeCb = Compressed != nullptr ? ZlibCompress(Filtered, FilteredSizeCb, Spec->Compression == PNG_COMPRESSION_STORED, Compressed) : 0;
+	free(Filtered);
+	SIZE_T IdatCount = (CompressedSizeCb + PNG_IDAT_CHUNK_SIZE - 1) / PNG_IDAT_CHUNK_SIZE;
+	SIZE_T Size = PNG_SIGNATURE_SIZE + (12 + 13) + (12 + PaletteSize * 3) + (12 + TransparencySizeCb) + IdatCount * 12 + CompressedSizeCb + 12;
+	BYTE *Data = CompressedSizeCb != 0 ? (BYTE *)malloc(Size) : nullptr;
+	if (Data == nullptr)
+	{
+		free(Compressed);
+		return nullptr;
+	}
+
+	static const BYTE Signature[PNG_SIGNATURE_SIZE] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	memcpy(Data, Signature, PNG_SIGNATURE_SIZE);
+	BYTE Header[13];
+	WriteBigEndian(Header, (DWORD)Width);
+	WriteBigEndian(Header + 4, (DWORD)Height);
+	Header[8] = Depth;
+	Header[9] = Spec->ColorType;
+	Header[10] = 0;
+	Header[11] = 0;
+	Header[12] = Spec->Interlaced ? 1 : 0;
+	BYTE *p = WriteChunk(Data + PNG_SIGNATURE_SIZE, "IHDR", Header, sizeof(Header));
+	if (PaletteSize != 0) p = WriteChunk(p, "PLTE", Palette, PaletteSize * 3);
+	if (TransparencySizeCb != 0) p = WriteChunk(p, "tRNS", Transparency, TransparencySizeCb);
+	for (SIZE_T Offset = 0; Offset < CompressedSizeCb; Offset += PNG_IDAT_CHUNK_SIZE)
+	{
+		p = WriteChunk(p, "IDAT", Compressed + Offset, CompressedSizeCb - Offset < PNG_IDAT_CHUNK_SIZE ? CompressedSizeCb - Offset : PNG_IDAT_CHUNK_SIZE);
+	}
+	p = WriteChunk(p, "IEND", nullptr, 0);
+	free(Compressed);
+	*SizeCb = p - Data;
+	return Data;
+}
+
+
+static const char *const AsciiWords[] =
+{
+	"the", "clipboard", "monitor", "shows", "what", "was", "copied", "last", "and", "keeps", "a", "history", "of", "it",
+	"text", "image", "format", "window", "data", "is", "not", "read", "until", "needed", "to", "for", "with", "every",
+	"change", "in", "on", "at", "from", "by", "value", "result", "error", "request", "response", "buffer", "size",
+};
+
+static const WCHAR Word_Groesse[] = { 'G', 'r', 0x00F6, 0x00DF, 'e', 0 };
+static const WCHAR Word_Cafe[] = { 'c', 'a', 'f', 0x00E9, 0 };
+static const WCHAR Word_Nihongo[] = { 0x65E5, 0x672C, 0x8A9E, 0 };
+static const WCHAR Word_Tekisuto[] = { 0x30C6, 0x30AD, 0x30B9, 0x30C8, 0 };
+static const WCHAR Word_Ellinika[] = { 0x0395, 0x03BB, 0x03BB, 0x03B7, 0x03BD, 0x03B9, 0x03BA, 0x03AC, 0 };
+static const WCHAR Word_Emoji[] = { 0xD83D, 0xDE00, 0 };
+static const WCHAR Word_Fraktur[] = { 0xD835, 0xDD18, 0xD835, 0xDD2B, 0 };
+
+static const WCHAR *const OtherWords[] =
+{
+	Word_Groesse, Word_Cafe, Word_Nihongo, Word_Tekisuto, Word_Ellinika, Word_Emoji, Word_Fraktur,
+};
+
+static const char *const CodeTokens[] =
+{
+	"if", "(", ")", "{", "}", "return", "Buffer", "->", "SizeCb", "=", "==", "nullptr", ";", "for", "++i", "Length",
+	"Index", "+", "*", "const", "BYTE", "UINT", "Count", "<", "0", "1", ",", "Data", "[", "]",
+};
+
+static const char *const LogLevels[] = { "INFO", "WARN", "DEBUG", "ERROR" };
+static const char Base64Digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+
+struct TEXT_WRITER
+{
+	WCHAR *Text;
+	SIZE_T Length;
+	SIZE_T Capacity;
+};
+
+
+static void PutChar(TEXT_WRITER *Writer, WCHAR c)
+{
+	if (Writer->Length < Writer->Capacity)
+	{
+		Writer->Text[Writer->Length++] = c;
+	}
+}
+
+
+static void PutAscii(TEXT_WRITER *Writer, const char *s)
+{
+	while (*s != 0) PutChar(Writer, (WCHAR)(BYTE)*s++);
+}
+
+
+static void PutWide(TEXT_WRITER *Writer, const WCHAR *s)
+{
+	while (*s != 0) PutChar(Writer, *s++);
+}
+
+
+static void PutNumber(TEXT_WRITER *Writer, DWORD Value, int Digits)
+{
+	char Buffer[16];
+	for (int i = Digits - 1; i >= 0; --i)
+	{
+		Buffer[i] = (char)('0' + Value % 10);
+		Value /= 10;
+	}
+	Buffer[Digits] = 0;
+	PutAscii(Writer, Buffer);
+}
+
+
+static void PutWord(TEXT_WRITER *Writer, DWORD *State)
+{
+	if (RandomBelow(State, 40) == 0)
+	{
+		PutWide(Writer, OtherWords[RandomBelow(State, sizeof(OtherWords) / sizeof(OtherWords[0]))]);
+	}
+	else
+	{
+		PutAscii(Writer, AsciiWords[RandomBelow(State, sizeof(AsciiWords) / sizeof(AsciiWords[0]))]);
+	}
+}
+
+
+static void PutProseLine(TEXT_WRITER *Writer, DWORD *State, DWORD WordCount)
+{
+	for (DWORD i = 0; i < WordCount; ++i)
+	{
+		if (i > 0)
+		{
+			if (RandomBelow(State, 12) == 0) PutChar(Writer, ',');
+			PutChar(Writer, ' ');
+		}
+		PutWord(Writer, State);
+	}
+	if (WordCount > 0) PutChar(Writer, '.');
+}
+
+
+static void PutCodeLine(TEXT_WRITER *Writer, DWORD *State)
+{
+	DWORD Depth = RandomBelow(State, 5);
+	for (DWORD i = 0; i < Depth; ++i) PutChar(Writer, '\t');
+	DWORD TokenCount = 1 + RandomBelow(State, 14);
+	for (DWORD i = 0; i < TokenCount; ++i)
+	{
+		if (i > 0) PutChar(Writer, ' ');
+		PutAscii(Writer, CodeTokens[RandomBelow(State, sizeof(CodeTokens) / sizeof(CodeTokens[0]))]);
+	}
+}
+
+
+static void PutLogLine(TEXT_WRITER *Writer, DWORD *State, DWORD Sequence)
+{
+	PutAscii(Writer, "2026-10-18 ");
+	PutNumber(Writer, Sequence / 3600000 % 24, 2);
+	PutChar(Writer, ':');
+	PutNumber(Writer, Sequence / 60000 % 60, 2);
+	PutChar(Writer, ':');
+	PutNumber(Writer, Sequence / 1000 % 60, 2);
+	PutChar(Writer, '.');
+	PutNumber(Writer, Sequence % 1000, 3);
+	PutAscii(Writer, " [");
+	PutAscii(Writer, LogLevels[RandomBelow(State, 4)]);
+	PutAscii(Writer, "] worker-");
+	PutNumber(Writer, RandomBelow(State, 16), 2);
+	PutAscii(Writer, ": ");
+	PutProseLine(Writer, State, 2 + RandomBelow(State, 8));
+	PutAscii(Writer, " id=");
+	PutNumber(Writer, NextRandom(State) % 100000000, 8);
+}
+
+
+// Something like an embedded blob or minified data: long, and without line breaks.
+static void PutLongLine(TEXT_WRITER *Writer, DWORD *State)
+{
+	DWORD Length = 2000 + RandomBelow(State, 18000);
+	for (DWORD i = 0; i < Length; ++i)
+	{
+		PutChar(Writer, (WCHAR)Base64Digits[RandomBelow(State, 64)]);
+	}
+}
+
+
+// Returns Length characters of text, followed by a 0.
+WCHAR *GenerateText(SIZE_T Length, DWORD Seed)
+{
+	TEXT_WRITER Writer = {};
+	Writer.Text = (WCHAR *)malloc((Length + 1) * sizeof(WCHAR));
+	if (Writer.Text == nullptr) return nullptr;
+	Writer.Capacity = Length;
+
+	DWORD State = InitRandom(Seed);
+	DWORD Sequence = RandomBelow(&State, 86400000);
+	while (Writer.Length < Writer.Capacity)
+	{
+		DWORD Kind = RandomBelow(&State, 100);
+		if (Kind < 40)
+		{
+			PutProseLine(&Writer, &State, 3 + RandomBelow(&State, 25));
+		}
+		else if (Kind < 65)
+		{
+			PutCodeLine(&Writer, &State);
+		}
+		else if (Kind < 80)
+		{
+			Sequence += RandomBelow(&State, 5000);
+			PutLogLine(&Writer, &State, Sequence);
+		}
+		else if (Kind < 95)
+		{
+			PutProseLine(&Writer, &State, RandomBelow(&State, 4));
+		}
+		else
+		{
+			PutLongLine(&Writer, &State);
+		}
+		if (RandomBelow(&State, 10) != 0) PutChar(&Writer, '\r');
+		PutChar(&Writer, '\n');
+	}
+	// Do not end in the middle of a surrogate pair.
+	if (Length > 0 && Writer.Text[Length - 1] >= 0xD800 && Writer.Text[Length - 1] < 0xDC00)
+	{
+		Writer.Text[Length - 1] = '.';
+	}
+	Writer.Text[Length] = 0;
+	return Writer.Text;
+}
+
+
+struct BYTE_WRITER
+{
+	BYTE *Data;
+	SIZE_T SizeCb;
+	SIZE_T Capacity;
+	BOOL Failed;
+};
+
+
+static void PutBytes(BYTE_WRITER *Writer, const void *Bytes, SIZE_T SizeCb)
+{
+	if (Writer->SizeCb + SizeCb > Writer->Capacity)
+	{
+		SIZE_T Capacity = Writer->Capacity * 2 > Writer->SizeCb + SizeCb ? Writer->Capacity * 2 : Writer->SizeCb + SizeCb + 4096;
+		BYTE *Data = Writer->Failed ? nullptr : (BYTE *)realloc(Writer->Data, Capacity);
+		if (Data == nullptr)
+		{
+			Writer->Failed = true;
+			return;
+		}
+		Writer->Data = Data;
+		Writer->Capacity = Capacity;
+	}
+	memcpy(Writer->Data + Writer->SizeCb, Bytes, SizeCb);
+	Writer->SizeCb += SizeCb;
+}
+
+
+static void PutString(BYTE_WRITER *Writer, const char *s)
+{
+	PutBytes(Writer, s, strlen(s));
+}
+
+
+static void PutByte(BYTE_WRITER *Writer, BYTE b)
+{
+	PutBytes(Writer, &b, 1);
+}
+
+
+static void PutSigned(BYTE_WRITER *Writer, LONG Value)
+{
+	char Buffer[16];
+	int i = sizeof(Buffer);
+	DWORD Magnitude = Value < 0 ? 0u - (DWORD)Value : (DWORD)Value;
+	do
+	{
+		Buffer[--i] = (char)('0' + Magnitude % 10);
+		Magnitude /= 10;
+	} while (Magnitude != 0);
+	if (Value < 0) Buffer[--i] = '-';
+	PutBytes(Writer, Buffer + i, sizeof(Buffer) - i);
+}
+
+
+static void PutUtf8(BYTE_WRITER *Writer, DWORD c)
+{
+	BYTE Bytes[4];
+	if (c < 0x80)
+	{
+		PutByte(Writer, (BYTE)c);
+		return;
+	}
+	if (c < 0x800)
+	{
+		Bytes[0] = (BYTE)(0xC0 | c >> 6);
+		Bytes[1] = (BYTE)(0x80 | (c & 0x3F));
+		PutBytes(Writer, Bytes, 2);
+	}
+	else if (c < 0x10000)
+	{
+		Bytes[0] = (BYTE)(0xE0 | c >> 12);
+		Bytes[1] = (BYTE)(0x80 | (c >> 6 & 0x3F));
+		Bytes[2] = (BYTE)(0x80 | (c & 0x3F));
+		PutBytes(Writer, Bytes, 3);
+	}
+	else
+	{
+		Bytes[0] = (BYTE)(0xF0 | c >> 18);
+		Bytes[1] = (BYTE)(0x80 | (c >> 12 & 0x3F));
+		Bytes[2] = (BYTE)(0x80 | (c >> 6 & 0x3F));
+		Bytes[3] = (BYTE)(0x80 | (c & 0x3F));
+		PutBytes(Writer, Bytes, 4);
+	}
+}
+
+
+static BYTE *FinishPayload(BYTE_WRITER *Writer, SIZE_T *SizeCb)
+{
+	PutByte(Writer, 0);
+	if (Writer->Failed)
+	{
+		free(Writer->Data);
+		return nullptr;
+	}
+	*SizeCb = Writer->SizeCb;
+	return Writer->Data;
+}
+
+
+// Writes Value as the ten digits that the CF_HTML header has room for.
+static void WriteHtmlOffset(BYTE *p, SIZE_T Value)
+{
+	for (int i = 9; i >= 0; --i)
+	{
+		p[i] = (BYTE)('0' + Value % 10);
+		Value /= 10;
+	}
+}
+
+
+// CF_HTML around Length characters of GenerateText, like a browser puts it on the clipboard: a paragraph or <pre> per
+// line, with some bold text and links, and a header with correct offsets. Ends with a zero byte, which is included in
+// SizeCb.
+BYTE *GenerateHtmlFormat(SIZE_T Length, DWORD Seed, SIZE_T *SizeCb)
+{
+	WCHAR *Text = GenerateText(Length, Seed);
+	if (Text == nullptr) return nullptr;
+	BYTE_WRITER Writer = {};
+	static const char *const OffsetNames[] = { "StartHTML:", "EndHTML:", "StartFragment:", "EndFragment:" };
+	SIZE_T OffsetPositions[4];
+	PutString(&Writer, "Version:0.9\r\n");
+	for (UINT i = 0; i < 4; ++i)
+	{
+		PutString(&Writer, OffsetNames[i]);
+		OffsetPositions[i] = Writer.SizeCb;
+		PutString(&Writer, "0000000000\r\n");
+	}
+	PutString(&Writer, "SourceURL:https://example.com/articles/clipboard-history\r\n");
+	SIZE_T Offsets[4];
+	Offsets[0] = Writer.SizeCb;
+	PutString(&Writer, "<html>\r\n<body>\r\n<!--StartFragment-->");
+	Offsets[2] = Writer.SizeCb;
+
+	DWORD State = InitRandom(Seed);
+	SIZE_T i = 0;
+	while (i < Length)
+	{
+		BOOL Pre = RandomBelow(&State, 4) == 0;
+		BOOL Bold = false;
+		PutString(&Writer, Pre ? "<pre>" : "<p>");
+		if (!Pre && RandomBelow(&State, 50) == 0)
+		{
+			PutString(&Writer, "<a href=\"https://example.com/docs?page=2&amp;section=4\">see also</a> ");
+		}
+		for (; i < Length && Text[i] != '\r' && Text[i] != '\n'; ++i)
+		{
+			WCHAR c = Text[i];
+			if (c == ' ' && !Pre && RandomBelow(&State, 30) == 0)
+			{
+				PutString(&Writer, Bold ? "</b> " : " <b>");
+				Bold = !Bold;
+			}
+			else if (c == '&') PutString(&Writer, "&amp;");
+			else if (c == '<') PutString(&Writer, "&lt;");
+			else if (c == '>') PutString(&Writer, "&gt;");
+			else if (c >= 0xD800 && c < 0xDC00 && i + 1 < Length && Text[i + 1] >= 0xDC00 && Text[i + 1] < 0xE000)
+			{
+				PutUtf8(&Writer, 0x10000 + ((DWORD)(c - 0xD800) << 10) + (Text[i + 1] - 0xDC00));
+				++i;
+			}
+			else PutUtf8(&Writer, c);
+		}
+		if (Bold) PutString(&Writer, "</b>");
+		PutString(&Writer, Pre ? "</pre>\r\n" : "</p>\r\n");
+		if (i < Length && Text[i] == '\r') ++i;
+		if (i < Length && Text[i] == '\n') ++i;
+	}
+	free(Text);
+
+	Offsets[3] = Writer.SizeCb;
+	PutString(&Writer, "<!--EndFragment-->\r\n</body>\r\n</html>");
+	Offsets[1] = Writer.SizeCb;
+	if (!Writer.Failed)
+	{
+		for (UINT k = 0; k < 4; ++k) WriteHtmlOffset(Writer.Data + OffsetPositions[k], Offsets[k]);
+	}
+	return FinishPayload(&Writer, SizeCb);
+}
+
+
+// Some picture data, as hex digits: what makes up most of the size of documents with images in them.
+static void PutRtfPicture(BYTE_WRITER *Writer, DWORD *State)
+{
+	static const char HexDigits[] = "0123456789abcdef";
+	PutString(Writer, "{\\*\\shppict{\\pict\\pngblip\\picw32\\pich32\\picwgoal480\\pichgoal480\r\n");
+	for (UINT Row = 0; Row < 16; ++Row)
+	{
+		for (UINT k = 0; k < 64; ++k) PutByte(Writer, (BYTE)HexDigits[RandomBelow(State, 16)]);
+		PutString(Writer, "\r\n");
+	}
+	PutString(Writer, "}}{\\nonshppict{\\pict\\wmetafile8\\picw32\\pich32 0100090000}}");
+}
+
+
+// Rich Text Format around Length characters of GenerateText, like a word processor puts it on the clipboard: font and
+// color tables, a paragraph per line with some bold and colored runs, hyperlink fields and pictures, and the characters
+// outside of ASCII as \'hh or \uN. Ends with a zero byte, which is included in SizeCb.
+BYTE *GenerateRtf(SIZE_T Length, DWORD Seed, SIZE_T *SizeCb)
+{
+	WCHAR *Text = GenerateText(Length, Seed);
+	if (Text == nullptr) return nullptr;
+	BYTE_WRITER Writer = {};
+	PutString(&Writer, "{\\rtf1\\ansi\\ansicpg1252\\deff0\\nouicompat\\deflang1033{\\fonttbl{\\f0\\fswiss\\fcharset0 Calibri;}{\\f1\\fmodern\\fcharset0 Consolas;}}\r\n");
+	PutString(&Writer, "{\\colortbl ;\\red192\\green0\\blue0;\\red5\\green99\\blue193;}\r\n");
+	PutString(&Writer, "{\\*\\generator Riched20 10.0.19041}\\viewkind4\\uc1 \r\n\\pard\\sa200\\sl276\\slmult1\\f0\\fs22\\lang9 ");
+
+	DWORD State = InitRandom(Seed);
+	SIZE_T i = 0;
+	while (i < Length)
+	{
+		DWORD Kind = RandomBelow(&State, 16);
+		if (Kind == 0) PutString(&Writer, "{\\b ");
+		else if (Kind == 1) PutString(&Writer, "{\\i\\cf1 ");
+		else if (Kind == 2) PutString(&Writer, "{\\f1\\fs20 ");
+		for (; i < Length && Text[i] != '\r' && Text[i] != '\n'; ++i)
+		{
+			WCHAR c = Text[i];
+			if (c == '\\' || c == '{' || c == '}')
+			{
+				PutByte(&Writer, '\\');
+				PutByte(&Writer, (BYTE)c);
+			}
+			else if (c == '\t') PutString(&Writer, "\\tab ");
+			else if (c >= 0x20 && c < 0x80) PutByte(&Writer, (BYTE)c);
+			else if (c >= 0xA0 && c < 0x100)
+			{
+				static const char HexDigits[] = "0123456789abcdef";
+				PutString(&Writer, "\\'");
+				PutByte(&Writer, (BYTE)HexDigits[c >> 4]);
+				PutByte(&Writer, (BYTE)HexDigits[c & 15]);
+			}
+			else
+			{
+				// Signed 16 bit, with a question mark for readers that do not know \u.
+				PutString(&Writer, "\\u");
+				PutSigned(&Writer, (LONG)(c >= 0x8000 ? c - 0x10000 : c));
+				PutByte(&Writer, '?');
+			}
+		}
+		if (Kind <= 2) PutByte(&Writer, '}');
+		if (RandomBelow(&State, 150) == 0)
+		{
+			PutString(&Writer, "{\\field{\\*\\fldinst{HYPERLINK \"https://example.com/\" }}{\\fldrslt{\\ul\\cf2 example.com}}}");
+		}
+		if (RandomBelow(&State, 200) == 0) PutRtfPicture(&Writer, &State);
+		PutString(&Writer, "\\par\r\n");
+		if (i < Length && Text[i] == '\r') ++i;
+		if (i < Length && Text[i] == '\n') ++i;
+	}
+	free(Text);
+	PutString(&Writer, "}\r\n");
+	return FinishPayload(&Writer, SizeCb);
+}
+
+
+static BOOL AddPayload(GENERATED_PAYLOAD *Payloads, UINT Capacity, UINT *Count, const char *Name, BYTE *Data, SIZE_T SizeCb)
+{
+	if (Data == nullptr) return false;
+	if (*Count == Capacity)
+	{
+		free(Data);
+		return false;
+	}
+	Payloads[*Count].Name = Name;
+	Payloads[*Count].Data = Data;
+	Payloads[*Count].SizeCb = SizeCb;
+	++*Count;
+	return true;
+}
+
+
+// A valid DIB, cut to at most MaxSizeCb bytes.
+static BYTE *GenerateCutDIB(const DIB_PAYLOAD_SPEC *Spec, SIZE_T MaxSizeCb, SIZE_T *SizeCb)
+{
+	BYTE *Data = GeneratePackedDIB(Spec, SizeCb);
+	if (Data != nullptr && *SizeCb > MaxSizeCb)
+	{
+		*SizeCb = MaxSizeCb;
+	}
+	return Data;
+}
+
+
+// Where the pixels of a DIB from GeneratePackedDIB start, for a BITMAPINFOHEADER and up to 8 bpp.
+static SIZE_T GetColorTableEnd(const BYTE *Data)
+{
+	const BITMAPINFOHEADER *Header = (const BITMAPINFOHEADER *)Data;
+	DWORD Colors = Header->biClrUsed != 0 ? Header->biClrUsed : 1u << Header->biBitCount;
+	return Header->biSize + Colors * sizeof(RGBQUAD);
+}
+
+
+// A small valid DIB with some fields of the BITMAPINFOHEADER overwritten.
+static BYTE *GeneratePatchedDIB(WORD BitCount, DWORD Seed, LONG Width, LONG Height, DWORD Compression, DWORD ClrUsed, DWORD BiSize, SIZE_T *SizeCb)
+{
+	DIB_PAYLOAD_SPEC Spec = { 64, 64, BitCount, BI_RGB, DIB_HEADER_INFO, 0, Seed };
+	BYTE *Data = GeneratePackedDIB(&Spec, SizeCb);
+	if (Data == nullptr) return nullptr;
+	BITMAPINFOHEADER *Header = (BITMAPINFOHEADER *)Data;
+	Header->biWidth = Width;
+	Header->biHeight = Height;
+	Header->biCompression = Compression;
+	Header->biClrUsed = ClrUsed;
+	Header->biSize = BiSize;
+	return Data;
+}
+
+
+// Fills Payloads with DIBs that are broken in the ways that GetPackedDIBInfo has to catch, plus truncated copies of
+// valid DIBs and random bytes. Returns the number of payloads.
+UINT GenerateMalformedDIBs(DWORD Seed, GENERATED_PAYLOAD *Payloads, UINT Capacity)
+{
+	UINT Count = 0;
+	SIZE_T Size;
+	BYTE *Data;
+	DIB_PAYLOAD_SPEC Spec32 = { 256, 256, 32, BI_RGB, DIB_HEADER_INFO, 0, Seed };
+	DIB_PAYLOAD_SPEC Spec8 = { 256, 256, 8, BI_RGB, DIB_HEADER_INFO, 0, Seed };
+	DIB_PAYLOAD_SPEC SpecMasks = { 256, 256, 32, BI_BITFIELDS, DIB_HEADER_INFO, 0, Seed };
+
+	Data = GenerateCutDIB(&Spec32, 24, &Size);
+	AddPayload(Payloads, Capacity, &Count, "header-truncated", Data, Size);
+	Data = GenerateCutDIB(&SpecMasks, sizeof(BITMAPINFOHEADER) + 4, &Size);
+	AddPayload(Payloads, Capacity, &Count, "masks-truncated", Data, Size);
+	Data = GenerateCutDIB(&Spec8, sizeof(BITMAPINFOHEADER) + 100 * sizeof(RGBQUAD), &Size);
+	AddPayload(Payloads, Capacity, &Count, "color-table-truncated", Data, Size);
+	Data = GenerateCutDIB(&Spec32, sizeof(BITMAPINFOHEADER) + 256 * 4 * 100 + 17, &Size);
+	AddPayload(Payloads, Capacity, &Count, "pixels-truncated", Data, Size);
+	Data = GenerateCutDIB(&Spec32, sizeof(BITMAPINFOHEADER), &Size);
+	AddPayload(Payloads, Capacity, &Count, "pixels-missing", Data, Size);
+
+	Data = GeneratePatchedDIB(8, Seed, 64, 64, BI_RGB, 0xFFFFFFFF, DIB_HEADER_INFO, &Size);
+	AddPayload(Payloads, Capacity, &Count, "clrused-huge", Data, Size);
+	Data = GeneratePatchedDIB(8, Seed, 64, 64, BI_RGB, 1000, DIB_HEADER_INFO, &Size);
+	AddPayload(Payloads, Capacity, &Count, "clrused-over-max", Data, Size);
+	Data = GeneratePatchedDIB(32, Seed, 0x7FFFFFFF, 0x7FFFFFFF, BI_RGB, 0, DIB_HEADER_INFO, &Size);
+	AddPayload(Payloads, Capacity, &Count, "size-huge", Data, Size);
+	Data = GeneratePatchedDIB(32, Seed, 64, (LONG)0x80000000, BI_RGB, 0, DIB_HEADER_INFO, &Size);
+	AddPayload(Payloads, Capacity, &Count, "height-int-min", Data, Size);
+	Data = GeneratePatchedDIB(32, Seed, 0, 64, BI_RGB, 0, DIB_HEADER_INFO, &Size);
+	AddPayload(Payloads, Capacity, &Count, "width-zero", Data, Size);
+	Data = GeneratePatchedDIB(32, Seed, -64, 64, BI_RGB, 0, DIB_HEADER_INFO, &Size);
+	AddPayload(Payloads, Capacity, &Count, "width-negative", Data, Size);
+	Data = GeneratePatchedDIB(8, Seed, 64, 64, BI_RLE8, 0, DIB_HEADER_INFO, &Size);
+	AddPayload(Payloads, Capacity, &Count, "compression-rle8-raw-pixels", Data, Size);
+	Data = GeneratePatchedDIB(4, Seed, 64, 64, BI_RLE8, 0, DIB_HEADER_INFO, &Size);
+	AddPayload(Payloads, Capacity, &Count, "compression-rle8-4bpp", Data, Size);
+	Data = GeneratePatchedDIB(1, Seed, 64, 64, BI_RLE4, 0, DIB_HEADER_INFO, &Size);
+	AddPayload(Payloads, Capacity, &Count, "compression-rle4-1bpp", Data, Size);
+	Data = GeneratePatchedDIB(8, Seed, 64, -64, BI_RLE8, 0, DIB_HEADER_INFO, &Size);
+	AddPayload(Payloads, Capacity, &Count, "compression-rle8-top-down", Data, Size);
+	Data = GeneratePatchedDIB(24, Seed, 64, 64, BI_JPEG_VALUE, 0, DIB_HEADER_INFO, &Size);
+	AddPayload(Payloads, Capacity, &Count, "compression-jpeg", Data, Size);
+	Data = GeneratePatchedDIB(24, Seed, 64, 64, BI_PNG_VALUE, 0, DIB_HEADER_INFO, &Size);
+	AddPayload(Payloads, Capacity, &Count, "compression-png", Data, Size);
+	Data = GeneratePatchedDIB(24, Seed, 64, 64, BI_BITFIELDS, 0, DIB_HEADER_INFO, &Size);
+	AddPayload(Payloads, Capacity, &Count, "compression-bitfields-24bpp", Data, Size);
+	Data = GeneratePatchedDIB(32, Seed, 64, 64, BI_RGB, 0, 0xFFFFFFF0, &Size);
+	AddPayload(Payloads, Capacity, &Count, "bisize-huge", Data, Size);
+	Data = GeneratePatchedDIB(32, Seed, 64, 64, BI_RGB, 0, 12, &Size);
+	AddPayload(Payloads, Capacity, &Count, "bisize-core-header", Data, Size);
+	Data = GeneratePatchedDIB(32, Seed, 64, 64, BI_RGB, 0, DIB_HEADER_INFO, &Size);
+	if (Data != nullptr)
+	{
+		((BITMAPINFOHEADER *)Data)->biBitCount = 12;
+	}
+	AddPayload(Payloads, Capacity, &Count, "bitcount-invalid", Data, Size);
+
+	DIB_PAYLOAD_SPEC SpecCore = { 256, 256, 8, BI_RGB, DIB_HEADER_CORE, 0, Seed };
+	Data = GenerateCutDIB(&SpecCore, DIB_HEADER_CORE + 100 * 3, &Size);
+	AddPayload(Payloads, Capacity, &Count, "core-color-table-truncated", Data, Size);
+	Data = GenerateCutDIB(&SpecCore, DIB_HEADER_CORE - 2, &Size);
+	AddPayload(Payloads, Capacity, &Count, "core-header-truncated", Data, Size);
+
+	// RLE streams whose commands point outside of the bitmap, or stop in the middle of a command.
+	static const BYTE BadStreams[][12] =
+	{
+		{ 0, 2, 255, 255, 4, 1, 0, 2, 255, 0, 3, 7 },      // Deltas past the top and the right edge, then runs.
+		{ 255, 1, 255, 1, 255, 1, 255, 1, 255, 1, 0, 0 },  // Runs much longer than a row.
+		{ 0, 255, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10 },         // A literal run longer than the rest of the stream.
+		{ 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2 },            // Only line ends, then a cut delta.
+	};
+	for (UINT i = 0; i < sizeof(BadStreams) / sizeof(BadStreams[0]); ++i)
+	{
+		DIB_PAYLOAD_SPEC Spec = { 16, 8, (WORD)(i % 2 == 0 ? 8 : 4), (DWORD)(i % 2 == 0 ? BI_RLE8 : BI_RLE4), DIB_HEADER_INFO, 0, Seed };
+		Data = GeneratePackedDIB(&Spec, &Size);
+		if (Data != nullptr)
+		{
+			SIZE_T PixelOffset = GetColorTableEnd(Data);
+			memcpy(Data + PixelOffset, BadStreams[i], sizeof(BadStreams[i]));
+			Size = PixelOffset + sizeof(BadStreams[i]);
+		}
+		AddPayload(Payloads, Capacity, &Count, "rle-bad-stream", Data, Size);
+	}
+
+	// Valid DIBs in all bit depths, cut at random points, and random bytes.
+	static const WORD BitCounts[] = { 1, 4, 8, 16, 24, 32 };
+	DWORD State = InitRandom(Seed);
+	for (UINT i = 0; i < 4; ++i)
+	{
+		DIB_PAYLOAD_SPEC Spec = { 100 + (LONG)RandomBelow(&State, 200), 100 + (LONG)RandomBelow(&State, 200), (WORD)(i % 2 == 0 ? 8 : 4), (DWORD)(i % 2 == 0 ? BI_RLE8 : BI_RLE4), DIB_HEADER_INFO, 0, NextRandom(&State) };
+		SIZE_T FullSize;
+		Data = GeneratePackedDIB(&Spec, &FullSize);
+		if (Data != nullptr)
+		{
+			SIZE_T PixelOffset = GetColorTableEnd(Data);
+			Size = PixelOffset + RandomBelow(&State, (DWORD)(FullSize - PixelOffset));
+			// Every other one has its stream replaced by random bytes.
+			for (SIZE_T j = PixelOffset; i % 2 == 1 && j < Size; ++j) Data[j] = (BYTE)NextRandom(&State);
+		}
+		AddPayload(Payloads, Capacity, &Count, "rle-random-cut", Data, Size);
+	}
+	for (UINT i = 0; i < 24; ++i)
+	{
+		DIB_PAYLOAD_SPEC Spec = { 100 + (LONG)RandomBelow(&State, 200), 100 + (LONG)RandomBelow(&State, 200), BitCounts[i % 6], BI_RGB, DIB_HEADER_INFO, 0, NextRandom(&State) };
+		SIZE_T FullSize;
+		Data = GeneratePackedDIB(&Spec, &FullSize);
+		if (Data != nullptr)
+		{
+			Size = RandomBelow(&State, (DWORD)FullSize);
+		}
+		AddPayload(Payloads, Capacity, &Count, "random-cut", Data, Size);
+	}
+	for (UINT i = 0; i < 8; ++i)
+	{
+		Size = 16 + RandomBelow(&State, 4096);
+		Data = (BYTE *)malloc(Size);
+		if (Data != nullptr)
+		{
+			for (SIZE_T j = 0; j < Size; ++j) Data[j] = (BYTE)NextRandom(&State);
+			// Make the header at least look plausible some of the time.
+			if (i % 2 == 0) WriteDword(Data, DIB_HEADER_INFO);
+		}
+		AddPayload(Payloads, Capacity, &Count, "random-bytes", Data, Size);
+	}
+	return Count;
+}
+
+// The chunk of the given type in a PNG from GeneratePng, or null.
+static BYTE *FindChunk(BYTE *Data, SIZE_T SizeCb, const char *Type)
+{
+	SIZE_T Offset = PNG_SIGNATURE_SIZE;
+	while (Offset + 12 <= SizeCb)
+	{
+		BYTE *Chunk = Data + Offset;
+		if (memcmp(Chunk + 4, Type, 4) == 0) return Chunk;
+		Offset += 12 + ((SIZE_T)Chunk[0] << 24 | (SIZE_T)Chunk[1] << 16 | (SIZE_T)Chunk[2] << 8 | Chunk[3]);
+	}
+	return nullptr;
+}
+
+
+// Makes a patched chunk look intact again.
+static void UpdateChunkCrc(BYTE *Chunk)
+{
+	SIZE_T Length = (SIZE_T)Chunk[0] << 24 | (SIZE_T)Chunk[1] << 16 | (SIZE_T)Chunk[2] << 8 | Chunk[3];
+	WriteBigEndian(Chunk + 8 + Length, UpdateCrc32(0, Chunk + 4, Length + 4));
+}
+
+
+// Fills Payloads with PNGs that GetPngInfo or DecodePng have to reject: broken chunks, headers that do not match the
+// data, invalid filters and DEFLATE streams (with intact CRCs, so that they get that far), plus truncated copies of
+// valid PNGs. Returns the number of payloads.
+UINT GenerateMalformedPngs(DWORD Seed, GENERATED_PAYLOAD *Payloads, UINT Capacity)
+{
+	UINT Count = 0;
+	SIZE_T Size;
+	BYTE *Data;
+	BYTE *Chunk;
+	// Stored, so that the filter bytes can be found in the IDAT data.
+	PNG_PAYLOAD_SPEC Spec = { 64, 64, PNG_RGBA, 8, false, PNG_FILTER_ADAPTIVE, PNG_COMPRESSION_STORED, false, Seed };
+	// The IHDR content, and the first filter byte after the zlib header and the stored block header.
+	const SIZE_T HeaderOffset = PNG_SIGNATURE_SIZE + 8;
+	const SIZE_T FirstFilterOffset = 8 + 2 + 5;
+
+	Data = GeneratePng(&Spec, &Size);
+	if (Data != nullptr) Size = PNG_SIGNATURE_SIZE;
+	AddPayload(Payloads, Capacity, &Count, "png-signature-only", Data, Size);
+	Data = GeneratePng(&Spec, &Size);
+	if (Data != nullptr) Size = HeaderOffset + 7;
+	AddPayload(Payloads, Capacity, &Count, "png-header-truncated", Data, Size);
+	Data = GeneratePng(&Spec, &Size);
+	if (Data != nullptr) Data[HeaderOffset + 13] ^= 0x01;
+	AddPayload(Payloads, Capacity, &Count, "png-header-crc", Data, Size);
+	Data = GeneratePng(&Spec, &Size);
+	if (Data != nullptr)
+	{
+		WriteBigEndian(Data + HeaderOffset, 0x7FFFFFFF);
+		WriteBigEndian(Data + HeaderOffset + 4, 0x7FFFFFFF);
+		UpdateChunkCrc(Data + PNG_SIGNATURE_SIZE);
+	}
+	AddPayload(Payloads, Capacity, &Count, "png-size-huge", Data, Size);
+	Data = GeneratePng(&Spec, &Size);
+	if (Data != nullptr)
+	{
+		Data[HeaderOffset + 8] = 3;
+		UpdateChunkCrc(Data + PNG_SIGNATURE_SIZE);
+	}
+	AddPayload(Payloads, Capacity, &Count, "png-depth-invalid", Data, Size);
+	// One row more or less than there is data for.
+	for (LONG Delta = -1; Delta <= 1; Delta += 2)
+	{
+		Data = GeneratePng(&Spec, &Size);
+		if (Data != nullptr)
+		{
+			WriteBigEndian(Data + HeaderOffset + 4, (DWORD)(Spec.Height + Delta));
+			UpdateChunkCrc(Data + PNG_SIGNATURE_SIZE);
+		}
+		AddPayload(Payloads, Capacity, &Count, Delta < 0 ? "png-data-too-long" : "png-data-too-short", Data, Size);
+	}
+	Data = GeneratePng(&Spec, &Size);
+	Chunk = Data != nullptr ? FindChunk(Data, Size, "IDAT") : nullptr;
+	if (Chunk != nullptr) Chunk[FirstFilterOffset + 100] ^= 0x10;
+	AddPayload(Payloads, Capacity, &Count, "png-idat-crc", Data, Size);
+	Data = GeneratePng(&Spec, &Size);
+	Chunk = Data != nullptr ? FindChunk(Data, Size, "IDAT") : nullptr;
+	if (Chunk != nullptr)
+	{
+		Chunk[FirstFilterOffset] = 5;
+		UpdateChunkCrc(Chunk);
+	}
+	AddPayload(Payloads, Capacity, &Count, "png-filter-invalid", Data, Size);
+	Data = GeneratePng(&Spec, &Size);
+	Chunk = Data != nullptr ? FindChunk(Data, Size, "IEND") : nullptr;
+	if (Chunk != nullptr) Size = Chunk - Data;
+	AddPayload(Payloads, Capacity, &Count, "png-end-missing", Data, Size);
+
+	// Valid PNGs of all color types, whose compressed data is replaced by random bytes (after the zlib header), or which
+	// are cut at random points.
+	static const BYTE ColorTypes[] = { PNG_GRAY, PNG_RGB, PNG_PALETTE, PNG_GRAY_ALPHA, PNG_RGBA };
+	DWORD State = InitRandom(Seed);
+	for (UINT i = 0; i < 10; ++i)
+	{
+		PNG_PAYLOAD_SPEC Random = { 50 + (LONG)RandomBelow(&State, 150), 50 + (LONG)RandomBelow(&State, 150), ColorTypes[i % 5], 8, i % 3 == 0, PNG_FILTER_ADAPTIVE, PNG_COMPRESSION_FIXED, false, NextRandom(&State) };
+		Data = GeneratePng(&Random, &Size);
+		Chunk = Data != nullptr ? FindChunk(Data, Size, "IDAT") : nullptr;
+		if (Chunk != nullptr && i % 2 == 0)
+		{
+			SIZE_T Length = (SIZE_T)Chunk[0] << 24 | (SIZE_T)Chunk[1] << 16 | (SIZE_T)Chunk[2] << 8 | Chunk[3];
+			for (SIZE_T j = 2; j < Length; ++j) Chunk[8 + j] = (BYTE)NextRandom(&State);
+			UpdateChunkCrc(Chunk);
+		}
+		else if (Chunk != nullptr)
+		{
+			Size = RandomBelow(&State, (DWORD)Size);
+		}
+		AddPayload(Payloads, Capacity, &Count, i % 2 == 0 ? "png-deflate-random" : "png-random-cut", Data, Size);
+	}
+	return Count;
+}
+
+
+static BYTE *CopyString(const char *s, SIZE_T *SizeCb)
+{
+	*SizeCb = strlen(s);
+	BYTE *Data = (BYTE *)malloc(*SizeCb + 1);
+	if (Data != nullptr) memcpy(Data, s, *SizeCb + 1);
+	return Data;
+}
+
+
+// A valid CF_HTML payload with one of its header offsets replaced.
+static BYTE *GeneratePatchedHtml(DWORD Seed, const char *Name, const char *Value, SIZE_T *SizeCb)
+{
+	BYTE *Data = GenerateHtmlFormat(2000, Seed, SizeCb);
+	if (Data == nullptr) return nullptr;
+	BYTE *Field = (BYTE *)strstr((const char *)Data, Name);
+	if (Field != nullptr) memcpy(Field + strlen(Name), Value, 10);
+	return Data;
+}
+
+
+// Fills Payloads with CF_HTML and RTF payloads that ParseClipboardHtml and RtfExtract have to reject or survive: wrong
+// and overflowing offsets, missing headers, unbalanced and very deep groups, control words at the very end, huge
+// parameters, plus truncated copies of valid payloads and random bytes. Returns the number of payloads.
+UINT GenerateMalformedRichText(DWORD Seed, GENERATED_PAYLOAD *Payloads, UINT Capacity)
+{
+	UINT Count = 0;
+	SIZE_T Size;
+	BYTE *Data;
+	DWORD State = InitRandom(Seed);
+
+	Data = CopyString("<html><body><!--StartFragment-->hi<!--EndFragment--></body></html>", &Size);
+	AddPayload(Payloads, Capacity, &Count, "html-no-header", Data, Size);
+	Data = CopyString("Version:0.9\r\nStartHTML:0000000071\r\nEndHTML:0000000071\r\n", &Size);
+	AddPayload(Payloads, Capacity, &Count, "html-header-only", Data, Size);
+	Data = CopyString("Version:0.9\r\nStartHTML:99999999999999999999\r\nEndFragment:-99999999999999999999\r\n<p>x</p>", &Size);
+	AddPayload(Payloads, Capacity, &Count, "html-offset-huge", Data, Size);
+	Data = GeneratePatchedHtml(Seed, "EndHTML:", "9999999999", &Size);
+	AddPayload(Payloads, Capacity, &Count, "html-end-beyond-data", Data, Size);
+	Data = GeneratePatchedHtml(Seed, "StartFragment:", "9999999999", &Size);
+	AddPayload(Payloads, Capacity, &Count, "html-fragment-reversed", Data, Size);
+	Data = GeneratePatchedHtml(Seed, "StartHTML:", "-000000001", &Size);
+	AddPayload(Payloads, Capacity, &Count, "html-start-negative", Data, Size);
+	Data = GeneratePatchedHtml(Seed, "StartFragment:", "0000000003", &Size);
+	AddPayload(Payloads, Capacity, &Count, "html-fragment-in-header", Data, Size);
+	for (UINT i = 0; i < 4; ++i)
+	{
+		Data = GenerateHtmlFormat(1000 + RandomBelow(&State, 4000), NextRandom(&State), &Size);
+		if (Data != nullptr) Size = RandomBelow(&State, (DWORD)Size);
+		AddPayload(Payloads, Capacity, &Count, "html-random-cut", Data, Size);
+	}
+
+	Data = CopyString("{\\rtf", &Size);
+	AddPayload(Payloads, Capacity, &Count, "rtf-empty", Data, Size);
+	Data = CopyString("{\\rtf1 text\\", &Size);
+	AddPayload(Payloads, Capacity, &Count, "rtf-backslash-end", Data, Size);
+	Data = CopyString("{\\rtf1 text\\'4", &Size);
+	AddPayload(Payloads, Capacity, &Count, "rtf-hex-end", Data, Size);
+	Data = CopyString("{\\rtf1 a}}}}}} b {{\\*}{\\* c}\\u", &Size);
+	AddPayload(Payloads, Capacity, &Count, "rtf-unbalanced", Data, Size);
+	Data = CopyString("{\\rtf1\\uc99999999999 \\u99999999999999 x\\u-99999999999 y\\fs-", &Size);
+	AddPayload(Payloads, Capacity, &Count, "rtf-parameter-huge", Data, Size);
+	Data = CopyString("{\\rtf1{\\pict\\bin2147483647 abc}} after", &Size);
+	AddPayload(Payloads, Capacity, &Count, "rtf-bin-huge", Data, Size);
+	// Far deeper than any group state is kept for, and never closed.
+	const SIZE_T Depth = 1000000;
+	Data = (BYTE *)malloc(Depth + 16);
+	if (Data != nullptr)
+	{
+		memcpy(Data, "{\\rtf1", 6);
+		memset(Data + 6, '{', Depth);
+		memcpy(Data + 6 + Depth, "\\*\\x deep", 9);
+		Size = 6 + Depth + 9;
+	}
+	AddPayload(Payloads, Capacity, &Count, "rtf-deep-nesting", Data, Size);
+	for (UINT i = 0; i < 4; ++i)
+	{
+		Data = GenerateRtf(1000 + RandomBelow(&State, 4000), NextRandom(&State), &Size);
+		if (Data != nullptr) Size = RandomBelow(&State, (DWORD)Size);
+		AddPayload(Payloads, Capacity, &Count, "rtf-random-cut", Data, Size);
+	}
+	// Random bytes, drawn mostly from the characters that mean something to the tokenizer.
+	static const char Alphabet[] = "{}\\\\\\'*u0123456789-abc \r\n";
+	for (UINT i = 0; i < 4; ++i)
+	{
+		Size = 4096;
+		Data = (BYTE *)malloc(Size);
+		if (Data != nullptr)
+		{
+			memcpy(Data, "{\\rtf1", 6);
+			for (SIZE_T k = 6; k < Size; ++k)
+			{
+				Data[k] = i % 2 == 0 ? (BYTE)Alphabet[RandomBelow(&State, sizeof(Alphabet) - 1)] : (BYTE)NextRandom(&State);
+			}
+		}
+		AddPayload(Payloads, Capacity, &Count, "rtf-random-bytes", Data, Size);
+	}
+	return Count;
+}
+
+
+void FreeGeneratedPayloads(GENERATED_PAYLOAD *Payloads, UINT Count)
+{
+	for (UINT i = 0; i < Count; ++i)
+	{
+		free(Payloads[i].Data);
+	}
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Portable.h"
+
+struct DIB_PAYLOAD_SPEC;
+struct PNG_PAYLOAD_SPEC;
+struct GENERATED_PAYLOAD;
+
+// Synthetic clipboard payloads for the benchmarks (see Benchmark.cpp). Everything is derived from a seed, so the same
+// seed always gives the same bytes.
+//
+// Images look roughly like screenshots: flat window areas, rows of small glyph-like detail, and a photo-like gradient,
+// so that the compressing and hashing code sees realistic amounts of redundancy. Texts mix prose, indented code, log
+// lines and the occasional very long line, with CRLF and LF line ends and some text outside of ASCII (including
+// surrogate pairs). PNGs show the same screen, compressed by a simple DEFLATE encoder of their own. CF_HTML and RTF
+// payloads wrap the same texts in markup, the way browsers and word processors put them on the clipboard.
+//
+// All payloads are allocated with malloc.
+
+extern BYTE               *GeneratePackedDIB(const DIB_PAYLOAD_SPEC *Spec, SIZE_T *SizeCb);
+extern WCHAR              *GenerateText(SIZE_T Length, DWORD Seed);
+extern UINT                GenerateMalformedDIBs(DWORD Seed, GENERATED_PAYLOAD *Payloads, UINT Capacity);
+extern BYTE               *GeneratePng(const PNG_PAYLOAD_SPEC *Spec, SIZE_T *SizeCb);
+extern UINT                GenerateMalformedPngs(DWORD Seed, GENERATED_PAYLOAD *Payloads, UINT Capacity);
+extern BYTE               *GenerateHtmlFormat(SIZE_T Length, DWORD Seed, SIZE_T *SizeCb);
+extern BYTE               *GenerateRtf(SIZE_T Length, DWORD Seed, SIZE_T *SizeCb);
+extern UINT                GenerateMalformedRichText(DWORD Seed, GENERATED_PAYLOAD *Payloads, UINT Capacity);
+extern void                FreeGeneratedPayloads(GENERATED_PAYLOAD *Payloads, UINT Count);
+
+// The headers that GetPixelDataOffsetForPackedDIB understands. V4 and V5 headers carry the masks (and V5 the alpha mask)
+// in the header itself. The OS/2 BITMAPCOREHEADER has 3 byte color table entries, and only bottom-up, uncompressed
+// bitmaps of 1, 4, 8 or 24 bpp are generated with it.
+#define DIB_HEADER_CORE 12
+#define DIB_HEADER_INFO 40
+#define DIB_HEADER_V4 108
+#define DIB_HEADER_V5 124
+
+struct DIB_PAYLOAD_SPEC
+{
+	LONG Width;
+	LONG Height;           // Negative for a top-down DIB.
+	WORD BitCount;         // 1, 4, 8, 16, 24 or 32.
+	DWORD Compression;     // BI_RGB, BI_BITFIELDS (16 and 32 bpp), BI_ALPHABITFIELDS (32 bpp, DIB_HEADER_INFO only), or
+	                       // BI_RLE4 and BI_RLE8 (4 and 8 bpp, bottom-up only).
+	DWORD HeaderSize;      // DIB_HEADER_*.
+	DWORD ClrUsed;         // Size of the color table, or 0 for the full one.
+	DWORD Seed;
+};
+
+// Filter, besides the five PNG filters: the one that looks best for each row, like libpng chooses.
+#define PNG_FILTER_ADAPTIVE 5
+// Compression: stored blocks, or greedy LZ77 matches with the fixed Huffman codes.
+#define PNG_COMPRESSION_STORED 0
+#define PNG_COMPRESSION_FIXED 1
+
+struct PNG_PAYLOAD_SPEC
+{
+	LONG Width;
+	LONG Height;
+	BYTE ColorType;        // PNG_GRAY, PNG_RGB, PNG_PALETTE, PNG_GRAY_ALPHA or PNG_RGBA (see PngDecoder.h).
+	BYTE BitDepth;         // Any that is valid for the color type.
+	BOOL Interlaced;       // Adam7.
+	BYTE Filter;           // 0 to 4, or PNG_FILTER_ADAPTIVE.
+	BYTE Compression;      // PNG_COMPRESSION_*.
+	BOOL Transparency;     // Adds a tRNS chunk, for the color types without alpha.
+	DWORD Seed;
+};
+
+// A payload that the decoders have to reject, or survive.
+struct GENERATED_PAYLOAD
+{
+	const char *Name;      // Static.
+	BYTE *Data;
+	SIZE_T SizeCb;
+};
@@ -0,0 +1,106 @@
+#include "PerceptualHash.h"
+#include "PixelBuffer.h"
+#include <string.h>
+
+// Pixels per cell (in each direction) that the level used for hashing must at least have.
+#define MIN_PIXELS_PER_CELL 4
+// A cell only counts as brighter than its neighbour if its average luma is larger by more than this. Screenshots have
+// large flat areas, and without the margin, noise alone would decide the bits of equal cells.
+#define BRIGHTER_MARGIN 2
+
+
+// Start of cell Cell out of Cells, over Size pixels. In images smaller than the grid, cells may be empty.
+static LONG GetCellStart(LONG Size, LONG Cells, LONG Cell)
+{
+	return (LONG)((LONGLONG)Size * Cell / Cells);
+}
+
+
+ULONGLONG ComputePerceptualHash(const PIXEL_BUFFER *Image)
+{
+	const PIXEL_BUFFER *Level = Image;
+	while (Level->HalfSize != nullptr && Level->HalfSize->Width >= PERCEPTUAL_HASH_COLUMNS * MIN_PIXELS_PER_CELL &&
+		Level->HalfSize->Height >= PERCEPTUAL_HASH_ROWS * MIN_PIXELS_PER_CELL)
+	{
+		Level = Level->HalfSize;
+	}
+
+	// Sums of the luma (BT.601 weights, times 256) and pixel counts per cell.
+	ULONGLONG Sums[PERCEPTUAL_HASH_ROWS][PERCEPTUAL_HASH_COLUMNS];
+	ULONGLONG Counts[PERCEPTUAL_HASH_ROWS][PERCEPTUAL_HASH_COLUMNS];
+	memset(Sums, 0, sizeof(Sums));
+	memset(Counts, 0, sizeof(Counts));
+	for (LONG Row = 0; Row < PERCEPTUAL_HASH_ROWS; ++Row)
+	{
+		LONG Top = GetCellStart(Level->Height, PERCEPTUAL_HASH_ROWS, Row);
+		LONG Bottom = GetCellStart(Level->Height, PERCEPTUAL_HASH_ROWS, Row + 1);
+		if (Bottom <= Top) Bottom = Top + 1;
+		for (LONG Column = 0; Column < PERCEPTUAL_HASH_COLUMNS; ++Column)
+		{
+			LONG Left = GetCellStart(Level->Width, PERCEPTUAL_HASH_COLUMNS, Column);
+			LONG Right = GetCellStart(Level->Width, PERCEPTUAL_HASH_COLUMNS, Column + 1);
+			if (Right <= Left) Right = Left + 1;
+			for (LONG y = Top; y < Bottom; ++y)
+			{
+				const BYTE *Pixel = Level->Pixels + (SIZE_T)y * Level->Stride + (SIZE_T)Left * 4;
+				for (LONG x = Left; x < Right; ++x, Pixel += 4)
+				{
+					Sums[Row][Column] += Pixel[0] * 29 + Pixel[1] * 150 + Pixel[2] * 77;
+				}
+			}
+			Counts[Row][Column] = (ULONGLONG)(Bottom - Top) * (Right - Left);
+		}
+	}
+
+	ULONGLONG Hash = 0;
+	for (LONG Row = 0; Row < PERCEPTUAL_HASH_ROWS; ++Row)
+	{
+		for (LONG Column = 0; Column + 1 < PERCEPTUAL_HASH_COLUMNS; ++Column)
+		{
+			// Comparing the averages without dividing: a / b > c / d + m, with the sums scaled by 256.
+			ULONGLONG CountProduct = Counts[Row][Column] * Counts[Row][Column + 1];
+			if (Sums[Row][Column] * Counts[Row][Column + 1] > Sums[Row][Column + 1] * Counts[Row][Column] + BRIGHTER_MARGIN * 256 * CountProduct)
+			{
+				Hash |= 1ULL << (Row * (PERCEPTUAL_HASH_COLUMNS - 1) + Column);
+			}
+		}
+	}
+	return Hash;
+}
+
+
+UINT PerceptualHashDistance(ULONGLONG a, ULONGLONG b)
+{
+	ULONGLONG x = a ^ b;
+	x = x - ((x >> 1) & 0x5555555555555555ULL);
+	x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+	x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+	return (UINT)((x * 0x0101010101010101ULL) >> 56);
+}
+
+
+// The average color of the image as BGRA, taken from the last level of its mip pyramid. Without a pyramid, this
+// averages all pixels.
+DWORD GetAverageColor(const PIXEL_BUFFER *Image)
+{
+	const PIXEL_BUFFER *Level = Image;
+	while (Level->HalfSize != nullptr) Level = Level->HalfSize;
+	if (Level->Width == 1 && Level->Height == 1) return *(const DWORD *)Level->Pixels;
+
+	ULONGLONG Sums[4] = {};
+	for (LONG y = 0; y < Level->Height; ++y)
+	{
+		const BYTE *Pixel = Level->Pixels + (SIZE_T)y * Level->Stride;
+		for (LONG x = 0; x < Level->Width; ++x, Pixel += 4)
+		{
+			for (int Channel = 0; Channel < 4; ++Channel) Sums[Channel] += Pixel[Channel];
+		}
+	}
+	ULONGLONG Count = (ULONGLONG)Level->Width * Level->Height;
+	DWORD Color = 0;
+	for (int Channel = 0; Channel < 4; ++Channel)
+	{
+		Color |= (DWORD)((Sums[Channel] + Count / 2) / Count) << (Channel * 8);
+	}
+	return Color;
+}
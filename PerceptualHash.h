@@ -0,0 +1,24 @@
+#pragma once
+
+#include "Portable.h"
+
+struct PIXEL_BUFFER;
+
+// 64 bit perceptual hash (dHash) of an image, for recognizing captures that look the same although their pixels are
+// not identical (e.g. screenshots of the same screen with a blinking cursor, or after lossy re-encoding).
+//
+// The image is averaged down to PERCEPTUAL_HASH_COLUMNS x PERCEPTUAL_HASH_ROWS gray cells, and every bit tells whether
+// a cell is brighter than its right neighbour. The number of differing bits (PerceptualHashDistance) is small for
+// images that look alike. Since only the differences between cells count, the hash ignores the overall brightness and
+// the aspect ratio; a uniform image hashes to 0 whatever its color. Callers that need to tell such images apart have
+// to compare their size and average color as well.
+//
+// The averages are taken from the smallest level of the image's mip pyramid (see MipPyramid.h) that still has a few
+// pixels per cell, so hashing is cheap once the pyramid has been built.
+
+#define PERCEPTUAL_HASH_COLUMNS 9
+#define PERCEPTUAL_HASH_ROWS 8
+
+extern ULONGLONG           ComputePerceptualHash(const PIXEL_BUFFER *Image);
+extern UINT                PerceptualHashDistance(ULONGLONG a, ULONGLONG b);
+extern DWORD               GetAverageColor(const PIXEL_BUFFER *Image);
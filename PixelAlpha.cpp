@@ -0,0 +1,189 @@
+#include "PixelAlpha.h"
+#include "PixelBuffer.h"
+
+// Pixels between two checks for whether ClassifyAlpha can stop early.
+#define CLASSIFY_BLOCK_PIXELS 1024
+
+
+// x * a / 255, rounded, for x and a up to 255.
+static DWORD MultiplyDiv255(DWORD x, DWORD a)
+{
+	DWORD t = x * a + 128;
+	return (t + (t >> 8)) >> 8;
+}
+
+
+static ALPHA_KIND ToAlphaKind(DWORD And, DWORD Or)
+{
+	if (And == 0xFF) return ALPHA_OPAQUE;
+	if (Or == 0) return ALPHA_TRANSPARENT;
+	return ALPHA_TRANSLUCENT;
+}
+
+
+ALPHA_KIND ClassifyAlpha(const BYTE *Pixels, SIZE_T PixelCount)
+{
+	DWORD And = 0xFF;
+	DWORD Or = 0;
+	SIZE_T i = 0;
+	while (i < PixelCount)
+	{
+		SIZE_T BlockEnd = PixelCount - i < CLASSIFY_BLOCK_PIXELS ? PixelCount : i + CLASSIFY_BLOCK_PIXELS;
+#ifdef PORTABLE_SSE2
+		__m128i AndVector = _mm_set1_epi8((char)0xFF);
+		__m128i OrVector = _mm_setzero_si128();
+		for (; i + 4 <= BlockEnd; i += 4)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i *)(Pixels + i * 4));
+			AndVector = _mm_and_si128(AndVector, v);
+			OrVector = _mm_or_si128(OrVector, v);
+		}
+		// Folds the four pixels into one.
+		AndVector = _mm_and_si128(AndVector, _mm_srli_si128(AndVector, 8));
+		AndVector = _mm_and_si128(AndVector, _mm_srli_si128(AndVector, 4));
+		OrVector = _mm_or_si128(OrVector, _mm_srli_si128(OrVector, 8));
+		OrVector = _mm_or_si128(OrVector, _mm_srli_si128(OrVector, 4));
+		And &= (DWORD)_mm_cvtsi128_si32(AndVector) >> 24;
+		Or |= (DWORD)_mm_cvtsi128_si32(OrVector) >> 24;
+#endif
+		for (; i < BlockEnd; ++i)
+		{
+			And &= Pixels[i * 4 + 3];
+			Or |= Pixels[i * 4 + 3];
+		}
+		if (ToAlphaKind(And, Or) == ALPHA_TRANSLUCENT) return ALPHA_TRANSLUCENT;
+	}
+	return ToAlphaKind(And, Or);
+}
+
+
+void PremultiplyAlpha(BYTE *Pixels, SIZE_T PixelCount)
+{
+	SIZE_T i = 0;
+#ifdef PORTABLE_SSE2
+	const __m128i Zero = _mm_setzero_si128();
+	const __m128i AlphaBytes = _mm_set1_epi32((int)0xFF000000);
+	const __m128i ColorLanes = _mm_set_epi16(0, -1, -1, -1, 0, -1, -1, -1);
+	// The alpha channel is multiplied by 255, i.e. stays as it is.
+	const __m128i AlphaLanes = _mm_set_epi16(255, 0, 0, 0, 255, 0, 0, 0);
+	const __m128i Rounding = _mm_set1_epi16(128);
+	for (; i + 4 <= PixelCount; i += 4)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)(Pixels + i * 4));
+		// Opaque pixels are by far the most common, even in translucent images.
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(_mm_and_si128(v, AlphaBytes), AlphaBytes)) == 0xFFFF) continue;
+
+		__m128i Halves[2] = { _mm_unpacklo_epi8(v, Zero), _mm_unpackhi_epi8(v, Zero) };
+		for (int h = 0; h < 2; ++h)
+		{
+			__m128i Alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(Halves[h], 0xFF), 0xFF);
+			Alpha = _mm_or_si128(_mm_and_si128(Alpha, ColorLanes), AlphaLanes);
+			__m128i t = _mm_add_epi16(_mm_mullo_epi16(Halves[h], Alpha), Rounding);
+			Halves[h] = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+		}
+		_mm_storeu_si128((__m128i *)(Pixels + i * 4), _mm_packus_epi16(Halves[0], Halves[1]));
+	}
+#endif
+	for (; i < PixelCount; ++i)
+	{
+		BYTE *p = Pixels + i * 4;
+		DWORD a = p[3];
+		if (a == 255) continue;
+		p[0] = (BYTE)MultiplyDiv255(p[0], a);
+		p[1] = (BYTE)MultiplyDiv255(p[1], a);
+		p[2] = (BYTE)MultiplyDiv255(p[2], a);
+	}
+}
+
+
+void SetOpaque(BYTE *Pixels, SIZE_T PixelCount)
+{
+	for (SIZE_T i = 0; i < PixelCount; ++i)
+	{
+		Pixels[i * 4 + 3] = 0xFF;
+	}
+}
+
+
+// Sets Image->HasAlpha, and premultiplies the image if it has translucent pixels. An image whose alpha is 0 everywhere
+// usually comes from a program that doesn't fill in alpha at all, and is made opaque if ZeroAlphaIsOpaque.
+// Must be called before the image is shared.
+void PrepareDecodedAlpha(PIXEL_BUFFER *Image, BOOL ZeroAlphaIsOpaque)
+{
+	SIZE_T PixelCount = Image->SizeCb / 4;
+	ALPHA_KIND Kind = ClassifyAlpha(Image->Pixels, PixelCount);
+	if (Kind == ALPHA_TRANSPARENT && ZeroAlphaIsOpaque)
+	{
+		SetOpaque(Image->Pixels, PixelCount);
+		Kind = ALPHA_OPAQUE;
+	}
+	Image->HasAlpha = Kind != ALPHA_OPAQUE;
+	if (Image->HasAlpha)
+	{
+		PremultiplyAlpha(Image->Pixels, PixelCount);
+	}
+}
+
+
+// Color of the checkerboard square under the pixel (x, y).
+static DWORD GetCheckerboardGray(LONGLONG x, LONGLONG y)
+{
+	return ((x / CHECKERBOARD_SIZE + y / CHECKERBOARD_SIZE) & 1) != 0 ? CHECKERBOARD_DARK : CHECKERBOARD_LIGHT;
+}
+
+
+static DWORD CompositePixel(const BYTE *p, DWORD Gray)
+{
+	DWORD Background = MultiplyDiv255(Gray, 255 - p[3]);
+	DWORD Result = 0xFF000000;
+	for (int Channel = 0; Channel < 3; ++Channel)
+	{
+		DWORD Value = p[Channel] + Background;
+		Result |= (Value < 255 ? Value : 255) << (Channel * 8);
+	}
+	return Result;
+}
+
+
+// Draws the premultiplied Source over a checkerboard into Destination, which may be Source itself. The result is opaque.
+// (X, Y) is the position of the top left pixel relative to where the checkerboard is anchored; it must not be negative.
+void CompositeOverCheckerboard(const BYTE *Source, SIZE_T SourceStride, BYTE *Destination, SIZE_T DestinationStride, LONG Width, LONG Height, LONGLONG X, LONGLONG Y)
+{
+#ifdef PORTABLE_SSE2
+	const __m128i Zero = _mm_setzero_si128();
+	const __m128i Opaque = _mm_set1_epi32((int)0xFF000000);
+	const __m128i Max = _mm_set1_epi16(255);
+	const __m128i Rounding = _mm_set1_epi16(128);
+#endif
+	for (LONG y = 0; y < Height; ++y)
+	{
+		const BYTE *In = Source + (SIZE_T)y * SourceStride;
+		DWORD *Out = (DWORD *)(Destination + (SIZE_T)y * DestinationStride);
+		LONG x = 0;
+#ifdef PORTABLE_SSE2
+		// Up to where groups of four pixels start, which are never split between two squares.
+		for (; x < Width && (X + x) % 4 != 0; ++x)
+		{
+			Out[x] = CompositePixel(In + x * 4, GetCheckerboardGray(X + x, Y + y));
+		}
+		for (; x + 4 <= Width; x += 4)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i *)(In + x * 4));
+			__m128i Gray = _mm_set1_epi16((short)GetCheckerboardGray(X + x, Y + y));
+			__m128i Halves[2] = { _mm_unpacklo_epi8(v, Zero), _mm_unpackhi_epi8(v, Zero) };
+			for (int h = 0; h < 2; ++h)
+			{
+				__m128i Inverse = _mm_sub_epi16(Max, _mm_shufflehi_epi16(_mm_shufflelo_epi16(Halves[h], 0xFF), 0xFF));
+				__m128i t = _mm_add_epi16(_mm_mullo_epi16(Gray, Inverse), Rounding);
+				Halves[h] = _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+			}
+			__m128i Background = _mm_packus_epi16(Halves[0], Halves[1]);
+			_mm_storeu_si128((__m128i *)(Out + x), _mm_or_si128(_mm_adds_epu8(v, Background), Opaque));
+		}
+#endif
+		for (; x < Width; ++x)
+		{
+			Out[x] = CompositePixel(In + x * 4, GetCheckerboardGray(X + x, Y + y));
+		}
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include "Portable.h"
+
+struct PIXEL_BUFFER;
+
+// Alpha handling for BGRA pixels.
+//
+// Decoders produce straight alpha. Before an image is shared, PrepareDecodedAlpha finds out whether it has any
+// translucent pixels at all (most clipboard images don't), and if so premultiplies them, so that scaling and compositing
+// are plain weighted sums. For display, translucent images are composited over a checkerboard, which is anchored to the
+// top left corner of the (zoomed) image, so that it scrolls with it and composited tiles can be cached.
+
+enum ALPHA_KIND
+{
+	ALPHA_OPAQUE,       // Every alpha value is 255.
+	ALPHA_TRANSPARENT,  // Every alpha value is 0.
+	ALPHA_TRANSLUCENT,  // Anything else.
+};
+
+#define CHECKERBOARD_SIZE 8
+#define CHECKERBOARD_LIGHT 0xFF
+#define CHECKERBOARD_DARK 0xCC
+
+extern ALPHA_KIND          ClassifyAlpha(const BYTE *Pixels, SIZE_T PixelCount);
+extern void                PremultiplyAlpha(BYTE *Pixels, SIZE_T PixelCount);
+extern void                SetOpaque(BYTE *Pixels, SIZE_T PixelCount);
+extern void                PrepareDecodedAlpha(PIXEL_BUFFER *Image, BOOL ZeroAlphaIsOpaque);
+extern void                CompositeOverCheckerboard(const BYTE *Source, SIZE_T SourceStride, BYTE *Destination, SIZE_T DestinationStride, LONG Width, LONG Height, LONGLONG X, LONGLONG Y);
@@ -0,0 +1,86 @@
+#include "PixelBuffer.h"
+#include "PackedDIB.h"
+#include "PixelAlpha.h"
+#include <stdlib.h>
+#include <new>
+
+static std::atomic<LONGLONG> Stats_Allocations;
+static std::atomic<LONGLONG> Stats_Frees;
+static std::atomic<LONGLONG> Stats_BytesAllocated;
+static std::atomic<LONGLONG> Stats_LiveBytes;
+
+
+PIXEL_BUFFER *PixelBufferCreate(LONG Width, LONG Height)
+{
+	if (Width <= 0 || Height <= 0) return nullptr;
+	SIZE_T Stride = (SIZE_T)Width * 4;
+	if (Stride / 4 != (SIZE_T)Width || (SIZE_T)Height > ((SIZE_T)-1 - sizeof(PIXEL_BUFFER) - 15) / Stride) return nullptr;
+	SIZE_T SizeCb = Stride * Height;
+
+	void *Memory = malloc(sizeof(PIXEL_BUFFER) + 15 + SizeCb);
+	if (Memory == nullptr) return nullptr;
+
+	PIXEL_BUFFER *Buffer = new (Memory) PIXEL_BUFFER;
+	Buffer->RefCount = 1;
+	Buffer->Width = Width;
+	Buffer->Height = Height;
+	Buffer->Stride = Stride;
+	Buffer->SizeCb = SizeCb;
+	Buffer->Pixels = (BYTE *)(((UINT_PTR)(Buffer + 1) + 15) & ~(UINT_PTR)15);
+	Buffer->HasAlpha = false;
+	Buffer->HalfSize = nullptr;
+
+	++Stats_Allocations;
+	Stats_BytesAllocated += SizeCb;
+	Stats_LiveBytes += SizeCb;
+	return Buffer;
+}
+
+
+// This is the one and only copy of the pixels; everything else refers to the returned buffer.
+PIXEL_BUFFER *PixelBufferCreateFromPackedDIB(const BITMAPINFOHEADER *PackedDIB, SIZE_T PackedDIBSizeCb)
+{
+	PACKED_DIB_INFO Info;
+	if (!GetPackedDIBInfo(PackedDIB, PackedDIBSizeCb, &Info)) return nullptr;
+	PIXEL_BUFFER *Buffer = PixelBufferCreate(Info.Width, Info.Height);
+	if (Buffer == nullptr) return nullptr;
+	DecodePackedDIB(&Info, Buffer->Pixels, Buffer->Stride);
+	if (Info.HasAlpha)
+	{
+		PrepareDecodedAlpha(Buffer, Info.Masks[3] != 0);
+	}
+	return Buffer;
+}
+
+
+PIXEL_BUFFER *PixelBufferAddRef(PIXEL_BUFFER *Buffer)
+{
+	if (Buffer != nullptr)
+	{
+		Buffer->RefCount.fetch_add(1, std::memory_order_relaxed);
+	}
+	return Buffer;
+}
+
+
+void PixelBufferRelease(PIXEL_BUFFER *Buffer)
+{
+	if (Buffer == nullptr) return;
+	if (Buffer->RefCount.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+
+	++Stats_Frees;
+	Stats_LiveBytes -= Buffer->SizeCb;
+	PixelBufferRelease(Buffer->HalfSize);
+	Buffer->~PIXEL_BUFFER();
+	free(Buffer);
+}
+
+
+void GetPixelBufferStats(PIXEL_BUFFER_STATS *Stats)
+{
+	Stats->Allocations = Stats_Allocations;
+	Stats->Frees = Stats_Frees;
+	Stats->BytesAllocated = Stats_BytesAllocated;
+	Stats->LiveBuffers = Stats->Allocations - Stats->Frees;
+	Stats->LiveBytes = Stats_LiveBytes;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Portable.h"
+#include <atomic>
+
+// A reference counted 32bpp BGRA, top-down pixel buffer. Alpha is premultiplied (see PixelAlpha.h).
+// The pixels may only be written by whoever created the buffer, and only until the first PixelBufferAddRef.
+// After that, the buffer is immutable and can be shared freely between the viewer, the history, worker threads, etc.
+// Header and pixels live in a single allocation.
+
+struct PIXEL_BUFFER;
+struct PIXEL_BUFFER_STATS;
+
+extern PIXEL_BUFFER       *PixelBufferCreate(LONG Width, LONG Height);
+extern PIXEL_BUFFER       *PixelBufferCreateFromPackedDIB(const BITMAPINFOHEADER *PackedDIB, SIZE_T PackedDIBSizeCb);
+extern PIXEL_BUFFER       *PixelBufferAddRef(PIXEL_BUFFER *Buffer);
+extern void                PixelBufferRelease(PIXEL_BUFFER *Buffer);
+extern void                GetPixelBufferStats(PIXEL_BUFFER_STATS *Stats);
+
+struct PIXEL_BUFFER
+{
+	std::atomic<LONG> RefCount;
+	LONG Width;
+	LONG Height;
+	SIZE_T Stride; // Bytes per row. Always Width * 4, which is what SetDIBitsToDevice expects for 32bpp.
+	SIZE_T SizeCb; // Size of the pixel data in bytes.
+	BYTE *Pixels;  // 16 byte aligned.
+	BOOL HasAlpha; // Some pixels are not opaque, so the image must be composited rather than copied to the screen.
+	// The next level of the mip pyramid (see MipPyramid.h), or null. Owned by this buffer, and, like the pixels, only
+	// set by whoever created the buffer.
+	PIXEL_BUFFER *HalfSize;
+};
+
+// Process wide counters, so that the number of pixel copies can be checked.
+struct PIXEL_BUFFER_STATS
+{
+	LONGLONG Allocations;
+	LONGLONG Frees;
+	LONGLONG BytesAllocated; // Total over the lifetime of the process.
+	LONGLONG LiveBuffers;
+	LONGLONG LiveBytes;
+};
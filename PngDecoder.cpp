@@ -0,0 +1,976 @@
+#include "PngDecoder.h"
+#include "Inflate.h"
+#include "PixelBuffer.h"
+#include "PixelAlpha.h"
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// How often the decompression reports progress, i.e. how much of the filtered data is waiting to be unfiltered at most.
+// Small enough to still be in the cache when the rows are unfiltered.
+#define PROGRESS_INTERVAL (64 * 1024)
+// Below this much filtered data, starting a thread costs more than it saves.
+#define PIPELINE_MIN_SIZE (1024 * 1024)
+// DEFLATE cannot expand data by more than this: the longest match, 258 bytes, takes at least 2 bits.
+#define MAX_INFLATE_RATIO 1032
+
+static const BYTE PngSignature[PNG_SIGNATURE_SIZE] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+// The seven passes of Adam7 interlacing: first column, first row, column step, row step.
+static const BYTE Adam7Passes[7][4] =
+{
+	{ 0, 0, 8, 8 },
+	{ 4, 0, 8, 8 },
+	{ 0, 4, 4, 8 },
+	{ 2, 0, 4, 4 },
+	{ 0, 2, 2, 4 },
+	{ 1, 0, 2, 2 },
+	{ 0, 1, 1, 2 },
+};
+
+
+struct CRC_TABLES
+{
+	// Slicing by 8: Tables[k][b] is the CRC of byte b followed by k zero bytes.
+	DWORD Tables[8][256];
+};
+
+struct PNG_DECODER;
+typedef void (*PNG_ROW_KERNEL)(const PNG_DECODER *Decoder, const BYTE *Source, DWORD *Destination, LONG Width);
+
+// A pass of the image: all of it, or one of the Adam7 passes. Passes without pixels have no data at all.
+struct PNG_PASS
+{
+	LONG X;
+	LONG Y;
+	LONG StepX;
+	LONG StepY;
+	LONG Width;
+	LONG Height;
+	SIZE_T RowSizeCb;          // Without the filter type byte.
+};
+
+struct PNG_DECODER
+{
+	const PNG_INFO *Info;
+	PIXEL_BUFFER *Image;
+	PNG_PASS Passes[7];
+	UINT PassCount;
+	UINT PixelSizeCb;          // What filters count as one pixel: the bytes of a pixel, but at least 1.
+
+	// The filtered rows of all passes, each starting with its filter type, as decompressed.
+	BYTE *Filtered;
+	SIZE_T FilteredSizeCb;
+
+	// Rows are unfiltered into alternating buffers, so that the previous row is still there as the prior row. Rows
+	// without a filter are used where they are.
+	BYTE *RowBuffers[2];
+	UINT NextRowBuffer;
+	BYTE *ZeroRow;             // The prior row of the first row of each pass.
+	DWORD *PassRow;            // A converted row of an interlaced pass, before it is spread out over the image.
+
+	PNG_ROW_KERNEL Kernel;
+	DWORD Palette[256];        // Premultiplied BGRA. Also used for gray of up to 8 bits.
+	BOOL HasKey;               // tRNS gives a gray or RGB color that is transparent.
+	WORD Key[3];
+	BOOL MayHaveAlpha;
+	BOOL Premultiply;          // The kernel produces straight alpha.
+
+	// Where unfiltering is.
+	UINT Pass;
+	LONG PassY;
+	SIZE_T Offset;
+	const BYTE *Prior;
+	BOOL HasAlpha;
+
+	// For unfiltering on a second thread: how much the decompression has produced so far.
+	std::mutex Lock;
+	std::condition_variable Progressed;
+	SIZE_T Available;
+	BOOL Finished;
+	std::atomic<BOOL> UnfilterFailed;
+};
+
+
+static CRC_TABLES BuildCrcTables()
+{
+	CRC_TABLES Crc;
+	for (DWORD b = 0; b < 256; ++b)
+	{
+		DWORD c = b;
+		for (int k = 0; k < 8; ++k)
+		{
+			c = (c & 1) ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+		}
+		Crc.Tables[0][b] = c;
+	}
+	for (DWORD b = 0; b < 256; ++b)
+	{
+		for (int k = 1; k < 8; ++k)
+		{
+			DWORD c = Crc.Tables[k - 1][b];
+			Crc.Tables[k][b] = Crc.Tables[0][c & 0xFF] ^ (c >> 8);
+		}
+	}
+	return Crc;
+}
+
+
+// The CRC-32 of PNG chunks (and zip, and Ethernet).
+static DWORD ComputeCrc32(const BYTE *Data, SIZE_T SizeCb)
+{
+	static const CRC_TABLES Crc = BuildCrcTables();
+	const DWORD (*t)[256] = Crc.Tables;
+	DWORD c = 0xFFFFFFFF;
+	for (; SizeCb >= 8; SizeCb -= 8, Data += 8)
+	{
+		DWORD Low;
+		DWORD High;
+		memcpy(&Low, Data, 4);
+		memcpy(&High, Data + 4, 4);
+		Low ^= c;
+		c = t[7][Low & 0xFF] ^ t[6][(Low >> 8) & 0xFF] ^ t[5][(Low >> 16) & 0xFF] ^ t[4][Low >> 24] ^
+			t[3][High & 0xFF] ^ t[2][(High >> 8) & 0xFF] ^ t[1][(High >> 16) & 0xFF] ^ t[0][High >> 24];
+	}
+	for (; SizeCb > 0; --SizeCb, ++Data)
+	{
+		c = t[0][(c ^ *Data) & 0xFF] ^ (c >> 8);
+	}
+	return c ^ 0xFFFFFFFF;
+}
+
+
+static DWORD ReadBigEndian32(const BYTE *p)
+{
+	return ((DWORD)p[0] << 24) | ((DWORD)p[1] << 16) | ((DWORD)p[2] << 8) | p[3];
+}
+
+
+static BOOL IsChunkType(const BYTE *Type, const char *Name)
+{
+	return memcmp(Type, Name, 4) == 0;
+}
+
+
+// The CRC covers the chunk type and data. Chunk points at the length.
+static BOOL IsChunkCrcValid(const BYTE *Chunk, DWORD Length)
+{
+	return ComputeCrc32(Chunk + 4, 4 + (SIZE_T)Length) == ReadBigEndian32(Chunk + 8 + Length);
+}
+
+
+BOOL IsPng(const BYTE *Data, SIZE_T SizeCb)
+{
+	return SizeCb >= PNG_SIGNATURE_SIZE && memcmp(Data, PngSignature, PNG_SIGNATURE_SIZE) == 0;
+}
+
+
+static BOOL IsValidFormat(BYTE ColorType, BYTE BitDepth)
+{
+	switch (ColorType)
+	{
+		case PNG_GRAY:       return BitDepth == 1 || BitDepth == 2 || BitDepth == 4 || BitDepth == 8 || BitDepth == 16;
+		case PNG_PALETTE:    return BitDepth == 1 || BitDepth == 2 || BitDepth == 4 || BitDepth == 8;
+		case PNG_RGB:
+		case PNG_GRAY_ALPHA:
+		case PNG_RGBA:       return BitDepth == 8 || BitDepth == 16;
+	}
+	return false;
+}
+
+
+static BOOL ReadHeader(const BYTE *Content, DWORD Length, PNG_INFO *Info)
+{
+	if (Length != 13) return false;
+	DWORD Width = ReadBigEndian32(Content);
+	DWORD Height = ReadBigEndian32(Content + 4);
+	if (Width == 0 || Height == 0 || Width > 0x7FFFFFFF || Height > 0x7FFFFFFF) return false;
+	Info->Width = (LONG)Width;
+	Info->Height = (LONG)Height;
+	Info->BitDepth = Content[8];
+	Info->ColorType = Content[9];
+	// Compression and filter method 0 are the only ones there are.
+	if (!IsValidFormat(Info->ColorType, Info->BitDepth) || Content[10] != 0 || Content[11] != 0 || Content[12] > 1) return false;
+	Info->Interlaced = Content[12] == 1;
+	return true;
+}
+
+
+// Goes through the chunks up to IEND. Checks the CRCs of all chunks that are used, except for the IDAT chunks, whose
+// CRCs DecodePng checks when it gets to them.
+BOOL GetPngInfo(const BYTE *Data, SIZE_T SizeCb, PNG_INFO *Info)
+{
+	memset(Info, 0, sizeof(*Info));
+	if (!IsPng(Data, SizeCb)) return false;
+
+	SIZE_T Offset = PNG_SIGNATURE_SIZE;
+	BOOL HasHeader = false;
+	BOOL InIdats = false;
+	for (;;)
+	{
+		// Length, type and CRC.
+		if (SizeCb - Offset < 12) return false;
+		const BYTE *Chunk = Data + Offset;
+		DWORD Length = ReadBigEndian32(Chunk);
+		if (Length > 0x7FFFFFFF || Length > SizeCb - Offset - 12) return false;
+		const BYTE *Type = Chunk + 4;
+		const BYTE *Content = Chunk + 8;
+		Offset += 12 + (SIZE_T)Length;
+		// Critical chunks have an upper case first letter.
+		BOOL Critical = (Type[0] & 0x20) == 0;
+
+		if (!HasHeader && !IsChunkType(Type, "IHDR")) return false;
+		if (IsChunkType(Type, "IDAT"))
+		{
+			// All IDAT chunks must follow each other.
+			if (Info->IdatCount != 0 && !InIdats) return false;
+			if (Info->IdatCount == 0) Info->FirstIdat = Chunk;
+			++Info->IdatCount;
+			Info->IdatSizeCb += Length;
+			InIdats = true;
+			continue;
+		}
+		InIdats = false;
+
+		if (IsChunkType(Type, "IHDR"))
+		{
+			if (HasHeader || !IsChunkCrcValid(Chunk, Length) || !ReadHeader(Content, Length, Info)) return false;
+			HasHeader = true;
+		}
+		else if (IsChunkType(Type, "PLTE"))
+		{
+			if (Info->Palette != nullptr || Info->IdatCount != 0 || !IsChunkCrcValid(Chunk, Length)) return false;
+			if (Length == 0 || Length % 3 != 0 || Length / 3 > 256) return false;
+			// Gray images must not have one; for RGB images, it's only a suggestion for displays with few colors.
+			if (Info->ColorType == PNG_GRAY || Info->ColorType == PNG_GRAY_ALPHA) return false;
+			Info->Palette = Content;
+			Info->PaletteSize = Length / 3;
+		}
+		else if (IsChunkType(Type, "tRNS"))
+		{
+			// Ancillary, but it changes what the image looks like, so a damaged one is not just ignored.
+			if (Info->Transparency != nullptr || Info->IdatCount != 0 || !IsChunkCrcValid(Chunk, Length)) return false;
+			BOOL Usable =
+				(Info->ColorType == PNG_PALETTE && Info->Palette != nullptr) ||
+				(Info->ColorType == PNG_GRAY && Length >= 2) ||
+				(Info->ColorType == PNG_RGB && Length >= 6);
+			if (Usable)
+			{
+				Info->Transparency = Content;
+				Info->TransparencySizeCb = Length;
+			}
+		}
+		else if (IsChunkType(Type, "IEND"))
+		{
+			break;
+		}
+		else if (Critical)
+		{
+			return false;
+		}
+	}
+	if (Info->IdatCount == 0) return false;
+	if (Info->ColorType == PNG_PALETTE && Info->Palette == nullptr) return false;
+	return true;
+}
+
+
+// Makes the compressed data contiguous, checking the CRC of every IDAT chunk on the way. Returns the data, and in
+// *Copy what must be freed afterwards, which is null if there is only one IDAT chunk.
+static const BYTE *GatherIdats(const PNG_INFO *Info, BYTE **Copy)
+{
+	*Copy = nullptr;
+	if (Info->IdatCount > 1)
+	{
+		*Copy = (BYTE *)malloc(Info->IdatSizeCb != 0 ? Info->IdatSizeCb : 1);
+		if (*Copy == nullptr) return nullptr;
+	}
+	const BYTE *Chunk = Info->FirstIdat;
+	SIZE_T Offset = 0;
+	for (UINT i = 0; i < Info->IdatCount; ++i)
+	{
+		DWORD Length = ReadBigEndian32(Chunk);
+		if (!IsChunkCrcValid(Chunk, Length))
+		{
+			free(*Copy);
+			*Copy = nullptr;
+			return nullptr;
+		}
+		if (*Copy == nullptr) return Chunk + 8;
+		memcpy(*Copy + Offset, Chunk + 8, Length);
+		Offset += Length;
+		Chunk += 12 + (SIZE_T)Length;
+	}
+	return *Copy;
+}
+
+
+static BYTE PaethPredictor(int a, int b, int c)
+{
+	int pa = abs(b - c);
+	int pb = abs(a - c);
+	int pc = abs(a + b - 2 * c);
+	if (pa <= pb && pa <= pc) return (BYTE)a;
+	if (pb <= pc) return (BYTE)b;
+	return (BYTE)c;
+}
+
+
+#ifdef PORTABLE_SSE2
+// Every byte plus the bytes of the same channel in all pixels before it in the register.
+static __m128i SumPrecedingPixels(__m128i x, UINT PixelSizeCb)
+{
+	switch (PixelSizeCb)
+	{
+		case 1: x = _mm_add_epi8(x, _mm_slli_si128(x, 1)); // Fall through.
+		case 2: x = _mm_add_epi8(x, _mm_slli_si128(x, 2)); // Fall through.
+		case 4: x = _mm_add_epi8(x, _mm_slli_si128(x, 4)); // Fall through.
+		case 8: x = _mm_add_epi8(x, _mm_slli_si128(x, 8));
+	}
+	return x;
+}
+
+
+// The last pixel in the register, in every pixel.
+static __m128i BroadcastLastPixel(__m128i x, UINT PixelSizeCb)
+{
+	switch (PixelSizeCb)
+	{
+		case 1:
+			x = _mm_srli_si128(x, 15);
+			x = _mm_unpacklo_epi8(x, x);
+			return _mm_shuffle_epi32(_mm_unpacklo_epi16(x, x), 0);
+		case 2:
+			return _mm_shuffle_epi32(_mm_shufflelo_epi16(_mm_srli_si128(x, 14), 0), 0);
+		case 4:
+			return _mm_shuffle_epi32(x, 0xFF);
+	}
+	return _mm_unpackhi_epi64(x, x);
+}
+
+
+static __m128i Select(__m128i Mask, __m128i IfSet, __m128i IfClear)
+{
+	return _mm_or_si128(_mm_and_si128(Mask, IfSet), _mm_andnot_si128(Mask, IfClear));
+}
+
+
+static __m128i Abs16(__m128i x)
+{
+	return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+#endif
+
+
+// Out[i] = Row[i] + Out[i - PixelSizeCb].
+static void UnfilterSub(const BYTE *Row, BYTE *Out, SIZE_T RowSizeCb, UINT PixelSizeCb)
+{
+	SIZE_T i = 0;
+#ifdef PORTABLE_SSE2
+	if (PixelSizeCb == 3 || PixelSizeCb == 6)
+	{
+		// One pixel at a time; the bytes beyond it are overwritten by the next one, or are in the slack.
+		__m128i Left = _mm_setzero_si128();
+		for (; i < RowSizeCb; i += PixelSizeCb)
+		{
+			Left = _mm_add_epi8(_mm_loadl_epi64((const __m128i *)(Row + i)), Left);
+			_mm_storel_epi64((__m128i *)(Out + i), Left);
+		}
+		return;
+	}
+	// 16 bytes at a time, as a prefix sum within the register plus the last pixel of the previous 16 bytes.
+	__m128i Carry = _mm_setzero_si128();
+	for (; i + 16 <= RowSizeCb; i += 16)
+	{
+		__m128i x = _mm_add_epi8(SumPrecedingPixels(_mm_loadu_si128((const __m128i *)(Row + i)), PixelSizeCb), Carry);
+		_mm_storeu_si128((__m128i *)(Out + i), x);
+		Carry = BroadcastLastPixel(x, PixelSizeCb);
+	}
+#endif
+	for (; i < PixelSizeCb && i < RowSizeCb; ++i)
+	{
+		Out[i] = Row[i];
+	}
+	for (; i < RowSizeCb; ++i)
+	{
+		Out[i] = (BYTE)(Row[i] + Out[i - PixelSizeCb]);
+	}
+}
+
+
+// Out[i] = Row[i] + Prior[i].
+static void UnfilterUp(const BYTE *Row, const BYTE *Prior, BYTE *Out, SIZE_T RowSizeCb)
+{
+	SIZE_T i = 0;
+#ifdef PORTABLE_SSE2
+	for (; i + 16 <= RowSizeCb; i += 16)
+	{
+		__m128i x = _mm_loadu_si128((const __m128i *)(Row + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(Prior + i));
+		_mm_storeu_si128((__m128i *)(Out + i), _mm_add_epi8(x, b));
+	}
+#endif
+	for (; i < RowSizeCb; ++i)
+	{
+		Out[i] = (BYTE)(Row[i] + Prior[i]);
+	}
+}
+
+
+// Out[i] = Row[i] + (Out[i - PixelSizeCb] + Prior[i]) / 2.
+static void UnfilterAverage(const BYTE *Row, const BYTE *Prior, BYTE *Out, SIZE_T RowSizeCb, UINT PixelSizeCb)
+{
+	SIZE_T i = 0;
+#ifdef PORTABLE_SSE2
+	if (PixelSizeCb >= 3)
+	{
+		// One pixel at a time, like UnfilterSub. _mm_avg_epu8 rounds up, so the carry out of the lowest bit is taken
+		// off again.
+		const __m128i One = _mm_set1_epi8(1);
+		__m128i a = _mm_setzero_si128();
+		for (; i < RowSizeCb; i += PixelSizeCb)
+		{
+			__m128i b = _mm_loadl_epi64((const __m128i *)(Prior + i));
+			__m128i Average = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), One));
+			a = _mm_add_epi8(_mm_loadl_epi64((const __m128i *)(Row + i)), Average);
+			_mm_storel_epi64((__m128i *)(Out + i), a);
+		}
+		return;
+	}
+#endif
+	for (; i < PixelSizeCb && i < RowSizeCb; ++i)
+	{
+		Out[i] = (BYTE)(Row[i] + (Prior[i] >> 1));
+	}
+	for (; i < RowSizeCb; ++i)
+	{
+		Out[i] = (BYTE)(Row[i] + ((Out[i - PixelSizeCb] + Prior[i]) >> 1));
+	}
+}
+
+
+// Out[i] = Row[i] + whichever of the left, upper and upper left byte is closest to left + upper - upper left.
+static void UnfilterPaeth(const BYTE *Row, const BYTE *Prior, BYTE *Out, SIZE_T RowSizeCb, UINT PixelSizeCb)
+{
+	SIZE_T i = 0;
+#ifdef PORTABLE_SSE2
+	if (PixelSizeCb >= 3)
+	{
+		// One pixel at a time, in 16 bit lanes. With p = a + b - c, |p - a| = |b - c|, |p - b| = |a - c|, and
+		// |p - c| = |(b - c) + (a - c)|.
+		const __m128i Zero = _mm_setzero_si128();
+		__m128i a = Zero;
+		__m128i c = Zero;
+		for (; i < RowSizeCb; i += PixelSizeCb)
+		{
+			__m128i b = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)(Prior + i)), Zero);
+			__m128i p = _mm_sub_epi16(b, c);
+			__m128i q = _mm_sub_epi16(a, c);
+			__m128i pa = Abs16(p);
+			__m128i pb = Abs16(q);
+			__m128i pc = Abs16(_mm_add_epi16(p, q));
+			__m128i Smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+			// Ties go to a, then b.
+			__m128i Nearest = Select(_mm_cmpeq_epi16(Smallest, pa), a, Select(_mm_cmpeq_epi16(Smallest, pb), b, c));
+			__m128i x = _mm_add_epi8(_mm_loadl_epi64((const __m128i *)(Row + i)), _mm_packus_epi16(Nearest, Nearest));
+			_mm_storel_epi64((__m128i *)(Out + i), x);
+			a = _mm_unpacklo_epi8(x, Zero);
+			c = b;
+		}
+		return;
+	}
+#endif
+	for (; i < PixelSizeCb && i < RowSizeCb; ++i)
+	{
+		// With no left pixel, the predictor always picks the upper one.
+		Out[i] = (BYTE)(Row[i] + Prior[i]);
+	}
+	for (; i < RowSizeCb; ++i)
+	{
+		Out[i] = (BYTE)(Row[i] + PaethPredictor(Out[i - PixelSizeCb], Prior[i], Prior[i - PixelSizeCb]));
+	}
+}
+
+
+// Reverses a filter (1 to 4; 0 is a plain copy). Prior is the previous row, already unfiltered, or zeros for the first
+// row of a pass. Row, Prior and Out must have PNG_ROW_SLACK bytes after RowSizeCb that may be read (Row and Prior)
+// or overwritten (Out).
+void PngUnfilterRow(BYTE Filter, const BYTE *Row, const BYTE *Prior, BYTE *Out, SIZE_T RowSizeCb, UINT PixelSizeCb)
+{
+	switch (Filter)
+	{
+		case 1:  UnfilterSub(Row, Out, RowSizeCb, PixelSizeCb); break;
+		case 2:  UnfilterUp(Row, Prior, Out, RowSizeCb); break;
+		case 3:  UnfilterAverage(Row, Prior, Out, RowSizeCb, PixelSizeCb); break;
+		case 4:  UnfilterPaeth(Row, Prior, Out, RowSizeCb, PixelSizeCb); break;
+		default: memcpy(Out, Row, RowSizeCb); break;
+	}
+}
+
+
+static DWORD MakeOpaqueColor(DWORD Red, DWORD Green, DWORD Blue)
+{
+	return 0xFF000000 | (Red << 16) | (Green << 8) | Blue;
+}
+
+
+// Palette images, and gray of up to 8 bits through a palette of gray levels. Samples are packed from the top bit down.
+static void DecodeRow_Indexed(const PNG_DECODER *Decoder, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	UINT Depth = Decoder->Info->BitDepth;
+	if (Depth == 8)
+	{
+		for (LONG x = 0; x < Width; ++x)
+		{
+			Destination[x] = Decoder->Palette[Source[x]];
+		}
+		return;
+	}
+	DWORD Mask = (1u << Depth) - 1;
+	for (LONG x = 0; x < Width; ++x)
+	{
+		SIZE_T Bit = (SIZE_T)x * Depth;
+		Destination[x] = Decoder->Palette[(Source[Bit >> 3] >> (8 - Depth - (Bit & 7))) & Mask];
+	}
+}
+
+
+static void DecodeRow_Gray16(const PNG_DECODER *Decoder, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	for (LONG x = 0; x < Width; ++x)
+	{
+		const BYTE *p = Source + x * 2;
+		BOOL Transparent = Decoder->HasKey && ((p[0] << 8) | p[1]) == Decoder->Key[0];
+		Destination[x] = Transparent ? 0 : MakeOpaqueColor(p[0], p[0], p[0]);
+	}
+}
+
+
+static void DecodeRow_RGB8(const PNG_DECODER *, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	for (LONG x = 0; x < Width; ++x)
+	{
+		const BYTE *p = Source + x * 3;
+		Destination[x] = MakeOpaqueColor(p[0], p[1], p[2]);
+	}
+}
+
+
+#ifdef PORTABLE_SSE2
+PORTABLE_TARGET("ssse3")
+static void DecodeRow_RGB8_SSSE3(const PNG_DECODER *Decoder, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	const __m128i Shuffle = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+	const __m128i Alpha = _mm_set1_epi32((int)0xFF000000);
+	LONG x = 0;
+	// Each iteration reads 16 bytes but only consumes 12; stop early enough to never read past the end of the row.
+	for (; x + 6 <= Width; x += 4, Source += 12)
+	{
+		__m128i Pixels = _mm_loadu_si128((const __m128i *)Source);
+		_mm_storeu_si128((__m128i *)(Destination + x), _mm_or_si128(_mm_shuffle_epi8(Pixels, Shuffle), Alpha));
+	}
+	DecodeRow_RGB8(Decoder, Source, Destination + x, Width - x);
+}
+#endif
+
+
+static void DecodeRow_RGB8Key(const PNG_DECODER *Decoder, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	const WORD *Key = Decoder->Key;
+	for (LONG x = 0; x < Width; ++x)
+	{
+		const BYTE *p = Source + x * 3;
+		BOOL Transparent = p[0] == Key[0] && p[1] == Key[1] && p[2] == Key[2];
+		Destination[x] = Transparent ? 0 : MakeOpaqueColor(p[0], p[1], p[2]);
+	}
+}
+
+
+static void DecodeRow_RGB16(const PNG_DECODER *Decoder, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	const WORD *Key = Decoder->Key;
+	for (LONG x = 0; x < Width; ++x)
+	{
+		const BYTE *p = Source + x * 6;
+		BOOL Transparent = Decoder->HasKey && ((p[0] << 8) | p[1]) == Key[0] && ((p[2] << 8) | p[3]) == Key[1] && ((p[4] << 8) | p[5]) == Key[2];
+		Destination[x] = Transparent ? 0 : MakeOpaqueColor(p[0], p[2], p[4]);
+	}
+}
+
+
+static void DecodeRow_GrayAlpha8(const PNG_DECODER *, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	LONG x = 0;
+#ifdef PORTABLE_SSE2
+	// As 16 bit lanes, a pixel is gray | alpha << 8; the result is (gray | gray << 8) | pixel << 16.
+	const __m128i GrayMask = _mm_set1_epi16(0xFF);
+	for (; x + 8 <= Width; x += 8)
+	{
+		__m128i Pixels = _mm_loadu_si128((const __m128i *)(Source + x * 2));
+		__m128i Gray = _mm_and_si128(Pixels, GrayMask);
+		Gray = _mm_or_si128(Gray, _mm_slli_epi16(Gray, 8));
+		_mm_storeu_si128((__m128i *)(Destination + x), _mm_unpacklo_epi16(Gray, Pixels));
+		_mm_storeu_si128((__m128i *)(Destination + x + 4), _mm_unpackhi_epi16(Gray, Pixels));
+	}
+#endif
+	for (; x < Width; ++x)
+	{
+		DWORD Gray = Source[x * 2];
+		Destination[x] = ((DWORD)Source[x * 2 + 1] << 24) | (Gray << 16) | (Gray << 8) | Gray;
+	}
+}
+
+
+static void DecodeRow_GrayAlpha16(const PNG_DECODER *, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	for (LONG x = 0; x < Width; ++x)
+	{
+		DWORD Gray = Source[x * 4];
+		Destination[x] = ((DWORD)Source[x * 4 + 2] << 24) | (Gray << 16) | (Gray << 8) | Gray;
+	}
+}
+
+
+static void DecodeRow_RGBA8(const PNG_DECODER *, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	LONG x = 0;
+#ifdef PORTABLE_SSE2
+	// Swaps red and blue.
+	const __m128i RedBlue = _mm_set1_epi32(0x00FF00FF);
+	for (; x + 4 <= Width; x += 4)
+	{
+		__m128i Pixels = _mm_loadu_si128((const __m128i *)(Source + x * 4));
+		__m128i rb = _mm_and_si128(Pixels, RedBlue);
+		rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+		_mm_storeu_si128((__m128i *)(Destination + x), _mm_or_si128(_mm_andnot_si128(RedBlue, Pixels), rb));
+	}
+#endif
+	for (; x < Width; ++x)
+	{
+		const BYTE *p = Source + x * 4;
+		Destination[x] = ((DWORD)p[3] << 24) | ((DWORD)p[0] << 16) | ((DWORD)p[1] << 8) | p[2];
+	}
+}
+
+
+static void DecodeRow_RGBA16(const PNG_DECODER *, const BYTE *Source, DWORD *Destination, LONG Width)
+{
+	for (LONG x = 0; x < Width; ++x)
+	{
+		const BYTE *p = Source + x * 8;
+		Destination[x] = ((DWORD)p[6] << 24) | ((DWORD)p[0] << 16) | ((DWORD)p[2] << 8) | p[4];
+	}
+}
+
+
+static void BuildPalette(PNG_DECODER *Decoder)
+{
+	const PNG_INFO *Info = Decoder->Info;
+	for (UINT i = 0; i < 256; ++i)
+	{
+		DWORD Color = 0xFF000000;
+		if (Info->ColorType == PNG_PALETTE)
+		{
+			// Indices beyond the palette are black, like in browsers.
+			if (i < Info->PaletteSize)
+			{
+				const BYTE *p = Info->Palette + i * 3;
+				Color = MakeOpaqueColor(p[0], p[1], p[2]);
+			}
+			if (i < Info->TransparencySizeCb)
+			{
+				Color = (Color & 0x00FFFFFF) | ((DWORD)Info->Transparency[i] << 24);
+				Decoder->MayHaveAlpha |= Info->Transparency[i] != 0xFF;
+			}
+		}
+		else if (i < (1u << Info->BitDepth))
+		{
+			// Scaled up to 8 bits by repeating the bits, e.g. 0b10 becomes 0b10101010.
+			DWORD Gray = i * (255 / ((1u << Info->BitDepth) - 1));
+			Color = Decoder->HasKey && i == Decoder->Key[0] ? 0 : MakeOpaqueColor(Gray, Gray, Gray);
+		}
+		Decoder->Palette[i] = Color;
+	}
+	PremultiplyAlpha((BYTE *)Decoder->Palette, 256);
+}
+
+
+static PNG_ROW_KERNEL SelectRowKernel(PNG_DECODER *Decoder)
+{
+	const PNG_INFO *Info = Decoder->Info;
+	BOOL Is16 = Info->BitDepth == 16;
+	if (Info->Transparency != nullptr && Info->ColorType != PNG_PALETTE)
+	{
+		const BYTE *t = Info->Transparency;
+		Decoder->HasKey = true;
+		Decoder->Key[0] = (WORD)((t[0] << 8) | t[1]);
+		if (Info->ColorType == PNG_RGB)
+		{
+			Decoder->Key[1] = (WORD)((t[2] << 8) | t[3]);
+			Decoder->Key[2] = (WORD)((t[4] << 8) | t[5]);
+		}
+		Decoder->MayHaveAlpha = true;
+	}
+
+	switch (Info->ColorType)
+	{
+		case PNG_GRAY:
+			if (Is16) return DecodeRow_Gray16;
+			BuildPalette(Decoder);
+			return DecodeRow_Indexed;
+		case PNG_PALETTE:
+			BuildPalette(Decoder);
+			return DecodeRow_Indexed;
+		case PNG_RGB:
+			if (Is16) return DecodeRow_RGB16;
+			if (Decoder->HasKey) return DecodeRow_RGB8Key;
+#ifdef PORTABLE_SSE2
+			if (CpuHasSSSE3()) return DecodeRow_RGB8_SSSE3;
+#endif
+			return DecodeRow_RGB8;
+	}
+	// With an alpha channel.
+	Decoder->MayHaveAlpha = true;
+	Decoder->Premultiply = true;
+	if (Info->ColorType == PNG_GRAY_ALPHA) return Is16 ? DecodeRow_GrayAlpha16 : DecodeRow_GrayAlpha8;
+	return Is16 ? DecodeRow_RGBA16 : DecodeRow_RGBA8;
+}
+
+
+static UINT GetChannelCount(BYTE ColorType)
+{
+	switch (ColorType)
+	{
+		case PNG_RGB:        return 3;
+		case PNG_GRAY_ALPHA: return 2;
+		case PNG_RGBA:       return 4;
+	}
+	return 1;
+}
+
+
+// Works out where the passes are in the filtered data, and how large it is. Fails if that does not fit in memory, or
+// if the compressed data cannot possibly be that much, so that a small file cannot make the decoder allocate gigabytes.
+static BOOL SetUpPasses(PNG_DECODER *Decoder)
+{
+	const PNG_INFO *Info = Decoder->Info;
+	ULONGLONG BitsPerPixel = (ULONGLONG)GetChannelCount(Info->ColorType) * Info->BitDepth;
+	Decoder->PixelSizeCb = BitsPerPixel >= 8 ? (UINT)(BitsPerPixel / 8) : 1;
+	Decoder->PassCount = Info->Interlaced ? 7 : 1;
+	ULONGLONG Total = 0;
+	for (UINT i = 0; i < Decoder->PassCount; ++i)
+	{
+		PNG_PASS *Pass = &Decoder->Passes[i];
+		const BYTE *Adam7 = Info->Interlaced ? Adam7Passes[i] : nullptr;
+		Pass->X = Adam7 != nullptr ? Adam7[0] : 0;
+		Pass->Y = Adam7 != nullptr ? Adam7[1] : 0;
+		Pass->StepX = Adam7 != nullptr ? Adam7[2] : 1;
+		Pass->StepY = Adam7 != nullptr ? Adam7[3] : 1;
+		// Rounded up, without overflowing for sizes near 2^31.
+		Pass->Width = Info->Width > Pass->X ? (Info->Width - Pass->X - 1) / Pass->StepX + 1 : 0;
+		Pass->Height = Info->Height > Pass->Y && Pass->Width > 0 ? (Info->Height - Pass->Y - 1) / Pass->StepY + 1 : 0;
+		ULONGLONG RowSizeCb = ((ULONGLONG)Pass->Width * BitsPerPixel + 7) / 8;
+		Pass->RowSizeCb = (SIZE_T)RowSizeCb;
+		// Width and height are below 2^31, and a pixel has at most 64 bits, so this cannot overflow.
+		Total += (RowSizeCb + (Pass->Height > 0 ? 1 : 0)) * Pass->Height;
+	}
+	if (Total > (SIZE_T)-1 - PNG_ROW_SLACK - INFLATE_OUTPUT_SLACK) return false;
+	if (Total > ((ULONGLONG)Info->IdatSizeCb + 1) * MAX_INFLATE_RATIO) return false;
+	Decoder->FilteredSizeCb = (SIZE_T)Total;
+	return true;
+}
+
+
+static void StoreRow(PNG_DECODER *Decoder, const PNG_PASS *Pass, const BYTE *Unfiltered)
+{
+	PIXEL_BUFFER *Image = Decoder->Image;
+	DWORD *Destination = (DWORD *)(Image->Pixels + (SIZE_T)(Pass->Y + Decoder->PassY * Pass->StepY) * Image->Stride);
+	// Interlaced rows are converted on their own first, and then spread out.
+	DWORD *Converted = Pass->StepX == 1 ? Destination : Decoder->PassRow;
+	Decoder->Kernel(Decoder, Unfiltered, Converted, Pass->Width);
+	if (Decoder->MayHaveAlpha)
+	{
+		if (Decoder->Premultiply) PremultiplyAlpha((BYTE *)Converted, Pass->Width);
+		if (!Decoder->HasAlpha) Decoder->HasAlpha = ClassifyAlpha((const BYTE *)Converted, Pass->Width) != ALPHA_OPAQUE;
+	}
+	if (Converted != Destination)
+	{
+		for (LONG x = 0; x < Pass->Width; ++x)
+		{
+			Destination[Pass->X + x * Pass->StepX] = Converted[x];
+		}
+	}
+}
+
+
+// Unfilters and stores all rows that are complete in the first AvailableCb bytes of the filtered data. Unfiltering
+// reads a little beyond the row, so until the decompression is done, that has to be available too. Returns false if a
+// row has an invalid filter type.
+static BOOL UnfilterRows(PNG_DECODER *Decoder, SIZE_T AvailableCb)
+{
+	BOOL Complete = AvailableCb == Decoder->FilteredSizeCb;
+	while (Decoder->Pass < Decoder->PassCount)
+	{
+		const PNG_PASS *Pass = &Decoder->Passes[Decoder->Pass];
+		if (Decoder->PassY == Pass->Height)
+		{
+			++Decoder->Pass;
+			Decoder->PassY = 0;
+			Decoder->Prior = Decoder->ZeroRow;
+			continue;
+		}
+		SIZE_T End = Decoder->Offset + 1 + Pass->RowSizeCb;
+		if (Complete ? End > AvailableCb : End + PNG_ROW_SLACK > AvailableCb) break;
+
+		const BYTE *Row = Decoder->Filtered + Decoder->Offset;
+		BYTE Filter = Row[0];
+		if (Filter > 4) return false;
+		const BYTE *Unfiltered = Row + 1;
+		if (Filter != 0)
+		{
+			BYTE *Out = Decoder->RowBuffers[Decoder->NextRowBuffer];
+			Decoder->NextRowBuffer ^= 1;
+			PngUnfilterRow(Filter, Row + 1, Decoder->Prior, Out, Pass->RowSizeCb, Decoder->PixelSizeCb);
+			Unfiltered = Out;
+		}
+		StoreRow(Decoder, Pass, Unfiltered);
+		Decoder->Prior = Unfiltered;
+		Decoder->Offset = End;
+		++Decoder->PassY;
+	}
+	return true;
+}
+
+
+// Progress callback for unfiltering on the same thread.
+static BOOL UnfilterProgress(void *Context, SIZE_T ProducedCb)
+{
+	return UnfilterRows((PNG_DECODER *)Context, ProducedCb);
+}
+
+
+// Progress callback for unfiltering on a second thread. Stops the decompression if unfiltering has failed.
+static BOOL PublishProgress(void *Context, SIZE_T ProducedCb)
+{
+	PNG_DECODER *Decoder = (PNG_DECODER *)Context;
+	{
+		std::lock_guard<std::mutex> Lock(Decoder->Lock);
+		Decoder->Available = ProducedCb;
+	}
+	Decoder->Progressed.notify_one();
+	return !Decoder->UnfilterFailed.load(std::memory_order_relaxed);
+}
+
+
+static void UnfilterThread(PNG_DECODER *Decoder)
+{
+	SIZE_T Available = 0;
+	BOOL Finished = false;
+	while (!Finished)
+	{
+		{
+			std::unique_lock<std::mutex> Lock(Decoder->Lock);
+			while (Decoder->Available == Available && !Decoder->Finished)
+			{
+				Decoder->Progressed.wait(Lock);
+			}
+			Available = Decoder->Available;
+			Finished = Decoder->Finished;
+		}
+		if (!UnfilterRows(Decoder, Available))
+		{
+			Decoder->UnfilterFailed.store(true);
+			return;
+		}
+	}
+}
+
+
+// Decompresses the image data, and unfilters the rows as they come in, on this thread or on a second one.
+static BOOL DecompressAndUnfilter(PNG_DECODER *Decoder, const BYTE *Compressed, SIZE_T CompressedSizeCb, UINT ThreadCount)
+{
+	INFLATE_PROGRESS Progress = { PROGRESS_INTERVAL, UnfilterProgress, Decoder };
+	SIZE_T ProducedCb;
+	BOOL Succeeded;
+	if (ThreadCount != 1 && Decoder->FilteredSizeCb >= PIPELINE_MIN_SIZE)
+	{
+		Progress.Callback = PublishProgress;
+		Decoder->Available = 0;
+		Decoder->Finished = false;
+		Decoder->UnfilterFailed.store(false);
+		std::thread Unfilter(UnfilterThread, Decoder);
+		Succeeded = ZlibInflate(Compressed, CompressedSizeCb, Decoder->Filtered, Decoder->FilteredSizeCb, &ProducedCb, &Progress);
+		{
+			std::lock_guard<std::mutex> Lock(Decoder->Lock);
+			Decoder->Finished = true;
+		}
+		Decoder->Progressed.notify_one();
+		Unfilter.join();
+		Succeeded &= !Decoder->UnfilterFailed.load();
+	}
+	else
+	{
+		Succeeded = ZlibInflate(Compressed, CompressedSizeCb, Decoder->Filtered, Decoder->FilteredSizeCb, &ProducedCb, &Progress);
+	}
+	// Every row must be there.
+	return Succeeded && ProducedCb == Decoder->FilteredSizeCb && Decoder->Pass == Decoder->PassCount;
+}
+
+
+// Returns null if the image data is damaged or incomplete, or if out of memory.
+PIXEL_BUFFER *DecodePng(const PNG_INFO *Info, UINT ThreadCount)
+{
+	PNG_DECODER *Decoder = new PNG_DECODER();
+	Decoder->Info = Info;
+	PIXEL_BUFFER *Image = nullptr;
+	BYTE *IdatCopy = nullptr;
+	const BYTE *Compressed = nullptr;
+	if (SetUpPasses(Decoder))
+	{
+		SIZE_T MaxRowSizeCb = 0;
+		for (UINT i = 0; i < Decoder->PassCount; ++i)
+		{
+			if (Decoder->Passes[i].RowSizeCb > MaxRowSizeCb) MaxRowSizeCb = Decoder->Passes[i].RowSizeCb;
+		}
+		Image = PixelBufferCreate(Info->Width, Info->Height);
+		Decoder->Filtered = (BYTE *)malloc(Decoder->FilteredSizeCb + PNG_ROW_SLACK + INFLATE_OUTPUT_SLACK);
+		// Zeroed, so that what unfiltering reads beyond the rows is at least defined.
+		Decoder->RowBuffers[0] = (BYTE *)calloc(1, MaxRowSizeCb + PNG_ROW_SLACK);
+		Decoder->RowBuffers[1] = (BYTE *)calloc(1, MaxRowSizeCb + PNG_ROW_SLACK);
+		Decoder->ZeroRow = (BYTE *)calloc(1, MaxRowSizeCb + PNG_ROW_SLACK);
+		// The widest pass that is spread out is the fifth, with every other column.
+		Decoder->PassRow = Info->Interlaced ? (DWORD *)malloc(((SIZE_T)Info->Width + 1) / 2 * sizeof(DWORD)) : nullptr;
+		Compressed = GatherIdats(Info, &IdatCopy);
+	}
+	BOOL Succeeded = Image != nullptr && Decoder->Filtered != nullptr && Decoder->RowBuffers[0] != nullptr && Decoder->RowBuffers[1] != nullptr &&
+		Decoder->ZeroRow != nullptr && (Decoder->PassRow != nullptr || !Info->Interlaced) && Compressed != nullptr;
+	if (Succeeded)
+	{
+		memset(Decoder->Filtered + Decoder->FilteredSizeCb, 0, PNG_ROW_SLACK + INFLATE_OUTPUT_SLACK);
+		Decoder->Image = Image;
+		Decoder->Kernel = SelectRowKernel(Decoder);
+		Decoder->Prior = Decoder->ZeroRow;
+		Succeeded = DecompressAndUnfilter(Decoder, Compressed, Info->IdatSizeCb, ThreadCount);
+	}
+	if (Succeeded)
+	{
+		Image->HasAlpha = Decoder->HasAlpha;
+	}
+	else
+	{
+		PixelBufferRelease(Image);
+		Image = nullptr;
+	}
+
+	free(IdatCopy);
+	free(Decoder->Filtered);
+	free(Decoder->RowBuffers[0]);
+	free(Decoder->RowBuffers[1]);
+	free(Decoder->ZeroRow);
+	free(Decoder->PassRow);
+	delete Decoder;
+	return Image;
+}
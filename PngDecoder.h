@@ -0,0 +1,52 @@
+#pragma once
+
+#include "Portable.h"
+
+struct PIXEL_BUFFER;
+struct PNG_INFO;
+
+// Decodes PNG files (what the registered "PNG" clipboard format and the X11 image/png target contain) into a
+// PIXEL_BUFFER, premultiplied, with HasAlpha set if any pixel is not opaque.
+//
+// All color types and bit depths are supported, with palettes, tRNS transparency and Adam7 interlacing. 16 bit samples
+// are cut down to their high byte. Ancillary chunks (gamma, color profiles, text, ...) are ignored. Every chunk up to
+// IEND must have a valid CRC, and unknown critical chunks are rejected. So are images that are larger than their
+// compressed data could possibly decompress to, before anything is allocated for them.
+//
+// The image data is decompressed with ZlibInflate (see Inflate.h) into a buffer of filtered scanlines, and each row is
+// unfiltered and converted as soon as it is complete, while it is still in the cache. With more than one thread, that
+// happens on a second thread, behind the decompression, which is the part that cannot be parallelized.
+// ThreadCount 0 uses as many threads as are useful, which for this pipeline is two.
+
+#define PNG_SIGNATURE_SIZE 8
+// Unfiltering reads and writes up to this many bytes past the end of each row.
+#define PNG_ROW_SLACK 16
+
+extern BOOL                IsPng(const BYTE *Data, SIZE_T SizeCb);
+extern BOOL                GetPngInfo(const BYTE *Data, SIZE_T SizeCb, PNG_INFO *Info);
+extern PIXEL_BUFFER       *DecodePng(const PNG_INFO *Info, UINT ThreadCount);
+extern void                PngUnfilterRow(BYTE Filter, const BYTE *Row, const BYTE *Prior, BYTE *Out, SIZE_T RowSizeCb, UINT PixelSizeCb);
+
+// Color types.
+#define PNG_GRAY 0
+#define PNG_RGB 2
+#define PNG_PALETTE 3
+#define PNG_GRAY_ALPHA 4
+#define PNG_RGBA 6
+
+// Filled by GetPngInfo. The pointers point into the file, which must stay valid while decoding.
+struct PNG_INFO
+{
+	LONG Width;
+	LONG Height;
+	BYTE BitDepth;
+	BYTE ColorType;
+	BOOL Interlaced;
+	const BYTE *Palette;          // PLTE: red, green, blue.
+	UINT PaletteSize;             // In entries.
+	const BYTE *Transparency;     // tRNS: an alpha value per palette entry, or the 16 bit gray or RGB key color.
+	UINT TransparencySizeCb;
+	const BYTE *FirstIdat;        // The first IDAT chunk, starting with its length. The others follow it directly.
+	UINT IdatCount;
+	SIZE_T IdatSizeCb;            // The compressed data in all IDAT chunks.
+};
@@ -0,0 +1,55 @@
+#include "Portable.h"
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#endif
+
+static BOOL DetectSSSE3()
+{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+	int Info[4] = {};
+	__cpuid(Info, 1);
+	return (Info[2] & (1 << 9)) != 0;
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	unsigned int a = 0, b = 0, c = 0, d = 0;
+	return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_SSSE3) != 0;
+#else
+	return false;
+#endif
+}
+
+
+// Called from the UI, capture and decoding threads; the first call initializes the flag, and the others wait for it.
+BOOL CpuHasSSSE3()
+{
+	static const BOOL HasSSSE3 = DetectSSSE3();
+	return HasSSSE3;
+}
+
+
+// Microseconds since some arbitrary point in time. Never goes backwards.
+ULONGLONG GetMonotonicTimeUs()
+{
+#ifdef _WIN32
+	static LARGE_INTEGER Frequency;
+	if (Frequency.QuadPart == 0)
+	{
+		QueryPerformanceFrequency(&Frequency);
+	}
+	LARGE_INTEGER Counter;
+	QueryPerformanceCounter(&Counter);
+	ULONGLONG Seconds = Counter.QuadPart / Frequency.QuadPart;
+	ULONGLONG Remainder = Counter.QuadPart % Frequency.QuadPart;
+	return Seconds * 1000000 + Remainder * 1000000 / Frequency.QuadPart;
+#else
+	timespec Now;
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+	return (ULONGLONG)Now.tv_sec * 1000000 + Now.tv_nsec / 1000;
+#endif
+}
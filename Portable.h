@@ -0,0 +1,102 @@
+#pragma once
+
+// The clipboard processing code (decoders, hashing, history, ...) is written against the Win32 types,
+// but does not call into Windows. This header makes it compile without the Windows SDK, so that it
+// can be built and measured on other platforms as well.
+
+#ifdef _WIN32
+
+#include <sdkddkver.h>
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+
+#else
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef int32_t             BOOL;
+typedef uint8_t             BYTE;
+typedef uint16_t            WORD;
+typedef uint32_t            DWORD;
+typedef int32_t             LONG;
+typedef int32_t             INT;
+typedef uint32_t            UINT;
+typedef int64_t             LONGLONG;
+typedef uint64_t            ULONGLONG;
+typedef size_t              SIZE_T;
+typedef intptr_t            INT_PTR;
+typedef uintptr_t           UINT_PTR;
+typedef char16_t            WCHAR; // Clipboard text is always UTF-16, no matter what wchar_t is on this platform.
+
+#define BI_RGB              0
+#define BI_RLE8             1
+#define BI_RLE4             2
+#define BI_BITFIELDS        3
+
+#define CF_TEXT             1
+#define CF_BITMAP           2
+#define CF_OEMTEXT          7
+#define CF_DIB              8
+#define CF_UNICODETEXT      13
+#define CF_HDROP            15
+#define CF_LOCALE           16
+#define CF_DIBV5            17
+
+struct RGBQUAD
+{
+	BYTE rgbBlue;
+	BYTE rgbGreen;
+	BYTE rgbRed;
+	BYTE rgbReserved;
+};
+
+struct BITMAPCOREHEADER
+{
+	DWORD bcSize;
+	WORD  bcWidth;
+	WORD  bcHeight;
+	WORD  bcPlanes;
+	WORD  bcBitCount;
+};
+
+struct BITMAPINFOHEADER
+{
+	DWORD biSize;
+	LONG  biWidth;
+	LONG  biHeight;
+	WORD  biPlanes;
+	WORD  biBitCount;
+	DWORD biCompression;
+	DWORD biSizeImage;
+	LONG  biXPelsPerMeter;
+	LONG  biYPelsPerMeter;
+	DWORD biClrUsed;
+	DWORD biClrImportant;
+};
+
+#endif
+
+#ifndef BI_ALPHABITFIELDS
+#define BI_ALPHABITFIELDS   6
+#endif
+
+// SSE2 is part of x64, and the default target for 32-bit builds with MSVC.
+// Define PORTABLE_NO_SIMD to build the scalar code paths instead, e.g. to compare them in benchmarks.
+#if !defined(PORTABLE_NO_SIMD) && (defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define PORTABLE_SSE2 1
+#include <emmintrin.h>
+#include <tmmintrin.h>
+#endif
+
+// Functions using instructions beyond SSE2 must be marked with this, and must only be called after checking the matching CpuHas* function.
+// MSVC does not need this, but GCC and Clang refuse to emit the instructions otherwise.
+#if defined(__GNUC__)
+#define PORTABLE_TARGET(x) __attribute__((target(x)))
+#else
+#define PORTABLE_TARGET(x)
+#endif
+
+extern BOOL                CpuHasSSSE3();
+extern ULONGLONG           GetMonotonicTimeUs();
@@ -0,0 +1,289 @@
+#include "PortableFile.h"
+#include <string.h>
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+
+BOOL FileOpen(PORTABLE_FILE *File, const PATH_CHAR *Path, BOOL Create)
+{
+	HANDLE Handle = CreateFileW(Path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr, Create ? OPEN_ALWAYS : OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	File->Handle = Handle != INVALID_HANDLE_VALUE ? Handle : nullptr;
+	return File->Handle != nullptr;
+}
+
+
+// Unlike FileOpen, this works while the file is open for writing elsewhere.
+BOOL FileOpenForReading(PORTABLE_FILE *File, const PATH_CHAR *Path)
+{
+	HANDLE Handle = CreateFileW(Path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	File->Handle = Handle != INVALID_HANDLE_VALUE ? Handle : nullptr;
+	return File->Handle != nullptr;
+}
+
+
+void FileClose(PORTABLE_FILE *File)
+{
+	if (File->Handle != nullptr)
+	{
+		CloseHandle(File->Handle);
+		File->Handle = nullptr;
+	}
+}
+
+
+BOOL FileIsOpen(const PORTABLE_FILE *File)
+{
+	return File->Handle != nullptr;
+}
+
+
+BOOL FileGetSize(const PORTABLE_FILE *File, ULONGLONG *Size)
+{
+	LARGE_INTEGER FileSize;
+	if (!GetFileSizeEx(File->Handle, &FileSize)) return false;
+	*Size = FileSize.QuadPart;
+	return true;
+}
+
+
+static BOOL Seek(const PORTABLE_FILE *File, ULONGLONG Offset)
+{
+	LARGE_INTEGER Position;
+	Position.QuadPart = (LONGLONG)Offset;
+	return SetFilePointerEx(File->Handle, Position, nullptr, FILE_BEGIN);
+}
+
+
+BOOL FileReadAt(const PORTABLE_FILE *File, ULONGLONG Offset, void *Buffer, SIZE_T SizeCb)
+{
+	if (!Seek(File, Offset)) return false;
+	BYTE *Destination = (BYTE *)Buffer;
+	while (SizeCb > 0)
+	{
+		DWORD Chunk = SizeCb < 0x40000000 ? (DWORD)SizeCb : 0x40000000;
+		DWORD Read;
+		if (!ReadFile(File->Handle, Destination, Chunk, &Read, nullptr) || Read == 0) return false;
+		Destination += Read;
+		SizeCb -= Read;
+	}
+	return true;
+}
+
+
+BOOL FileWriteAt(const PORTABLE_FILE *File, ULONGLONG Offset, const void *Data, SIZE_T SizeCb)
+{
+	if (!Seek(File, Offset)) return false;
+	const BYTE *Source = (const BYTE *)Data;
+	while (SizeCb > 0)
+	{
+		DWORD Chunk = SizeCb < 0x40000000 ? (DWORD)SizeCb : 0x40000000;
+		DWORD Written;
+		if (!WriteFile(File->Handle, Source, Chunk, &Written, nullptr) || Written == 0) return false;
+		Source += Written;
+		SizeCb -= Written;
+	}
+	return true;
+}
+
+
+BOOL FileTruncate(const PORTABLE_FILE *File, ULONGLONG Size)
+{
+	return Seek(File, Size) && SetEndOfFile(File->Handle);
+}
+
+
+BOOL FileFlush(const PORTABLE_FILE *File)
+{
+	return FlushFileBuffers(File->Handle);
+}
+
+
+BOOL FileMapView(const PORTABLE_FILE *File, ULONGLONG Size, FILE_VIEW *View)
+{
+	memset(View, 0, sizeof(*View));
+	if (Size == 0) return true;
+	if (Size > (SIZE_T)-1) return false;
+	View->Mapping = CreateFileMappingW(File->Handle, nullptr, PAGE_READONLY, (DWORD)(Size >> 32), (DWORD)Size, nullptr);
+	if (View->Mapping == nullptr) return false;
+	View->Data = (const BYTE *)MapViewOfFile(View->Mapping, FILE_MAP_READ, 0, 0, (SIZE_T)Size);
+	if (View->Data == nullptr)
+	{
+		CloseHandle(View->Mapping);
+		View->Mapping = nullptr;
+		return false;
+	}
+	View->SizeCb = (SIZE_T)Size;
+	return true;
+}
+
+
+void FileUnmapView(FILE_VIEW *View)
+{
+	if (View->Data != nullptr) UnmapViewOfFile(View->Data);
+	if (View->Mapping != nullptr) CloseHandle(View->Mapping);
+	memset(View, 0, sizeof(*View));
+}
+
+
+BOOL FileDelete(const PATH_CHAR *Path)
+{
+	return DeleteFileW(Path);
+}
+
+
+BOOL FileExists(const PATH_CHAR *Path)
+{
+	return GetFileAttributesW(Path) != INVALID_FILE_ATTRIBUTES;
+}
+
+
+BOOL DirectoryCreate(const PATH_CHAR *Path)
+{
+	return CreateDirectoryW(Path, nullptr) || GetLastError() == ERROR_ALREADY_EXISTS;
+}
+
+
+// Only deletes empty directories.
+BOOL DirectoryDelete(const PATH_CHAR *Path)
+{
+	return RemoveDirectoryW(Path);
+}
+
+#else
+
+BOOL FileOpen(PORTABLE_FILE *File, const PATH_CHAR *Path, BOOL Create)
+{
+	File->Descriptor = open(Path, O_RDWR | O_CLOEXEC | (Create ? O_CREAT : 0), 0600);
+	File->IsOpen = File->Descriptor >= 0;
+	return File->IsOpen;
+}
+
+
+BOOL FileOpenForReading(PORTABLE_FILE *File, const PATH_CHAR *Path)
+{
+	File->Descriptor = open(Path, O_RDONLY | O_CLOEXEC);
+	File->IsOpen = File->Descriptor >= 0;
+	return File->IsOpen;
+}
+
+
+void FileClose(PORTABLE_FILE *File)
+{
+	if (File->IsOpen)
+	{
+		close(File->Descriptor);
+		File->IsOpen = false;
+	}
+}
+
+
+BOOL FileIsOpen(const PORTABLE_FILE *File)
+{
+	return File->IsOpen;
+}
+
+
+BOOL FileGetSize(const PORTABLE_FILE *File, ULONGLONG *Size)
+{
+	struct stat Stat;
+	if (fstat(File->Descriptor, &Stat) != 0) return false;
+	*Size = (ULONGLONG)Stat.st_size;
+	return true;
+}
+
+
+BOOL FileReadAt(const PORTABLE_FILE *File, ULONGLONG Offset, void *Buffer, SIZE_T SizeCb)
+{
+	BYTE *Destination = (BYTE *)Buffer;
+	while (SizeCb > 0)
+	{
+		ssize_t Read = pread(File->Descriptor, Destination, SizeCb, (off_t)Offset);
+		if (Read < 0 && errno == EINTR) continue;
+		if (Read <= 0) return false;
+		Destination += Read;
+		Offset += Read;
+		SizeCb -= Read;
+	}
+	return true;
+}
+
+
+BOOL FileWriteAt(const PORTABLE_FILE *File, ULONGLONG Offset, const void *Data, SIZE_T SizeCb)
+{
+	const BYTE *Source = (const BYTE *)Data;
+	while (SizeCb > 0)
+	{
+		ssize_t Written = pwrite(File->Descriptor, Source, SizeCb, (off_t)Offset);
+		if (Written < 0 && errno == EINTR) continue;
+		if (Written <= 0) return false;
+		Source += Written;
+		Offset += Written;
+		SizeCb -= Written;
+	}
+	return true;
+}
+
+
+BOOL FileTruncate(const PORTABLE_FILE *File, ULONGLONG Size)
+{
+	return ftruncate(File->Descriptor, (off_t)Size) == 0;
+}
+
+
+BOOL FileFlush(const PORTABLE_FILE *File)
+{
+	return fsync(File->Descriptor) == 0;
+}
+
+
+BOOL FileMapView(const PORTABLE_FILE *File, ULONGLONG Size, FILE_VIEW *View)
+{
+	memset(View, 0, sizeof(*View));
+	if (Size == 0) return true;
+	if (Size > (SIZE_T)-1) return false;
+	void *Data = mmap(nullptr, (SIZE_T)Size, PROT_READ, MAP_SHARED, File->Descriptor, 0);
+	if (Data == MAP_FAILED) return false;
+	View->Data = (const BYTE *)Data;
+	View->SizeCb = (SIZE_T)Size;
+	return true;
+}
+
+
+void FileUnmapView(FILE_VIEW *View)
+{
+	if (View->Data != nullptr) munmap((void *)View->Data, View->SizeCb);
+	memset(View, 0, sizeof(*View));
+}
+
+
+BOOL FileDelete(const PATH_CHAR *Path)
+{
+	return unlink(Path) == 0;
+}
+
+
+BOOL FileExists(const PATH_CHAR *Path)
+{
+	return access(Path, F_OK) == 0;
+}
+
+
+BOOL DirectoryCreate(const PATH_CHAR *Path)
+{
+	return mkdir(Path, 0700) == 0 || errno == EEXIST;
+}
+
+
+BOOL DirectoryDelete(const PATH_CHAR *Path)
+{
+	return rmdir(Path) == 0;
+}
+
+#endif
@@ -0,0 +1,56 @@
+#pragma once
+
+#include "Portable.h"
+
+struct PORTABLE_FILE;
+struct FILE_VIEW;
+
+// Just enough file access for the history store: positioned reads and writes, and read-only mappings.
+// Paths are wide on Windows and UTF-8 elsewhere.
+
+#ifdef _WIN32
+typedef WCHAR               PATH_CHAR;
+#define PATH_TEXT(s)        L##s
+#define PATH_SEPARATOR      '\\'
+#else
+typedef char                PATH_CHAR;
+#define PATH_TEXT(s)        s
+#define PATH_SEPARATOR      '/'
+#endif
+
+extern BOOL                FileOpen(PORTABLE_FILE *File, const PATH_CHAR *Path, BOOL Create);
+extern BOOL                FileOpenForReading(PORTABLE_FILE *File, const PATH_CHAR *Path);
+extern void                FileClose(PORTABLE_FILE *File);
+extern BOOL                FileIsOpen(const PORTABLE_FILE *File);
+extern BOOL                FileGetSize(const PORTABLE_FILE *File, ULONGLONG *Size);
+extern BOOL                FileReadAt(const PORTABLE_FILE *File, ULONGLONG Offset, void *Buffer, SIZE_T SizeCb);
+extern BOOL                FileWriteAt(const PORTABLE_FILE *File, ULONGLONG Offset, const void *Data, SIZE_T SizeCb);
+extern BOOL                FileTruncate(const PORTABLE_FILE *File, ULONGLONG Size);
+extern BOOL                FileFlush(const PORTABLE_FILE *File);
+extern BOOL                FileMapView(const PORTABLE_FILE *File, ULONGLONG Size, FILE_VIEW *View);
+extern void                FileUnmapView(FILE_VIEW *View);
+extern BOOL                FileDelete(const PATH_CHAR *Path);
+extern BOOL                FileExists(const PATH_CHAR *Path);
+extern BOOL                DirectoryCreate(const PATH_CHAR *Path);
+extern BOOL                DirectoryDelete(const PATH_CHAR *Path);
+
+struct PORTABLE_FILE
+{
+#ifdef _WIN32
+	HANDLE Handle;       // Null if not open.
+#else
+	int Descriptor;      // Only valid if IsOpen.
+	BOOL IsOpen;
+#endif
+};
+
+// A read-only view of the start of a file. Changes made to the file through FileWriteAt after mapping may or may not
+// show up in it.
+struct FILE_VIEW
+{
+	const BYTE *Data;    // Null for an empty view.
+	SIZE_T SizeCb;
+#ifdef _WIN32
+	HANDLE Mapping;
+#endif
+};
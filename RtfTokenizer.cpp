@@ -0,0 +1,557 @@
+#include "RtfTokenizer.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Control word parameters are 16 bit in the specification, but \binN and a few others can be larger. Longer ones are
+// cut down to this.
+#define MAX_PARAMETER 0x7FFFFFFF
+
+#define KEYWORD_CHARACTER 0     // Value: the character.
+#define KEYWORD_BREAK 1         // A line break.
+#define KEYWORD_DESTINATION 2   // Value: whether the destination holds document text.
+
+struct KEYWORD
+{
+	const char *Name;
+	BYTE Kind;
+	WCHAR Value;
+};
+
+
+// The control words that matter for the text. Everything else (formatting, mostly) is ignored.
+static const KEYWORD Keywords[] =
+{
+	{ "par", KEYWORD_BREAK, 0 },
+	{ "line", KEYWORD_BREAK, 0 },
+	{ "sect", KEYWORD_BREAK, 0 },
+	{ "page", KEYWORD_BREAK, 0 },
+	{ "row", KEYWORD_BREAK, 0 },
+	{ "nestrow", KEYWORD_BREAK, 0 },
+	{ "tab", KEYWORD_CHARACTER, '\t' },
+	{ "cell", KEYWORD_CHARACTER, '\t' },
+	{ "nestcell", KEYWORD_CHARACTER, '\t' },
+	{ "emdash", KEYWORD_CHARACTER, 0x2014 },
+	{ "endash", KEYWORD_CHARACTER, 0x2013 },
+	{ "emspace", KEYWORD_CHARACTER, 0x2003 },
+	{ "enspace", KEYWORD_CHARACTER, 0x2002 },
+	{ "qmspace", KEYWORD_CHARACTER, 0x2005 },
+	{ "bullet", KEYWORD_CHARACTER, 0x2022 },
+	{ "lquote", KEYWORD_CHARACTER, 0x2018 },
+	{ "rquote", KEYWORD_CHARACTER, 0x2019 },
+	{ "ldblquote", KEYWORD_CHARACTER, 0x201C },
+	{ "rdblquote", KEYWORD_CHARACTER, 0x201D },
+	{ "zwbo", KEYWORD_CHARACTER, 0x200B },
+	{ "zwnj", KEYWORD_CHARACTER, 0x200C },
+	{ "zwj", KEYWORD_CHARACTER, 0x200D },
+	{ "ltrmark", KEYWORD_CHARACTER, 0x200E },
+	{ "rtlmark", KEYWORD_CHARACTER, 0x200F },
+	{ "rtf", KEYWORD_DESTINATION, true },
+	{ "field", KEYWORD_DESTINATION, true },
+	{ "fldrslt", KEYWORD_DESTINATION, true },
+	{ "footnote", KEYWORD_DESTINATION, true },
+	{ "shptxt", KEYWORD_DESTINATION, true },
+	{ "fonttbl", KEYWORD_DESTINATION, false },
+	{ "colortbl", KEYWORD_DESTINATION, false },
+	{ "stylesheet", KEYWORD_DESTINATION, false },
+	{ "listtable", KEYWORD_DESTINATION, false },
+	{ "listoverridetable", KEYWORD_DESTINATION, false },
+	{ "revtbl", KEYWORD_DESTINATION, false },
+	{ "info", KEYWORD_DESTINATION, false },
+	{ "pict", KEYWORD_DESTINATION, false },
+	{ "object", KEYWORD_DESTINATION, false },
+	{ "nonshppict", KEYWORD_DESTINATION, false },
+	{ "fldinst", KEYWORD_DESTINATION, false },
+	{ "header", KEYWORD_DESTINATION, false },
+	{ "headerl", KEYWORD_DESTINATION, false },
+	{ "headerr", KEYWORD_DESTINATION, false },
+	{ "headerf", KEYWORD_DESTINATION, false },
+	{ "footer", KEYWORD_DESTINATION, false },
+	{ "footerl", KEYWORD_DESTINATION, false },
+	{ "footerr", KEYWORD_DESTINATION, false },
+	{ "footerf", KEYWORD_DESTINATION, false },
+	{ "author", KEYWORD_DESTINATION, false },
+	{ "title", KEYWORD_DESTINATION, false },
+	{ "subject", KEYWORD_DESTINATION, false },
+	{ "operator", KEYWORD_DESTINATION, false },
+};
+
+
+// Windows-1252 from 0x80 to 0x9F; the rest is the same as Latin-1. The holes map to themselves.
+static const WCHAR Windows1252[32] =
+{
+	0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021, 0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+	0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014, 0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178,
+};
+
+
+void RtfTokenizerInit(RTF_TOKENIZER *Tokenizer, const BYTE *Data, SIZE_T SizeCb)
+{
+	Tokenizer->Data = Data;
+	Tokenizer->SizeCb = SizeCb;
+	Tokenizer->Position = 0;
+	Tokenizer->BinarySizeCb = 0;
+}
+
+
+static BOOL IsLetter(BYTE c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+
+static BOOL IsDigit(BYTE c)
+{
+	return c >= '0' && c <= '9';
+}
+
+
+static int HexValue(BYTE c)
+{
+	if (c >= '0' && c <= '9') return c - '0';
+	if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+	return -1;
+}
+
+
+static BOOL EndsText(BYTE c)
+{
+	return c == '\\' || c == '{' || c == '}' || c == '\r' || c == '\n' || c == 0;
+}
+
+
+// Returns where the text that starts at Position ends. Most of a document is plain text, so this is the hot loop.
+static SIZE_T FindTextEnd(const BYTE *Data, SIZE_T Position, SIZE_T SizeCb)
+{
+#ifdef PORTABLE_SSE2
+	const __m128i Backslash = _mm_set1_epi8('\\');
+	const __m128i OpenBrace = _mm_set1_epi8('{');
+	const __m128i CloseBrace = _mm_set1_epi8('}');
+	const __m128i CarriageReturn = _mm_set1_epi8('\r');
+	const __m128i LineFeed = _mm_set1_epi8('\n');
+	const __m128i Zero = _mm_setzero_si128();
+	while (Position + 16 <= SizeCb)
+	{
+		__m128i Bytes = _mm_loadu_si128((const __m128i *)(Data + Position));
+		__m128i Braces = _mm_or_si128(_mm_cmpeq_epi8(Bytes, OpenBrace), _mm_cmpeq_epi8(Bytes, CloseBrace));
+		__m128i Breaks = _mm_or_si128(_mm_cmpeq_epi8(Bytes, CarriageReturn), _mm_cmpeq_epi8(Bytes, LineFeed));
+		__m128i Special = _mm_or_si128(_mm_or_si128(Braces, Breaks), _mm_or_si128(_mm_cmpeq_epi8(Bytes, Backslash), _mm_cmpeq_epi8(Bytes, Zero)));
+		if (_mm_movemask_epi8(Special) != 0) break;
+		Position += 16;
+	}
+#endif
+	while (Position < SizeCb && !EndsText(Data[Position])) ++Position;
+	return Position;
+}
+
+
+BOOL RtfNextToken(RTF_TOKENIZER *Tokenizer, RTF_TOKEN *Token)
+{
+	const BYTE *Data = Tokenizer->Data;
+	SIZE_T SizeCb = Tokenizer->SizeCb;
+	SIZE_T Position = Tokenizer->Position;
+	Token->Parameter = 0;
+	Token->HasParameter = false;
+
+	if (Tokenizer->BinarySizeCb > 0)
+	{
+		SIZE_T Remaining = SizeCb - Position;
+		Token->Type = RTF_TOKEN_BINARY;
+		Token->Data = Data + Position;
+		Token->SizeCb = Tokenizer->BinarySizeCb < Remaining ? Tokenizer->BinarySizeCb : Remaining;
+		Token->Offset = Position;
+		Tokenizer->Position = Position + Token->SizeCb;
+		Tokenizer->BinarySizeCb = 0;
+		return true;
+	}
+
+	while (Position < SizeCb && (Data[Position] == '\r' || Data[Position] == '\n')) ++Position;
+	Token->Data = Data + Position;
+	Token->Offset = Position;
+	// A backslash at the very end starts nothing.
+	if (Position == SizeCb || Data[Position] == 0 || (Data[Position] == '\\' && (Position + 1 == SizeCb || Data[Position + 1] == 0)))
+	{
+		Token->Type = RTF_TOKEN_END;
+		Token->SizeCb = 0;
+		Tokenizer->Position = Position;
+		return false;
+	}
+
+	BYTE c = Data[Position];
+	if (c == '{' || c == '}')
+	{
+		Token->Type = c == '{' ? RTF_TOKEN_GROUP_START : RTF_TOKEN_GROUP_END;
+		Token->SizeCb = 1;
+		++Position;
+	}
+	else if (c != '\\')
+	{
+		SIZE_T End = FindTextEnd(Data, Position, SizeCb);
+		Token->Type = RTF_TOKEN_TEXT;
+		Token->SizeCb = End - Position;
+		Position = End;
+	}
+	else if (IsLetter(Data[Position + 1]))
+	{
+		// \name, an optional signed number, and an optional space that belongs to the control word.
+		SIZE_T NameStart = ++Position;
+		while (Position < SizeCb && IsLetter(Data[Position])) ++Position;
+		Token->Type = RTF_TOKEN_CONTROL_WORD;
+		Token->Data = Data + NameStart;
+		Token->SizeCb = Position - NameStart;
+
+		BOOL Negative = Position + 1 < SizeCb && Data[Position] == '-' && IsDigit(Data[Position + 1]);
+		if (Negative) ++Position;
+		LONGLONG Parameter = 0;
+		while (Position < SizeCb && IsDigit(Data[Position]))
+		{
+			Parameter = Parameter * 10 + (Data[Position] - '0');
+			if (Parameter > MAX_PARAMETER) Parameter = MAX_PARAMETER;
+			Token->HasParameter = true;
+			++Position;
+		}
+		Token->Parameter = (LONG)(Negative ? -Parameter : Parameter);
+		if (Position < SizeCb && Data[Position] == ' ') ++Position;
+		if (Token->SizeCb == 3 && memcmp(Token->Data, "bin", 3) == 0 && Token->Parameter > 0) Tokenizer->BinarySizeCb = Token->Parameter;
+	}
+	else
+	{
+		// \x for any other character x, with \'hh carrying a byte.
+		++Position;
+		Token->Type = RTF_TOKEN_CONTROL_SYMBOL;
+		Token->Data = Data + Position;
+		Token->SizeCb = 1;
+		++Position;
+		if (Data[Position - 1] == '\'' && Position + 2 <= SizeCb)
+		{
+			int High = HexValue(Data[Position]);
+			int Low = HexValue(Data[Position + 1]);
+			if (High >= 0 && Low >= 0)
+			{
+				Token->Parameter = High * 16 + Low;
+				Token->HasParameter = true;
+				Position += 2;
+			}
+		}
+	}
+	Tokenizer->Position = Position;
+	return true;
+}
+
+
+struct GROUP_STATE
+{
+	BOOL Skip;                // In a destination that holds no text.
+	UINT UnicodeSkip;         // \ucN: how many fallback characters follow each \uN.
+	UINT OutlineEntry;        // 1 + the index of the group's outline entry, or 0.
+};
+
+
+struct TEXT_OUTPUT
+{
+	WCHAR *Text;
+	SIZE_T Length;
+	SIZE_T Capacity;
+	BOOL Failed;
+};
+
+
+// Makes room for Count more characters, plus the terminating zero.
+static BOOL Reserve(TEXT_OUTPUT *Output, SIZE_T Count)
+{
+	if (Output->Length + Count < Output->Capacity) return true;
+	if (Output->Failed) return false;
+	SIZE_T Capacity = Output->Capacity * 2;
+	if (Capacity < Output->Length + Count + 1) Capacity = Output->Length + Count + 1;
+	WCHAR *Text = (WCHAR *)realloc(Output->Text, Capacity * sizeof(WCHAR));
+	if (Text == nullptr)
+	{
+		Output->Failed = true;
+		return false;
+	}
+	Output->Text = Text;
+	Output->Capacity = Capacity;
+	return true;
+}
+
+
+static void AppendCharacter(TEXT_OUTPUT *Output, WCHAR c)
+{
+	if (Reserve(Output, 1)) Output->Text[Output->Length++] = c;
+}
+
+
+static void AppendBreak(TEXT_OUTPUT *Output)
+{
+	if (Reserve(Output, 2))
+	{
+		Output->Text[Output->Length++] = '\r';
+		Output->Text[Output->Length++] = '\n';
+	}
+}
+
+
+static WCHAR DecodeByte(BYTE b)
+{
+	return b >= 0x80 && b < 0xA0 ? Windows1252[b - 0x80] : b;
+}
+
+
+static void AppendBytes(TEXT_OUTPUT *Output, const BYTE *Bytes, SIZE_T SizeCb)
+{
+	if (Reserve(Output, SizeCb))
+	{
+		WCHAR *Out = Output->Text + Output->Length;
+		SIZE_T i = 0;
+#ifdef PORTABLE_SSE2
+		// ASCII, which is almost all of it, only has to be widened.
+		const __m128i Zero = _mm_setzero_si128();
+		for (; i + 16 <= SizeCb; i += 16)
+		{
+			__m128i Chunk = _mm_loadu_si128((const __m128i *)(Bytes + i));
+			if (_mm_movemask_epi8(Chunk) != 0)
+			{
+				for (SIZE_T k = i; k < i + 16; ++k) Out[k] = DecodeByte(Bytes[k]);
+				continue;
+			}
+			_mm_storeu_si128((__m128i *)(Out + i), _mm_unpacklo_epi8(Chunk, Zero));
+			_mm_storeu_si128((__m128i *)(Out + i + 8), _mm_unpackhi_epi8(Chunk, Zero));
+		}
+#endif
+		for (; i < SizeCb; ++i) Out[i] = DecodeByte(Bytes[i]);
+		Output->Length += SizeCb;
+	}
+}
+
+
+static const KEYWORD *FindKeyword(const BYTE *Name, SIZE_T SizeCb)
+{
+	for (SIZE_T i = 0; i < sizeof(Keywords) / sizeof(Keywords[0]); ++i)
+	{
+		const char *k = Keywords[i].Name;
+		if (k[0] == Name[0] && strlen(k) == SizeCb && memcmp(k, Name, SizeCb) == 0) return &Keywords[i];
+	}
+	return nullptr;
+}
+
+
+static BOOL IsWord(const RTF_TOKEN *Token, const char *Word)
+{
+	return Token->SizeCb == strlen(Word) && memcmp(Token->Data, Word, Token->SizeCb) == 0;
+}
+
+
+static void AddOutlineEntry(RTF_DOCUMENT *Document, UINT *Capacity, UINT Depth, const RTF_TOKEN *Name, BOOL Ignorable, SIZE_T Offset, GROUP_STATE *Group)
+{
+	if (Document->OutlineCount == RTF_MAX_OUTLINE_ENTRIES)
+	{
+		Document->OutlineTruncated = true;
+		return;
+	}
+	if (Document->OutlineCount == *Capacity)
+	{
+		UINT NewCapacity = *Capacity != 0 ? *Capacity * 2 : 64;
+		RTF_OUTLINE_ENTRY *Outline = (RTF_OUTLINE_ENTRY *)realloc(Document->Outline, NewCapacity * sizeof(RTF_OUTLINE_ENTRY));
+		if (Outline == nullptr)
+		{
+			Document->OutlineTruncated = true;
+			return;
+		}
+		Document->Outline = Outline;
+		*Capacity = NewCapacity;
+	}
+	RTF_OUTLINE_ENTRY *Entry = &Document->Outline[Document->OutlineCount++];
+	Entry->Depth = Depth;
+	Entry->Name = Name->Data;
+	Entry->NameSizeCb = Name->SizeCb;
+	Entry->Ignorable = Ignorable;
+	Entry->Offset = Offset;
+	Entry->SizeCb = 0;
+	Group->OutlineEntry = Document->OutlineCount;
+}
+
+
+BOOL RtfExtract(const BYTE *Data, SIZE_T SizeCb, RTF_DOCUMENT *Document)
+{
+	memset(Document, 0, sizeof(*Document));
+	if (SizeCb < 5 || memcmp(Data, "{\\rtf", 5) != 0) return false;
+
+	TEXT_OUTPUT Output;
+	Output.Text = nullptr;
+	Output.Length = 0;
+	Output.Capacity = 0;
+	Output.Failed = false;
+	// Formatting usually takes up most of a document; grow from there if it does not.
+	Reserve(&Output, SizeCb / 4 + 256);
+	UINT OutlineCapacity = 0;
+
+	// Groups[Depth] is the innermost group, Groups[0] the state outside of all groups.
+	static const GROUP_STATE InitialGroup = { false, 1, 0 };
+	GROUP_STATE Groups[RTF_MAX_DEPTH + 1];
+	Groups[0] = InitialGroup;
+	SIZE_T Depth = 0;
+	GROUP_STATE *Group = &Groups[0];
+	// Set by a group start, for the token after it that tells whether the group is a destination.
+	BOOL AtGroupStart = false;
+	BOOL Ignorable = false;
+	SIZE_T GroupOffset = 0;
+	// The \uN fallback characters that are still to be skipped.
+	UINT PendingSkip = 0;
+
+	RTF_TOKENIZER Tokenizer;
+	RtfTokenizerInit(&Tokenizer, Data, SizeCb);
+	RTF_TOKEN Token;
+	while (RtfNextToken(&Tokenizer, &Token))
+	{
+		BOOL WasAtGroupStart = AtGroupStart;
+		AtGroupStart = false;
+		switch (Token.Type)
+		{
+			case RTF_TOKEN_GROUP_START:
+				PendingSkip = 0;
+				++Depth;
+				if (Depth > Document->MaxDepth) Document->MaxDepth = Depth;
+				if (Depth <= RTF_MAX_DEPTH)
+				{
+					Groups[Depth] = *Group;
+					Group = &Groups[Depth];
+					Group->OutlineEntry = 0;
+					AtGroupStart = true;
+					Ignorable = false;
+					GroupOffset = Token.Offset;
+				}
+				break;
+
+			case RTF_TOKEN_GROUP_END:
+				PendingSkip = 0;
+				if (Depth == 0) break;
+				if (Depth <= RTF_MAX_DEPTH)
+				{
+					if (Group->OutlineEntry != 0)
+					{
+						RTF_OUTLINE_ENTRY *Entry = &Document->Outline[Group->OutlineEntry - 1];
+						Entry->SizeCb = Token.Offset + 1 - Entry->Offset;
+					}
+					Group = &Groups[Depth - 1];
+				}
+				--Depth;
+				break;
+
+			case RTF_TOKEN_CONTROL_SYMBOL:
+				if (WasAtGroupStart && Token.Data[0] == '*')
+				{
+					Ignorable = true;
+					Group->Skip = true;
+					AtGroupStart = true;
+					break;
+				}
+				if (Group->Skip) break;
+				if (PendingSkip > 0)
+				{
+					--PendingSkip;
+					break;
+				}
+				switch (Token.Data[0])
+				{
+					case '\'':
+						if (Token.HasParameter) AppendCharacter(&Output, DecodeByte((BYTE)Token.Parameter));
+						break;
+					case '\\':
+					case '{':
+					case '}':
+						AppendCharacter(&Output, Token.Data[0]);
+						break;
+					case '~':
+						AppendCharacter(&Output, 0x00A0);
+						break;
+					case '_':
+						AppendCharacter(&Output, 0x2011);
+						break;
+					case '\r':
+					case '\n':
+						AppendBreak(&Output);
+						break;
+				}
+				break;
+
+			case RTF_TOKEN_CONTROL_WORD:
+			{
+				if (Token.SizeCb == 1 && Token.Data[0] == 'u' && Token.HasParameter)
+				{
+					if (!Group->Skip)
+					{
+						AppendCharacter(&Output, (WCHAR)(Token.Parameter & 0xFFFF));
+						PendingSkip = Group->UnicodeSkip;
+					}
+					break;
+				}
+				if (IsWord(&Token, "uc"))
+				{
+					Group->UnicodeSkip = Token.HasParameter && Token.Parameter > 0 ? Token.Parameter : 0;
+					break;
+				}
+				const KEYWORD *Keyword = FindKeyword(Token.Data, Token.SizeCb);
+				if (WasAtGroupStart && (Ignorable || (Keyword != nullptr && Keyword->Kind == KEYWORD_DESTINATION)))
+				{
+					if (Keyword != nullptr && !Keyword->Value) Group->Skip = true;
+					AddOutlineEntry(Document, &OutlineCapacity, (UINT)Depth, &Token, Ignorable, GroupOffset, Group);
+					break;
+				}
+				if (Group->Skip || Keyword == nullptr || Keyword->Kind == KEYWORD_DESTINATION) break;
+				if (PendingSkip > 0)
+				{
+					--PendingSkip;
+					break;
+				}
+				if (Keyword->Kind == KEYWORD_BREAK) AppendBreak(&Output);
+				else AppendCharacter(&Output, Keyword->Value);
+				break;
+			}
+
+			case RTF_TOKEN_TEXT:
+				if (!Group->Skip)
+				{
+					SIZE_T Skipped = PendingSkip < Token.SizeCb ? PendingSkip : Token.SizeCb;
+					PendingSkip -= (UINT)Skipped;
+					AppendBytes(&Output, Token.Data + Skipped, Token.SizeCb - Skipped);
+				}
+				break;
+
+			case RTF_TOKEN_BINARY:
+				if (PendingSkip > 0) --PendingSkip;
+				break;
+		}
+	}
+
+	// Groups that were never closed end with the payload.
+	for (SIZE_T d = Depth < RTF_MAX_DEPTH ? Depth : RTF_MAX_DEPTH; d > 0; --d)
+	{
+		if (Groups[d].OutlineEntry != 0)
+		{
+			RTF_OUTLINE_ENTRY *Entry = &Document->Outline[Groups[d].OutlineEntry - 1];
+			Entry->SizeCb = Token.Offset - Entry->Offset;
+		}
+	}
+
+	if (!Reserve(&Output, 0))
+	{
+		free(Output.Text);
+		RtfDocumentFree(Document);
+		return false;
+	}
+	Output.Text[Output.Length] = 0;
+	Document->Text = Output.Text;
+	Document->TextLength = Output.Length;
+	return true;
+}
+
+
+void RtfDocumentFree(RTF_DOCUMENT *Document)
+{
+	free(Document->Text);
+	free(Document->Outline);
+	Document->Text = nullptr;
+	Document->TextLength = 0;
+	Document->Outline = nullptr;
+	Document->OutlineCount = 0;
+}
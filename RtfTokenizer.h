@@ -0,0 +1,79 @@
+#pragma once
+
+#include "Portable.h"
+
+struct RTF_TOKEN;
+struct RTF_TOKENIZER;
+struct RTF_OUTLINE_ENTRY;
+struct RTF_DOCUMENT;
+
+// Reads "Rich Text Format" clipboard data in a single pass, without building a tree of it.
+//
+// RtfNextToken pulls one token at a time out of the payload; tokens point into it, so nothing is copied. RtfExtract
+// runs the tokenizer over a whole document and keeps track of just enough group state to turn it into plain text:
+// destinations that hold no text (font and color tables, pictures, document properties, anything marked with \*, ...)
+// are skipped, \uN characters replace their \ucN fallback characters, and paragraphs, line breaks, tabs and the
+// typographic control words become their characters. \'hh bytes are read as Windows-1252; other code pages are rare
+// in practice, since writers also put every non-ASCII character in a \uN.
+//
+// Alongside the text, RtfExtract collects an outline: one entry per destination group, with its nesting depth and its
+// place in the payload. Groups nested deeper than RTF_MAX_DEPTH share the state of the deepest tracked one, so hostile
+// nesting costs neither stack nor memory. The payload ends at its size or at the first zero byte, as on the clipboard.
+
+#define RTF_TOKEN_END 0
+#define RTF_TOKEN_GROUP_START 1
+#define RTF_TOKEN_GROUP_END 2
+#define RTF_TOKEN_CONTROL_WORD 3
+#define RTF_TOKEN_CONTROL_SYMBOL 4
+#define RTF_TOKEN_TEXT 5
+#define RTF_TOKEN_BINARY 6      // The data of a \binN control word, which follows it.
+
+#define RTF_MAX_DEPTH 256
+// RtfExtract stops adding outline entries after this many, and sets OutlineTruncated.
+#define RTF_MAX_OUTLINE_ENTRIES 10000
+
+extern void                RtfTokenizerInit(RTF_TOKENIZER *Tokenizer, const BYTE *Data, SIZE_T SizeCb);
+extern BOOL                RtfNextToken(RTF_TOKENIZER *Tokenizer, RTF_TOKEN *Token);
+extern BOOL                RtfExtract(const BYTE *Data, SIZE_T SizeCb, RTF_DOCUMENT *Document);
+extern void                RtfDocumentFree(RTF_DOCUMENT *Document);
+
+struct RTF_TOKEN
+{
+	UINT Type;
+	// Control words: the name without the backslash. Control symbols: the character after the backslash. Text and
+	// binary data: the bytes themselves; text never contains line breaks, which RTF ignores.
+	const BYTE *Data;
+	SIZE_T SizeCb;
+	LONG Parameter;       // Of control words, and the byte value of \'hh.
+	BOOL HasParameter;
+	SIZE_T Offset;        // Where the token starts in the payload.
+};
+
+struct RTF_TOKENIZER
+{
+	const BYTE *Data;
+	SIZE_T SizeCb;
+	SIZE_T Position;
+	SIZE_T BinarySizeCb;  // Of the \bin data that comes next.
+};
+
+struct RTF_OUTLINE_ENTRY
+{
+	UINT Depth;           // 1 for the \rtf1 group itself.
+	const BYTE *Name;     // The destination's control word, pointing into the payload.
+	SIZE_T NameSizeCb;
+	BOOL Ignorable;       // Marked with \*.
+	SIZE_T Offset;        // Of the opening brace.
+	SIZE_T SizeCb;        // Up to and including the closing brace, or to the end of the payload if there is none.
+};
+
+// Filled by RtfExtract.
+struct RTF_DOCUMENT
+{
+	WCHAR *Text;          // Zero terminated, with CRLF line breaks.
+	SIZE_T TextLength;
+	RTF_OUTLINE_ENTRY *Outline;
+	UINT OutlineCount;
+	BOOL OutlineTruncated;
+	SIZE_T MaxDepth;      // The deepest group nesting, including groups beyond RTF_MAX_DEPTH.
+};
@@ -0,0 +1,509 @@
+#include "SearchWorker.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define RESULT_QUEUE_CAPACITY 8
+// Characters of context shown before the match in a snippet.
+#define SNIPPET_LEAD 20
+
+
+static void FreeDocument(SEARCH_DOCUMENT *Document)
+{
+	if (Document == nullptr) return;
+	free(Document->Text);
+	free(Document);
+}
+
+
+void SearchQueryFree(SEARCH_QUERY *Query)
+{
+	if (Query == nullptr) return;
+	free(Query->Pattern);
+	free(Query);
+}
+
+
+static BOOL IsStale(SEARCH_WORKER *Worker, ULONGLONG Generation)
+{
+	return Generation != Worker->Generation.load(std::memory_order_acquire);
+}
+
+
+// Makes room for SizeCb bytes of text in the read buffer, plus one character that is never read.
+static BOOL ReserveReadBuffer(SEARCH_WORKER *Worker, ULONGLONG SizeCb)
+{
+	if (SizeCb > (SIZE_T)-1 - sizeof(WCHAR)) return false;
+	SIZE_T Length = (SIZE_T)(SizeCb / sizeof(WCHAR)) + 1;
+	if (Length <= Worker->ReadBufferLength) return true;
+	WCHAR *NewBuffer = (WCHAR *)realloc(Worker->ReadBuffer, Length * sizeof(WCHAR));
+	if (NewBuffer == nullptr) return false;
+	Worker->ReadBuffer = NewBuffer;
+	Worker->ReadBufferLength = Length;
+	return true;
+}
+
+
+static BOOL ReadCompressedDocument(SEARCH_WORKER *Worker, const SEARCH_DOCUMENT *Document, const WCHAR **Text, SIZE_T *Length)
+{
+	ULONGLONG SizeCb = Document->Entry.SizeCb;
+	if (SizeCb < sizeof(CONTENT_HASH) || SizeCb > (SIZE_T)-1) return false;
+	if (SizeCb > Worker->RecordBufferSize)
+	{
+		BYTE *NewBuffer = (BYTE *)realloc(Worker->RecordBuffer, (SIZE_T)SizeCb);
+		if (NewBuffer == nullptr) return false;
+		Worker->RecordBuffer = NewBuffer;
+		Worker->RecordBufferSize = (SIZE_T)SizeCb;
+	}
+	if (!HistoryStoreReaderRead(&Worker->Reader, &Document->Entry, Worker->RecordBuffer)) return false;
+	// The record starts with the hash of the raw text.
+	const TEXT_CODEC_HEADER *Header = TextCodecValidate(Worker->RecordBuffer + sizeof(CONTENT_HASH), (SIZE_T)SizeCb - sizeof(CONTENT_HASH));
+	if (Header == nullptr || !ReserveReadBuffer(Worker, Header->Length * sizeof(WCHAR))) return false;
+	if (!TextCodecDecode(Header, (SIZE_T)SizeCb - sizeof(CONTENT_HASH), Document->Dictionary, Worker->ReadBuffer)) return false;
+	*Text = Worker->ReadBuffer;
+	*Length = (SIZE_T)Header->Length;
+	return true;
+}
+
+
+// Returns the text of an indexed document, or false if it is not available anymore.
+static BOOL GetDocumentText(SEARCH_WORKER *Worker, const SEARCH_DOCUMENT *Document, const WCHAR **Text, SIZE_T *Length)
+{
+	if (!Document->Stored)
+	{
+		*Text = Document->Text;
+		*Length = Document->Length;
+		return Document->Text != nullptr;
+	}
+	if (!Worker->HasStore) return false;
+	if (Document->Entry.Format == STORED_FORMAT_COMPRESSED_TEXT)
+	{
+		return ReadCompressedDocument(Worker, Document, Text, Length);
+	}
+	if (!ReserveReadBuffer(Worker, Document->Entry.SizeCb)) return false;
+	if (!HistoryStoreReaderRead(&Worker->Reader, &Document->Entry, Worker->ReadBuffer)) return false;
+	*Text = Worker->ReadBuffer;
+	*Length = (SIZE_T)(Document->Entry.SizeCb / sizeof(WCHAR));
+	return true;
+}
+
+
+static SEARCH_DOCUMENT *FindDocument(SEARCH_WORKER *Worker, ULONGLONG Id)
+{
+	SIZE_T Low = 0;
+	SIZE_T High = Worker->DocumentCount;
+	while (Low < High)
+	{
+		SIZE_T Middle = Low + (High - Low) / 2;
+		if (Worker->Documents[Middle]->Id < Id) Low = Middle + 1;
+		else High = Middle;
+	}
+	return Low < Worker->DocumentCount && Worker->Documents[Low]->Id == Id ? Worker->Documents[Low] : nullptr;
+}
+
+
+// Drops the oldest texts until the rest fits the budget. Their documents leave the index right away, and the array
+// once they are half of it.
+static void DropTextsOverBudget(SEARCH_WORKER *Worker)
+{
+	while (Worker->TextBytes > Worker->TextBudget && Worker->OldestText < Worker->DocumentCount)
+	{
+		SEARCH_DOCUMENT *Document = Worker->Documents[Worker->OldestText++];
+		if (Document->Stored) continue;
+		Worker->TextBytes -= Document->Length * sizeof(WCHAR);
+		free(Document->Text);
+		Document->Text = nullptr;
+		TrigramIndexRemove(&Worker->Index, Document->Id);
+		++Worker->DroppedCount;
+	}
+	if (Worker->DroppedCount * 2 < Worker->DocumentCount) return;
+
+	SIZE_T Kept = 0;
+	for (SIZE_T i = 0; i < Worker->OldestText; ++i)
+	{
+		if (Worker->Documents[i]->Stored) Worker->Documents[Kept++] = Worker->Documents[i];
+		else FreeDocument(Worker->Documents[i]);
+	}
+	memmove(Worker->Documents + Kept, Worker->Documents + Worker->OldestText, (Worker->DocumentCount - Worker->OldestText) * sizeof(SEARCH_DOCUMENT *));
+	Worker->DocumentCount -= Worker->OldestText - Kept;
+	Worker->OldestText = Kept;
+	Worker->DroppedCount = 0;
+}
+
+
+// Takes ownership of the document.
+static void IndexDocument(SEARCH_WORKER *Worker, SEARCH_DOCUMENT *Document)
+{
+	if (Worker->DocumentCount > 0 && Document->Id <= Worker->Documents[Worker->DocumentCount - 1]->Id)
+	{
+		// Ids must increase; the caller made a mistake.
+		FreeDocument(Document);
+		return;
+	}
+	if (Worker->DocumentCount == Worker->DocumentCapacity)
+	{
+		SIZE_T NewCapacity = Worker->DocumentCapacity != 0 ? Worker->DocumentCapacity * 2 : 1024;
+		SEARCH_DOCUMENT **NewDocuments = (SEARCH_DOCUMENT **)realloc(Worker->Documents, NewCapacity * sizeof(SEARCH_DOCUMENT *));
+		if (NewDocuments == nullptr)
+		{
+			FreeDocument(Document);
+			return;
+		}
+		Worker->Documents = NewDocuments;
+		Worker->DocumentCapacity = NewCapacity;
+	}
+
+	const WCHAR *Text;
+	SIZE_T Length;
+	if (!GetDocumentText(Worker, Document, &Text, &Length) || !TrigramIndexAdd(&Worker->Index, Document->Id, Text, Length))
+	{
+		FreeDocument(Document);
+		return;
+	}
+	Worker->Documents[Worker->DocumentCount++] = Document;
+	if (Document->Text != nullptr)
+	{
+		Worker->TextBytes += Document->Length * sizeof(WCHAR);
+		DropTextsOverBudget(Worker);
+	}
+}
+
+
+static void MakeSnippet(const WCHAR *Text, SIZE_T Length, SIZE_T Position, WCHAR *Snippet)
+{
+	SIZE_T Start = Position > SNIPPET_LEAD ? Position - SNIPPET_LEAD : 0;
+	SIZE_T Count = 0;
+	for (SIZE_T i = Start; i < Length && Count < SEARCH_SNIPPET_LENGTH; ++i)
+	{
+		WCHAR c = Text[i];
+		if (c < ' ')
+		{
+			// Line breaks and tabs become a single space each.
+			if (Count > 0 && Snippet[Count - 1] == ' ') continue;
+			c = ' ';
+		}
+		Snippet[Count++] = c;
+	}
+	Snippet[Count] = 0;
+}
+
+
+// Checks the candidates, newest first, until there are enough results. Returns false if the query went stale.
+static BOOL AnswerQuery(SEARCH_WORKER *Worker, SEARCH_QUERY *Query)
+{
+	ULONGLONG StartUs = GetMonotonicTimeUs();
+	SIZE_T MaxCandidates = Worker->Index.DocumentCount;
+	if (MaxCandidates > Worker->CandidateCapacity)
+	{
+		ULONGLONG *NewCandidates = (ULONGLONG *)realloc(Worker->Candidates, MaxCandidates * sizeof(ULONGLONG));
+		if (NewCandidates == nullptr) return true;
+		Worker->Candidates = NewCandidates;
+		Worker->CandidateCapacity = MaxCandidates;
+	}
+	SIZE_T CandidateCount = TrigramIndexQuery(&Worker->Index, Query->Pattern, Query->PatternLength, Worker->Candidates, MaxCandidates);
+
+	Query->CandidateCount = CandidateCount;
+	Query->DocumentCount = Worker->DocumentCount;
+	for (SIZE_T i = 0; i < CandidateCount; ++i)
+	{
+		if ((i & 63) == 0 && IsStale(Worker, Query->Generation)) return false;
+		const SEARCH_DOCUMENT *Document = FindDocument(Worker, Worker->Candidates[i]);
+		const WCHAR *Text;
+		SIZE_T Length;
+		SIZE_T Position;
+		if (Document == nullptr || !GetDocumentText(Worker, Document, &Text, &Length)) continue;
+		if (!TextFindFolded(Text, Length, Query->Pattern, Query->PatternLength, &Position)) continue;
+		if (Query->ResultCount == SEARCH_MAX_RESULTS)
+		{
+			Query->MoreResults = true;
+			break;
+		}
+		SEARCH_RESULT *Result = &Query->Results[Query->ResultCount++];
+		Result->Id = Document->Id;
+		Result->Timestamp = Document->Timestamp;
+		MakeSnippet(Text, Length, Position, Result->Snippet);
+	}
+	Query->DurationUs = GetMonotonicTimeUs() - StartUs;
+	return true;
+}
+
+
+// Takes ownership of the query.
+static void ProcessQuery(SEARCH_WORKER *Worker, SEARCH_QUERY *Query)
+{
+	if (!AnswerQuery(Worker, Query))
+	{
+		SearchQueryFree(Query);
+		return;
+	}
+
+	free(Worker->RepeatPattern);
+	Worker->RepeatPattern = nullptr;
+	if (!Query->Complete)
+	{
+		Worker->RepeatPattern = (WCHAR *)malloc((Query->PatternLength + 1) * sizeof(WCHAR));
+		if (Worker->RepeatPattern != nullptr)
+		{
+			memcpy(Worker->RepeatPattern, Query->Pattern, (Query->PatternLength + 1) * sizeof(WCHAR));
+			Worker->RepeatLength = Query->PatternLength;
+			Worker->RepeatGeneration = Query->Generation;
+		}
+	}
+
+	// The UI normally drains the queue as soon as it is notified, so it is only ever full for a moment.
+	while (!SpscQueuePush(&Worker->Results, Query))
+	{
+		if (IsStale(Worker, Query->Generation))
+		{
+			SearchQueryFree(Query);
+			return;
+		}
+		std::this_thread::yield();
+	}
+	Worker->Notify(Worker->NotifyContext);
+}
+
+
+static SEARCH_QUERY *CreateQuery(const WCHAR *Pattern, SIZE_T PatternLength)
+{
+	SEARCH_QUERY *Query = (SEARCH_QUERY *)calloc(1, sizeof(SEARCH_QUERY));
+	if (Query == nullptr) return nullptr;
+	Query->Pattern = (WCHAR *)malloc((PatternLength + 1) * sizeof(WCHAR));
+	if (Query->Pattern == nullptr)
+	{
+		free(Query);
+		return nullptr;
+	}
+	memcpy(Query->Pattern, Pattern, PatternLength * sizeof(WCHAR));
+	Query->Pattern[PatternLength] = 0;
+	Query->PatternLength = PatternLength;
+	return Query;
+}
+
+
+static void WorkerThread(SEARCH_WORKER *Worker)
+{
+	for (;;)
+	{
+		SEARCH_QUERY *Query = nullptr;
+		SEARCH_DOCUMENT *Document = nullptr;
+		BOOL QueueEmpty;
+		{
+			std::unique_lock<std::mutex> Lock(Worker->Lock);
+			while (!Worker->Stopping && Worker->PendingQuery == nullptr && Worker->QueueHead == nullptr && Worker->RepeatPattern == nullptr)
+			{
+				Worker->WakeCondition.wait(Lock);
+			}
+			if (Worker->Stopping) break;
+
+			// Queries go first, so that typing stays responsive while a large history is being indexed.
+			if (Worker->PendingQuery != nullptr)
+			{
+				Query = Worker->PendingQuery;
+				Worker->PendingQuery = nullptr;
+			}
+			else if (Worker->QueueHead != nullptr)
+			{
+				Document = Worker->QueueHead;
+				Worker->QueueHead = Document->Next;
+				if (Worker->QueueHead == nullptr) Worker->QueueTail = nullptr;
+			}
+			QueueEmpty = Worker->QueueHead == nullptr;
+		}
+
+		if (Query != nullptr)
+		{
+			Query->Complete = QueueEmpty;
+			ProcessQuery(Worker, Query);
+		}
+		else if (Document != nullptr)
+		{
+			IndexDocument(Worker, Document);
+		}
+		else
+		{
+			// Everything has been indexed since the last query was answered.
+			WCHAR *Pattern = Worker->RepeatPattern;
+			Worker->RepeatPattern = nullptr;
+			if (!IsStale(Worker, Worker->RepeatGeneration))
+			{
+				Query = CreateQuery(Pattern, Worker->RepeatLength);
+				if (Query != nullptr)
+				{
+					Query->Generation = Worker->RepeatGeneration;
+					Query->Complete = true;
+					ProcessQuery(Worker, Query);
+				}
+			}
+			free(Pattern);
+		}
+	}
+}
+
+
+// Store is where stored documents are read from; it may be null if there are none. The store must stay open while the
+// worker is running. TextBudget limits the text that is kept of documents that are not stored.
+BOOL SearchWorkerStart(SEARCH_WORKER *Worker, const HISTORY_STORE *Store, SIZE_T TextBudget, void (*Notify)(void *Context), void *NotifyContext)
+{
+	if (!SpscQueueInit(&Worker->Results, RESULT_QUEUE_CAPACITY)) return false;
+	if (!TrigramIndexInit(&Worker->Index))
+	{
+		SpscQueueFree(&Worker->Results);
+		return false;
+	}
+	Worker->Notify = Notify;
+	Worker->NotifyContext = NotifyContext;
+	Worker->Generation.store(0);
+	Worker->PendingQuery = nullptr;
+	Worker->QueueHead = nullptr;
+	Worker->QueueTail = nullptr;
+	Worker->Stopping = false;
+	Worker->HasStore = Store != nullptr;
+	if (Store != nullptr) HistoryStoreReaderInit(&Worker->Reader, Store);
+	Worker->Documents = nullptr;
+	Worker->DocumentCount = 0;
+	Worker->DocumentCapacity = 0;
+	Worker->OldestText = 0;
+	Worker->DroppedCount = 0;
+	Worker->TextBytes = 0;
+	Worker->TextBudget = TextBudget;
+	Worker->ReadBuffer = nullptr;
+	Worker->ReadBufferLength = 0;
+	Worker->RecordBuffer = nullptr;
+	Worker->RecordBufferSize = 0;
+	Worker->Candidates = nullptr;
+	Worker->CandidateCapacity = 0;
+	Worker->RepeatPattern = nullptr;
+	Worker->Thread = std::thread(WorkerThread, Worker);
+	return true;
+}
+
+
+// Waits for the worker thread to exit, and frees everything, including results that have not been picked up.
+void SearchWorkerStop(SEARCH_WORKER *Worker)
+{
+	if (!Worker->Thread.joinable()) return;
+	{
+		std::lock_guard<std::mutex> Lock(Worker->Lock);
+		Worker->Stopping = true;
+	}
+	Worker->WakeCondition.notify_one();
+	Worker->Thread.join();
+
+	SearchQueryFree(Worker->PendingQuery);
+	Worker->PendingQuery = nullptr;
+	while (Worker->QueueHead != nullptr)
+	{
+		SEARCH_DOCUMENT *Next = Worker->QueueHead->Next;
+		FreeDocument(Worker->QueueHead);
+		Worker->QueueHead = Next;
+	}
+	Worker->QueueTail = nullptr;
+	void *Item;
+	while (SpscQueuePop(&Worker->Results, &Item))
+	{
+		SearchQueryFree((SEARCH_QUERY *)Item);
+	}
+	SpscQueueFree(&Worker->Results);
+
+	for (SIZE_T i = 0; i < Worker->DocumentCount; ++i)
+	{
+		FreeDocument(Worker->Documents[i]);
+	}
+	free(Worker->Documents);
+	Worker->Documents = nullptr;
+	Worker->DocumentCount = 0;
+	TrigramIndexFree(&Worker->Index);
+	if (Worker->HasStore) HistoryStoreReaderClose(&Worker->Reader);
+	free(Worker->ReadBuffer);
+	free(Worker->RecordBuffer);
+	free(Worker->Candidates);
+	free(Worker->RepeatPattern);
+	Worker->ReadBuffer = nullptr;
+	Worker->RecordBuffer = nullptr;
+	Worker->RecordBufferSize = 0;
+	Worker->Candidates = nullptr;
+	Worker->RepeatPattern = nullptr;
+}
+
+
+static void Enqueue(SEARCH_WORKER *Worker, SEARCH_DOCUMENT *Document)
+{
+	{
+		std::lock_guard<std::mutex> Lock(Worker->Lock);
+		if (Worker->QueueTail != nullptr) Worker->QueueTail->Next = Document;
+		else Worker->QueueHead = Document;
+		Worker->QueueTail = Document;
+	}
+	Worker->WakeCondition.notify_one();
+}
+
+
+// Adds a CF_UNICODETEXT or STORED_FORMAT_COMPRESSED_TEXT entry of the store. Ids must increase from one call to the
+// next (of either Add function). Dictionary is the one a compressed entry needs; it must stay around until the worker
+// is stopped.
+BOOL SearchWorkerAddStored(SEARCH_WORKER *Worker, ULONGLONG Id, const STORED_ENTRY *Entry, const TEXT_DICTIONARY *Dictionary)
+{
+	if (!Worker->HasStore) return false;
+	SEARCH_DOCUMENT *Document = (SEARCH_DOCUMENT *)calloc(1, sizeof(SEARCH_DOCUMENT));
+	if (Document == nullptr) return false;
+	Document->Id = Id;
+	Document->Timestamp = Entry->Timestamp;
+	Document->Stored = true;
+	Document->Entry = *Entry;
+	Document->Dictionary = Dictionary;
+	Enqueue(Worker, Document);
+	return true;
+}
+
+
+// Copies the text.
+BOOL SearchWorkerAddText(SEARCH_WORKER *Worker, ULONGLONG Id, const WCHAR *Text, SIZE_T Length, LONGLONG Timestamp)
+{
+	SEARCH_DOCUMENT *Document = (SEARCH_DOCUMENT *)calloc(1, sizeof(SEARCH_DOCUMENT));
+	if (Document == nullptr) return false;
+	Document->Text = (WCHAR *)malloc(Length != 0 ? Length * sizeof(WCHAR) : 1);
+	if (Document->Text == nullptr)
+	{
+		free(Document);
+		return false;
+	}
+	memcpy(Document->Text, Text, Length * sizeof(WCHAR));
+	Document->Length = Length;
+	Document->Id = Id;
+	Document->Timestamp = Timestamp;
+	Enqueue(Worker, Document);
+	return true;
+}
+
+
+// Replaces the query that is waiting or running. Must always be called from the same thread as SearchWorkerGetResult.
+BOOL SearchWorkerQuery(SEARCH_WORKER *Worker, const WCHAR *Pattern, SIZE_T PatternLength)
+{
+	SEARCH_QUERY *Query = CreateQuery(Pattern, PatternLength);
+	if (Query == nullptr) return false;
+	SEARCH_QUERY *Replaced;
+	{
+		std::lock_guard<std::mutex> Lock(Worker->Lock);
+		Query->Generation = Worker->Generation.fetch_add(1) + 1;
+		Replaced = Worker->PendingQuery;
+		Worker->PendingQuery = Query;
+	}
+	Worker->WakeCondition.notify_one();
+	SearchQueryFree(Replaced);
+	return true;
+}
+
+
+// Returns the answer to the newest query, or null. Answers to older queries are skipped. The caller owns the returned
+// query.
+SEARCH_QUERY *SearchWorkerGetResult(SEARCH_WORKER *Worker)
+{
+	void *Item;
+	while (SpscQueuePop(&Worker->Results, &Item))
+	{
+		SEARCH_QUERY *Query = (SEARCH_QUERY *)Item;
+		if (Query->Generation == Worker->Generation.load(std::memory_order_relaxed)) return Query;
+		SearchQueryFree(Query);
+	}
+	return nullptr;
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "Portable.h"
+#include "HistoryStore.h"
+#include "TextCodec.h"
+#include "TrigramIndex.h"
+#include "SpscQueue.h"
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+struct SEARCH_DOCUMENT;
+struct SEARCH_RESULT;
+struct SEARCH_QUERY;
+struct SEARCH_WORKER;
+
+// Full-text search over the captured text, on a background thread.
+//
+// The UI thread hands over every text capture as a document, and the worker adds it to a TRIGRAM_INDEX. A document
+// either is an entry of the history store, which the worker reads by itself, or comes with a copy of its text. Those
+// copies are needed to check query candidates, and are only kept up to a budget; the oldest ones are dropped first,
+// and their documents removed from the index.
+//
+// Queries work like capture jobs: a new one replaces the one that is waiting, and cancels the one that is running.
+// Answered queries go back through a lock-free queue, and Notify is called (on the worker thread) for each one.
+// A query that is answered while documents are still waiting to be indexed is answered again once they are.
+
+#define SEARCH_MAX_RESULTS 200
+#define SEARCH_SNIPPET_LENGTH 80
+
+extern BOOL                SearchWorkerStart(SEARCH_WORKER *Worker, const HISTORY_STORE *Store, SIZE_T TextBudget, void (*Notify)(void *Context), void *NotifyContext);
+extern void                SearchWorkerStop(SEARCH_WORKER *Worker);
+extern BOOL                SearchWorkerAddStored(SEARCH_WORKER *Worker, ULONGLONG Id, const STORED_ENTRY *Entry, const TEXT_DICTIONARY *Dictionary);
+extern BOOL                SearchWorkerAddText(SEARCH_WORKER *Worker, ULONGLONG Id, const WCHAR *Text, SIZE_T Length, LONGLONG Timestamp);
+extern BOOL                SearchWorkerQuery(SEARCH_WORKER *Worker, const WCHAR *Pattern, SIZE_T PatternLength);
+extern SEARCH_QUERY       *SearchWorkerGetResult(SEARCH_WORKER *Worker);
+extern void                SearchQueryFree(SEARCH_QUERY *Query);
+
+struct SEARCH_DOCUMENT
+{
+	SEARCH_DOCUMENT *Next;       // While waiting to be indexed.
+	ULONGLONG Id;
+	LONGLONG Timestamp;
+	BOOL Stored;
+	STORED_ENTRY Entry;          // If Stored.
+	const TEXT_DICTIONARY *Dictionary; // For a STORED_FORMAT_COMPRESSED_TEXT entry, if it was compressed with one.
+	WCHAR *Text;                 // Otherwise. Null once it has been dropped.
+	SIZE_T Length;
+};
+
+struct SEARCH_RESULT
+{
+	ULONGLONG Id;
+	LONGLONG Timestamp;
+	WCHAR Snippet[SEARCH_SNIPPET_LENGTH + 1]; // Text around the first match, on one line.
+};
+
+struct SEARCH_QUERY
+{
+	ULONGLONG Generation;        // Assigned by SearchWorkerQuery.
+	WCHAR *Pattern;
+	SIZE_T PatternLength;
+
+	// Filled in by the worker.
+	SEARCH_RESULT Results[SEARCH_MAX_RESULTS]; // Newest first.
+	UINT ResultCount;
+	BOOL MoreResults;            // Stopped at SEARCH_MAX_RESULTS.
+	BOOL Complete;               // False if documents were still waiting to be indexed.
+	SIZE_T CandidateCount;
+	SIZE_T DocumentCount;        // Indexed at the time.
+	ULONGLONG DurationUs;
+};
+
+struct SEARCH_WORKER
+{
+	std::thread Thread;
+	void (*Notify)(void *Context);
+	void *NotifyContext;
+	std::atomic<ULONGLONG> Generation;
+	SPSC_QUEUE Results;
+
+	// Shared with the UI thread, under Lock.
+	std::mutex Lock;
+	std::condition_variable WakeCondition;
+	SEARCH_QUERY *PendingQuery;
+	SEARCH_DOCUMENT *QueueHead;
+	SEARCH_DOCUMENT *QueueTail;
+	BOOL Stopping;
+
+	// Only used by the worker thread.
+	TRIGRAM_INDEX Index;
+	BOOL HasStore;
+	HISTORY_STORE_READER Reader;
+	SEARCH_DOCUMENT **Documents; // Indexed documents, in order.
+	SIZE_T DocumentCount;
+	SIZE_T DocumentCapacity;
+	SIZE_T OldestText;           // Documents before this one have no text of their own.
+	SIZE_T DroppedCount;         // Documents before OldestText whose text was dropped, and that are not indexed anymore.
+	SIZE_T TextBytes;
+	SIZE_T TextBudget;
+	WCHAR *ReadBuffer;           // For stored documents.
+	SIZE_T ReadBufferLength;
+	BYTE *RecordBuffer;          // For compressed stored documents, before they are decoded into ReadBuffer.
+	SIZE_T RecordBufferSize;
+	ULONGLONG *Candidates;
+	SIZE_T CandidateCapacity;
+	WCHAR *RepeatPattern;        // Of the last query, if it has to be answered again.
+	SIZE_T RepeatLength;
+	ULONGLONG RepeatGeneration;
+};
@@ -0,0 +1,59 @@
+#include "SpscQueue.h"
+#include <stdlib.h>
+
+// Capacity is rounded up to a power of two.
+BOOL SpscQueueInit(SPSC_QUEUE *Queue, UINT Capacity)
+{
+	UINT RoundedCapacity = 1;
+	while (RoundedCapacity < Capacity)
+	{
+		if (RoundedCapacity > 0x40000000) return false;
+		RoundedCapacity *= 2;
+	}
+	Queue->Slots = (void **)calloc(RoundedCapacity, sizeof(void *));
+	if (Queue->Slots == nullptr) return false;
+	Queue->Mask = RoundedCapacity - 1;
+	Queue->Head.store(0, std::memory_order_relaxed);
+	Queue->Tail.store(0, std::memory_order_relaxed);
+	Queue->CachedHead = 0;
+	Queue->CachedTail = 0;
+	return true;
+}
+
+
+// Items that are still in the queue are not freed.
+void SpscQueueFree(SPSC_QUEUE *Queue)
+{
+	free(Queue->Slots);
+	Queue->Slots = nullptr;
+}
+
+
+// Returns false if the queue is full.
+BOOL SpscQueuePush(SPSC_QUEUE *Queue, void *Item)
+{
+	UINT Tail = Queue->Tail.load(std::memory_order_relaxed);
+	if (Tail - Queue->CachedHead > Queue->Mask)
+	{
+		Queue->CachedHead = Queue->Head.load(std::memory_order_acquire);
+		if (Tail - Queue->CachedHead > Queue->Mask) return false;
+	}
+	Queue->Slots[Tail & Queue->Mask] = Item;
+	Queue->Tail.store(Tail + 1, std::memory_order_release);
+	return true;
+}
+
+
+// Returns false if the queue is empty.
+BOOL SpscQueuePop(SPSC_QUEUE *Queue, void **Item)
+{
+	UINT Head = Queue->Head.load(std::memory_order_relaxed);
+	if (Head == Queue->CachedTail)
+	{
+		Queue->CachedTail = Queue->Tail.load(std::memory_order_acquire);
+		if (Head == Queue->CachedTail) return false;
+	}
+	*Item = Queue->Slots[Head & Queue->Mask];
+	Queue->Head.store(Head + 1, std::memory_order_release);
+	return true;
+}
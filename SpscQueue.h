@@ -0,0 +1,27 @@
+#pragma once
+
+#include "Portable.h"
+#include <atomic>
+
+struct SPSC_QUEUE;
+
+// Bounded lock-free queue of pointers for exactly one producer thread and one consumer thread.
+// Push may only be called by the producer, Pop only by the consumer. Neither ever blocks.
+
+extern BOOL                SpscQueueInit(SPSC_QUEUE *Queue, UINT Capacity);
+extern void                SpscQueueFree(SPSC_QUEUE *Queue);
+extern BOOL                SpscQueuePush(SPSC_QUEUE *Queue, void *Item);
+extern BOOL                SpscQueuePop(SPSC_QUEUE *Queue, void **Item);
+
+struct SPSC_QUEUE
+{
+	void **Slots;
+	UINT Mask; // Capacity - 1; the capacity is a power of two.
+
+	// Head and Tail only ever increase (and wrap around). Each side keeps a cached copy of the other side's index,
+	// so that it only touches the other side's cache line when the queue looks full or empty.
+	alignas(64) std::atomic<UINT> Head; // Written by the consumer.
+	UINT CachedTail;
+	alignas(64) std::atomic<UINT> Tail; // Written by the producer.
+	UINT CachedHead;
+};
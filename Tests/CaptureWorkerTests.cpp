@@ -0,0 +1,158 @@
+// Races submitting, cancelling and collecting against the capture worker: only the newest job may come back, every job
+// is accounted for exactly once, and nothing leaks. Meant to be run under -fsanitize=thread (and address) as well.
+
+#include "Test.h"
+#include "CaptureWorker.h"
+#include "PackedDIB.h"
+#include "PayloadGenerator.h"
+#include "PixelBuffer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+
+#define RACE_STEPS 20000
+#define RACE_IMAGE_SIZE 256
+
+static std::atomic<UINT> Notifications;
+
+
+static void CountNotification(void *Context)
+{
+	++Notifications;
+}
+
+
+// A copy of Data, followed by the two zero bytes that jobs carry.
+static CAPTURE_JOB *CreateTestJob(UINT Format, const void *Data, SIZE_T SizeCb)
+{
+	CAPTURE_JOB *Job = (CAPTURE_JOB *)calloc(1, sizeof(CAPTURE_JOB));
+	if (Job == nullptr) return nullptr;
+	Job->Format = Format;
+	Job->Data = (BYTE *)malloc(SizeCb + 2);
+	if (Job->Data == nullptr)
+	{
+		free(Job);
+		return nullptr;
+	}
+	memcpy(Job->Data, Data, SizeCb);
+	Job->Data[SizeCb] = 0;
+	Job->Data[SizeCb + 1] = 0;
+	Job->SizeCb = SizeCb;
+	return Job;
+}
+
+
+// Waits for the result of the job submitted last, with Generation. Gives up after a few seconds.
+static CAPTURE_JOB *WaitForResult(CAPTURE_WORKER *Worker, ULONGLONG Generation)
+{
+	ULONGLONG StartUs = GetMonotonicTimeUs();
+	while (GetMonotonicTimeUs() - StartUs < 10000000)
+	{
+		CAPTURE_JOB *Job = CaptureWorkerGetResult(Worker);
+		if (Job != nullptr)
+		{
+			CHECK(Job->Generation == Generation);
+			return Job;
+		}
+		std::this_thread::yield();
+	}
+	CHECK(!"timed out");
+	return nullptr;
+}
+
+
+void TestCaptureWorkerCancel()
+{
+	DIB_PAYLOAD_SPEC Spec = { RACE_IMAGE_SIZE, RACE_IMAGE_SIZE, 24, BI_RGB, DIB_HEADER_INFO, 0, 1 };
+	SIZE_T DibSize;
+	BYTE *Dib = GeneratePackedDIB(&Spec, &DibSize);
+	WCHAR *Text = GenerateText(1000, 1);
+	if (!CHECK(Dib != nullptr && Text != nullptr))
+	{
+		free(Dib);
+		free(Text);
+		return;
+	}
+	CONTENT_HASH DibHash;
+	ComputeContentHash(Dib, DibSize, &DibHash);
+
+	static CAPTURE_WORKER Worker;
+	Notifications = 0;
+	if (!CHECK(CaptureWorkerStart(&Worker, CountNotification, nullptr)))
+	{
+		free(Dib);
+		free(Text);
+		return;
+	}
+
+	DWORD Random = 1;
+	UINT Submitted = 0;
+	UINT Received = 0;
+	ULONGLONG LastGeneration = 0;
+	ULONGLONG LastReceived = 0;
+	for (UINT Step = 0; Step < RACE_STEPS; ++Step)
+	{
+		DWORD Action = TestRandom(&Random) % 100;
+		if (Action < 60)
+		{
+			// Mostly texts, which are done in no time; images take long enough to be cancelled while decoding. Some of
+			// them are known already, and come back undecoded.
+			CAPTURE_JOB *Job = Action < 50 ? CreateTestJob(CF_UNICODETEXT, Text, (SIZE_T)(TestRandom(&Random) % 1000) * sizeof(WCHAR)) : CreateTestJob(CF_DIB, Dib, DibSize);
+			if (!CHECK(Job != nullptr)) break;
+			if (Job->Format == CF_DIB && Action >= 57)
+			{
+				Job->KnownHashes = (CONTENT_HASH *)malloc(sizeof(CONTENT_HASH));
+				if (Job->KnownHashes != nullptr)
+				{
+					Job->KnownHashes[0] = DibHash;
+					Job->KnownHashCount = 1;
+				}
+			}
+			CaptureWorkerSubmit(&Worker, Job);
+			LastGeneration = Job->Generation;
+			++Submitted;
+		}
+		else if (Action < 70)
+		{
+			CaptureWorkerCancel(&Worker);
+		}
+		else
+		{
+			while (CAPTURE_JOB *Job = CaptureWorkerGetResult(&Worker))
+			{
+				// Only the newest job comes back, and each at most once.
+				CHECK(Job->Generation == LastGeneration && Job->Generation > LastReceived);
+				LastReceived = Job->Generation;
+				if (Job->Format == CF_DIB)
+				{
+					CHECK(ContentHashEqual(&Job->Hash, &DibHash));
+					CHECK(Job->IsKnown == (Job->KnownHashCount != 0));
+					CHECK(Job->IsKnown ? Job->Image == nullptr && Job->Data != nullptr : Job->Image != nullptr && Job->CompressedImage != nullptr && Job->Data == nullptr);
+				}
+				CaptureJobFree(Job);
+				++Received;
+			}
+		}
+	}
+
+	// The last job always makes it.
+	CAPTURE_JOB *Job = CreateTestJob(CF_DIB, Dib, DibSize);
+	if (CHECK(Job != nullptr))
+	{
+		CaptureWorkerSubmit(&Worker, Job);
+		++Submitted;
+		Job = WaitForResult(&Worker, Job->Generation);
+		CHECK(Job != nullptr && Job->Image != nullptr && Job->Image->Width == RACE_IMAGE_SIZE);
+		CaptureJobFree(Job);
+		++Received;
+	}
+	CaptureWorkerStop(&Worker);
+
+	// Completed jobs include those that were only dropped when collecting, so the two numbers add up to every job.
+	CHECK(Received > 0 && Received <= Notifications && Worker.JobsCancelled > 0);
+	CHECK(Worker.JobsCompleted + Worker.JobsCancelled == (LONGLONG)Submitted);
+	CHECK((UINT)Worker.JobsCompleted == Notifications);
+	free(Dib);
+	free(Text);
+}
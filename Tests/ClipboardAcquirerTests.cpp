@@ -0,0 +1,212 @@
+// Drives the acquirer against the fake clipboard, with time passed in by the test: how the delays grow, how far the
+// jitter moves them, when it gives up, and what it reports.
+
+#include "Test.h"
+#include "ClipboardAcquirer.h"
+#include "ClipboardBackend.h"
+#include "FakeClipboardBackend.h"
+
+#define NEVER_FREE_US ((ULONGLONG)-1)
+
+
+static void InitTestConfig(CLIPBOARD_ACQUIRER_CONFIG *Config, UINT MaxAttempts, ULONGLONG MaxWaitUs, UINT JitterPercent)
+{
+	Config->MaxAttempts = MaxAttempts;
+	Config->MaxWaitUs = MaxWaitUs;
+	Config->InitialDelayUs = 1000;
+	Config->MaxDelayUs = 16000;
+	Config->JitterPercent = JitterPercent;
+}
+
+
+// Retries at exactly the time the acquirer asks for, until it opens the clipboard or gives up. Delays receives the
+// delay before every retry (up to MaxDelays of them), and DelayCount how many there were.
+static ACQUIRE_RESULT RunAcquisition(CLIPBOARD_ACQUIRER *Acquirer, FAKE_CLIPBOARD *Fake, ULONGLONG *Delays, UINT MaxDelays, UINT *DelayCount)
+{
+	*DelayCount = 0;
+	ULONGLONG DelayUs;
+	ACQUIRE_RESULT Result = ClipboardAcquirerBegin(Acquirer, Fake->NowUs, &DelayUs);
+	while (Result == ACQUIRE_RETRY)
+	{
+		if (*DelayCount < MaxDelays) Delays[*DelayCount] = DelayUs;
+		++*DelayCount;
+		if (!CHECK(ClipboardAcquirerIsPending(Acquirer))) break;
+		Fake->NowUs += DelayUs;
+		Result = ClipboardAcquirerRetry(Acquirer, Fake->NowUs, &DelayUs);
+	}
+	return Result;
+}
+
+
+// Without jitter, the delays double from InitialDelayUs up to MaxDelayUs, and the statistics add up.
+void TestAcquirerBackoff()
+{
+	CLIPBOARD_BACKEND Backend;
+	FAKE_CLIPBOARD Fake;
+	FakeClipboardInit(&Fake, &Backend);
+	CLIPBOARD_ACQUIRER_CONFIG Config;
+	InitTestConfig(&Config, 100, 1000000000, 0);
+	CLIPBOARD_ACQUIRER Acquirer;
+	ClipboardAcquirerInit(&Acquirer, &Backend, &Config, 1);
+
+	Fake.NowUs = 7000;
+	Fake.FailNextOpens = 10;
+	ULONGLONG Delays[16];
+	UINT DelayCount;
+	CHECK(RunAcquisition(&Acquirer, &Fake, Delays, 16, &DelayCount) == ACQUIRE_OPENED);
+	static const ULONGLONG Expected[] = { 1000, 2000, 4000, 8000, 16000, 16000, 16000, 16000, 16000, 16000 };
+	if (!CHECK(DelayCount == 10)) return;
+	ULONGLONG TotalUs = 0;
+	for (UINT i = 0; i < DelayCount; ++i)
+	{
+		TestSetContext("retry %u", i);
+		CHECK(Delays[i] == Expected[i]);
+		TotalUs += Expected[i];
+	}
+	TestSetContext("");
+	CHECK(Fake.IsOpen && Fake.OpenAttempts == 11 && Fake.OpenCount == 1);
+	CHECK(!ClipboardAcquirerIsPending(&Acquirer) && Acquirer.LastSucceeded && Acquirer.LastAttempts == 11 && Acquirer.LastDurationUs == TotalUs);
+	ClipboardAcquirerRelease(&Acquirer, Fake.NowUs);
+	CHECK(!Fake.IsOpen);
+
+	// The next acquisition starts over with InitialDelayUs; one that opens right away reports a single attempt.
+	Fake.FailNextOpens = 1;
+	CHECK(RunAcquisition(&Acquirer, &Fake, Delays, 16, &DelayCount) == ACQUIRE_OPENED && DelayCount == 1 && Delays[0] == 1000);
+	ClipboardAcquirerRelease(&Acquirer, Fake.NowUs);
+	CHECK(RunAcquisition(&Acquirer, &Fake, Delays, 16, &DelayCount) == ACQUIRE_OPENED && DelayCount == 0);
+	CHECK(Acquirer.LastAttempts == 1 && Acquirer.LastDurationUs == 0);
+	ClipboardAcquirerRelease(&Acquirer, Fake.NowUs);
+
+	// A delay of 0 tells the caller a timer is already set, so with no initial delay, or jitter that takes it all away,
+	// every retry still waits at least 1 microsecond.
+	for (UINT JitterPercent = 0; JitterPercent <= 100; JitterPercent += 100)
+	{
+		TestSetContext("no initial delay, jitter %u", JitterPercent);
+		InitTestConfig(&Config, 100, 1000000000, JitterPercent);
+		Config.InitialDelayUs = 0;
+		Config.MaxDelayUs = 1;
+		ClipboardAcquirerInit(&Acquirer, &Backend, &Config, 1);
+		Fake.FailNextOpens = 20;
+		if (!CHECK(RunAcquisition(&Acquirer, &Fake, Delays, 16, &DelayCount) == ACQUIRE_OPENED && DelayCount == 20)) continue;
+		for (UINT i = 0; i < 16; ++i)
+		{
+			CHECK(Delays[i] >= 1 && Delays[i] <= 2);
+		}
+		ClipboardAcquirerRelease(&Acquirer, Fake.NowUs);
+	}
+}
+
+
+// Every delay stays within JitterPercent of the one without jitter, and the jitter actually spreads them over the range.
+void TestAcquirerJitter()
+{
+	CLIPBOARD_BACKEND Backend;
+	FAKE_CLIPBOARD Fake;
+	FakeClipboardInit(&Fake, &Backend);
+	CLIPBOARD_ACQUIRER_CONFIG Config;
+	InitTestConfig(&Config, 8, 1000000000, 25);
+
+	static const ULONGLONG Nominal[] = { 1000, 2000, 4000, 8000, 16000, 16000, 16000 };
+	ULONGLONG Smallest[7] = { NEVER_FREE_US, NEVER_FREE_US, NEVER_FREE_US, NEVER_FREE_US, NEVER_FREE_US, NEVER_FREE_US, NEVER_FREE_US };
+	ULONGLONG Largest[7] = {};
+	for (DWORD Seed = 1; Seed <= 1000; ++Seed)
+	{
+		TestSetContext("seed %u", Seed);
+		CLIPBOARD_ACQUIRER Acquirer;
+		ClipboardAcquirerInit(&Acquirer, &Backend, &Config, Seed);
+		Fake.BusyUntilUs = NEVER_FREE_US;
+		ULONGLONG Delays[8];
+		UINT DelayCount;
+		CHECK(RunAcquisition(&Acquirer, &Fake, Delays, 8, &DelayCount) == ACQUIRE_FAILED);
+		if (!CHECK(DelayCount == 7)) return;
+		for (UINT i = 0; i < DelayCount; ++i)
+		{
+			if (!CHECK(Delays[i] >= Nominal[i] * 3 / 4 && Delays[i] <= Nominal[i] * 5 / 4)) return;
+			if (Delays[i] < Smallest[i]) Smallest[i] = Delays[i];
+			if (Delays[i] > Largest[i]) Largest[i] = Delays[i];
+		}
+	}
+	TestSetContext("");
+	for (UINT i = 0; i < 7; ++i)
+	{
+		// 1000 draws from 2 * Nominal / 4 + 1 values: the extremes of the range are hardly ever further off than this.
+		CHECK(Smallest[i] < Nominal[i] * 4 / 5 && Largest[i] > Nominal[i] * 6 / 5);
+	}
+}
+
+
+// MaxAttempts counts the first attempt too; MaxWaitUs stops it before a retry that would come after the deadline.
+void TestAcquirerGiveUp()
+{
+	CLIPBOARD_BACKEND Backend;
+	FAKE_CLIPBOARD Fake;
+	FakeClipboardInit(&Fake, &Backend);
+	Fake.BusyUntilUs = NEVER_FREE_US;
+	CLIPBOARD_ACQUIRER_CONFIG Config;
+	InitTestConfig(&Config, 5, 1000000000, 0);
+	CLIPBOARD_ACQUIRER Acquirer;
+	ClipboardAcquirerInit(&Acquirer, &Backend, &Config, 1);
+	ULONGLONG Delays[16];
+	UINT DelayCount;
+	CHECK(RunAcquisition(&Acquirer, &Fake, Delays, 16, &DelayCount) == ACQUIRE_FAILED);
+	CHECK(DelayCount == 4 && Fake.OpenAttempts == 5 && Fake.OpenCount == 0);
+	CHECK(!ClipboardAcquirerIsPending(&Acquirer) && !Acquirer.LastSucceeded && Acquirer.LastAttempts == 5 && Acquirer.LastDurationUs == 1000 + 2000 + 4000 + 8000);
+
+	// Retries at 1000, 3000 and 7000 us; the next one would be at 15000.
+	InitTestConfig(&Config, 100, 10000, 0);
+	ClipboardAcquirerInit(&Acquirer, &Backend, &Config, 1);
+	Fake.NowUs = 0;
+	Fake.OpenAttempts = 0;
+	CHECK(RunAcquisition(&Acquirer, &Fake, Delays, 16, &DelayCount) == ACQUIRE_FAILED);
+	CHECK(DelayCount == 3 && Fake.OpenAttempts == 4 && Fake.NowUs == 7000 && Acquirer.LastDurationUs == 7000);
+
+	// With jitter, no retry is ever scheduled past the deadline.
+	InitTestConfig(&Config, 100, 50000, 50);
+	for (DWORD Seed = 1; Seed <= 200; ++Seed)
+	{
+		TestSetContext("seed %u", Seed);
+		ClipboardAcquirerInit(&Acquirer, &Backend, &Config, Seed);
+		Fake.NowUs = 0;
+		CHECK(RunAcquisition(&Acquirer, &Fake, Delays, 16, &DelayCount) == ACQUIRE_FAILED && Fake.NowUs <= 50000);
+	}
+	TestSetContext("");
+
+	// The clipboard becoming free in time ends the retries.
+	InitTestConfig(&Config, 100, 1000000000, 0);
+	ClipboardAcquirerInit(&Acquirer, &Backend, &Config, 1);
+	Fake.NowUs = 0;
+	Fake.BusyUntilUs = 5000;
+	CHECK(RunAcquisition(&Acquirer, &Fake, Delays, 16, &DelayCount) == ACQUIRE_OPENED && Fake.NowUs == 7000);
+	ClipboardAcquirerRelease(&Acquirer, Fake.NowUs);
+}
+
+
+// The hold time runs from the attempt that opened the clipboard to the release, not from the first attempt. Beginning
+// again while an acquisition is pending does not touch the clipboard, and retrying after a cancel fails.
+void TestAcquirerHoldTime()
+{
+	CLIPBOARD_BACKEND Backend;
+	FAKE_CLIPBOARD Fake;
+	FakeClipboardInit(&Fake, &Backend);
+	CLIPBOARD_ACQUIRER_CONFIG Config;
+	InitTestConfig(&Config, 100, 1000000000, 0);
+	CLIPBOARD_ACQUIRER Acquirer;
+	ClipboardAcquirerInit(&Acquirer, &Backend, &Config, 1);
+
+	Fake.NowUs = 100000;
+	Fake.FailNextOpens = 3;
+	ULONGLONG Delays[16];
+	UINT DelayCount;
+	CHECK(RunAcquisition(&Acquirer, &Fake, Delays, 16, &DelayCount) == ACQUIRE_OPENED && Fake.NowUs == 107000);
+	ClipboardAcquirerRelease(&Acquirer, Fake.NowUs + 412);
+	CHECK(!Fake.IsOpen && Acquirer.LastHoldUs == 412 && Acquirer.LastDurationUs == 7000);
+
+	Fake.FailNextOpens = 1;
+	ULONGLONG DelayUs;
+	CHECK(ClipboardAcquirerBegin(&Acquirer, Fake.NowUs, &DelayUs) == ACQUIRE_RETRY && DelayUs == 1000);
+	CHECK(ClipboardAcquirerBegin(&Acquirer, Fake.NowUs + 10, &DelayUs) == ACQUIRE_RETRY && DelayUs == 0);
+	CHECK(Fake.OpenAttempts == 5 && ClipboardAcquirerIsPending(&Acquirer));
+	ClipboardAcquirerCancel(&Acquirer);
+	CHECK(!ClipboardAcquirerIsPending(&Acquirer));
+	CHECK(ClipboardAcquirerRetry(&Acquirer, Fake.NowUs + 1000, &DelayUs) == ACQUIRE_FAILED && Fake.OpenAttempts == 5 && !Fake.IsOpen);
+}
@@ -0,0 +1,324 @@
+// Checks the history against a list of everything appended to it: evictions take the oldest entries first, removals
+// hand their arena space on without losing any, and the payloads stay intact through every wrap-around.
+
+#include "Test.h"
+#include "ClipboardHistory.h"
+#include "ImageCodec.h"
+#include "PixelBuffer.h"
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+#define MODEL_CAPACITY 20000
+#define MAX_TEST_PAYLOAD (80 * 1024)
+
+// Everything that was appended, oldest first. Entries leave the history from the front, except for removals.
+struct HISTORY_MODEL
+{
+	ULONGLONG Ids[MODEL_CAPACITY];
+	SIZE_T Sizes[MODEL_CAPACITY];
+	BOOL Removed[MODEL_CAPACITY];
+	UINT Count;
+	UINT Oldest;           // Everything before this has been evicted.
+};
+
+struct ARENA_RANGE
+{
+	SIZE_T Start;
+	SIZE_T End;
+};
+
+static BYTE Payload[MAX_TEST_PAYLOAD];
+
+
+// The payload of the entry with Id: different for every id, so that any mixup shows.
+static void FillPayload(ULONGLONG Id, SIZE_T SizeCb)
+{
+	DWORD State = (DWORD)Id * 2654435761u | 1;
+	for (SIZE_T i = 0; i < SizeCb; ++i)
+	{
+		Payload[i] = (BYTE)TestRandom(&State);
+	}
+}
+
+
+static void GetTestHash(ULONGLONG Id, CONTENT_HASH *Hash)
+{
+	Hash->Low = Id * 0x9E3779B97F4A7C15ull;
+	Hash->High = ~Id;
+}
+
+
+static const HISTORY_ENTRY *AppendTestEntry(CLIPBOARD_HISTORY *History, HISTORY_MODEL *Model, SIZE_T SizeCb)
+{
+	ULONGLONG Id = History->NextId;
+	FillPayload(Id, SizeCb);
+	CONTENT_HASH Hash;
+	GetTestHash(Id, &Hash);
+	const HISTORY_ENTRY *Entry = ClipboardHistoryAppend(History, 1, Payload, SizeCb, nullptr, &Hash, (LONGLONG)Id);
+	if (Entry != nullptr)
+	{
+		// A store index to follow the entry around through removals.
+		CHECK(Entry->StoredIndex == HISTORY_NOT_STORED);
+		ClipboardHistorySetStoredIndex(History, 0, Id * 3);
+	}
+	if (Entry != nullptr && Model->Count < MODEL_CAPACITY)
+	{
+		Model->Ids[Model->Count] = Id;
+		Model->Sizes[Model->Count] = SizeCb;
+		Model->Removed[Model->Count] = false;
+		++Model->Count;
+	}
+	return Entry;
+}
+
+
+static void RemoveTestEntry(CLIPBOARD_HISTORY *History, HISTORY_MODEL *Model, UINT Index)
+{
+	ULONGLONG Id = ClipboardHistoryGet(History, Index)->Id;
+	ClipboardHistoryRemove(History, Index);
+	for (UINT i = Model->Oldest; i < Model->Count; ++i)
+	{
+		if (Model->Ids[i] == Id) Model->Removed[i] = true;
+	}
+}
+
+
+static SIZE_T AllocationSize(SIZE_T SizeCb)
+{
+	return (SizeCb + 2 + 7) & ~(SIZE_T)7;
+}
+
+
+// Compares the history with the model, and checks its bookkeeping. Entries missing from the history must be the oldest
+// ones of the model, and are marked as evicted. Comparing the payloads is by far the slowest part, and can be left out.
+static BOOL CheckHistory(const CLIPBOARD_HISTORY *History, HISTORY_MODEL *Model, BOOL ComparePayloads)
+{
+	UINT Expected = 0;
+	for (UINT i = Model->Oldest; i < Model->Count; ++i)
+	{
+		if (!Model->Removed[i]) ++Expected;
+	}
+	if (!CHECK(History->Count <= Expected)) return false;
+	for (UINT Evicted = Expected - History->Count; Evicted > 0; ++Model->Oldest)
+	{
+		if (!Model->Removed[Model->Oldest]) --Evicted;
+	}
+
+	SIZE_T BytesUsed = 0;
+	SIZE_T ArenaUsed = 0;
+	static ARENA_RANGE Ranges[MODEL_CAPACITY];
+	UINT RangeCount = 0;
+	UINT Index = History->Count;
+	for (UINT i = Model->Oldest; i < Model->Count; ++i)
+	{
+		if (Model->Removed[i]) continue;
+		const HISTORY_ENTRY *Entry = ClipboardHistoryGet(History, --Index);
+		if (!CHECK(Entry != nullptr && Entry->Id == Model->Ids[i] && Entry->SizeCb == Model->Sizes[i] && Entry->StoredIndex == Entry->Id * 3)) return false;
+		if (ComparePayloads) FillPayload(Entry->Id, Entry->SizeCb);
+		if (ComparePayloads && !CHECK(memcmp(Entry->Data, Payload, Entry->SizeCb) == 0 && Entry->Data[Entry->SizeCb] == 0 && Entry->Data[Entry->SizeCb + 1] == 0)) return false;
+		UINT Found;
+		if (!CHECK(ClipboardHistoryFindId(History, Entry->Id, &Found) && Found == Index)) return false;
+		CONTENT_HASH Hash;
+		GetTestHash(Entry->Id, &Hash);
+		if (!CHECK(ClipboardHistoryFind(History, 1, &Hash, &Found) && Found == Index)) return false;
+
+		BytesUsed += Entry->BudgetCharge;
+		if (!Entry->OutsideArena)
+		{
+			ArenaUsed += Entry->ArenaCharge;
+			Ranges[RangeCount].Start = Entry->ArenaOffset;
+			Ranges[RangeCount].End = Entry->ArenaOffset + AllocationSize(Entry->SizeCb);
+			if (!CHECK(Ranges[RangeCount].End <= History->ArenaSize)) return false;
+			++RangeCount;
+		}
+	}
+	if (!CHECK(BytesUsed == History->BytesUsed && BytesUsed <= History->ByteBudget)) return false;
+	if (!CHECK(ArenaUsed == History->ArenaUsed && ArenaUsed <= History->ArenaSize)) return false;
+
+	// No two payloads share arena bytes.
+	std::sort(Ranges, Ranges + RangeCount, [](const ARENA_RANGE &a, const ARENA_RANGE &b) { return a.Start < b.Start; });
+	for (UINT i = 1; i < RangeCount; ++i)
+	{
+		if (!CHECK(Ranges[i - 1].End <= Ranges[i].Start)) return false;
+	}
+
+	// Ids that are gone are not found; the recently evicted ones are the likeliest to still be around.
+	UINT Found;
+	for (UINT i = Model->Oldest > 100 ? Model->Oldest - 100 : 0; i < Model->Count; ++i)
+	{
+		if ((i < Model->Oldest || Model->Removed[i]) && !CHECK(!ClipboardHistoryFindId(History, Model->Ids[i], &Found))) return false;
+	}
+	return true;
+}
+
+
+// With only MaxEntries limiting, the history holds the last MaxEntries appends, newest first.
+void TestHistoryEvictionOrder()
+{
+	CLIPBOARD_HISTORY History;
+	if (!CHECK(ClipboardHistoryInit(&History, 8, 64 * 1024, 1024 * 1024))) return;
+	static HISTORY_MODEL Model;
+	memset(&Model, 0, sizeof(Model));
+	for (UINT i = 0; i < 20; ++i)
+	{
+		const HISTORY_ENTRY *Entry = AppendTestEntry(&History, &Model, 100 + i);
+		CHECK(Entry != nullptr && Entry->Id == i + 1 && Entry == ClipboardHistoryGet(&History, 0));
+		CHECK(ClipboardHistoryCount(&History) == (i < 8 ? i + 1 : 8));
+	}
+	for (UINT i = 0; i < 8; ++i)
+	{
+		CHECK(ClipboardHistoryGet(&History, i)->Id == 20 - i);
+	}
+	CHECK(CheckHistory(&History, &Model, true) && Model.Oldest == 12);
+	ClipboardHistoryFree(&History);
+}
+
+
+// Random appends of all sizes, some larger than the arena, and removals from anywhere.
+void TestHistoryRandom()
+{
+	static const SIZE_T ArenaSizes[] = { 4096, 10000, 65536 };
+	static HISTORY_MODEL Model;
+	for (UINT a = 0; a < sizeof(ArenaSizes) / sizeof(ArenaSizes[0]); ++a)
+	{
+		for (int Removals = 0; Removals < 2; ++Removals)
+		{
+			TestSetContext("arena of %u bytes%s", (UINT)ArenaSizes[a], Removals ? ", with removals" : "");
+			CLIPBOARD_HISTORY History;
+			if (!CHECK(ClipboardHistoryInit(&History, 50, ArenaSizes[a], ArenaSizes[a] * 3))) return;
+			memset(&Model, 0, sizeof(Model));
+			DWORD Random = a * 2 + Removals + 1;
+			for (UINT Step = 0; Step < 5000; ++Step)
+			{
+				if (Removals && History.Count > 0 && TestRandom(&Random) % 3 == 0)
+				{
+					RemoveTestEntry(&History, &Model, TestRandom(&Random) % History.Count);
+				}
+				else
+				{
+					DWORD Kind = TestRandom(&Random) % 16;
+					SIZE_T SizeCb = Kind == 0 ? ArenaSizes[a] + TestRandom(&Random) % 1000 : Kind < 4 ? TestRandom(&Random) % (ArenaSizes[a] / 2) : TestRandom(&Random) % 300;
+					CHECK(AppendTestEntry(&History, &Model, SizeCb) != nullptr);
+				}
+				if (!CheckHistory(&History, &Model, Step % 50 == 0)) break;
+			}
+
+			CheckHistory(&History, &Model, true);
+
+			// Removing everything gives all the space back.
+			while (History.Count > 0)
+			{
+				ClipboardHistoryRemove(&History, TestRandom(&Random) % History.Count);
+			}
+			CHECK(History.ArenaUsed == 0 && History.BytesUsed == 0 && History.ArenaHead == 0 && History.ArenaTail == 0);
+			ClipboardHistoryFree(&History);
+		}
+	}
+}
+
+
+// The space of a removed entry goes to the next newer one in the arena, and comes back when that one is evicted; the
+// newest one gives it back right away.
+void TestHistoryRemoveMerging()
+{
+	CLIPBOARD_HISTORY History;
+	if (!CHECK(ClipboardHistoryInit(&History, 16, 1024, 1024 * 1024))) return;
+	static HISTORY_MODEL Model;
+	memset(&Model, 0, sizeof(Model));
+	for (UINT i = 0; i < 4; ++i)
+	{
+		AppendTestEntry(&History, &Model, 198); // 200 bytes each in the arena.
+	}
+	CHECK(History.ArenaUsed == 800 && History.ArenaHead == 800);
+
+	// Index 2 is the second oldest; its space goes to the third, and comes back when that one is evicted.
+	RemoveTestEntry(&History, &Model, 2);
+	CHECK(History.ArenaUsed == 800 && ClipboardHistoryGet(&History, 1)->Id == 3 && ClipboardHistoryGet(&History, 1)->ArenaCharge == 400);
+	RemoveTestEntry(&History, &Model, 2);
+	CHECK(History.ArenaUsed == 600 && History.ArenaTail == 200);
+	RemoveTestEntry(&History, &Model, 1);
+	CHECK(History.ArenaUsed == 200 && History.ArenaTail == 600);
+
+	// The newest one in the arena rolls the head back; an entry that is larger than the arena does not take part.
+	AppendTestEntry(&History, &Model, 198);
+	AppendTestEntry(&History, &Model, 2000);
+	CHECK(ClipboardHistoryGet(&History, 0)->OutsideArena && History.ArenaUsed == 400 && History.ArenaHead == 1000);
+	RemoveTestEntry(&History, &Model, 1);
+	CHECK(History.ArenaUsed == 200 && History.ArenaHead == 800);
+
+	CHECK(CheckHistory(&History, &Model, true));
+	ClipboardHistoryFree(&History);
+
+	// Wrapping around charges the skipped end of the arena to the entry that wrapped, and taking that entry back
+	// returns the head to the end.
+	if (!CHECK(ClipboardHistoryInit(&History, 16, 1024, 1024 * 1024))) return;
+	memset(&Model, 0, sizeof(Model));
+	for (UINT i = 0; i < 6; ++i)
+	{
+		AppendTestEntry(&History, &Model, 198);
+	}
+	const HISTORY_ENTRY *Wrapped = ClipboardHistoryGet(&History, 0);
+	CHECK(History.Count == 5 && Wrapped->ArenaOffset == 0 && Wrapped->ArenaCharge == 24 + 200 && History.ArenaUsed == 1024);
+	RemoveTestEntry(&History, &Model, 0);
+	CHECK(History.ArenaHead == 1000 && History.ArenaUsed == 800);
+
+	// The same, with the space of the entry that wrapped merged into the next one.
+	AppendTestEntry(&History, &Model, 198);
+	AppendTestEntry(&History, &Model, 198);
+	CHECK(History.Count == 5 && History.ArenaHead == 400 && History.ArenaTail == 400);
+	RemoveTestEntry(&History, &Model, 1);
+	CHECK(ClipboardHistoryGet(&History, 0)->ArenaCharge == 24 + 200 + 200);
+	RemoveTestEntry(&History, &Model, 0);
+	CHECK(History.ArenaHead == 1000 && History.ArenaUsed == 600);
+	CHECK(CheckHistory(&History, &Model, true));
+	AppendTestEntry(&History, &Model, 600);
+	CHECK(CheckHistory(&History, &Model, true));
+	ClipboardHistoryFree(&History);
+}
+
+
+// Images count against the budget at their compressed size, and whatever is over the budget on its own is refused.
+void TestHistoryBudget()
+{
+	CLIPBOARD_HISTORY History;
+	if (!CHECK(ClipboardHistoryInit(&History, 100, 1024 * 1024, 10000))) return;
+	static HISTORY_MODEL Model;
+	memset(&Model, 0, sizeof(Model));
+	for (UINT i = 0; i < 10; ++i)
+	{
+		AppendTestEntry(&History, &Model, 998);
+	}
+	CHECK(History.Count == 10 && History.BytesUsed == 10000);
+	AppendTestEntry(&History, &Model, 1);
+	CHECK(History.Count == 10 && ClipboardHistoryGet(&History, 9)->Id == 2);
+	CHECK(AppendTestEntry(&History, &Model, 9999) == nullptr);
+	CHECK(CheckHistory(&History, &Model, true));
+
+	PIXEL_BUFFER *Pixels = PixelBufferCreate(16, 16);
+	if (!CHECK(Pixels != nullptr)) return;
+	memset(Pixels->Pixels, 0x80, Pixels->SizeCb);
+	COMPRESSED_IMAGE *Image = ImageCodecEncode(Pixels, 1);
+	PixelBufferRelease(Pixels);
+	if (!CHECK(Image != nullptr)) return;
+	CONTENT_HASH Hash = {};
+	const HISTORY_ENTRY *Entry = ClipboardHistoryAppend(&History, 2, nullptr, 0, Image, &Hash, 0);
+	CHECK(Entry != nullptr && Entry->Image == Image && Entry->BudgetCharge == 8 + ImageCodecGetSize(Image));
+	// Only as many entries as needed made room.
+	CHECK(History.BytesUsed <= 10000 && History.BytesUsed + 1000 > 10000);
+
+	// Noise does not compress, so this one is over the budget, and is freed.
+	Pixels = PixelBufferCreate(64, 64);
+	if (!CHECK(Pixels != nullptr)) return;
+	DWORD Random = 1;
+	for (SIZE_T i = 0; i < Pixels->SizeCb; ++i)
+	{
+		Pixels->Pixels[i] = (BYTE)TestRandom(&Random);
+	}
+	Image = ImageCodecEncode(Pixels, 1);
+	PixelBufferRelease(Pixels);
+	if (!CHECK(Image != nullptr && ImageCodecGetSize(Image) > 10000)) return;
+	UINT Count = History.Count;
+	CHECK(ClipboardHistoryAppend(&History, 2, nullptr, 0, Image, &Hash, 0) == nullptr && History.Count == Count);
+	ClipboardHistoryFree(&History);
+}
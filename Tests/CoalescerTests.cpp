@@ -0,0 +1,136 @@
+// Feeds event traces to the coalescer with a simulated clock, polling at exactly the deadlines it asks for, the way the
+// monitor's timer does.
+
+#include "Test.h"
+#include "Coalescer.h"
+
+#define TEST_QUIET_US (30 * 1000)
+#define TEST_MAX_LATENCY_US (250 * 1000)
+#define MAX_TEST_FIRES 64
+
+
+struct TRACE_RESULT
+{
+	ULONGLONG FireUs[MAX_TEST_FIRES];
+	UINT Fires;
+};
+
+
+static void InitTestCoalescer(COALESCER *Coalescer)
+{
+	COALESCER_CONFIG Config;
+	Config.QuietUs = TEST_QUIET_US;
+	Config.MaxLatencyUs = TEST_MAX_LATENCY_US;
+	CoalescerInit(Coalescer, &Config);
+}
+
+
+// Polls at every deadline before UntilUs.
+static void RunTimer(COALESCER *Coalescer, ULONGLONG *DeadlineUs, ULONGLONG UntilUs, TRACE_RESULT *Result)
+{
+	while (*DeadlineUs != 0 && *DeadlineUs <= UntilUs)
+	{
+		ULONGLONG NowUs = *DeadlineUs;
+		if (CoalescerPoll(Coalescer, NowUs, DeadlineUs))
+		{
+			if (Result->Fires < MAX_TEST_FIRES) Result->FireUs[Result->Fires] = NowUs;
+			++Result->Fires;
+		}
+		else if (!CHECK(*DeadlineUs > NowUs))
+		{
+			return;
+		}
+	}
+}
+
+
+// Events at Start, Start + Interval, ... (Count of them), then runs the timer until nothing is pending.
+static void RunEvenTrace(COALESCER *Coalescer, ULONGLONG StartUs, ULONGLONG IntervalUs, UINT Count, TRACE_RESULT *Result)
+{
+	ULONGLONG DeadlineUs = 0;
+	for (UINT i = 0; i < Count; ++i)
+	{
+		ULONGLONG NowUs = StartUs + i * IntervalUs;
+		RunTimer(Coalescer, &DeadlineUs, NowUs, Result);
+		DeadlineUs = CoalescerAddEvent(Coalescer, NowUs);
+	}
+	RunTimer(Coalescer, &DeadlineUs, (ULONGLONG)-1, Result);
+	CHECK(!CoalescerIsPending(Coalescer));
+}
+
+
+// A burst of 100 events closer together than QuietUs fires once, QuietUs after the last one. Bursts that are further
+// apart fire separately.
+void TestCoalescerBurst()
+{
+	COALESCER Coalescer;
+	InitTestCoalescer(&Coalescer);
+	TRACE_RESULT Result = {};
+	RunEvenTrace(&Coalescer, 1000000, 1000, 100, &Result);
+	CHECK(Result.Fires == 1 && Result.FireUs[0] == 1000000 + 99 * 1000 + TEST_QUIET_US);
+	CHECK(Coalescer.Events == 100 && Coalescer.Fires == 1 && Coalescer.MaxLatencyUs == 99 * 1000 + TEST_QUIET_US);
+
+	// Exactly QuietUs apart is quiet enough.
+	RunEvenTrace(&Coalescer, 5000000, TEST_QUIET_US, 5, &Result);
+	CHECK(Result.Fires == 6 && Coalescer.Fires == 6 && Coalescer.Events == 105);
+
+	// Events at the same time count as one burst, too.
+	RunEvenTrace(&Coalescer, 9000000, 0, 1000, &Result);
+	CHECK(Result.Fires == 7 && Result.FireUs[6] == 9000000 + TEST_QUIET_US);
+}
+
+
+// A stream of events that never leaves QuietUs of quiet still fires every MaxLatencyUs.
+void TestCoalescerMaxLatency()
+{
+	COALESCER Coalescer;
+	InitTestCoalescer(&Coalescer);
+	TRACE_RESULT Result = {};
+	RunEvenTrace(&Coalescer, 0, 10000, 190, &Result);
+	// Bursts start at 0, 250 ms (the first event after the fire at 250 ms), 500 ms, ...; the last one ends in quiet.
+	if (!CHECK(Result.Fires == 8)) return;
+	for (UINT i = 0; i < 7; ++i)
+	{
+		TestSetContext("fire %u", i);
+		CHECK(Result.FireUs[i] == (i + 1) * (ULONGLONG)TEST_MAX_LATENCY_US);
+	}
+	TestSetContext("");
+	CHECK(Result.FireUs[7] == 189 * 10000 + TEST_QUIET_US);
+	CHECK(Coalescer.MaxLatencyUs == TEST_MAX_LATENCY_US);
+
+	// Polling late (a busy message loop) fires at once, and reports the actual latency.
+	ULONGLONG DeadlineUs = CoalescerAddEvent(&Coalescer, 10000000);
+	CHECK(DeadlineUs == 10000000 + TEST_QUIET_US);
+	CHECK(!CoalescerPoll(&Coalescer, DeadlineUs - 1, &DeadlineUs) && DeadlineUs == 10000000 + TEST_QUIET_US);
+	CHECK(CoalescerPoll(&Coalescer, 10000000 + 400000, &DeadlineUs) && DeadlineUs == 0 && Coalescer.MaxLatencyUs == 400000);
+	CHECK(!CoalescerPoll(&Coalescer, 10000000 + 500000, &DeadlineUs) && DeadlineUs == 0);
+
+	// A MaxLatencyUs below QuietUs is raised to it.
+	COALESCER_CONFIG Config;
+	Config.QuietUs = 5000;
+	Config.MaxLatencyUs = 1000;
+	CoalescerInit(&Coalescer, &Config);
+	CHECK(CoalescerAddEvent(&Coalescer, 100) == 5100);
+}
+
+
+// ONE SHOT mode captures the first change right away, without the coalescer; switching to it cancels the burst that
+// AUTO mode was waiting for, so that burst cannot fire later and capture a later state instead. Whatever comes after a
+// cancel is a new burst, with its own latency bound.
+void TestCoalescerOneShot()
+{
+	COALESCER Coalescer;
+	InitTestCoalescer(&Coalescer);
+	ULONGLONG DeadlineUs = CoalescerAddEvent(&Coalescer, 1000);
+	CoalescerAddEvent(&Coalescer, 2000);
+	CoalescerCancel(&Coalescer);
+	CHECK(!CoalescerIsPending(&Coalescer));
+	CHECK(!CoalescerPoll(&Coalescer, DeadlineUs, &DeadlineUs) && DeadlineUs == 0 && Coalescer.Fires == 0);
+
+	// Back in AUTO mode, much later.
+	DeadlineUs = CoalescerAddEvent(&Coalescer, 1000000);
+	CHECK(DeadlineUs == 1000000 + TEST_QUIET_US && Coalescer.FirstEventUs == 1000000);
+	TRACE_RESULT Result = {};
+	RunTimer(&Coalescer, &DeadlineUs, (ULONGLONG)-1, &Result);
+	CHECK(Result.Fires == 1 && Coalescer.MaxLatencyUs == TEST_QUIET_US && Coalescer.Events == 3);
+}
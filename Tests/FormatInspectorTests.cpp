@@ -0,0 +1,190 @@
+// Runs the format inspector on snapshots of the fake clipboard, the way the Formats menu does: listing the formats must
+// not lock a single payload, only the selected format is copied, and whatever was fetched goes away with the content.
+
+#include "Test.h"
+#include "ClipboardBackend.h"
+#include "ClipboardSnapshot.h"
+#include "FakeClipboardBackend.h"
+#include "FormatInspector.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_FORMAT_HTML (FAKE_CLIPBOARD_FIRST_REGISTERED + 1)
+#define TEST_FORMAT_BITMAP 2
+
+
+struct INSPECTOR_TEST
+{
+	CLIPBOARD_BACKEND Backend;
+	FAKE_CLIPBOARD Fake;
+	CLIPBOARD_SNAPSHOT Snapshot;
+	FORMAT_INSPECTOR Inspector;
+};
+
+
+// Opens the fake clipboard, lists its formats and copies Format (unless it is 0), and closes it again. Then hands the
+// snapshot to the inspector like the monitor does. Returns the copied item, or null.
+static const CLIPBOARD_SNAPSHOT_ITEM *InspectClipboard(INSPECTOR_TEST *Test, UINT Format)
+{
+	if (!CHECK(Test->Backend.Open(Test->Backend.Context))) return nullptr;
+	CLIPBOARD_SNAPSHOT_REQUEST Request = { &Format, 1 };
+	BOOL Taken = ClipboardSnapshotTake(&Test->Snapshot, &Test->Backend, &Request, Format != 0 ? 1 : 0);
+	Test->Backend.Close(Test->Backend.Context);
+	if (!CHECK(Taken && FormatInspectorUpdate(&Test->Inspector, &Test->Snapshot))) return nullptr;
+	if (Format == 0) return nullptr;
+	const CLIPBOARD_SNAPSHOT_ITEM *Item = &Test->Snapshot.Items[0];
+	FormatInspectorSetData(&Test->Inspector, Format, Item->Format != 0 ? Item->Data : nullptr, Item->SizeCb);
+	return Item;
+}
+
+
+static UINT CountOccurrences(const WCHAR *Text, SIZE_T Length, const char *Pattern)
+{
+	SIZE_T PatternLength = strlen(Pattern);
+	UINT Count = 0;
+	for (SIZE_T i = 0; i + PatternLength <= Length; ++i)
+	{
+		SIZE_T j = 0;
+		while (j < PatternLength && Text[i + j] == (WCHAR)Pattern[j]) ++j;
+		if (j == PatternLength) ++Count;
+	}
+	return Count;
+}
+
+
+static UINT CountDescribed(const FORMAT_INSPECTOR *Inspector, const char *Pattern)
+{
+	SIZE_T Length;
+	WCHAR *Text = FormatInspectorDescribe(Inspector, 0, &Length);
+	if (!CHECK(Text != nullptr)) return 0;
+	UINT Count = CountOccurrences(Text, Length, Pattern);
+	free(Text);
+	return Count;
+}
+
+
+static const WCHAR TestText[] = u"Hello, clipboard";
+static const char TestHtml[] = "Version:0.9\r\nStartHTML:0\r\n";
+static const WCHAR HtmlName[] = u"HTML Format";
+static const WCHAR TextName[] = u"CF_UNICODETEXT";
+// A bitmap handle is not a block of memory, so it cannot be locked.
+static const FAKE_CLIPBOARD_FORMAT TestFormats[] =
+{
+	{ CF_UNICODETEXT, TextName, TestText, sizeof(TestText) },
+	{ TEST_FORMAT_HTML, HtmlName, TestHtml, sizeof(TestHtml) - 1 },
+	{ TEST_FORMAT_BITMAP, nullptr, nullptr, 0 },
+};
+
+
+static void InitInspectorTest(INSPECTOR_TEST *Test)
+{
+	FakeClipboardInit(&Test->Fake, &Test->Backend);
+	FakeClipboardSetFormats(&Test->Fake, TestFormats, 3);
+	ClipboardSnapshotInit(&Test->Snapshot);
+	FormatInspectorInit(&Test->Inspector, &Test->Backend);
+}
+
+
+static void FreeInspectorTest(INSPECTOR_TEST *Test)
+{
+	FormatInspectorFree(&Test->Inspector);
+	ClipboardSnapshotFree(&Test->Snapshot);
+}
+
+
+// Listing the formats locks nothing; selecting one locks exactly that one, and only it has a size.
+void TestFormatInspectorLazy()
+{
+	INSPECTOR_TEST Test;
+	InitInspectorTest(&Test);
+	CHECK(FormatInspectorIsStale(&Test.Inspector));
+	InspectClipboard(&Test, 0);
+	CHECK(Test.Fake.LockCount == 0 && Test.Snapshot.Arena == nullptr);
+	CHECK(!FormatInspectorIsStale(&Test.Inspector) && Test.Inspector.Count == 3);
+	for (UINT i = 0; i < Test.Inspector.Count; ++i)
+	{
+		const CLIPBOARD_FORMAT_INFO *Info = &Test.Inspector.Formats[i];
+		TestSetContext("format %u", Info->Format);
+		CHECK(Info->Format == TestFormats[i].Format && !Info->Fetched && Info->Data == nullptr);
+	}
+	TestSetContext("");
+	CHECK(CountDescribed(&Test.Inspector, "not fetched") == 3);
+	const CLIPBOARD_FORMAT_INFO *Html = FormatInspectorFind(&Test.Inspector, TEST_FORMAT_HTML);
+	CHECK(Html != nullptr && Html->Name[0] == 'H' && Html->Name[4] == ' ');
+	const CLIPBOARD_FORMAT_INFO *Bitmap = FormatInspectorFind(&Test.Inspector, TEST_FORMAT_BITMAP);
+	CHECK(Bitmap != nullptr && Bitmap->Name[0] == 0);
+
+	// Selecting HTML Format copies it, and nothing else.
+	InspectClipboard(&Test, TEST_FORMAT_HTML);
+	CHECK(Test.Fake.LockCount == 1 && Test.Fake.LockedCount == 0);
+	CHECK(Html->Fetched && !Html->Unavailable && Html->SizeCb == sizeof(TestHtml) - 1 && memcmp(Html->Data, TestHtml, Html->SizeCb) == 0);
+	CHECK(!FormatInspectorFind(&Test.Inspector, CF_UNICODETEXT)->Fetched);
+	CHECK(CountDescribed(&Test.Inspector, "not fetched") == 2 && CountDescribed(&Test.Inspector, "26 bytes") == 1);
+
+	// Taking the payload leaves its size in the list.
+	SIZE_T SizeCb;
+	BYTE *Data = FormatInspectorTakeData(&Test.Inspector, TEST_FORMAT_HTML, &SizeCb);
+	CHECK(Data != nullptr && SizeCb == sizeof(TestHtml) - 1 && Html->Data == nullptr && Html->Fetched);
+	CHECK(FormatInspectorTakeData(&Test.Inspector, TEST_FORMAT_HTML, &SizeCb) == nullptr);
+	free(Data);
+
+	// A format that is not memory is fetched, but unavailable.
+	InspectClipboard(&Test, TEST_FORMAT_BITMAP);
+	CHECK(Test.Fake.LockCount == 1 && Bitmap->Fetched && Bitmap->Unavailable && Bitmap->Data == nullptr);
+	CHECK(CountDescribed(&Test.Inspector, "not available as memory") == 1);
+
+	// Formats that are not on the clipboard are not added.
+	CHECK(FormatInspectorSetData(&Test.Inspector, 0x1234, (const BYTE *)TestHtml, 1) == nullptr && Test.Inspector.Count == 3);
+	FreeInspectorTest(&Test);
+}
+
+
+// The list and everything fetched stay as long as the clipboard does not change, and are replaced when it does.
+void TestFormatInspectorRefresh()
+{
+	INSPECTOR_TEST Test;
+	InitInspectorTest(&Test);
+	InspectClipboard(&Test, CF_UNICODETEXT);
+	const CLIPBOARD_FORMAT_INFO *Text = FormatInspectorFind(&Test.Inspector, CF_UNICODETEXT);
+	CHECK(Text != nullptr && Text->Fetched && Text->SizeCb == sizeof(TestText));
+
+	// Another snapshot of the same content keeps what was fetched.
+	InspectClipboard(&Test, 0);
+	Text = FormatInspectorFind(&Test.Inspector, CF_UNICODETEXT);
+	CHECK(!FormatInspectorIsStale(&Test.Inspector) && Text != nullptr && Text->Fetched && Text->Data != nullptr);
+
+	// Someone copies something else: the list is stale until the next snapshot, which drops the payload.
+	static const FAKE_CLIPBOARD_FORMAT NewFormats[] =
+	{
+		{ TEST_FORMAT_HTML, HtmlName, TestHtml, sizeof(TestHtml) - 1 },
+	};
+	FakeClipboardSetFormats(&Test.Fake, NewFormats, 1);
+	CHECK(FormatInspectorIsStale(&Test.Inspector));
+	InspectClipboard(&Test, 0);
+	CHECK(!FormatInspectorIsStale(&Test.Inspector) && Test.Inspector.Count == 1);
+	CHECK(FormatInspectorFind(&Test.Inspector, CF_UNICODETEXT) == nullptr);
+	CHECK(!Test.Inspector.Formats[0].Fetched && Test.Inspector.Formats[0].Data == nullptr);
+	CHECK(CountDescribed(&Test.Inspector, "not fetched") == 1);
+
+	// A change to the same formats is a change, too.
+	InspectClipboard(&Test, TEST_FORMAT_HTML);
+	CHECK(Test.Inspector.Formats[0].Fetched);
+	FakeClipboardChange(&Test.Fake);
+	CHECK(FormatInspectorIsStale(&Test.Inspector));
+	InspectClipboard(&Test, 0);
+	CHECK(!Test.Inspector.Formats[0].Fetched);
+
+	// An unknown sequence number is never trusted.
+	Test.Fake.SequenceNumber = 0;
+	CHECK(FormatInspectorIsStale(&Test.Inspector));
+	InspectClipboard(&Test, TEST_FORMAT_HTML);
+	CHECK(FormatInspectorIsStale(&Test.Inspector) && Test.Inspector.Formats[0].Fetched);
+	InspectClipboard(&Test, 0);
+	CHECK(!Test.Inspector.Formats[0].Fetched);
+
+	// An empty clipboard says so.
+	FakeClipboardSetFormats(&Test.Fake, nullptr, 0);
+	InspectClipboard(&Test, 0);
+	CHECK(Test.Inspector.Count == 0 && CountDescribed(&Test.Inspector, "The clipboard is empty") == 1);
+	FreeInspectorTest(&Test);
+}
@@ -0,0 +1,145 @@
+// Compares every query of the BK-tree with a brute-force search over the hashes that are still in it, while hashes are
+// added, removed one by one and removed by id, and the tree is rebuilt without the removed ones.
+
+#include "Test.h"
+#include "HammingIndex.h"
+#include "PerceptualHash.h"
+#include <stdlib.h>
+
+#define TEST_HASH_COUNT 6000
+#define TEST_MAX_RADIUS 10
+
+
+static ULONGLONG GetRandomHash(DWORD *Random)
+{
+	return (ULONGLONG)TestRandom(Random) << 32 | TestRandom(Random);
+}
+
+
+// The ids in the index are their positions in Hashes, and Removed tells which are gone.
+struct HASH_MODEL
+{
+	ULONGLONG Hashes[TEST_HASH_COUNT];
+	BOOL Removed[TEST_HASH_COUNT];
+	UINT Count;
+	UINT LiveCount;
+};
+
+
+// Rejects every third id, like an image that has the same hash but a different size.
+static BOOL AcceptTestId(void *Context, ULONGLONG Id)
+{
+	return Id % 3 != 0;
+}
+
+
+// The nearest hash within Radius, and of those the newest, the slow way.
+static BOOL FindNearestBruteForce(const HASH_MODEL *Model, ULONGLONG Hash, UINT Radius, BOOL Filter, ULONGLONG *Id, UINT *Distance)
+{
+	BOOL Found = false;
+	for (UINT i = 0; i < Model->Count; ++i)
+	{
+		if (Model->Removed[i] || (Filter && i % 3 == 0)) continue;
+		UINT d = PerceptualHashDistance(Hash, Model->Hashes[i]);
+		if (d <= Radius && (!Found || d <= *Distance))
+		{
+			Found = true;
+			*Id = i;
+			*Distance = d;
+		}
+	}
+	return Found;
+}
+
+
+static void CheckQueries(HAMMING_INDEX *Index, const HASH_MODEL *Model, DWORD *Random)
+{
+	for (UINT q = 0; q < 40; ++q)
+	{
+		// Near a hash in the index (removed or not), or anywhere.
+		ULONGLONG Hash = q % 4 != 3 && Model->Count > 0 ? Model->Hashes[TestRandom(Random) % Model->Count] : GetRandomHash(Random);
+		for (UINT Flips = TestRandom(Random) % 5; Flips > 0; --Flips) Hash ^= 1ULL << TestRandom(Random) % 64;
+		UINT Radius = q % (TEST_MAX_RADIUS + 1);
+		BOOL Filter = q % 2 != 0;
+		TestSetContext("%u hashes, radius %u%s", Model->Count, Radius, Filter ? ", filtered" : "");
+		ULONGLONG ExpectedId = 0, Id = 0;
+		UINT ExpectedDistance = 0, Distance = 0;
+		BOOL Expected = FindNearestBruteForce(Model, Hash, Radius, Filter, &ExpectedId, &ExpectedDistance);
+		BOOL Found = HammingIndexFindNearest(Index, Hash, Radius, Filter ? AcceptTestId : nullptr, nullptr, &Id, &Distance);
+		if (!CHECK(Found == Expected)) return;
+		if (Found && !CHECK(Id == ExpectedId && Distance == ExpectedDistance)) return;
+		if (!CHECK(Index->LastVisited <= Index->Count)) return;
+	}
+}
+
+
+void TestHammingIndexBruteForce()
+{
+	static HASH_MODEL Model;
+	Model.Count = 0;
+	Model.LiveCount = 0;
+	HAMMING_INDEX Index;
+	HammingIndexInit(&Index);
+	ULONGLONG Empty;
+	UINT EmptyDistance;
+	CHECK(!HammingIndexFindNearest(&Index, 0, 64, nullptr, nullptr, &Empty, &EmptyDistance) && HammingIndexGetCount(&Index) == 0);
+
+	DWORD Random = 1;
+	UINT FirstLive = 0;
+	BOOL Rebuilt = false;
+	while (Model.Count < TEST_HASH_COUNT)
+	{
+		// Groups of near-duplicates, like screenshots of the same screen, and some hashes that occur again exactly.
+		DWORD r = TestRandom(&Random) % 10;
+		ULONGLONG Hash = GetRandomHash(&Random);
+		if (Model.Count > 0 && r < 7)
+		{
+			Hash = Model.Hashes[Model.Count - 1 - TestRandom(&Random) % (Model.Count < 8 ? Model.Count : 8)];
+			for (UINT Flips = TestRandom(&Random) % 4; Flips > 0; --Flips) Hash ^= 1ULL << TestRandom(&Random) % 64;
+		}
+		if (!CHECK(HammingIndexAdd(&Index, Hash, Model.Count))) break;
+		Model.Hashes[Model.Count] = Hash;
+		Model.Removed[Model.Count++] = false;
+		++Model.LiveCount;
+
+		// Remove single hashes, sometimes ones that are already gone.
+		if (TestRandom(&Random) % 4 == 0)
+		{
+			UINT Id = TestRandom(&Random) % Model.Count;
+			HammingIndexRemove(&Index, Id);
+			if (!Model.Removed[Id])
+			{
+				Model.Removed[Id] = true;
+				--Model.LiveCount;
+			}
+		}
+		// Every so often, drop the oldest ones like the history does, sometimes most of them.
+		if (Model.Count % 500 == 0)
+		{
+			UINT Before = Model.Count % 1500 == 0 ? Model.Count - 50 : FirstLive + (Model.Count - FirstLive) / 4;
+			UINT Nodes = Index.Count;
+			HammingIndexRemoveBefore(&Index, Before);
+			for (; FirstLive < Before; ++FirstLive)
+			{
+				if (!Model.Removed[FirstLive])
+				{
+					Model.Removed[FirstLive] = true;
+					--Model.LiveCount;
+				}
+			}
+			Rebuilt |= Index.Count < Nodes;
+		}
+		if (!CHECK(HammingIndexGetCount(&Index) == Model.LiveCount)) break;
+		if (Model.Count % 50 == 0) CheckQueries(&Index, &Model, &Random);
+	}
+	TestSetContext("");
+	// The removals above are enough to make the tree rebuild itself.
+	CHECK(Rebuilt && Index.Count < Model.Count);
+
+	// Removing everything leaves nothing to find; ids that do not exist are ignored.
+	HammingIndexRemove(&Index, TEST_HASH_COUNT + 5);
+	HammingIndexRemoveBefore(&Index, TEST_HASH_COUNT);
+	CHECK(HammingIndexGetCount(&Index) == 0);
+	CHECK(!HammingIndexFindNearest(&Index, Model.Hashes[TEST_HASH_COUNT - 1], 64, nullptr, nullptr, &Empty, &EmptyDistance));
+	HammingIndexFree(&Index);
+}
@@ -0,0 +1,103 @@
+#!/bin/bash
+# Runs the headless monitor against a virtual X server (Xvfb), copies text, a PNG and a text large enough to be
+# transferred with the INCR protocol with xclip, and checks the line of JSON written for each of them.
+#
+#   Tests/HeadlessMonitorTest.sh [path to clipboard-monitor]
+
+set -u
+Monitor=${1:-./clipboard-monitor}
+for Tool in Xvfb xclip; do
+	if ! command -v $Tool >/dev/null; then
+		echo "$Tool is not installed (Debian/Ubuntu: xvfb xclip)." >&2
+		exit 2
+	fi
+done
+if [ ! -x "$Monitor" ]; then
+	echo "$Monitor does not exist; build it first, or pass its path." >&2
+	exit 2
+fi
+
+Dir=$(mktemp -d)
+XvfbPid=
+MonitorPid=
+Cleanup()
+{
+	[ -n "$MonitorPid" ] && kill $MonitorPid 2>/dev/null
+	# xclip keeps serving the selection until another owner takes it, or the display goes away.
+	[ -n "$XvfbPid" ] && kill $XvfbPid 2>/dev/null
+	wait 2>/dev/null
+	rm -rf "$Dir"
+}
+trap Cleanup EXIT
+
+# Xvfb picks a free display, and writes its number once it accepts connections.
+Xvfb -displayfd 3 -nolisten tcp 3>"$Dir/display" 2>"$Dir/xvfb.log" &
+XvfbPid=$!
+for i in $(seq 100); do
+	[ -s "$Dir/display" ] && break
+	sleep 0.1
+done
+if [ ! -s "$Dir/display" ]; then
+	echo "Xvfb did not start:" >&2
+	cat "$Dir/xvfb.log" >&2
+	exit 1
+fi
+export DISPLAY=:$(cat "$Dir/display")
+
+"$Monitor" >"$Dir/records" 2>"$Dir/monitor.log" &
+MonitorPid=$!
+# Nothing tells when it watches the selection; give it a moment to connect.
+sleep 1
+
+Failed=0
+Records=0
+
+# Copies the file with the given target type, waits for the next record, and checks that it contains every expected
+# "key":value pair.
+CheckCopy()
+{
+	local Name=$1 Type=$2 File=$3
+	shift 3
+	xclip -selection clipboard -t "$Type" -i "$File"
+	Records=$((Records + 1))
+	for i in $(seq 100); do
+		[ $(wc -l <"$Dir/records") -ge $Records ] && break
+		sleep 0.1
+	done
+	local Record=$(sed -n "${Records}p" "$Dir/records")
+	local Result=ok
+	if [ -z "$Record" ]; then
+		Result="FAILED (no record)"
+	else
+		for Expected in "$@"; do
+			case "$Record" in
+				*"$Expected"*) ;;
+				*) Result="FAILED (no $Expected)" ;;
+			esac
+		done
+	fi
+	echo "$Result $Name: ${Record:0:160}"
+	[ "$Result" = ok ] || Failed=$((Failed + 1))
+}
+
+printf 'Hello, clipboard' >"$Dir/text"
+CheckCopy text UTF8_STRING "$Dir/text" '"format":"CF_UNICODETEXT"' '"length":16'
+
+# A 3 x 2 RGB image.
+printf '\211\120\116\107\015\012\032\012\000\000\000\015\111\110\104\122\000\000\000\003\000\000\000\002\010\002\000\000\000\022\026\361\115\000\000\000\033\111\104\101\124\170\332\143\140\140\140\010\140\320\130\000\044\030\052\064\002\052\002\026\124\124\000\000\040\154\004\261\177\302\150\374\000\000\000\000\111\105\116\104\256\102\140\202' >"$Dir/image.png"
+CheckCopy image/png image/png "$Dir/image.png" '"format":"PNG"' '"size":84' '"width":3' '"height":2'
+
+# Far more than fits into a single request, so xclip sends it in chunks.
+head -c 4194304 /dev/zero | tr '\0' x >"$Dir/large"
+CheckCopy incr UTF8_STRING "$Dir/large" '"format":"CF_UNICODETEXT"' '"length":4194304' '"size":8388608'
+
+if ! kill -0 $MonitorPid 2>/dev/null; then
+	echo "FAILED: the monitor exited:" >&2
+	cat "$Dir/monitor.log" >&2
+	exit 1
+fi
+if [ $Failed -ne 0 ]; then
+	echo "$Failed of 3 copies failed."
+	exit 1
+fi
+echo "3 of 3 copies passed."
@@ -0,0 +1,102 @@
+// Formats rows of random data with the SSE2 and the scalar row formatter, and compares both with a reference built
+// with sprintf, for every length of the last row and for both widths of the offset column.
+
+#include "Test.h"
+#include "HexDump.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_ROWS 64
+#define UNTOUCHED 0xFFFF
+
+
+// The row as the header comment of HexDump.h describes it.
+static UINT FormatReferenceRow(const HEX_DUMP *Dump, ULONGLONG Row, WCHAR *Out)
+{
+	char Text[HEX_DUMP_MAX_ROW_LENGTH + 8];
+	ULONGLONG Offset = Row * HEX_DUMP_BYTES_PER_ROW;
+	int Length = snprintf(Text, sizeof(Text), "%0*llX  ", (int)Dump->OffsetDigits, (unsigned long long)Offset);
+	SIZE_T Count = Dump->SizeCb - Offset < HEX_DUMP_BYTES_PER_ROW ? Dump->SizeCb - Offset : HEX_DUMP_BYTES_PER_ROW;
+	for (SIZE_T i = 0; i < HEX_DUMP_BYTES_PER_ROW; ++i)
+	{
+		Length += i < Count ? snprintf(Text + Length, sizeof(Text) - Length, "%02X ", Dump->Data[Offset + i]) : snprintf(Text + Length, sizeof(Text) - Length, "   ");
+		if (i == 7 || i == 15) Text[Length++] = ' ';
+	}
+	for (SIZE_T i = 0; i < HEX_DUMP_BYTES_PER_ROW; ++i)
+	{
+		BYTE b = i < Count ? Dump->Data[Offset + i] : ' ';
+		Text[Length++] = b >= 0x20 && b < 0x7F ? (char)b : '.';
+	}
+	for (int i = 0; i < Length; ++i)
+	{
+		Out[i] = (WCHAR)(BYTE)Text[i];
+	}
+	return (UINT)Length;
+}
+
+
+// Every row matches the reference, and nothing is written past the end of the row.
+static void CheckRows(const HEX_DUMP *Dump)
+{
+	ULONGLONG RowCount = HexDumpGetRowCount(Dump);
+	for (ULONGLONG Row = 0; Row < RowCount; ++Row)
+	{
+		WCHAR Expected[HEX_DUMP_MAX_ROW_LENGTH];
+		WCHAR Simd[HEX_DUMP_MAX_ROW_LENGTH];
+		WCHAR Scalar[HEX_DUMP_MAX_ROW_LENGTH];
+		for (UINT i = 0; i < HEX_DUMP_MAX_ROW_LENGTH; ++i)
+		{
+			Simd[i] = UNTOUCHED;
+			Scalar[i] = UNTOUCHED;
+		}
+		UINT ExpectedLength = FormatReferenceRow(Dump, Row, Expected);
+		UINT SimdLength = HexDumpFormatRow(Dump, Row, Simd);
+		UINT ScalarLength = HexDumpFormatRowScalar(Dump, Row, Scalar);
+		if (!CHECK(ExpectedLength == Dump->RowLength && SimdLength == Dump->RowLength && ScalarLength == Dump->RowLength)) return;
+		for (UINT i = 0; i < HEX_DUMP_MAX_ROW_LENGTH; ++i)
+		{
+			WCHAR c = i < ExpectedLength ? Expected[i] : UNTOUCHED;
+			if (!CHECK(Simd[i] == c && Scalar[i] == c)) return;
+		}
+	}
+	WCHAR Out[HEX_DUMP_MAX_ROW_LENGTH];
+	CHECK(HexDumpFormatRow(Dump, RowCount, Out) == 0 && HexDumpFormatRowScalar(Dump, RowCount, Out) == 0);
+}
+
+
+void TestHexDumpRows()
+{
+	static BYTE Data[TEST_ROWS * HEX_DUMP_BYTES_PER_ROW];
+	DWORD Random = 1;
+	for (UINT i = 0; i < sizeof(Data); ++i)
+	{
+		// Every byte value, and plenty of the boundaries between printable and not.
+		DWORD r = TestRandom(&Random);
+		Data[i] = (BYTE)(r & 0x100 ? r >> 16 : 0x1E + (r >> 16) % 4 + (r & 0x200 ? 0x60 : 0));
+	}
+
+	for (UINT OffsetDigits = 8; OffsetDigits <= 16; OffsetDigits += 8)
+	{
+		for (UINT Tail = 0; Tail < HEX_DUMP_BYTES_PER_ROW; ++Tail)
+		{
+			TestSetContext("%u digits, %u bytes in the last row", OffsetDigits, Tail);
+			HEX_DUMP Dump;
+			HexDumpInit(&Dump, Data, (TEST_ROWS - 1) * HEX_DUMP_BYTES_PER_ROW + Tail);
+			if (OffsetDigits == 16)
+			{
+				// What HexDumpInit picks for 4 GB and more, without needing that much data.
+				Dump.OffsetDigits = 16;
+				Dump.RowLength += 8;
+			}
+			CheckRows(&Dump);
+		}
+	}
+	TestSetContext("");
+
+	// The wide offset column starts at 4 GB, and fits HEX_DUMP_MAX_ROW_LENGTH.
+	HEX_DUMP Dump;
+	HexDumpInit(&Dump, nullptr, 0xFFFFFFFF);
+	CHECK(Dump.OffsetDigits == 8 && HexDumpGetRowCount(&Dump) == 0x10000000);
+	HexDumpInit(&Dump, nullptr, (SIZE_T)0x100000000ULL);
+	CHECK(Dump.OffsetDigits == (sizeof(SIZE_T) > 4 ? 16u : 8u) && Dump.RowLength <= HEX_DUMP_MAX_ROW_LENGTH);
+}
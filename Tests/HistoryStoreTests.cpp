@@ -0,0 +1,266 @@
+// Simulates crashes of the history store: the log cut off at every byte of the last record, the index deleted, and the
+// end of the index cut off or overwritten. Opening the store again must keep every complete record, in order, drop the
+// rest, and leave a store that appends and reopens normally. Works in a directory below the current one.
+
+#include "Test.h"
+#include "HistoryStore.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_STORE_DIRECTORY PATH_TEXT("clipboard-tests.store")
+// Small enough that the test records fill several segments.
+#define TEST_SEGMENT_SIZE 2048
+#define TEST_RECORDS 24
+#define TEST_MAX_PAYLOAD 300
+// Sizes that are part of the file format.
+#define INDEX_HEADER_SIZE 16
+#define RECORD_HEADER_SIZE 48
+
+
+static BYTE Payloads[TEST_RECORDS + 1][TEST_MAX_PAYLOAD];
+static SIZE_T PayloadSizes[TEST_RECORDS + 1];
+
+
+// The same payloads on every call: random bytes of random sizes, including empty ones.
+static void GeneratePayloads()
+{
+	DWORD Random = 5;
+	for (UINT i = 0; i <= TEST_RECORDS; ++i)
+	{
+		PayloadSizes[i] = i % 7 == 3 ? 0 : TestRandom(&Random) % TEST_MAX_PAYLOAD;
+		for (SIZE_T j = 0; j < PayloadSizes[i]; ++j)
+		{
+			Payloads[i][j] = (BYTE)TestRandom(&Random);
+		}
+	}
+}
+
+
+static BOOL AppendPayload(HISTORY_STORE *Store, UINT i)
+{
+	CONTENT_HASH Hash;
+	ComputeContentHash(Payloads[i], PayloadSizes[i], &Hash);
+	return HistoryStoreAppend(Store, CF_UNICODETEXT + i, Payloads[i], PayloadSizes[i], &Hash, 1000 + i);
+}
+
+
+// A new store with the first Count payloads, closed again.
+static BOOL CreateTestStore(UINT Count)
+{
+	HistoryStoreDelete(TEST_STORE_DIRECTORY);
+	HISTORY_STORE Store;
+	if (!CHECK(HistoryStoreOpen(&Store, TEST_STORE_DIRECTORY, TEST_SEGMENT_SIZE))) return false;
+	BOOL Succeeded = true;
+	for (UINT i = 0; i < Count && Succeeded; ++i)
+	{
+		Succeeded = CHECK(AppendPayload(&Store, i));
+	}
+	HistoryStoreClose(&Store);
+	return Succeeded;
+}
+
+
+// The store holds exactly the first Count payloads.
+static BOOL CheckStoreContent(HISTORY_STORE *Store, UINT Count)
+{
+	if (!CHECK(HistoryStoreGetCount(Store) == Count)) return false;
+	for (UINT i = 0; i < Count; ++i)
+	{
+		const STORED_ENTRY *Entry = HistoryStoreGetEntry(Store, i);
+		BYTE Buffer[TEST_MAX_PAYLOAD + 1];
+		if (!CHECK(Entry->Format == CF_UNICODETEXT + i && Entry->Timestamp == 1000 + i && Entry->SizeCb == PayloadSizes[i])) return false;
+		if (!CHECK(HistoryStoreRead(Store, i, Buffer) && memcmp(Buffer, Payloads[i], PayloadSizes[i]) == 0)) return false;
+	}
+	return true;
+}
+
+
+// After the repair, the store takes the next record, and opens with everything in place again.
+static void CheckAppendAfterRecovery(UINT Count)
+{
+	HISTORY_STORE Store;
+	if (!CHECK(HistoryStoreOpen(&Store, TEST_STORE_DIRECTORY, TEST_SEGMENT_SIZE))) return;
+	CHECK(AppendPayload(&Store, Count));
+	HistoryStoreClose(&Store);
+	if (!CHECK(HistoryStoreOpen(&Store, TEST_STORE_DIRECTORY, TEST_SEGMENT_SIZE))) return;
+	CHECK(Store.DroppedEntries == 0 && Store.RecoveredEntries == 0 && !Store.TruncatedLog);
+	CHECK(HistoryStoreGetCount(&Store) == Count + 1 && Store.AddedCount == 0);
+	const STORED_ENTRY *Entry = HistoryStoreGetEntry(&Store, Count);
+	BYTE Buffer[TEST_MAX_PAYLOAD + 1];
+	CHECK(Entry != nullptr && Entry->SizeCb == PayloadSizes[Count] && HistoryStoreRead(&Store, Count, Buffer) && memcmp(Buffer, Payloads[Count], PayloadSizes[Count]) == 0);
+	HistoryStoreClose(&Store);
+}
+
+
+// The index for Segment 0, as in HistoryStore.h.
+static void BuildStoreFilePath(UINT Segment, PATH_CHAR *Path)
+{
+	static const PATH_CHAR Directory[] = TEST_STORE_DIRECTORY;
+	SIZE_T Length = sizeof(Directory) / sizeof(Directory[0]) - 1;
+	memcpy(Path, Directory, Length * sizeof(PATH_CHAR));
+	Path[Length++] = PATH_SEPARATOR;
+	static const PATH_CHAR IndexName[] = PATH_TEXT("history.idx");
+	static const PATH_CHAR SegmentName[] = PATH_TEXT("00000000.log");
+	memcpy(Path + Length, Segment == 0 ? IndexName : SegmentName, Segment == 0 ? sizeof(IndexName) : sizeof(SegmentName));
+	for (int i = 7; Segment != 0 && i >= 0; --i, Segment /= 10)
+	{
+		Path[Length + i] = (PATH_CHAR)('0' + Segment % 10);
+	}
+}
+
+
+static BOOL OpenStoreFile(UINT Segment, PORTABLE_FILE *File)
+{
+	PATH_CHAR Path[STORE_PATH_LENGTH];
+	BuildStoreFilePath(Segment, Path);
+	return FileOpen(File, Path, false);
+}
+
+
+// Cuts the segment file of the last record at every byte from the start of the record to its end. A record is
+// complete once its payload is; only the padding after it may be missing.
+void TestHistoryStoreTruncatedLog()
+{
+	GeneratePayloads();
+	if (!CreateTestStore(TEST_RECORDS)) return;
+	HISTORY_STORE Store;
+	if (!CHECK(HistoryStoreOpen(&Store, TEST_STORE_DIRECTORY, TEST_SEGMENT_SIZE))) return;
+	STORED_ENTRY Last = *HistoryStoreGetEntry(&Store, TEST_RECORDS - 1);
+	CHECK(Last.Segment > 2);
+	HistoryStoreClose(&Store);
+	ULONGLONG PayloadEnd = Last.Offset + RECORD_HEADER_SIZE + Last.SizeCb;
+	ULONGLONG RecordEnd = (PayloadEnd + 7) & ~(ULONGLONG)7;
+
+	for (ULONGLONG Cut = Last.Offset; Cut < RecordEnd; ++Cut)
+	{
+		TestSetContext("log cut at %llu of %llu", (unsigned long long)(Cut - Last.Offset), (unsigned long long)(RecordEnd - Last.Offset));
+		if (!CreateTestStore(TEST_RECORDS)) break;
+		PORTABLE_FILE File;
+		if (!CHECK(OpenStoreFile(Last.Segment, &File))) break;
+		CHECK(FileTruncate(&File, Cut));
+		FileClose(&File);
+
+		if (!CHECK(HistoryStoreOpen(&Store, TEST_STORE_DIRECTORY, TEST_SEGMENT_SIZE))) break;
+		BOOL Complete = Cut >= PayloadEnd;
+		CHECK(Store.DroppedEntries == (Complete ? 0u : 1u) && Store.RecoveredEntries == 0);
+		CHECK(Store.TruncatedLog == (!Complete && Cut > Last.Offset));
+		BOOL Intact = CheckStoreContent(&Store, Complete ? TEST_RECORDS : TEST_RECORDS - 1);
+		HistoryStoreClose(&Store);
+		if (!Intact) break;
+		CheckAppendAfterRecovery(Complete ? TEST_RECORDS : TEST_RECORDS - 1);
+	}
+	TestSetContext("");
+	CHECK(HistoryStoreDelete(TEST_STORE_DIRECTORY));
+}
+
+
+// Without its index, the store is rebuilt from the log. An empty index is as good as none.
+void TestHistoryStoreDeletedIndex()
+{
+	GeneratePayloads();
+	for (UINT Empty = 0; Empty < 2; ++Empty)
+	{
+		TestSetContext(Empty ? "empty index" : "deleted index");
+		if (!CreateTestStore(TEST_RECORDS)) return;
+		PATH_CHAR Path[STORE_PATH_LENGTH];
+		BuildStoreFilePath(0, Path);
+		PORTABLE_FILE File;
+		if (Empty)
+		{
+			if (!CHECK(FileOpen(&File, Path, false))) return;
+			CHECK(FileTruncate(&File, 0));
+			FileClose(&File);
+		}
+		else
+		{
+			CHECK(FileDelete(Path) && !FileExists(Path));
+		}
+
+		HISTORY_STORE Store;
+		if (!CHECK(HistoryStoreOpen(&Store, TEST_STORE_DIRECTORY, TEST_SEGMENT_SIZE))) return;
+		CHECK(Store.RecoveredEntries == TEST_RECORDS && Store.DroppedEntries == 0 && !Store.TruncatedLog);
+		CheckStoreContent(&Store, TEST_RECORDS);
+		HistoryStoreClose(&Store);
+		CheckAppendAfterRecovery(TEST_RECORDS);
+	}
+	TestSetContext("");
+	CHECK(HistoryStoreDelete(TEST_STORE_DIRECTORY));
+}
+
+
+// The end of the index cut off or overwritten with garbage, and an index that is ahead of the log.
+void TestHistoryStoreCorruptIndex()
+{
+	GeneratePayloads();
+	const ULONGLONG IndexSize = INDEX_HEADER_SIZE + TEST_RECORDS * sizeof(STORED_ENTRY);
+
+	// Cut within the last entry, at every byte: the entry goes, and its record is indexed again.
+	for (ULONGLONG Cut = IndexSize - sizeof(STORED_ENTRY); Cut < IndexSize; ++Cut)
+	{
+		TestSetContext("index cut at %llu", (unsigned long long)Cut);
+		if (!CreateTestStore(TEST_RECORDS)) return;
+		PORTABLE_FILE File;
+		if (!CHECK(OpenStoreFile(0, &File))) return;
+		CHECK(FileTruncate(&File, Cut));
+		FileClose(&File);
+		HISTORY_STORE Store;
+		if (!CHECK(HistoryStoreOpen(&Store, TEST_STORE_DIRECTORY, TEST_SEGMENT_SIZE))) return;
+		CHECK(Store.RecoveredEntries == 1 && Store.DroppedEntries == 0);
+		BOOL Intact = CheckStoreContent(&Store, TEST_RECORDS);
+		HistoryStoreClose(&Store);
+		if (!Intact) return;
+	}
+
+	// Garbage in the last two entries: both are dropped, and their records indexed again.
+	DWORD Random = 9;
+	for (UINT Round = 0; Round < 20; ++Round)
+	{
+		TestSetContext("garbage %u", Round);
+		if (!CreateTestStore(TEST_RECORDS)) return;
+		BYTE Garbage[2 * sizeof(STORED_ENTRY)];
+		for (UINT i = 0; i < sizeof(Garbage); ++i) Garbage[i] = (BYTE)TestRandom(&Random);
+		PORTABLE_FILE File;
+		if (!CHECK(OpenStoreFile(0, &File))) return;
+		CHECK(FileWriteAt(&File, IndexSize - sizeof(Garbage), Garbage, sizeof(Garbage)));
+		FileClose(&File);
+		HISTORY_STORE Store;
+		if (!CHECK(HistoryStoreOpen(&Store, TEST_STORE_DIRECTORY, TEST_SEGMENT_SIZE))) return;
+		CHECK(Store.DroppedEntries == 2 && Store.RecoveredEntries == 2);
+		BOOL Intact = CheckStoreContent(&Store, TEST_RECORDS);
+		HistoryStoreClose(&Store);
+		if (!Intact) return;
+	}
+
+	// The log lost its last records (e.g. the file system kept the index, but not the segment): their entries go.
+	TestSetContext("log behind the index");
+	if (!CreateTestStore(TEST_RECORDS)) return;
+	HISTORY_STORE Store;
+	if (!CHECK(HistoryStoreOpen(&Store, TEST_STORE_DIRECTORY, TEST_SEGMENT_SIZE))) return;
+	UINT LastSegment = HistoryStoreGetEntry(&Store, TEST_RECORDS - 1)->Segment;
+	UINT Kept = TEST_RECORDS;
+	while (HistoryStoreGetEntry(&Store, Kept - 1)->Segment == LastSegment) --Kept;
+	HistoryStoreClose(&Store);
+	PORTABLE_FILE File;
+	if (!CHECK(OpenStoreFile(LastSegment, &File))) return;
+	CHECK(FileTruncate(&File, 0));
+	FileClose(&File);
+	if (!CHECK(HistoryStoreOpen(&Store, TEST_STORE_DIRECTORY, TEST_SEGMENT_SIZE))) return;
+	CHECK(Store.DroppedEntries == TEST_RECORDS - Kept && Store.RecoveredEntries == 0);
+	CheckStoreContent(&Store, Kept);
+	HistoryStoreClose(&Store);
+	CheckAppendAfterRecovery(Kept);
+
+	// A broken header makes the whole index unusable.
+	TestSetContext("header");
+	if (!CreateTestStore(TEST_RECORDS)) return;
+	if (!CHECK(OpenStoreFile(0, &File))) return;
+	static const BYTE BrokenVersion[4] = { 0xFF, 0xFF, 0xFF, 0xFF };
+	CHECK(FileWriteAt(&File, 4, BrokenVersion, sizeof(BrokenVersion)));
+	FileClose(&File);
+	if (!CHECK(HistoryStoreOpen(&Store, TEST_STORE_DIRECTORY, TEST_SEGMENT_SIZE))) return;
+	CHECK(Store.RecoveredEntries == TEST_RECORDS && Store.DroppedEntries == 0);
+	CheckStoreContent(&Store, TEST_RECORDS);
+	HistoryStoreClose(&Store);
+	TestSetContext("");
+	CHECK(HistoryStoreDelete(TEST_STORE_DIRECTORY));
+}
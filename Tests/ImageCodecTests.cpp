@@ -0,0 +1,278 @@
+// Round trips images of random sizes and contents through the codec, on any number of threads and by ranges of rows,
+// and feeds the decoder blobs that were truncated, had bits flipped or had their header changed. Those must be
+// rejected by ImageCodecValidate or fail to decode, and never read or write out of bounds (which the sanitizers see).
+
+#include "Test.h"
+#include "ImageCodec.h"
+#include "PerceptualHash.h"
+#include "PixelBuffer.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_IMAGE_COUNT 120
+#define TEST_MAX_SIZE 300
+
+enum TEST_IMAGE_KIND
+{
+	TEST_IMAGE_NOISE,          // Every code is OP_RGBA.
+	TEST_IMAGE_FLAT,           // Long runs, across rows and stripes.
+	TEST_IMAGE_GRADIENT,       // Small differences: OP_DIFF and OP_LUMA.
+	TEST_IMAGE_FEW_COLORS,     // The color cache.
+	TEST_IMAGE_KIND_COUNT,
+};
+
+
+static PIXEL_BUFFER *GenerateTestImage(LONG Width, LONG Height, TEST_IMAGE_KIND Kind, DWORD *Random)
+{
+	PIXEL_BUFFER *Image = PixelBufferCreate(Width, Height);
+	if (Image == nullptr) return nullptr;
+	static const DWORD Colors[] = { 0xFF000000, 0xFFFFFFFF, 0xFF3366CC, 0x80402010, 0x00000000, 0xFFF0F0F0 };
+	DWORD Color = TestRandom(Random);
+	for (LONG y = 0; y < Height; ++y)
+	{
+		DWORD *Row = (DWORD *)(Image->Pixels + (SIZE_T)y * Image->Stride);
+		for (LONG x = 0; x < Width; ++x)
+		{
+			DWORD r = TestRandom(Random);
+			switch (Kind)
+			{
+			case TEST_IMAGE_NOISE:
+				Row[x] = r;
+				break;
+			case TEST_IMAGE_FLAT:
+				if (r % 500 == 0) Color = r;
+				Row[x] = Color;
+				break;
+			case TEST_IMAGE_GRADIENT:
+				Row[x] = 0xFF000000 | (DWORD)(BYTE)(x + (r & 3)) << 16 | (DWORD)(BYTE)(y * 3 + (r >> 8 & 15)) << 8 | (BYTE)(x * y + (r >> 16 & 63));
+				break;
+			default:
+				Row[x] = Colors[r % (sizeof(Colors) / sizeof(Colors[0]))];
+				break;
+			}
+		}
+	}
+	return Image;
+}
+
+
+static BOOL SamePixels(const PIXEL_BUFFER *Image, const BYTE *Pixels, LONG FirstRow, LONG RowCount)
+{
+	return memcmp(Image->Pixels + (SIZE_T)FirstRow * Image->Stride, Pixels, (SIZE_T)RowCount * Image->Stride) == 0;
+}
+
+
+static void CheckRoundTrip(const PIXEL_BUFFER *Image, UINT Threads, DWORD *Random)
+{
+	COMPRESSED_IMAGE *Compressed = ImageCodecEncode(Image, Threads);
+	if (!CHECK(Compressed != nullptr)) return;
+	SIZE_T SizeCb = ImageCodecGetSize(Compressed);
+	CHECK(ImageCodecValidate(Compressed, SizeCb) == Compressed);
+	CHECK(Compressed->Width == Image->Width && Compressed->Height == Image->Height);
+	CHECK(Compressed->StripeCount == (UINT)((Image->Height + IMAGE_CODEC_STRIPE_ROWS - 1) / IMAGE_CODEC_STRIPE_ROWS));
+	CHECK(Compressed->AverageColor == GetAverageColor(Image) && Compressed->PerceptualHash == ComputePerceptualHash(Image));
+
+	PIXEL_BUFFER *Decoded = ImageCodecDecode(Compressed, Threads % 3);
+	if (CHECK(Decoded != nullptr))
+	{
+		CHECK(Decoded->Width == Image->Width && Decoded->Height == Image->Height && SamePixels(Image, Decoded->Pixels, 0, Image->Height));
+		PixelBufferRelease(Decoded);
+	}
+
+	// Ranges of rows that start and end anywhere, within a stripe or across several, and empty ones.
+	BYTE *Rows = (BYTE *)malloc(Image->SizeCb);
+	if (CHECK(Rows != nullptr))
+	{
+		for (UINT i = 0; i < 6; ++i)
+		{
+			LONG FirstRow = (LONG)(TestRandom(Random) % Image->Height);
+			LONG RowCount = (LONG)(TestRandom(Random) % (Image->Height - FirstRow + 1));
+			if (i == 0)
+			{
+				FirstRow = 0;
+				RowCount = Image->Height;
+			}
+			if (!CHECK(ImageCodecDecodeRows(Compressed, FirstRow, RowCount, Rows, Image->Stride) && SamePixels(Image, Rows, FirstRow, RowCount))) break;
+		}
+		CHECK(!ImageCodecDecodeRows(Compressed, -1, 1, Rows, Image->Stride));
+		CHECK(!ImageCodecDecodeRows(Compressed, Image->Height, 1, Rows, Image->Stride));
+		CHECK(!ImageCodecDecodeRows(Compressed, 0, Image->Height + 1, Rows, Image->Stride));
+		free(Rows);
+	}
+	free(Compressed);
+}
+
+
+void TestImageCodecRoundTrip()
+{
+	DWORD Random = 1;
+	for (UINT i = 0; i < TEST_IMAGE_COUNT; ++i)
+	{
+		// Heights around the stripe size, and some of every size.
+		LONG Width = 1 + (LONG)(TestRandom(&Random) % TEST_MAX_SIZE);
+		LONG Height = i < 8 ? IMAGE_CODEC_STRIPE_ROWS - 2 + (LONG)i : 1 + (LONG)(TestRandom(&Random) % TEST_MAX_SIZE);
+		TEST_IMAGE_KIND Kind = (TEST_IMAGE_KIND)(i % TEST_IMAGE_KIND_COUNT);
+		TestSetContext("%ld x %ld, kind %u", (long)Width, (long)Height, (UINT)Kind);
+		PIXEL_BUFFER *Image = GenerateTestImage(Width, Height, Kind, &Random);
+		if (!CHECK(Image != nullptr)) return;
+		CheckRoundTrip(Image, 1 + i % 5, &Random);
+		PixelBufferRelease(Image);
+	}
+	TestSetContext("");
+
+	// A single row that is longer than the longest run.
+	PIXEL_BUFFER *Image = PixelBufferCreate(5000, 1);
+	if (CHECK(Image != nullptr))
+	{
+		memset(Image->Pixels, 0x7F, Image->SizeCb);
+		CheckRoundTrip(Image, 1, &Random);
+		PixelBufferRelease(Image);
+	}
+}
+
+
+// Validates a copy of the blob that is exactly SizeCb long, and decodes it if it passes. The result does not matter,
+// only that the decoder stays within the blob and the image.
+static BOOL ValidateAndDecode(const BYTE *Blob, SIZE_T SizeCb, BOOL *Decoded)
+{
+	BYTE *Copy = (BYTE *)malloc(SizeCb != 0 ? SizeCb : 1);
+	if (!CHECK(Copy != nullptr)) return false;
+	memcpy(Copy, Blob, SizeCb);
+	const COMPRESSED_IMAGE *Image = ImageCodecValidate(Copy, SizeCb);
+	*Decoded = false;
+	if (Image != nullptr)
+	{
+		PIXEL_BUFFER *Pixels = ImageCodecDecode(Image, 2);
+		if (Pixels != nullptr)
+		{
+			CHECK(Pixels->Width == Image->Width && Pixels->Height == Image->Height);
+			*Decoded = true;
+		}
+		PixelBufferRelease(Pixels);
+		LONG RowCount = Image->Height < 100 ? Image->Height : 100;
+		BYTE *Rows = (BYTE *)malloc((SIZE_T)RowCount * Image->Width * 4);
+		if (Rows != nullptr)
+		{
+			ImageCodecDecodeRows(Image, Image->Height - RowCount, RowCount, Rows, (SIZE_T)Image->Width * 4);
+			free(Rows);
+		}
+	}
+	free(Copy);
+	return Image != nullptr;
+}
+
+
+void TestImageCodecCorrupt()
+{
+	DWORD Random = 7;
+	for (UINT i = 0; i < 24; ++i)
+	{
+		LONG Width = 1 + (LONG)(TestRandom(&Random) % 200);
+		LONG Height = 1 + (LONG)(TestRandom(&Random) % 200);
+		TestSetContext("%ld x %ld, kind %u", (long)Width, (long)Height, i % TEST_IMAGE_KIND_COUNT);
+		PIXEL_BUFFER *Image = GenerateTestImage(Width, Height, (TEST_IMAGE_KIND)(i % TEST_IMAGE_KIND_COUNT), &Random);
+		COMPRESSED_IMAGE *Compressed = Image != nullptr ? ImageCodecEncode(Image, 1) : nullptr;
+		if (!CHECK(Compressed != nullptr)) break;
+		SIZE_T SizeCb = ImageCodecGetSize(Compressed);
+		SIZE_T HeaderSizeCb = sizeof(COMPRESSED_IMAGE) + Compressed->StripeCount * sizeof(ULONGLONG);
+		BYTE *Blob = (BYTE *)malloc(SizeCb);
+		if (!CHECK(Blob != nullptr)) break;
+		BOOL Decoded;
+
+		// Truncated anywhere: the size no longer matches. With the size in the header patched to match, the stripes
+		// no longer fit.
+		for (SIZE_T Cut = 0; Cut < SizeCb; Cut += 1 + Cut / 8)
+		{
+			memcpy(Blob, Compressed, SizeCb);
+			CHECK(!ValidateAndDecode(Blob, Cut, &Decoded));
+			if (Cut >= sizeof(COMPRESSED_IMAGE))
+			{
+				((COMPRESSED_IMAGE *)Blob)->SizeCb = Cut;
+				CHECK(!ValidateAndDecode(Blob, Cut, &Decoded));
+			}
+		}
+
+		// Random bits flipped anywhere, in the header or the codes.
+		for (UINT Round = 0; Round < 40; ++Round)
+		{
+			memcpy(Blob, Compressed, SizeCb);
+			for (UINT Flips = 1 + TestRandom(&Random) % 6; Flips > 0; --Flips)
+			{
+				SIZE_T Offset = Round % 2 == 0 ? TestRandom(&Random) % HeaderSizeCb : TestRandom(&Random) % SizeCb;
+				Blob[Offset] ^= (BYTE)(1 << TestRandom(&Random) % 8);
+			}
+			ValidateAndDecode(Blob, SizeCb, &Decoded);
+		}
+
+		// Garbage in the codes leaves the header valid; decoding either fails or produces some image of the right size.
+		if (SizeCb > HeaderSizeCb)
+		{
+			for (UINT Round = 0; Round < 20; ++Round)
+			{
+				memcpy(Blob, Compressed, SizeCb);
+				for (UINT Bytes = 1 + TestRandom(&Random) % 8; Bytes > 0; --Bytes)
+				{
+					Blob[HeaderSizeCb + TestRandom(&Random) % (SizeCb - HeaderSizeCb)] = (BYTE)TestRandom(&Random);
+				}
+				CHECK(ValidateAndDecode(Blob, SizeCb, &Decoded));
+			}
+		}
+
+		// Codes that end in the middle of an operation: each of the last bytes of the last stripe, which ends the blob,
+		// made the start of an operation that takes more bytes than are left.
+		static const BYTE LongCodes[] = { 0xFF, 0xFE, 0x80 };
+		for (SIZE_T Back = 1; Back <= 5 && Back <= SizeCb - HeaderSizeCb; ++Back)
+		{
+			for (UINT c = 0; c < sizeof(LongCodes); ++c)
+			{
+				memcpy(Blob, Compressed, SizeCb);
+				Blob[SizeCb - Back] = LongCodes[c];
+				CHECK(ValidateAndDecode(Blob, SizeCb, &Decoded));
+			}
+		}
+
+		// Sizes that are not positive, that do not match the stripes, or that claim far more pixels than the codes can
+		// hold. A width that is merely too large may pass, but cannot decode beyond the image.
+		static const LONG Widths[] = { 0, -1, 1000 };
+		for (UINT w = 0; w < sizeof(Widths) / sizeof(Widths[0]); ++w)
+		{
+			memcpy(Blob, Compressed, SizeCb);
+			((COMPRESSED_IMAGE *)Blob)->Width = Width * Widths[w];
+			CHECK(!ValidateAndDecode(Blob, SizeCb, &Decoded));
+		}
+		memcpy(Blob, Compressed, SizeCb);
+		((COMPRESSED_IMAGE *)Blob)->Width = Width * 2;
+		ValidateAndDecode(Blob, SizeCb, &Decoded);
+		memcpy(Blob, Compressed, SizeCb);
+		((COMPRESSED_IMAGE *)Blob)->Height = Height + IMAGE_CODEC_STRIPE_ROWS;
+		CHECK(!ValidateAndDecode(Blob, SizeCb, &Decoded));
+		memcpy(Blob, Compressed, SizeCb);
+		((COMPRESSED_IMAGE *)Blob)->StripeRows = 0;
+		CHECK(!ValidateAndDecode(Blob, SizeCb, &Decoded));
+		memcpy(Blob, Compressed, SizeCb);
+		((COMPRESSED_IMAGE *)Blob)->StripeCount += 1;
+		CHECK(!ValidateAndDecode(Blob, SizeCb, &Decoded));
+		memcpy(Blob, Compressed, SizeCb);
+		((COMPRESSED_IMAGE *)Blob)->Magic ^= 1;
+		CHECK(!ValidateAndDecode(Blob, SizeCb, &Decoded));
+		if (Compressed->StripeCount > 1)
+		{
+			// Stripes that overlap, or end beyond the codes.
+			memcpy(Blob, Compressed, SizeCb);
+			ULONGLONG *StripeEnds = (ULONGLONG *)(Blob + sizeof(COMPRESSED_IMAGE));
+			StripeEnds[0] = StripeEnds[1] + 1;
+			CHECK(!ValidateAndDecode(Blob, SizeCb, &Decoded));
+			memcpy(Blob, Compressed, SizeCb);
+			StripeEnds[Compressed->StripeCount - 1] = SizeCb;
+			CHECK(!ValidateAndDecode(Blob, SizeCb, &Decoded));
+		}
+
+		// The untouched blob still decodes.
+		memcpy(Blob, Compressed, SizeCb);
+		CHECK(ValidateAndDecode(Blob, SizeCb, &Decoded) && Decoded);
+		free(Blob);
+		free(Compressed);
+		PixelBufferRelease(Image);
+	}
+	TestSetContext("");
+}
@@ -0,0 +1,185 @@
+// Compares every level of the mip pyramid, and images resampled from it, with the formulas: the rounded average of
+// each 2x2 block, and bilinear interpolation rounded once per direction. Built with and without -DPORTABLE_NO_SIMD,
+// this checks the SIMD and the scalar kernels against the same reference.
+
+#include "Test.h"
+#include "MipPyramid.h"
+#include "PixelBuffer.h"
+#include <math.h>
+#include <stdlib.h>
+
+static const LONG ImageSizes[] = { 1, 2, 3, 4, 5, 7, 8, 9, 16, 33 };
+static const double Scales[] = { 0.99, 0.75, 0.5, 0.34, 0.2, 0.05 };
+
+
+static PIXEL_BUFFER *CreateRandomImage(LONG Width, LONG Height, DWORD *Random)
+{
+	PIXEL_BUFFER *Image = PixelBufferCreate(Width, Height);
+	if (Image == nullptr) return nullptr;
+	for (SIZE_T i = 0; i < Image->SizeCb; ++i)
+	{
+		// Mostly random, with runs of the extremes so that the sums reach the largest values.
+		DWORD Value = TestRandom(Random);
+		Image->Pixels[i] = (Value & 0x300) == 0 ? (BYTE)((Value >> 10) & 1 ? 255 : 0) : (BYTE)Value;
+	}
+	return Image;
+}
+
+
+static const BYTE *GetPixel(const PIXEL_BUFFER *Image, LONG x, LONG y)
+{
+	return Image->Pixels + (SIZE_T)y * Image->Stride + (SIZE_T)x * 4;
+}
+
+
+// The last column or row of an odd sized level is averaged with itself.
+static BOOL CheckLevel(const PIXEL_BUFFER *Source, const PIXEL_BUFFER *Level)
+{
+	if (!CHECK(Level->Width == (Source->Width + 1) / 2 && Level->Height == (Source->Height + 1) / 2)) return false;
+	for (LONG y = 0; y < Level->Height; ++y)
+	{
+		LONG y0 = 2 * y;
+		LONG y1 = 2 * y + 1 < Source->Height ? 2 * y + 1 : 2 * y;
+		for (LONG x = 0; x < Level->Width; ++x)
+		{
+			LONG x0 = 2 * x;
+			LONG x1 = 2 * x + 1 < Source->Width ? 2 * x + 1 : 2 * x;
+			for (int Channel = 0; Channel < 4; ++Channel)
+			{
+				DWORD Sum = GetPixel(Source, x0, y0)[Channel] + GetPixel(Source, x1, y0)[Channel] + GetPixel(Source, x0, y1)[Channel] + GetPixel(Source, x1, y1)[Channel];
+				if (!CHECK(GetPixel(Level, x, y)[Channel] == (Sum + 2) / 4)) return false;
+			}
+		}
+	}
+	return true;
+}
+
+
+// Every width up to 19 leaves every number of pairs after the last group of four, at even and odd heights, down to the
+// single pixel.
+void TestMipPyramidDownsample()
+{
+	DWORD Random = 1;
+	static const LONG Heights[] = { 1, 2, 3, 4, 5, 17 };
+	for (LONG Width = 1; Width <= 19; ++Width)
+	{
+		for (UINT h = 0; h < sizeof(Heights) / sizeof(Heights[0]); ++h)
+		{
+			LONG Height = Heights[h];
+			PIXEL_BUFFER *Image = CreateRandomImage(Width, Height, &Random);
+			if (!CHECK(Image != nullptr)) return;
+			UINT LevelCount = 1;
+			const PIXEL_BUFFER *Source = Image;
+			for (;;)
+			{
+				TestSetContext("%d x %d, level %u", Width, Height, LevelCount);
+				PIXEL_BUFFER *Level = MipPyramidAddLevel((PIXEL_BUFFER *)Source);
+				if (Level == nullptr) break;
+				if (!CheckLevel(Source, Level)) break;
+				Source = Level;
+				++LevelCount;
+			}
+			CHECK(Source->Width == 1 && Source->Height == 1);
+			UINT ExpectedCount = 1;
+			for (LONG Size = Width > Height ? Width : Height; Size > 1; Size = (Size + 1) / 2) ++ExpectedCount;
+			CHECK(LevelCount == ExpectedCount);
+			PixelBufferRelease(Image);
+		}
+	}
+}
+
+
+// Where the center of screen pixel i falls in the level, in 1/256 pixels, clamped to the level so that Index and
+// Index + 1 are both pixels of it (unless it is a single pixel wide).
+static void ReferencePosition(LONGLONG i, double Ratio, LONG LevelSize, LONG *Index, UINT *Weight)
+{
+	LONGLONG Fixed = (LONGLONG)floor((((double)i + 0.5) * Ratio - 0.5) * 256);
+	if (Fixed < 0) Fixed = 0;
+	if (LevelSize < 2)
+	{
+		*Index = 0;
+		*Weight = 0;
+	}
+	else if (Fixed >= (LONGLONG)(LevelSize - 1) * 256)
+	{
+		*Index = LevelSize - 2;
+		*Weight = 256;
+	}
+	else
+	{
+		*Index = (LONG)(Fixed >> 8);
+		*Weight = (UINT)(Fixed & 255);
+	}
+}
+
+
+static UINT Lerp(UINT a, UINT b, UINT Weight)
+{
+	return (a * (256 - Weight) + b * Weight + 128) >> 8;
+}
+
+
+// Every scale below 1, from every level, at widths that end on the last column of a level and beyond it.
+void TestMipPyramidResample()
+{
+	DWORD Random = 7;
+	const UINT SizeCount = sizeof(ImageSizes) / sizeof(ImageSizes[0]);
+	for (UINT w = 0; w < SizeCount; ++w)
+	{
+		for (UINT h = 0; h < SizeCount; ++h)
+		{
+			PIXEL_BUFFER *Image = CreateRandomImage(ImageSizes[w], ImageSizes[h], &Random);
+			if (!CHECK(Image != nullptr)) return;
+			for (PIXEL_BUFFER *Level = Image; Level != nullptr; Level = MipPyramidAddLevel(Level))
+			{
+			}
+
+			for (UINT s = 0; s < sizeof(Scales) / sizeof(Scales[0]); ++s)
+			{
+				double Scale = Scales[s];
+				const PIXEL_BUFFER *Level = MipPyramidSelectLevel(Image, Scale);
+				double RatioX = (double)Level->Width / ((double)Image->Width * Scale);
+				double RatioY = (double)Level->Height / ((double)Image->Height * Scale);
+				for (LONGLONG Offset = 0; Offset <= 3; Offset += 3)
+				{
+					TestSetContext("%d x %d at %g from (%lld, %lld)", Image->Width, Image->Height, Scale, Offset, Offset);
+					LONG Width = (LONG)ceil(Image->Width * Scale) + 2;
+					LONG Height = (LONG)ceil(Image->Height * Scale) + 2;
+					SIZE_T Stride = (SIZE_T)Width * 4 + 4;
+					BYTE *Pixels = (BYTE *)malloc(Stride * Height);
+					if (!CHECK(Pixels != nullptr))
+					{
+						PixelBufferRelease(Image);
+						return;
+					}
+					MipResample(Image, Scale, Offset, Offset, Width, Height, Pixels, Stride);
+
+					BOOL Same = true;
+					for (LONG y = 0; y < Height && Same; ++y)
+					{
+						LONG Row;
+						UINT WeightY;
+						ReferencePosition(Offset + y, RatioY, Level->Height, &Row, &WeightY);
+						LONG NextRow = Row + 1 < Level->Height ? Row + 1 : Row;
+						for (LONG x = 0; x < Width && Same; ++x)
+						{
+							LONG Column;
+							UINT WeightX;
+							ReferencePosition(Offset + x, RatioX, Level->Width, &Column, &WeightX);
+							LONG NextColumn = Column + 1 < Level->Width ? Column + 1 : Column;
+							for (int Channel = 0; Channel < 4; ++Channel)
+							{
+								UINT Left = Lerp(GetPixel(Level, Column, Row)[Channel], GetPixel(Level, Column, NextRow)[Channel], WeightY);
+								UINT Right = Lerp(GetPixel(Level, NextColumn, Row)[Channel], GetPixel(Level, NextColumn, NextRow)[Channel], WeightY);
+								Same &= Pixels[(SIZE_T)y * Stride + (SIZE_T)x * 4 + Channel] == Lerp(Left, Right, WeightX);
+							}
+						}
+					}
+					CHECK(Same);
+					free(Pixels);
+				}
+			}
+			PixelBufferRelease(Image);
+		}
+	}
+}
@@ -0,0 +1,682 @@
+// Compares DecodePackedDIB with a reference decoder that reads every pixel on its own, the slow and obvious way, over
+// DIBs with random pixels in every uncompressed layout, the same DIBs with OS/2 headers, and random RLE streams. Also
+// checks that bitmaps whose pixels could not possibly be in their data are refused.
+
+#include "Test.h"
+#include "PackedDIB.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Widths from 1 up to this, so that every SIMD kernel sees every tail length.
+#define MAX_TEST_WIDTH 37
+#define TEST_HEIGHT 5
+#define RLE_TEST_COUNT 4000
+#define MAX_RLE_TEST_WIDTH 40
+#define MAX_RLE_TEST_HEIGHT 20
+
+struct DIB_LAYOUT
+{
+	const char *Name;
+	WORD BitCount;
+	DWORD Compression;
+	DWORD HeaderSize;      // 40, or 108 and 124 for V4 and V5 headers, which hold the masks themselves.
+	DWORD Masks[4];        // Red, green, blue, alpha; written for BI_BITFIELDS and BI_ALPHABITFIELDS.
+	DWORD ClrUsed;
+};
+
+static const DIB_LAYOUT Layouts[] =
+{
+	{ "1bpp",                    1, BI_RGB, 40, {}, 0 },
+	{ "1bpp-1-color",            1, BI_RGB, 40, {}, 1 },
+	{ "4bpp",                    4, BI_RGB, 40, {}, 0 },
+	{ "4bpp-5-colors",           4, BI_RGB, 40, {}, 5 },
+	{ "8bpp",                    8, BI_RGB, 40, {}, 0 },
+	{ "8bpp-16-colors",          8, BI_RGB, 40, {}, 16 },
+	{ "16bpp-555",               16, BI_RGB, 40, {}, 0 },
+	{ "16bpp-565",               16, BI_BITFIELDS, 40, { 0xF800, 0x07E0, 0x001F }, 0 },
+	{ "16bpp-444",               16, BI_BITFIELDS, 40, { 0x0F00, 0x00F0, 0x000F }, 0 },
+	{ "16bpp-4444-alpha",        16, BI_ALPHABITFIELDS, 40, { 0x0F00, 0x00F0, 0x000F, 0xF000 }, 0 },
+	{ "16bpp-1555-v5",           16, BI_BITFIELDS, 124, { 0x7C00, 0x03E0, 0x001F, 0x8000 }, 0 },
+	{ "24bpp",                   24, BI_RGB, 40, {}, 0 },
+	{ "32bpp",                   32, BI_RGB, 40, {}, 0 },
+	{ "32bpp-v5-rgb",            32, BI_RGB, 124, { 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000 }, 0 },
+	{ "32bpp-bitfields",         32, BI_BITFIELDS, 40, { 0x00FF0000, 0x0000FF00, 0x000000FF }, 0 },
+	{ "32bpp-bitfields-rgbx",    32, BI_BITFIELDS, 40, { 0x000000FF, 0x0000FF00, 0x00FF0000 }, 0 },
+	{ "32bpp-bitfields-10bit",   32, BI_BITFIELDS, 40, { 0x3FF00000, 0x000FFC00, 0x000003FF }, 0 },
+	{ "32bpp-alphabitfields",    32, BI_ALPHABITFIELDS, 40, { 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000 }, 0 },
+	{ "32bpp-alphabitfields-2",  32, BI_ALPHABITFIELDS, 40, { 0x3FF00000, 0x000FFC00, 0x000003FF, 0xC0000000 }, 0 },
+	{ "32bpp-v4-bitfields",      32, BI_BITFIELDS, 108, { 0x00FF0000, 0x0000FF00, 0x000000FF }, 0 },
+	{ "32bpp-v5-alpha",          32, BI_BITFIELDS, 124, { 0x00FF0000, 0x0000FF00, 0x000000FF, 0xFF000000 }, 0 },
+	{ "4bpp-v4",                 4, BI_RGB, 108, {}, 0 },
+	{ "8bpp-v5",                 8, BI_RGB, 124, {}, 0 },
+	{ "8bpp-v5-7-colors",        8, BI_RGB, 124, {}, 7 },
+	{ "24bpp-v5",                24, BI_RGB, 124, {}, 0 },
+};
+
+
+static void WriteDword(BYTE *p, DWORD Value)
+{
+	memcpy(p, &Value, sizeof(Value));
+}
+
+static DWORD ReadDword(const BYTE *p)
+{
+	DWORD Value;
+	memcpy(&Value, p, sizeof(Value));
+	return Value;
+}
+
+
+// A DIB in Layout, with random pixels and a random color table. Height is negative for a top-down DIB.
+static BYTE *BuildDib(const DIB_LAYOUT *Layout, LONG Width, LONG Height, DWORD Seed, SIZE_T *SizeCb)
+{
+	DWORD MaskCount = 0;
+	if (Layout->HeaderSize == 40 && Layout->Compression == BI_BITFIELDS) MaskCount = 3;
+	if (Layout->HeaderSize == 40 && Layout->Compression == BI_ALPHABITFIELDS) MaskCount = 4;
+	DWORD Colors = Layout->BitCount > 8 ? 0 : Layout->ClrUsed != 0 ? Layout->ClrUsed : 1u << Layout->BitCount;
+	LONG Rows = Height < 0 ? -Height : Height;
+	SIZE_T Stride = (((SIZE_T)Width * Layout->BitCount + 31) / 32) * 4;
+	SIZE_T PixelOffset = Layout->HeaderSize + MaskCount * 4 + Colors * 4;
+	*SizeCb = PixelOffset + Stride * Rows;
+	BYTE *Data = (BYTE *)calloc(1, *SizeCb);
+
+	BITMAPINFOHEADER Header = {};
+	Header.biSize = Layout->HeaderSize;
+	Header.biWidth = Width;
+	Header.biHeight = Height;
+	Header.biPlanes = 1;
+	Header.biBitCount = Layout->BitCount;
+	Header.biCompression = Layout->Compression;
+	Header.biClrUsed = Layout->ClrUsed;
+	memcpy(Data, &Header, sizeof(Header));
+	for (DWORD i = 0; i < 4 && Layout->HeaderSize > 40; ++i)
+	{
+		WriteDword(Data + 40 + i * 4, Layout->Masks[i]);
+	}
+	for (DWORD i = 0; i < MaskCount; ++i)
+	{
+		WriteDword(Data + 40 + i * 4, Layout->Masks[i]);
+	}
+	DWORD Random = Seed;
+	for (SIZE_T i = Layout->HeaderSize + MaskCount * 4; i < *SizeCb; ++i)
+	{
+		Data[i] = (BYTE)TestRandom(&Random);
+	}
+	return Data;
+}
+
+
+static DWORD ReferenceChannel(DWORD Pixel, DWORD Mask, DWORD ValueIfMissing)
+{
+	if (Mask == 0) return ValueIfMissing;
+	int Shift = 0;
+	while (((Mask >> Shift) & 1) == 0) ++Shift;
+	int Bits = 0;
+	while (Shift + Bits < 32 && ((Mask >> (Shift + Bits)) & 1) != 0) ++Bits;
+	DWORD Value = (Pixel & Mask) >> Shift;
+	if (Bits > 8) return Value >> (Bits - 8);
+	DWORD Max = (1u << Bits) - 1;
+	return (Value * 255 + Max / 2) / Max;
+}
+
+
+// The pixel at (x, y), counted from the top left, as BGRA, read straight from the packed DIB's bytes.
+static DWORD ReferencePixel(const BYTE *Dib, LONG x, LONG y)
+{
+	BITMAPINFOHEADER Header;
+	memcpy(&Header, Dib, sizeof(Header));
+	LONG Height = Header.biHeight < 0 ? -Header.biHeight : Header.biHeight;
+	DWORD Masks[4] = { 0x00FF0000, 0x0000FF00, 0x000000FF, 0 };
+	if (Header.biBitCount == 16)
+	{
+		Masks[0] = 0x7C00;
+		Masks[1] = 0x03E0;
+		Masks[2] = 0x001F;
+	}
+	DWORD MaskCount = 0;
+	if (Header.biCompression == BI_BITFIELDS || Header.biCompression == BI_ALPHABITFIELDS)
+	{
+		MaskCount = Header.biCompression == BI_ALPHABITFIELDS || Header.biSize >= 56 ? 4 : 3;
+		for (DWORD i = 0; i < MaskCount; ++i)
+		{
+			Masks[i] = ReadDword(Dib + 40 + i * 4);
+		}
+	}
+	DWORD Colors = Header.biBitCount > 8 ? 0 : Header.biClrUsed != 0 ? Header.biClrUsed : 1u << Header.biBitCount;
+	const BYTE *ColorTable = Dib + Header.biSize + (Header.biSize == 40 ? MaskCount * 4 : 0);
+	const BYTE *Pixels = ColorTable + Colors * 4;
+	SIZE_T Stride = (((SIZE_T)Header.biWidth * Header.biBitCount + 31) / 32) * 4;
+	const BYTE *Row = Pixels + Stride * (Header.biHeight < 0 ? y : Height - 1 - y);
+
+	SIZE_T Bit = (SIZE_T)x * Header.biBitCount;
+	DWORD Value = 0;
+	for (UINT i = 0; i < (Header.biBitCount + 7u) / 8; ++i)
+	{
+		Value |= (DWORD)Row[Bit / 8 + i] << (8 * i);
+	}
+	if (Header.biBitCount < 8)
+	{
+		Value = (Value >> (8 - Header.biBitCount - Bit % 8)) & ((1u << Header.biBitCount) - 1);
+	}
+
+	if (Header.biBitCount <= 8)
+	{
+		if (Value >= Colors) return 0xFF000000;
+		const BYTE *q = ColorTable + Value * 4;
+		return 0xFF000000 | (DWORD)q[2] << 16 | (DWORD)q[1] << 8 | q[0];
+	}
+	if (Header.biBitCount == 24)
+	{
+		return 0xFF000000 | Value;
+	}
+	return ReferenceChannel(Value, Masks[2], 0) | ReferenceChannel(Value, Masks[1], 0) << 8 | ReferenceChannel(Value, Masks[0], 0) << 16 | ReferenceChannel(Value, Masks[3], 0xFF) << 24;
+}
+
+
+// The common 16 bpp layouts widen their 5 and 6 bit channels by repeating the high bits, which is within 1 of the
+// rounded value that the reference computes.
+static BOOL IsClose(DWORD Pixel, DWORD Expected, DWORD Tolerance)
+{
+	for (int Shift = 0; Shift < 32; Shift += 8)
+	{
+		int Difference = (int)((Pixel >> Shift) & 0xFF) - (int)((Expected >> Shift) & 0xFF);
+		if (Difference > (int)Tolerance || Difference < -(int)Tolerance) return false;
+	}
+	return true;
+}
+
+
+static DWORD GetTolerance(const DIB_LAYOUT *Layout)
+{
+	return Layout->BitCount == 16 && Layout->Masks[3] == 0 ? 1 : 0;
+}
+
+
+void TestPackedDIBReference()
+{
+	for (UINT l = 0; l < sizeof(Layouts) / sizeof(Layouts[0]); ++l)
+	{
+		const DIB_LAYOUT *Layout = &Layouts[l];
+		for (LONG Width = 1; Width <= MAX_TEST_WIDTH; ++Width)
+		{
+			for (int TopDown = 0; TopDown < 2; ++TopDown)
+			{
+				TestSetContext("%s, %d pixels wide%s", Layout->Name, (int)Width, TopDown ? ", top-down" : "");
+				SIZE_T SizeCb;
+				BYTE *Dib = BuildDib(Layout, Width, TopDown ? -TEST_HEIGHT : TEST_HEIGHT, l * 1000 + Width * 2 + TopDown + 1, &SizeCb);
+				PACKED_DIB_INFO Info;
+				if (!CHECK(GetPackedDIBInfo((const BITMAPINFOHEADER *)Dib, SizeCb, &Info)))
+				{
+					free(Dib);
+					continue;
+				}
+				CHECK(Info.Width == Width && Info.Height == TEST_HEIGHT && Info.TopDown == (BOOL)TopDown);
+				CHECK(Info.HasAlpha == (Layout->Masks[3] != 0 && Layout->Compression != BI_RGB));
+				CHECK(Info.Pixels + Info.Stride * TEST_HEIGHT == Dib + SizeCb);
+				CHECK(GetPixelDataOffsetForPackedDIB((const BITMAPINFOHEADER *)Dib) == (INT)(Info.Pixels - Dib));
+
+				DWORD Pixels[MAX_TEST_WIDTH * TEST_HEIGHT];
+				DecodePackedDIB(&Info, (BYTE *)Pixels, Width * 4);
+				for (LONG y = 0; y < TEST_HEIGHT; ++y)
+				{
+					for (LONG x = 0; x < Width; ++x)
+					{
+						if (!CHECK(IsClose(Pixels[y * Width + x], ReferencePixel(Dib, x, y), GetTolerance(Layout))))
+						{
+							y = TEST_HEIGHT;
+							break;
+						}
+					}
+				}
+				free(Dib);
+			}
+		}
+	}
+}
+
+
+// Any range of rows decodes to the same pixels as the whole image, into a destination with a larger stride.
+void TestPackedDIBRows()
+{
+	const LONG Width = 19;
+	const LONG Height = 11;
+	for (UINT l = 0; l < sizeof(Layouts) / sizeof(Layouts[0]); ++l)
+	{
+		for (int TopDown = 0; TopDown < 2; ++TopDown)
+		{
+			TestSetContext("%s%s", Layouts[l].Name, TopDown ? ", top-down" : "");
+			SIZE_T SizeCb;
+			BYTE *Dib = BuildDib(&Layouts[l], Width, TopDown ? -Height : Height, l + 7, &SizeCb);
+			PACKED_DIB_INFO Info;
+			if (!CHECK(GetPackedDIBInfo((const BITMAPINFOHEADER *)Dib, SizeCb, &Info)))
+			{
+				free(Dib);
+				continue;
+			}
+			DWORD Whole[Width * Height];
+			DecodePackedDIB(&Info, (BYTE *)Whole, Width * 4);
+			const LONG Stride = Width + 3;
+			DWORD Part[Stride * Height];
+			for (LONG FirstRow = 0; FirstRow < Height; FirstRow += 3)
+			{
+				for (LONG RowCount = 1; FirstRow + RowCount <= Height; RowCount += 4)
+				{
+					memset(Part, 0xCD, sizeof(Part));
+					DecodePackedDIBRows(&Info, FirstRow, RowCount, (BYTE *)Part, Stride * 4);
+					BOOL Same = true;
+					for (LONG y = 0; y < RowCount; ++y)
+					{
+						Same = Same && memcmp(Part + y * Stride, Whole + (FirstRow + y) * Width, Width * 4) == 0;
+						// The padding between the rows is left alone.
+						Same = Same && Part[y * Stride + Width] == 0xCDCDCDCD;
+					}
+					CHECK(Same);
+				}
+			}
+			free(Dib);
+		}
+	}
+}
+
+
+// Rows that are cut off decode as opaque black; the rows before them are intact.
+void TestPackedDIBTruncated()
+{
+	const LONG Width = 13;
+	const LONG Height = 6;
+	for (UINT l = 0; l < sizeof(Layouts) / sizeof(Layouts[0]); ++l)
+	{
+		for (int TopDown = 0; TopDown < 2; ++TopDown)
+		{
+			TestSetContext("%s%s", Layouts[l].Name, TopDown ? ", top-down" : "");
+			SIZE_T SizeCb;
+			BYTE *Dib = BuildDib(&Layouts[l], Width, TopDown ? -Height : Height, l + 11, &SizeCb);
+			SIZE_T PixelOffset = (SIZE_T)GetPixelDataOffsetForPackedDIB((const BITMAPINFOHEADER *)Dib);
+			SIZE_T Stride = (SizeCb - PixelOffset) / Height;
+			// Two rows are there, and all but the last byte of the pixels of the third.
+			SIZE_T CutSizeCb = PixelOffset + Stride * 2 + ((SIZE_T)Width * Layouts[l].BitCount + 7) / 8 - 1;
+			PACKED_DIB_INFO Info;
+			if (!CHECK(GetPackedDIBInfo((const BITMAPINFOHEADER *)Dib, CutSizeCb, &Info)))
+			{
+				free(Dib);
+				continue;
+			}
+			DWORD Pixels[Width * Height];
+			DecodePackedDIB(&Info, (BYTE *)Pixels, Width * 4);
+			for (LONG y = 0; y < Height; ++y)
+			{
+				// The rows that are stored first are at the bottom of a bottom-up DIB.
+				BOOL Present = TopDown ? y < 2 : y >= Height - 2;
+				for (LONG x = 0; x < Width; ++x)
+				{
+					DWORD Expected = Present ? ReferencePixel(Dib, x, y) : 0xFF000000;
+					if (!CHECK(IsClose(Pixels[y * Width + x], Expected, GetTolerance(&Layouts[l])))) break;
+				}
+			}
+			free(Dib);
+		}
+	}
+}
+
+
+// Heights in the range of a LONG: negative means top-down, and INT_MIN, which has no positive counterpart, is invalid.
+// Heights far beyond the data are refused; a truncated DIB of up to a million pixels is still decoded.
+void TestPackedDIBHeight()
+{
+	SIZE_T SizeCb;
+	BYTE *Dib = BuildDib(&Layouts[12], 4, 4, 1, &SizeCb);
+	BITMAPINFOHEADER *Header = (BITMAPINFOHEADER *)Dib;
+	PACKED_DIB_INFO Info;
+
+	Header->biHeight = (LONG)0x80000000;
+	CHECK(!GetPackedDIBInfo(Header, SizeCb, &Info));
+	Header->biHeight = -0x7FFFFFFF;
+	CHECK(!GetPackedDIBInfo(Header, SizeCb, &Info));
+	Header->biHeight = 0x7FFFFFFF;
+	CHECK(!GetPackedDIBInfo(Header, SizeCb, &Info));
+	Header->biHeight = 0;
+	CHECK(!GetPackedDIBInfo(Header, SizeCb, &Info));
+	Header->biHeight = -4;
+	CHECK(GetPackedDIBInfo(Header, SizeCb, &Info) && Info.TopDown && Info.Height == 4);
+	Header->biHeight = -1024 * 1024 / 4;
+	CHECK(GetPackedDIBInfo(Header, SizeCb, &Info) && Info.TopDown && Info.Height == 1024 * 1024 / 4);
+	Header->biHeight = 1024 * 1024 / 4 + 1;
+	CHECK(!GetPackedDIBInfo(Header, SizeCb, &Info));
+	free(Dib);
+}
+
+
+// The same DIB with a BITMAPCOREHEADER (OS/2 1.x) or an OS/2 2.x header of HeaderSize bytes instead of its
+// BITMAPINFOHEADER. Dib must be BI_RGB, and a core header needs a full color table.
+static BYTE *ConvertToOs2(const BYTE *Dib, SIZE_T SizeCb, DWORD HeaderSize, SIZE_T *Os2SizeCb)
+{
+	BITMAPINFOHEADER Header;
+	memcpy(&Header, Dib, sizeof(Header));
+	DWORD Colors = Header.biBitCount > 8 ? 0 : Header.biClrUsed != 0 ? Header.biClrUsed : 1u << Header.biBitCount;
+	DWORD EntrySize = HeaderSize == sizeof(BITMAPCOREHEADER) ? 3 : 4;
+	SIZE_T PixelOffset = sizeof(BITMAPINFOHEADER) + Colors * 4;
+	*Os2SizeCb = HeaderSize + Colors * EntrySize + (SizeCb - PixelOffset);
+	BYTE *Os2 = (BYTE *)malloc(*Os2SizeCb);
+
+	if (HeaderSize == sizeof(BITMAPCOREHEADER))
+	{
+		BITMAPCOREHEADER Core = {};
+		Core.bcSize = HeaderSize;
+		Core.bcWidth = (WORD)Header.biWidth;
+		Core.bcHeight = (WORD)Header.biHeight;
+		Core.bcPlanes = 1;
+		Core.bcBitCount = Header.biBitCount;
+		memcpy(Os2, &Core, sizeof(Core));
+	}
+	else
+	{
+		// The OS/2 fields after the first 40 bytes (units, halftoning, ...) do not matter.
+		DWORD Random = HeaderSize;
+		for (DWORD i = 0; i < HeaderSize; ++i)
+		{
+			Os2[i] = i < sizeof(BITMAPINFOHEADER) ? Dib[i] : (BYTE)TestRandom(&Random);
+		}
+		WriteDword(Os2, HeaderSize);
+	}
+	for (DWORD i = 0; i < Colors; ++i)
+	{
+		memcpy(Os2 + HeaderSize + i * EntrySize, Dib + sizeof(BITMAPINFOHEADER) + i * 4, EntrySize);
+	}
+	memcpy(Os2 + HeaderSize + Colors * EntrySize, Dib + PixelOffset, SizeCb - PixelOffset);
+	return Os2;
+}
+
+
+// DIBs with OS/2 headers decode to the same pixels as with a BITMAPINFOHEADER.
+void TestPackedDIBOs2()
+{
+	static const DWORD HeaderSizes[] = { sizeof(BITMAPCOREHEADER), 16, 20, 24, 36, 64 };
+	const LONG Width = 21;
+	for (UINT l = 0; l < sizeof(Layouts) / sizeof(Layouts[0]); ++l)
+	{
+		const DIB_LAYOUT *Layout = &Layouts[l];
+		if (Layout->HeaderSize != sizeof(BITMAPINFOHEADER) || Layout->Compression != BI_RGB) continue;
+		for (UINT h = 0; h < sizeof(HeaderSizes) / sizeof(HeaderSizes[0]); ++h)
+		{
+			BOOL Core = HeaderSizes[h] == sizeof(BITMAPCOREHEADER);
+			// A core header has neither biClrUsed nor 16 and 32 bpp, and its height is unsigned.
+			if (Layout->ClrUsed != 0 && HeaderSizes[h] < 36) continue;
+			if (Core && (Layout->BitCount == 16 || Layout->BitCount == 32)) continue;
+			for (int TopDown = 0; TopDown < (Core ? 1 : 2); ++TopDown)
+			{
+				TestSetContext("%s, %u byte header%s", Layout->Name, HeaderSizes[h], TopDown ? ", top-down" : "");
+				SIZE_T SizeCb, Os2SizeCb;
+				BYTE *Dib = BuildDib(Layout, Width, TopDown ? -TEST_HEIGHT : TEST_HEIGHT, l * 100 + h * 2 + TopDown + 1, &SizeCb);
+				BYTE *Os2 = ConvertToOs2(Dib, SizeCb, HeaderSizes[h], &Os2SizeCb);
+				PACKED_DIB_INFO Info;
+				if (CHECK(GetPackedDIBInfo((const BITMAPINFOHEADER *)Os2, Os2SizeCb, &Info)))
+				{
+					CHECK(Info.Width == Width && Info.Height == TEST_HEIGHT && Info.TopDown == (BOOL)TopDown && !Info.HasAlpha);
+					CHECK(Layout->BitCount > 8 || Info.ColorTableEntrySize == (Core ? 3u : 4u));
+					CHECK(Info.Pixels + Info.Stride * TEST_HEIGHT == Os2 + Os2SizeCb);
+					DWORD Pixels[Width * TEST_HEIGHT];
+					DecodePackedDIB(&Info, (BYTE *)Pixels, Width * 4);
+					BOOL Same = true;
+					for (LONG i = 0; i < Width * TEST_HEIGHT; ++i)
+					{
+						Same = Same && IsClose(Pixels[i], ReferencePixel(Dib, i % Width, i / Width), GetTolerance(Layout));
+					}
+					CHECK(Same);
+				}
+				free(Os2);
+				free(Dib);
+			}
+		}
+	}
+}
+
+
+static void PutRlePixel(DWORD *Pixels, LONG Width, LONG Height, LONG *x, LONG Row, DWORD Index, const BYTE *ColorTable, DWORD Colors)
+{
+	if (*x >= Width) return;
+	const BYTE *q = ColorTable + Index * 4;
+	Pixels[(SIZE_T)(Height - 1 - Row) * Width + *x] = Index < Colors ? 0xFF000000 | (DWORD)q[2] << 16 | (DWORD)q[1] << 8 | q[0] : 0xFF000000;
+	++*x;
+}
+
+
+// Decodes an RLE4 or RLE8 DIB command by command. Everything that is not drawn is transparent.
+static void DecodeRleReference(const BYTE *Dib, SIZE_T SizeCb, DWORD *Pixels)
+{
+	BITMAPINFOHEADER Header;
+	memcpy(&Header, Dib, sizeof(Header));
+	LONG Width = Header.biWidth;
+	LONG Height = Header.biHeight;
+	BOOL Rle4 = Header.biCompression == BI_RLE4;
+	DWORD Colors = Header.biClrUsed != 0 ? Header.biClrUsed : 1u << Header.biBitCount;
+	const BYTE *ColorTable = Dib + Header.biSize;
+	const BYTE *p = ColorTable + Colors * 4;
+	const BYTE *End = Dib + SizeCb;
+	memset(Pixels, 0, (SIZE_T)Width * Height * 4);
+
+	LONG x = 0;
+	LONG Row = 0;
+	while (Row < Height && End - p >= 2)
+	{
+		UINT Count = p[0];
+		UINT Value = p[1];
+		p += 2;
+		if (Count > 0)
+		{
+			for (UINT i = 0; i < Count; ++i)
+			{
+				PutRlePixel(Pixels, Width, Height, &x, Row, Rle4 ? (i % 2 == 0 ? Value >> 4 : Value & 15) : Value, ColorTable, Colors);
+			}
+		}
+		else if (Value == 0)
+		{
+			x = 0;
+			++Row;
+		}
+		else if (Value == 1)
+		{
+			break;
+		}
+		else if (Value == 2)
+		{
+			if (End - p < 2) break;
+			x = x + p[0] < Width ? x + p[0] : Width;
+			Row += p[1];
+			p += 2;
+		}
+		else
+		{
+			LONG Bytes = Rle4 ? (Value + 1) / 2 : Value;
+			if (End - p < Bytes) break;
+			for (UINT i = 0; i < Value; ++i)
+			{
+				PutRlePixel(Pixels, Width, Height, &x, Row, Rle4 ? (p[i / 2] >> (i % 2 == 0 ? 4 : 0)) & 15 : p[i], ColorTable, Colors);
+			}
+			LONG PaddedBytes = (Bytes + 1) & ~1;
+			p += PaddedBytes < End - p ? PaddedBytes : End - p;
+		}
+	}
+}
+
+
+// Runs, literal runs (some of them longer than a row), line ends, jumps and the odd end of bitmap, mixed with random
+// bytes. Returns the size of the stream.
+static SIZE_T GenerateRleStream(BYTE *Stream, SIZE_T Capacity, LONG Width, BOOL Rle4, DWORD *Random)
+{
+	SIZE_T SizeCb = 0;
+	SIZE_T Length = TestRandom(Random) % (Capacity - 300);
+	while (SizeCb < Length)
+	{
+		DWORD r = TestRandom(Random) % 16;
+		BYTE *p = Stream + SizeCb;
+		if (r < 6)
+		{
+			p[0] = (BYTE)(1 + TestRandom(Random) % (Width + 8));
+			p[1] = (BYTE)TestRandom(Random);
+			SizeCb += 2;
+		}
+		else if (r < 9)
+		{
+			UINT Count = 3 + TestRandom(Random) % (Width + 8);
+			UINT Bytes = Rle4 ? (Count + 1) / 2 : Count;
+			p[0] = 0;
+			p[1] = (BYTE)Count;
+			for (UINT i = 0; i < Bytes; ++i) p[2 + i] = (BYTE)TestRandom(Random);
+			SizeCb += 2 + ((Bytes + 1) & ~1u);
+		}
+		else if (r < 11 || (r == 12 && TestRandom(Random) % 8 != 0))
+		{
+			p[0] = 0;
+			p[1] = 0;
+			SizeCb += 2;
+		}
+		else if (r == 11)
+		{
+			p[0] = 0;
+			p[1] = 2;
+			p[2] = (BYTE)(TestRandom(Random) % (Width + 2));
+			p[3] = (BYTE)(TestRandom(Random) % 3);
+			SizeCb += 4;
+		}
+		else if (r == 12)
+		{
+			p[0] = 0;
+			p[1] = 1;
+			SizeCb += 2;
+		}
+		else
+		{
+			// Mostly zeros and small values, which are commands after a zero.
+			DWORD b = TestRandom(Random) % 10;
+			p[0] = b < 3 ? 0 : b < 5 ? (BYTE)(TestRandom(Random) % 3) : (BYTE)TestRandom(Random);
+			SizeCb += 1;
+		}
+	}
+	return SizeCb;
+}
+
+
+// Random RLE streams, valid or not, decode like the reference does, whole or any range of rows, without writing past
+// the rows asked for or leaving a pixel unwritten.
+void TestPackedDIBRle()
+{
+	static const DWORD HeaderSizes[] = { 40, 108, 124 };
+	const SIZE_T StreamCapacity = 1200;
+	DWORD Random = 1;
+	for (UINT t = 0; t < RLE_TEST_COUNT; ++t)
+	{
+		BOOL Rle4 = t % 2 != 0;
+		LONG Width = 1 + (LONG)(TestRandom(&Random) % MAX_RLE_TEST_WIDTH);
+		LONG Height = 1 + (LONG)(TestRandom(&Random) % MAX_RLE_TEST_HEIGHT);
+		DWORD HeaderSize = HeaderSizes[TestRandom(&Random) % 3];
+		DWORD ClrUsed = TestRandom(&Random) % 4 == 0 ? 1 + TestRandom(&Random) % (Rle4 ? 16 : 256) : 0;
+		DWORD Colors = ClrUsed != 0 ? ClrUsed : Rle4 ? 16 : 256;
+		BYTE *Dib = (BYTE *)calloc(1, HeaderSize + Colors * 4 + StreamCapacity);
+		BITMAPINFOHEADER Header = {};
+		Header.biSize = HeaderSize;
+		Header.biWidth = Width;
+		Header.biHeight = Height;
+		Header.biPlanes = 1;
+		Header.biBitCount = Rle4 ? 4 : 8;
+		Header.biCompression = Rle4 ? BI_RLE4 : BI_RLE8;
+		Header.biClrUsed = ClrUsed;
+		memcpy(Dib, &Header, sizeof(Header));
+		for (DWORD i = 0; i < Colors * 4; ++i) Dib[HeaderSize + i] = (BYTE)TestRandom(&Random);
+		SIZE_T SizeCb = HeaderSize + Colors * 4 + GenerateRleStream(Dib + HeaderSize + Colors * 4, StreamCapacity, Width, Rle4, &Random);
+		TestSetContext("RLE%d, %d x %d, %u byte header, %u colors, %u bytes", Rle4 ? 4 : 8, (int)Width, (int)Height, HeaderSize, Colors, (UINT)SizeCb);
+
+		PACKED_DIB_INFO Info;
+		if (!CHECK(GetPackedDIBInfo((const BITMAPINFOHEADER *)Dib, SizeCb, &Info)))
+		{
+			free(Dib);
+			continue;
+		}
+		CHECK(Info.HasAlpha && Info.Stride == 0 && Info.Pixels == Dib + HeaderSize + Colors * 4);
+		DWORD Expected[MAX_RLE_TEST_WIDTH * MAX_RLE_TEST_HEIGHT];
+		DecodeRleReference(Dib, SizeCb, Expected);
+		DWORD Pixels[MAX_RLE_TEST_WIDTH * MAX_RLE_TEST_HEIGHT + 1];
+		memset(Pixels, 0x5A, sizeof(Pixels));
+		DecodePackedDIB(&Info, (BYTE *)Pixels, Width * 4);
+		CHECK(memcmp(Pixels, Expected, (SIZE_T)Width * Height * 4) == 0 && Pixels[Width * Height] == 0x5A5A5A5A);
+
+		LONG FirstRow = (LONG)(TestRandom(&Random) % Height);
+		LONG RowCount = 1 + (LONG)(TestRandom(&Random) % (Height - FirstRow));
+		memset(Pixels, 0x5A, sizeof(Pixels));
+		DecodePackedDIBRows(&Info, FirstRow, RowCount, (BYTE *)Pixels, Width * 4);
+		CHECK(memcmp(Pixels, Expected + FirstRow * Width, (SIZE_T)Width * RowCount * 4) == 0 && Pixels[Width * RowCount] == 0x5A5A5A5A);
+		free(Dib);
+	}
+}
+
+
+// An RLE8 DIB with a 2 color palette, and StreamSizeCb bytes of zeros (line ends) for its stream.
+static BYTE *BuildRle8Dib(LONG Width, LONG Height, SIZE_T StreamSizeCb, SIZE_T *SizeCb)
+{
+	*SizeCb = sizeof(BITMAPINFOHEADER) + 2 * 4 + StreamSizeCb;
+	BYTE *Dib = (BYTE *)calloc(1, *SizeCb);
+	BITMAPINFOHEADER Header = {};
+	Header.biSize = sizeof(Header);
+	Header.biWidth = Width;
+	Header.biHeight = Height;
+	Header.biPlanes = 1;
+	Header.biBitCount = 8;
+	Header.biCompression = BI_RLE8;
+	Header.biClrUsed = 2;
+	memcpy(Dib, &Header, sizeof(Header));
+	WriteDword(Dib + sizeof(Header) + 4, 0x336699);
+	return Dib;
+}
+
+
+// A few bytes of RLE cannot make a bitmap of GBs: what could not be in the data is refused (and shown as a hex dump).
+void TestPackedDIBPixelLimit()
+{
+	PACKED_DIB_INFO Info;
+	SIZE_T SizeCb;
+
+	// A kilobyte that ends the bitmap right away, for 20000 x 20000 pixels (1.6 GB).
+	BYTE *Dib = BuildRle8Dib(20000, 20000, 1024, &SizeCb);
+	Dib[sizeof(BITMAPINFOHEADER) + 2 * 4 + 1] = 1;
+	CHECK(!GetPackedDIBInfo((const BITMAPINFOHEADER *)Dib, SizeCb, &Info));
+	free(Dib);
+
+	// Small bitmaps may skip everything, though.
+	Dib = BuildRle8Dib(1024, 1024, 2, &SizeCb);
+	Dib[sizeof(BITMAPINFOHEADER) + 2 * 4 + 1] = 1;
+	CHECK(GetPackedDIBInfo((const BITMAPINFOHEADER *)Dib, SizeCb, &Info));
+	BITMAPINFOHEADER *Header = (BITMAPINFOHEADER *)Dib;
+	Header->biWidth = 1025;
+	CHECK(!GetPackedDIBInfo(Header, SizeCb, &Info));
+	free(Dib);
+
+	// Even a flat image, in runs as long as they get, has enough data.
+	const LONG FlatSize = 2000;
+	Dib = BuildRle8Dib(FlatSize, FlatSize, FlatSize * 18, &SizeCb);
+	BYTE *p = Dib + sizeof(BITMAPINFOHEADER) + 2 * 4;
+	for (LONG y = 0; y < FlatSize; ++y, p += 2)
+	{
+		for (LONG x = 0; x < FlatSize; x += 255, p += 2)
+		{
+			p[0] = (BYTE)(FlatSize - x < 255 ? FlatSize - x : 255);
+			p[1] = 1;
+		}
+	}
+	if (CHECK(p == Dib + SizeCb && GetPackedDIBInfo((const BITMAPINFOHEADER *)Dib, SizeCb, &Info)))
+	{
+		DWORD *Pixels = (DWORD *)malloc((SIZE_T)FlatSize * FlatSize * 4);
+		DecodePackedDIB(&Info, (BYTE *)Pixels, FlatSize * 4);
+		BOOL Flat = true;
+		for (SIZE_T i = 0; i < (SIZE_T)FlatSize * FlatSize; ++i) Flat = Flat && Pixels[i] == 0xFF336699;
+		CHECK(Flat);
+		free(Pixels);
+	}
+	free(Dib);
+
+	// Nothing has more than 16384 x 16384 pixels, however much data there is.
+	Dib = BuildRle8Dib(16384, 16384, 3 * 1024 * 1024, &SizeCb);
+	Header = (BITMAPINFOHEADER *)Dib;
+	CHECK(GetPackedDIBInfo(Header, SizeCb, &Info));
+	Header->biHeight = 16385;
+	CHECK(!GetPackedDIBInfo(Header, SizeCb, &Info));
+	free(Dib);
+}
@@ -0,0 +1,154 @@
+// Hashes generated screenshots (a desktop with windows full of text) and variants of them, and checks that the changes
+// users make between two screenshots of the same screen stay within the default /similar distance, while screenshots
+// of other screens stay out of it.
+
+#include "Test.h"
+#include "PerceptualHash.h"
+#include "MipPyramid.h"
+#include "PixelBuffer.h"
+#include <string.h>
+
+#define TEST_SCREEN_WIDTH 1920
+#define TEST_SCREEN_HEIGHT 1080
+#define TEST_SCREEN_COUNT 40
+// The monitor's default for /similar.
+#define DEFAULT_SIMILAR_DISTANCE 3
+
+enum SCREEN_CHANGE
+{
+	SCREEN_CURSOR,         // The mouse cursor somewhere else.
+	SCREEN_TEXT_LINE,      // A line of text typed.
+	SCREEN_NOISE,          // Every channel off by up to 6, like after lossy re-encoding.
+	SCREEN_CLOCK,          // The clock in the corner, and the cursor.
+	SCREEN_UNRELATED,      // Another screen altogether.
+	SCREEN_CHANGE_COUNT,
+};
+
+
+static void FillRectangle(PIXEL_BUFFER *Image, LONG X, LONG Y, LONG Width, LONG Height, DWORD Color)
+{
+	for (LONG y = Y < 0 ? 0 : Y; y < Y + Height && y < Image->Height; ++y)
+	{
+		DWORD *Row = (DWORD *)(Image->Pixels + (SIZE_T)y * Image->Stride);
+		for (LONG x = X < 0 ? 0 : X; x < X + Width && x < Image->Width; ++x) Row[x] = Color;
+	}
+}
+
+
+// A desktop in some color, with a few windows that have a title bar and lines of words.
+static PIXEL_BUFFER *GenerateScreen(DWORD *Random)
+{
+	PIXEL_BUFFER *Image = PixelBufferCreate(TEST_SCREEN_WIDTH, TEST_SCREEN_HEIGHT);
+	if (Image == nullptr) return nullptr;
+	FillRectangle(Image, 0, 0, Image->Width, Image->Height, TestRandom(Random) & 0xFFFFFF);
+	for (UINT Windows = 2 + TestRandom(Random) % 5; Windows > 0; --Windows)
+	{
+		LONG X = (LONG)(TestRandom(Random) % Image->Width);
+		LONG Y = (LONG)(TestRandom(Random) % Image->Height);
+		LONG Width = 70 + (LONG)(TestRandom(Random) % (Image->Width / 2));
+		LONG Height = 70 + (LONG)(TestRandom(Random) % (Image->Height / 2));
+		FillRectangle(Image, X, Y, Width, Height, 0xF0F0F0 | (TestRandom(Random) & 0x0F0F0F));
+		FillRectangle(Image, X, Y, Width, 16, TestRandom(Random) & 0xFFFFFF);
+		for (LONG Line = Y + 20; Line < Y + Height - 8; Line += 12)
+		{
+			for (LONG Word = X + 6; Word < X + Width - 14; )
+			{
+				LONG WordWidth = 7 + (LONG)(TestRandom(Random) % 40);
+				FillRectangle(Image, Word, Line, WordWidth, 7, 0x202020);
+				Word += WordWidth + 4;
+			}
+		}
+	}
+	return Image;
+}
+
+
+static PIXEL_BUFFER *ChangeScreen(const PIXEL_BUFFER *Screen, SCREEN_CHANGE Change, DWORD *Random)
+{
+	if (Change == SCREEN_UNRELATED) return GenerateScreen(Random);
+	PIXEL_BUFFER *Image = PixelBufferCreate(Screen->Width, Screen->Height);
+	if (Image == nullptr) return nullptr;
+	memcpy(Image->Pixels, Screen->Pixels, Screen->SizeCb);
+	LONG X = (LONG)(TestRandom(Random) % Image->Width);
+	LONG Y = (LONG)(TestRandom(Random) % Image->Height);
+	switch (Change)
+	{
+	case SCREEN_CURSOR:
+		FillRectangle(Image, X, Y, 8, 14, 0xFFFFFF);
+		break;
+	case SCREEN_TEXT_LINE:
+		FillRectangle(Image, X, Y, 270, 8, 0x202020);
+		break;
+	case SCREEN_NOISE:
+		for (SIZE_T i = 0; i < Image->SizeCb; i += 4)
+		{
+			DWORD r = TestRandom(Random);
+			for (UINT c = 0; c < 3; ++c)
+			{
+				int Value = Image->Pixels[i + c] + (int)((r >> c * 8 & 0xFF) % 13) - 6;
+				Image->Pixels[i + c] = (BYTE)(Value < 0 ? 0 : Value > 255 ? 255 : Value);
+			}
+		}
+		break;
+	case SCREEN_CLOCK:
+		FillRectangle(Image, Image->Width - 54, Image->Height - 20, 40, 10, TestRandom(Random) & 0xFFFFFF);
+		FillRectangle(Image, X, Y, 8, 14, 0);
+		break;
+	default:
+		break;
+	}
+	return Image;
+}
+
+
+// Hashes the image the way the monitor does, from its mip pyramid.
+static ULONGLONG HashScreen(PIXEL_BUFFER *Image)
+{
+	for (PIXEL_BUFFER *Level = Image; Level != nullptr; Level = MipPyramidAddLevel(Level));
+	return ComputePerceptualHash(Image);
+}
+
+
+void TestPerceptualHashAccuracy()
+{
+	static const char *const ChangeNames[] = { "cursor", "text line", "noise", "clock", "unrelated" };
+	UINT Similar[SCREEN_CHANGE_COUNT] = {};
+	DWORD Random = 1;
+	for (UINT i = 0; i < TEST_SCREEN_COUNT; ++i)
+	{
+		PIXEL_BUFFER *Screen = GenerateScreen(&Random);
+		if (!CHECK(Screen != nullptr)) return;
+		ULONGLONG Hash = HashScreen(Screen);
+		for (UINT Change = 0; Change < SCREEN_CHANGE_COUNT; ++Change)
+		{
+			PIXEL_BUFFER *Changed = ChangeScreen(Screen, (SCREEN_CHANGE)Change, &Random);
+			if (!CHECK(Changed != nullptr)) break;
+			UINT Distance = PerceptualHashDistance(Hash, HashScreen(Changed));
+			Similar[Change] += Distance <= DEFAULT_SIMILAR_DISTANCE;
+			PixelBufferRelease(Changed);
+		}
+		PixelBufferRelease(Screen);
+	}
+
+	// Small changes are always recognized; other screens rarely look the same.
+	for (UINT Change = 0; Change < SCREEN_CHANGE_COUNT; ++Change)
+	{
+		TestSetContext("%s: %u of %u similar", ChangeNames[Change], Similar[Change], TEST_SCREEN_COUNT);
+		CHECK(Change == SCREEN_UNRELATED ? Similar[Change] <= TEST_SCREEN_COUNT / 20 : Similar[Change] == TEST_SCREEN_COUNT);
+	}
+	TestSetContext("");
+
+	// The hash hardly depends on whether there is a pyramid (which rounds each level), and uniform images hash to 0.
+	PIXEL_BUFFER *Flat = PixelBufferCreate(97, 61);
+	PIXEL_BUFFER *Screen = GenerateScreen(&Random);
+	if (CHECK(Flat != nullptr && Screen != nullptr))
+	{
+		FillRectangle(Flat, 0, 0, Flat->Width, Flat->Height, 0x336699);
+		CHECK(ComputePerceptualHash(Flat) == 0 && HashScreen(Flat) == 0);
+		ULONGLONG Hash = ComputePerceptualHash(Screen);
+		CHECK(PerceptualHashDistance(Hash, HashScreen(Screen)) <= DEFAULT_SIMILAR_DISTANCE);
+	}
+	PixelBufferRelease(Screen);
+	PixelBufferRelease(Flat);
+	CHECK(PerceptualHashDistance(0, ~0ULL) == 64 && PerceptualHashDistance(0x8000000000000001ULL, 1) == 1);
+}
@@ -0,0 +1,189 @@
+// Compares the alpha kernels with the obvious formulas, in floating point: premultiplying every color with every alpha,
+// and compositing every premultiplied pixel over both squares of the checkerboard. Built with and without
+// -DPORTABLE_NO_SIMD, this checks the SIMD and the scalar kernels against the same reference.
+
+#include "Test.h"
+#include "PixelAlpha.h"
+#include "PixelBuffer.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Every (color, alpha) pair, and a few pixels more for the scalar tail.
+#define PAIR_COUNT (256 * 256)
+#define TAIL_COUNT 3
+
+
+static DWORD ReferenceMultiply(DWORD x, DWORD a)
+{
+	return (DWORD)floor(x * a / 255.0 + 0.5);
+}
+
+
+// Every premultiplied pixel, i.e. with no channel above its alpha. Returns the number of pixels.
+static LONG FillPremultiplied(BYTE *Pixels)
+{
+	LONG Count = 0;
+	for (DWORD a = 0; a < 256; ++a)
+	{
+		for (DWORD x = 0; x <= a; ++x, ++Count)
+		{
+			BYTE *p = Pixels + (SIZE_T)Count * 4;
+			p[0] = (BYTE)x;
+			p[1] = (BYTE)(x / 2);
+			p[2] = (BYTE)(a - x);
+			p[3] = (BYTE)a;
+		}
+	}
+	return Count;
+}
+
+
+void TestPixelAlphaPremultiply()
+{
+	const SIZE_T Count = PAIR_COUNT + TAIL_COUNT;
+	BYTE *Original = (BYTE *)malloc(Count * 4);
+	BYTE *Pixels = (BYTE *)malloc(Count * 4 + 12);
+	if (!CHECK(Original != nullptr && Pixels != nullptr))
+	{
+		free(Original);
+		free(Pixels);
+		return;
+	}
+	for (DWORD i = 0; i < PAIR_COUNT; ++i)
+	{
+		BYTE *p = Original + (SIZE_T)i * 4;
+		p[0] = (BYTE)i;
+		p[1] = (BYTE)(255 - i);
+		p[2] = (BYTE)(i ^ 0x55);
+		p[3] = (BYTE)(i >> 8);
+	}
+	for (DWORD i = 0; i < TAIL_COUNT; ++i)
+	{
+		BYTE *p = Original + (SIZE_T)(PAIR_COUNT + i) * 4;
+		p[0] = 200;
+		p[1] = 100;
+		p[2] = 50;
+		p[3] = (BYTE)(77 * i);
+	}
+
+	// At every alignment of the buffer, and lengths that leave every tail.
+	for (SIZE_T Offset = 0; Offset <= 12; Offset += 4)
+	{
+		for (SIZE_T Length = Count - 7; Length <= Count; ++Length)
+		{
+			TestSetContext("%u pixels at offset %u", (UINT)Length, (UINT)Offset);
+			BYTE *Buffer = Pixels + Offset;
+			memcpy(Buffer, Original, Count * 4);
+			PremultiplyAlpha(Buffer, Length);
+			BOOL Same = true;
+			for (SIZE_T i = 0; i < Count * 4; ++i)
+			{
+				DWORD Expected = i / 4 >= Length || i % 4 == 3 ? Original[i] : ReferenceMultiply(Original[i], Original[i | 3]);
+				Same = Same && Buffer[i] == Expected;
+			}
+			CHECK(Same);
+		}
+	}
+	free(Pixels);
+	free(Original);
+}
+
+
+// Every premultiplied pixel over the checkerboard, starting at positions that cut the groups of four and the squares
+// anywhere, into another buffer and in place.
+void TestPixelAlphaComposite()
+{
+	const LONG Rows = 3;
+	BYTE *Source = (BYTE *)malloc(PAIR_COUNT * 4);
+	LONG Width = Source != nullptr ? FillPremultiplied(Source) / Rows : 0;
+	SIZE_T Stride = (SIZE_T)Width * 4 + 8;
+	BYTE *Padded = (BYTE *)malloc(Stride * Rows);
+	BYTE *Composited = (BYTE *)malloc(Stride * Rows);
+	BYTE *InPlace = (BYTE *)malloc(Stride * Rows);
+	if (CHECK(Source != nullptr && Padded != nullptr && Composited != nullptr && InPlace != nullptr))
+	{
+		for (LONG y = 0; y < Rows; ++y) memcpy(Padded + y * Stride, Source + (SIZE_T)y * Width * 4, (SIZE_T)Width * 4);
+		for (LONGLONG X = 0; X < 20; X += 3)
+		{
+			for (LONGLONG Y = 0; Y < 17; Y += 5)
+			{
+				TestSetContext("at (%d, %d)", (int)X, (int)Y);
+				memset(Composited, 0x5A, Stride * Rows);
+				CompositeOverCheckerboard(Padded, Stride, Composited, Stride, Width, Rows, X, Y);
+				BOOL Same = true;
+				for (LONG y = 0; y < Rows; ++y)
+				{
+					for (LONG x = 0; x < Width; ++x)
+					{
+						const BYTE *p = Padded + y * Stride + (SIZE_T)x * 4;
+						const BYTE *q = Composited + y * Stride + (SIZE_T)x * 4;
+						DWORD Gray = (((X + x) / CHECKERBOARD_SIZE + (Y + y) / CHECKERBOARD_SIZE) & 1) != 0 ? CHECKERBOARD_DARK : CHECKERBOARD_LIGHT;
+						DWORD Background = ReferenceMultiply(Gray, 255 - p[3]);
+						for (int c = 0; c < 3; ++c)
+						{
+							Same = Same && q[c] == (p[c] + Background < 255 ? p[c] + Background : 255);
+						}
+						Same = Same && q[3] == 255;
+					}
+					// The padding after each row is left alone.
+					Same = Same && Composited[y * Stride + (SIZE_T)Width * 4] == 0x5A;
+				}
+				CHECK(Same);
+
+				memcpy(InPlace, Padded, Stride * Rows);
+				CompositeOverCheckerboard(InPlace, Stride, InPlace, Stride, Width, Rows, X, Y);
+				BOOL SameInPlace = true;
+				for (LONG y = 0; y < Rows; ++y)
+				{
+					SameInPlace = SameInPlace && memcmp(InPlace + y * Stride, Composited + y * Stride, (SIZE_T)Width * 4) == 0;
+				}
+				CHECK(SameInPlace);
+			}
+		}
+	}
+	free(InPlace);
+	free(Composited);
+	free(Padded);
+	free(Source);
+}
+
+
+// A single pixel anywhere in a block decides the kind; decoded images are made opaque or premultiplied accordingly.
+void TestPixelAlphaClassify()
+{
+	const SIZE_T Count = 9000;
+	static BYTE Pixels[Count * 4];
+	CHECK(ClassifyAlpha(Pixels, 0) == ALPHA_OPAQUE);
+	for (SIZE_T i = 0; i < Count; i += 997)
+	{
+		TestSetContext("pixel %u", (UINT)i);
+		memset(Pixels, 0xFF, sizeof(Pixels));
+		CHECK(ClassifyAlpha(Pixels, Count) == ALPHA_OPAQUE);
+		Pixels[i * 4 + 3] = 3;
+		CHECK(ClassifyAlpha(Pixels, Count) == ALPHA_TRANSLUCENT);
+		// Only the pixels asked for count.
+		CHECK(ClassifyAlpha(Pixels, i) == ALPHA_OPAQUE);
+		memset(Pixels, 0, sizeof(Pixels));
+		for (SIZE_T j = 0; j < Count; ++j) Pixels[j * 4] = 9;
+		CHECK(ClassifyAlpha(Pixels, Count) == ALPHA_TRANSPARENT);
+		Pixels[i * 4 + 3] = 255;
+		CHECK(ClassifyAlpha(Pixels, Count) == ALPHA_TRANSLUCENT);
+	}
+	TestSetContext("");
+
+	PIXEL_BUFFER *Image = PixelBufferCreate(5, 3);
+	if (!CHECK(Image != nullptr)) return;
+	memset(Image->Pixels, 0x40, Image->SizeCb);
+	for (SIZE_T i = 0; i < Image->SizeCb; i += 4) Image->Pixels[i + 3] = 0;
+	PrepareDecodedAlpha(Image, true);
+	CHECK(!Image->HasAlpha && Image->Pixels[3] == 255 && Image->Pixels[0] == 0x40);
+	for (SIZE_T i = 0; i < Image->SizeCb; i += 4) Image->Pixels[i + 3] = 0;
+	PrepareDecodedAlpha(Image, false);
+	CHECK(Image->HasAlpha && Image->Pixels[0] == 0 && Image->Pixels[3] == 0);
+	Image->Pixels[4] = 0x40;
+	Image->Pixels[7] = 0x80;
+	PrepareDecodedAlpha(Image, true);
+	CHECK(Image->HasAlpha && Image->Pixels[4] == 0x20 && Image->Pixels[7] == 0x80);
+	PixelBufferRelease(Image);
+}
@@ -0,0 +1,82 @@
+// Checks that a captured image is decoded once, into one buffer, however many places share it.
+
+#include "Test.h"
+#include "PixelBuffer.h"
+#include "PackedDIB.h"
+#include "PayloadGenerator.h"
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+#define SHARING_THREADS 4
+
+
+static void ReadSharedBuffer(PIXEL_BUFFER *Buffer, const BYTE *Expected, BOOL *Same)
+{
+	*Same = Buffer->Width == 320 && memcmp(Buffer->Pixels, Expected, Buffer->SizeCb) == 0;
+	PixelBufferRelease(Buffer);
+}
+
+
+void TestPixelBufferSingleCopy()
+{
+	DIB_PAYLOAD_SPEC Spec = { 320, 200, 24, BI_RGB, DIB_HEADER_INFO, 0, 1 };
+	SIZE_T SizeCb;
+	BYTE *Dib = GeneratePackedDIB(&Spec, &SizeCb);
+	PACKED_DIB_INFO Info;
+	BYTE *Expected = (BYTE *)malloc((SIZE_T)320 * 200 * 4);
+	if (!CHECK(Dib != nullptr && Expected != nullptr && GetPackedDIBInfo((const BITMAPINFOHEADER *)Dib, SizeCb, &Info)))
+	{
+		free(Expected);
+		free(Dib);
+		return;
+	}
+	DecodePackedDIB(&Info, Expected, (SIZE_T)320 * 4);
+
+	PIXEL_BUFFER_STATS Before;
+	GetPixelBufferStats(&Before);
+	PIXEL_BUFFER *Buffer = PixelBufferCreateFromPackedDIB((const BITMAPINFOHEADER *)Dib, SizeCb);
+	if (!CHECK(Buffer != nullptr))
+	{
+		free(Expected);
+		free(Dib);
+		return;
+	}
+
+	// The viewer and the history keep a reference, and worker threads read it and let go.
+	PIXEL_BUFFER *Viewer = PixelBufferAddRef(Buffer);
+	PIXEL_BUFFER *History = PixelBufferAddRef(Buffer);
+	std::thread Threads[SHARING_THREADS];
+	BOOL Same[SHARING_THREADS] = {};
+	for (int i = 0; i < SHARING_THREADS; ++i)
+	{
+		Threads[i] = std::thread(ReadSharedBuffer, PixelBufferAddRef(Buffer), Expected, &Same[i]);
+	}
+	for (int i = 0; i < SHARING_THREADS; ++i)
+	{
+		Threads[i].join();
+		CHECK(Same[i]);
+	}
+
+	PIXEL_BUFFER_STATS Shared;
+	GetPixelBufferStats(&Shared);
+	CHECK(Shared.Allocations - Before.Allocations == 1);
+	CHECK(Shared.BytesAllocated - Before.BytesAllocated == (LONGLONG)320 * 200 * 4);
+	CHECK(Shared.LiveBuffers - Before.LiveBuffers == 1);
+	CHECK(Viewer == Buffer && History == Buffer && Buffer->RefCount == 3);
+
+	PixelBufferRelease(History);
+	PixelBufferRelease(Viewer);
+	PIXEL_BUFFER_STATS Held;
+	GetPixelBufferStats(&Held);
+	CHECK(Held.Frees == Before.Frees);
+	PixelBufferRelease(Buffer);
+
+	PIXEL_BUFFER_STATS After;
+	GetPixelBufferStats(&After);
+	CHECK(After.Allocations - Before.Allocations == 1);
+	CHECK(After.Frees - Before.Frees == 1);
+	CHECK(After.LiveBytes == Before.LiveBytes);
+	free(Expected);
+	free(Dib);
+}
@@ -0,0 +1,1217 @@
+// PngSuite-style conformance: PNGs in every color type and bit depth, with every filter type (and one picked at random
+// for each row), interlaced or not, with and without tRNS, from stored, fixed and dynamic DEFLATE blocks spread over
+// IDAT chunks of any size, decoded on one thread and on two. Every pixel is compared with what the samples written
+// into the file should look like. Damaged files (broken headers, chunks, CRCs and zlib streams, bad filter types, too
+// little or too much image data, truncation anywhere) must be rejected.
+
+#include "Test.h"
+#include "PngDecoder.h"
+#include "PixelBuffer.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_TEST_PNG_SIZE 40
+// Large enough for DecodePng to unfilter on a second thread.
+#define PIPELINE_TEST_SIZE_CB (1200 * 1024)
+
+#define TEST_FILTER_RANDOM 5
+
+enum TEST_COMPRESSION
+{
+	TEST_STORED,
+	TEST_FIXED,
+	TEST_DYNAMIC,
+	TEST_MIXED,             // Each block is any of the three.
+	TEST_COMPRESSION_COUNT,
+};
+
+// The longest match, and how far back DEFLATE can look.
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_WINDOW 32768
+#define DEFLATE_HASH_BITS 12
+#define DEFLATE_MAX_BLOCK_SYMBOLS 4096
+#define LITLEN_SYMBOLS 286
+#define DIST_SYMBOLS 30
+#define PRECODE_SYMBOLS 19
+
+struct TEST_PNG
+{
+	LONG Width;
+	LONG Height;
+	BYTE ColorType;
+	BYTE BitDepth;
+	BOOL Interlaced;
+	BYTE Filter;            // 0 to 4, or TEST_FILTER_RANDOM.
+	BYTE Compression;       // TEST_COMPRESSION.
+	BOOL Transparency;      // tRNS: alphas for the first palette entries, or the key color of a pixel in the image.
+	BOOL ExtraChunks;       // Ancillary chunks before, between and after the others, and a suggested palette for RGB.
+	BOOL SingleIdat;
+	BOOL Ramp;              // Samples that count up, so that every gray level is there, instead of random ones.
+	// Damage: a row (counted through all passes) with the invalid filter type BadFilter, and image data that is this
+	// many bytes longer (or shorter, if negative) than it should be.
+	LONG BadFilterRow;
+	BYTE BadFilter;
+	int SizeError;
+
+	// Filled in by GenerateTestPng.
+	WORD *Samples;          // Width * Height pixels, top-down, with all their channels.
+	BYTE Palette[256 * 3];
+	UINT PaletteSize;
+	BYTE Alphas[256];
+	UINT AlphaCount;
+	WORD Key[3];
+};
+
+struct BIT_WRITER
+{
+	BYTE *Out;
+	ULONGLONG Bits;
+	UINT Count;
+};
+
+// A literal (Length 0, Value is the byte), or a match of Length bytes, Value bytes back.
+struct DEFLATE_SYMBOL
+{
+	WORD Length;
+	WORD Value;
+};
+
+static const WORD LengthBases[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const BYTE LengthExtraBits[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const WORD DistBases[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const BYTE DistExtraBits[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const BYTE PrecodeOrder[PRECODE_SYMBOLS] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+static const BYTE Adam7[7][4] = { { 0, 0, 8, 8 }, { 4, 0, 8, 8 }, { 0, 4, 4, 8 }, { 2, 0, 4, 4 }, { 0, 2, 2, 4 }, { 1, 0, 2, 2 }, { 0, 1, 1, 2 } };
+
+// Color type and bit depth.
+static const BYTE Formats[][2] =
+{
+	{ PNG_GRAY, 1 }, { PNG_GRAY, 2 }, { PNG_GRAY, 4 }, { PNG_GRAY, 8 }, { PNG_GRAY, 16 },
+	{ PNG_RGB, 8 }, { PNG_RGB, 16 },
+	{ PNG_PALETTE, 1 }, { PNG_PALETTE, 2 }, { PNG_PALETTE, 4 }, { PNG_PALETTE, 8 },
+	{ PNG_GRAY_ALPHA, 8 }, { PNG_GRAY_ALPHA, 16 },
+	{ PNG_RGBA, 8 }, { PNG_RGBA, 16 },
+};
+
+
+static DWORD ComputeTestCrc32(const BYTE *Data, SIZE_T SizeCb)
+{
+	DWORD Crc = 0xFFFFFFFF;
+	for (SIZE_T i = 0; i < SizeCb; ++i)
+	{
+		Crc ^= Data[i];
+		for (int Bit = 0; Bit < 8; ++Bit) Crc = (Crc >> 1) ^ (0xEDB88320 & (0 - (Crc & 1)));
+	}
+	return ~Crc;
+}
+
+
+static void WriteBigEndian(BYTE *p, DWORD Value)
+{
+	p[0] = (BYTE)(Value >> 24);
+	p[1] = (BYTE)(Value >> 16);
+	p[2] = (BYTE)(Value >> 8);
+	p[3] = (BYTE)Value;
+}
+
+
+static DWORD ReadBigEndian(const BYTE *p)
+{
+	return (DWORD)p[0] << 24 | (DWORD)p[1] << 16 | (DWORD)p[2] << 8 | p[3];
+}
+
+
+static void PutBits(BIT_WRITER *Writer, DWORD Value, UINT Count)
+{
+	Writer->Bits |= (ULONGLONG)Value << Writer->Count;
+	Writer->Count += Count;
+	while (Writer->Count >= 8)
+	{
+		*Writer->Out++ = (BYTE)Writer->Bits;
+		Writer->Bits >>= 8;
+		Writer->Count -= 8;
+	}
+}
+
+
+static void FlushBits(BIT_WRITER *Writer)
+{
+	if (Writer->Count > 0) PutBits(Writer, 0, 8 - Writer->Count);
+}
+
+
+// Huffman codes are sent starting with their most significant bit.
+static void PutCode(BIT_WRITER *Writer, DWORD Code, UINT Length)
+{
+	DWORD Reversed = 0;
+	for (UINT i = 0; i < Length; ++i) Reversed = Reversed << 1 | ((Code >> i) & 1);
+	PutBits(Writer, Reversed, Length);
+}
+
+
+// Huffman code lengths for the frequencies, none longer than MaxBits: while the tree is too deep, the frequencies are
+// flattened, which ends with a balanced tree. At least two symbols get a code, so that the code is complete.
+static void BuildCodeLengths(DWORD *Frequencies, UINT Count, UINT MaxBits, BYTE *Lengths)
+{
+	UINT Used = 0;
+	for (UINT s = 0; s < Count; ++s) Used += Frequencies[s] != 0;
+	for (UINT s = 0; Used < 2; ++s)
+	{
+		if (Frequencies[s] == 0)
+		{
+			Frequencies[s] = 1;
+			++Used;
+		}
+	}
+	ULONGLONG Weights[2 * LITLEN_SYMBOLS];
+	int Parents[2 * LITLEN_SYMBOLS];
+	BOOL Active[2 * LITLEN_SYMBOLS];
+	for (;;)
+	{
+		UINT Nodes = Count;
+		for (UINT s = 0; s < Count; ++s)
+		{
+			Weights[s] = Frequencies[s];
+			Parents[s] = -1;
+			Active[s] = Frequencies[s] != 0;
+		}
+		for (UINT Merges = 1; Merges < Used; ++Merges)
+		{
+			int Smallest[2] = { -1, -1 };
+			for (UINT n = 0; n < Nodes; ++n)
+			{
+				if (!Active[n]) continue;
+				if (Smallest[0] < 0 || Weights[n] < Weights[Smallest[0]])
+				{
+					Smallest[1] = Smallest[0];
+					Smallest[0] = (int)n;
+				}
+				else if (Smallest[1] < 0 || Weights[n] < Weights[Smallest[1]])
+				{
+					Smallest[1] = (int)n;
+				}
+			}
+			Weights[Nodes] = Weights[Smallest[0]] + Weights[Smallest[1]];
+			Parents[Nodes] = -1;
+			Active[Nodes] = true;
+			Active[Smallest[0]] = Active[Smallest[1]] = false;
+			Parents[Smallest[0]] = Parents[Smallest[1]] = (int)Nodes++;
+		}
+		UINT Deepest = 0;
+		for (UINT s = 0; s < Count; ++s)
+		{
+			UINT Depth = 0;
+			for (int n = (int)s; Frequencies[s] != 0 && Parents[n] >= 0; n = Parents[n]) ++Depth;
+			Lengths[s] = (BYTE)Depth;
+			if (Depth > Deepest) Deepest = Depth;
+		}
+		if (Deepest <= MaxBits) return;
+		for (UINT s = 0; s < Count; ++s) Frequencies[s] = (Frequencies[s] + 1) / 2;
+	}
+}
+
+
+// The canonical codes for the lengths, as RFC 1951 assigns them.
+static void BuildCodes(const BYTE *Lengths, UINT Count, WORD *Codes)
+{
+	UINT LengthCounts[16] = {};
+	for (UINT s = 0; s < Count; ++s) ++LengthCounts[Lengths[s]];
+	LengthCounts[0] = 0;
+	WORD Next[16];
+	WORD Code = 0;
+	for (UINT Length = 1; Length < 16; ++Length)
+	{
+		Code = (WORD)((Code + LengthCounts[Length - 1]) << 1);
+		Next[Length] = Code;
+	}
+	for (UINT s = 0; s < Count; ++s) Codes[s] = Lengths[s] != 0 ? Next[Lengths[s]]++ : 0;
+}
+
+
+static UINT FindCode(const WORD *Bases, UINT Count, UINT Value)
+{
+	UINT Code = 0;
+	while (Code + 1 < Count && Bases[Code + 1] <= Value) ++Code;
+	return Code;
+}
+
+
+static void PutSymbols(BIT_WRITER *Writer, const DEFLATE_SYMBOL *Symbols, UINT Count, const BYTE *LitLenLengths, const BYTE *DistLengths)
+{
+	WORD LitLenCodes[LITLEN_SYMBOLS + 2];
+	WORD DistCodes[DIST_SYMBOLS];
+	BuildCodes(LitLenLengths, LITLEN_SYMBOLS + 2, LitLenCodes);
+	BuildCodes(DistLengths, DIST_SYMBOLS, DistCodes);
+	for (UINT i = 0; i < Count; ++i)
+	{
+		if (Symbols[i].Length == 0)
+		{
+			PutCode(Writer, LitLenCodes[Symbols[i].Value], LitLenLengths[Symbols[i].Value]);
+			continue;
+		}
+		UINT LengthCode = FindCode(LengthBases, 29, Symbols[i].Length);
+		PutCode(Writer, LitLenCodes[257 + LengthCode], LitLenLengths[257 + LengthCode]);
+		PutBits(Writer, Symbols[i].Length - LengthBases[LengthCode], LengthExtraBits[LengthCode]);
+		UINT DistCode = FindCode(DistBases, 30, Symbols[i].Value);
+		PutCode(Writer, DistCodes[DistCode], DistLengths[DistCode]);
+		PutBits(Writer, Symbols[i].Value - DistBases[DistCode], DistExtraBits[DistCode]);
+	}
+	PutCode(Writer, LitLenCodes[256], LitLenLengths[256]);
+}
+
+
+static void PutFixedBlock(BIT_WRITER *Writer, const DEFLATE_SYMBOL *Symbols, UINT Count)
+{
+	BYTE LitLenLengths[LITLEN_SYMBOLS + 2];
+	BYTE DistLengths[DIST_SYMBOLS];
+	for (UINT s = 0; s < LITLEN_SYMBOLS + 2; ++s) LitLenLengths[s] = s < 144 ? 8 : s < 256 ? 9 : s < 280 ? 7 : 8;
+	memset(DistLengths, 5, sizeof(DistLengths));
+	PutBits(Writer, 1, 2);
+	PutSymbols(Writer, Symbols, Count, LitLenLengths, DistLengths);
+}
+
+
+// The code lengths of both codes, run-length encoded with the repeat symbols 16, 17 and 18 wherever they fit.
+static void PutDynamicBlock(BIT_WRITER *Writer, const DEFLATE_SYMBOL *Symbols, UINT Count)
+{
+	DWORD LitLenFrequencies[LITLEN_SYMBOLS] = {};
+	DWORD DistFrequencies[DIST_SYMBOLS] = {};
+	for (UINT i = 0; i < Count; ++i)
+	{
+		if (Symbols[i].Length == 0)
+		{
+			++LitLenFrequencies[Symbols[i].Value];
+			continue;
+		}
+		++LitLenFrequencies[257 + FindCode(LengthBases, 29, Symbols[i].Length)];
+		++DistFrequencies[FindCode(DistBases, 30, Symbols[i].Value)];
+	}
+	LitLenFrequencies[256] = 1;
+	BYTE LitLenLengths[LITLEN_SYMBOLS + 2] = {};
+	BYTE DistLengths[DIST_SYMBOLS] = {};
+	BuildCodeLengths(LitLenFrequencies, LITLEN_SYMBOLS, 15, LitLenLengths);
+	BuildCodeLengths(DistFrequencies, DIST_SYMBOLS, 15, DistLengths);
+	UINT LitLenCount = LITLEN_SYMBOLS;
+	while (LitLenCount > 257 && LitLenLengths[LitLenCount - 1] == 0) --LitLenCount;
+	UINT DistCount = DIST_SYMBOLS;
+	while (DistCount > 1 && DistLengths[DistCount - 1] == 0) --DistCount;
+
+	BYTE All[LITLEN_SYMBOLS + DIST_SYMBOLS];
+	memcpy(All, LitLenLengths, LitLenCount);
+	memcpy(All + LitLenCount, DistLengths, DistCount);
+	UINT AllCount = LitLenCount + DistCount;
+	BYTE Runs[LITLEN_SYMBOLS + DIST_SYMBOLS][2];
+	UINT RunCount = 0;
+	DWORD PrecodeFrequencies[PRECODE_SYMBOLS] = {};
+	for (UINT i = 0; i < AllCount; )
+	{
+		UINT Same = 1;
+		while (i + Same < AllCount && All[i + Same] == All[i]) ++Same;
+		BYTE Symbol = All[i];
+		UINT Repeat = 0;
+		if (All[i] == 0 && Same >= 11) Symbol = 18, Repeat = Same < 138 ? Same : 138;
+		else if (All[i] == 0 && Same >= 3) Symbol = 17, Repeat = Same;
+		else if (i > 0 && All[i - 1] == All[i] && Same >= 3) Symbol = 16, Repeat = Same < 6 ? Same : 6;
+		Runs[RunCount][0] = Symbol;
+		Runs[RunCount++][1] = (BYTE)Repeat;
+		++PrecodeFrequencies[Symbol];
+		i += Repeat != 0 ? Repeat : 1;
+	}
+	BYTE PrecodeLengths[PRECODE_SYMBOLS] = {};
+	WORD PrecodeCodes[PRECODE_SYMBOLS];
+	BuildCodeLengths(PrecodeFrequencies, PRECODE_SYMBOLS, 7, PrecodeLengths);
+	BuildCodes(PrecodeLengths, PRECODE_SYMBOLS, PrecodeCodes);
+	UINT PrecodeCount = PRECODE_SYMBOLS;
+	while (PrecodeCount > 4 && PrecodeLengths[PrecodeOrder[PrecodeCount - 1]] == 0) --PrecodeCount;
+
+	PutBits(Writer, 2, 2);
+	PutBits(Writer, LitLenCount - 257, 5);
+	PutBits(Writer, DistCount - 1, 5);
+	PutBits(Writer, PrecodeCount - 4, 4);
+	for (UINT i = 0; i < PrecodeCount; ++i) PutBits(Writer, PrecodeLengths[PrecodeOrder[i]], 3);
+	for (UINT i = 0; i < RunCount; ++i)
+	{
+		BYTE Symbol = Runs[i][0];
+		PutCode(Writer, PrecodeCodes[Symbol], PrecodeLengths[Symbol]);
+		if (Symbol == 16) PutBits(Writer, Runs[i][1] - 3, 2);
+		if (Symbol == 17) PutBits(Writer, Runs[i][1] - 3, 3);
+		if (Symbol == 18) PutBits(Writer, Runs[i][1] - 11, 7);
+	}
+	PutSymbols(Writer, Symbols, Count, LitLenLengths, DistLengths);
+}
+
+
+static UINT GetMatchLength(const BYTE *Data, SIZE_T SizeCb, SIZE_T Position, SIZE_T Distance)
+{
+	UINT Length = 0;
+	while (Length < DEFLATE_MAX_MATCH && Position + Length < SizeCb && Data[Position + Length] == Data[Position + Length - Distance]) ++Length;
+	return Length;
+}
+
+
+// Greedy matches, at the last position with the same three bytes, or just a few bytes back (runs, and repeated pixels).
+static UINT FindSymbols(const BYTE *Data, SIZE_T SizeCb, SIZE_T *Position, DWORD *Head, DEFLATE_SYMBOL *Symbols, UINT Capacity)
+{
+	static const BYTE ShortDistances[] = { 1, 2, 3, 4, 6, 8 };
+	UINT Count = 0;
+	SIZE_T i = *Position;
+	while (Count < Capacity && i < SizeCb)
+	{
+		UINT BestLength = 0;
+		SIZE_T BestDistance = 0;
+		DWORD Hash = 0;
+		if (i + 3 <= SizeCb)
+		{
+			Hash = ((DWORD)Data[i] << 16 | (DWORD)Data[i + 1] << 8 | Data[i + 2]) * 2654435761u >> (32 - DEFLATE_HASH_BITS);
+			if (Head[Hash] != 0 && i - (Head[Hash] - 1) <= DEFLATE_WINDOW)
+			{
+				BestDistance = i - (Head[Hash] - 1);
+				BestLength = GetMatchLength(Data, SizeCb, i, BestDistance);
+			}
+		}
+		for (UINT d = 0; d < sizeof(ShortDistances); ++d)
+		{
+			if (ShortDistances[d] > i) break;
+			UINT Length = GetMatchLength(Data, SizeCb, i, ShortDistances[d]);
+			if (Length > BestLength)
+			{
+				BestLength = Length;
+				BestDistance = ShortDistances[d];
+			}
+		}
+		if (i + 3 <= SizeCb) Head[Hash] = (DWORD)i + 1;
+		if (BestLength >= 3)
+		{
+			Symbols[Count].Length = (WORD)BestLength;
+			Symbols[Count++].Value = (WORD)BestDistance;
+			i += BestLength;
+		}
+		else
+		{
+			Symbols[Count].Length = 0;
+			Symbols[Count++].Value = Data[i++];
+		}
+	}
+	*Position = i;
+	return Count;
+}
+
+
+static SIZE_T GetCompressBound(SIZE_T SizeCb)
+{
+	// Stored blocks add 5 bytes to every one of at least 1 byte; Huffman blocks take at most 15 bits per symbol, and
+	// their headers at most 320 bytes for every 16 symbols or more.
+	return 2 * SizeCb + 320 * (SizeCb / 16 + 2) + 16;
+}
+
+
+// A zlib stream of blocks of random sizes, at least one of them, the last with BFINAL set.
+static SIZE_T CompressTestData(const BYTE *Data, SIZE_T SizeCb, BYTE Compression, DWORD *Random, BYTE *Out)
+{
+	BIT_WRITER Writer = { Out + 2, 0, 0 };
+	Out[0] = 0x78;
+	Out[1] = 0x9C;
+	DWORD *Head = (DWORD *)calloc(1 << DEFLATE_HASH_BITS, sizeof(DWORD));
+	DEFLATE_SYMBOL *Symbols = (DEFLATE_SYMBOL *)malloc(DEFLATE_MAX_BLOCK_SYMBOLS * sizeof(DEFLATE_SYMBOL));
+	SIZE_T Position = 0;
+	do
+	{
+		BYTE Type = Compression == TEST_MIXED ? (BYTE)(TestRandom(Random) % 3) : Compression;
+		SIZE_T Start = Position;
+		UINT Count = 0;
+		if (Type == TEST_STORED)
+		{
+			// Sometimes an empty one.
+			SIZE_T Length = TestRandom(Random) % 8 == 0 ? 0 : 1 + TestRandom(Random) % 65535;
+			Position += Length < SizeCb - Position ? Length : SizeCb - Position;
+		}
+		else
+		{
+			Count = FindSymbols(Data, SizeCb, &Position, Head, Symbols, 16 + TestRandom(Random) % (DEFLATE_MAX_BLOCK_SYMBOLS - 16));
+		}
+		PutBits(&Writer, Position == SizeCb ? 1 : 0, 1);
+		if (Type == TEST_STORED)
+		{
+			PutBits(&Writer, 0, 2);
+			FlushBits(&Writer);
+			WORD Length = (WORD)(Position - Start);
+			BYTE Lengths[4] = { (BYTE)Length, (BYTE)(Length >> 8), (BYTE)~Length, (BYTE)(~Length >> 8) };
+			memcpy(Writer.Out, Lengths, 4);
+			memcpy(Writer.Out + 4, Data + Start, Length);
+			Writer.Out += 4 + Length;
+		}
+		else if (Type == TEST_FIXED)
+		{
+			PutFixedBlock(&Writer, Symbols, Count);
+		}
+		else
+		{
+			PutDynamicBlock(&Writer, Symbols, Count);
+		}
+	} while (Position < SizeCb);
+	FlushBits(&Writer);
+	free(Symbols);
+	free(Head);
+
+	DWORD a = 1, b = 0;
+	for (SIZE_T i = 0; i < SizeCb; ++i)
+	{
+		a = (a + Data[i]) % 65521;
+		b = (b + a) % 65521;
+	}
+	WriteBigEndian(Writer.Out, b << 16 | a);
+	return Writer.Out + 4 - Out;
+}
+
+
+static UINT GetChannelCount(BYTE ColorType)
+{
+	switch (ColorType)
+	{
+		case PNG_RGB:        return 3;
+		case PNG_GRAY_ALPHA: return 2;
+		case PNG_RGBA:       return 4;
+	}
+	return 1;
+}
+
+
+static BYTE PaethPredictor(int a, int b, int c)
+{
+	int p = a + b - c;
+	int pa = abs(p - a);
+	int pb = abs(p - b);
+	int pc = abs(p - c);
+	if (pa <= pb && pa <= pc) return (BYTE)a;
+	if (pb <= pc) return (BYTE)b;
+	return (BYTE)c;
+}
+
+
+// Writes Filter and the filtered Row to Out.
+static void FilterRow(BYTE Filter, const BYTE *Row, const BYTE *Prior, BYTE *Out, SIZE_T RowSizeCb, UINT PixelSizeCb)
+{
+	Out[0] = Filter;
+	for (SIZE_T i = 0; i < RowSizeCb; ++i)
+	{
+		int a = i >= PixelSizeCb ? Row[i - PixelSizeCb] : 0;
+		int b = Prior[i];
+		int c = i >= PixelSizeCb ? Prior[i - PixelSizeCb] : 0;
+		int Predicted = Filter == 1 ? a : Filter == 2 ? b : Filter == 3 ? (a + b) / 2 : Filter == 4 ? PaethPredictor(a, b, c) : 0;
+		Out[1 + i] = (BYTE)(Row[i] - Predicted);
+	}
+}
+
+
+static BYTE *WriteChunk(BYTE *p, const char *Type, const BYTE *Content, DWORD Length)
+{
+	WriteBigEndian(p, Length);
+	memcpy(p + 4, Type, 4);
+	if (Length != 0) memcpy(p + 8, Content, Length);
+	WriteBigEndian(p + 8 + Length, ComputeTestCrc32(p + 4, 4 + Length));
+	return p + 12 + Length;
+}
+
+
+static void InitTestPng(TEST_PNG *Png, LONG Width, LONG Height, BYTE ColorType, BYTE BitDepth)
+{
+	memset(Png, 0, sizeof(*Png));
+	Png->Width = Width;
+	Png->Height = Height;
+	Png->ColorType = ColorType;
+	Png->BitDepth = BitDepth;
+	Png->BadFilterRow = -1;
+}
+
+
+// Random samples, palette and transparency, and the file that holds them.
+static BYTE *GenerateTestPng(TEST_PNG *Png, DWORD *Random, SIZE_T *SizeCb)
+{
+	UINT Channels = GetChannelCount(Png->ColorType);
+	UINT BitsPerPixel = Channels * Png->BitDepth;
+	UINT PixelSizeCb = BitsPerPixel >= 8 ? BitsPerPixel / 8 : 1;
+	DWORD MaxSample = (1u << Png->BitDepth) - 1;
+	SIZE_T SampleCount = (SIZE_T)Png->Width * Png->Height * Channels;
+	Png->Samples = (WORD *)malloc(SampleCount * sizeof(WORD));
+
+	// Palette indices go a little beyond the palette; those pixels are black.
+	DWORD MaxIndex = 0;
+	if (Png->ColorType == PNG_PALETTE)
+	{
+		Png->PaletteSize = 1 + TestRandom(Random) % (MaxSample + 1);
+		for (UINT i = 0; i < Png->PaletteSize * 3; ++i) Png->Palette[i] = (BYTE)TestRandom(Random);
+		MaxIndex = Png->PaletteSize + 1 < MaxSample ? Png->PaletteSize + 1 : MaxSample;
+	}
+	else if (Png->ExtraChunks && (Png->ColorType == PNG_RGB || Png->ColorType == PNG_RGBA))
+	{
+		Png->PaletteSize = 1 + TestRandom(Random) % 256;
+		for (UINT i = 0; i < Png->PaletteSize * 3; ++i) Png->Palette[i] = (BYTE)TestRandom(Random);
+	}
+	for (SIZE_T i = 0; i < SampleCount; ++i)
+	{
+		DWORD r = TestRandom(Random);
+		Png->Samples[i] = (WORD)(Png->Ramp ? i & MaxSample : Png->ColorType == PNG_PALETTE ? r % (MaxIndex + 1) : r & MaxSample);
+	}
+	if (Png->Transparency && Png->ColorType == PNG_PALETTE)
+	{
+		// Mostly opaque, and some entries fully transparent.
+		Png->AlphaCount = 1 + TestRandom(Random) % Png->PaletteSize;
+		for (UINT i = 0; i < Png->AlphaCount; ++i)
+		{
+			DWORD r = TestRandom(Random);
+			Png->Alphas[i] = (BYTE)(r % 4 == 0 ? 0 : r % 4 == 1 ? r >> 8 : 255);
+		}
+	}
+	else if (Png->Transparency && (Png->ColorType == PNG_GRAY || Png->ColorType == PNG_RGB))
+	{
+		const WORD *Pixel = Png->Samples + (TestRandom(Random) % ((SIZE_T)Png->Width * Png->Height)) * Channels;
+		for (UINT c = 0; c < Channels; ++c) Png->Key[c] = Pixel[c];
+		// More pixels of the key color, and some that differ from it in just one channel.
+		for (SIZE_T i = 0; i < SampleCount; i += Channels)
+		{
+			DWORD r = TestRandom(Random) % 8;
+			if (r > 1) continue;
+			for (UINT c = 0; c < Channels; ++c) Png->Samples[i + c] = Png->Key[c];
+			UINT c = TestRandom(Random) % Channels;
+			if (r == 1) Png->Samples[i + c] = (WORD)((Png->Key[c] + 1 + TestRandom(Random) % MaxSample) & MaxSample);
+		}
+	}
+
+	// The passes of the image, one filtered row after the other.
+	UINT PassCount = Png->Interlaced ? 7 : 1;
+	SIZE_T FilteredSizeCb = 0;
+	SIZE_T MaxRowSizeCb = ((SIZE_T)Png->Width * BitsPerPixel + 7) / 8;
+	for (UINT Pass = 0; Pass < PassCount; ++Pass)
+	{
+		const BYTE *Step = Png->Interlaced ? Adam7[Pass] : (const BYTE *)"\0\0\1\1";
+		if (Step[0] >= Png->Width || Step[1] >= Png->Height) continue;
+		SIZE_T PassWidth = (Png->Width - Step[0] + Step[2] - 1) / Step[2];
+		SIZE_T PassHeight = (Png->Height - Step[1] + Step[3] - 1) / Step[3];
+		FilteredSizeCb += PassHeight * (1 + (PassWidth * BitsPerPixel + 7) / 8);
+	}
+	SIZE_T DataSizeCb = Png->SizeError < 0 ? FilteredSizeCb - (SIZE_T)-Png->SizeError : FilteredSizeCb + Png->SizeError;
+	BYTE *Filtered = (BYTE *)malloc(FilteredSizeCb + (Png->SizeError > 0 ? Png->SizeError : 0));
+	BYTE *Rows = (BYTE *)calloc(2, MaxRowSizeCb + 1);
+	BYTE *Out = Filtered;
+	LONG RowIndex = 0;
+	for (UINT Pass = 0; Pass < PassCount; ++Pass)
+	{
+		const BYTE *Step = Png->Interlaced ? Adam7[Pass] : (const BYTE *)"\0\0\1\1";
+		if (Step[0] >= Png->Width || Step[1] >= Png->Height) continue;
+		SIZE_T RowSizeCb = (((Png->Width - Step[0] + Step[2] - 1) / Step[2]) * (SIZE_T)BitsPerPixel + 7) / 8;
+		BYTE *Row = Rows;
+		BYTE *Prior = Rows + MaxRowSizeCb + 1;
+		memset(Prior, 0, RowSizeCb);
+		for (LONG y = Step[1]; y < Png->Height; y += Step[3], ++RowIndex)
+		{
+			// Big endian, and the first pixel in the highest bits.
+			memset(Row, 0, RowSizeCb);
+			SIZE_T Bit = 0;
+			for (LONG x = Step[0]; x < Png->Width; x += Step[2])
+			{
+				const WORD *Samples = Png->Samples + ((SIZE_T)y * Png->Width + x) * Channels;
+				for (UINT c = 0; c < Channels; ++c, Bit += Png->BitDepth)
+				{
+					if (Png->BitDepth == 16)
+					{
+						Row[Bit / 8] = (BYTE)(Samples[c] >> 8);
+						Row[Bit / 8 + 1] = (BYTE)Samples[c];
+					}
+					else
+					{
+						Row[Bit / 8] |= (BYTE)(Samples[c] << (8 - Png->BitDepth - Bit % 8));
+					}
+				}
+			}
+			BYTE Filter = Png->Filter == TEST_FILTER_RANDOM ? (BYTE)(TestRandom(Random) % 5) : Png->Filter;
+			FilterRow(Filter, Row, Prior, Out, RowSizeCb, PixelSizeCb);
+			if (RowIndex == Png->BadFilterRow) Out[0] = Png->BadFilter;
+			Out += 1 + RowSizeCb;
+			BYTE *Swap = Row;
+			Row = Prior;
+			Prior = Swap;
+		}
+	}
+	free(Rows);
+	for (int i = 0; i < Png->SizeError; ++i) *Out++ = (BYTE)TestRandom(Random);
+
+	BYTE *Compressed = (BYTE *)malloc(GetCompressBound(DataSizeCb));
+	SIZE_T CompressedSizeCb = CompressTestData(Filtered, DataSizeCb, Png->Compression, Random, Compressed);
+	free(Filtered);
+
+	// Every chunk, with IDATs of at least 1 byte, and the ancillary chunks.
+	SIZE_T Capacity = PNG_SIGNATURE_SIZE + 25 + (12 + 768) + (12 + 256) + 12 * (CompressedSizeCb + 1) + CompressedSizeCb + 3 * 32 + 12;
+	BYTE *Data = (BYTE *)malloc(Capacity);
+	static const BYTE Signature[PNG_SIGNATURE_SIZE] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	memcpy(Data, Signature, PNG_SIGNATURE_SIZE);
+	BYTE Header[13];
+	WriteBigEndian(Header, (DWORD)Png->Width);
+	WriteBigEndian(Header + 4, (DWORD)Png->Height);
+	Header[8] = Png->BitDepth;
+	Header[9] = Png->ColorType;
+	Header[10] = 0;
+	Header[11] = 0;
+	Header[12] = Png->Interlaced ? 1 : 0;
+	BYTE *p = WriteChunk(Data + PNG_SIGNATURE_SIZE, "IHDR", Header, sizeof(Header));
+	static const BYTE Gamma[4] = { 0, 0, 0xB1, 0x8F };
+	if (Png->ExtraChunks) p = WriteChunk(p, "gAMA", Gamma, sizeof(Gamma));
+	if (Png->PaletteSize != 0) p = WriteChunk(p, "PLTE", Png->Palette, Png->PaletteSize * 3);
+	if (Png->AlphaCount != 0) p = WriteChunk(p, "tRNS", Png->Alphas, Png->AlphaCount);
+	if (Png->Transparency && (Png->ColorType == PNG_GRAY || Png->ColorType == PNG_RGB))
+	{
+		BYTE Key[6];
+		for (UINT c = 0; c < Channels; ++c)
+		{
+			Key[c * 2] = (BYTE)(Png->Key[c] >> 8);
+			Key[c * 2 + 1] = (BYTE)Png->Key[c];
+		}
+		p = WriteChunk(p, "tRNS", Key, Channels * 2);
+	}
+	// A private chunk, safe to copy.
+	static const BYTE Private[] = "private";
+	if (Png->ExtraChunks) p = WriteChunk(p, "prVt", Private, sizeof(Private));
+	for (SIZE_T Offset = 0; Offset < CompressedSizeCb; )
+	{
+		SIZE_T Length = CompressedSizeCb - Offset;
+		if (!Png->SingleIdat)
+		{
+			DWORD r = TestRandom(Random) % 8;
+			Length = r == 0 ? 1 : r == 1 ? 0 : 1 + TestRandom(Random) % (r < 5 ? 64 : 16384);
+			Length = Length < CompressedSizeCb - Offset ? Length : CompressedSizeCb - Offset;
+		}
+		p = WriteChunk(p, "IDAT", Compressed + Offset, (DWORD)Length);
+		Offset += Length;
+	}
+	static const BYTE Text[] = "Comment\0Written after the image data";
+	if (Png->ExtraChunks) p = WriteChunk(p, "tEXt", Text, sizeof(Text) - 1);
+	p = WriteChunk(p, "IEND", nullptr, 0);
+	free(Compressed);
+	*SizeCb = p - Data;
+	return Data;
+}
+
+
+static BYTE ScaleSample(DWORD Sample, BYTE BitDepth)
+{
+	return (BYTE)(BitDepth == 16 ? Sample >> 8 : Sample * 255 / ((1u << BitDepth) - 1));
+}
+
+
+// The pixel at (x, y) as the decoder should produce it: BGRA, premultiplied with floor(c * a / 255 + 0.5).
+static DWORD GetExpectedPixel(const TEST_PNG *Png, LONG x, LONG y)
+{
+	UINT Channels = GetChannelCount(Png->ColorType);
+	const WORD *s = Png->Samples + ((SIZE_T)y * Png->Width + x) * Channels;
+	BYTE Depth = Png->BitDepth;
+	DWORD Red, Green, Blue, Alpha = 255;
+	switch (Png->ColorType)
+	{
+		case PNG_GRAY:
+			Red = Green = Blue = ScaleSample(s[0], Depth);
+			if (Png->Transparency && s[0] == Png->Key[0]) Alpha = 0;
+			break;
+		case PNG_RGB:
+			Red = ScaleSample(s[0], Depth);
+			Green = ScaleSample(s[1], Depth);
+			Blue = ScaleSample(s[2], Depth);
+			if (Png->Transparency && s[0] == Png->Key[0] && s[1] == Png->Key[1] && s[2] == Png->Key[2]) Alpha = 0;
+			break;
+		case PNG_PALETTE:
+			Red = s[0] < Png->PaletteSize ? Png->Palette[s[0] * 3] : 0;
+			Green = s[0] < Png->PaletteSize ? Png->Palette[s[0] * 3 + 1] : 0;
+			Blue = s[0] < Png->PaletteSize ? Png->Palette[s[0] * 3 + 2] : 0;
+			if (s[0] < Png->AlphaCount) Alpha = Png->Alphas[s[0]];
+			break;
+		case PNG_GRAY_ALPHA:
+			Red = Green = Blue = ScaleSample(s[0], Depth);
+			Alpha = ScaleSample(s[1], Depth);
+			break;
+		default:
+			Red = ScaleSample(s[0], Depth);
+			Green = ScaleSample(s[1], Depth);
+			Blue = ScaleSample(s[2], Depth);
+			Alpha = ScaleSample(s[3], Depth);
+			break;
+	}
+	Red = (Red * Alpha * 2 + 255) / 510;
+	Green = (Green * Alpha * 2 + 255) / 510;
+	Blue = (Blue * Alpha * 2 + 255) / 510;
+	return Alpha << 24 | Red << 16 | Green << 8 | Blue;
+}
+
+
+// Decodes a copy of the file in a block of exactly its size, so that the sanitizers see any read beyond it.
+static PIXEL_BUFFER *DecodeTestPng(const BYTE *Data, SIZE_T SizeCb, UINT ThreadCount)
+{
+	BYTE *Copy = (BYTE *)malloc(SizeCb != 0 ? SizeCb : 1);
+	memcpy(Copy, Data, SizeCb);
+	PNG_INFO Info;
+	PIXEL_BUFFER *Image = GetPngInfo(Copy, SizeCb, &Info) ? DecodePng(&Info, ThreadCount) : nullptr;
+	free(Copy);
+	return Image;
+}
+
+
+static BOOL IsDecodedCorrectly(const TEST_PNG *Png, const PIXEL_BUFFER *Image)
+{
+	if (Image == nullptr || Image->Width != Png->Width || Image->Height != Png->Height) return false;
+	BOOL HasAlpha = false;
+	for (LONG y = 0; y < Png->Height; ++y)
+	{
+		const DWORD *Row = (const DWORD *)(Image->Pixels + (SIZE_T)y * Image->Stride);
+		for (LONG x = 0; x < Png->Width; ++x)
+		{
+			DWORD Expected = GetExpectedPixel(Png, x, y);
+			if (Row[x] != Expected) return false;
+			HasAlpha |= Expected >> 24 != 0xFF;
+		}
+	}
+	return Image->HasAlpha == HasAlpha;
+}
+
+
+static void CheckDecoding(TEST_PNG *Png, DWORD *Random)
+{
+	SIZE_T SizeCb;
+	BYTE *Data = GenerateTestPng(Png, Random, &SizeCb);
+	for (UINT ThreadCount = 1; ThreadCount <= 2; ++ThreadCount)
+	{
+		PIXEL_BUFFER *Image = DecodeTestPng(Data, SizeCb, ThreadCount);
+		CHECK(IsDecodedCorrectly(Png, Image));
+		PixelBufferRelease(Image);
+	}
+	free(Png->Samples);
+	Png->Samples = nullptr;
+	free(Data);
+}
+
+
+void TestPngConformance()
+{
+	static const char *const CompressionNames[] = { "stored", "fixed", "dynamic", "mixed" };
+	DWORD Random = 1;
+	for (UINT f = 0; f < sizeof(Formats) / sizeof(Formats[0]); ++f)
+	{
+		for (int Interlaced = 0; Interlaced < 2; ++Interlaced)
+		{
+			for (BYTE Filter = 0; Filter <= TEST_FILTER_RANDOM; ++Filter)
+			{
+				for (BYTE Compression = 0; Compression < TEST_COMPRESSION_COUNT; ++Compression)
+				{
+					// The smallest images first, where Adam7 leaves passes empty.
+					LONG Width = Compression == 0 ? 1 + Filter : 1 + (LONG)(TestRandom(&Random) % MAX_TEST_PNG_SIZE);
+					LONG Height = Compression == 0 ? 1 + (Filter + 3) % 6 : 1 + (LONG)(TestRandom(&Random) % MAX_TEST_PNG_SIZE);
+					TEST_PNG Png;
+					InitTestPng(&Png, Width, Height, Formats[f][0], Formats[f][1]);
+					Png.Interlaced = Interlaced;
+					Png.Filter = Filter;
+					Png.Compression = Compression;
+					Png.Transparency = (Filter + Compression) % 2 != 0;
+					Png.ExtraChunks = Filter % 3 == Compression % 3;
+					TestSetContext("color type %u, %u bits, %d x %d%s, filter %u, %s%s%s", Png.ColorType, Png.BitDepth, (int)Width, (int)Height,
+						Interlaced ? ", interlaced" : "", Filter, CompressionNames[Compression], Png.Transparency ? ", tRNS" : "", Png.ExtraChunks ? ", extra chunks" : "");
+					CheckDecoding(&Png, &Random);
+				}
+			}
+		}
+	}
+}
+
+
+// Images large enough to be unfiltered on a second thread, in every format, both ways.
+void TestPngPipeline()
+{
+	DWORD Random = 2;
+	for (UINT f = 0; f < sizeof(Formats) / sizeof(Formats[0]); ++f)
+	{
+		UINT BitsPerPixel = GetChannelCount(Formats[f][0]) * Formats[f][1];
+		LONG Width = 500 + (LONG)(TestRandom(&Random) % 300);
+		LONG Height = (LONG)(PIPELINE_TEST_SIZE_CB * 8 / ((SIZE_T)Width * BitsPerPixel));
+		TEST_PNG Png;
+		InitTestPng(&Png, Width, Height, Formats[f][0], Formats[f][1]);
+		Png.Interlaced = f % 2 != 0;
+		Png.Filter = TEST_FILTER_RANDOM;
+		Png.Compression = TEST_MIXED;
+		Png.Transparency = true;
+		TestSetContext("color type %u, %u bits, %d x %d%s", Png.ColorType, Png.BitDepth, (int)Width, (int)Height, Png.Interlaced ? ", interlaced" : "");
+		CheckDecoding(&Png, &Random);
+	}
+}
+
+
+// A copy of Data with RemoveCb bytes at Offset replaced by Insert.
+static BYTE *SpliceBytes(const BYTE *Data, SIZE_T SizeCb, SIZE_T Offset, SIZE_T RemoveCb, const BYTE *Insert, SIZE_T InsertCb, SIZE_T *NewSizeCb)
+{
+	*NewSizeCb = SizeCb - RemoveCb + InsertCb;
+	BYTE *Result = (BYTE *)malloc(*NewSizeCb);
+	memcpy(Result, Data, Offset);
+	memcpy(Result + Offset, Insert, InsertCb);
+	memcpy(Result + Offset + InsertCb, Data + Offset + RemoveCb, SizeCb - Offset - RemoveCb);
+	return Result;
+}
+
+
+// The offset of the first chunk of Type, or 0.
+static SIZE_T FindChunk(const BYTE *Data, SIZE_T SizeCb, const char *Type)
+{
+	for (SIZE_T Offset = PNG_SIGNATURE_SIZE; Offset + 12 <= SizeCb; Offset += 12 + ReadBigEndian(Data + Offset))
+	{
+		if (memcmp(Data + Offset + 4, Type, 4) == 0) return Offset;
+	}
+	return 0;
+}
+
+
+static SIZE_T GetChunkSize(const BYTE *Data, SIZE_T Offset)
+{
+	return 12 + ReadBigEndian(Data + Offset);
+}
+
+
+static void UpdateCrc(BYTE *Chunk)
+{
+	DWORD Length = ReadBigEndian(Chunk);
+	WriteBigEndian(Chunk + 8 + Length, ComputeTestCrc32(Chunk + 4, 4 + Length));
+}
+
+
+static BOOL IsRejected(const BYTE *Data, SIZE_T SizeCb)
+{
+	BOOL Rejected = true;
+	for (UINT ThreadCount = 1; ThreadCount <= 2; ++ThreadCount)
+	{
+		PIXEL_BUFFER *Image = DecodeTestPng(Data, SizeCb, ThreadCount);
+		Rejected &= Image == nullptr;
+		PixelBufferRelease(Image);
+	}
+	return Rejected;
+}
+
+
+// Replaces the chunk at Offset, or inserts one there if Remove is false.
+static void CheckChunkRejected(const BYTE *Data, SIZE_T SizeCb, SIZE_T Offset, BOOL Remove, const char *Type, const BYTE *Content, DWORD Length)
+{
+	BYTE Chunk[12 + 1024];
+	SIZE_T ChunkSizeCb = WriteChunk(Chunk, Type, Content, Length) - Chunk;
+	SIZE_T NewSizeCb;
+	BYTE *Damaged = SpliceBytes(Data, SizeCb, Offset, Remove ? GetChunkSize(Data, Offset) : 0, Chunk, ChunkSizeCb, &NewSizeCb);
+	CHECK(IsRejected(Damaged, NewSizeCb));
+	free(Damaged);
+}
+
+
+// A gray image, Width pixels wide and 1 high, of the zlib stream that Writer has written after its first 2 bytes
+// (which are left for the header). The Adler-32 is not checked, so it is left out.
+static SIZE_T BuildGrayPng(BYTE Width, BYTE *Stream, BIT_WRITER *Writer, BYTE *Data)
+{
+	FlushBits(Writer);
+	Stream[0] = 0x78;
+	Stream[1] = 0x9C;
+	memset(Writer->Out, 0, 4);
+	static const BYTE Signature[PNG_SIGNATURE_SIZE] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	BYTE Header[13] = { 0, 0, 0, Width, 0, 0, 0, 1, 8, PNG_GRAY, 0, 0, 0 };
+	memcpy(Data, Signature, PNG_SIGNATURE_SIZE);
+	BYTE *p = WriteChunk(Data + PNG_SIGNATURE_SIZE, "IHDR", Header, sizeof(Header));
+	p = WriteChunk(p, "IDAT", Stream, (DWORD)(Writer->Out + 4 - Stream));
+	p = WriteChunk(p, "IEND", nullptr, 0);
+	return p - Data;
+}
+
+
+// 3 x 1 pixels: a zero filter byte and a fixed Huffman block of a literal 0 and a match of 3 bytes, Distance back.
+static SIZE_T BuildMatchPng(DWORD Distance, BYTE *Data)
+{
+	BYTE Stream[16];
+	BIT_WRITER Writer = { Stream + 2, 0, 0 };
+	PutBits(&Writer, 1, 1);
+	DEFLATE_SYMBOL Symbols[2] = { { 0, 0 }, { 3, (WORD)Distance } };
+	PutFixedBlock(&Writer, Symbols, 2);
+	return BuildGrayPng(3, Stream, &Writer, Data);
+}
+
+
+// 1 x 1 pixel of value 1, from a dynamic block whose literal/length code has the 1 bit code 0 for literal 0, and the
+// 2 bit codes 10 for literal 1 and 11 for the end of the block. Over-subscribed adds literal 2 with 2 bits, which leaves
+// the end of the block with a code that does not fit in 2 bits; if that was let through, it would take the place of
+// the first entries, and the data would still decode.
+static SIZE_T BuildCodeLengthsPng(BOOL OverSubscribed, BYTE *Data)
+{
+	BYTE Stream[64];
+	BIT_WRITER Writer = { Stream + 2, 0, 0 };
+	PutBits(&Writer, 1 | 2 << 1, 3);
+	PutBits(&Writer, 257 - 257, 5);
+	PutBits(&Writer, 1 - 1, 5);
+	// Code length codes 0, 1, 2 and 18, all with 2 bits; the last one sent is that of 1.
+	PutBits(&Writer, 18 - 4, 4);
+	for (UINT i = 0; i < 18; ++i)
+	{
+		BYTE Symbol = PrecodeOrder[i];
+		PutBits(&Writer, Symbol <= 2 || Symbol == 18 ? 2 : 0, 3);
+	}
+	static const BYTE PrecodeCodes[PRECODE_SYMBOLS] = { 0, 1, 2, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 3 };
+	PutCode(&Writer, PrecodeCodes[1], 2);
+	PutCode(&Writer, PrecodeCodes[2], 2);
+	PutCode(&Writer, PrecodeCodes[OverSubscribed ? 2 : 0], 2);
+	// 253 zeros for literals 3 to 255.
+	PutCode(&Writer, PrecodeCodes[18], 2);
+	PutBits(&Writer, 138 - 11, 7);
+	PutCode(&Writer, PrecodeCodes[18], 2);
+	PutBits(&Writer, 115 - 11, 7);
+	PutCode(&Writer, PrecodeCodes[2], 2);
+	PutCode(&Writer, PrecodeCodes[0], 2);
+	// The filter byte, the pixel and the end of the block.
+	PutCode(&Writer, 0, 1);
+	PutCode(&Writer, 2, 2);
+	PutCode(&Writer, OverSubscribed ? 4 : 3, 2);
+	return BuildGrayPng(1, Stream, &Writer, Data);
+}
+
+
+void TestPngCorrupt()
+{
+	DWORD Random = 3;
+	TEST_PNG Png;
+	SIZE_T SizeCb, NewSizeCb;
+
+	// Cut off anywhere, or with any bit flipped that a CRC covers: all of it, except for the CRC of IEND.
+	for (UINT Base = 0; Base < 2; ++Base)
+	{
+		InitTestPng(&Png, 13, 11, Base == 0 ? PNG_RGBA : PNG_PALETTE, Base == 0 ? 8 : 2);
+		Png.Interlaced = Base == 0;
+		Png.Filter = TEST_FILTER_RANDOM;
+		Png.Compression = TEST_MIXED;
+		BYTE *Data = GenerateTestPng(&Png, &Random, &SizeCb);
+		free(Png.Samples);
+		BOOL Truncated = true;
+		BOOL Flipped = true;
+		for (SIZE_T i = 0; i < SizeCb; ++i)
+		{
+			Truncated &= IsRejected(Data, i);
+			if (i >= SizeCb - 4) continue;
+			BYTE Bit = (BYTE)(1 << TestRandom(&Random) % 8);
+			Data[i] ^= Bit;
+			Flipped &= IsRejected(Data, SizeCb);
+			Data[i] ^= Bit;
+		}
+		TestSetContext("%s", Base == 0 ? "RGBA" : "palette");
+		CHECK(Truncated);
+		CHECK(Flipped);
+		TestSetContext("");
+		free(Data);
+	}
+
+	// Damaged compressed data with valid CRCs: whatever it decodes to (if anything), it is the same on two threads.
+	InitTestPng(&Png, 29, 7, PNG_RGB, 8);
+	Png.Filter = TEST_FILTER_RANDOM;
+	Png.Compression = TEST_MIXED;
+	Png.SingleIdat = true;
+	BYTE *Data = GenerateTestPng(&Png, &Random, &SizeCb);
+	free(Png.Samples);
+	SIZE_T Idat = FindChunk(Data, SizeCb, "IDAT");
+	BOOL Consistent = true;
+	for (SIZE_T i = Idat + 8; i < Idat + GetChunkSize(Data, Idat) - 4; ++i)
+	{
+		BYTE Bit = (BYTE)(1 << TestRandom(&Random) % 8);
+		Data[i] ^= Bit;
+		UpdateCrc(Data + Idat);
+		PIXEL_BUFFER *Images[2] = { DecodeTestPng(Data, SizeCb, 1), DecodeTestPng(Data, SizeCb, 2) };
+		Consistent &= (Images[0] == nullptr) == (Images[1] == nullptr);
+		Consistent &= Images[0] == nullptr || Images[1] == nullptr || memcmp(Images[0]->Pixels, Images[1]->Pixels, Images[0]->SizeCb) == 0;
+		PixelBufferRelease(Images[0]);
+		PixelBufferRelease(Images[1]);
+		Data[i] ^= Bit;
+	}
+	UpdateCrc(Data + Idat);
+	CHECK(Consistent);
+
+	// The zlib header: a window beyond 32 KB, another method, a wrong check, a preset dictionary. Then a block of the
+	// reserved type 3.
+	static const BYTE ZlibHeaders[][2] = { { 0x88, 0x98 }, { 0x77, 0x9C }, { 0x78, 0x9D }, { 0x78, 0xBB } };
+	for (UINT i = 0; i < sizeof(ZlibHeaders) / sizeof(ZlibHeaders[0]); ++i)
+	{
+		BYTE Saved[3];
+		memcpy(Saved, Data + Idat + 8, 3);
+		memcpy(Data + Idat + 8, ZlibHeaders[i], 2);
+		UpdateCrc(Data + Idat);
+		TestSetContext("zlib header %02X %02X", ZlibHeaders[i][0], ZlibHeaders[i][1]);
+		CHECK(IsRejected(Data, SizeCb));
+		memcpy(Data + Idat + 8, Saved, 3);
+		Data[Idat + 10] |= 6;
+		UpdateCrc(Data + Idat);
+		CHECK(IsRejected(Data, SizeCb));
+		memcpy(Data + Idat + 8, Saved, 3);
+		UpdateCrc(Data + Idat);
+	}
+	TestSetContext("");
+	CHECK(!IsRejected(Data, SizeCb));
+
+	// The Adler-32 is not checked, and what follows the last block is ignored.
+	Data[Idat + GetChunkSize(Data, Idat) - 5] ^= 0x10;
+	UpdateCrc(Data + Idat);
+	CHECK(!IsRejected(Data, SizeCb));
+	static const BYTE Trailer[] = { 0x12, 0x34 };
+	BYTE *Longer = SpliceBytes(Data, SizeCb, Idat + GetChunkSize(Data, Idat) - 4, 0, Trailer, sizeof(Trailer), &NewSizeCb);
+	WriteBigEndian(Longer + Idat, ReadBigEndian(Longer + Idat) + sizeof(Trailer));
+	UpdateCrc(Longer + Idat);
+	CHECK(!IsRejected(Longer, NewSizeCb));
+	free(Longer);
+	free(Data);
+
+	// A stored block whose length does not match its complement.
+	InitTestPng(&Png, 5, 5, PNG_GRAY, 8);
+	Png.Compression = TEST_STORED;
+	Png.SingleIdat = true;
+	Data = GenerateTestPng(&Png, &Random, &SizeCb);
+	free(Png.Samples);
+	Idat = FindChunk(Data, SizeCb, "IDAT");
+	CHECK(!IsRejected(Data, SizeCb));
+	BYTE *Stored = Data + Idat + 8 + 2;
+	while ((Stored[1] | Stored[2] << 8) == 0) Stored += 5;
+	Stored[3] ^= 1;
+	UpdateCrc(Data + Idat);
+	CHECK(IsRejected(Data, SizeCb));
+	free(Data);
+
+	// Matches from before the start of the data are refused; the same match from within is fine.
+	BYTE Small[128];
+	CHECK(!IsRejected(Small, BuildMatchPng(1, Small)));
+	CHECK(IsRejected(Small, BuildMatchPng(2, Small)));
+
+	// An invalid filter type in the first, a middle or the last row, and image data that is a byte short or too long,
+	// also on two threads.
+	for (UINT Large = 0; Large < 2; ++Large)
+	{
+		LONG Height = Large ? 1100 : 9;
+		for (UINT Case = 0; Case < 5; ++Case)
+		{
+			InitTestPng(&Png, Large ? 400 : 17, Height, PNG_RGB, 8);
+			Png.Filter = TEST_FILTER_RANDOM;
+			Png.Compression = TEST_MIXED;
+			Png.BadFilterRow = Case == 0 ? 0 : Case == 1 ? Height / 2 : Case == 2 ? Height - 1 : -1;
+			Png.BadFilter = Case == 0 ? 5 : Case == 1 ? 255 : (BYTE)(6 + TestRandom(&Random) % 249);
+			Png.SizeError = Case == 3 ? -1 : Case == 4 ? 1 : 0;
+			Data = GenerateTestPng(&Png, &Random, &SizeCb);
+			free(Png.Samples);
+			TestSetContext("%d rows, filter %u in row %d, %d bytes too many", (int)Height, Png.BadFilter, (int)Png.BadFilterRow, Png.SizeError);
+			CHECK(IsRejected(Data, SizeCb));
+			free(Data);
+		}
+	}
+	TestSetContext("");
+
+	// Headers and chunks.
+	InitTestPng(&Png, 6, 4, PNG_PALETTE, 4);
+	Png.Transparency = true;
+	Png.SingleIdat = true;
+	Data = GenerateTestPng(&Png, &Random, &SizeCb);
+	free(Png.Samples);
+	SIZE_T Header = FindChunk(Data, SizeCb, "IHDR");
+	SIZE_T Palette = FindChunk(Data, SizeCb, "PLTE");
+	SIZE_T Transparency = FindChunk(Data, SizeCb, "tRNS");
+	Idat = FindChunk(Data, SizeCb, "IDAT");
+	SIZE_T End = FindChunk(Data, SizeCb, "IEND");
+	CHECK(Header != 0 && Palette != 0 && Transparency != 0 && Idat != 0 && End != 0);
+	CHECK(!IsRejected(Data, SizeCb));
+	BYTE Content[1024];
+	memcpy(Content, Data + Header + 8, 13);
+	for (BYTE ColorType = 0; ColorType < 8; ++ColorType)
+	{
+		for (BYTE BitDepth = 0; BitDepth <= 17; ++BitDepth)
+		{
+			BOOL Valid = false;
+			for (UINT f = 0; f < sizeof(Formats) / sizeof(Formats[0]); ++f) Valid |= Formats[f][0] == ColorType && Formats[f][1] == BitDepth;
+			if (Valid) continue;
+			Content[8] = BitDepth;
+			Content[9] = ColorType;
+			TestSetContext("color type %u, %u bits", ColorType, BitDepth);
+			CheckChunkRejected(Data, SizeCb, Header, true, "IHDR", Content, 13);
+		}
+	}
+	TestSetContext("");
+	memcpy(Content, Data + Header + 8, 13);
+	// Compression method, filter method, interlace method; a width and a height of 0 and 2^31, and 2^31 - 1 for a
+	// file this small.
+	static const BYTE Fields[][2] = { { 10, 1 }, { 11, 1 }, { 12, 2 }, { 3, 0 }, { 7, 0 } };
+	for (UINT i = 0; i < sizeof(Fields) / sizeof(Fields[0]); ++i)
+	{
+		BYTE Saved = Content[Fields[i][0]];
+		Content[Fields[i][0]] = Fields[i][1];
+		CheckChunkRejected(Data, SizeCb, Header, true, "IHDR", Content, 13);
+		Content[Fields[i][0]] = Saved;
+	}
+	for (UINT i = 0; i < 2; ++i)
+	{
+		BYTE Saved[4];
+		memcpy(Saved, Content + i * 4, 4);
+		WriteBigEndian(Content + i * 4, 0x80000000);
+		CheckChunkRejected(Data, SizeCb, Header, true, "IHDR", Content, 13);
+		WriteBigEndian(Content + i * 4, 0x7FFFFFFF);
+		CheckChunkRejected(Data, SizeCb, Header, true, "IHDR", Content, 13);
+		memcpy(Content + i * 4, Saved, 4);
+	}
+	CheckChunkRejected(Data, SizeCb, Header, true, "IHDR", Content, 12);
+	CheckChunkRejected(Data, SizeCb, Palette, false, "IHDR", Content, 13);
+	CheckChunkRejected(Data, SizeCb, Header, false, "gAMA", Content, 4);
+
+	// The palette: missing, empty, not whole entries, too many entries, twice, or after the image data.
+	memset(Content, 0x80, sizeof(Content));
+	CheckChunkRejected(Data, SizeCb, Palette, true, "tEXt", Content, 0);
+	CheckChunkRejected(Data, SizeCb, Palette, true, "PLTE", Content, 0);
+	CheckChunkRejected(Data, SizeCb, Palette, true, "PLTE", Content, 16);
+	CheckChunkRejected(Data, SizeCb, Palette, true, "PLTE", Content, 257 * 3);
+	CheckChunkRejected(Data, SizeCb, Transparency, false, "PLTE", Content, 48);
+	CheckChunkRejected(Data, SizeCb, End, false, "PLTE", Content, 48);
+	// tRNS twice or after the image data; no image data, or split by another chunk; an unknown critical chunk.
+	CheckChunkRejected(Data, SizeCb, Idat, false, "tRNS", Content, 3);
+	CheckChunkRejected(Data, SizeCb, End, false, "tRNS", Content, 3);
+	CheckChunkRejected(Data, SizeCb, Idat, true, "tEXt", Content, 0);
+	CheckChunkRejected(Data, SizeCb, Idat, false, "ABCD", Content, 0);
+	// The image data in two IDAT chunks, with another chunk in between. That one holds the second half too, so that
+	// reading it as image data would even work.
+	DWORD IdatLength = ReadBigEndian(Data + Idat);
+	DWORD Half = IdatLength / 2;
+	BYTE Chunks[3 * 12 + 2 * 1024];
+	CHECK(IdatLength <= 1024);
+	BYTE *p = WriteChunk(Chunks, "IDAT", Data + Idat + 8, Half);
+	BYTE *Between = p;
+	p = WriteChunk(p, "tEXt", Data + Idat + 8 + Half, IdatLength - Half);
+	BYTE *Second = p;
+	p = WriteChunk(p, "IDAT", Data + Idat + 8 + Half, IdatLength - Half);
+	BYTE *Split = SpliceBytes(Data, SizeCb, Idat, GetChunkSize(Data, Idat), Chunks, p - Chunks, &NewSizeCb);
+	CHECK(IsRejected(Split, NewSizeCb));
+	free(Split);
+	memmove(Between, Second, p - Second);
+	p -= Second - Between;
+	Split = SpliceBytes(Data, SizeCb, Idat, GetChunkSize(Data, Idat), Chunks, p - Chunks, &NewSizeCb);
+	CHECK(!IsRejected(Split, NewSizeCb));
+	free(Split);
+	// A damaged tRNS is not just ignored.
+	Data[Transparency + 8] ^= 1;
+	CHECK(IsRejected(Data, SizeCb));
+	Data[Transparency + 8] ^= 1;
+	free(Data);
+
+	// Gray images must not have a palette, and a tRNS that is too short for them is ignored: no gray level becomes
+	// transparent.
+	InitTestPng(&Png, 16, 16, PNG_GRAY, 8);
+	Png.Ramp = true;
+	Data = GenerateTestPng(&Png, &Random, &SizeCb);
+	Idat = FindChunk(Data, SizeCb, "IDAT");
+	CheckChunkRejected(Data, SizeCb, Idat, false, "PLTE", Content, 48);
+	BYTE Chunk[12 + 1];
+	Content[0] = 0;
+	WriteChunk(Chunk, "tRNS", Content, 1);
+	BYTE *ShortKey = SpliceBytes(Data, SizeCb, Idat, 0, Chunk, sizeof(Chunk), &NewSizeCb);
+	PIXEL_BUFFER *Image = DecodeTestPng(ShortKey, NewSizeCb, 1);
+	CHECK(IsDecodedCorrectly(&Png, Image));
+	PixelBufferRelease(Image);
+	free(ShortKey);
+	free(Png.Samples);
+	free(Data);
+
+	// Over-subscribed code lengths, next to the same code without the extra literal.
+	Image = DecodeTestPng(Small, BuildCodeLengthsPng(false, Small), 1);
+	CHECK(Image != nullptr && *(const DWORD *)Image->Pixels == 0xFF010101);
+	PixelBufferRelease(Image);
+	CHECK(IsRejected(Small, BuildCodeLengthsPng(true, Small)));
+}
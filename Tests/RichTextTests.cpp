@@ -0,0 +1,268 @@
+// Feeds ParseClipboardHtml, RtfNextToken and RtfExtract the malformed payloads of GenerateMalformedRichText and valid
+// ones, and then thousands of mutations of them: flipped bits, bytes that mean something to the parsers, inserted
+// markup, deleted and repeated ranges, and truncation. Whatever they make of them must point into the payload, and
+// must never read beyond it (which the sanitizers see, since every payload is copied into a block of its exact size).
+
+#include "Test.h"
+#include "ClipboardHtml.h"
+#include "PayloadGenerator.h"
+#include "RtfTokenizer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_RICH_TEXT_PAYLOADS 80
+#define VALID_PAYLOAD_COUNT 4
+#define MUTATIONS_PER_PAYLOAD 300
+// Payloads larger than this (the deep nesting) are mutated less often.
+#define LARGE_PAYLOAD_SIZE (64 * 1024)
+#define LARGE_PAYLOAD_MUTATIONS 12
+
+enum TEST_MUTATION
+{
+	MUTATE_FLIP_BIT,
+	MUTATE_SET_BYTE,
+	MUTATE_INSERT,
+	MUTATE_DELETE,
+	MUTATE_REPEAT,
+	MUTATE_TRUNCATE,
+	MUTATE_HEADER_LINES,    // A pair of CF_HTML offsets that point anywhere, often close to the end, after the first line.
+	MUTATION_COUNT,
+};
+
+
+static BOOL IsWithin(const BYTE *p, SIZE_T SizeCb, const BYTE *Data, SIZE_T DataSizeCb)
+{
+	return p >= Data && SizeCb <= DataSizeCb && p - Data <= (ptrdiff_t)(DataSizeCb - SizeCb);
+}
+
+
+// Applies one to four mutations to Data, which has room for Capacity bytes. Returns the new size.
+static SIZE_T MutatePayload(BYTE *Data, SIZE_T SizeCb, SIZE_T Capacity, DWORD *Random)
+{
+	static const char Bytes[] = "{}\\'*0123456789-uc \r\n<>!:";
+	static const char *const OffsetNames[] = { "HTML", "Fragment", "Selection" };
+	static const char *const Snippets[] =
+	{
+		"\\bin5 ", "\\bin99999999999 ", "{\\*\\", "\\'", "\\'f", "\\u-", "\\uc2 ", "\\u8364?", "{\\fonttbl", "{\\pict ", "\\par ",
+		"<!--StartFragment-->", "<!--EndFragment-->", "StartHTML:", "EndHTML:", "StartFragment:", "EndFragment:",
+		"StartSelection:", "EndSelection:", "SourceURL:", "-1", "0000000000", "99999999999999999999", "\r\n",
+	};
+	UINT Count = 1 + TestRandom(Random) % 4;
+	for (UINT i = 0; i < Count; ++i)
+	{
+		SIZE_T Position = SizeCb != 0 ? TestRandom(Random) % SizeCb : 0;
+		SIZE_T Length = 1 + TestRandom(Random) % (TestRandom(Random) % 4 == 0 ? 4096 : 16);
+		switch (TestRandom(Random) % MUTATION_COUNT)
+		{
+			case MUTATE_FLIP_BIT:
+				if (SizeCb != 0) Data[Position] ^= (BYTE)(1 << TestRandom(Random) % 8);
+				break;
+			case MUTATE_SET_BYTE:
+				if (SizeCb != 0) Data[Position] = TestRandom(Random) % 8 == 0 ? 0 : (BYTE)Bytes[TestRandom(Random) % (sizeof(Bytes) - 1)];
+				break;
+			case MUTATE_INSERT:
+			{
+				const char *Snippet = Snippets[TestRandom(Random) % (sizeof(Snippets) / sizeof(Snippets[0]))];
+				SIZE_T SnippetSizeCb = strlen(Snippet);
+				if (SizeCb + SnippetSizeCb > Capacity) break;
+				memmove(Data + Position + SnippetSizeCb, Data + Position, SizeCb - Position);
+				memcpy(Data + Position, Snippet, SnippetSizeCb);
+				SizeCb += SnippetSizeCb;
+				break;
+			}
+			case MUTATE_DELETE:
+				Length = Length < SizeCb - Position ? Length : SizeCb - Position;
+				memmove(Data + Position, Data + Position + Length, SizeCb - Position - Length);
+				SizeCb -= Length;
+				break;
+			case MUTATE_REPEAT:
+				Length = Length < SizeCb - Position ? Length : SizeCb - Position;
+				if (SizeCb + Length > Capacity) break;
+				memmove(Data + Position + Length, Data + Position, SizeCb - Position);
+				SizeCb += Length;
+				break;
+			case MUTATE_TRUNCATE:
+				SizeCb = Position;
+				break;
+			case MUTATE_HEADER_LINES:
+			{
+				const BYTE *LineEnd = (const BYTE *)memchr(Data, '\n', SizeCb);
+				Position = LineEnd != nullptr ? LineEnd + 1 - Data : 0;
+				int Offsets[2];
+				for (UINT k = 0; k < 2; ++k)
+				{
+					DWORD r = TestRandom(Random) % 8;
+					Offsets[k] = r == 0 ? -1 : r < 4 ? (int)(TestRandom(Random) % (SizeCb + 64)) : (int)(SizeCb + 8 - TestRandom(Random) % 24);
+				}
+				const char *Name = OffsetNames[TestRandom(Random) % 3];
+				char Lines[128];
+				SIZE_T LinesSizeCb = snprintf(Lines, sizeof(Lines), "Start%s:%010d\r\nEnd%s:%010d\r\n", Name, Offsets[0], Name, Offsets[1]);
+				if (SizeCb + LinesSizeCb > Capacity) break;
+				memmove(Data + Position + LinesSizeCb, Data + Position, SizeCb - Position);
+				memcpy(Data + Position, Lines, LinesSizeCb);
+				SizeCb += LinesSizeCb;
+				break;
+			}
+		}
+	}
+	return SizeCb;
+}
+
+
+static BOOL IsHtmlParsedSafely(const BYTE *Data, SIZE_T SizeCb)
+{
+	CLIPBOARD_HTML Html;
+	if (!ParseClipboardHtml(Data, SizeCb, &Html)) return true;
+	BOOL Safe = IsWithin(Html.Document, Html.DocumentSizeCb, Data, SizeCb);
+	// The fragment is always within the document.
+	Safe &= IsWithin(Html.Fragment, Html.FragmentSizeCb, Html.Document, Html.DocumentSizeCb);
+	Safe &= Html.Version == nullptr || IsWithin(Html.Version, Html.VersionSizeCb, Data, SizeCb);
+	Safe &= Html.Selection == nullptr || IsWithin(Html.Selection, Html.SelectionSizeCb, Html.Document, Html.DocumentSizeCb);
+	Safe &= Html.SourceUrl == nullptr || IsWithin(Html.SourceUrl, Html.SourceUrlSizeCb, Data, SizeCb);
+	return Safe;
+}
+
+
+// Every token moves forward, lies within the payload, and the tokens end.
+static BOOL IsRtfTokenizedSafely(const BYTE *Data, SIZE_T SizeCb)
+{
+	RTF_TOKENIZER Tokenizer;
+	RTF_TOKEN Token;
+	RtfTokenizerInit(&Tokenizer, Data, SizeCb);
+	BOOL Safe = true;
+	SIZE_T Count = 0;
+	SIZE_T End = 0;
+	while (RtfNextToken(&Tokenizer, &Token))
+	{
+		Safe &= Count == 0 || Token.Offset >= End;
+		Safe &= Token.Type != RTF_TOKEN_END && IsWithin(Token.Data, Token.SizeCb, Data, SizeCb) && Token.Data >= Data + Token.Offset;
+		End = Token.Data + Token.SizeCb - Data;
+		// Only \bin data at the very end is empty.
+		Safe &= End > Token.Offset || (Token.Type == RTF_TOKEN_BINARY && End == SizeCb);
+		if (!Safe || ++Count > SizeCb) return false;
+	}
+	return Safe && Token.Type == RTF_TOKEN_END && Token.Offset <= SizeCb;
+}
+
+
+// Anything that starts like RTF is extracted, the same way every time, and the outline points into the payload.
+static BOOL IsRtfExtractedSafely(const BYTE *Data, SIZE_T SizeCb)
+{
+	RTF_DOCUMENT Document;
+	BOOL IsRtf = SizeCb >= 5 && memcmp(Data, "{\\rtf", 5) == 0;
+	if (!RtfExtract(Data, SizeCb, &Document)) return !IsRtf;
+	BOOL Safe = IsRtf && Document.Text != nullptr && Document.Text[Document.TextLength] == 0;
+	Safe &= Document.OutlineCount <= RTF_MAX_OUTLINE_ENTRIES && (Document.OutlineCount == 0 || Document.MaxDepth >= 1);
+	for (UINT i = 0; Safe && i < Document.OutlineCount; ++i)
+	{
+		const RTF_OUTLINE_ENTRY *Entry = &Document.Outline[i];
+		Safe &= Entry->Depth >= 1 && Entry->Depth <= Document.MaxDepth;
+		Safe &= IsWithin(Data + Entry->Offset, Entry->SizeCb, Data, SizeCb) && IsWithin(Entry->Name, Entry->NameSizeCb, Data, SizeCb);
+	}
+	RTF_DOCUMENT Again;
+	if (Safe && RtfExtract(Data, SizeCb, &Again))
+	{
+		Safe &= Again.TextLength == Document.TextLength && Again.OutlineCount == Document.OutlineCount;
+		Safe &= Safe && memcmp(Again.Text, Document.Text, Document.TextLength * sizeof(WCHAR)) == 0;
+		RtfDocumentFree(&Again);
+	}
+	RtfDocumentFree(&Document);
+	return Safe;
+}
+
+
+// Copies the payload into a block of exactly its size, and runs every parser over it.
+static BOOL IsParsedSafely(const BYTE *Data, SIZE_T SizeCb)
+{
+	BYTE *Copy = (BYTE *)malloc(SizeCb != 0 ? SizeCb : 1);
+	if (Copy == nullptr) return false;
+	memcpy(Copy, Data, SizeCb);
+	BOOL Safe = IsHtmlParsedSafely(Copy, SizeCb) && IsRtfTokenizedSafely(Copy, SizeCb) && IsRtfExtractedSafely(Copy, SizeCb);
+	free(Copy);
+	return Safe;
+}
+
+
+// The malformed payloads and a few valid ones. Returns the number of payloads.
+static UINT GenerateRichTextPayloads(GENERATED_PAYLOAD *Payloads)
+{
+	UINT Count = GenerateMalformedRichText(24, Payloads, MAX_RICH_TEXT_PAYLOADS - VALID_PAYLOAD_COUNT);
+	for (UINT i = 0; i < VALID_PAYLOAD_COUNT; ++i)
+	{
+		GENERATED_PAYLOAD *Payload = &Payloads[Count++];
+		Payload->Name = i % 2 == 0 ? "html-valid" : "rtf-valid";
+		Payload->Data = i % 2 == 0 ? GenerateHtmlFormat(2000 + 3000 * i, i, &Payload->SizeCb) : GenerateRtf(2000 + 3000 * i, i, &Payload->SizeCb);
+	}
+	return Count;
+}
+
+
+void TestRichTextMalformed()
+{
+	GENERATED_PAYLOAD Payloads[MAX_RICH_TEXT_PAYLOADS];
+	UINT Count = GenerateRichTextPayloads(Payloads);
+	CHECK(Count > VALID_PAYLOAD_COUNT);
+	for (UINT i = 0; i < Count; ++i)
+	{
+		TestSetContext("%s (payload %u)", Payloads[i].Name, i);
+		if (!CHECK(Payloads[i].Data != nullptr)) continue;
+		CHECK(IsParsedSafely(Payloads[i].Data, Payloads[i].SizeCb));
+	}
+
+	// The valid payloads are understood as intended.
+	for (UINT i = Count - VALID_PAYLOAD_COUNT; i < Count; ++i)
+	{
+		const GENERATED_PAYLOAD *Payload = &Payloads[i];
+		TestSetContext("%s (payload %u)", Payload->Name, i);
+		if (Payload->Data == nullptr) continue;
+		if (strcmp(Payload->Name, "html-valid") == 0)
+		{
+			CLIPBOARD_HTML Html;
+			CHECK(ParseClipboardHtml(Payload->Data, Payload->SizeCb, &Html) && Html.OffsetsValid);
+			CHECK(Html.Fragment >= Payload->Data + 20 && memcmp(Html.Fragment - 20, "<!--StartFragment-->", 20) == 0);
+			CHECK(memcmp(Html.Fragment + Html.FragmentSizeCb, "<!--EndFragment-->", 18) == 0);
+			CHECK(Html.SourceUrl != nullptr && Html.SourceUrlSizeCb > 8 && memcmp(Html.SourceUrl, "https://", 8) == 0);
+		}
+		else
+		{
+			RTF_DOCUMENT Document;
+			CHECK(RtfExtract(Payload->Data, Payload->SizeCb, &Document) && Document.TextLength > 1000 && Document.OutlineCount != 0);
+			RtfDocumentFree(&Document);
+		}
+	}
+	TestSetContext("");
+	FreeGeneratedPayloads(Payloads, Count);
+}
+
+
+// The same seeds every run, so that a failure can be repeated; the context names the payload and the mutation.
+void TestRichTextMutated()
+{
+	GENERATED_PAYLOAD Payloads[MAX_RICH_TEXT_PAYLOADS];
+	UINT Count = GenerateRichTextPayloads(Payloads);
+	DWORD Random = 25;
+	for (UINT i = 0; i < Count; ++i)
+	{
+		const GENERATED_PAYLOAD *Payload = &Payloads[i];
+		if (Payload->Data == nullptr) continue;
+		BOOL Large = Payload->SizeCb > LARGE_PAYLOAD_SIZE;
+		SIZE_T Capacity = Payload->SizeCb + 4 * 4096 + 64;
+		BYTE *Mutant = (BYTE *)malloc(Capacity);
+		if (!CHECK(Mutant != nullptr)) break;
+		UINT MutationCount = Large ? LARGE_PAYLOAD_MUTATIONS : MUTATIONS_PER_PAYLOAD;
+		BOOL Safe = true;
+		for (UINT m = 0; m < MutationCount && Safe; ++m)
+		{
+			DWORD Seed = Random;
+			memcpy(Mutant, Payload->Data, Payload->SizeCb);
+			SIZE_T SizeCb = MutatePayload(Mutant, Payload->SizeCb, Capacity, &Random);
+			Safe = IsParsedSafely(Mutant, SizeCb);
+			TestSetContext("%s (payload %u), mutation %u from seed %u", Payload->Name, i, m, (UINT)Seed);
+		}
+		CHECK(Safe);
+		free(Mutant);
+	}
+	TestSetContext("");
+	FreeGeneratedPayloads(Payloads, Count);
+}
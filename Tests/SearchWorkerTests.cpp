@@ -0,0 +1,223 @@
+// Holds the search worker in Notify to replace the query it is about to answer, and the one it is going to answer
+// again, checks the answers given before and after documents are indexed, and drops texts over the budget.
+
+#include "Test.h"
+#include "SearchWorker.h"
+#include <stdlib.h>
+#include <string.h>
+#include <mutex>
+#include <condition_variable>
+
+#define TEST_TEXT_LENGTH 1000
+#define TEST_KEPT_TEXTS 100
+
+// Notify returns once it is given a permit, so that the worker can be held right after an answer.
+static std::mutex GateLock;
+static std::condition_variable GateCondition;
+static UINT GatePermits;
+static UINT GateArrivals;
+
+
+static void WaitAtGate(void *Context)
+{
+	std::unique_lock<std::mutex> Lock(GateLock);
+	++GateArrivals;
+	GateCondition.notify_all();
+	while (GatePermits == 0)
+	{
+		GateCondition.wait(Lock);
+	}
+	--GatePermits;
+}
+
+
+static void OpenGate(UINT Permits)
+{
+	{
+		std::lock_guard<std::mutex> Lock(GateLock);
+		GatePermits += Permits;
+	}
+	GateCondition.notify_all();
+}
+
+
+// Waits until Notify has been called Count times in all.
+static BOOL WaitForArrivals(UINT Count)
+{
+	std::unique_lock<std::mutex> Lock(GateLock);
+	return GateCondition.wait_for(Lock, std::chrono::seconds(10), [Count] { return GateArrivals >= Count; });
+}
+
+
+static BOOL Query(SEARCH_WORKER *Worker, const char *String)
+{
+	WCHAR Pattern[64];
+	SIZE_T Length = 0;
+	for (; String[Length] != 0; ++Length) Pattern[Length] = (WCHAR)(BYTE)String[Length];
+	return SearchWorkerQuery(Worker, Pattern, Length);
+}
+
+
+static BOOL AddText(SEARCH_WORKER *Worker, ULONGLONG Id, const char *String)
+{
+	WCHAR Text[TEST_TEXT_LENGTH];
+	SIZE_T Length = 0;
+	for (; String[Length] != 0; ++Length) Text[Length] = (WCHAR)(BYTE)String[Length];
+	return SearchWorkerAddText(Worker, Id, Text, Length, (LONGLONG)Id * 10);
+}
+
+
+// Gives up after a few seconds.
+static SEARCH_QUERY *WaitForResult(SEARCH_WORKER *Worker)
+{
+	ULONGLONG StartUs = GetMonotonicTimeUs();
+	while (GetMonotonicTimeUs() - StartUs < 10000000)
+	{
+		SEARCH_QUERY *Query = SearchWorkerGetResult(Worker);
+		if (Query != nullptr) return Query;
+		std::this_thread::yield();
+	}
+	CHECK(!"timed out");
+	return nullptr;
+}
+
+
+static BOOL IsPattern(const SEARCH_QUERY *Query, const char *String)
+{
+	SIZE_T Length = strlen(String);
+	if (Query->PatternLength != Length) return false;
+	for (SIZE_T i = 0; i < Length; ++i)
+	{
+		if (Query->Pattern[i] != (WCHAR)(BYTE)String[i]) return false;
+	}
+	return true;
+}
+
+
+void TestSearchWorkerGenerations()
+{
+	static SEARCH_WORKER Worker;
+	GatePermits = 0;
+	GateArrivals = 0;
+	if (!CHECK(SearchWorkerStart(&Worker, nullptr, 1 << 20, WaitAtGate, nullptr))) return;
+	CHECK(AddText(&Worker, 1, "An old needle in a haystack"));
+	CHECK(AddText(&Worker, 2, "Nothing to see here"));
+
+	// Until it has been answered with both documents indexed. The worker is then held in Notify.
+	CHECK(Query(&Worker, "NEEDLE"));
+	SEARCH_QUERY *Answer = nullptr;
+	for (UINT Arrivals = 1; Arrivals <= 2 && CHECK(WaitForArrivals(Arrivals)); ++Arrivals)
+	{
+		Answer = SearchWorkerGetResult(&Worker);
+		if (!CHECK(Answer != nullptr) || Answer->Complete) break;
+		SearchQueryFree(Answer);
+		Answer = nullptr;
+		OpenGate(1);
+	}
+	if (!CHECK(Answer != nullptr && Answer->ResultCount == 1 && Answer->Results[0].Id == 1 && Answer->Results[0].Timestamp == 10))
+	{
+		SearchQueryFree(Answer);
+		OpenGate(1000);
+		SearchWorkerStop(&Worker);
+		return;
+	}
+	ULONGLONG Generation = Answer->Generation;
+	SearchQueryFree(Answer);
+	UINT Arrivals = GateArrivals;
+
+	// Replaced before it was taken, and answered before the new documents, so it is answered again.
+	CHECK(Query(&Worker, "haystack"));
+	CHECK(AddText(&Worker, 3, "Another needle, and hay"));
+	CHECK(AddText(&Worker, 4, "The newest needle"));
+	CHECK(Query(&Worker, "needle"));
+	OpenGate(1);
+	CHECK(WaitForArrivals(++Arrivals));
+	Answer = SearchWorkerGetResult(&Worker);
+	if (CHECK(Answer != nullptr))
+	{
+		CHECK(IsPattern(Answer, "needle") && Answer->Generation == Generation + 2 && !Answer->Complete);
+		CHECK(Answer->ResultCount == 1 && Answer->Results[0].Id == 1 && Answer->DocumentCount == 2 && !Answer->MoreResults);
+		SearchQueryFree(Answer);
+	}
+
+	// Replaced before it is answered again, by a query that is itself answered twice.
+	CHECK(Query(&Worker, "HAY"));
+	OpenGate(1000);
+	Answer = WaitForResult(&Worker);
+	if (CHECK(Answer != nullptr))
+	{
+		CHECK(IsPattern(Answer, "HAY") && Answer->Generation == Generation + 3 && !Answer->Complete);
+		CHECK(Answer->ResultCount == 1 && Answer->Results[0].Id == 1 && Answer->DocumentCount == 2);
+		SearchQueryFree(Answer);
+	}
+	Answer = WaitForResult(&Worker);
+	if (CHECK(Answer != nullptr))
+	{
+		CHECK(IsPattern(Answer, "HAY") && Answer->Generation == Generation + 3 && Answer->Complete);
+		CHECK(Answer->ResultCount == 2 && Answer->Results[0].Id == 3 && Answer->Results[1].Id == 1);
+		CHECK(Answer->DocumentCount == 4 && Answer->CandidateCount == 2);
+		SearchQueryFree(Answer);
+	}
+
+	// Nothing more comes back.
+	CHECK(WaitForArrivals(Arrivals + 2));
+	CHECK(SearchWorkerGetResult(&Worker) == nullptr);
+	SearchWorkerStop(&Worker);
+	CHECK(GateArrivals == Arrivals + 2);
+}
+
+
+// The text of the oldest documents goes once there is too much, and so do they: they are neither results nor candidates,
+// and the worker and the index keep at most about as many again of them.
+void TestSearchWorkerTextBudget()
+{
+	static SEARCH_WORKER Worker;
+	GatePermits = 1000000;
+	GateArrivals = 0;
+	if (!CHECK(SearchWorkerStart(&Worker, nullptr, TEST_KEPT_TEXTS * TEST_TEXT_LENGTH * sizeof(WCHAR), WaitAtGate, nullptr))) return;
+	WCHAR *Text = (WCHAR *)malloc(TEST_TEXT_LENGTH * sizeof(WCHAR));
+	if (!CHECK(Text != nullptr))
+	{
+		SearchWorkerStop(&Worker);
+		return;
+	}
+
+	DWORD Random = 9;
+	const ULONGLONG DocumentCount = 10 * TEST_KEPT_TEXTS + 37;
+	for (ULONGLONG Id = 1; Id <= DocumentCount; ++Id)
+	{
+		for (UINT i = 0; i < TEST_TEXT_LENGTH; ++i) Text[i] = (WCHAR)('a' + TestRandom(&Random) % 26);
+		memcpy(Text + TEST_TEXT_LENGTH / 2, Id == 1 ? u"first!" : u"needle", 6 * sizeof(WCHAR));
+		if (!CHECK(SearchWorkerAddText(&Worker, Id, Text, TEST_TEXT_LENGTH, 0))) break;
+	}
+	free(Text);
+
+	// Answered once everything has been indexed.
+	CHECK(Query(&Worker, "NEEDLE"));
+	SEARCH_QUERY *Answer = WaitForResult(&Worker);
+	if (CHECK(Answer != nullptr) && !Answer->Complete)
+	{
+		SearchQueryFree(Answer);
+		Answer = WaitForResult(&Worker);
+	}
+	if (CHECK(Answer != nullptr))
+	{
+		CHECK(Answer->Complete && Answer->ResultCount == TEST_KEPT_TEXTS && !Answer->MoreResults);
+		CHECK(Answer->CandidateCount == TEST_KEPT_TEXTS);
+		CHECK(Answer->Results[0].Id == DocumentCount && Answer->Results[TEST_KEPT_TEXTS - 1].Id == DocumentCount - TEST_KEPT_TEXTS + 1);
+		CHECK(Answer->DocumentCount <= 2 * TEST_KEPT_TEXTS);
+		// The worker is idle until the next query.
+		CHECK(Worker.Index.DocumentCount <= 2 * TEST_KEPT_TEXTS);
+		CHECK(Worker.TextBytes == TEST_KEPT_TEXTS * TEST_TEXT_LENGTH * sizeof(WCHAR));
+		SearchQueryFree(Answer);
+	}
+
+	CHECK(Query(&Worker, "first!"));
+	Answer = WaitForResult(&Worker);
+	if (CHECK(Answer != nullptr))
+	{
+		CHECK(Answer->Complete && Answer->ResultCount == 0 && Answer->CandidateCount == 0);
+		SearchQueryFree(Answer);
+	}
+	SearchWorkerStop(&Worker);
+}
@@ -0,0 +1,91 @@
+// Pushes millions of items through the queue between two threads, with capacities small enough that both sides keep
+// running into a full or an empty queue. Meant to be run under -fsanitize=thread as well.
+
+#include "Test.h"
+#include "SpscQueue.h"
+#include <atomic>
+#include <thread>
+
+#define STRESS_ITEMS 4000000
+
+
+static void ProduceItems(SPSC_QUEUE *Queue, UINT Count)
+{
+	for (UINT i = 1; i <= Count; ++i)
+	{
+		while (!SpscQueuePush(Queue, (void *)(UINT_PTR)i))
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+
+// Every item arrives exactly once, in order, whatever the capacity.
+void TestSpscQueueStress()
+{
+	static const UINT Capacities[] = { 1, 2, 64, 1024 };
+	for (UINT c = 0; c < sizeof(Capacities) / sizeof(Capacities[0]); ++c)
+	{
+		TestSetContext("capacity %u", Capacities[c]);
+		SPSC_QUEUE Queue;
+		if (!CHECK(SpscQueueInit(&Queue, Capacities[c]))) return;
+		// The tiny queues hand over every item separately, which is far slower.
+		UINT Count = Capacities[c] < 64 ? STRESS_ITEMS / 8 : STRESS_ITEMS;
+		std::thread Producer(ProduceItems, &Queue, Count);
+		UINT Expected = 1;
+		UINT OutOfOrder = 0;
+		while (Expected <= Count)
+		{
+			void *Item;
+			if (!SpscQueuePop(&Queue, &Item))
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			if ((UINT)(UINT_PTR)Item != Expected) ++OutOfOrder;
+			++Expected;
+		}
+		Producer.join();
+		void *Item;
+		CHECK(OutOfOrder == 0 && !SpscQueuePop(&Queue, &Item));
+		SpscQueueFree(&Queue);
+	}
+}
+
+
+// Full and empty are told apart correctly when the indices wrap around.
+void TestSpscQueueWrap()
+{
+	SPSC_QUEUE Queue;
+	if (!CHECK(SpscQueueInit(&Queue, 4))) return;
+	Queue.Head.store(0xFFFFFFFA);
+	Queue.Tail.store(0xFFFFFFFA);
+	Queue.CachedHead = 0xFFFFFFFA;
+	Queue.CachedTail = 0xFFFFFFFA;
+	UINT_PTR Next = 1;
+	UINT_PTR NextPopped = 1;
+	for (UINT Round = 0; Round < 8; ++Round)
+	{
+		TestSetContext("round %u", Round);
+		for (UINT i = 0; i < 4; ++i)
+		{
+			CHECK(SpscQueuePush(&Queue, (void *)Next++));
+		}
+		CHECK(!SpscQueuePush(&Queue, (void *)Next));
+		for (UINT i = 0; i < 3; ++i)
+		{
+			void *Item;
+			CHECK(SpscQueuePop(&Queue, &Item) && Item == (void *)NextPopped++);
+		}
+		CHECK(SpscQueuePush(&Queue, (void *)Next++));
+		for (UINT i = 0; i < 2; ++i)
+		{
+			void *Item;
+			CHECK(SpscQueuePop(&Queue, &Item) && Item == (void *)NextPopped++);
+		}
+		void *Item;
+		CHECK(!SpscQueuePop(&Queue, &Item));
+	}
+	SpscQueueFree(&Queue);
+}
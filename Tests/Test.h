@@ -0,0 +1,16 @@
+#pragma once
+
+#include "Portable.h"
+
+// A minimal test harness, so that the tests build with nothing but a compiler (see the README for the command line).
+// Every test is a function without arguments, listed in the table in TestMain.cpp.
+//
+// CHECK records a failure and carries on, so that one run shows every broken expectation; a test that cannot go on
+// after a failure returns. TestSetContext describes what is being checked (e.g. which of many generated inputs), and is
+// printed with every failure until it is changed or the test ends.
+
+#define CHECK(Condition) TestCheck((Condition) ? true : false, #Condition, __FILE__, __LINE__)
+
+extern BOOL                TestCheck(BOOL Passed, const char *Expression, const char *File, int Line);
+extern void                TestSetContext(const char *Format, ...);
+extern DWORD               TestRandom(DWORD *State);
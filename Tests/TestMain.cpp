@@ -0,0 +1,228 @@
+// Unit tests for the platform-independent code. Builds on any platform that Portable.h supports (see the README for the
+// command line). Prints one line per test, and the failed checks of the tests that fail; the exit code is 0 if all of
+// them pass.
+//
+// Options:
+//   /filter:<text>   Only runs the tests whose name contains text.
+//   /list            Lists the names without running anything.
+
+#include "Test.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+// Failures beyond this many per test are counted, but not printed.
+#define MAX_PRINTED_FAILURES 20
+
+extern void                TestPackedDIBReference();
+extern void                TestPackedDIBRows();
+extern void                TestPackedDIBTruncated();
+extern void                TestPackedDIBHeight();
+extern void                TestPixelBufferSingleCopy();
+extern void                TestHistoryEvictionOrder();
+extern void                TestHistoryRandom();
+extern void                TestHistoryRemoveMerging();
+extern void                TestHistoryBudget();
+extern void                TestAcquirerBackoff();
+extern void                TestAcquirerJitter();
+extern void                TestAcquirerGiveUp();
+extern void                TestAcquirerHoldTime();
+extern void                TestSpscQueueStress();
+extern void                TestSpscQueueWrap();
+extern void                TestCaptureWorkerCancel();
+extern void                TestCoalescerBurst();
+extern void                TestCoalescerMaxLatency();
+extern void                TestCoalescerOneShot();
+extern void                TestTextLayoutColumns();
+extern void                TestTextLayoutScalar();
+extern void                TestFormatInspectorLazy();
+extern void                TestFormatInspectorRefresh();
+extern void                TestHexDumpRows();
+extern void                TestHistoryStoreTruncatedLog();
+extern void                TestHistoryStoreDeletedIndex();
+extern void                TestHistoryStoreCorruptIndex();
+extern void                TestTileCacheRanges();
+extern void                TestTileCacheEviction();
+extern void                TestPerceptualHashAccuracy();
+extern void                TestHammingIndexBruteForce();
+extern void                TestImageCodecRoundTrip();
+extern void                TestImageCodecCorrupt();
+extern void                TestTextCodecRoundTrip();
+extern void                TestTextCodecCorrupt();
+extern void                TestPackedDIBOs2();
+extern void                TestPackedDIBRle();
+extern void                TestPackedDIBPixelLimit();
+extern void                TestPixelAlphaPremultiply();
+extern void                TestPixelAlphaComposite();
+extern void                TestPixelAlphaClassify();
+extern void                TestPngConformance();
+extern void                TestPngPipeline();
+extern void                TestPngCorrupt();
+extern void                TestRichTextMalformed();
+extern void                TestRichTextMutated();
+extern void                TestMipPyramidDownsample();
+extern void                TestMipPyramidResample();
+extern void                TestTrigramIndexFoldCase();
+extern void                TestTrigramIndexBruteForce();
+extern void                TestTrigramIndexShortPatterns();
+extern void                TestTrigramIndexRepeatedTrigrams();
+extern void                TestTrigramIndexBudget();
+extern void                TestSearchWorkerGenerations();
+extern void                TestSearchWorkerTextBudget();
+
+struct TEST
+{
+	const char *Name;
+	void (*Run)();
+};
+
+static const TEST Tests[] =
+{
+	{ "dib/reference",                   TestPackedDIBReference },
+	{ "dib/rows",                        TestPackedDIBRows },
+	{ "dib/truncated",                   TestPackedDIBTruncated },
+	{ "dib/height",                      TestPackedDIBHeight },
+	{ "pixel-buffer/single-copy",        TestPixelBufferSingleCopy },
+	{ "history/eviction-order",          TestHistoryEvictionOrder },
+	{ "history/random",                  TestHistoryRandom },
+	{ "history/remove-merging",          TestHistoryRemoveMerging },
+	{ "history/budget",                  TestHistoryBudget },
+	{ "acquirer/backoff",                TestAcquirerBackoff },
+	{ "acquirer/jitter",                 TestAcquirerJitter },
+	{ "acquirer/give-up",                TestAcquirerGiveUp },
+	{ "acquirer/hold-time",              TestAcquirerHoldTime },
+	{ "spsc-queue/stress",               TestSpscQueueStress },
+	{ "spsc-queue/wrap",                 TestSpscQueueWrap },
+	{ "capture-worker/cancel",           TestCaptureWorkerCancel },
+	{ "coalescer/burst",                 TestCoalescerBurst },
+	{ "coalescer/max-latency",           TestCoalescerMaxLatency },
+	{ "coalescer/one-shot",              TestCoalescerOneShot },
+	{ "text-layout/columns",             TestTextLayoutColumns },
+	{ "text-layout/scalar",              TestTextLayoutScalar },
+	{ "format-inspector/lazy",           TestFormatInspectorLazy },
+	{ "format-inspector/refresh",        TestFormatInspectorRefresh },
+	{ "hex-dump/rows",                   TestHexDumpRows },
+	{ "store/truncated-log",             TestHistoryStoreTruncatedLog },
+	{ "store/deleted-index",             TestHistoryStoreDeletedIndex },
+	{ "store/corrupt-index",             TestHistoryStoreCorruptIndex },
+	{ "tile-cache/ranges",               TestTileCacheRanges },
+	{ "tile-cache/eviction",             TestTileCacheEviction },
+	{ "perceptual-hash/accuracy",        TestPerceptualHashAccuracy },
+	{ "hamming-index/brute-force",       TestHammingIndexBruteForce },
+	{ "image-codec/round-trip",          TestImageCodecRoundTrip },
+	{ "image-codec/corrupt",             TestImageCodecCorrupt },
+	{ "text-codec/round-trip",           TestTextCodecRoundTrip },
+	{ "text-codec/corrupt",              TestTextCodecCorrupt },
+	{ "dib/os2",                         TestPackedDIBOs2 },
+	{ "dib/rle",                         TestPackedDIBRle },
+	{ "dib/pixel-limit",                 TestPackedDIBPixelLimit },
+	{ "pixel-alpha/premultiply",         TestPixelAlphaPremultiply },
+	{ "pixel-alpha/composite",           TestPixelAlphaComposite },
+	{ "pixel-alpha/classify",            TestPixelAlphaClassify },
+	{ "png/conformance",                 TestPngConformance },
+	{ "png/pipeline",                    TestPngPipeline },
+	{ "png/corrupt",                     TestPngCorrupt },
+	{ "rich-text/malformed",             TestRichTextMalformed },
+	{ "rich-text/mutated",               TestRichTextMutated },
+	{ "mip-pyramid/downsample",          TestMipPyramidDownsample },
+	{ "mip-pyramid/resample",            TestMipPyramidResample },
+	{ "trigram-index/fold-case",         TestTrigramIndexFoldCase },
+	{ "trigram-index/brute-force",       TestTrigramIndexBruteForce },
+	{ "trigram-index/short-patterns",    TestTrigramIndexShortPatterns },
+	{ "trigram-index/repeated-trigrams", TestTrigramIndexRepeatedTrigrams },
+	{ "trigram-index/budget",            TestTrigramIndexBudget },
+	{ "search-worker/generations",       TestSearchWorkerGenerations },
+	{ "search-worker/text-budget",       TestSearchWorkerTextBudget },
+};
+
+static UINT FailureCount;
+static char Context[256];
+
+
+BOOL TestCheck(BOOL Passed, const char *Expression, const char *File, int Line)
+{
+	if (Passed) return true;
+	if (++FailureCount <= MAX_PRINTED_FAILURES)
+	{
+		printf("  %s(%d): CHECK(%s) failed%s%s\n", File, Line, Expression, Context[0] != 0 ? " -- " : "", Context);
+	}
+	return false;
+}
+
+
+void TestSetContext(const char *Format, ...)
+{
+	va_list Arguments;
+	va_start(Arguments, Format);
+	vsnprintf(Context, sizeof(Context), Format, Arguments);
+	va_end(Arguments);
+}
+
+
+// xorshift32. State must not be 0.
+DWORD TestRandom(DWORD *State)
+{
+	DWORD x = *State;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*State = x;
+	return x;
+}
+
+
+int main(int argc, char **argv)
+{
+	static const char FilterOption[] = "/filter:";
+	const char *Filter = nullptr;
+	BOOL ListOnly = false;
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strncmp(argv[i], FilterOption, sizeof(FilterOption) - 1) == 0)
+		{
+			Filter = argv[i] + sizeof(FilterOption) - 1;
+		}
+		else if (strcmp(argv[i], "/list") == 0)
+		{
+			ListOnly = true;
+		}
+		else
+		{
+			fprintf(stderr, "Unknown option: %s\nUsage: %s [/filter:<text>] [/list]\n", argv[i], argv[0]);
+			return 2;
+		}
+	}
+
+	UINT Run = 0;
+	UINT Failed = 0;
+	for (UINT i = 0; i < sizeof(Tests) / sizeof(Tests[0]); ++i)
+	{
+		if (Filter != nullptr && strstr(Tests[i].Name, Filter) == nullptr) continue;
+		if (ListOnly)
+		{
+			printf("%s\n", Tests[i].Name);
+			continue;
+		}
+		FailureCount = 0;
+		Context[0] = 0;
+		ULONGLONG StartUs = GetMonotonicTimeUs();
+		Tests[i].Run();
+		ULONGLONG ElapsedMs = (GetMonotonicTimeUs() - StartUs) / 1000;
+		if (FailureCount != 0)
+		{
+			printf("FAILED %s (%u failed checks)\n", Tests[i].Name, FailureCount);
+			++Failed;
+		}
+		else
+		{
+			printf("ok     %s (%llu ms)\n", Tests[i].Name, (unsigned long long)ElapsedMs);
+		}
+		fflush(stdout);
+		++Run;
+	}
+	if (!ListOnly)
+	{
+		printf("%u of %u tests passed.\n", Run - Failed, Run);
+	}
+	return Failed != 0 ? 1 : 0;
+}
@@ -0,0 +1,439 @@
+// Round trips texts of every kind (ASCII, two and three byte characters, surrogate pairs and unpaired surrogates, runs)
+// through the codec, without and with a trained dictionary, and checks when it picks UTF-8. Then feeds the decoder code
+// that was truncated, had bits flipped or had its header changed, which must be rejected by TextCodecValidate or
+// TextCodecDecode, and never read or write out of bounds (which the sanitizers see).
+
+#include "Test.h"
+#include "TextCodec.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_TEXT_COUNT 280
+#define TEST_MAX_LENGTH 3000
+// Longer than the 64 KB that copies reach back.
+#define TEST_LONG_LENGTH 70000
+#define TEST_SAMPLE_COUNT 60
+#define TEST_DICTIONARY_ID 0x123456789ULL
+
+enum TEST_TEXT_KIND
+{
+	TEST_TEXT_ASCII,           // Words, like code and logs.
+	TEST_TEXT_LATIN,           // Words with accented and Cyrillic letters: two bytes in UTF-8.
+	TEST_TEXT_CJK,             // Mostly three bytes in UTF-8, so kept as UTF-16.
+	TEST_TEXT_PAIRS,           // Words with emoji: surrogate pairs, four bytes in UTF-8.
+	TEST_TEXT_UNPAIRED,        // Words with surrogates that are not part of a pair.
+	TEST_TEXT_RUNS,            // Patterns of 1 to 9 characters, repeated: overlapping copies.
+	TEST_TEXT_RANDOM,          // Any WCHAR at all.
+	TEST_TEXT_KIND_COUNT,
+};
+
+
+static const char *const TestWords[] =
+{
+	"the ", "return ", "int ", "{\r\n", "}\r\n", "\t", "2026-10-18 12:00:", "[INFO] ", "worker-", "\"id\": ", "null, ",
+	"clipboard ", "if (", ") ", "0", "42", "Count", " = ", ";\r\n", "<div class=\"", "\">",
+};
+
+
+static void PutTestWord(WCHAR *Text, SIZE_T *i, SIZE_T Length, DWORD *Random)
+{
+	for (const char *Word = TestWords[TestRandom(Random) % (sizeof(TestWords) / sizeof(TestWords[0]))]; *Word != 0 && *i < Length; ++Word)
+	{
+		Text[(*i)++] = (WCHAR)*Word;
+	}
+}
+
+
+// Returns Length characters (at least one, so that there is always something to write to).
+static WCHAR *GenerateTestText(SIZE_T Length, TEST_TEXT_KIND Kind, DWORD *Random)
+{
+	WCHAR *Text = (WCHAR *)malloc((Length != 0 ? Length : 1) * sizeof(WCHAR));
+	if (Text == nullptr) return nullptr;
+	WCHAR Pattern[9];
+	SIZE_T Period = 1 + TestRandom(Random) % 9;
+	for (SIZE_T k = 0; k < Period; ++k) Pattern[k] = (WCHAR)(TestRandom(Random) % 2 != 0 ? 'a' + k : 0x430 + k);
+	SIZE_T i = 0;
+	while (i < Length)
+	{
+		DWORD r = TestRandom(Random);
+		switch (Kind)
+		{
+		case TEST_TEXT_LATIN:
+			if (r % 3 == 0) Text[i++] = (WCHAR)(r % 2 != 0 ? 0xE0 + (r >> 8) % 32 : 0x410 + (r >> 8) % 64);
+			else PutTestWord(Text, &i, Length, Random);
+			break;
+		case TEST_TEXT_CJK:
+			Text[i++] = (WCHAR)(r % 8 != 0 ? 0x4E00 + (r >> 8) % 200 : ' ');
+			break;
+		case TEST_TEXT_PAIRS:
+			if (r % 4 == 0 && i + 2 <= Length)
+			{
+				Text[i++] = 0xD83D;
+				Text[i++] = (WCHAR)(0xDE00 + (r >> 8) % 64);
+			}
+			else PutTestWord(Text, &i, Length, Random);
+			break;
+		case TEST_TEXT_UNPAIRED:
+			// A low surrogate alone, a high one before something else (or at the end), or a pair the wrong way around.
+			if (r % 4 == 0) Text[i++] = (WCHAR)(0xD800 + (r >> 8) % 0x800);
+			else if (r % 4 == 1 && i + 2 <= Length)
+			{
+				Text[i++] = (WCHAR)(0xDC00 + (r >> 8) % 0x400);
+				Text[i++] = (WCHAR)(0xD800 + (r >> 20) % 0x400);
+			}
+			else PutTestWord(Text, &i, Length, Random);
+			break;
+		case TEST_TEXT_RUNS:
+			if (r % 50 == 0) Period = 1 + (r >> 8) % 9;
+			Text[i] = Pattern[i % Period];
+			++i;
+			break;
+		case TEST_TEXT_RANDOM:
+			Text[i++] = (WCHAR)r;
+			break;
+		default:
+			PutTestWord(Text, &i, Length, Random);
+			break;
+		}
+	}
+	return Text;
+}
+
+
+// Encodes the text, checks the header, and decodes it again from a copy that is exactly as long as the code. Returns
+// the size of the code, or 0 if the round trip fails.
+static SIZE_T CheckRoundTrip(const WCHAR *Text, SIZE_T Length, const TEXT_DICTIONARY *Dictionary, BOOL *Utf8)
+{
+	SIZE_T MaxSizeCb = TextCodecGetMaxSize(Length);
+	BYTE *Output = (BYTE *)malloc(MaxSizeCb);
+	if (!CHECK(Output != nullptr)) return 0;
+	SIZE_T SizeCb = TextCodecEncode(Text, Length, Dictionary, Output);
+	BYTE *Code = SizeCb != 0 ? (BYTE *)malloc(SizeCb) : nullptr;
+	WCHAR *Decoded = (WCHAR *)malloc((Length != 0 ? Length : 1) * sizeof(WCHAR));
+	BOOL Passed = false;
+	if (CHECK(SizeCb > sizeof(TEXT_CODEC_HEADER) && SizeCb <= MaxSizeCb) && CHECK(Code != nullptr && Decoded != nullptr))
+	{
+		memcpy(Code, Output, SizeCb);
+		const TEXT_CODEC_HEADER *Header = TextCodecValidate(Code, SizeCb);
+		Passed = CHECK(Header != nullptr) &&
+			CHECK(Header->Length == Length && Header->DictionaryId == (Dictionary != nullptr ? Dictionary->Id : 0)) &&
+			CHECK(TextCodecDecode(Header, SizeCb, Dictionary, Decoded)) &&
+			CHECK(memcmp(Decoded, Text, Length * sizeof(WCHAR)) == 0);
+		if (Header != nullptr)
+		{
+			*Utf8 = (Header->Flags & TEXT_CODEC_UTF8) != 0;
+			CHECK(*Utf8 ? Header->CodedSizeCb >= Length && Header->CodedSizeCb <= Length * sizeof(WCHAR) : Header->CodedSizeCb == Length * sizeof(WCHAR));
+		}
+	}
+	free(Decoded);
+	free(Code);
+	free(Output);
+	return Passed ? SizeCb : 0;
+}
+
+
+// Checks that the text is stored as UTF-8 or not, and round trips it.
+static void CheckEncoding(const WCHAR *Text, SIZE_T Length, BOOL ExpectUtf8)
+{
+	BOOL Utf8 = false;
+	CHECK(CheckRoundTrip(Text, Length, nullptr, &Utf8) != 0 && Utf8 == ExpectUtf8);
+}
+
+
+// Trains a dictionary from texts like the ones that are compressed with it.
+static TEXT_DICTIONARY *TrainTestDictionary(DWORD *Random, BOOL Prepare)
+{
+	WCHAR *Samples[TEST_SAMPLE_COUNT];
+	SIZE_T Lengths[TEST_SAMPLE_COUNT];
+	for (UINT i = 0; i < TEST_SAMPLE_COUNT; ++i)
+	{
+		Lengths[i] = 50 + TestRandom(Random) % 400;
+		Samples[i] = GenerateTestText(Lengths[i], i % 2 != 0 ? TEST_TEXT_LATIN : TEST_TEXT_ASCII, Random);
+	}
+	BYTE *Data = (BYTE *)malloc(TEXT_DICTIONARY_MAX_SIZE);
+	TEXT_DICTIONARY *Dictionary = nullptr;
+	if (Data != nullptr)
+	{
+		SIZE_T SizeCb = TextDictionaryTrain(Samples, Lengths, TEST_SAMPLE_COUNT, Data, TEXT_DICTIONARY_MAX_SIZE);
+		if (CHECK(SizeCb > 0 && SizeCb <= TEXT_DICTIONARY_MAX_SIZE)) Dictionary = TextDictionaryCreate(Data, SizeCb, TEST_DICTIONARY_ID);
+		if (Dictionary != nullptr && Prepare && !TextDictionaryPrepareEncoding(Dictionary))
+		{
+			TextDictionaryFree(Dictionary);
+			Dictionary = nullptr;
+		}
+	}
+	free(Data);
+	for (UINT i = 0; i < TEST_SAMPLE_COUNT; ++i) free(Samples[i]);
+	return Dictionary;
+}
+
+
+void TestTextCodecRoundTrip()
+{
+	// UTF-8 is picked as long as it is no larger than UTF-16: one three byte character for every ASCII one is the limit.
+	static const WCHAR Ascii[] = { 'a', 'b', 'c' };
+	static const WCHAR Cyrillic[] = { 0x416, 0x43E, 0x440 };
+	static const WCHAR Balanced[] = { 0x4E00, 'a', 0x4E01, 'b' };
+	static const WCHAR Unbalanced[] = { 0x4E00, 'a', 0x4E01, 0x4E02, 'b' };
+	static const WCHAR Emoji[] = { 0xD83D, 0xDE00, 0xD83D, 0xDE01 };
+	CheckEncoding(Ascii, 0, true);
+	CheckEncoding(Ascii, 3, true);
+	CheckEncoding(Cyrillic, 3, true);
+	CheckEncoding(Balanced, 4, true);
+	CheckEncoding(Unbalanced, 5, false);
+	CheckEncoding(Emoji, 4, true);
+
+	// Unpaired surrogates, at the start and the end, and pairs the wrong way around, in either encoding.
+	static const WCHAR HighAtEnd[] = { 'a', 0xD83D };
+	static const WCHAR LowAtStart[] = { 0xDE00, 'a' };
+	static const WCHAR Reversed[] = { 'a', 0xDE00, 0xD83D, 'b' };
+	static const WCHAR HighThenHigh[] = { 0xD83D, 0xD83D, 0xDE00, 'a' };
+	static const WCHAR UnpairedCjk[] = { 0x4E00, 0xD800, 0x4E01, 0xDFFF, 0x4E02 };
+	CheckEncoding(HighAtEnd, 2, true);
+	CheckEncoding(HighAtEnd + 1, 1, false);
+	CheckEncoding(LowAtStart, 2, true);
+	CheckEncoding(Reversed, 4, true);
+	CheckEncoding(HighThenHigh, 4, true);
+	CheckEncoding(UnpairedCjk, 5, false);
+
+	DWORD Random = 1;
+	TEXT_DICTIONARY *Prepared = TrainTestDictionary(&Random, true);
+	Random = 1;
+	TEXT_DICTIONARY *Unprepared = TrainTestDictionary(&Random, false);
+	TEXT_DICTIONARY *Other = Prepared != nullptr ? TextDictionaryCreate(Prepared->Data, Prepared->SizeCb, TEST_DICTIONARY_ID + 1) : nullptr;
+	if (!CHECK(Prepared != nullptr && Unprepared != nullptr && Other != nullptr))
+	{
+		TextDictionaryFree(Prepared);
+		TextDictionaryFree(Unprepared);
+		TextDictionaryFree(Other);
+		return;
+	}
+
+	// Short texts of words shrink further with the dictionary than without.
+	SIZE_T PlainSizeCb = 0;
+	SIZE_T DictionarySizeCb = 0;
+	for (UINT i = 0; i < TEST_TEXT_COUNT; ++i)
+	{
+		// Every length up to past the 32 byte copies of the decoder, then random ones, and some beyond the window.
+		SIZE_T Length = i < 48 ? i : i % 40 == 0 ? TEST_LONG_LENGTH : 1 + TestRandom(&Random) % TEST_MAX_LENGTH;
+		TEST_TEXT_KIND Kind = (TEST_TEXT_KIND)(i % TEST_TEXT_KIND_COUNT);
+		TestSetContext("%zu characters, kind %u", Length, (UINT)Kind);
+		WCHAR *Text = GenerateTestText(Length, Kind, &Random);
+		if (!CHECK(Text != nullptr)) break;
+
+		BOOL Utf8 = false;
+		SIZE_T SizeCb = CheckRoundTrip(Text, Length, nullptr, &Utf8);
+		if (Length > 0 && (Kind == TEST_TEXT_ASCII || Kind == TEST_TEXT_LATIN || Kind == TEST_TEXT_PAIRS)) CHECK(Utf8);
+		if (Length > 40 && Kind == TEST_TEXT_CJK) CHECK(!Utf8);
+		BOOL DictionaryUtf8 = false;
+		SIZE_T WithDictionarySizeCb = CheckRoundTrip(Text, Length, Prepared, &DictionaryUtf8);
+		CHECK(DictionaryUtf8 == Utf8);
+		if ((Kind == TEST_TEXT_ASCII || Kind == TEST_TEXT_LATIN) && Length <= 500)
+		{
+			PlainSizeCb += SizeCb;
+			DictionarySizeCb += WithDictionarySizeCb;
+		}
+
+		// Preparing the dictionary only makes encoding faster: the code is the same.
+		BYTE *A = (BYTE *)malloc(TextCodecGetMaxSize(Length));
+		BYTE *B = (BYTE *)malloc(TextCodecGetMaxSize(Length));
+		if (CHECK(A != nullptr && B != nullptr))
+		{
+			SIZE_T ASizeCb = TextCodecEncode(Text, Length, Prepared, A);
+			SIZE_T BSizeCb = TextCodecEncode(Text, Length, Unprepared, B);
+			CHECK(ASizeCb == BSizeCb && memcmp(A, B, ASizeCb) == 0);
+			// Decoding needs the same dictionary, not just the same content; without one, it is ignored.
+			const TEXT_CODEC_HEADER *Header = TextCodecValidate(A, ASizeCb);
+			if (CHECK(Header != nullptr))
+			{
+				CHECK(!TextCodecDecode(Header, ASizeCb, nullptr, Text) && !TextCodecDecode(Header, ASizeCb, Other, Text));
+				CHECK(TextCodecDecode(Header, ASizeCb, Unprepared, Text));
+			}
+			SIZE_T PlainCb = TextCodecEncode(Text, Length, nullptr, B);
+			Header = TextCodecValidate(B, PlainCb);
+			CHECK(Header != nullptr && Header->DictionaryId == 0 && TextCodecDecode(Header, PlainCb, Other, Text));
+		}
+		free(A);
+		free(B);
+		free(Text);
+	}
+	TestSetContext("");
+	CHECK(DictionarySizeCb < PlainSizeCb * 3 / 4);
+
+	// Text made of what is in the dictionary (its ASCII, at least) shrinks much further with it than without.
+	WCHAR *Copied = (WCHAR *)malloc(Prepared->SizeCb * sizeof(WCHAR));
+	if (CHECK(Copied != nullptr))
+	{
+		SIZE_T Length = 0;
+		for (SIZE_T i = 0; i < Prepared->SizeCb; ++i)
+		{
+			if (Prepared->Data[i] < 0x80) Copied[Length++] = Prepared->Data[i];
+		}
+		BOOL Utf8 = false;
+		SIZE_T SizeCb = CheckRoundTrip(Copied, Length, Prepared, &Utf8);
+		CHECK(SizeCb != 0 && SizeCb < CheckRoundTrip(Copied, Length, nullptr, &Utf8) * 2 / 3);
+		free(Copied);
+	}
+
+	// Empty dictionaries are fine; ones that are too large, or have no id, are not.
+	TEXT_DICTIONARY *Empty = TextDictionaryCreate(Prepared->Data, 0, 5);
+	BOOL Utf8 = false;
+	CHECK(Empty != nullptr && TextDictionaryPrepareEncoding(Empty) && CheckRoundTrip(Ascii, 3, Empty, &Utf8) != 0);
+	TextDictionaryFree(Empty);
+	CHECK(TextDictionaryCreate(Prepared->Data, TEXT_DICTIONARY_MAX_SIZE + 1, 5) == nullptr);
+	CHECK(TextDictionaryCreate(Prepared->Data, Prepared->SizeCb, 0) == nullptr);
+	TextDictionaryFree(Prepared);
+	TextDictionaryFree(Unprepared);
+	TextDictionaryFree(Other);
+}
+
+
+// Validates a copy of the code that is exactly SizeCb long, and decodes it if it passes. Returns whether it decoded.
+// Which texts come out of broken code does not matter, only that the decoder stays within the code and the text.
+static BOOL ValidateAndDecode(const BYTE *Code, SIZE_T SizeCb, const TEXT_DICTIONARY *Dictionary)
+{
+	BYTE *Copy = (BYTE *)malloc(SizeCb != 0 ? SizeCb : 1);
+	if (!CHECK(Copy != nullptr)) return false;
+	memcpy(Copy, Code, SizeCb);
+	const TEXT_CODEC_HEADER *Header = TextCodecValidate(Copy, SizeCb);
+	BOOL Decoded = false;
+	if (Header != nullptr)
+	{
+		WCHAR *Text = (WCHAR *)malloc(Header->Length != 0 ? (SIZE_T)Header->Length * sizeof(WCHAR) : 1);
+		if (CHECK(Text != nullptr)) Decoded = TextCodecDecode(Header, SizeCb, Dictionary, Text);
+		free(Text);
+	}
+	free(Copy);
+	return Decoded;
+}
+
+
+void TestTextCodecCorrupt()
+{
+	DWORD Random = 7;
+	TEXT_DICTIONARY *Dictionary = TrainTestDictionary(&Random, true);
+	if (!CHECK(Dictionary != nullptr)) return;
+	for (UINT i = 0; i < 42; ++i)
+	{
+		SIZE_T Length = 1 + TestRandom(&Random) % 600;
+		TEST_TEXT_KIND Kind = (TEST_TEXT_KIND)(i % TEST_TEXT_KIND_COUNT);
+		const TEXT_DICTIONARY *UsedDictionary = i % 2 != 0 ? Dictionary : nullptr;
+		TestSetContext("%zu characters, kind %u%s", Length, (UINT)Kind, UsedDictionary != nullptr ? ", dictionary" : "");
+		WCHAR *Text = GenerateTestText(Length, Kind, &Random);
+		BYTE *Code = Text != nullptr ? (BYTE *)malloc(TextCodecGetMaxSize(Length)) : nullptr;
+		BYTE *Blob = Code != nullptr ? (BYTE *)malloc(TextCodecGetMaxSize(Length)) : nullptr;
+		if (!CHECK(Blob != nullptr))
+		{
+			free(Code);
+			free(Text);
+			break;
+		}
+		SIZE_T SizeCb = TextCodecEncode(Text, Length, UsedDictionary, Code);
+		TEXT_CODEC_HEADER *Header = (TEXT_CODEC_HEADER *)Blob;
+
+		// Truncated anywhere: the header is cut off, or the code ends before the text does.
+		for (SIZE_T Cut = 0; Cut < SizeCb; Cut += 1 + Cut / 16)
+		{
+			CHECK(!ValidateAndDecode(Code, Cut, UsedDictionary));
+		}
+
+		// Random bits flipped anywhere, in the header or the code, and bytes of garbage in the code.
+		for (UINT Round = 0; Round < 60; ++Round)
+		{
+			memcpy(Blob, Code, SizeCb);
+			for (UINT Flips = 1 + TestRandom(&Random) % 4; Flips > 0; --Flips)
+			{
+				SIZE_T Offset = Round % 3 == 0 ? TestRandom(&Random) % sizeof(TEXT_CODEC_HEADER) : TestRandom(&Random) % SizeCb;
+				if (Round % 3 == 2) Blob[Offset] = (BYTE)TestRandom(&Random);
+				else Blob[Offset] ^= (BYTE)(1 << TestRandom(&Random) % 8);
+			}
+			ValidateAndDecode(Blob, SizeCb, UsedDictionary);
+		}
+
+		// Headers that do not match the code: a text one longer or shorter, code that is not as long as it says, and
+		// sizes that claim far more than the code can hold.
+		static const LONGLONG LengthChanges[] = { 1, -1 };
+		for (UINT c = 0; c < 2; ++c)
+		{
+			memcpy(Blob, Code, SizeCb);
+			Header->Length += LengthChanges[c];
+			CHECK(!ValidateAndDecode(Blob, SizeCb, UsedDictionary));
+			memcpy(Blob, Code, SizeCb);
+			Header->CodedSizeCb += LengthChanges[c];
+			CHECK(!ValidateAndDecode(Blob, SizeCb, UsedDictionary));
+		}
+		memcpy(Blob, Code, SizeCb);
+		Header->Length = 1ULL << 62;
+		Header->CodedSizeCb = Header->Length * 2;
+		CHECK(!ValidateAndDecode(Blob, SizeCb, UsedDictionary));
+		memcpy(Blob, Code, SizeCb);
+		Header->Length = (ULONGLONG)SizeCb * 300;
+		Header->CodedSizeCb = Header->Length * ((Header->Flags & TEXT_CODEC_UTF8) != 0 ? 1 : 2);
+		CHECK(!ValidateAndDecode(Blob, SizeCb, UsedDictionary));
+
+		// Another magic, unknown flags, or another dictionary. Switching the encoding may pass, but not overflow.
+		memcpy(Blob, Code, SizeCb);
+		Header->Magic ^= 1;
+		CHECK(!ValidateAndDecode(Blob, SizeCb, UsedDictionary));
+		memcpy(Blob, Code, SizeCb);
+		Header->Flags |= 2;
+		CHECK(!ValidateAndDecode(Blob, SizeCb, UsedDictionary));
+		memcpy(Blob, Code, SizeCb);
+		Header->DictionaryId ^= 2;
+		CHECK(!ValidateAndDecode(Blob, SizeCb, UsedDictionary) && !ValidateAndDecode(Blob, SizeCb, Dictionary));
+		memcpy(Blob, Code, SizeCb);
+		Header->Flags ^= TEXT_CODEC_UTF8;
+		ValidateAndDecode(Blob, SizeCb, UsedDictionary);
+
+		// A character cut off at the end of UTF-8: the last byte of the code, which is the last literal (or the token
+		// of a last sequence without any), made the start of a four byte one.
+		if ((((const TEXT_CODEC_HEADER *)Code)->Flags & TEXT_CODEC_UTF8) != 0)
+		{
+			memcpy(Blob, Code, SizeCb);
+			Blob[SizeCb - 1] = 0xF0;
+			CHECK(!ValidateAndDecode(Blob, SizeCb, UsedDictionary));
+		}
+
+		// The untouched code still decodes, but not without its dictionary.
+		CHECK(ValidateAndDecode(Code, SizeCb, UsedDictionary));
+		if (UsedDictionary != nullptr) CHECK(!ValidateAndDecode(Code, SizeCb, nullptr));
+		free(Blob);
+		free(Code);
+		free(Text);
+	}
+	TestSetContext("");
+
+	// Code written by hand, for "abababab": two literals, and a copy of six from two back, which overlaps itself.
+	static const WCHAR Text[] = { 'a', 'b', 'a', 'b', 'a', 'b', 'a', 'b' };
+	static const BYTE Sequences[] = { 0x22, 'a', 'b', 2, 0, 0x00 };
+	// The header is the one the encoder writes for the text, with room for its code.
+	BYTE Blob[sizeof(TEXT_CODEC_HEADER) + 64];
+	SIZE_T SizeCb = sizeof(TEXT_CODEC_HEADER) + sizeof(Sequences);
+	if (CHECK(TextCodecGetMaxSize(8) <= sizeof(Blob) && TextCodecEncode(Text, 8, nullptr, Blob) != 0))
+	{
+		memcpy(Blob + sizeof(TEXT_CODEC_HEADER), Sequences, sizeof(Sequences));
+		const TEXT_CODEC_HEADER *Header = TextCodecValidate(Blob, SizeCb);
+		WCHAR Decoded[8];
+		CHECK(Header != nullptr && TextCodecDecode(Header, SizeCb, nullptr, Decoded) && memcmp(Decoded, Text, sizeof(Text)) == 0);
+
+		// A copy from no distance, from before the start of the text without a dictionary, and from further back than
+		// a dictionary goes.
+		static const BYTE Offsets[][2] = { { 0, 0 }, { 3, 0 }, { 0xFF, 0xFF } };
+		for (UINT o = 0; o < sizeof(Offsets) / sizeof(Offsets[0]); ++o)
+		{
+			memcpy(Blob + sizeof(TEXT_CODEC_HEADER) + 3, Offsets[o], 2);
+			CHECK(!ValidateAndDecode(Blob, SizeCb, nullptr));
+		}
+		((TEXT_CODEC_HEADER *)Blob)->DictionaryId = Dictionary->Id;
+		CHECK(!ValidateAndDecode(Blob, SizeCb, Dictionary));
+		((TEXT_CODEC_HEADER *)Blob)->DictionaryId = 0;
+
+		// A copy past the end of the text, and a last sequence that is missing.
+		memcpy(Blob + sizeof(TEXT_CODEC_HEADER), Sequences, sizeof(Sequences));
+		Blob[sizeof(TEXT_CODEC_HEADER)] = 0x23;
+		CHECK(!ValidateAndDecode(Blob, SizeCb, nullptr));
+		Blob[sizeof(TEXT_CODEC_HEADER)] = 0x22;
+		CHECK(ValidateAndDecode(Blob, SizeCb, nullptr) && !ValidateAndDecode(Blob, SizeCb - 1, nullptr));
+	}
+	TextDictionaryFree(Dictionary);
+}
@@ -0,0 +1,148 @@
+// Compares the mapping between columns and text offsets, which the text view selects with, against walking every line
+// of random texts with tabs and every kind of line break.
+
+#include "Test.h"
+#include "TextLayout.h"
+#include <stdlib.h>
+
+#define TEST_TEXT_LENGTH 20000
+#define TEST_TAB_WIDTH 4
+
+
+// Mostly letters, with tabs, CR, LF and CRLF mixed in, and some long lines without tabs.
+static void GenerateTestText(WCHAR *Text, SIZE_T Length, DWORD *Random)
+{
+	for (SIZE_T i = 0; i < Length; ++i)
+	{
+		DWORD r = TestRandom(Random) % 100;
+		Text[i] = r < 8 ? '\t' : r < 11 ? '\n' : r < 13 ? '\r' : (WCHAR)('a' + r % 26);
+	}
+}
+
+
+// Walks line by line from the start of the text, like the index does, and checks both mappings at every column and
+// every offset of every line.
+static void CheckLines(const TEXT_LINE_INDEX *Index, const WCHAR *Text, SIZE_T Length)
+{
+	static SIZE_T Columns[TEST_TEXT_LENGTH + 1];
+	SIZE_T Line = 0;
+	SIZE_T Start = 0;
+	for (;;)
+	{
+		SIZE_T End = Start;
+		while (End < Length && Text[End] != '\r' && Text[End] != '\n') ++End;
+		TestSetContext("line %zu", Line);
+		if (!CHECK(Line < TextLineIndexGetLineCount(Index))) return;
+		SIZE_T IndexStart, IndexLength;
+		TextLineIndexGetLine(Index, Line, &IndexStart, &IndexLength);
+		if (!CHECK(IndexStart == Start && IndexLength == End - Start)) return;
+
+		// Columns[i] is where character i of the line starts; Columns[Length] is the width of the line.
+		Columns[0] = 0;
+		for (SIZE_T i = Start; i < End; ++i)
+		{
+			SIZE_T Column = Columns[i - Start];
+			Columns[i - Start + 1] = Column + (Text[i] == '\t' ? TEST_TAB_WIDTH - Column % TEST_TAB_WIDTH : 1);
+		}
+		SIZE_T Width = Columns[End - Start];
+		for (SIZE_T Offset = Start; Offset <= End + 2; ++Offset)
+		{
+			if (!CHECK(TextLayoutGetColumn(Index, Line, Offset) == Columns[(Offset < End ? Offset : End) - Start])) return;
+		}
+		// Offsets before the line belong to an earlier one, and map to its start.
+		if (Start > 0 && !CHECK(TextLayoutGetColumn(Index, Line, Start - 1) == 0)) return;
+
+		SIZE_T Expected = Start;
+		for (SIZE_T Column = 0; Column <= Width + TEST_TAB_WIDTH; ++Column)
+		{
+			while (Expected < End && Columns[Expected - Start] < Column) ++Expected;
+			if (!CHECK(TextLayoutGetOffset(Index, Line, Column) == Expected)) return;
+		}
+		// The offset of a column is always where that column's character starts, and back.
+		for (SIZE_T Offset = Start; Offset <= End; ++Offset)
+		{
+			if (!CHECK(TextLayoutGetOffset(Index, Line, TextLayoutGetColumn(Index, Line, Offset)) == Offset)) return;
+		}
+
+		if (End == Length) break;
+		Start = End + (Text[End] == '\r' && End + 1 < Length && Text[End + 1] == '\n' ? 2 : 1);
+		++Line;
+	}
+	TestSetContext("");
+	CHECK(TextLineIndexGetLineCount(Index) == Line + 1);
+}
+
+
+void TestTextLayoutColumns()
+{
+	WCHAR *Text = (WCHAR *)malloc(TEST_TEXT_LENGTH * sizeof(WCHAR));
+	if (!CHECK(Text != nullptr)) return;
+	DWORD Random = 1;
+	for (UINT Round = 0; Round < 4; ++Round)
+	{
+		GenerateTestText(Text, TEST_TEXT_LENGTH, &Random);
+		if (Round == 1)
+		{
+			// A text that ends with a line break, and so with an empty line.
+			Text[TEST_TEXT_LENGTH - 1] = '\n';
+		}
+		if (Round == 2)
+		{
+			// Long lines without a single tab take the direct path.
+			for (SIZE_T i = 0; i < TEST_TEXT_LENGTH; ++i)
+			{
+				if (Text[i] == '\t') Text[i] = ' ';
+				if (Text[i] == '\n' && i % 7 != 0) Text[i] = 'x';
+			}
+		}
+		TEXT_LINE_INDEX Index;
+		if (CHECK(TextLineIndexBuild(&Index, Text, TEST_TEXT_LENGTH, TEST_TAB_WIDTH)))
+		{
+			CheckLines(&Index, Text, TEST_TEXT_LENGTH);
+		}
+		TextLineIndexFree(&Index);
+	}
+
+	// The empty text has a single empty line.
+	TEXT_LINE_INDEX Index;
+	if (CHECK(TextLineIndexBuild(&Index, Text, 0, TEST_TAB_WIDTH)))
+	{
+		CHECK(TextLayoutGetOffset(&Index, 0, 5) == 0 && TextLayoutGetColumn(&Index, 0, 3) == 0);
+	}
+	TextLineIndexFree(&Index);
+	free(Text);
+}
+
+
+// The SIMD scan finds the same lines as the scalar one, including breaks and tabs at every position in a block of
+// eight characters, and CRLFs split between two blocks.
+void TestTextLayoutScalar()
+{
+	WCHAR *Text = (WCHAR *)malloc(TEST_TEXT_LENGTH * sizeof(WCHAR));
+	if (!CHECK(Text != nullptr)) return;
+	DWORD Random = 7;
+	GenerateTestText(Text, TEST_TEXT_LENGTH, &Random);
+	for (SIZE_T Length = TEST_TEXT_LENGTH - 17; Length <= TEST_TEXT_LENGTH; ++Length)
+	{
+		TestSetContext("length %zu", Length);
+		TEXT_LINE_INDEX Index, ScalarIndex;
+		BOOL Built = TextLineIndexBuild(&Index, Text, Length, TEST_TAB_WIDTH);
+		BOOL ScalarBuilt = TextLineIndexBuildScalar(&ScalarIndex, Text, Length, TEST_TAB_WIDTH);
+		if (CHECK(Built && ScalarBuilt))
+		{
+			SIZE_T LineCount = TextLineIndexGetLineCount(&Index);
+			CHECK(LineCount == TextLineIndexGetLineCount(&ScalarIndex));
+			CHECK(TextLineIndexGetMaxColumns(&Index) == TextLineIndexGetMaxColumns(&ScalarIndex));
+			for (SIZE_T Line = 0; Line < LineCount; ++Line)
+			{
+				SIZE_T Start, LineLength, ScalarStart, ScalarLineLength;
+				TextLineIndexGetLine(&Index, Line, &Start, &LineLength);
+				TextLineIndexGetLine(&ScalarIndex, Line, &ScalarStart, &ScalarLineLength);
+				if (!CHECK(Start == ScalarStart && LineLength == ScalarLineLength)) break;
+			}
+		}
+		TextLineIndexFree(&Index);
+		TextLineIndexFree(&ScalarIndex);
+	}
+	free(Text);
+}
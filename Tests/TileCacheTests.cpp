@@ -0,0 +1,295 @@
+// Checks the tile math at the edges of images of every size around a multiple of TILE_SIZE, and the cache against a
+// model of its LRU list under a byte limit that only a few tiles fit into.
+
+#include "Test.h"
+#include "TileCache.h"
+#include "PixelBuffer.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_MAX_TILES 64
+
+
+// Rows of TILE_SIZE - 1, TILE_SIZE and TILE_SIZE + 1 pixels, and images smaller than a single tile.
+static const LONG TestSizes[] = { 1, TILE_SIZE - 1, TILE_SIZE, TILE_SIZE + 1, 2 * TILE_SIZE, 3 * TILE_SIZE - 1, 3 * TILE_SIZE + 1 };
+
+
+// Whether tile (Column, Row) shares a pixel with the rectangle, the slow way. An empty rectangle shares none.
+static BOOL TileIntersects(LONG ImageWidth, LONG ImageHeight, LONG Column, LONG Row, LONGLONG Left, LONGLONG Top, LONGLONG Right, LONGLONG Bottom)
+{
+	TILE_BOUNDS Bounds;
+	GetTileBounds(ImageWidth, ImageHeight, Column, Row, &Bounds);
+	return Left < Right && Top < Bottom && Bounds.X < Right && Left < Bounds.X + Bounds.Width && Bounds.Y < Bottom && Top < Bounds.Y + Bounds.Height;
+}
+
+
+// GetVisibleTiles returns exactly the tiles that the rectangle touches, for rectangles around every tile edge and
+// beyond the image.
+static void CheckVisibleTiles(LONG Width, LONG Height, LONGLONG Left, LONGLONG Top, LONGLONG Right, LONGLONG Bottom)
+{
+	TILE_RANGE Range;
+	BOOL Visible = GetVisibleTiles(Width, Height, Left, Top, Right, Bottom, &Range);
+	LONG Columns = (Width + TILE_SIZE - 1) / TILE_SIZE;
+	LONG Rows = (Height + TILE_SIZE - 1) / TILE_SIZE;
+	UINT Expected = 0;
+	for (LONG Row = 0; Row < Rows; ++Row)
+	{
+		for (LONG Column = 0; Column < Columns; ++Column)
+		{
+			BOOL Intersects = TileIntersects(Width, Height, Column, Row, Left, Top, Right, Bottom);
+			BOOL InRange = Visible && Column >= Range.FirstColumn && Column < Range.EndColumn && Row >= Range.FirstRow && Row < Range.EndRow;
+			if (!CHECK(Intersects == InRange)) return;
+			Expected += Intersects;
+		}
+	}
+	CHECK(Visible == (Expected != 0));
+	if (!Visible) CHECK(Range.FirstColumn == Range.EndColumn && Range.FirstRow == Range.EndRow);
+}
+
+
+void TestTileCacheRanges()
+{
+	for (UINT w = 0; w < sizeof(TestSizes) / sizeof(TestSizes[0]); ++w)
+	{
+		for (UINT h = 0; h < sizeof(TestSizes) / sizeof(TestSizes[0]); ++h)
+		{
+			LONG Width = TestSizes[w];
+			LONG Height = TestSizes[h];
+			TestSetContext("%ld x %ld", (long)Width, (long)Height);
+
+			// The tiles cover the image exactly, and only the last column and row are smaller.
+			LONG Columns = (Width + TILE_SIZE - 1) / TILE_SIZE;
+			LONG Rows = (Height + TILE_SIZE - 1) / TILE_SIZE;
+			LONGLONG Area = 0;
+			for (LONG Row = 0; Row < Rows; ++Row)
+			{
+				for (LONG Column = 0; Column < Columns; ++Column)
+				{
+					TILE_BOUNDS Bounds;
+					GetTileBounds(Width, Height, Column, Row, &Bounds);
+					CHECK(Bounds.X == Column * TILE_SIZE && Bounds.Y == Row * TILE_SIZE);
+					CHECK(Bounds.Width == (Column < Columns - 1 ? TILE_SIZE : Width - Bounds.X) && Bounds.Width > 0);
+					CHECK(Bounds.Height == (Row < Rows - 1 ? TILE_SIZE : Height - Bounds.Y) && Bounds.Height > 0);
+					Area += (LONGLONG)Bounds.Width * Bounds.Height;
+				}
+			}
+			CHECK(Area == (LONGLONG)Width * Height);
+
+			// Rectangles whose edges are one pixel before, on and after every tile edge, and far outside.
+			static const LONGLONG Offsets[] = { -1, 0, 1 };
+			LONGLONG Edges[32];
+			UINT EdgeCount = 0;
+			Edges[EdgeCount++] = -1000000;
+			Edges[EdgeCount++] = 1000000;
+			for (LONG Edge = 0; Edge <= (Width > Height ? Width : Height) + TILE_SIZE && EdgeCount + 3 <= 32; Edge += TILE_SIZE)
+			{
+				for (UINT i = 0; i < 3; ++i) Edges[EdgeCount++] = Edge + Offsets[i];
+			}
+			for (UINT l = 0; l < EdgeCount; ++l)
+			{
+				for (UINT r = 0; r < EdgeCount; ++r)
+				{
+					CheckVisibleTiles(Width, Height, Edges[l], Edges[l], Edges[r], Edges[r]);
+					CheckVisibleTiles(Width, Height, Edges[l], 0, Edges[r], Height);
+					CheckVisibleTiles(Width, Height, 0, Edges[l], Width, Edges[r]);
+				}
+			}
+			CheckVisibleTiles(Width, Height, Width - 1, Height - 1, Width, Height);
+			CheckVisibleTiles(Width, Height, Width, 0, Width + 1, Height);
+		}
+	}
+	TestSetContext("");
+
+	// Every pixel of an edge tile comes from the right place of the image.
+	PIXEL_BUFFER *Image = PixelBufferCreate(TILE_SIZE + 3, TILE_SIZE + 5);
+	if (!CHECK(Image != nullptr)) return;
+	for (SIZE_T i = 0; i < Image->SizeCb; ++i) Image->Pixels[i] = (BYTE)(i * 7 + i / 251);
+	TILE_BOUNDS Bounds;
+	GetTileBounds(Image->Width, Image->Height, 1, 1, &Bounds);
+	CHECK(Bounds.Width == 3 && Bounds.Height == 5);
+	BYTE Pixels[3 * 5 * 4 + 1];
+	Pixels[sizeof(Pixels) - 1] = 0xA5;
+	CopyTilePixels(Image, &Bounds, Pixels);
+	for (LONG y = 0; y < Bounds.Height; ++y)
+	{
+		CHECK(memcmp(Pixels + y * Bounds.Width * 4, Image->Pixels + (Bounds.Y + y) * Image->Stride + (SIZE_T)Bounds.X * 4, (SIZE_T)Bounds.Width * 4) == 0);
+	}
+	CHECK(Pixels[sizeof(Pixels) - 1] == 0xA5);
+	PixelBufferRelease(Image);
+}
+
+
+struct TEST_TILE
+{
+	TILE_BOUNDS Bounds;
+	SIZE_T SizeCb;
+};
+
+// What the cache should hold, newest first, and what the callbacks saw.
+struct TILE_MODEL
+{
+	SIZE_T Slots[TEST_MAX_TILES];
+	SIZE_T Sizes[TEST_MAX_TILES];
+	UINT Count;
+	SIZE_T Bytes;
+	UINT Created;
+	UINT Destroyed;
+	UINT Live;
+	BOOL FailCreate;
+};
+
+
+static void *CreateTestTile(void *Context, const PIXEL_BUFFER *Image, const TILE_BOUNDS *Bounds)
+{
+	TILE_MODEL *Model = (TILE_MODEL *)Context;
+	if (Model->FailCreate) return nullptr;
+	TEST_TILE *Tile = (TEST_TILE *)malloc(sizeof(TEST_TILE));
+	if (Tile == nullptr) return nullptr;
+	Tile->Bounds = *Bounds;
+	Tile->SizeCb = (SIZE_T)Bounds->Width * Bounds->Height * 4;
+	++Model->Created;
+	++Model->Live;
+	return Tile;
+}
+
+
+static void DestroyTestTile(void *Context, void *Tile)
+{
+	TILE_MODEL *Model = (TILE_MODEL *)Context;
+	++Model->Destroyed;
+	--Model->Live;
+	free(Tile);
+}
+
+
+// Looks the tile up in the model, the way the cache should: a hit moves it to the front; a miss first drops the oldest
+// tiles until the new one fits (or none are left), then adds it. Returns how many tiles were evicted.
+static UINT ModelGet(TILE_MODEL *Model, SIZE_T Slot, SIZE_T SizeCb, SIZE_T MaxBytes, BOOL *Hit)
+{
+	for (UINT i = 0; i < Model->Count; ++i)
+	{
+		if (Model->Slots[i] != Slot) continue;
+		SIZE_T Size = Model->Sizes[i];
+		memmove(Model->Slots + 1, Model->Slots, i * sizeof(SIZE_T));
+		memmove(Model->Sizes + 1, Model->Sizes, i * sizeof(SIZE_T));
+		Model->Slots[0] = Slot;
+		Model->Sizes[0] = Size;
+		*Hit = true;
+		return 0;
+	}
+	*Hit = false;
+	UINT Evicted = 0;
+	while (Model->Count > 0 && Model->Bytes + SizeCb > MaxBytes)
+	{
+		Model->Bytes -= Model->Sizes[--Model->Count];
+		++Evicted;
+	}
+	memmove(Model->Slots + 1, Model->Slots, Model->Count * sizeof(SIZE_T));
+	memmove(Model->Sizes + 1, Model->Sizes, Model->Count * sizeof(SIZE_T));
+	Model->Slots[0] = Slot;
+	Model->Sizes[0] = SizeCb;
+	++Model->Count;
+	Model->Bytes += SizeCb;
+	return Evicted;
+}
+
+
+// The LRU list of the cache, from newest to oldest, matches the model.
+static BOOL CheckAgainstModel(const TILE_CACHE *Cache, const TILE_MODEL *Model)
+{
+	if (!CHECK(Cache->Bytes == Model->Bytes && Model->Live == Model->Count)) return false;
+	UINT Index = Cache->Newest;
+	UINT Newer = TILE_CACHE_NONE;
+	for (UINT i = 0; i < Model->Count; ++i)
+	{
+		if (!CHECK(Index != TILE_CACHE_NONE)) return false;
+		const TILE_CACHE_ENTRY *Entry = &Cache->Entries[Index];
+		if (!CHECK(Entry->Slot == Model->Slots[i] && Entry->SizeCb == Model->Sizes[i] && Entry->Newer == Newer)) return false;
+		if (!CHECK(Cache->Slots[Entry->Slot] == Index + 1 && ((const TEST_TILE *)Entry->Tile)->SizeCb == Entry->SizeCb)) return false;
+		Newer = Index;
+		Index = Entry->Older;
+	}
+	return CHECK(Index == TILE_CACHE_NONE && Cache->Oldest == Newer);
+}
+
+
+void TestTileCacheEviction()
+{
+	// 4 x 3 tiles; the last column is 10 pixels wide and the last row 1 pixel high, so tiles differ a lot in size.
+	PIXEL_BUFFER *Image = PixelBufferCreate(3 * TILE_SIZE + 10, 2 * TILE_SIZE + 1);
+	PIXEL_BUFFER *Other = PixelBufferCreate(TILE_SIZE, TILE_SIZE);
+	if (!CHECK(Image != nullptr && Other != nullptr)) return;
+	const SIZE_T FullTile = (SIZE_T)TILE_SIZE * TILE_SIZE * 4;
+	// Three full tiles, or more of the small ones; and a limit below the size of a single tile.
+	static const SIZE_T Limits[] = { 3 * FullTile, 3 * FullTile + 1, 2 * FullTile + 10 * TILE_SIZE * 4, FullTile / 2 };
+	for (UINT l = 0; l < sizeof(Limits) / sizeof(Limits[0]); ++l)
+	{
+		TestSetContext("limit %zu", Limits[l]);
+		TILE_MODEL Model = {};
+		TILE_CACHE Cache;
+		TileCacheInit(&Cache, Limits[l], CreateTestTile, DestroyTestTile, &Model);
+		if (!CHECK(TileCacheSetImage(&Cache, Image)) || !CHECK(Cache.Columns == 4 && Cache.Rows == 3)) return;
+		DWORD Random = 1 + l;
+		ULONGLONG Hits = 0, Misses = 0, Evictions = 0;
+		for (UINT i = 0; i < 5000; ++i)
+		{
+			DWORD r = TestRandom(&Random);
+			LONG Column = (LONG)(r % 4);
+			LONG Row = (LONG)(r >> 8) % 3;
+			TILE_BOUNDS Bounds;
+			GetTileBounds(Image->Width, Image->Height, Column, Row, &Bounds);
+			SIZE_T SizeCb = (SIZE_T)Bounds.Width * Bounds.Height * 4;
+			BOOL Hit;
+			UINT Destroyed = Model.Destroyed;
+			UINT Evicted = ModelGet(&Model, (SIZE_T)Row * 4 + Column, SizeCb, Limits[l], &Hit);
+			Evictions += Evicted;
+			Hits += Hit;
+			Misses += !Hit;
+			const TEST_TILE *Tile = (const TEST_TILE *)TileCacheGet(&Cache, Column, Row);
+			if (!CHECK(Tile != nullptr && memcmp(&Tile->Bounds, &Bounds, sizeof(Bounds)) == 0)) break;
+			if (!CHECK(Model.Destroyed - Destroyed == Evicted)) break;
+			if (!CHECK(Cache.Hits == Hits && Cache.Misses == Misses && Cache.Evictions == Evictions)) break;
+			// Over the limit only with the single tile that was just created.
+			if (!CHECK(Cache.Bytes <= Limits[l] || (Model.Count == 1 && Cache.Bytes == SizeCb))) break;
+			if (!CheckAgainstModel(&Cache, &Model)) break;
+		}
+
+		// Outside of the image, there are no tiles, and nothing changes.
+		CHECK(TileCacheGet(&Cache, 4, 0) == nullptr && TileCacheGet(&Cache, 0, 3) == nullptr && TileCacheGet(&Cache, -1, 0) == nullptr);
+		CHECK(Cache.Misses == Misses && CheckAgainstModel(&Cache, &Model));
+
+		// A tile that cannot be created leaves the cache as it was, apart from what was evicted to make room.
+		Model.FailCreate = true;
+		LONG MissingColumn = -1;
+		for (LONG Column = 0; Column < 4 && MissingColumn < 0; ++Column)
+		{
+			if (Cache.Slots[Column] == 0) MissingColumn = Column;
+		}
+		if (MissingColumn >= 0)
+		{
+			BOOL Hit;
+			ModelGet(&Model, (SIZE_T)MissingColumn, (SIZE_T)(MissingColumn < 3 ? TILE_SIZE : 10) * TILE_SIZE * 4, Limits[l], &Hit);
+			// The model added it; take it out again.
+			Model.Bytes -= Model.Sizes[0];
+			memmove(Model.Slots, Model.Slots + 1, --Model.Count * sizeof(SIZE_T));
+			memmove(Model.Sizes, Model.Sizes + 1, Model.Count * sizeof(SIZE_T));
+			CHECK(TileCacheGet(&Cache, MissingColumn, 0) == nullptr && Cache.Slots[MissingColumn] == 0);
+			CheckAgainstModel(&Cache, &Model);
+		}
+		Model.FailCreate = false;
+
+		// The same image keeps the tiles; another one destroys them all, and so does clearing.
+		UINT Live = Model.Live;
+		CHECK(TileCacheSetImage(&Cache, Image) && Model.Live == Live);
+		CHECK(TileCacheSetImage(&Cache, Other) && Model.Live == 0 && Cache.Bytes == 0 && Cache.Columns == 1 && Cache.Rows == 1);
+		CHECK(TileCacheGet(&Cache, 0, 0) != nullptr && Model.Live == 1);
+		TileCacheClear(&Cache);
+		CHECK(Model.Live == 0 && Cache.Bytes == 0 && Cache.Newest == TILE_CACHE_NONE && Cache.Oldest == TILE_CACHE_NONE);
+		CHECK(TileCacheGet(&Cache, 0, 0) != nullptr && Model.Live == 1);
+		TileCacheFree(&Cache);
+		CHECK(Model.Live == 0 && Model.Created == Model.Destroyed);
+	}
+	TestSetContext("");
+	PixelBufferRelease(Other);
+	PixelBufferRelease(Image);
+}
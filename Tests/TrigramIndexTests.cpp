@@ -0,0 +1,282 @@
+// Compares the candidates of the trigram index with a brute-force search of every trigram of the pattern, while
+// documents are added and removed and the lists move between the recent and the packed ones, and checks the case
+// folding, patterns without a trigram, repeated trigrams and the budget.
+
+#include "Test.h"
+#include "TrigramIndex.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_DOCUMENT_COUNT 6000
+#define TEST_MAX_DOCUMENT_LENGTH 400
+
+// Mostly letters that fold to the same six, so that the lists are long, and now and then a rare one.
+static const WCHAR CommonCharacters[] = { 'a', 'A', 'b', 'B', 'c', ' ', 0x3B1, 0x391, 0x436, 0x416 };
+
+struct TEXT_MODEL
+{
+	WCHAR *Text;
+	SIZE_T Starts[TEST_DOCUMENT_COUNT + 1];
+	BOOL Removed[TEST_DOCUMENT_COUNT];
+	UINT Count;
+};
+
+
+static SIZE_T AddString(TRIGRAM_INDEX *Index, ULONGLONG Id, const char *String)
+{
+	WCHAR Text[256];
+	SIZE_T Length = 0;
+	for (; String[Length] != 0; ++Length) Text[Length] = (WCHAR)(BYTE)String[Length];
+	CHECK(TrigramIndexAdd(Index, Id, Text, Length));
+	return Length;
+}
+
+
+static SIZE_T QueryString(const TRIGRAM_INDEX *Index, const char *String, ULONGLONG *Candidates, SIZE_T MaxCandidates)
+{
+	WCHAR Pattern[256];
+	SIZE_T Length = 0;
+	for (; String[Length] != 0; ++Length) Pattern[Length] = (WCHAR)(BYTE)String[Length];
+	return TrigramIndexQuery(Index, Pattern, Length, Candidates, MaxCandidates);
+}
+
+
+// A document is a candidate if it contains every three characters of the pattern, wherever they are.
+static BOOL ContainsTrigrams(const WCHAR *Text, SIZE_T Length, const WCHAR *Pattern, SIZE_T PatternLength)
+{
+	SIZE_T Position;
+	for (SIZE_T i = 0; i + 3 <= PatternLength; ++i)
+	{
+		if (!TextFindFolded(Text, Length, Pattern + i, 3, &Position)) return false;
+	}
+	return true;
+}
+
+
+static void CheckQueries(const TRIGRAM_INDEX *Index, const TEXT_MODEL *Model, DWORD *Random, ULONGLONG *Candidates)
+{
+	for (UINT q = 0; q < 8; ++q)
+	{
+		// Part of a document, which may have been removed, changed in case now and then; or anything.
+		WCHAR Pattern[12];
+		SIZE_T PatternLength = 3 + TestRandom(Random) % 8;
+		UINT Source = TestRandom(Random) % Model->Count;
+		SIZE_T SourceLength = Model->Starts[Source + 1] - Model->Starts[Source];
+		for (SIZE_T i = 0; i < PatternLength; ++i)
+		{
+			if (q % 4 == 3 || SourceLength < PatternLength) Pattern[i] = CommonCharacters[TestRandom(Random) % 10];
+			else Pattern[i] = Model->Text[Model->Starts[Source] + i];
+			if (TestRandom(Random) % 8 == 0) Pattern[i] = Pattern[i] == FoldCase(Pattern[i]) ? (WCHAR)(Pattern[i] - 0x20) : FoldCase(Pattern[i]);
+		}
+		TestSetContext("%u documents, query %u", Model->Count, q);
+		SIZE_T Count = TrigramIndexQuery(Index, Pattern, PatternLength, Candidates, TEST_DOCUMENT_COUNT);
+		SIZE_T c = 0;
+		BOOL Same = true;
+		for (UINT d = Model->Count; d > 0 && Same; --d)
+		{
+			if (Model->Removed[d - 1]) continue;
+			const WCHAR *Text = Model->Text + Model->Starts[d - 1];
+			if (!ContainsTrigrams(Text, Model->Starts[d] - Model->Starts[d - 1], Pattern, PatternLength)) continue;
+			Same = c < Count && Candidates[c++] == d - 1;
+		}
+		if (!CHECK(Same && c == Count)) return;
+	}
+}
+
+
+void TestTrigramIndexFoldCase()
+{
+	CHECK(FoldCase('A') == 'a' && FoldCase('Z') == 'z' && FoldCase('a') == 'a' && FoldCase('@') == '@' && FoldCase('[') == '[');
+	CHECK(FoldCase(0xC4) == 0xE4 && FoldCase(0xDE) == 0xFE && FoldCase(0xD7) == 0xD7 && FoldCase(0xDF) == 0xDF);
+	CHECK(FoldCase(0x391) == 0x3B1 && FoldCase(0x3A3) == 0x3C3 && FoldCase(0x3A2) == 0x3A2 && FoldCase(0x3C2) == 0x3C2);
+	CHECK(FoldCase(0x416) == 0x436 && FoldCase(0x401) == 0x451 && FoldCase(0x436) == 0x436 && FoldCase(0x4E00) == 0x4E00);
+
+	static const WCHAR Text[] = { 'x', 0x416, 0x401, 'L', 'L', 0xC4, ' ', 0x3A3, 0x3C3, 0x3A3 };
+	static const WCHAR Pattern[] = { 0x436, 0x451, 'l', 'l', 0xE4 };
+	SIZE_T Position;
+	CHECK(TextFindFolded(Text, 10, Pattern, 5, &Position) && Position == 1);
+	CHECK(TextFindFolded(Text, 10, Text + 7, 3, &Position) && Position == 7);
+	CHECK(TextFindFolded(Text, 10, Pattern + 1, 4, &Position) && Position == 2);
+	CHECK(!TextFindFolded(Text, 9, Text + 7, 3, &Position));
+	CHECK(TextFindFolded(Text, 10, Pattern, 0, &Position) && Position == 0);
+
+	TRIGRAM_INDEX Index;
+	if (!CHECK(TrigramIndexInit(&Index))) return;
+	CHECK(TrigramIndexAdd(&Index, 10, Text, 10));
+	AddString(&Index, 11, "Hello, World");
+	AddString(&Index, 12, "HELLO again");
+	ULONGLONG Candidates[4];
+	CHECK(TrigramIndexQuery(&Index, Pattern, 5, Candidates, 4) == 1 && Candidates[0] == 10);
+	CHECK(QueryString(&Index, "hello", Candidates, 4) == 2 && Candidates[0] == 12 && Candidates[1] == 11);
+	CHECK(QueryString(&Index, "wORLD", Candidates, 4) == 1 && Candidates[0] == 11);
+	CHECK(QueryString(&Index, "hellx", Candidates, 4) == 0);
+	TrigramIndexFree(&Index);
+}
+
+
+void TestTrigramIndexBruteForce()
+{
+	static TEXT_MODEL Model;
+	Model.Text = (WCHAR *)malloc(TEST_DOCUMENT_COUNT * TEST_MAX_DOCUMENT_LENGTH * sizeof(WCHAR));
+	ULONGLONG *Candidates = (ULONGLONG *)malloc(TEST_DOCUMENT_COUNT * sizeof(ULONGLONG));
+	TRIGRAM_INDEX Index;
+	if (!CHECK(Model.Text != nullptr && Candidates != nullptr && TrigramIndexInit(&Index)))
+	{
+		free(Model.Text);
+		free(Candidates);
+		return;
+	}
+	Model.Count = 0;
+	Model.Starts[0] = 0;
+
+	DWORD Random = 3;
+	BOOL SawRecentOnly = false;
+	BOOL SawPackedOnly = false;
+	BOOL SawBoth = false;
+	UINT RemovedBefore = 0;
+	while (Model.Count < TEST_DOCUMENT_COUNT)
+	{
+		// Some documents too short to have a trigram, and runs of the same character.
+		SIZE_T Length = TestRandom(&Random) % 8 == 0 ? TestRandom(&Random) % 4 : TestRandom(&Random) % TEST_MAX_DOCUMENT_LENGTH;
+		WCHAR *Text = Model.Text + Model.Starts[Model.Count];
+		for (SIZE_T i = 0; i < Length; ++i)
+		{
+			DWORD r = TestRandom(&Random);
+			if (r % 50 == 0) Text[i] = (WCHAR)('d' + r / 50 % 23);
+			else if (r % 50 < 3 && i > 0) Text[i] = Text[i - 1];
+			else Text[i] = CommonCharacters[r / 50 % 10];
+		}
+		if (!CHECK(TrigramIndexAdd(&Index, Model.Count, Text, Length))) break;
+		Model.Removed[Model.Count] = false;
+		Model.Starts[Model.Count + 1] = Model.Starts[Model.Count] + Length;
+		++Model.Count;
+		CHECK(!TrigramIndexAdd(&Index, Model.Count - 1, Text, Length));
+
+		// Remove single documents, and once, most of the oldest ones, in order.
+		if (TestRandom(&Random) % 5 == 0)
+		{
+			UINT Id = TestRandom(&Random) % Model.Count;
+			CHECK(TrigramIndexRemove(&Index, Id) == !Model.Removed[Id]);
+			Model.Removed[Id] = true;
+		}
+		if (Model.Count == TEST_DOCUMENT_COUNT / 2)
+		{
+			for (; RemovedBefore < Model.Count * 3 / 4; ++RemovedBefore)
+			{
+				CHECK(TrigramIndexRemove(&Index, RemovedBefore) == !Model.Removed[RemovedBefore]);
+				Model.Removed[RemovedBefore] = true;
+			}
+		}
+		SawRecentOnly |= Index.RecentSizeCb > 0 && Index.PackedSizeCb == 0;
+		SawPackedOnly |= Index.RecentSizeCb == 0 && Index.PackedSizeCb > 0;
+		SawBoth |= Index.RecentSizeCb > 0 && Index.PackedSizeCb > 0;
+		if (Model.Count % 100 == 0) CheckQueries(&Index, &Model, &Random, Candidates);
+	}
+	TestSetContext("");
+	CHECK(Index.UnindexedCount == 0 && Index.FirstOrdinal > 0);
+	CHECK(SawRecentOnly && SawPackedOnly && SawBoth);
+	CHECK(!TrigramIndexRemove(&Index, 0) && !TrigramIndexRemove(&Index, TEST_DOCUMENT_COUNT));
+
+	TrigramIndexFree(&Index);
+	free(Model.Text);
+	free(Candidates);
+}
+
+
+// Without a trigram, every document is a candidate, those shorter than a trigram included, but not the removed ones.
+void TestTrigramIndexShortPatterns()
+{
+	TRIGRAM_INDEX Index;
+	if (!CHECK(TrigramIndexInit(&Index))) return;
+	AddString(&Index, 1, "");
+	AddString(&Index, 2, "ab");
+	AddString(&Index, 3, "abc");
+	AddString(&Index, 5, "xyz");
+	AddString(&Index, 8, "q");
+	CHECK(TrigramIndexRemove(&Index, 3));
+
+	ULONGLONG Candidates[8];
+	static const char *const Patterns[] = { "", "a", "AB", "zz" };
+	for (UINT p = 0; p < sizeof(Patterns) / sizeof(Patterns[0]); ++p)
+	{
+		TestSetContext("\"%s\"", Patterns[p]);
+		CHECK(QueryString(&Index, Patterns[p], Candidates, 8) == 4 && Candidates[0] == 8 && Candidates[1] == 5 && Candidates[2] == 2 && Candidates[3] == 1);
+		CHECK(QueryString(&Index, Patterns[p], Candidates, 2) == 2 && Candidates[0] == 8 && Candidates[1] == 5);
+		CHECK(QueryString(&Index, Patterns[p], Candidates, 0) == 0);
+	}
+	TestSetContext("");
+	CHECK(QueryString(&Index, "abc", Candidates, 8) == 0);
+	CHECK(QueryString(&Index, "XYZ", Candidates, 8) == 1 && Candidates[0] == 5);
+	CHECK(QueryString(&Index, "XYZ", Candidates, 0) == 0);
+	TrigramIndexFree(&Index);
+}
+
+
+// A trigram that occurs many times in a document, or in a pattern, lists the document once.
+void TestTrigramIndexRepeatedTrigrams()
+{
+	TRIGRAM_INDEX Index;
+	if (!CHECK(TrigramIndexInit(&Index))) return;
+	AddString(&Index, 1, "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
+	AddString(&Index, 2, "abcabcabcabcabcabcabcabcabc");
+	AddString(&Index, 3, "aaa");
+	AddString(&Index, 4, "xaaax abcab");
+	AddString(&Index, 5, "AbCaBc");
+
+	ULONGLONG Candidates[8];
+	CHECK(QueryString(&Index, "aaa", Candidates, 8) == 3 && Candidates[0] == 4 && Candidates[1] == 3 && Candidates[2] == 1);
+	// All of the trigrams of the pattern are in "xaaax", even though the pattern is not.
+	CHECK(QueryString(&Index, "AAAAAAAA", Candidates, 8) == 3 && Candidates[2] == 1);
+	CHECK(QueryString(&Index, "abcabcabca", Candidates, 8) == 3 && Candidates[0] == 5 && Candidates[1] == 4 && Candidates[2] == 2);
+	CHECK(QueryString(&Index, "bcab", Candidates, 8) == 3 && Candidates[0] == 5 && Candidates[1] == 4 && Candidates[2] == 2);
+	CHECK(QueryString(&Index, "aaab", Candidates, 8) == 0);
+	TrigramIndexFree(&Index);
+}
+
+
+// Text that is nothing but new trigrams does not fit the budget. What does not fit is not indexed, and returned by
+// every query.
+void TestTrigramIndexBudget()
+{
+	TRIGRAM_INDEX Index;
+	if (!CHECK(TrigramIndexInit(&Index))) return;
+	WCHAR *Text = (WCHAR *)malloc(4096 * sizeof(WCHAR));
+	if (!CHECK(Text != nullptr)) return;
+	DWORD Random = 5;
+	ULONGLONG Candidates[8];
+	static BOOL IsUnindexed[1000];
+	UINT Unindexed = 0;
+	for (UINT d = 0; d < 1000; ++d)
+	{
+		TestSetContext("document %u", d);
+		for (UINT i = 0; i < 4096; ++i) Text[i] = (WCHAR)(0x4E00 + TestRandom(&Random) % 0x5000);
+		if (d % 100 == 0) memcpy(Text, u"needle", 6 * sizeof(WCHAR));
+		if (!CHECK(TrigramIndexAdd(&Index, d, Text, 4096))) break;
+		if (!CHECK(TrigramIndexGetMemoryUsage(&Index) <= TrigramIndexGetBudget(&Index))) break;
+		IsUnindexed[d] = Index.Documents[Index.DocumentCount - 1].State == TRIGRAM_DOCUMENT_UNINDEXED;
+		if (!IsUnindexed[d]) continue;
+		++Unindexed;
+		CHECK(QueryString(&Index, "zzz", Candidates, 8) >= 1 && Candidates[0] == d);
+	}
+	TestSetContext("");
+	CHECK(Unindexed > 0 && Unindexed == Index.UnindexedCount && Unindexed < 1000);
+
+	// The needles, and the documents that are not indexed, newest first.
+	SIZE_T Count = QueryString(&Index, "NEEDLE", Candidates, 8);
+	BOOL Expected = Count == 8;
+	for (SIZE_T c = 0, d = 1000; c < Count && Expected; ++c)
+	{
+		do --d;
+		while (d % 100 != 0 && !IsUnindexed[d]);
+		Expected = Candidates[c] == d;
+	}
+	CHECK(Expected);
+
+	for (UINT d = 0; d < 1000; ++d)
+	{
+		if (IsUnindexed[d]) CHECK(TrigramIndexRemove(&Index, d));
+	}
+	CHECK(Index.UnindexedCount == 0 && QueryString(&Index, "zzz", Candidates, 8) == 0);
+	free(Text);
+	TrigramIndexFree(&Index);
+}
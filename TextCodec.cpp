@@ -0,0 +1,654 @@
+#include "TextCodec.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TEXT_CODEC_MAGIC 0x545A4C43 // "CLZT"
+
+// A sequence is a token byte (literal count in the high nibble, match length - MIN_MATCH in the low one), more length
+// bytes for the literal count if its nibble is 15, the literals, the match offset (2 bytes, little endian), and more
+// length bytes for the match length if its nibble is 15. Longer lengths continue in bytes of 255, up to a byte below
+// that. The last sequence has no match.
+#define MIN_MATCH 4
+#define MAX_OFFSET 65535
+#define HASH_BITS 14
+#define HASH_SIZE (1 << HASH_BITS)
+// The encoder steps faster through data that does not compress: one more byte for every 64 bytes without a match.
+#define SKIP_SHIFT 6
+
+// TextDictionaryTrain looks for segments of this many bytes made of d-mers that show up in many of the samples.
+#define TRAIN_DMER 8
+#define TRAIN_SEGMENT 128
+#define TRAIN_HASH_BITS 18
+#define TRAIN_MAX_SAMPLE_BYTES (4 * 1024 * 1024)
+
+
+static DWORD Read32(const BYTE *p)
+{
+	DWORD Value;
+	memcpy(&Value, p, sizeof(Value));
+	return Value;
+}
+
+
+static ULONGLONG Read64(const BYTE *p)
+{
+	ULONGLONG Value;
+	memcpy(&Value, p, sizeof(Value));
+	return Value;
+}
+
+
+static UINT HashAt(const BYTE *p)
+{
+	return (Read32(p) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+
+// Size of Text in UTF-8. Unpaired surrogates take 3 bytes, like any other character from U+0800 to U+FFFF.
+static SIZE_T GetUtf8Size(const WCHAR *Text, SIZE_T Length)
+{
+	SIZE_T Size = 0;
+	for (SIZE_T i = 0; i < Length; ++i)
+	{
+		UINT c = Text[i];
+		if (c < 0x80) Size += 1;
+		else if (c < 0x800) Size += 2;
+		else if (c >= 0xD800 && c < 0xDC00 && i + 1 < Length && Text[i + 1] >= 0xDC00 && Text[i + 1] < 0xE000)
+		{
+			Size += 4;
+			++i;
+		}
+		else Size += 3;
+	}
+	return Size;
+}
+
+
+// Out must have room for GetUtf8Size bytes.
+static void Utf16ToUtf8(const WCHAR *Text, SIZE_T Length, BYTE *Out)
+{
+	SIZE_T i = 0;
+	while (i < Length)
+	{
+#ifdef PORTABLE_SSE2
+		// 16 characters of ASCII at once.
+		while (i + 16 <= Length)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i *)(Text + i));
+			__m128i b = _mm_loadu_si128((const __m128i *)(Text + i + 8));
+			__m128i NonAscii = _mm_and_si128(_mm_or_si128(a, b), _mm_set1_epi16((short)0xFF80));
+			if (_mm_movemask_epi8(_mm_cmpeq_epi16(NonAscii, _mm_setzero_si128())) != 0xFFFF) break;
+			_mm_storeu_si128((__m128i *)Out, _mm_packus_epi16(a, b));
+			Out += 16;
+			i += 16;
+		}
+		if (i == Length) break;
+#endif
+		UINT c = Text[i++];
+		if (c < 0x80)
+		{
+			*Out++ = (BYTE)c;
+		}
+		else if (c < 0x800)
+		{
+			*Out++ = (BYTE)(0xC0 | (c >> 6));
+			*Out++ = (BYTE)(0x80 | (c & 0x3F));
+		}
+		else if (c >= 0xD800 && c < 0xDC00 && i < Length && Text[i] >= 0xDC00 && Text[i] < 0xE000)
+		{
+			c = 0x10000 + ((c - 0xD800) << 10) + (Text[i++] - 0xDC00);
+			*Out++ = (BYTE)(0xF0 | (c >> 18));
+			*Out++ = (BYTE)(0x80 | ((c >> 12) & 0x3F));
+			*Out++ = (BYTE)(0x80 | ((c >> 6) & 0x3F));
+			*Out++ = (BYTE)(0x80 | (c & 0x3F));
+		}
+		else
+		{
+			*Out++ = (BYTE)(0xE0 | (c >> 12));
+			*Out++ = (BYTE)(0x80 | ((c >> 6) & 0x3F));
+			*Out++ = (BYTE)(0x80 | (c & 0x3F));
+		}
+	}
+}
+
+
+// Returns false unless In is exactly Length characters of UTF-8, as written by Utf16ToUtf8.
+static BOOL Utf8ToUtf16(const BYTE *In, SIZE_T SizeCb, WCHAR *Text, SIZE_T Length)
+{
+	SIZE_T i = 0;
+	SIZE_T o = 0;
+	while (i < SizeCb)
+	{
+#ifdef PORTABLE_SSE2
+		while (i + 16 <= SizeCb && o + 16 <= Length)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i *)(In + i));
+			if (_mm_movemask_epi8(v) != 0) break;
+			_mm_storeu_si128((__m128i *)(Text + o), _mm_unpacklo_epi8(v, _mm_setzero_si128()));
+			_mm_storeu_si128((__m128i *)(Text + o + 8), _mm_unpackhi_epi8(v, _mm_setzero_si128()));
+			i += 16;
+			o += 16;
+		}
+		if (i == SizeCb) break;
+#endif
+		UINT c = In[i];
+		SIZE_T Bytes;
+		if (c < 0x80) Bytes = 1;
+		else if ((c & 0xE0) == 0xC0) Bytes = 2, c &= 0x1F;
+		else if ((c & 0xF0) == 0xE0) Bytes = 3, c &= 0x0F;
+		else if ((c & 0xF8) == 0xF0) Bytes = 4, c &= 0x07;
+		else return false;
+		if (Bytes > SizeCb - i) return false;
+		for (SIZE_T k = 1; k < Bytes; ++k)
+		{
+			if ((In[i + k] & 0xC0) != 0x80) return false;
+			c = (c << 6) | (In[i + k] & 0x3F);
+		}
+		i += Bytes;
+
+		if (Bytes < 4)
+		{
+			if (o == Length) return false;
+			Text[o++] = (WCHAR)c;
+		}
+		else
+		{
+			if (c < 0x10000 || c > 0x10FFFF || Length - o < 2) return false;
+			c -= 0x10000;
+			Text[o++] = (WCHAR)(0xD800 + (c >> 10));
+			Text[o++] = (WCHAR)(0xDC00 + (c & 0x3FF));
+		}
+	}
+	return o == Length;
+}
+
+
+static BYTE *WriteLength(BYTE *Out, SIZE_T Length)
+{
+	while (Length >= 255)
+	{
+		*Out++ = 255;
+		Length -= 255;
+	}
+	*Out++ = (BYTE)Length;
+	return Out;
+}
+
+
+// A sequence without a match if MatchLength is 0.
+static BYTE *WriteSequence(BYTE *Out, const BYTE *Literals, SIZE_T LiteralCount, SIZE_T Offset, SIZE_T MatchLength)
+{
+	SIZE_T MatchCode = MatchLength != 0 ? MatchLength - MIN_MATCH : 0;
+	*Out++ = (BYTE)(((LiteralCount < 15 ? LiteralCount : 15) << 4) | (MatchCode < 15 ? MatchCode : 15));
+	if (LiteralCount >= 15) Out = WriteLength(Out, LiteralCount - 15);
+	memcpy(Out, Literals, LiteralCount);
+	Out += LiteralCount;
+	if (MatchLength == 0) return Out;
+	*Out++ = (BYTE)Offset;
+	*Out++ = (BYTE)(Offset >> 8);
+	if (MatchCode >= 15) Out = WriteLength(Out, MatchCode - 15);
+	return Out;
+}
+
+
+// Number of bytes that a and b (which is before a) have in common, up to End.
+static SIZE_T GetCommonLength(const BYTE *a, const BYTE *b, const BYTE *End)
+{
+	const BYTE *Start = a;
+	while (End - a >= 8)
+	{
+		ULONGLONG Difference = Read64(a) ^ Read64(b);
+		if (Difference != 0)
+		{
+			// Little endian: the first differing byte is the lowest nonzero one.
+			while ((Difference & 0xFF) == 0)
+			{
+				Difference >>= 8;
+				++a;
+			}
+			return a - Start;
+		}
+		a += 8;
+		b += 8;
+	}
+	while (a < End && *a == *b)
+	{
+		++a;
+		++b;
+	}
+	return a - Start;
+}
+
+
+// Compresses Window[Start, End); whatever is in front of Start (the dictionary) may be referred to. Table holds the
+// hashed positions in front of Start. Returns the number of bytes written to Out.
+static SIZE_T EncodeLz(const BYTE *Window, SIZE_T Start, SIZE_T End, DWORD *Table, BYTE *Out)
+{
+	BYTE *First = Out;
+	SIZE_T Anchor = Start;
+	SIZE_T i = Start;
+	while (i + MIN_MATCH <= End)
+	{
+		UINT Hash = HashAt(Window + i);
+		SIZE_T Candidate = Table[Hash];
+		Table[Hash] = (DWORD)i;
+		if (Candidate >= i || i - Candidate > MAX_OFFSET || Read32(Window + Candidate) != Read32(Window + i))
+		{
+			i += 1 + ((i - Anchor) >> SKIP_SHIFT);
+			continue;
+		}
+
+		// The match may start before the position that found it.
+		while (i > Anchor && Candidate > 0 && Window[i - 1] == Window[Candidate - 1])
+		{
+			--i;
+			--Candidate;
+		}
+		SIZE_T Length = MIN_MATCH + GetCommonLength(Window + i + MIN_MATCH, Window + Candidate + MIN_MATCH, Window + End);
+		Out = WriteSequence(Out, Window + Anchor, i - Anchor, i - Candidate, Length);
+		i += Length;
+		Anchor = i;
+		// A position within the match, so that repeats of its end can be found.
+		if (i + 2 <= End) Table[HashAt(Window + i - 2)] = (DWORD)(i - 2);
+	}
+	Out = WriteSequence(Out, Window + Anchor, End - Anchor, 0, 0);
+	return Out - First;
+}
+
+
+static BOOL ReadLength(const BYTE **In, const BYTE *End, SIZE_T Limit, SIZE_T *Length)
+{
+	const BYTE *p = *In;
+	for (;;)
+	{
+		if (p == End) return false;
+		BYTE Byte = *p++;
+		*Length += Byte;
+		if (*Length > Limit) return false;
+		if (Byte != 255) break;
+	}
+	*In = p;
+	return true;
+}
+
+
+// Copies from Source to Out up to End, in chunks of 8 bytes, so up to 7 bytes more than that are read and written.
+// Source may overlap Out if it is at least 8 bytes before it.
+static void CopyChunks(BYTE *Out, const BYTE *Source, const BYTE *End)
+{
+	do
+	{
+		memcpy(Out, Source, 8);
+		Out += 8;
+		Source += 8;
+	} while (Out < End);
+}
+
+
+// Decodes exactly OutSize bytes. Copies reaching back beyond Out continue in the dictionary. Never reads or writes
+// outside of the buffers, whatever the input.
+static BOOL DecodeLz(const BYTE *In, SIZE_T InSize, const BYTE *Dictionary, SIZE_T DictionarySize, BYTE *Out, SIZE_T OutSize)
+{
+	const BYTE *ip = In;
+	const BYTE *InEnd = In + InSize;
+	BYTE *op = Out;
+	BYTE *OutEnd = Out + OutSize;
+	for (;;)
+	{
+		if (ip == InEnd) return false;
+		UINT Token = *ip++;
+
+		// The common case: few literals, a short match that is not in the dictionary, and enough room around it for
+		// whole chunks. (More than 14 literals are followed by at least 18 bytes, so this is not the last sequence.)
+		if (Token < 0xF0 && (Token & 15) != 15 && InEnd - ip >= 32 && OutEnd - op >= 48)
+		{
+			SIZE_T LiteralCount = Token >> 4;
+			memcpy(op, ip, 16);
+			ip += LiteralCount;
+			op += LiteralCount;
+			SIZE_T Offset = ip[0] | (ip[1] << 8);
+			SIZE_T Produced = op - Out;
+			const BYTE *Match = nullptr;
+			if (Offset >= 8 && Offset <= Produced) Match = op - Offset;
+			else if (Offset >= Produced + 18 && Offset - Produced <= DictionarySize) Match = Dictionary + DictionarySize - (Offset - Produced);
+			if (Match != nullptr)
+			{
+				memcpy(op, Match, 8);
+				memcpy(op + 8, Match + 8, 8);
+				memcpy(op + 16, Match + 16, 2);
+				ip += 2;
+				op += (Token & 15) + MIN_MATCH;
+				continue;
+			}
+			// Back to the general case, for the match only.
+			ip -= LiteralCount;
+			op -= LiteralCount;
+		}
+
+		SIZE_T LiteralCount = Token >> 4;
+		if (LiteralCount == 15 && !ReadLength(&ip, InEnd, OutSize, &LiteralCount)) return false;
+		if (LiteralCount > (SIZE_T)(InEnd - ip) || LiteralCount > (SIZE_T)(OutEnd - op)) return false;
+		if (LiteralCount <= 32 && InEnd - ip >= 32 && OutEnd - op >= 32)
+		{
+			memcpy(op, ip, 16);
+			memcpy(op + 16, ip + 16, 16);
+		}
+		else
+		{
+			memcpy(op, ip, LiteralCount);
+		}
+		ip += LiteralCount;
+		op += LiteralCount;
+		if (ip == InEnd) return op == OutEnd;
+
+		if (InEnd - ip < 2) return false;
+		SIZE_T Offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		SIZE_T Length = Token & 15;
+		if (Length == 15 && !ReadLength(&ip, InEnd, OutSize, &Length)) return false;
+		Length += MIN_MATCH;
+		if (Offset == 0 || Length > (SIZE_T)(OutEnd - op)) return false;
+
+		SIZE_T Produced = op - Out;
+		if (Offset > Produced)
+		{
+			SIZE_T Back = Offset - Produced;
+			if (Back > DictionarySize) return false;
+			SIZE_T Count = Back < Length ? Back : Length;
+			if (Back - Count >= 8 && OutEnd - (op + Count) >= 8)
+			{
+				CopyChunks(op, Dictionary + DictionarySize - Back, op + Count);
+			}
+			else
+			{
+				memcpy(op, Dictionary + DictionarySize - Back, Count);
+			}
+			op += Count;
+			Length -= Count;
+			// Anything left continues at the start of Out.
+		}
+		if (Length == 0) continue;
+
+		const BYTE *Match = op - Offset;
+		BYTE *CopyEnd = op + Length;
+		if (Offset < 8)
+		{
+			// Overlapping: a pattern of Offset bytes, repeated. Once a few bytes of it are in place, the rest can be
+			// copied from a multiple of Offset that is at least 8 back.
+			SIZE_T Stride = Offset * ((8 + Offset - 1) / Offset);
+			BYTE *PatternEnd = op + (Stride - Offset);
+			while (op < CopyEnd && op < PatternEnd) *op++ = *Match++;
+			if (op == CopyEnd) continue;
+			Match = op - Stride;
+		}
+		if (OutEnd - CopyEnd >= 8)
+		{
+			CopyChunks(op, Match, CopyEnd);
+			op = CopyEnd;
+		}
+		else
+		{
+			while (op < CopyEnd) *op++ = *Match++;
+		}
+	}
+}
+
+
+SIZE_T TextCodecGetMaxSize(SIZE_T Length)
+{
+	// UTF-16 at worst, all of it literals.
+	SIZE_T SizeCb = Length * sizeof(WCHAR);
+	return sizeof(TEXT_CODEC_HEADER) + SizeCb + SizeCb / 255 + 16;
+}
+
+
+static void HashDictionary(const BYTE *Data, SIZE_T SizeCb, DWORD *Table)
+{
+	for (SIZE_T i = 0; i + MIN_MATCH <= SizeCb; ++i)
+	{
+		Table[HashAt(Data + i)] = (DWORD)i;
+	}
+}
+
+
+// Output must have room for TextCodecGetMaxSize(Length) bytes. Returns the size of the output, or 0 if there is not
+// enough memory.
+SIZE_T TextCodecEncode(const WCHAR *Text, SIZE_T Length, const TEXT_DICTIONARY *Dictionary, void *Output)
+{
+	SIZE_T Utf8Size = GetUtf8Size(Text, Length);
+	BOOL Utf8 = Utf8Size <= Length * sizeof(WCHAR);
+	SIZE_T CodedSize = Utf8 ? Utf8Size : Length * sizeof(WCHAR);
+	SIZE_T DictionarySize = Dictionary != nullptr ? Dictionary->SizeCb : 0;
+	// Window positions are kept in DWORDs.
+	if (CodedSize > 0xFFFFFFFF - DictionarySize) return 0;
+
+	BYTE *Window = (BYTE *)malloc(DictionarySize + CodedSize + 1);
+	DWORD *Table = (DWORD *)malloc(HASH_SIZE * sizeof(DWORD));
+	if (Window == nullptr || Table == nullptr)
+	{
+		free(Window);
+		free(Table);
+		return 0;
+	}
+	if (DictionarySize > 0) memcpy(Window, Dictionary->Data, DictionarySize);
+	if (Utf8) Utf16ToUtf8(Text, Length, Window + DictionarySize);
+	else memcpy(Window + DictionarySize, Text, CodedSize);
+	if (Dictionary != nullptr && Dictionary->HashTable != nullptr)
+	{
+		memcpy(Table, Dictionary->HashTable, HASH_SIZE * sizeof(DWORD));
+	}
+	else
+	{
+		memset(Table, 0, HASH_SIZE * sizeof(DWORD));
+		if (DictionarySize > 0) HashDictionary(Window, DictionarySize, Table);
+	}
+
+	TEXT_CODEC_HEADER *Header = (TEXT_CODEC_HEADER *)Output;
+	Header->Magic = TEXT_CODEC_MAGIC;
+	Header->Flags = Utf8 ? TEXT_CODEC_UTF8 : 0;
+	Header->Length = Length;
+	Header->CodedSizeCb = CodedSize;
+	Header->DictionaryId = Dictionary != nullptr ? Dictionary->Id : 0;
+	SIZE_T SizeCb = sizeof(TEXT_CODEC_HEADER) + EncodeLz(Window, DictionarySize, DictionarySize + CodedSize, Table, (BYTE *)(Header + 1));
+	free(Window);
+	free(Table);
+	return SizeCb;
+}
+
+
+// Checks the header of something that claims to be the output of TextCodecEncode, of SizeCb bytes. Corrupted code
+// is caught by TextCodecDecode.
+const TEXT_CODEC_HEADER *TextCodecValidate(const void *Data, SIZE_T SizeCb)
+{
+	if (SizeCb < sizeof(TEXT_CODEC_HEADER)) return nullptr;
+	const TEXT_CODEC_HEADER *Header = (const TEXT_CODEC_HEADER *)Data;
+	if (Header->Magic != TEXT_CODEC_MAGIC || (Header->Flags & ~TEXT_CODEC_UTF8) != 0) return nullptr;
+	if (Header->Length > ((SIZE_T)-1 - sizeof(WCHAR)) / 3) return nullptr;
+	if (Header->Flags & TEXT_CODEC_UTF8)
+	{
+		if (Header->CodedSizeCb < Header->Length || Header->CodedSizeCb > Header->Length * 3) return nullptr;
+	}
+	else if (Header->CodedSizeCb != Header->Length * sizeof(WCHAR)) return nullptr;
+	// No length byte stands for more than 255 bytes, so a small input cannot claim a huge text.
+	if (Header->CodedSizeCb / 255 > SizeCb - sizeof(TEXT_CODEC_HEADER)) return nullptr;
+	return Header;
+}
+
+
+// Decodes a validated header, of SizeCb bytes with the code, into Text, which must have room for Header->Length
+// characters. Dictionary must be the one the text was encoded with, or may be null if the text was encoded without one.
+// Returns false if the code is corrupted or the dictionary does not match.
+BOOL TextCodecDecode(const TEXT_CODEC_HEADER *Header, SIZE_T SizeCb, const TEXT_DICTIONARY *Dictionary, WCHAR *Text)
+{
+	if (Header->DictionaryId != 0 && (Dictionary == nullptr || Dictionary->Id != Header->DictionaryId)) return false;
+	const BYTE *DictionaryData = Header->DictionaryId != 0 ? Dictionary->Data : nullptr;
+	SIZE_T DictionarySize = Header->DictionaryId != 0 ? Dictionary->SizeCb : 0;
+	const BYTE *Code = (const BYTE *)(Header + 1);
+	SIZE_T CodeSize = SizeCb - sizeof(TEXT_CODEC_HEADER);
+	if (!(Header->Flags & TEXT_CODEC_UTF8))
+	{
+		return DecodeLz(Code, CodeSize, DictionaryData, DictionarySize, (BYTE *)Text, (SIZE_T)Header->CodedSizeCb);
+	}
+
+	BYTE *Utf8 = (BYTE *)malloc((SIZE_T)Header->CodedSizeCb + 1);
+	if (Utf8 == nullptr) return false;
+	BOOL Decoded = DecodeLz(Code, CodeSize, DictionaryData, DictionarySize, Utf8, (SIZE_T)Header->CodedSizeCb) &&
+		Utf8ToUtf16(Utf8, (SIZE_T)Header->CodedSizeCb, Text, (SIZE_T)Header->Length);
+	free(Utf8);
+	return Decoded;
+}
+
+
+// Copies Data (which is taken as UTF-8). Returns null if there is not enough memory, Data is larger than
+// TEXT_DICTIONARY_MAX_SIZE, or Id is 0.
+TEXT_DICTIONARY *TextDictionaryCreate(const void *Data, SIZE_T SizeCb, ULONGLONG Id)
+{
+	if (SizeCb > TEXT_DICTIONARY_MAX_SIZE || Id == 0) return nullptr;
+	TEXT_DICTIONARY *Dictionary = (TEXT_DICTIONARY *)calloc(1, sizeof(TEXT_DICTIONARY));
+	if (Dictionary == nullptr) return nullptr;
+	Dictionary->Data = (BYTE *)malloc(SizeCb != 0 ? SizeCb : 1);
+	if (Dictionary->Data == nullptr)
+	{
+		free(Dictionary);
+		return nullptr;
+	}
+	memcpy(Dictionary->Data, Data, SizeCb);
+	Dictionary->SizeCb = SizeCb;
+	Dictionary->Id = Id;
+	return Dictionary;
+}
+
+
+// Hashes the dictionary once, for all texts that TextCodecEncode compresses with it. Without this, it is hashed again
+// for every text.
+BOOL TextDictionaryPrepareEncoding(TEXT_DICTIONARY *Dictionary)
+{
+	if (Dictionary->HashTable != nullptr) return true;
+	DWORD *Table = (DWORD *)calloc(HASH_SIZE, sizeof(DWORD));
+	if (Table == nullptr) return false;
+	HashDictionary(Dictionary->Data, Dictionary->SizeCb, Table);
+	Dictionary->HashTable = Table;
+	return true;
+}
+
+
+void TextDictionaryFree(TEXT_DICTIONARY *Dictionary)
+{
+	if (Dictionary == nullptr) return;
+	free(Dictionary->Data);
+	free(Dictionary->HashTable);
+	free(Dictionary);
+}
+
+
+static UINT HashDmer(const BYTE *p)
+{
+	return (UINT)((Read64(p) * 0x9E3779B97F4A7C15ull) >> (64 - TRAIN_HASH_BITS));
+}
+
+
+struct TRAIN_SEGMENT_INFO
+{
+	SIZE_T Offset;
+	ULONGLONG Score;
+};
+
+
+static int CompareSegmentScores(const void *a, const void *b)
+{
+	ULONGLONG x = ((const TRAIN_SEGMENT_INFO *)a)->Score;
+	ULONGLONG y = ((const TRAIN_SEGMENT_INFO *)b)->Score;
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+
+// Builds a dictionary of up to Capacity bytes (at most TEXT_DICTIONARY_MAX_SIZE) from sample texts, and returns its
+// size. This is a simple take on the "cover" method: the samples are cut into as many epochs as the dictionary has
+// segments, and from each epoch, the segment is picked whose d-mers are in the most samples. D-mers that a picked
+// segment covers do not count again. Returns 0 if there is not enough memory, or nothing worth putting in a dictionary.
+SIZE_T TextDictionaryTrain(const WCHAR *const *Texts, const SIZE_T *Lengths, UINT Count, void *Dictionary, SIZE_T Capacity)
+{
+	if (Capacity > TEXT_DICTIONARY_MAX_SIZE) Capacity = TEXT_DICTIONARY_MAX_SIZE;
+	SIZE_T SegmentCount = Capacity / TRAIN_SEGMENT;
+	SIZE_T Total = 0;
+	UINT SampleCount = 0;
+	while (SampleCount < Count)
+	{
+		SIZE_T Size = GetUtf8Size(Texts[SampleCount], Lengths[SampleCount]);
+		if (Size > TRAIN_MAX_SAMPLE_BYTES - Total) break;
+		Total += Size;
+		++SampleCount;
+	}
+	if (SegmentCount == 0 || Total < TRAIN_SEGMENT) return 0;
+
+	BYTE *Samples = (BYTE *)malloc(Total);
+	UINT *Frequencies = (UINT *)calloc((SIZE_T)1 << TRAIN_HASH_BITS, sizeof(UINT));
+	UINT *LastSample = (UINT *)malloc(((SIZE_T)1 << TRAIN_HASH_BITS) * sizeof(UINT));
+	TRAIN_SEGMENT_INFO *Segments = (TRAIN_SEGMENT_INFO *)malloc(SegmentCount * sizeof(TRAIN_SEGMENT_INFO));
+	SIZE_T Found = 0;
+	if (Samples != nullptr && Frequencies != nullptr && LastSample != nullptr && Segments != nullptr)
+	{
+		// In how many samples each d-mer is.
+		memset(LastSample, 0xFF, ((SIZE_T)1 << TRAIN_HASH_BITS) * sizeof(UINT));
+		SIZE_T Start = 0;
+		for (UINT s = 0; s < SampleCount; ++s)
+		{
+			SIZE_T Size = GetUtf8Size(Texts[s], Lengths[s]);
+			Utf16ToUtf8(Texts[s], Lengths[s], Samples + Start);
+			for (SIZE_T p = Start; p + TRAIN_DMER <= Start + Size; ++p)
+			{
+				UINT Hash = HashDmer(Samples + p);
+				if (LastSample[Hash] != s)
+				{
+					LastSample[Hash] = s;
+					++Frequencies[Hash];
+				}
+			}
+			Start += Size;
+		}
+		// Whatever is in a single sample only is no help for the others.
+		for (SIZE_T Hash = 0; Hash < ((SIZE_T)1 << TRAIN_HASH_BITS); ++Hash)
+		{
+			if (Frequencies[Hash] < 2) Frequencies[Hash] = 0;
+		}
+
+		SIZE_T EpochSize = Total / SegmentCount;
+		if (EpochSize < TRAIN_SEGMENT) EpochSize = TRAIN_SEGMENT;
+		for (SIZE_T Epoch = 0; Epoch + TRAIN_SEGMENT <= Total && Found < SegmentCount; Epoch += EpochSize)
+		{
+			SIZE_T EpochEnd = Total - Epoch > EpochSize ? Epoch + EpochSize : Total;
+			// Sliding sum over the d-mers that start within the segment.
+			ULONGLONG Score = 0;
+			for (SIZE_T p = Epoch; p + TRAIN_DMER <= Epoch + TRAIN_SEGMENT; ++p) Score += Frequencies[HashDmer(Samples + p)];
+			ULONGLONG BestScore = Score;
+			SIZE_T BestOffset = Epoch;
+			for (SIZE_T w = Epoch + 1; w + TRAIN_SEGMENT <= EpochEnd; ++w)
+			{
+				Score -= Frequencies[HashDmer(Samples + w - 1)];
+				Score += Frequencies[HashDmer(Samples + w + TRAIN_SEGMENT - TRAIN_DMER)];
+				if (Score > BestScore)
+				{
+					BestScore = Score;
+					BestOffset = w;
+				}
+			}
+			if (BestScore == 0) continue;
+			Segments[Found].Offset = BestOffset;
+			Segments[Found].Score = BestScore;
+			++Found;
+			for (SIZE_T p = BestOffset; p + TRAIN_DMER <= BestOffset + TRAIN_SEGMENT; ++p) Frequencies[HashDmer(Samples + p)] = 0;
+		}
+
+		// The best segments go last, where they are closest to the text.
+		qsort(Segments, Found, sizeof(TRAIN_SEGMENT_INFO), CompareSegmentScores);
+		for (SIZE_T i = 0; i < Found; ++i)
+		{
+			memcpy((BYTE *)Dictionary + i * TRAIN_SEGMENT, Samples + Segments[i].Offset, TRAIN_SEGMENT);
+		}
+	}
+	free(Samples);
+	free(Frequencies);
+	free(LastSample);
+	free(Segments);
+	return Found * TRAIN_SEGMENT;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Portable.h"
+
+struct TEXT_DICTIONARY;
+struct TEXT_CODEC_HEADER;
+
+// Fast lossless compression of text, for the texts in the history store.
+//
+// The code is LZ4-style: runs of literal bytes, each followed by a copy of at least 4 bytes from at most 64 KB back. It
+// is cheap to decode (mostly 8 and 16 byte copies), at well above 1 GB/s. Text that is not made larger by it, which is
+// anything mostly below U+0800, is transcoded to UTF-8 first. Unpaired surrogates survive the round trip.
+//
+// Single texts on the clipboard are short, so there is little to find within each of them. A dictionary with content
+// that is common in earlier texts (see TextDictionaryTrain) is therefore put in front of the window: copies may reach
+// back into it. The caller names each dictionary by an id of its choosing, which is kept in the header and checked when
+// decoding. Dictionaries do not change once created (except for TextDictionaryPrepareEncoding, which only touches what
+// the decoder does not use), so one thread may decode with a dictionary while another one encodes with it.
+//
+// The output is a TEXT_CODEC_HEADER followed by the code. It has no pointers, and can be written to a file as it is.
+
+// Dictionaries are always taken as UTF-8.
+#define TEXT_DICTIONARY_MAX_SIZE (32 * 1024)
+
+extern SIZE_T              TextCodecGetMaxSize(SIZE_T Length);
+extern SIZE_T              TextCodecEncode(const WCHAR *Text, SIZE_T Length, const TEXT_DICTIONARY *Dictionary, void *Output);
+extern const TEXT_CODEC_HEADER *TextCodecValidate(const void *Data, SIZE_T SizeCb);
+extern BOOL                TextCodecDecode(const TEXT_CODEC_HEADER *Header, SIZE_T SizeCb, const TEXT_DICTIONARY *Dictionary, WCHAR *Text);
+extern TEXT_DICTIONARY    *TextDictionaryCreate(const void *Data, SIZE_T SizeCb, ULONGLONG Id);
+extern BOOL                TextDictionaryPrepareEncoding(TEXT_DICTIONARY *Dictionary);
+extern void                TextDictionaryFree(TEXT_DICTIONARY *Dictionary);
+extern SIZE_T              TextDictionaryTrain(const WCHAR *const *Texts, const SIZE_T *Lengths, UINT Count, void *Dictionary, SIZE_T Capacity);
+
+struct TEXT_CODEC_HEADER
+{
+	DWORD Magic;
+	DWORD Flags;              // TEXT_CODEC_UTF8.
+	ULONGLONG Length;         // Of the text, in WCHARs.
+	ULONGLONG CodedSizeCb;    // Of the text as it was compressed: UTF-8, or the original UTF-16.
+	ULONGLONG DictionaryId;   // 0 without a dictionary.
+};
+
+#define TEXT_CODEC_UTF8 0x1
+
+struct TEXT_DICTIONARY
+{
+	ULONGLONG Id;             // Nonzero.
+	BYTE *Data;
+	SIZE_T SizeCb;
+	DWORD *HashTable;         // Positions of the dictionary, for the encoder. Null until TextDictionaryPrepareEncoding.
+};
@@ -0,0 +1,46 @@
+#include "TextIndexer.h"
+#include "TextLayout.h"
+
+// Characters scanned between checks for cancellation. Takes well below a millisecond.
+#define INDEXER_CHUNK_CHARACTERS (256 * 1024)
+
+
+static void IndexerThread(TEXT_INDEXER *Indexer)
+{
+	TEXT_LINE_INDEX *Index = Indexer->Index;
+	ULONGLONG LastNotifyUs = GetMonotonicTimeUs();
+	while (!Indexer->Cancelled.load(std::memory_order_relaxed))
+	{
+		if (!TextLineIndexContinue(Index, INDEXER_CHUNK_CHARACTERS)) break;
+		BOOL Complete = TextLineIndexIsComplete(Index);
+		ULONGLONG NowUs = GetMonotonicTimeUs();
+		if (Complete || NowUs - LastNotifyUs >= Indexer->NotifyIntervalUs)
+		{
+			LastNotifyUs = NowUs;
+			Indexer->Notify(Indexer->NotifyContext);
+		}
+		if (Complete) break;
+	}
+}
+
+
+// Index must have been initialized, and must not be scanned by anyone else until TextIndexerStop.
+void TextIndexerStart(TEXT_INDEXER *Indexer, TEXT_LINE_INDEX *Index, ULONGLONG NotifyIntervalUs, void (*Notify)(void *Context), void *NotifyContext)
+{
+	Indexer->Cancelled.store(false);
+	Indexer->Index = Index;
+	Indexer->NotifyIntervalUs = NotifyIntervalUs;
+	Indexer->Notify = Notify;
+	Indexer->NotifyContext = NotifyContext;
+	Indexer->Thread = std::thread(IndexerThread, Indexer);
+}
+
+
+// Cancels indexing and waits for the thread to exit. The index keeps the lines published so far.
+// Does nothing if the indexer is not running.
+void TextIndexerStop(TEXT_INDEXER *Indexer)
+{
+	if (!Indexer->Thread.joinable()) return;
+	Indexer->Cancelled.store(true);
+	Indexer->Thread.join();
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "Portable.h"
+#include <atomic>
+#include <thread>
+
+struct TEXT_LINE_INDEX;
+struct TEXT_INDEXER;
+
+// Finishes a TEXT_LINE_INDEX on a background thread, while the lines indexed so far can already be displayed.
+// Notify is called on the indexer thread whenever more lines have been published (at most every NotifyIntervalUs),
+// and once more when the index is complete.
+
+extern void                TextIndexerStart(TEXT_INDEXER *Indexer, TEXT_LINE_INDEX *Index, ULONGLONG NotifyIntervalUs, void (*Notify)(void *Context), void *NotifyContext);
+extern void                TextIndexerStop(TEXT_INDEXER *Indexer);
+
+struct TEXT_INDEXER
+{
+	std::thread Thread;
+	std::atomic<BOOL> Cancelled;
+	TEXT_LINE_INDEX *Index;
+	ULONGLONG NotifyIntervalUs;
+	void (*Notify)(void *Context);
+	void *NotifyContext;
+};
@@ -0,0 +1,329 @@
+#include "TextLayout.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define LINE_BLOCK_SHIFT 12
+#define LINE_BLOCK_SIZE ((SIZE_T)1 << LINE_BLOCK_SHIFT)
+#define LINE_HAS_TAB ((SIZE_T)1 << (sizeof(SIZE_T) * 8 - 1))
+
+
+static SIZE_T GetEntry(const TEXT_LINE_INDEX *Index, SIZE_T Entry)
+{
+	return Index->Blocks[Entry >> LINE_BLOCK_SHIFT][Entry & (LINE_BLOCK_SIZE - 1)];
+}
+
+
+static BOOL SetEntry(TEXT_LINE_INDEX *Index, SIZE_T Entry, SIZE_T Value)
+{
+	SIZE_T *&Block = Index->Blocks[Entry >> LINE_BLOCK_SHIFT];
+	if (Block == nullptr)
+	{
+		Block = (SIZE_T *)malloc(LINE_BLOCK_SIZE * sizeof(SIZE_T));
+		if (Block == nullptr) return false;
+	}
+	Block[Entry & (LINE_BLOCK_SIZE - 1)] = Value;
+	return true;
+}
+
+
+// Text must stay valid while the index is used. The index must be freed even if this fails.
+BOOL TextLineIndexInit(TEXT_LINE_INDEX *Index, const WCHAR *Text, SIZE_T Length, UINT TabWidth)
+{
+	Index->Text = Text;
+	Index->Length = Length;
+	Index->TabWidth = TabWidth != 0 ? TabWidth : 1;
+	Index->Scanned = 0;
+	Index->LineCount = 0;
+	Index->LineStart = 0;
+	Index->LineHasTab = false;
+	Index->MaxColumns = 0;
+	Index->PublishedLineCount.store(0, std::memory_order_relaxed);
+	Index->PublishedMaxColumns.store(0, std::memory_order_relaxed);
+	Index->Complete.store(false, std::memory_order_relaxed);
+
+	// There can be at most Length + 1 lines, and one more entry than lines. This table is the only thing that is
+	// sized up front; it's tiny compared to the text.
+	Index->BlockCount = (Length + 1) / LINE_BLOCK_SIZE + 1;
+	Index->Blocks = (SIZE_T **)calloc(Index->BlockCount, sizeof(SIZE_T *));
+	if (Index->Blocks == nullptr) return false;
+	return SetEntry(Index, 0, 0);
+}
+
+
+static SIZE_T GetExpandedWidth(const WCHAR *Text, SIZE_T Length, UINT TabWidth)
+{
+	SIZE_T Column = 0;
+	for (SIZE_T i = 0; i < Length; ++i)
+	{
+		Column += Text[i] == '\t' ? TabWidth - Column % TabWidth : 1;
+	}
+	return Column;
+}
+
+
+// Ends the current line at Position (which is a CR or LF, or the end of the text).
+static BOOL EndLine(TEXT_LINE_INDEX *Index, SIZE_T Position)
+{
+	const WCHAR *Text = Index->Text;
+	SIZE_T Columns = Position - Index->LineStart;
+	if (Index->LineHasTab)
+	{
+		Columns = GetExpandedWidth(Text + Index->LineStart, Position - Index->LineStart, Index->TabWidth);
+	}
+	if (Columns > Index->MaxColumns)
+	{
+		Index->MaxColumns = Columns;
+	}
+
+	SIZE_T NextStart = Position;
+	if (Position < Index->Length)
+	{
+		NextStart = Position + 1;
+		if (Text[Position] == '\r' && NextStart < Index->Length && Text[NextStart] == '\n') ++NextStart;
+	}
+	if (!SetEntry(Index, Index->LineCount + 1, NextStart | (Index->LineHasTab ? LINE_HAS_TAB : 0))) return false;
+	++Index->LineCount;
+	Index->LineStart = NextStart;
+	Index->LineHasTab = false;
+	return true;
+}
+
+
+// Handles a CR, LF or tab at Position.
+static BOOL HandleSpecialCharacter(TEXT_LINE_INDEX *Index, SIZE_T Position)
+{
+	// The LF of a CRLF has already been dealt with together with the CR.
+	if (Position < Index->LineStart) return true;
+	if (Index->Text[Position] == '\t')
+	{
+		Index->LineHasTab = true;
+		return true;
+	}
+	return EndLine(Index, Position);
+}
+
+
+static BOOL ContinueIndex(TEXT_LINE_INDEX *Index, SIZE_T MaxCharacters, BOOL UseSimd)
+{
+	if (Index->Complete.load(std::memory_order_relaxed)) return true;
+
+	const WCHAR *Text = Index->Text;
+	SIZE_T i = Index->Scanned;
+	SIZE_T End = Index->Length - i < MaxCharacters ? Index->Length : i + MaxCharacters;
+	BOOL Succeeded = true;
+
+#ifdef PORTABLE_SSE2
+	// Eight characters at a time. Most blocks contain neither line breaks nor tabs, and are skipped as a whole.
+	const __m128i CR = _mm_set1_epi16('\r');
+	const __m128i LF = _mm_set1_epi16('\n');
+	const __m128i Tab = _mm_set1_epi16('\t');
+	for (; UseSimd && Succeeded && i + 8 <= End; i += 8)
+	{
+		__m128i Characters = _mm_loadu_si128((const __m128i *)(Text + i));
+		__m128i Special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi16(Characters, CR), _mm_cmpeq_epi16(Characters, LF)), _mm_cmpeq_epi16(Characters, Tab));
+		int Mask = _mm_movemask_epi8(Special);
+		if (Mask == 0) continue;
+		for (int Lane = 0; Lane < 8 && Succeeded; ++Lane)
+		{
+			if (Mask & (1 << (Lane * 2)))
+			{
+				Succeeded = HandleSpecialCharacter(Index, i + Lane);
+			}
+		}
+	}
+#endif
+
+	for (; Succeeded && i < End; ++i)
+	{
+		WCHAR c = Text[i];
+		if (c == '\r' || c == '\n' || c == '\t')
+		{
+			Succeeded = HandleSpecialCharacter(Index, i);
+		}
+	}
+
+	if (Succeeded)
+	{
+		Index->Scanned = i;
+		if (i == Index->Length)
+		{
+			// The last line has no terminator; it is empty if the text ends with a line break.
+			Succeeded = EndLine(Index, i);
+		}
+	}
+
+	Index->PublishedMaxColumns.store(Index->MaxColumns, std::memory_order_relaxed);
+	Index->PublishedLineCount.store(Index->LineCount, std::memory_order_release);
+	if (Succeeded && Index->Scanned == Index->Length)
+	{
+		Index->Complete.store(true, std::memory_order_release);
+	}
+	return Succeeded;
+}
+
+
+// Scans up to MaxCharacters more characters, and publishes the lines found. Returns false if memory ran out; the lines
+// published so far stay valid, but the index will never be completed.
+BOOL TextLineIndexContinue(TEXT_LINE_INDEX *Index, SIZE_T MaxCharacters)
+{
+	return ContinueIndex(Index, MaxCharacters, true);
+}
+
+
+BOOL TextLineIndexBuild(TEXT_LINE_INDEX *Index, const WCHAR *Text, SIZE_T Length, UINT TabWidth)
+{
+	return TextLineIndexInit(Index, Text, Length, TabWidth) && TextLineIndexContinue(Index, Length);
+}
+
+
+// The same index as TextLineIndexBuild, found one character at a time even where SIMD is available. Only there to
+// compare the two.
+BOOL TextLineIndexBuildScalar(TEXT_LINE_INDEX *Index, const WCHAR *Text, SIZE_T Length, UINT TabWidth)
+{
+	return TextLineIndexInit(Index, Text, Length, TabWidth) && ContinueIndex(Index, Length, false);
+}
+
+
+void TextLineIndexFree(TEXT_LINE_INDEX *Index)
+{
+	if (Index->Blocks != nullptr)
+	{
+		for (SIZE_T i = 0; i < Index->BlockCount; ++i)
+		{
+			free(Index->Blocks[i]);
+		}
+		free(Index->Blocks);
+	}
+	Index->Blocks = nullptr;
+	Index->BlockCount = 0;
+	Index->Text = nullptr;
+	Index->Length = 0;
+	Index->PublishedLineCount.store(0, std::memory_order_relaxed);
+	Index->PublishedMaxColumns.store(0, std::memory_order_relaxed);
+	Index->Complete.store(false, std::memory_order_relaxed);
+}
+
+
+BOOL TextLineIndexIsComplete(const TEXT_LINE_INDEX *Index)
+{
+	return Index->Complete.load(std::memory_order_acquire);
+}
+
+
+SIZE_T TextLineIndexGetLineCount(const TEXT_LINE_INDEX *Index)
+{
+	return Index->PublishedLineCount.load(std::memory_order_acquire);
+}
+
+
+SIZE_T TextLineIndexGetMaxColumns(const TEXT_LINE_INDEX *Index)
+{
+	return Index->PublishedMaxColumns.load(std::memory_order_relaxed);
+}
+
+
+// Line must be a published line. Length excludes the line terminator.
+void TextLineIndexGetLine(const TEXT_LINE_INDEX *Index, SIZE_T Line, SIZE_T *Start, SIZE_T *Length)
+{
+	SIZE_T LineStart = GetEntry(Index, Line) & ~LINE_HAS_TAB;
+	SIZE_T LineEnd = GetEntry(Index, Line + 1) & ~LINE_HAS_TAB;
+	if (LineEnd > LineStart && Index->Text[LineEnd - 1] == '\n') --LineEnd;
+	if (LineEnd > LineStart && Index->Text[LineEnd - 1] == '\r') --LineEnd;
+	*Start = LineStart;
+	*Length = LineEnd - LineStart;
+}
+
+
+// Returns the published lines that intersect the vertical pixel range [Top, Bottom), where line N starts at
+// N * LineHeight.
+void TextLayoutGetVisibleLines(const TEXT_LINE_INDEX *Index, ULONGLONG Top, ULONGLONG Bottom, UINT LineHeight, SIZE_T *FirstLine, SIZE_T *EndLine)
+{
+	*FirstLine = 0;
+	*EndLine = 0;
+	if (LineHeight == 0 || Bottom <= Top) return;
+	SIZE_T LineCount = TextLineIndexGetLineCount(Index);
+	ULONGLONG First = Top / LineHeight;
+	ULONGLONG End = (Bottom + LineHeight - 1) / LineHeight;
+	if (First > LineCount) First = LineCount;
+	if (End > LineCount) End = LineCount;
+	*FirstLine = (SIZE_T)First;
+	*EndLine = (SIZE_T)End;
+}
+
+
+// Returns up to MaxColumns columns of the line, starting at FirstColumn, with tabs expanded to spaces. For lines
+// without tabs, this points straight into the text; otherwise the expanded run is written to Scratch, which must have
+// room for MaxColumns characters.
+const WCHAR *TextLayoutGetVisibleRun(const TEXT_LINE_INDEX *Index, SIZE_T Line, SIZE_T FirstColumn, SIZE_T MaxColumns, WCHAR *Scratch, SIZE_T *RunLength)
+{
+	SIZE_T Start, Length;
+	TextLineIndexGetLine(Index, Line, &Start, &Length);
+	const WCHAR *Text = Index->Text + Start;
+
+	if (!(GetEntry(Index, Line + 1) & LINE_HAS_TAB))
+	{
+		if (FirstColumn >= Length)
+		{
+			*RunLength = 0;
+			return Text;
+		}
+		*RunLength = Length - FirstColumn < MaxColumns ? Length - FirstColumn : MaxColumns;
+		return Text + FirstColumn;
+	}
+
+	SIZE_T Column = 0;
+	SIZE_T Written = 0;
+	for (SIZE_T i = 0; i < Length && Written < MaxColumns; ++i)
+	{
+		WCHAR c = Text[i];
+		if (c == '\t')
+		{
+			SIZE_T TabEnd = Column + Index->TabWidth - Column % Index->TabWidth;
+			for (; Column < TabEnd && Written < MaxColumns; ++Column)
+			{
+				if (Column >= FirstColumn) Scratch[Written++] = ' ';
+			}
+		}
+		else
+		{
+			if (Column >= FirstColumn) Scratch[Written++] = c;
+			++Column;
+		}
+	}
+	*RunLength = Written;
+	return Scratch;
+}
+
+
+// Returns the text offset of the caret position at Column in a published line: before the first character that starts
+// at or after Column (a tab starts at its first column), or at the end of the line.
+SIZE_T TextLayoutGetOffset(const TEXT_LINE_INDEX *Index, SIZE_T Line, SIZE_T Column)
+{
+	SIZE_T Start, Length;
+	TextLineIndexGetLine(Index, Line, &Start, &Length);
+	if (!(GetEntry(Index, Line + 1) & LINE_HAS_TAB))
+	{
+		return Start + (Column < Length ? Column : Length);
+	}
+
+	const WCHAR *Text = Index->Text + Start;
+	SIZE_T CharacterColumn = 0;
+	SIZE_T i = 0;
+	for (; i < Length && CharacterColumn < Column; ++i)
+	{
+		CharacterColumn += Text[i] == '\t' ? Index->TabWidth - CharacterColumn % Index->TabWidth : 1;
+	}
+	return Start + i;
+}
+
+
+// Returns the column at which the character at Offset starts in a published line. Offsets past the end of the line
+// give the width of the line.
+SIZE_T TextLayoutGetColumn(const TEXT_LINE_INDEX *Index, SIZE_T Line, SIZE_T Offset)
+{
+	SIZE_T Start, Length;
+	TextLineIndexGetLine(Index, Line, &Start, &Length);
+	SIZE_T End = Offset < Start ? 0 : Offset - Start < Length ? Offset - Start : Length;
+	if (!(GetEntry(Index, Line + 1) & LINE_HAS_TAB)) return End;
+	return GetExpandedWidth(Index->Text + Start, End, Index->TabWidth);
+}
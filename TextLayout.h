@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Portable.h"
+#include <atomic>
+
+struct TEXT_LINE_INDEX;
+
+// Line index and line windowing for displaying large texts with a monospace font. Only the lines and columns that
+// are actually visible are ever looked at when painting; the text itself is not copied.
+// Lines are terminated by CR, LF or CRLF. Columns count UTF-16 code units, except that tabs are expanded.
+//
+// The index can be built incrementally: TextLineIndexContinue scans the next part of the text, and makes the lines
+// found so far visible to readers. One thread may scan while another one reads the lines that have already been
+// published (everything except TextLineIndexContinue only looks at published lines).
+
+extern BOOL                TextLineIndexInit(TEXT_LINE_INDEX *Index, const WCHAR *Text, SIZE_T Length, UINT TabWidth);
+extern BOOL                TextLineIndexContinue(TEXT_LINE_INDEX *Index, SIZE_T MaxCharacters);
+extern BOOL                TextLineIndexBuild(TEXT_LINE_INDEX *Index, const WCHAR *Text, SIZE_T Length, UINT TabWidth);
+extern BOOL                TextLineIndexBuildScalar(TEXT_LINE_INDEX *Index, const WCHAR *Text, SIZE_T Length, UINT TabWidth);
+extern void                TextLineIndexFree(TEXT_LINE_INDEX *Index);
+extern BOOL                TextLineIndexIsComplete(const TEXT_LINE_INDEX *Index);
+extern SIZE_T              TextLineIndexGetLineCount(const TEXT_LINE_INDEX *Index);
+extern SIZE_T              TextLineIndexGetMaxColumns(const TEXT_LINE_INDEX *Index);
+extern void                TextLineIndexGetLine(const TEXT_LINE_INDEX *Index, SIZE_T Line, SIZE_T *Start, SIZE_T *Length);
+extern void                TextLayoutGetVisibleLines(const TEXT_LINE_INDEX *Index, ULONGLONG Top, ULONGLONG Bottom, UINT LineHeight, SIZE_T *FirstLine, SIZE_T *EndLine);
+extern const WCHAR        *TextLayoutGetVisibleRun(const TEXT_LINE_INDEX *Index, SIZE_T Line, SIZE_T FirstColumn, SIZE_T MaxColumns, WCHAR *Scratch, SIZE_T *RunLength);
+extern SIZE_T              TextLayoutGetOffset(const TEXT_LINE_INDEX *Index, SIZE_T Line, SIZE_T Column);
+extern SIZE_T              TextLayoutGetColumn(const TEXT_LINE_INDEX *Index, SIZE_T Line, SIZE_T Offset);
+
+struct TEXT_LINE_INDEX
+{
+	const WCHAR *Text;
+	SIZE_T Length;
+	UINT TabWidth;
+
+	// Line boundaries: entry N is the offset of the first character of line N, and entry N + 1 ends it. Entries are
+	// stored in fixed size blocks that never move, so that readers are not disturbed when the index grows.
+	// The top bit of entry N + 1 is set if line N contains a tab; lines without tabs map columns to characters directly.
+	SIZE_T **Blocks;
+	SIZE_T BlockCount;
+
+	// Scanner state. Only used by TextLineIndexContinue.
+	SIZE_T Scanned;
+	SIZE_T LineCount;  // Lines that have been terminated so far.
+	SIZE_T LineStart;  // Of the line that is being scanned.
+	BOOL LineHasTab;
+	SIZE_T MaxColumns;
+
+	// What readers get to see.
+	std::atomic<SIZE_T> PublishedLineCount;
+	std::atomic<SIZE_T> PublishedMaxColumns;  // Width of the widest published line, in columns.
+	std::atomic<BOOL> Complete;
+};
@@ -0,0 +1,212 @@
+#include "TileCache.h"
+#include "PixelBuffer.h"
+#include <stdlib.h>
+#include <string.h>
+
+
+static LONG GetTileCount(LONG Pixels)
+{
+	return (LONG)(((LONGLONG)Pixels + TILE_SIZE - 1) / TILE_SIZE);
+}
+
+
+// Finds the tiles that intersect the rectangle [Left, Right) x [Top, Bottom), in image coordinates. The rectangle may
+// reach beyond the image. Returns false if it does not intersect the image at all.
+BOOL GetVisibleTiles(LONG ImageWidth, LONG ImageHeight, LONGLONG Left, LONGLONG Top, LONGLONG Right, LONGLONG Bottom, TILE_RANGE *Range)
+{
+	memset(Range, 0, sizeof(*Range));
+	if (Left < 0) Left = 0;
+	if (Top < 0) Top = 0;
+	if (Right > ImageWidth) Right = ImageWidth;
+	if (Bottom > ImageHeight) Bottom = ImageHeight;
+	if (Left >= Right || Top >= Bottom) return false;
+	Range->FirstColumn = (LONG)(Left / TILE_SIZE);
+	Range->FirstRow = (LONG)(Top / TILE_SIZE);
+	Range->EndColumn = (LONG)((Right + TILE_SIZE - 1) / TILE_SIZE);
+	Range->EndRow = (LONG)((Bottom + TILE_SIZE - 1) / TILE_SIZE);
+	return true;
+}
+
+
+void GetTileBounds(LONG ImageWidth, LONG ImageHeight, LONG Column, LONG Row, TILE_BOUNDS *Bounds)
+{
+	Bounds->X = Column * TILE_SIZE;
+	Bounds->Y = Row * TILE_SIZE;
+	Bounds->Width = ImageWidth - Bounds->X < TILE_SIZE ? ImageWidth - Bounds->X : TILE_SIZE;
+	Bounds->Height = ImageHeight - Bounds->Y < TILE_SIZE ? ImageHeight - Bounds->Y : TILE_SIZE;
+}
+
+
+// Copies the pixels of a tile into a buffer of Bounds->Width * Bounds->Height * 4 bytes, without gaps between the rows.
+void CopyTilePixels(const PIXEL_BUFFER *Image, const TILE_BOUNDS *Bounds, BYTE *Pixels)
+{
+	SIZE_T RowSizeCb = (SIZE_T)Bounds->Width * 4;
+	const BYTE *Source = Image->Pixels + Bounds->Y * Image->Stride + (SIZE_T)Bounds->X * 4;
+	for (LONG y = 0; y < Bounds->Height; ++y)
+	{
+		memcpy(Pixels + y * RowSizeCb, Source + y * Image->Stride, RowSizeCb);
+	}
+}
+
+
+void TileCacheInit(TILE_CACHE *Cache, SIZE_T MaxBytes, void *(*CreateTile)(void *Context, const PIXEL_BUFFER *Image, const TILE_BOUNDS *Bounds), void (*DestroyTile)(void *Context, void *Tile), void *Context)
+{
+	memset(Cache, 0, sizeof(*Cache));
+	Cache->CreateTile = CreateTile;
+	Cache->DestroyTile = DestroyTile;
+	Cache->Context = Context;
+	Cache->MaxBytes = MaxBytes;
+	Cache->FreeEntry = TILE_CACHE_NONE;
+	Cache->Newest = TILE_CACHE_NONE;
+	Cache->Oldest = TILE_CACHE_NONE;
+}
+
+
+void TileCacheFree(TILE_CACHE *Cache)
+{
+	TileCacheSetImage(Cache, nullptr);
+	free(Cache->Entries);
+	Cache->Entries = nullptr;
+	Cache->EntryCount = 0;
+	Cache->EntryCapacity = 0;
+	Cache->FreeEntry = TILE_CACHE_NONE;
+}
+
+
+static void Unlink(TILE_CACHE *Cache, UINT Index)
+{
+	TILE_CACHE_ENTRY *Entry = &Cache->Entries[Index];
+	if (Entry->Newer != TILE_CACHE_NONE) Cache->Entries[Entry->Newer].Older = Entry->Older;
+	else Cache->Newest = Entry->Older;
+	if (Entry->Older != TILE_CACHE_NONE) Cache->Entries[Entry->Older].Newer = Entry->Newer;
+	else Cache->Oldest = Entry->Newer;
+}
+
+
+static void LinkAsNewest(TILE_CACHE *Cache, UINT Index)
+{
+	TILE_CACHE_ENTRY *Entry = &Cache->Entries[Index];
+	Entry->Newer = TILE_CACHE_NONE;
+	Entry->Older = Cache->Newest;
+	if (Cache->Newest != TILE_CACHE_NONE) Cache->Entries[Cache->Newest].Newer = Index;
+	else Cache->Oldest = Index;
+	Cache->Newest = Index;
+}
+
+
+static void DestroyEntry(TILE_CACHE *Cache, UINT Index)
+{
+	TILE_CACHE_ENTRY *Entry = &Cache->Entries[Index];
+	Unlink(Cache, Index);
+	Cache->DestroyTile(Cache->Context, Entry->Tile);
+	Cache->Slots[Entry->Slot] = 0;
+	Cache->Bytes -= Entry->SizeCb;
+	Entry->Tile = nullptr;
+	Entry->Older = Cache->FreeEntry;
+	Cache->FreeEntry = Index;
+}
+
+
+// Destroys all tiles, but keeps the image.
+void TileCacheClear(TILE_CACHE *Cache)
+{
+	while (Cache->Oldest != TILE_CACHE_NONE)
+	{
+		DestroyEntry(Cache, Cache->Oldest);
+	}
+}
+
+
+// Switches the cache to another image (or none), and destroys the tiles of the previous one. Setting the same image
+// again keeps its tiles. Returns false if there is not enough memory to cache tiles of Image; TileCacheGet then always
+// returns null.
+BOOL TileCacheSetImage(TILE_CACHE *Cache, PIXEL_BUFFER *Image)
+{
+	if (Image == Cache->Image) return Image == nullptr || Cache->Slots != nullptr;
+	TileCacheClear(Cache);
+	PixelBufferRelease(Cache->Image);
+	free(Cache->Slots);
+	Cache->Image = nullptr;
+	Cache->Slots = nullptr;
+	Cache->Columns = 0;
+	Cache->Rows = 0;
+	if (Image == nullptr) return true;
+
+	Cache->Image = PixelBufferAddRef(Image);
+	LONG Columns = GetTileCount(Image->Width);
+	LONG Rows = GetTileCount(Image->Height);
+	Cache->Slots = (UINT *)calloc((SIZE_T)Columns * Rows, sizeof(UINT));
+	if (Cache->Slots == nullptr) return false;
+	Cache->Columns = Columns;
+	Cache->Rows = Rows;
+	return true;
+}
+
+
+static UINT AllocateEntry(TILE_CACHE *Cache)
+{
+	if (Cache->FreeEntry != TILE_CACHE_NONE)
+	{
+		UINT Index = Cache->FreeEntry;
+		Cache->FreeEntry = Cache->Entries[Index].Older;
+		return Index;
+	}
+	if (Cache->EntryCount == Cache->EntryCapacity)
+	{
+		UINT NewCapacity = Cache->EntryCapacity != 0 ? Cache->EntryCapacity * 2 : 64;
+		TILE_CACHE_ENTRY *NewEntries = (TILE_CACHE_ENTRY *)realloc(Cache->Entries, NewCapacity * sizeof(TILE_CACHE_ENTRY));
+		if (NewEntries == nullptr) return TILE_CACHE_NONE;
+		Cache->Entries = NewEntries;
+		Cache->EntryCapacity = NewCapacity;
+	}
+	return Cache->EntryCount++;
+}
+
+
+// Returns the tile, creating it if it is not cached. Returns null if the tile is outside of the image, or could not be
+// created; the caller then has to draw that part of the image some other way. The tile stays valid until the next call.
+void *TileCacheGet(TILE_CACHE *Cache, LONG Column, LONG Row)
+{
+	if (Cache->Slots == nullptr || Column < 0 || Row < 0 || Column >= Cache->Columns || Row >= Cache->Rows) return nullptr;
+	SIZE_T Slot = (SIZE_T)Row * Cache->Columns + Column;
+	if (Cache->Slots[Slot] != 0)
+	{
+		UINT Index = Cache->Slots[Slot] - 1;
+		if (Cache->Newest != Index)
+		{
+			Unlink(Cache, Index);
+			LinkAsNewest(Cache, Index);
+		}
+		++Cache->Hits;
+		return Cache->Entries[Index].Tile;
+	}
+
+	++Cache->Misses;
+	TILE_BOUNDS Bounds;
+	GetTileBounds(Cache->Image->Width, Cache->Image->Height, Column, Row, &Bounds);
+	SIZE_T SizeCb = (SIZE_T)Bounds.Width * Bounds.Height * 4;
+	// Make room first, so that the old tiles are gone before the new one is allocated.
+	while (Cache->Oldest != TILE_CACHE_NONE && Cache->Bytes + SizeCb > Cache->MaxBytes)
+	{
+		DestroyEntry(Cache, Cache->Oldest);
+		++Cache->Evictions;
+	}
+
+	UINT Index = AllocateEntry(Cache);
+	if (Index == TILE_CACHE_NONE) return nullptr;
+	void *Tile = Cache->CreateTile(Cache->Context, Cache->Image, &Bounds);
+	if (Tile == nullptr)
+	{
+		Cache->Entries[Index].Older = Cache->FreeEntry;
+		Cache->FreeEntry = Index;
+		return nullptr;
+	}
+	TILE_CACHE_ENTRY *Entry = &Cache->Entries[Index];
+	Entry->Tile = Tile;
+	Entry->Slot = Slot;
+	Entry->SizeCb = SizeCb;
+	LinkAsNewest(Cache, Index);
+	Cache->Slots[Slot] = Index + 1;
+	Cache->Bytes += SizeCb;
+	return Tile;
+}
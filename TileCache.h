@@ -0,0 +1,82 @@
+#pragma once
+
+#include "Portable.h"
+
+struct PIXEL_BUFFER;
+struct TILE_BOUNDS;
+struct TILE_RANGE;
+struct TILE_CACHE_ENTRY;
+struct TILE_CACHE;
+
+// Splits an image into TILE_SIZE x TILE_SIZE tiles (smaller at the right and bottom edges), so that painting only has to
+// touch the tiles that intersect the damaged area, and keeps the tiles that were painted recently in a form that is
+// cheap to draw again (e.g. a device-dependent bitmap).
+//
+// The cache holds one image at a time, and does not know what a tile is: CreateTile makes one from a part of the image,
+// and DestroyTile gets rid of it. Tiles that have not been used for the longest time are destroyed once the tiles
+// take up more than MaxBytes (counting 4 bytes per pixel), but never the one that has just been created.
+
+#define TILE_SIZE 256
+#define TILE_CACHE_NONE ((UINT)-1)
+
+extern BOOL                GetVisibleTiles(LONG ImageWidth, LONG ImageHeight, LONGLONG Left, LONGLONG Top, LONGLONG Right, LONGLONG Bottom, TILE_RANGE *Range);
+extern void                GetTileBounds(LONG ImageWidth, LONG ImageHeight, LONG Column, LONG Row, TILE_BOUNDS *Bounds);
+extern void                CopyTilePixels(const PIXEL_BUFFER *Image, const TILE_BOUNDS *Bounds, BYTE *Pixels);
+extern void                TileCacheInit(TILE_CACHE *Cache, SIZE_T MaxBytes, void *(*CreateTile)(void *Context, const PIXEL_BUFFER *Image, const TILE_BOUNDS *Bounds), void (*DestroyTile)(void *Context, void *Tile), void *Context);
+extern void                TileCacheFree(TILE_CACHE *Cache);
+extern BOOL                TileCacheSetImage(TILE_CACHE *Cache, PIXEL_BUFFER *Image);
+extern void               *TileCacheGet(TILE_CACHE *Cache, LONG Column, LONG Row);
+extern void                TileCacheClear(TILE_CACHE *Cache);
+
+struct TILE_BOUNDS
+{
+	LONG X;
+	LONG Y;
+	LONG Width;
+	LONG Height;
+};
+
+// Tiles [FirstColumn, EndColumn) x [FirstRow, EndRow).
+struct TILE_RANGE
+{
+	LONG FirstColumn;
+	LONG FirstRow;
+	LONG EndColumn;
+	LONG EndRow;
+};
+
+struct TILE_CACHE_ENTRY
+{
+	void *Tile;            // Null if the entry is free.
+	SIZE_T Slot;           // Row * Columns + Column.
+	SIZE_T SizeCb;
+	UINT Newer;            // Neighbours in the LRU list, or TILE_CACHE_NONE.
+	UINT Older;
+};
+
+struct TILE_CACHE
+{
+	void *(*CreateTile)(void *Context, const PIXEL_BUFFER *Image, const TILE_BOUNDS *Bounds);
+	void (*DestroyTile)(void *Context, void *Tile);
+	void *Context;
+	SIZE_T MaxBytes;
+
+	PIXEL_BUFFER *Image;   // Reference held by the cache, or null.
+	LONG Columns;
+	LONG Rows;
+	// One per tile of the image: the index of its entry plus one, or 0 if the tile is not cached.
+	UINT *Slots;
+
+	TILE_CACHE_ENTRY *Entries;
+	UINT EntryCount;       // Used and free entries.
+	UINT EntryCapacity;
+	UINT FreeEntry;        // Start of the list of free entries, linked through Older.
+	UINT Newest;
+	UINT Oldest;
+	SIZE_T Bytes;
+
+	// Since the cache was created.
+	ULONGLONG Hits;
+	ULONGLONG Misses;
+	ULONGLONG Evictions;
+};
@@ -0,0 +1,397 @@
+#include "Tracer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <new>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define TRACE_USE_TSC 1
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define TRACE_USE_TSC 1
+#elif !defined(_WIN32)
+#include <time.h>
+#endif
+
+// The tick rate is measured against GetMonotonicTimeUs over at least this long before writing a trace.
+#define CALIBRATION_MIN_US (20 * 1000)
+
+static std::atomic<bool> Enabled;
+static std::atomic<TRACE_BUFFER *> Buffers[TRACE_MAX_THREADS];
+static std::atomic<UINT> BufferCount;
+static thread_local TRACE_BUFFER *ThreadBuffer;
+static thread_local BOOL ThreadRefused;
+static thread_local const char *ThreadName;
+
+// Where the time line of the trace starts, and the reference for measuring the tick rate.
+static ULONGLONG OriginTicks;
+static ULONGLONG OriginUs;
+
+
+// Something that steadily counts up, as cheaply as possible: the time stamp counter where there is one (which runs at
+// a constant rate on every CPU since about 2008), and the OS's monotonic clock elsewhere.
+ULONGLONG TraceGetTicks()
+{
+#if defined(TRACE_USE_TSC)
+	return __rdtsc();
+#elif defined(_WIN32)
+	LARGE_INTEGER Counter;
+	QueryPerformanceCounter(&Counter);
+	return Counter.QuadPart;
+#else
+	timespec Now;
+	clock_gettime(CLOCK_MONOTONIC, &Now);
+	return (ULONGLONG)Now.tv_sec * 1000000000 + Now.tv_nsec;
+#endif
+}
+
+
+void TracerStart()
+{
+	if (OriginTicks == 0)
+	{
+		OriginUs = GetMonotonicTimeUs();
+		OriginTicks = TraceGetTicks();
+	}
+	Enabled.store(true);
+}
+
+
+void TracerStop()
+{
+	Enabled.store(false);
+}
+
+
+// Must only be called when no other thread records anything anymore.
+void TracerFree()
+{
+	Enabled.store(false);
+	UINT Count = BufferCount.load();
+	for (UINT i = 0; i < Count && i < TRACE_MAX_THREADS; ++i)
+	{
+		delete Buffers[i].exchange(nullptr);
+	}
+	BufferCount.store(0);
+	ThreadBuffer = nullptr;
+	ThreadRefused = false;
+}
+
+
+static TRACE_BUFFER *CreateThreadBuffer()
+{
+	if (ThreadRefused) return nullptr;
+	UINT Index = BufferCount.fetch_add(1);
+	TRACE_BUFFER *Buffer = Index < TRACE_MAX_THREADS ? new (std::nothrow) TRACE_BUFFER() : nullptr;
+	if (Buffer == nullptr)
+	{
+		ThreadRefused = true;
+		return nullptr;
+	}
+	Buffer->ThreadIndex = Index;
+	Buffer->ThreadName.store(ThreadName);
+	Buffers[Index].store(Buffer, std::memory_order_release);
+	ThreadBuffer = Buffer;
+	return Buffer;
+}
+
+
+static void Record(const char *Name, ULONGLONG StartTicks, ULONGLONG EndTicks, ULONGLONG Id)
+{
+	TRACE_BUFFER *Buffer = ThreadBuffer;
+	if (Buffer == nullptr)
+	{
+		Buffer = CreateThreadBuffer();
+		if (Buffer == nullptr) return;
+	}
+	ULONGLONG Count = Buffer->Count.load(std::memory_order_relaxed);
+	TRACE_EVENT *Event = &Buffer->Events[Count & (TRACE_BUFFER_CAPACITY - 1)];
+	Event->Name = Name;
+	Event->StartTicks = StartTicks;
+	Event->EndTicks = EndTicks;
+	Event->Id = Id;
+	Buffer->Count.store(Count + 1, std::memory_order_release);
+}
+
+
+// Names the calling thread in the trace. Does not set up a buffer; a thread that never records anything costs nothing.
+void TracerSetThreadName(const char *Name)
+{
+	ThreadName = Name;
+	if (ThreadBuffer != nullptr) ThreadBuffer->ThreadName.store(Name);
+}
+
+
+ULONGLONG TraceBegin()
+{
+	if (!Enabled.load(std::memory_order_relaxed)) return 0;
+	return TraceGetTicks();
+}
+
+
+// Returns when the span ended, for a span that begins right after it.
+ULONGLONG TraceEnd(const char *Name, ULONGLONG StartTicks, ULONGLONG Id)
+{
+	if (StartTicks == 0) return 0;
+	ULONGLONG EndTicks = TraceGetTicks();
+	Record(Name, StartTicks, EndTicks, Id);
+	return EndTicks;
+}
+
+
+// Records a span that was not measured on this thread, or not with TraceBegin; e.g. from the arrival of a message to
+// the end of the paint that it caused.
+void TraceSpan(const char *Name, ULONGLONG StartTicks, ULONGLONG EndTicks, ULONGLONG Id)
+{
+	if (StartTicks == 0 || EndTicks < StartTicks || !Enabled.load(std::memory_order_relaxed)) return;
+	Record(Name, StartTicks, EndTicks, Id);
+}
+
+
+void TraceInstant(const char *Name, ULONGLONG Id)
+{
+	if (!Enabled.load(std::memory_order_relaxed)) return;
+	ULONGLONG Now = TraceGetTicks();
+	Record(Name, Now, Now, Id);
+}
+
+
+// An event copied out of a ring buffer, for writing.
+struct COLLECTED_EVENT
+{
+	TRACE_EVENT Event;
+	UINT ThreadIndex;
+};
+
+
+// Copies what the ring buffers hold. The owning threads may keep recording meanwhile; events that they may have
+// overwritten while they were being copied are left out.
+static COLLECTED_EVENT *CollectEvents(SIZE_T *EventCount)
+{
+	*EventCount = 0;
+	UINT ThreadCount = BufferCount.load();
+	if (ThreadCount > TRACE_MAX_THREADS) ThreadCount = TRACE_MAX_THREADS;
+	COLLECTED_EVENT *Events = (COLLECTED_EVENT *)malloc(((SIZE_T)ThreadCount * TRACE_BUFFER_CAPACITY + 1) * sizeof(COLLECTED_EVENT));
+	if (Events == nullptr) return nullptr;
+
+	for (UINT t = 0; t < ThreadCount; ++t)
+	{
+		TRACE_BUFFER *Buffer = Buffers[t].load(std::memory_order_acquire);
+		if (Buffer == nullptr) continue;
+		ULONGLONG End = Buffer->Count.load(std::memory_order_acquire);
+		ULONGLONG Begin = End > TRACE_BUFFER_CAPACITY ? End - TRACE_BUFFER_CAPACITY : 0;
+		SIZE_T First = *EventCount;
+		for (ULONGLONG i = Begin; i < End; ++i)
+		{
+			Events[*EventCount].Event = Buffer->Events[i & (TRACE_BUFFER_CAPACITY - 1)];
+			Events[*EventCount].ThreadIndex = t;
+			++*EventCount;
+		}
+		// The slot of the event that is being recorded right now counts as overwritten, too.
+		ULONGLONG Now = Buffer->Count.load(std::memory_order_acquire);
+		if (Now + 1 > Begin + TRACE_BUFFER_CAPACITY)
+		{
+			ULONGLONG Lost = Now + 1 - TRACE_BUFFER_CAPACITY - Begin;
+			if (Lost > End - Begin) Lost = End - Begin;
+			memmove(&Events[First], &Events[First + Lost], (SIZE_T)(End - Begin - Lost) * sizeof(COLLECTED_EVENT));
+			*EventCount -= (SIZE_T)Lost;
+		}
+	}
+	return Events;
+}
+
+
+// The text of the trace, built up in memory.
+struct TRACE_OUTPUT
+{
+	char *Text;
+	SIZE_T Length;
+	SIZE_T Capacity;
+	BOOL Failed;
+};
+
+
+static void Append(TRACE_OUTPUT *Output, const char *Format, ...)
+{
+	if (Output->Failed) return;
+	for (;;)
+	{
+		va_list Arguments;
+		va_start(Arguments, Format);
+		int Length = vsnprintf(Output->Text + Output->Length, Output->Capacity - Output->Length, Format, Arguments);
+		va_end(Arguments);
+		if (Length < 0)
+		{
+			Output->Failed = true;
+			return;
+		}
+		if ((SIZE_T)Length < Output->Capacity - Output->Length)
+		{
+			Output->Length += Length;
+			return;
+		}
+		SIZE_T Capacity = Output->Capacity * 2 + Length;
+		char *Text = (char *)realloc(Output->Text, Capacity);
+		if (Text == nullptr)
+		{
+			Output->Failed = true;
+			return;
+		}
+		Output->Text = Text;
+		Output->Capacity = Capacity;
+	}
+}
+
+
+// Span names are meant to be identifiers, but anything that would break the JSON is replaced anyway.
+static void AppendName(TRACE_OUTPUT *Output, const char *Name)
+{
+	const char *p = Name;
+	while (*p != 0 && *p != '"' && *p != '\\' && (unsigned char)*p >= 0x20) ++p;
+	if (*p == 0)
+	{
+		Append(Output, "\"%s\"", Name);
+		return;
+	}
+	Append(Output, "\"");
+	for (p = Name; *p != 0; ++p)
+	{
+		char c = *p;
+		Append(Output, "%c", c == '"' || c == '\\' || (unsigned char)c < 0x20 ? '_' : c);
+	}
+	Append(Output, "\"");
+}
+
+
+static int CompareByNameAndDuration(const void *a, const void *b)
+{
+	const TRACE_EVENT *A = &((const COLLECTED_EVENT *)a)->Event;
+	const TRACE_EVENT *B = &((const COLLECTED_EVENT *)b)->Event;
+	int Order = strcmp(A->Name, B->Name);
+	if (Order != 0) return Order;
+	ULONGLONG DurationA = A->EndTicks - A->StartTicks;
+	ULONGLONG DurationB = B->EndTicks - B->StartTicks;
+	return DurationA < DurationB ? -1 : DurationA > DurationB ? 1 : 0;
+}
+
+
+// Writes one entry of "histograms" for Events[0..Count), which all have the same name and are sorted by duration.
+static void AppendHistogram(TRACE_OUTPUT *Output, const COLLECTED_EVENT *Events, SIZE_T Count, double TicksPerUs)
+{
+	double P50 = (Events[(Count - 1) / 2].Event.EndTicks - Events[(Count - 1) / 2].Event.StartTicks) / TicksPerUs;
+	double P99 = (Events[(Count - 1) * 99 / 100].Event.EndTicks - Events[(Count - 1) * 99 / 100].Event.StartTicks) / TicksPerUs;
+	double Max = (Events[Count - 1].Event.EndTicks - Events[Count - 1].Event.StartTicks) / TicksPerUs;
+	Append(Output, "{\"name\":");
+	AppendName(Output, Events[0].Event.Name);
+	Append(Output, ",\"count\":%llu,\"p50_us\":%.3f,\"p99_us\":%.3f,\"max_us\":%.3f,\"buckets\":[",
+		(unsigned long long)Count, P50, P99, Max);
+
+	// [upper bound in microseconds, count] for every non-empty bucket; the first one takes everything up to 1 us.
+	double UpperUs = 1;
+	SIZE_T i = 0;
+	BOOL First = true;
+	while (i < Count)
+	{
+		SIZE_T InBucket = 0;
+		while (i < Count && (Events[i].Event.EndTicks - Events[i].Event.StartTicks) / TicksPerUs <= UpperUs)
+		{
+			++InBucket;
+			++i;
+		}
+		if (InBucket > 0)
+		{
+			Append(Output, "%s[%.0f,%llu]", First ? "" : ",", UpperUs, (unsigned long long)InBucket);
+			First = false;
+		}
+		UpperUs *= 2;
+	}
+	Append(Output, "]}");
+}
+
+
+// The events that are instants rather than spans are left out of the histograms.
+static void AppendHistograms(TRACE_OUTPUT *Output, COLLECTED_EVENT *Events, SIZE_T EventCount, double TicksPerUs)
+{
+	qsort(Events, EventCount, sizeof(COLLECTED_EVENT), CompareByNameAndDuration);
+	BOOL First = true;
+	SIZE_T Start = 0;
+	while (Start < EventCount)
+	{
+		SIZE_T End = Start + 1;
+		while (End < EventCount && strcmp(Events[End].Event.Name, Events[Start].Event.Name) == 0) ++End;
+		SIZE_T Spans = Start;
+		while (Spans < End && Events[Spans].Event.EndTicks == Events[Spans].Event.StartTicks) ++Spans;
+		if (Spans < End)
+		{
+			if (!First) Append(Output, ",\n");
+			AppendHistogram(Output, Events + Spans, End - Spans, TicksPerUs);
+			First = false;
+		}
+		Start = End;
+	}
+}
+
+
+// Writes everything that the ring buffers currently hold. May take CALIBRATION_MIN_US if the tracer was only just
+// started. Returns false if the file could not be written.
+BOOL TracerWriteChromeTrace(const PATH_CHAR *Path)
+{
+	if (OriginTicks == 0) return false;
+	ULONGLONG NowUs = GetMonotonicTimeUs();
+	while (NowUs - OriginUs < CALIBRATION_MIN_US) NowUs = GetMonotonicTimeUs();
+	ULONGLONG NowTicks = TraceGetTicks();
+	double TicksPerUs = (double)(NowTicks - OriginTicks) / (NowUs - OriginUs);
+	if (TicksPerUs <= 0) return false;
+
+	SIZE_T EventCount;
+	COLLECTED_EVENT *Events = CollectEvents(&EventCount);
+	if (Events == nullptr) return false;
+
+	TRACE_OUTPUT Output = {};
+	Append(&Output, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+	Append(&Output, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"Clipboard Monitor\"}}");
+	UINT ThreadCount = BufferCount.load();
+	for (UINT t = 0; t < ThreadCount && t < TRACE_MAX_THREADS; ++t)
+	{
+		TRACE_BUFFER *Buffer = Buffers[t].load(std::memory_order_acquire);
+		const char *Name = Buffer != nullptr ? Buffer->ThreadName.load() : nullptr;
+		if (Name == nullptr) continue;
+		Append(&Output, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":", t + 1);
+		AppendName(&Output, Name);
+		Append(&Output, "}}");
+	}
+	for (SIZE_T i = 0; i < EventCount; ++i)
+	{
+		const TRACE_EVENT *Event = &Events[i].Event;
+		double StartUs = ((double)Event->StartTicks - (double)OriginTicks) / TicksPerUs;
+		Append(&Output, ",\n{\"name\":");
+		AppendName(&Output, Event->Name);
+		if (Event->EndTicks == Event->StartTicks)
+		{
+			Append(&Output, ",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f", StartUs);
+		}
+		else
+		{
+			Append(&Output, ",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f", StartUs, (Event->EndTicks - Event->StartTicks) / TicksPerUs);
+		}
+		Append(&Output, ",\"pid\":1,\"tid\":%u", Events[i].ThreadIndex + 1);
+		if (Event->Id != 0) Append(&Output, ",\"args\":{\"id\":%llu}", (unsigned long long)Event->Id);
+		Append(&Output, "}");
+	}
+	Append(&Output, "\n],\n\"histograms\":[\n");
+	AppendHistograms(&Output, Events, EventCount, TicksPerUs);
+	Append(&Output, "\n]}\n");
+	free(Events);
+
+	BOOL Succeeded = false;
+	PORTABLE_FILE File;
+	if (!Output.Failed && FileOpen(&File, Path, true))
+	{
+		Succeeded = FileTruncate(&File, 0) && FileWriteAt(&File, 0, Output.Text, Output.Length);
+		FileClose(&File);
+	}
+	free(Output.Text);
+	return Succeeded;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Portable.h"
+#include "PortableFile.h"
+#include <atomic>
+
+struct TRACE_EVENT;
+struct TRACE_BUFFER;
+
+// Records how long the stages of a capture take, from the clipboard notification to the paint that shows the result,
+// cheaply enough to stay on in normal use: a span costs a read of the time stamp counter at either end and a few stores,
+// and nothing but a check of a flag while the tracer is stopped. Stages that follow each other share the reading in
+// between (TraceEnd returns it), so each of them costs a single read (see the trace/* benchmarks).
+//
+// Every thread records into a ring buffer of its own, so recording never locks or allocates, except for the first span
+// of a thread, which sets up its buffer. Once a ring buffer is full, the oldest spans are overwritten. Buffers are kept
+// until TracerFree, so only long-lived threads should record spans.
+//
+//   ULONGLONG Start = TraceBegin();
+//   ...
+//   TraceEnd("DecodeCapture", Start, SequenceNumber);
+//
+//   ULONGLONG Start = TraceBegin();
+//   ...
+//   Start = TraceEnd("MipPyramid", Start, SequenceNumber);
+//   ...
+//   TraceEnd("CompressImage", Start, SequenceNumber);
+//
+// Span names must be string literals (or otherwise live until TracerFree); only the pointer is recorded. Id ties the
+// spans of one capture together (the clipboard sequence number), or is 0. While the tracer is stopped, TraceBegin
+// returns 0 and TraceEnd ignores that (and returns 0, too).
+//
+// TracerWriteChromeTrace writes what the buffers hold in the Chrome trace event format, which chrome://tracing and
+// https://ui.perfetto.dev display as a timeline. Besides "traceEvents", the file has a "histograms" array with the
+// count, p50, p99 and maximum duration of every span name, and how the durations are distributed over power-of-two
+// buckets.
+
+#define TRACE_BUFFER_CAPACITY 8192 // Spans per thread; a power of two.
+#define TRACE_MAX_THREADS 32       // Threads beyond these do not record anything.
+
+extern void                TracerStart();
+extern void                TracerStop();
+extern void                TracerFree();
+extern void                TracerSetThreadName(const char *Name);
+extern ULONGLONG           TraceGetTicks();
+extern ULONGLONG           TraceBegin();
+extern ULONGLONG           TraceEnd(const char *Name, ULONGLONG StartTicks, ULONGLONG Id);
+extern void                TraceSpan(const char *Name, ULONGLONG StartTicks, ULONGLONG EndTicks, ULONGLONG Id);
+extern void                TraceInstant(const char *Name, ULONGLONG Id);
+extern BOOL                TracerWriteChromeTrace(const PATH_CHAR *Path);
+
+struct TRACE_EVENT
+{
+	const char *Name;
+	ULONGLONG StartTicks;
+	ULONGLONG EndTicks;    // Equal to StartTicks for an instant.
+	ULONGLONG Id;
+};
+
+struct TRACE_BUFFER
+{
+	TRACE_EVENT Events[TRACE_BUFFER_CAPACITY];
+	// How many events were ever recorded; event i is at Events[i % TRACE_BUFFER_CAPACITY]. Only written by the thread
+	// that owns the buffer, after the event itself.
+	std::atomic<ULONGLONG> Count;
+	std::atomic<const char *> ThreadName;
+	UINT ThreadIndex;
+};
@@ -0,0 +1,906 @@
+#include "TrigramIndex.h"
+#include <stdlib.h>
+#include <string.h>
+
+// The index may take this much of the UTF-16 text of its documents, plus BASE_BUDGET for the entries of the trigrams,
+// which grow with the vocabulary rather than with the text.
+#define BUDGET_PERCENT 50
+#define BASE_BUDGET (2 * 1024 * 1024)
+#define INITIAL_HASH_SIZE 1024
+#define INITIAL_TRIGRAM_CAPACITY 512
+// The recent lists are packed once they have as many postings as the packed ones, and at least take this much.
+#define MIN_RECENT_SIZE (256 * 1024)
+// The first block of a spilled list has this many bytes.
+#define INITIAL_BLOCK_SIZE 16
+// A gap whose Rice quotient would take this many bits is written out in full instead.
+#define RICE_ESCAPE 24
+// Postings are appended to a packed list as a new chunk while its chunks are fewer than MAX_CHUNKS and take at least
+// MIN_CHUNK_SIZE bytes on average. Otherwise, it is written as a single chunk.
+#define MAX_CHUNKS 64
+#define MIN_CHUNK_SIZE 64
+
+// TRIGRAM_ENTRY.State: whether there is a recent list, whether it spilled into blocks, and if not, how many bytes of
+// deltas Recent holds.
+#define STATE_RECENT 0x8000
+#define STATE_SPILLED 0x4000
+#define STATE_INLINE_MASK 7
+#define INLINE_SIZE 4
+#define PACKED_INLINE 0x80000000u
+#define PACKED_NONE 0xFFFFFFFFu
+#define NO_NUMBER ((SIZE_T)-1)
+#define NO_TRIGRAM (~0ull)
+#define NO_BLOCK 0xFFFFFFFFu
+
+// A list that spilled out of its entry is a chain of blocks in RecentData, each twice as large as the one before, so
+// that nothing is ever copied.
+struct RECENT_BLOCK
+{
+	UINT Previous;               // Offset of the block before, or NO_BLOCK.
+	UINT SizeCb;
+	UINT Capacity;
+	// Followed by the varint deltas.
+};
+
+// Ordinals decoded from a list.
+struct ORDINAL_LIST
+{
+	UINT *Items;
+	SIZE_T Count;
+	SIZE_T Capacity;
+};
+
+// Packed lists while they are written.
+struct BYTE_BUFFER
+{
+	BYTE *Data;
+	SIZE_T SizeCb;
+	SIZE_T Capacity;
+};
+
+// Bits are read and written starting with the lowest bit of every byte.
+struct BIT_READER
+{
+	const BYTE *Data;
+	const BYTE *End;
+	ULONGLONG Bits;
+	UINT BitCount;
+};
+
+struct BIT_WRITER
+{
+	BYTE_BUFFER *Buffer;
+	ULONGLONG Bits;
+	UINT BitCount;
+};
+
+
+// Case folding without a locale: ASCII, Latin-1, Greek and Cyrillic letters, which covers most text that gets copied.
+// Anything else only matches exactly.
+WCHAR FoldCase(WCHAR c)
+{
+	if (c < 0x80)
+	{
+		return c >= 'A' && c <= 'Z' ? (WCHAR)(c + 0x20) : c;
+	}
+	if ((c >= 0xC0 && c <= 0xDE && c != 0xD7) || (c >= 0x391 && c <= 0x3AB && c != 0x3A2) || (c >= 0x410 && c <= 0x42F))
+	{
+		return (WCHAR)(c + 0x20);
+	}
+	if (c >= 0x400 && c <= 0x40F)
+	{
+		return (WCHAR)(c + 0x50);
+	}
+	return c;
+}
+
+
+static ULONGLONG MakeTrigram(WCHAR a, WCHAR b, WCHAR c)
+{
+	return ((ULONGLONG)a << 32) | ((ULONGLONG)b << 16) | c;
+}
+
+
+static ULONGLONG GetTrigram(const TRIGRAM_ENTRY *Entry)
+{
+	return MakeTrigram(Entry->Trigram[0], Entry->Trigram[1], Entry->Trigram[2]);
+}
+
+
+static SIZE_T HashTrigram(ULONGLONG Trigram)
+{
+	ULONGLONG h = Trigram * 0x9E3779B97F4A7C15ull;
+	return (SIZE_T)(h ^ (h >> 29));
+}
+
+
+static SIZE_T WriteVarint(BYTE *Data, UINT Value)
+{
+	SIZE_T Size = 0;
+	while (Value >= 0x80)
+	{
+		Data[Size++] = (BYTE)(Value | 0x80);
+		Value >>= 7;
+	}
+	Data[Size++] = (BYTE)Value;
+	return Size;
+}
+
+
+static UINT ReadVarint(const BYTE **Data, const BYTE *End)
+{
+	UINT Value = 0;
+	for (UINT Shift = 0; *Data < End && Shift < 35; Shift += 7)
+	{
+		BYTE b = *(*Data)++;
+		Value |= (UINT)(b & 0x7F) << Shift;
+		if (!(b & 0x80)) break;
+	}
+	return Value;
+}
+
+
+// Bytes allocated by the index, including unused capacity.
+SIZE_T TrigramIndexGetMemoryUsage(const TRIGRAM_INDEX *Index)
+{
+	SIZE_T Bytes = Index->DocumentCapacity * sizeof(TRIGRAM_DOCUMENT);
+	Bytes += Index->TrigramCapacity * sizeof(TRIGRAM_ENTRY) + (Index->HashMask + 1) * sizeof(UINT);
+	Bytes += Index->PackedSizeCb + Index->RecentCapacity;
+	return Bytes;
+}
+
+
+SIZE_T TrigramIndexGetBudget(const TRIGRAM_INDEX *Index)
+{
+	return (SIZE_T)(Index->TextLength * sizeof(WCHAR) * BUDGET_PERCENT / 100) + BASE_BUDGET;
+}
+
+
+static BOOL FitsBudget(const TRIGRAM_INDEX *Index, SIZE_T MoreBytes)
+{
+	return TrigramIndexGetMemoryUsage(Index) + MoreBytes <= TrigramIndexGetBudget(Index);
+}
+
+
+static BOOL IsIndexed(const TRIGRAM_INDEX *Index, UINT Ordinal)
+{
+	return Ordinal >= Index->FirstOrdinal && Index->Documents[Ordinal - Index->FirstOrdinal].State == TRIGRAM_DOCUMENT_INDEXED;
+}
+
+
+BOOL TrigramIndexInit(TRIGRAM_INDEX *Index)
+{
+	memset(Index, 0, sizeof(*Index));
+	Index->Hash = (UINT *)calloc(INITIAL_HASH_SIZE, sizeof(UINT));
+	if (Index->Hash == nullptr) return false;
+	Index->HashMask = INITIAL_HASH_SIZE - 1;
+	return true;
+}
+
+
+void TrigramIndexFree(TRIGRAM_INDEX *Index)
+{
+	free(Index->Documents);
+	free(Index->Trigrams);
+	free(Index->Hash);
+	free(Index->PackedData);
+	free(Index->RecentData);
+	memset(Index, 0, sizeof(*Index));
+}
+
+
+// Returns the number of the trigram, or NO_NUMBER and the free position in Hash where it would go.
+static SIZE_T FindTrigram(const TRIGRAM_INDEX *Index, ULONGLONG Trigram, SIZE_T *Position)
+{
+	SIZE_T i = HashTrigram(Trigram) & Index->HashMask;
+	for (; Index->Hash[i] != 0; i = (i + 1) & Index->HashMask)
+	{
+		SIZE_T Number = Index->Hash[i] - 1;
+		if (GetTrigram(&Index->Trigrams[Number]) == Trigram) return Number;
+	}
+	*Position = i;
+	return NO_NUMBER;
+}
+
+
+static void FillHash(UINT *Hash, SIZE_T HashMask, const TRIGRAM_ENTRY *Trigrams, SIZE_T TrigramCount)
+{
+	for (SIZE_T Number = 0; Number < TrigramCount; ++Number)
+	{
+		SIZE_T i = HashTrigram(GetTrigram(&Trigrams[Number])) & HashMask;
+		while (Hash[i] != 0) i = (i + 1) & HashMask;
+		Hash[i] = (UINT)Number + 1;
+	}
+}
+
+
+static BOOL ResizeHash(TRIGRAM_INDEX *Index, SIZE_T Size)
+{
+	UINT *NewHash = (UINT *)calloc(Size, sizeof(UINT));
+	if (NewHash == nullptr) return false;
+	FillHash(NewHash, Size - 1, Index->Trigrams, Index->TrigramCount);
+	free(Index->Hash);
+	Index->Hash = NewHash;
+	Index->HashMask = Size - 1;
+	return true;
+}
+
+
+// Adds an entry with empty lists for the trigram, which FindTrigram did not find at Position.
+static BOOL AddTrigram(TRIGRAM_INDEX *Index, ULONGLONG Trigram, SIZE_T Position, SIZE_T *Number)
+{
+	if (Index->TrigramCount == Index->TrigramCapacity)
+	{
+		// Doubles while the budget allows it, and grows by an eighth after that.
+		SIZE_T NewCapacity = Index->TrigramCapacity != 0 ? Index->TrigramCapacity * 2 : INITIAL_TRIGRAM_CAPACITY;
+		if (!FitsBudget(Index, (NewCapacity - Index->TrigramCapacity) * sizeof(TRIGRAM_ENTRY))) NewCapacity = Index->TrigramCapacity + Index->TrigramCapacity / 8;
+		if (NewCapacity >= 0xFFFFFFFF || !FitsBudget(Index, (NewCapacity - Index->TrigramCapacity) * sizeof(TRIGRAM_ENTRY))) return false;
+		TRIGRAM_ENTRY *NewTrigrams = (TRIGRAM_ENTRY *)realloc(Index->Trigrams, NewCapacity * sizeof(TRIGRAM_ENTRY));
+		if (NewTrigrams == nullptr) return false;
+		Index->Trigrams = NewTrigrams;
+		Index->TrigramCapacity = NewCapacity;
+	}
+	// Kept at most half full.
+	if ((Index->TrigramCount + 1) * 2 > Index->HashMask + 1)
+	{
+		SIZE_T NewSize = (Index->HashMask + 1) * 2;
+		if (!FitsBudget(Index, NewSize / 2 * sizeof(UINT)) || !ResizeHash(Index, NewSize)) return false;
+		FindTrigram(Index, Trigram, &Position);
+	}
+	*Number = Index->TrigramCount++;
+	TRIGRAM_ENTRY *Entry = &Index->Trigrams[*Number];
+	Entry->Trigram[0] = (WCHAR)(Trigram >> 32);
+	Entry->Trigram[1] = (WCHAR)(Trigram >> 16);
+	Entry->Trigram[2] = (WCHAR)Trigram;
+	Entry->State = 0;
+	Entry->Packed = PACKED_NONE;
+	Index->Hash[Position] = (UINT)*Number + 1;
+	return true;
+}
+
+
+// Adds a block with Capacity bytes for deltas at the end of RecentData.
+static BOOL AllocateBlock(TRIGRAM_INDEX *Index, UINT Capacity, UINT Previous, UINT *Offset)
+{
+	SIZE_T Needed = Index->RecentSizeCb + sizeof(RECENT_BLOCK) + Capacity;
+	if (Needed > Index->RecentCapacity)
+	{
+		// Doubles while the budget allows it, and grows by an eighth after that.
+		SIZE_T NewCapacity = Index->RecentCapacity != 0 ? Index->RecentCapacity * 2 : 64 * 1024;
+		if (!FitsBudget(Index, NewCapacity - Index->RecentCapacity)) NewCapacity = Index->RecentCapacity + Index->RecentCapacity / 8;
+		if (NewCapacity < Needed) NewCapacity = Needed;
+		if (NewCapacity > NO_BLOCK || !FitsBudget(Index, NewCapacity - Index->RecentCapacity)) return false;
+		BYTE *NewData = (BYTE *)realloc(Index->RecentData, NewCapacity);
+		if (NewData == nullptr) return false;
+		Index->RecentData = NewData;
+		Index->RecentCapacity = NewCapacity;
+	}
+	RECENT_BLOCK Block = { Previous, 0, Capacity };
+	memcpy(Index->RecentData + Index->RecentSizeCb, &Block, sizeof(Block));
+	*Offset = (UINT)Index->RecentSizeCb;
+	Index->RecentSizeCb = Needed;
+	return true;
+}
+
+
+// Adds Ordinal to the recent list of the trigram, unless it is the last one there already. Returns false if that would
+// take the index over its budget, or memory ran out.
+static BOOL AddPosting(TRIGRAM_INDEX *Index, ULONGLONG Trigram, UINT Ordinal)
+{
+	SIZE_T Position;
+	SIZE_T Number = FindTrigram(Index, Trigram, &Position);
+	if (Number == NO_NUMBER && !AddTrigram(Index, Trigram, Position, &Number)) return false;
+	TRIGRAM_ENTRY *Entry = &Index->Trigrams[Number];
+	if (!(Entry->State & STATE_RECENT))
+	{
+		Entry->State = STATE_RECENT;
+		Entry->Last = Ordinal;
+		return true;
+	}
+	// Each document is listed once per trigram.
+	if (Entry->Last == Ordinal) return true;
+
+	BYTE Delta[5];
+	UINT DeltaSize = (UINT)WriteVarint(Delta, Ordinal - Entry->Last);
+	RECENT_BLOCK Block;
+	if (!(Entry->State & STATE_SPILLED))
+	{
+		UINT InlineSize = Entry->State & STATE_INLINE_MASK;
+		if (InlineSize + DeltaSize <= INLINE_SIZE)
+		{
+			memcpy((BYTE *)&Entry->Recent + InlineSize, Delta, DeltaSize);
+			Entry->State += (WORD)DeltaSize;
+			Entry->Last = Ordinal;
+				return true;
+		}
+		UINT Offset;
+		if (!AllocateBlock(Index, INITIAL_BLOCK_SIZE, NO_BLOCK, &Offset)) return false;
+		memcpy(Index->RecentData + Offset + sizeof(RECENT_BLOCK), &Entry->Recent, InlineSize);
+		Block.Previous = NO_BLOCK;
+		Block.SizeCb = InlineSize;
+		Block.Capacity = INITIAL_BLOCK_SIZE;
+		Entry->State = STATE_RECENT | STATE_SPILLED;
+		Entry->Recent = Offset;
+	}
+	else
+	{
+		memcpy(&Block, Index->RecentData + Entry->Recent, sizeof(Block));
+	}
+	if (Block.SizeCb + DeltaSize > Block.Capacity)
+	{
+		UINT Offset;
+		if (Block.Capacity > 0x7FFFFFFF || !AllocateBlock(Index, Block.Capacity * 2, Entry->Recent, &Offset)) return false;
+		Block.Previous = Entry->Recent;
+		Block.SizeCb = 0;
+		Block.Capacity *= 2;
+		Entry->Recent = Offset;
+	}
+	memcpy(Index->RecentData + Entry->Recent + sizeof(RECENT_BLOCK) + Block.SizeCb, Delta, DeltaSize);
+	Block.SizeCb += DeltaSize;
+	memcpy(Index->RecentData + Entry->Recent, &Block, sizeof(Block));
+	Entry->Last = Ordinal;
+	return true;
+}
+
+
+// Appends Ordinal if it is that of an indexed document, and comes after the ones that are there.
+static BOOL AppendOrdinal(const TRIGRAM_INDEX *Index, ORDINAL_LIST *Ordinals, UINT Ordinal)
+{
+	if (!IsIndexed(Index, Ordinal) || (Ordinals->Count > 0 && Ordinal <= Ordinals->Items[Ordinals->Count - 1])) return true;
+	if (Ordinals->Count == Ordinals->Capacity)
+	{
+		SIZE_T NewCapacity = Ordinals->Capacity != 0 ? Ordinals->Capacity * 2 : 256;
+		UINT *NewItems = (UINT *)realloc(Ordinals->Items, NewCapacity * sizeof(UINT));
+		if (NewItems == nullptr) return false;
+		Ordinals->Items = NewItems;
+		Ordinals->Capacity = NewCapacity;
+	}
+	Ordinals->Items[Ordinals->Count++] = Ordinal;
+	return true;
+}
+
+
+static BOOL DecodeRecent(const TRIGRAM_INDEX *Index, SIZE_T Number, ORDINAL_LIST *Ordinals)
+{
+	const TRIGRAM_ENTRY *Entry = &Index->Trigrams[Number];
+	if (!(Entry->State & STATE_RECENT)) return true;
+
+	// The deltas lead up to Last, so their sum tells where the list starts. The blocks are chained from the newest,
+	// and since each is twice as large as the one before, there are fewer than 32.
+	const BYTE *Starts[32];
+	const BYTE *Ends[32];
+	UINT BlockCount = 0;
+	if (Entry->State & STATE_SPILLED)
+	{
+		for (UINT Offset = Entry->Recent; Offset != NO_BLOCK && BlockCount < 32; ++BlockCount)
+		{
+			RECENT_BLOCK Block;
+			memcpy(&Block, Index->RecentData + Offset, sizeof(Block));
+			Starts[BlockCount] = Index->RecentData + Offset + sizeof(RECENT_BLOCK);
+			Ends[BlockCount] = Starts[BlockCount] + Block.SizeCb;
+			Offset = Block.Previous;
+		}
+	}
+	else
+	{
+		Starts[0] = (const BYTE *)&Entry->Recent;
+		Ends[0] = Starts[0] + (Entry->State & STATE_INLINE_MASK);
+		BlockCount = 1;
+	}
+	UINT Ordinal = Entry->Last;
+	for (UINT b = 0; b < BlockCount; ++b)
+	{
+		for (const BYTE *Data = Starts[b]; Data < Ends[b];)
+		{
+			Ordinal -= ReadVarint(&Data, Ends[b]);
+		}
+	}
+	if (!AppendOrdinal(Index, Ordinals, Ordinal)) return false;
+	for (UINT b = BlockCount; b > 0; --b)
+	{
+		for (const BYTE *Data = Starts[b - 1]; Data < Ends[b - 1];)
+		{
+			Ordinal += ReadVarint(&Data, Ends[b - 1]);
+			if (!AppendOrdinal(Index, Ordinals, Ordinal)) return false;
+		}
+	}
+	return true;
+}
+
+
+// Tops up Bits to at least 57 bits, which is enough for any gap. Past the end, there are only zeros.
+static void FillBits(BIT_READER *Reader)
+{
+	while (Reader->BitCount <= 56)
+	{
+		if (Reader->Data < Reader->End) Reader->Bits |= (ULONGLONG)*Reader->Data++ << Reader->BitCount;
+		Reader->BitCount += 8;
+	}
+}
+
+
+// Count is at most 56.
+static void WriteBits(BIT_WRITER *Writer, ULONGLONG Value, UINT Count)
+{
+	Writer->Bits |= Value << Writer->BitCount;
+	Writer->BitCount += Count;
+	while (Writer->BitCount >= 8)
+	{
+		Writer->Buffer->Data[Writer->Buffer->SizeCb++] = (BYTE)Writer->Bits;
+		Writer->Bits >>= 8;
+		Writer->BitCount -= 8;
+	}
+}
+
+
+// A gap is Rice coded: its quotient by 2^RiceBits as that many 0 bits and a 1 bit, then the remainder. A quotient of
+// RICE_ESCAPE or more is written as RICE_ESCAPE 0 bits, followed by the whole gap in 32 bits.
+static UINT ReadGap(BIT_READER *Reader, UINT RiceBits)
+{
+	FillBits(Reader);
+	UINT Quotient = 0;
+	while (!(Reader->Bits & 1) && Quotient < RICE_ESCAPE)
+	{
+		Reader->Bits >>= 1;
+		++Quotient;
+	}
+	UINT Gap;
+	if (Quotient == RICE_ESCAPE)
+	{
+		Gap = (UINT)Reader->Bits;
+		Reader->Bits >>= 32;
+		Reader->BitCount -= RICE_ESCAPE + 32;
+		return Gap;
+	}
+	Reader->Bits >>= 1;
+	Gap = (Quotient << RiceBits) | (UINT)(Reader->Bits & ((1ull << RiceBits) - 1));
+	Reader->Bits >>= RiceBits;
+	Reader->BitCount -= Quotient + 1 + RiceBits;
+	return Gap;
+}
+
+
+static void WriteGap(BIT_WRITER *Writer, UINT Gap, UINT RiceBits)
+{
+	UINT Quotient = Gap >> RiceBits;
+	if (Quotient >= RICE_ESCAPE)
+	{
+		WriteBits(Writer, (ULONGLONG)Gap << RICE_ESCAPE, RICE_ESCAPE + 32);
+		return;
+	}
+	ULONGLONG Remainder = Gap & ((1u << RiceBits) - 1);
+	WriteBits(Writer, (1ull << Quotient) | (Remainder << (Quotient + 1)), Quotient + 1 + RiceBits);
+}
+
+
+// A packed list is a number of chunks, one for every time recent postings were appended to it. A chunk is the number
+// of its ordinals, the Rice parameter and the first ordinal, followed by the gaps between the ordinals (minus one),
+// padded to a byte.
+static BOOL DecodePacked(const TRIGRAM_INDEX *Index, UINT Packed, ORDINAL_LIST *Ordinals)
+{
+	if (Packed == PACKED_NONE) return true;
+	if (Packed & PACKED_INLINE) return AppendOrdinal(Index, Ordinals, Packed & ~PACKED_INLINE);
+	const BYTE *Data = Index->PackedData + Packed;
+	const BYTE *End = Index->PackedData + Index->PackedSizeCb;
+	UINT ChunkCount = ReadVarint(&Data, End);
+	for (UINT c = 0; c < ChunkCount && Data < End; ++c)
+	{
+		UINT Count = ReadVarint(&Data, End);
+		UINT RiceBits = Data < End ? *Data++ : 0;
+		UINT Ordinal = ReadVarint(&Data, End);
+		if (!AppendOrdinal(Index, Ordinals, Ordinal)) return false;
+		if (Count < 2) continue;
+		BIT_READER Reader = { Data, End, 0, 0 };
+		for (UINT i = 1; i < Count; ++i)
+		{
+			Ordinal += ReadGap(&Reader, RiceBits) + 1;
+			if (!AppendOrdinal(Index, Ordinals, Ordinal)) return false;
+		}
+		// The next chunk starts after the last byte with bits that were used.
+		Data = Reader.Data - Reader.BitCount / 8;
+	}
+	return true;
+}
+
+
+static BOOL ReserveBytes(BYTE_BUFFER *Buffer, SIZE_T SizeCb)
+{
+	if (SizeCb <= Buffer->Capacity - Buffer->SizeCb) return true;
+	SIZE_T NewCapacity = Buffer->Capacity != 0 ? Buffer->Capacity * 2 : 64 * 1024;
+	if (NewCapacity - Buffer->SizeCb < SizeCb) NewCapacity = Buffer->SizeCb + SizeCb;
+	BYTE *NewData = (BYTE *)realloc(Buffer->Data, NewCapacity);
+	if (NewData == nullptr) return false;
+	Buffer->Data = NewData;
+	Buffer->Capacity = NewCapacity;
+	return true;
+}
+
+
+// Appends a chunk of Count ordinals to Buffer.
+static BOOL EncodeChunk(BYTE_BUFFER *Buffer, const UINT *Ordinals, SIZE_T Count)
+{
+	// At most the varints, and every gap escaped.
+	if (!ReserveBytes(Buffer, 16 + Count * 7)) return false;
+
+	// The parameter that suits the average gap.
+	ULONGLONG Mean = Count > 1 ? (Ordinals[Count - 1] - Ordinals[0] - (Count - 1)) / (Count - 1) : 0;
+	UINT RiceBits = 0;
+	while (RiceBits < 31 && (2ull << RiceBits) <= Mean) ++RiceBits;
+
+	Buffer->SizeCb += WriteVarint(Buffer->Data + Buffer->SizeCb, (UINT)Count);
+	Buffer->Data[Buffer->SizeCb++] = (BYTE)RiceBits;
+	Buffer->SizeCb += WriteVarint(Buffer->Data + Buffer->SizeCb, Ordinals[0]);
+	BIT_WRITER Writer = { Buffer, 0, 0 };
+	for (SIZE_T i = 1; i < Count; ++i)
+	{
+		WriteGap(&Writer, Ordinals[i] - Ordinals[i - 1] - 1, RiceBits);
+	}
+	if (Writer.BitCount > 0) Buffer->Data[Buffer->SizeCb++] = (BYTE)Writer.Bits;
+	return true;
+}
+
+
+// Appends a packed list of Count ordinals to Buffer, and returns what goes into TRIGRAM_ENTRY.Packed.
+static BOOL EncodeList(BYTE_BUFFER *Buffer, const UINT *Ordinals, SIZE_T Count, UINT *Packed)
+{
+	if (Count == 1 && (PACKED_INLINE | Ordinals[0]) != PACKED_NONE)
+	{
+		*Packed = PACKED_INLINE | Ordinals[0];
+		return true;
+	}
+	if (Buffer->SizeCb >= PACKED_INLINE || !ReserveBytes(Buffer, 5)) return false;
+	*Packed = (UINT)Buffer->SizeCb;
+	Buffer->SizeCb += WriteVarint(Buffer->Data + Buffer->SizeCb, 1);
+	return EncodeChunk(Buffer, Ordinals, Count);
+}
+
+
+// Copies the chunks of a packed list to Buffer, with the Count ordinals (if any) as a new chunk after them.
+static BOOL AppendList(BYTE_BUFFER *Buffer, const BYTE *Chunks, SIZE_T ChunksSizeCb, UINT ChunkCount, const UINT *Ordinals, SIZE_T Count, UINT *Packed)
+{
+	if (Buffer->SizeCb >= PACKED_INLINE || !ReserveBytes(Buffer, 5 + ChunksSizeCb)) return false;
+	*Packed = (UINT)Buffer->SizeCb;
+	Buffer->SizeCb += WriteVarint(Buffer->Data + Buffer->SizeCb, Count > 0 ? ChunkCount + 1 : ChunkCount);
+	memcpy(Buffer->Data + Buffer->SizeCb, Chunks, ChunksSizeCb);
+	Buffer->SizeCb += ChunksSizeCb;
+	return Count == 0 || EncodeChunk(Buffer, Ordinals, Count);
+}
+
+
+// Shrinks a buffer to what it holds. If that fails, it simply stays as large as it was.
+static void *ShrinkBuffer(void *Buffer, SIZE_T SizeCb)
+{
+	if (SizeCb == 0)
+	{
+		free(Buffer);
+		return nullptr;
+	}
+	void *Shrunk = realloc(Buffer, SizeCb);
+	return Shrunk != nullptr ? Shrunk : Buffer;
+}
+
+
+// Moves the recent lists into the packed ones, and leaves out the documents that are not indexed (anymore). The recent
+// postings of a trigram are appended to its packed list as a new chunk, which only needs the packed list copied. A list
+// that is small or has many chunks, or every list if Rewrite is set, is decoded and written as a single chunk instead,
+// which also drops the postings of removed documents. The packed lists are written anew, so for a moment, they take
+// twice the memory. Trigrams that have no list left are forgotten, and the others numbered anew.
+static BOOL PackLists(TRIGRAM_INDEX *Index, BOOL Rewrite)
+{
+	UINT *NewPacked = (UINT *)malloc((Index->TrigramCount + 1) * sizeof(UINT));
+	BYTE_BUFFER NewData = {};
+	ORDINAL_LIST Ordinals = {};
+	BOOL Succeeded = NewPacked != nullptr;
+
+	// The lists lie in PackedData in the order of their numbers, so each one ends where the next one starts.
+	SIZE_T ListEnd = Index->PackedSizeCb;
+	for (SIZE_T Number = Index->TrigramCount; Number > 0 && Succeeded; --Number)
+	{
+		UINT Packed = Index->Trigrams[Number - 1].Packed;
+		if (Packed & PACKED_INLINE) continue;
+		NewPacked[Number - 1] = (UINT)(ListEnd - Packed);
+		ListEnd = Packed;
+	}
+	for (SIZE_T Number = 0; Number < Index->TrigramCount && Succeeded; ++Number)
+	{
+		UINT Packed = Index->Trigrams[Number].Packed;
+		Ordinals.Count = 0;
+		if (!Rewrite && !(Packed & PACKED_INLINE))
+		{
+			const BYTE *Chunks = Index->PackedData + Packed;
+			SIZE_T SizeCb = NewPacked[Number];
+			UINT ChunkCount = ReadVarint(&Chunks, Chunks + SizeCb);
+			if (ChunkCount < MAX_CHUNKS && SizeCb >= (SIZE_T)(ChunkCount + 1) * MIN_CHUNK_SIZE)
+			{
+				SIZE_T ChunksSizeCb = SizeCb - (Chunks - (Index->PackedData + Packed));
+				Succeeded = DecodeRecent(Index, Number, &Ordinals) && AppendList(&NewData, Chunks, ChunksSizeCb, ChunkCount, Ordinals.Items, Ordinals.Count, &NewPacked[Number]);
+				continue;
+			}
+		}
+		NewPacked[Number] = PACKED_NONE;
+		Succeeded = DecodePacked(Index, Packed, &Ordinals) && DecodeRecent(Index, Number, &Ordinals);
+		if (Succeeded && Ordinals.Count > 0) Succeeded = EncodeList(&NewData, Ordinals.Items, Ordinals.Count, &NewPacked[Number]);
+	}
+	free(Ordinals.Items);
+	if (!Succeeded)
+	{
+		free(NewPacked);
+		free(NewData.Data);
+		return false;
+	}
+
+	SIZE_T NewCount = 0;
+	for (SIZE_T Number = 0; Number < Index->TrigramCount; ++Number)
+	{
+		if (NewPacked[Number] == PACKED_NONE) continue;
+		Index->Trigrams[NewCount] = Index->Trigrams[Number];
+		Index->Trigrams[NewCount].State = 0;
+		Index->Trigrams[NewCount].Packed = NewPacked[Number];
+		++NewCount;
+	}
+	free(NewPacked);
+	Index->TrigramCount = NewCount;
+	free(Index->PackedData);
+	Index->PackedData = (BYTE *)ShrinkBuffer(NewData.Data, NewData.SizeCb);
+	Index->PackedSizeCb = NewData.SizeCb;
+
+	free(Index->RecentData);
+	Index->RecentData = nullptr;
+	Index->RecentSizeCb = 0;
+	Index->RecentCapacity = 0;
+	if (Rewrite) Index->RemovedLength = 0;
+
+	// The table shrinks with the trigrams, or else is filled anew where it is.
+	SIZE_T HashSize = INITIAL_HASH_SIZE;
+	while (HashSize < NewCount * 2) HashSize *= 2;
+	if (!ResizeHash(Index, HashSize))
+	{
+		memset(Index->Hash, 0, (Index->HashMask + 1) * sizeof(UINT));
+		FillHash(Index->Hash, Index->HashMask, Index->Trigrams, NewCount);
+	}
+	return true;
+}
+
+
+// Over the budget, packing only makes room if the spilled lists take a good part of it. Otherwise, the index is full.
+static BOOL CanMakeRoom(const TRIGRAM_INDEX *Index)
+{
+	SIZE_T MinSize = TrigramIndexGetBudget(Index) / 8;
+	return Index->RecentCapacity >= (MinSize > MIN_RECENT_SIZE ? MinSize : MIN_RECENT_SIZE);
+}
+
+
+// Packs the lists once the recent ones take as much memory as the packed ones, so that the packed lists grow by a good
+// part each time, and most postings are only copied.
+static void PackListsIfLarge(TRIGRAM_INDEX *Index)
+{
+	if (Index->RecentSizeCb >= MIN_RECENT_SIZE && Index->RecentSizeCb >= Index->PackedSizeCb) PackLists(Index, false);
+}
+
+
+// Indexes the text of a document. DocumentId must be larger than that of every document added before. A document that
+// does not fit the budget, or for which memory runs out, is not indexed (see above). Returns false if the document
+// could not be added at all.
+BOOL TrigramIndexAdd(TRIGRAM_INDEX *Index, ULONGLONG DocumentId, const WCHAR *Text, SIZE_T Length)
+{
+	if (Index->DocumentCount > 0 && DocumentId <= Index->Documents[Index->DocumentCount - 1].Id) return false;
+	if ((ULONGLONG)Index->FirstOrdinal + Index->DocumentCount >= 0xFFFFFFFF) return false;
+	if (Index->DocumentCount == Index->DocumentCapacity)
+	{
+		SIZE_T NewCapacity = Index->DocumentCapacity != 0 ? Index->DocumentCapacity * 2 : 256;
+		TRIGRAM_DOCUMENT *NewDocuments = (TRIGRAM_DOCUMENT *)realloc(Index->Documents, NewCapacity * sizeof(TRIGRAM_DOCUMENT));
+		if (NewDocuments == nullptr) return false;
+		Index->Documents = NewDocuments;
+		Index->DocumentCapacity = NewCapacity;
+	}
+	UINT Ordinal = Index->FirstOrdinal + (UINT)Index->DocumentCount;
+	TRIGRAM_DOCUMENT *Document = &Index->Documents[Index->DocumentCount++];
+	Document->Id = DocumentId;
+	Document->Length = Length;
+	Document->State = TRIGRAM_DOCUMENT_INDEXED;
+	Index->TextLength += Length;
+	if (Length < 3) return true;
+
+	// When postings do not fit, packing may make room, once. Otherwise, the document is left out.
+	BOOL Packed = false;
+	if (!FitsBudget(Index, 0))
+	{
+		Packed = CanMakeRoom(Index) && PackLists(Index, false);
+		if (!FitsBudget(Index, 0))
+		{
+			Document->State = TRIGRAM_DOCUMENT_UNINDEXED;
+			++Index->UnindexedCount;
+			return true;
+		}
+	}
+	WCHAR a = FoldCase(Text[0]);
+	WCHAR b = FoldCase(Text[1]);
+	ULONGLONG Previous = NO_TRIGRAM;
+	for (SIZE_T i = 2; i < Length; ++i)
+	{
+		WCHAR c = FoldCase(Text[i]);
+		ULONGLONG Trigram = MakeTrigram(a, b, c);
+		a = b;
+		b = c;
+		// Runs of the same character would otherwise look up the same list over and over.
+		if (Trigram == Previous) continue;
+		Previous = Trigram;
+		if (AddPosting(Index, Trigram, Ordinal)) continue;
+		if (!Packed && CanMakeRoom(Index) && PackLists(Index, false) && AddPosting(Index, Trigram, Ordinal))
+		{
+			Packed = true;
+			continue;
+		}
+		// What was added of it is dropped when the lists are packed; right away if it went into the packed lists.
+		Document->State = TRIGRAM_DOCUMENT_UNINDEXED;
+		++Index->UnindexedCount;
+		if (Packed) PackLists(Index, true);
+		return true;
+	}
+	PackListsIfLarge(Index);
+	return true;
+}
+
+
+// Removes a document, so that queries do not return it anymore. Its postings go when the lists are rewritten, once a
+// quarter of the text has been removed. Returns false if there is no such document.
+BOOL TrigramIndexRemove(TRIGRAM_INDEX *Index, ULONGLONG DocumentId)
+{
+	SIZE_T Low = 0;
+	SIZE_T High = Index->DocumentCount;
+	while (Low < High)
+	{
+		SIZE_T Middle = Low + (High - Low) / 2;
+		if (Index->Documents[Middle].Id < DocumentId) Low = Middle + 1;
+		else High = Middle;
+	}
+	if (Low == Index->DocumentCount || Index->Documents[Low].Id != DocumentId) return false;
+	TRIGRAM_DOCUMENT *Document = &Index->Documents[Low];
+	if (Document->State == TRIGRAM_DOCUMENT_REMOVED) return false;
+	if (Document->State == TRIGRAM_DOCUMENT_UNINDEXED) --Index->UnindexedCount;
+	Document->State = TRIGRAM_DOCUMENT_REMOVED;
+	Index->TextLength -= Document->Length;
+	Index->RemovedLength += Document->Length;
+
+	// Removed documents at the front are forgotten once they are at least half of them.
+	if (Low == Index->RemovedCount)
+	{
+		while (Index->RemovedCount < Index->DocumentCount && Index->Documents[Index->RemovedCount].State == TRIGRAM_DOCUMENT_REMOVED)
+		{
+			++Index->RemovedCount;
+		}
+		if (Index->RemovedCount * 2 >= Index->DocumentCount)
+		{
+			Index->DocumentCount -= Index->RemovedCount;
+			memmove(Index->Documents, Index->Documents + Index->RemovedCount, Index->DocumentCount * sizeof(TRIGRAM_DOCUMENT));
+			Index->FirstOrdinal += (UINT)Index->RemovedCount;
+			Index->RemovedCount = 0;
+		}
+	}
+	if (Index->RemovedLength > Index->TextLength / 4) PackLists(Index, true);
+	return true;
+}
+
+
+static BOOL DecodeTrigram(const TRIGRAM_INDEX *Index, ULONGLONG Trigram, ORDINAL_LIST *Ordinals)
+{
+	SIZE_T Position;
+	SIZE_T Number = FindTrigram(Index, Trigram, &Position);
+	if (Number == NO_NUMBER) return true;
+	return DecodePacked(Index, Index->Trigrams[Number].Packed, Ordinals) && DecodeRecent(Index, Number, Ordinals);
+}
+
+
+static int CompareByCount(const void *a, const void *b)
+{
+	SIZE_T CountA = ((const ORDINAL_LIST *)a)->Count;
+	SIZE_T CountB = ((const ORDINAL_LIST *)b)->Count;
+	return CountA < CountB ? -1 : CountA > CountB ? 1 : 0;
+}
+
+
+static ULONGLONG GetPatternTrigram(const WCHAR *Pattern, SIZE_T i)
+{
+	return MakeTrigram(FoldCase(Pattern[i]), FoldCase(Pattern[i + 1]), FoldCase(Pattern[i + 2]));
+}
+
+
+// Writes the ids of up to MaxCandidates documents that may contain the pattern (case insensitively), newest first,
+// and returns how many there are. Returns every document if the pattern is shorter than a trigram.
+SIZE_T TrigramIndexQuery(const TRIGRAM_INDEX *Index, const WCHAR *Pattern, SIZE_T PatternLength, ULONGLONG *Candidates, SIZE_T MaxCandidates)
+{
+	SIZE_T Count = 0;
+	if (PatternLength < 3)
+	{
+		for (SIZE_T i = Index->DocumentCount; i > 0 && Count < MaxCandidates; --i)
+		{
+			if (Index->Documents[i - 1].State != TRIGRAM_DOCUMENT_REMOVED) Candidates[Count++] = Index->Documents[i - 1].Id;
+		}
+		return Count;
+	}
+	if (MaxCandidates == 0) return 0;
+
+	// The lists of all trigrams in the pattern, shortest first, so that the intersection shrinks quickly.
+	ORDINAL_LIST *Lists = (ORDINAL_LIST *)calloc(PatternLength - 2, sizeof(ORDINAL_LIST));
+	if (Lists == nullptr) return 0;
+	SIZE_T ListCount = 0;
+	BOOL Succeeded = true;
+	BOOL Empty = false;
+	for (SIZE_T i = 0; i + 2 < PatternLength && Succeeded && !Empty; ++i)
+	{
+		ULONGLONG Trigram = GetPatternTrigram(Pattern, i);
+		BOOL Duplicate = false;
+		for (SIZE_T j = 0; j < i && !Duplicate; ++j)
+		{
+			Duplicate = GetPatternTrigram(Pattern, j) == Trigram;
+		}
+		if (Duplicate) continue;
+		Succeeded = DecodeTrigram(Index, Trigram, &Lists[ListCount]);
+		Empty = Lists[ListCount++].Count == 0;
+	}
+
+	// The shortest list bounds the result. Every further list removes the ordinals it does not contain.
+	SIZE_T MatchCount = 0;
+	const UINT *Matches = nullptr;
+	if (Succeeded && !Empty)
+	{
+		qsort(Lists, ListCount, sizeof(Lists[0]), CompareByCount);
+		UINT *Kept = Lists[0].Items;
+		MatchCount = Lists[0].Count;
+		for (SIZE_T l = 1; l < ListCount && MatchCount > 0; ++l)
+		{
+			SIZE_T KeptCount = 0;
+			SIZE_T o = 0;
+			for (SIZE_T m = 0; m < MatchCount && o < Lists[l].Count; ++m)
+			{
+				while (o < Lists[l].Count && Lists[l].Items[o] < Kept[m]) ++o;
+				if (o < Lists[l].Count && Lists[l].Items[o] == Kept[m]) Kept[KeptCount++] = Kept[m];
+			}
+			MatchCount = KeptCount;
+		}
+		Matches = Kept;
+	}
+
+	// Newest first, together with the documents that are not indexed.
+	if (Succeeded)
+	{
+		SIZE_T m = MatchCount;
+		SIZE_T d = Index->UnindexedCount > 0 ? Index->DocumentCount : 0;
+		while (Count < MaxCandidates)
+		{
+			while (d > 0 && Index->Documents[d - 1].State != TRIGRAM_DOCUMENT_UNINDEXED) --d;
+			if (m == 0 && d == 0) break;
+			UINT Ordinal;
+			if (d > 0 && (m == 0 || Index->FirstOrdinal + d - 1 > Matches[m - 1])) Ordinal = Index->FirstOrdinal + (UINT)--d;
+			else Ordinal = Matches[--m];
+			Candidates[Count++] = Index->Documents[Ordinal - Index->FirstOrdinal].Id;
+		}
+	}
+	for (SIZE_T l = 0; l < ListCount; ++l)
+	{
+		free(Lists[l].Items);
+	}
+	free(Lists);
+	return Count;
+}
+
+
+// Finds the first occurrence of Pattern in Text, ignoring case the same way the index does.
+BOOL TextFindFolded(const WCHAR *Text, SIZE_T Length, const WCHAR *Pattern, SIZE_T PatternLength, SIZE_T *Position)
+{
+	*Position = 0;
+	if (PatternLength == 0) return true;
+	if (PatternLength > Length) return false;
+	WCHAR First = FoldCase(Pattern[0]);
+	for (SIZE_T i = 0; i + PatternLength <= Length; ++i)
+	{
+		if (FoldCase(Text[i]) != First) continue;
+		SIZE_T j = 1;
+		while (j < PatternLength && FoldCase(Text[i + j]) == FoldCase(Pattern[j])) ++j;
+		if (j == PatternLength)
+		{
+			*Position = i;
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "Portable.h"
+
+struct TRIGRAM_INDEX;
+struct TRIGRAM_DOCUMENT;
+struct TRIGRAM_ENTRY;
+
+// Inverted index from trigrams (three consecutive UTF-16 code units, case folded) to the documents that contain them.
+// A query returns the documents that contain every trigram of the pattern. That is a superset of the documents that
+// contain the pattern, so the candidates still have to be checked, e.g. with TextFindFolded.
+//
+// Documents are identified by the caller, and must be added in increasing order of their ids. Inside the index they
+// are numbered consecutively (their ordinals), and posting lists hold those. Every trigram has two lists. New postings
+// go to the recent one as varint deltas, which take the few bytes of its TRIGRAM_ENTRY until they spill into a chain
+// of growing blocks in a shared buffer. Every so often, the recent lists are appended to the packed ones, which lie
+// one after the other in a single buffer, with the gaps between their ordinals Rice coded.
+//
+// The index stays within half of the UTF-16 text of its documents, plus 2 MB for the entries of the trigrams, which
+// grow with the vocabulary rather than with the text. A document that does not fit is not indexed, and is then
+// returned by every query, like all documents are for patterns that are too short to have a trigram. On the generated
+// texts of the index/trigrams/*size benchmarks, every document fits. Removed documents are left out of queries right
+// away, and out of the lists once a quarter of the text has been removed.
+
+extern BOOL                TrigramIndexInit(TRIGRAM_INDEX *Index);
+extern void                TrigramIndexFree(TRIGRAM_INDEX *Index);
+extern BOOL                TrigramIndexAdd(TRIGRAM_INDEX *Index, ULONGLONG DocumentId, const WCHAR *Text, SIZE_T Length);
+extern BOOL                TrigramIndexRemove(TRIGRAM_INDEX *Index, ULONGLONG DocumentId);
+extern SIZE_T              TrigramIndexQuery(const TRIGRAM_INDEX *Index, const WCHAR *Pattern, SIZE_T PatternLength, ULONGLONG *Candidates, SIZE_T MaxCandidates);
+extern SIZE_T              TrigramIndexGetMemoryUsage(const TRIGRAM_INDEX *Index);
+extern SIZE_T              TrigramIndexGetBudget(const TRIGRAM_INDEX *Index);
+extern WCHAR               FoldCase(WCHAR c);
+extern BOOL                TextFindFolded(const WCHAR *Text, SIZE_T Length, const WCHAR *Pattern, SIZE_T PatternLength, SIZE_T *Position);
+
+struct TRIGRAM_DOCUMENT
+{
+	ULONGLONG Id;
+	SIZE_T Length;
+	BYTE State;                  // TRIGRAM_DOCUMENT_*.
+};
+
+#define TRIGRAM_DOCUMENT_INDEXED 0
+#define TRIGRAM_DOCUMENT_UNINDEXED 1 // Over the budget; a candidate for every query.
+#define TRIGRAM_DOCUMENT_REMOVED 2
+
+struct TRIGRAM_ENTRY
+{
+	WCHAR Trigram[3];
+	WORD State;                  // Of the recent list.
+	UINT Packed;                 // Offset of the packed list in PackedData, or the ordinal of its only document.
+	UINT Last;                   // Ordinal of the newest document in the recent list.
+	UINT Recent;                 // The varint deltas leading up to Last, or where the last block of them is.
+};
+
+struct TRIGRAM_INDEX
+{
+	// Every document that has not been removed, and some that have, in the order they were added. The first one has
+	// ordinal FirstOrdinal.
+	TRIGRAM_DOCUMENT *Documents;
+	SIZE_T DocumentCount;
+	SIZE_T DocumentCapacity;
+	UINT FirstOrdinal;
+	SIZE_T RemovedCount;         // Removed documents at the start of Documents.
+	SIZE_T UnindexedCount;
+	ULONGLONG TextLength;        // Characters in the documents that have not been removed.
+	ULONGLONG RemovedLength;     // Characters in documents removed since the lists were last rewritten.
+
+	// Every trigram that has a list, by number. Hash is an open addressing table of the numbers plus one (0 is free), at
+	// most half full.
+	TRIGRAM_ENTRY *Trigrams;
+	SIZE_T TrigramCount;
+	SIZE_T TrigramCapacity;
+	UINT *Hash;
+	SIZE_T HashMask;
+
+	BYTE *PackedData;
+	SIZE_T PackedSizeCb;
+
+	// The blocks of the recent lists that spilled.
+	BYTE *RecentData;
+	SIZE_T RecentSizeCb;
+	SIZE_T RecentCapacity;
+};
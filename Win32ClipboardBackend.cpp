@@ -0,0 +1,128 @@
+#include "Win32ClipboardBackend.h"
+#include "ClipboardBackend.h"
+#include <strsafe.h>
+#include <stdlib.h>
+#include <string.h>
+
+static BOOL Win32Open(void *Context)
+{
+	return OpenClipboard((HWND)Context);
+}
+
+
+static void Win32Close(void *Context)
+{
+	CloseClipboard();
+}
+
+
+static DWORD Win32GetSequenceNumber(void *Context)
+{
+	return GetClipboardSequenceNumber();
+}
+
+
+static UINT Win32EnumFormats(void *Context, UINT Format)
+{
+	return EnumClipboardFormats(Format);
+}
+
+
+static LPCWSTR GetStandardFormatName(UINT Format)
+{
+	switch (Format)
+	{
+		case CF_TEXT:             return L"CF_TEXT";
+		case CF_BITMAP:           return L"CF_BITMAP";
+		case CF_METAFILEPICT:     return L"CF_METAFILEPICT";
+		case CF_SYLK:             return L"CF_SYLK";
+		case CF_DIF:              return L"CF_DIF";
+		case CF_TIFF:             return L"CF_TIFF";
+		case CF_OEMTEXT:          return L"CF_OEMTEXT";
+		case CF_DIB:              return L"CF_DIB";
+		case CF_PALETTE:          return L"CF_PALETTE";
+		case CF_PENDATA:          return L"CF_PENDATA";
+		case CF_RIFF:             return L"CF_RIFF";
+		case CF_WAVE:             return L"CF_WAVE";
+		case CF_UNICODETEXT:      return L"CF_UNICODETEXT";
+		case CF_ENHMETAFILE:      return L"CF_ENHMETAFILE";
+		case CF_HDROP:            return L"CF_HDROP";
+		case CF_LOCALE:           return L"CF_LOCALE";
+		case CF_DIBV5:            return L"CF_DIBV5";
+		case CF_OWNERDISPLAY:     return L"CF_OWNERDISPLAY";
+		case CF_DSPTEXT:          return L"CF_DSPTEXT";
+		case CF_DSPBITMAP:        return L"CF_DSPBITMAP";
+		case CF_DSPMETAFILEPICT:  return L"CF_DSPMETAFILEPICT";
+		case CF_DSPENHMETAFILE:   return L"CF_DSPENHMETAFILE";
+	}
+	if (Format >= CF_PRIVATEFIRST && Format <= CF_PRIVATELAST) return L"(private)";
+	if (Format >= CF_GDIOBJFIRST && Format <= CF_GDIOBJLAST) return L"(GDI object)";
+	return nullptr;
+}
+
+
+static BOOL Win32GetFormatName(void *Context, UINT Format, WCHAR *Name, UINT NameLength)
+{
+	LPCWSTR StandardName = GetStandardFormatName(Format);
+	if (StandardName != nullptr)
+	{
+		return SUCCEEDED(StringCchCopyW(Name, NameLength, StandardName));
+	}
+	return GetClipboardFormatNameW(Format, Name, (int)NameLength) > 0;
+}
+
+
+static UINT Win32RegisterFormat(void *Context, const char *Name)
+{
+	return RegisterClipboardFormatA(Name);
+}
+
+
+// Formats whose handle is a GDI object, or something else that is not a global memory block.
+static BOOL IsHandleFormat(UINT Format)
+{
+	switch (Format)
+	{
+		case CF_BITMAP:
+		case CF_PALETTE:
+		case CF_ENHMETAFILE:
+		case CF_OWNERDISPLAY:
+		case CF_DSPBITMAP:
+		case CF_DSPENHMETAFILE:
+			return true;
+	}
+	return Format >= CF_GDIOBJFIRST && Format <= CF_GDIOBJLAST;
+}
+
+
+static const BYTE *Win32LockData(void *Context, UINT Format, SIZE_T *SizeCb)
+{
+	if (IsHandleFormat(Format)) return nullptr;
+
+	HANDLE Handle = GetClipboardData(Format);
+	if (Handle == nullptr) return nullptr;
+	const BYTE *Data = (const BYTE *)GlobalLock(Handle);
+	if (Data == nullptr) return nullptr;
+	*SizeCb = GlobalSize(Handle);
+	return Data;
+}
+
+
+static void Win32UnlockData(void *Context, UINT Format, const BYTE *Data)
+{
+	GlobalUnlock(GlobalHandle(Data));
+}
+
+
+void Win32ClipboardBackendInit(CLIPBOARD_BACKEND *Backend, HWND Hwnd)
+{
+	Backend->Context = Hwnd;
+	Backend->Open = Win32Open;
+	Backend->Close = Win32Close;
+	Backend->GetSequenceNumber = Win32GetSequenceNumber;
+	Backend->EnumFormats = Win32EnumFormats;
+	Backend->GetFormatName = Win32GetFormatName;
+	Backend->RegisterFormat = Win32RegisterFormat;
+	Backend->LockData = Win32LockData;
+	Backend->UnlockData = Win32UnlockData;
+}
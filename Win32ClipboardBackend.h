@@ -0,0 +1,8 @@
+#pragma once
+
+#include "Portable.h"
+
+struct CLIPBOARD_BACKEND;
+
+// The system clipboard. Hwnd becomes the clipboard owner while it is open.
+extern void                Win32ClipboardBackendInit(CLIPBOARD_BACKEND *Backend, HWND Hwnd);
@@ -31,8 +31,6 @@ extern BOOL                HandleWindowMessage_KeyDown_ForVScroll(HWND hWnd, WPA
 extern INT                 StrlenMax(LPCWSTR str, INT cchMax);
 extern void                ShowWindowModal(HWND hWnd, BOOL *QueryCloseRequested);
 extern INT                 GetDefaultSinglelineEditBoxHeight(HWND TextBox, INT dpi);
-extern INT                 GetPixelDataOffsetForPackedDIB(const BITMAPINFOHEADER *BitmapInfoHeader);
-extern HBITMAP             CreateDIBFromPackedDIB(BITMAPINFOHEADER *PackedDIB, SIZE_T PackedDIBSizeCb, BITMAP *BitmapDesc);
 extern BOOL                HeapPoolEnsure(HEAP_POOL *Pool, SIZE_T Size);
 extern void                HeapPoolFree(HEAP_POOL *Pool);
 extern LPCWSTR             GetFullFontFaceNameFromHDC(HDC hdc, HEAP_POOL *Pool);
@@ -0,0 +1,522 @@
+#include "X11ClipboardBackend.h"
+#include "ClipboardBackend.h"
+#include <X11/Xlib.h>
+#include <X11/Xatom.h>
+#include <X11/extensions/Xfixes.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Atoms are XIDs, which have the top 3 bits clear, so every atom fits between X11_CLIPBOARD_FORMAT_ATOM and the end of
+// the UINT range.
+#define MAX_ATOM 0x1FFFFFFF
+#define BMP_FILE_HEADER_SIZE 14
+
+
+// Errors are expected from owners that misbehave (e.g. with targets that are not atoms). Xlib's default handler would
+// end the process.
+static int IgnoreXError(Display *, XErrorEvent *)
+{
+	return 0;
+}
+
+
+static void HandleEvent(X11_CLIPBOARD *Clipboard, const XEvent *Event)
+{
+	if (Event->type == Clipboard->XFixesEventBase + XFixesSelectionNotify)
+	{
+		const XFixesSelectionNotifyEvent *Notify = (const XFixesSelectionNotifyEvent *)Event;
+		if (Notify->selection == Clipboard->Selection)
+		{
+			// 0 means unknown.
+			if (++Clipboard->SequenceNumber == 0) ++Clipboard->SequenceNumber;
+			Clipboard->Changed = true;
+		}
+	}
+}
+
+
+static BOOL IsSelectionNotify(const X11_CLIPBOARD *Clipboard, const XEvent *Event)
+{
+	return Event->type == SelectionNotify && Event->xselection.requestor == Clipboard->Window && Event->xselection.selection == Clipboard->Selection;
+}
+
+
+static BOOL IsNewPropertyValue(const X11_CLIPBOARD *Clipboard, const XEvent *Event)
+{
+	return Event->type == PropertyNotify && Event->xproperty.window == Clipboard->Window && Event->xproperty.atom == Clipboard->PropertyAtom && Event->xproperty.state == PropertyNewValue;
+}
+
+
+// Waits for an event that Matches, and handles all other events in the meantime. Returns false if there was none for
+// X11_CLIPBOARD_TIMEOUT_MS.
+static BOOL WaitForEvent(X11_CLIPBOARD *Clipboard, BOOL (*Matches)(const X11_CLIPBOARD *Clipboard, const XEvent *Event), XEvent *Event)
+{
+	ULONGLONG DeadlineUs = GetMonotonicTimeUs() + X11_CLIPBOARD_TIMEOUT_MS * 1000;
+	for (;;)
+	{
+		// This also sends the requests, and reads whatever has arrived.
+		while (XPending(Clipboard->Display) > 0)
+		{
+			XNextEvent(Clipboard->Display, Event);
+			if (Matches(Clipboard, Event)) return true;
+			HandleEvent(Clipboard, Event);
+		}
+		ULONGLONG NowUs = GetMonotonicTimeUs();
+		if (NowUs >= DeadlineUs) return false;
+		pollfd Fd = {};
+		Fd.fd = ConnectionNumber(Clipboard->Display);
+		Fd.events = POLLIN;
+		poll(&Fd, 1, (int)((DeadlineUs - NowUs + 999) / 1000));
+	}
+}
+
+
+// Reads and deletes the property that the owner has put the data in. Items of format 32 come as longs, as Xlib always
+// returns them.
+static BOOL ReadProperty(X11_CLIPBOARD *Clipboard, Atom *Type, BYTE **Data, SIZE_T *SizeCb)
+{
+	int Format;
+	unsigned long ItemCount;
+	unsigned long BytesAfter;
+	unsigned char *Value = nullptr;
+	if (XGetWindowProperty(Clipboard->Display, Clipboard->Window, Clipboard->PropertyAtom, 0, MAX_ATOM, True, AnyPropertyType, Type, &Format, &ItemCount, &BytesAfter, &Value) != Success) return false;
+
+	BOOL Succeeded = false;
+	if (*Type != None)
+	{
+		SIZE_T ItemSize = Format == 8 ? 1 : Format == 16 ? sizeof(short) : sizeof(long);
+		SIZE_T Size = ItemCount * ItemSize;
+		*Data = (BYTE *)malloc(Size != 0 ? Size : 1);
+		if (*Data != nullptr)
+		{
+			memcpy(*Data, Value, Size);
+			*SizeCb = Size;
+			Succeeded = true;
+		}
+	}
+	if (Value != nullptr)
+	{
+		XFree(Value);
+	}
+	return Succeeded;
+}
+
+
+// Reads a large transfer (the INCR protocol): the owner puts the data into the property chunk by chunk, each time after
+// the previous chunk was deleted, and ends with an empty one.
+static BOOL ReadIncrementally(X11_CLIPBOARD *Clipboard, Atom *Type, BYTE **Data, SIZE_T *SizeCb)
+{
+	BYTE *Buffer = nullptr;
+	SIZE_T Size = 0;
+	SIZE_T Capacity = 0;
+	for (;;)
+	{
+		XEvent Event;
+		BYTE *Chunk;
+		SIZE_T ChunkSize;
+		if (!WaitForEvent(Clipboard, IsNewPropertyValue, &Event) || !ReadProperty(Clipboard, Type, &Chunk, &ChunkSize))
+		{
+			free(Buffer);
+			return false;
+		}
+		if (ChunkSize == 0)
+		{
+			free(Chunk);
+			break;
+		}
+		if (ChunkSize > Capacity - Size)
+		{
+			SIZE_T NewCapacity = Capacity != 0 ? Capacity * 2 : 64 * 1024;
+			while (NewCapacity - Size < ChunkSize) NewCapacity *= 2;
+			BYTE *NewBuffer = (BYTE *)realloc(Buffer, NewCapacity);
+			if (NewBuffer == nullptr)
+			{
+				free(Chunk);
+				free(Buffer);
+				return false;
+			}
+			Buffer = NewBuffer;
+			Capacity = NewCapacity;
+		}
+		memcpy(Buffer + Size, Chunk, ChunkSize);
+		Size += ChunkSize;
+		free(Chunk);
+	}
+	*Data = Buffer != nullptr ? Buffer : (BYTE *)malloc(1);
+	*SizeCb = Size;
+	return *Data != nullptr;
+}
+
+
+// Asks the owner of the selection for Target, and waits for it.
+static BOOL ConvertSelection(X11_CLIPBOARD *Clipboard, Atom Target, Atom *Type, BYTE **Data, SIZE_T *SizeCb)
+{
+	XDeleteProperty(Clipboard->Display, Clipboard->Window, Clipboard->PropertyAtom);
+	XConvertSelection(Clipboard->Display, Clipboard->Selection, Target, Clipboard->PropertyAtom, Clipboard->Window, CurrentTime);
+
+	// Answers to earlier requests that timed out may still arrive.
+	XEvent Event;
+	do
+	{
+		if (!WaitForEvent(Clipboard, IsSelectionNotify, &Event)) return false;
+	}
+	while (Event.xselection.target != Target);
+
+	// The owner refused.
+	if (Event.xselection.property == None) return false;
+
+	if (!ReadProperty(Clipboard, Type, Data, SizeCb)) return false;
+	if (*Type != Clipboard->IncrAtom) return true;
+	// Reading the property has deleted it, which starts the transfer.
+	free(*Data);
+	return ReadIncrementally(Clipboard, Type, Data, SizeCb);
+}
+
+
+static BOOL X11Open(void *Context)
+{
+	X11_CLIPBOARD *Clipboard = (X11_CLIPBOARD *)Context;
+	if (Clipboard->IsOpen) return false;
+
+	// Without an owner, the selection is simply empty.
+	Clipboard->FormatCount = 0;
+	if (XGetSelectionOwner(Clipboard->Display, Clipboard->Selection) != None)
+	{
+		Atom Type;
+		BYTE *Data;
+		SIZE_T SizeCb;
+		if (!ConvertSelection(Clipboard, Clipboard->TargetsAtom, &Type, &Data, &SizeCb)) return false;
+
+		const unsigned long *Targets = (const unsigned long *)Data;
+		SIZE_T TargetCount = Type == XA_ATOM ? SizeCb / sizeof(unsigned long) : 0;
+		UINT *Formats = (UINT *)realloc(Clipboard->Formats, (TargetCount + 2) * sizeof(UINT));
+		if (Formats == nullptr)
+		{
+			free(Data);
+			return false;
+		}
+		Clipboard->Formats = Formats;
+
+		BOOL HasUtf8String = false;
+		BOOL HasBmp = false;
+		for (SIZE_T i = 0; i < TargetCount; ++i)
+		{
+			if (Targets[i] == None || Targets[i] > MAX_ATOM) continue;
+			UINT Format = X11_CLIPBOARD_FORMAT_ATOM + (UINT)Targets[i];
+			UINT j = 0;
+			while (j < Clipboard->FormatCount && Formats[j] != Format) ++j;
+			if (j < Clipboard->FormatCount) continue;
+
+			Formats[Clipboard->FormatCount++] = Format;
+			HasUtf8String |= Targets[i] == Clipboard->Utf8StringAtom;
+			HasBmp |= Targets[i] == Clipboard->BmpAtom;
+		}
+		if (HasUtf8String)
+		{
+			Formats[Clipboard->FormatCount++] = CF_UNICODETEXT;
+		}
+		if (HasBmp)
+		{
+			Formats[Clipboard->FormatCount++] = CF_DIB;
+		}
+		free(Data);
+	}
+	Clipboard->IsOpen = true;
+	return true;
+}
+
+
+static void X11Close(void *Context)
+{
+	((X11_CLIPBOARD *)Context)->IsOpen = false;
+}
+
+
+static DWORD X11GetSequenceNumber(void *Context)
+{
+	return ((X11_CLIPBOARD *)Context)->SequenceNumber;
+}
+
+
+static UINT X11EnumFormats(void *Context, UINT Format)
+{
+	X11_CLIPBOARD *Clipboard = (X11_CLIPBOARD *)Context;
+	UINT i = 0;
+	if (Format != 0)
+	{
+		while (i < Clipboard->FormatCount && Clipboard->Formats[i] != Format) ++i;
+		++i;
+	}
+	return i < Clipboard->FormatCount ? Clipboard->Formats[i] : 0;
+}
+
+
+// Atom names are Latin-1.
+static BOOL CopyName(const char *Source, WCHAR *Name, UINT NameLength)
+{
+	if (NameLength == 0) return false;
+	UINT i = 0;
+	for (; i + 1 < NameLength && Source[i] != 0; ++i)
+	{
+		Name[i] = (BYTE)Source[i];
+	}
+	Name[i] = 0;
+	return true;
+}
+
+
+static BOOL X11GetFormatName(void *Context, UINT Format, WCHAR *Name, UINT NameLength)
+{
+	X11_CLIPBOARD *Clipboard = (X11_CLIPBOARD *)Context;
+	switch (Format)
+	{
+		case CF_UNICODETEXT: return CopyName("CF_UNICODETEXT", Name, NameLength);
+		case CF_DIB:         return CopyName("CF_DIB", Name, NameLength);
+	}
+	if (Format < X11_CLIPBOARD_FORMAT_ATOM) return false;
+
+	char *AtomName = XGetAtomName(Clipboard->Display, Format - X11_CLIPBOARD_FORMAT_ATOM);
+	if (AtomName == nullptr) return false;
+	BOOL Succeeded = CopyName(AtomName, Name, NameLength);
+	XFree(AtomName);
+	return Succeeded;
+}
+
+
+// Registered formats are targets like any other.
+static UINT X11RegisterFormat(void *Context, const char *Name)
+{
+	X11_CLIPBOARD *Clipboard = (X11_CLIPBOARD *)Context;
+	Atom Target = XInternAtom(Clipboard->Display, Name, False);
+	if (Target == None || Target > MAX_ATOM) return 0;
+	return X11_CLIPBOARD_FORMAT_ATOM + (UINT)Target;
+}
+
+
+// Decodes one UTF-8 sequence, and returns its length in bytes, or 0 if it is not valid.
+static SIZE_T DecodeUtf8(const BYTE *Text, SIZE_T Remaining, DWORD *CodePoint)
+{
+	BYTE Lead = Text[0];
+	SIZE_T Length;
+	DWORD Minimum;
+	if (Lead < 0x80)
+	{
+		*CodePoint = Lead;
+		return 1;
+	}
+	else if (Lead >= 0xC2 && Lead < 0xE0)
+	{
+		Length = 2;
+		Minimum = 0x80;
+		*CodePoint = Lead & 0x1F;
+	}
+	else if (Lead >= 0xE0 && Lead < 0xF0)
+	{
+		Length = 3;
+		Minimum = 0x800;
+		*CodePoint = Lead & 0x0F;
+	}
+	else if (Lead >= 0xF0 && Lead < 0xF5)
+	{
+		Length = 4;
+		Minimum = 0x10000;
+		*CodePoint = Lead & 0x07;
+	}
+	else
+	{
+		return 0;
+	}
+	if (Remaining < Length) return 0;
+	for (SIZE_T i = 1; i < Length; ++i)
+	{
+		if ((Text[i] & 0xC0) != 0x80) return 0;
+		*CodePoint = (*CodePoint << 6) | (Text[i] & 0x3F);
+	}
+	if (*CodePoint < Minimum || *CodePoint > 0x10FFFF || (*CodePoint >= 0xD800 && *CodePoint < 0xE000)) return 0;
+	return Length;
+}
+
+
+// Returns the text as UTF-16 with a terminating 0, like CF_UNICODETEXT. Invalid sequences become U+FFFD.
+static WCHAR *ConvertUtf8ToUtf16(const BYTE *Text, SIZE_T SizeCb, SIZE_T *LengthWithTerminator)
+{
+	// Never more UTF-16 code units than UTF-8 bytes.
+	WCHAR *Result = (WCHAR *)malloc((SizeCb + 1) * sizeof(WCHAR));
+	if (Result == nullptr) return nullptr;
+	SIZE_T Length = 0;
+	for (SIZE_T i = 0; i < SizeCb;)
+	{
+		DWORD CodePoint;
+		SIZE_T SequenceLength = DecodeUtf8(Text + i, SizeCb - i, &CodePoint);
+		if (SequenceLength == 0)
+		{
+			CodePoint = 0xFFFD;
+			SequenceLength = 1;
+		}
+		i += SequenceLength;
+		if (CodePoint >= 0x10000)
+		{
+			CodePoint -= 0x10000;
+			Result[Length++] = (WCHAR)(0xD800 + (CodePoint >> 10));
+			Result[Length++] = (WCHAR)(0xDC00 + (CodePoint & 0x3FF));
+		}
+		else
+		{
+			Result[Length++] = (WCHAR)CodePoint;
+		}
+	}
+	Result[Length++] = 0;
+	*LengthWithTerminator = Length;
+	return Result;
+}
+
+
+// Copies the payload of a format into a buffer allocated with malloc.
+static BOOL CopyData(X11_CLIPBOARD *Clipboard, UINT Format, BYTE **Data, SIZE_T *SizeCb)
+{
+	Atom Target;
+	if (Format == CF_UNICODETEXT)
+	{
+		Target = Clipboard->Utf8StringAtom;
+	}
+	else if (Format == CF_DIB)
+	{
+		Target = Clipboard->BmpAtom;
+	}
+	else if (Format >= X11_CLIPBOARD_FORMAT_ATOM)
+	{
+		Target = Format - X11_CLIPBOARD_FORMAT_ATOM;
+	}
+	else
+	{
+		return false;
+	}
+
+	Atom Type;
+	if (!ConvertSelection(Clipboard, Target, &Type, Data, SizeCb)) return false;
+
+	if (Format == CF_UNICODETEXT)
+	{
+		SIZE_T Length;
+		WCHAR *Text = ConvertUtf8ToUtf16(*Data, *SizeCb, &Length);
+		free(*Data);
+		if (Text == nullptr) return false;
+		*Data = (BYTE *)Text;
+		*SizeCb = Length * sizeof(WCHAR);
+	}
+	else if (Format == CF_DIB)
+	{
+		// A CF_DIB is a BMP file without its BITMAPFILEHEADER.
+		if (*SizeCb < BMP_FILE_HEADER_SIZE || (*Data)[0] != 'B' || (*Data)[1] != 'M')
+		{
+			free(*Data);
+			return false;
+		}
+		*SizeCb -= BMP_FILE_HEADER_SIZE;
+		memmove(*Data, *Data + BMP_FILE_HEADER_SIZE, *SizeCb);
+	}
+	return true;
+}
+
+
+// A selection has no memory to share; what the owner sends is always a copy.
+static const BYTE *X11LockData(void *Context, UINT Format, SIZE_T *SizeCb)
+{
+	BYTE *Data;
+	if (!CopyData((X11_CLIPBOARD *)Context, Format, &Data, SizeCb)) return nullptr;
+	return Data;
+}
+
+
+static void X11UnlockData(void *, UINT, const BYTE *Data)
+{
+	free((void *)Data);
+}
+
+
+// Starts watching the selection. DisplayName may be null for $DISPLAY. Fails if the display cannot be opened, or has
+// no XFixes.
+BOOL X11ClipboardConnect(X11_CLIPBOARD *Clipboard, const char *DisplayName, const char *SelectionName)
+{
+	memset(Clipboard, 0, sizeof(*Clipboard));
+	Clipboard->Display = XOpenDisplay(DisplayName);
+	if (Clipboard->Display == nullptr) return false;
+	XSetErrorHandler(IgnoreXError);
+
+	Display *XDisplay = Clipboard->Display;
+	int ErrorBase;
+	int Major = 1;
+	int Minor = 0;
+	if (!XFixesQueryExtension(XDisplay, &Clipboard->XFixesEventBase, &ErrorBase) || !XFixesQueryVersion(XDisplay, &Major, &Minor))
+	{
+		XCloseDisplay(XDisplay);
+		Clipboard->Display = nullptr;
+		return false;
+	}
+
+	Clipboard->Window = XCreateSimpleWindow(XDisplay, DefaultRootWindow(XDisplay), 0, 0, 1, 1, 0, 0, 0);
+	XSelectInput(XDisplay, Clipboard->Window, PropertyChangeMask);
+	Clipboard->Selection = XInternAtom(XDisplay, SelectionName, False);
+	Clipboard->TargetsAtom = XInternAtom(XDisplay, "TARGETS", False);
+	Clipboard->Utf8StringAtom = XInternAtom(XDisplay, "UTF8_STRING", False);
+	Clipboard->BmpAtom = XInternAtom(XDisplay, "image/bmp", False);
+	Clipboard->IncrAtom = XInternAtom(XDisplay, "INCR", False);
+	Clipboard->PropertyAtom = XInternAtom(XDisplay, "CLIPBOARD_MONITOR", False);
+	XFixesSelectSelectionInput(XDisplay, Clipboard->Window, Clipboard->Selection, XFixesSetSelectionOwnerNotifyMask | XFixesSelectionWindowDestroyNotifyMask | XFixesSelectionClientCloseNotifyMask);
+	XFlush(XDisplay);
+
+	Clipboard->SequenceNumber = 1;
+	// Whatever is in the selection already counts as a change.
+	Clipboard->Changed = true;
+	return true;
+}
+
+
+void X11ClipboardDisconnect(X11_CLIPBOARD *Clipboard)
+{
+	if (Clipboard->Display == nullptr) return;
+	free(Clipboard->Formats);
+	Clipboard->Formats = nullptr;
+	Clipboard->FormatCount = 0;
+	XDestroyWindow(Clipboard->Display, Clipboard->Window);
+	XCloseDisplay(Clipboard->Display);
+	Clipboard->Display = nullptr;
+}
+
+
+void X11ClipboardBackendInit(CLIPBOARD_BACKEND *Backend, X11_CLIPBOARD *Clipboard)
+{
+	Backend->Context = Clipboard;
+	Backend->Open = X11Open;
+	Backend->Close = X11Close;
+	Backend->GetSequenceNumber = X11GetSequenceNumber;
+	Backend->EnumFormats = X11EnumFormats;
+	Backend->GetFormatName = X11GetFormatName;
+	Backend->RegisterFormat = X11RegisterFormat;
+	Backend->LockData = X11LockData;
+	Backend->UnlockData = X11UnlockData;
+}
+
+
+// The connection to the X server. It becomes readable when events arrive.
+int X11ClipboardGetFd(X11_CLIPBOARD *Clipboard)
+{
+	return ConnectionNumber(Clipboard->Display);
+}
+
+
+// Handles all events that have arrived, and returns true if the selection has changed since the last call. Xlib may
+// already have read events from the fd (e.g. during CopyData), so this must be called before every wait on it.
+BOOL X11ClipboardHandleEvents(X11_CLIPBOARD *Clipboard)
+{
+	while (XPending(Clipboard->Display) > 0)
+	{
+		XEvent Event;
+		XNextEvent(Clipboard->Display, &Event);
+		HandleEvent(Clipboard, &Event);
+	}
+	BOOL Changed = Clipboard->Changed;
+	Clipboard->Changed = false;
+	return Changed;
+}
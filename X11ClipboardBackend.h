@@ -0,0 +1,54 @@
+#pragma once
+
+#include "Portable.h"
+
+struct CLIPBOARD_BACKEND;
+struct X11_CLIPBOARD;
+struct _XDisplay;
+
+// An X11 selection (CLIPBOARD by default, or e.g. PRIMARY) as a CLIPBOARD_BACKEND, for Linux.
+//
+// Changes of the selection owner are reported by the XFixes extension, so nothing is polled: X11ClipboardGetFd can be
+// waited on with poll(), and X11ClipboardHandleEvents then tells whether the selection has changed since the last
+// call. Each change also advances the sequence number.
+//
+// Unlike the Win32 clipboard, an X11 selection has no content of its own; every read is a request to the owner, which
+// answers with events. Open asks the owner for its list of targets, and LockData for one of them; both wait for the
+// answer for at most X11_CLIPBOARD_TIMEOUT_MS, and fail otherwise. Open fails like a busy clipboard if the owner does
+// not answer, so the acquirer retries it.
+//
+// Every target is enumerated as a format of its own, X11_CLIPBOARD_FORMAT_ATOM + its atom, and named after the atom.
+// UTF8_STRING is also offered as CF_UNICODETEXT (converted to UTF-16), and image/bmp as CF_DIB (without the file
+// header), after all targets, like the Win32 clipboard enumerates its synthesized formats.
+
+#define X11_CLIPBOARD_FORMAT_ATOM 0x40000000
+#define X11_CLIPBOARD_TIMEOUT_MS 1000
+
+extern BOOL                X11ClipboardConnect(X11_CLIPBOARD *Clipboard, const char *DisplayName, const char *SelectionName);
+extern void                X11ClipboardDisconnect(X11_CLIPBOARD *Clipboard);
+extern void                X11ClipboardBackendInit(CLIPBOARD_BACKEND *Backend, X11_CLIPBOARD *Clipboard);
+extern int                 X11ClipboardGetFd(X11_CLIPBOARD *Clipboard);
+extern BOOL                X11ClipboardHandleEvents(X11_CLIPBOARD *Clipboard);
+
+// Atoms and windows are Xlib's Atom and Window.
+struct X11_CLIPBOARD
+{
+	_XDisplay *Display;
+	unsigned long Window;      // Unmapped; receives the selection transfers.
+	int XFixesEventBase;
+
+	unsigned long Selection;
+	unsigned long TargetsAtom;
+	unsigned long Utf8StringAtom;
+	unsigned long BmpAtom;
+	unsigned long IncrAtom;
+	unsigned long PropertyAtom; // Of Window, where the owner puts the data.
+
+	DWORD SequenceNumber;
+	BOOL Changed;              // Since the last X11ClipboardHandleEvents.
+
+	// The formats of the open selection, in the order of EnumFormats.
+	BOOL IsOpen;
+	UINT *Formats;
+	UINT FormatCount;
+};